@@ -0,0 +1,141 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "fota_image.h"
+
+/*
+ * Bytes transferred and decode speed of firmware updates, fota_image.h, on
+ * real build outputs: each update made by tools/fota_pack.py is downloaded in
+ * TCP segments through the decoder into a flash stand-in, rebuilt against the
+ * running image and checked against the plain one. The Makefile packs the
+ * host tracker rebuilt with a changed constant and with a feature switched,
+ * stripped as an ESP32 .bin; x86 code and the host zlib, the ESP32 ROM tinfl
+ * is several times slower.
+ *   make -C host bench
+ *   host/build/bench_fota_image base.bin image.bin update...
+ */
+
+#define SEGMENT         1436            // TCP MSS
+#define MIN_NS          200000000ull    // Per update, repeated until then
+
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+} blob_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+    size_t   size;
+} flash_t;
+
+static blob_t base;
+static flash_t flash;
+static fota_image_t img;
+
+
+static bool load(const char *path, blob_t *blob) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    blob->len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    blob->data = malloc(blob->len + 1);
+    bool ok = blob->data && fread(blob->data, 1, blob->len, f) == blob->len;
+    fclose(f);
+    return ok;
+}
+
+static int flash_begin(void *ctx, int64_t image_len) {
+    flash.len = 0;
+    return 0;
+}
+
+static int flash_write(void *ctx, const uint8_t *data, size_t len) {
+    if (len > flash.size - flash.len) {
+        return -1;
+    }
+    memcpy(&flash.data[flash.len], data, len);
+    flash.len += len;
+    return 0;
+}
+
+static const fota_sink_t flash_sink = { flash_begin, flash_write, NULL, NULL };
+
+static int base_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    if (offset > base.len || len > base.len - offset) {
+        return -1;
+    }
+    memcpy(buf, &base.data[offset], len);
+    return 0;
+}
+
+/*
+ * One download of the update
+ */
+static fota_err_t decode(const blob_t *update) {
+    const fota_base_t running = { base_read, NULL, (uint32_t)base.len };
+    fota_sink_t sink;
+
+    fota_image_init(&img, &flash_sink, &running);
+    fota_image_sink(&img, &sink);
+    sink.begin(sink.ctx, update->len);
+    for (size_t ofs = 0; ofs < update->len; ofs += SEGMENT) {
+        size_t n = update->len - ofs < SEGMENT ? update->len - ofs : SEGMENT;
+        if (sink.write(sink.ctx, &update->data[ofs], n)) {
+            break;
+        }
+    }
+    return fota_image_finish(&img);
+}
+
+int main(int argc, char **argv) {
+    blob_t image, update;
+    uint8_t sha256[FOTA_SHA256_LEN];
+    mbedtls_sha256_context sha;
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s base.bin image.bin update...\n", argv[0]);
+        return 2;
+    }
+    if (!load(argv[1], &base) || !load(argv[2], &image)) {
+        fprintf(stderr, "%s, %s: cannot read\n", argv[1], argv[2]);
+        return 2;
+    }
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, image.data, image.len);
+    mbedtls_sha256_finish(&sha, sha256);
+    flash.size = image.len + FOTA_IMAGE_OUT_SIZE;
+    flash.data = malloc(flash.size);
+
+    printf("Image %s, %zu bytes, running %s, %zu bytes, decoder %zu bytes + %u KB dictionary when compressed\n",
+           argv[2], image.len, argv[1], base.len, sizeof(fota_image_t), TINFL_LZ_DICT_SIZE / 1024);
+    for (int i = 2; i < argc; i++) {
+        if (!load(argv[i], &update)) {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            return 2;
+        }
+        uint32_t runs = 0;
+        fota_err_t err = FOTA_OK;
+        uint64_t start = host_time_ns(), ns;
+        do {
+            err = decode(&update);
+            runs++;
+            ns = host_time_ns() - start;
+        } while (err == FOTA_OK && ns < MIN_NS);
+        if (err != FOTA_OK || flash.len != image.len || memcmp(img.sha256, sha256, FOTA_SHA256_LEN) != 0) {
+            printf("%s: not the image, %s\n", argv[i], fota_err_name(err));
+            return 1;
+        }
+        double s = ns / 1e9 / runs;
+        static const char *const kinds[] = { "plain", "deflate", "delta", "delta, deflate" };
+        printf("  %-28s %8zu bytes, %5.1f%% of the image, %-14s decoded at %6.1f MB/s, %.2f ms\n", argv[i],
+               update.len, 100.0 * update.len / image.len, kinds[img.flags & 3], image.len / s / 1e6, s * 1e3);
+        free(update.data);
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "host.h"
+#include "fota_pipe.h"
+
+/*
+ * Wall time of a firmware update with simulated network and flash: the
+ * receive loop writing to flash in turn, as before the writer task, against
+ * the pipe of main/fota.c. The network delivers at a given rate while the
+ * unread bytes stay within the TCP window, the flash erases each sector just
+ * ahead of the data as fota_ota_write() does. A window holding more than a
+ * sector already hides the flash stalls of the loop in turn, a smaller one
+ * does not.
+ *   make -C host bench
+ */
+
+#define IMAGE_LEN       (64 * 1024)
+#define BUFFERS         4               // FOTA_BUFFER_COUNT
+#define BUFFER_SIZE     4096            // FOTA_BUFFER_SIZE
+#define SECTOR_SIZE     4096
+#define WRITE_US_PER_KB 2000
+#define TCP_MSS         1436
+
+typedef struct {
+    double   rate;                      // Bytes per ns
+    double   arrived;
+    size_t   consumed;
+    uint64_t last_ns;
+} net_t;
+
+typedef struct {
+    size_t   len;
+    size_t   erased;
+    uint32_t erases;
+} flash_t;
+
+typedef struct {
+    uint32_t erase_ms;                  // Per sector
+    uint32_t window;                    // TCP receive window, 5744 by default in the IDF
+} profile_t;
+
+static profile_t profile;
+static uint8_t image[IMAGE_LEN];
+static uint8_t written[IMAGE_LEN];
+static uint8_t pool[BUFFERS * BUFFER_SIZE];
+static flash_t flash;
+static net_t net;
+
+
+static void sleep_ns(uint64_t ns) {
+    struct timespec ts = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+}
+
+/*
+ * Bytes sent since the last call, the sender stops while the window is full
+ */
+static void net_update(void) {
+    uint64_t now = host_time_ns();
+    double flow = net.rate * (now - net.last_ns);
+    double room = profile.window - (net.arrived - net.consumed);
+    net.arrived += flow < room ? flow : room;
+    if (net.arrived > IMAGE_LEN) {
+        net.arrived = IMAGE_LEN;
+    }
+    net.last_ns = now;
+}
+
+/*
+ * recv(): waits for a segment when nothing is there
+ */
+static size_t net_recv(uint8_t *buf, size_t room) {
+    net_update();
+    while (net.arrived - net.consumed < 1.0 && net.consumed < IMAGE_LEN) {
+        size_t want = IMAGE_LEN - net.consumed < TCP_MSS ? IMAGE_LEN - net.consumed : TCP_MSS;
+        sleep_ns((uint64_t)((want - (net.arrived - net.consumed)) / net.rate) + 1);
+        net_update();
+    }
+    size_t n = (size_t)(net.arrived - net.consumed);
+    if (n > room) {
+        n = room;
+    }
+    memcpy(buf, &image[net.consumed], n);
+    net.consumed += n;
+    return n;
+}
+
+static int flash_begin(void *ctx, int64_t image_len) {
+    flash.len = 0;
+    flash.erased = SECTOR_SIZE;
+    flash.erases = 1;
+    sleep_ns(profile.erase_ms * 1000000ull);
+    return 0;
+}
+
+static int flash_write(void *ctx, const uint8_t *data, size_t len) {
+    size_t end = flash.len + len;
+    while (end > flash.erased) {
+        flash.erased += SECTOR_SIZE;
+        flash.erases++;
+        sleep_ns(profile.erase_ms * 1000000ull);
+    }
+    sleep_ns(len * WRITE_US_PER_KB * 1000ull / 1024);
+    memcpy(&written[flash.len], data, len);
+    flash.len = end;
+    return 0;
+}
+
+static const fota_sink_t flash_sink = { flash_begin, flash_write, NULL, NULL };
+
+/*
+ * The receive loop of fota_download()
+ * return: seconds from the request to the last byte flashed
+ */
+static double update(uint32_t kb_per_s, bool pipelined, uint32_t *stalls) {
+    static uint8_t buf[BUFFER_SIZE];
+    fota_sink_t sink = flash_sink;
+    fota_pipe_t pipe;
+
+    memset(&net, 0, sizeof(net));
+    net.rate = kb_per_s * 1024.0 / 1e9;
+    memset(written, 0, sizeof(written));
+    uint64_t start = host_time_ns();
+    net.last_ns = start;
+    if (pipelined) {
+        fota_pipe_start(&pipe, pool, BUFFERS, BUFFER_SIZE, &flash_sink, 5);
+        fota_pipe_sink(&pipe, &sink);
+    }
+    sink.begin(sink.ctx, IMAGE_LEN);
+    while (net.consumed < IMAGE_LEN) {
+        size_t room = sizeof(buf);
+        uint8_t *data = sink.buffer ? sink.buffer(sink.ctx, &room) : buf;
+        size_t n = net_recv(data, room);
+        sink.write(sink.ctx, data, n);
+    }
+    *stalls = 0;
+    if (pipelined) {
+        fota_pipe_finish(&pipe);
+        *stalls = pipe.stalls;
+    }
+    double seconds = (host_time_ns() - start) / 1e9;
+    if (flash.len != IMAGE_LEN || memcmp(written, image, IMAGE_LEN) != 0) {
+        printf("Image corrupted\n");
+        exit(1);
+    }
+    return seconds;
+}
+
+int main(void) {
+    static const profile_t profiles[] = { { 25, 5744 }, { 100, 5744 }, { 25, 1436 } };
+    static const uint32_t rates[] = { 64, 128, 512 };
+    uint32_t stalls;
+
+    for (size_t i = 0; i < sizeof(image); i++) {
+        image[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+    for (size_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        profile = profiles[p];
+        double flash_s = (IMAGE_LEN / SECTOR_SIZE * profile.erase_ms * 1000.0 + IMAGE_LEN / 1024 * WRITE_US_PER_KB) / 1e6;
+        printf("Firmware update of %u KB, flash %u ms per sector erase and %u ms per KB written, %.2f s in all, "
+               "%u B TCP window\n", IMAGE_LEN / 1024, profile.erase_ms, WRITE_US_PER_KB / 1000, flash_s,
+               profile.window);
+        for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            double net_s = IMAGE_LEN / 1024.0 / rates[r];
+            double in_turn = update(rates[r], false, &stalls);
+            double pipelined = update(rates[r], true, &stalls);
+            printf("  network %3u KB/s, %.2f s: in turn %5.2f s, pipelined %5.2f s, %+5.1f%%, "
+                   "reader waited %3u times for the flash\n", rates[r], net_s, in_turn, pipelined,
+                   100.0 * (pipelined / in_turn - 1.0), stalls);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "adv_json.h"
+#include "adv_frame.h"
+#include "adv_parse.h"
+
+/*
+ * Adverts/s of the JSON serializer against the sprintf() of the original GAP
+ * callback, and of the binary frames with their reference decoder, on the same
+ * scan results
+ *   make -C host bench
+ */
+
+#define SAMPLES         4
+#define ROUNDS          500000
+#define ESP_NAME        "ESP32_Name_42"
+
+static adv_record_t samples[SAMPLES];
+static char out[ADV_JSON_MAX_LEN];
+static uint8_t frame[ADV_FRAME_MAX_LEN];
+static volatile size_t sink;
+
+
+static void sample(adv_record_t *rec, uint8_t device, const uint8_t *data, uint8_t len) {
+    memset(rec, 0, sizeof(*rec));
+    rec->bda[0] = 0xC0;
+    rec->bda[5] = device;
+    rec->rssi = -67;
+    rec->dev_type = 1;
+    rec->adv_data_len = len;
+    memcpy(rec->data, data, len);
+}
+
+static void init_samples(void) {
+    static const uint8_t ibeacon[] = {
+        0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15,
+        0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2, 0xB0, 0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0,
+        0x00, 0x01, 0x00, 0x2A, 0xC5,
+    };
+    static const uint8_t uid[] = {
+        0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE, 0x17, 0x16, 0xAA, 0xFE, 0x00, 0xEE,
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x00, 0x00,
+    };
+    static const uint8_t url[] = {
+        0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE, 0x0F, 0x16, 0xAA, 0xFE, 0x10, 0xEE, 0x03,
+        'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x07,
+    };
+    static const uint8_t named[] = {
+        0x02, 0x01, 0x06, 0x0B, 0x09, 'T', 'a', 'g', ' ', 'K', 'i', 't', 'c', 'h', 'e', 0x02, 0x0A, 0x04,
+    };
+
+    sample(&samples[0], 1, ibeacon, sizeof(ibeacon));
+    sample(&samples[1], 2, uid, sizeof(uid));
+    sample(&samples[2], 3, url, sizeof(url));
+    sample(&samples[3], 4, named, sizeof(named));
+}
+
+/*
+ * The payload of the original esp_gap_cb(): complete name looked up apart,
+ * fixed offsets, the 30 byte advert hack and every number as a string
+ */
+static int sprintf_encode(const adv_record_t *rec, const char *esp_name, char *payload) {
+    const uint8_t *ble_adv = rec->data;
+    const uint8_t *adv_name = NULL;
+    uint8_t adv_name_len = 0;
+    char name[255];
+    int alt = 0;
+    adv_iter_t it;
+    adv_field_t field;
+
+    // esp_ble_resolve_adv_data(ESP_BLE_AD_TYPE_NAME_CMPL)
+    adv_iter_init(&it, rec->data, rec->adv_data_len);
+    while (adv_iter_next(&it, &field)) {
+        if (field.type == ADV_TYPE_NAME_CMPL) {
+            adv_name = field.data;
+            adv_name_len = field.len;
+            break;
+        }
+    }
+    if (adv_name_len == 0) {
+        name[0] = '\0';
+    } else {
+        name[adv_name_len] = '\0';
+        memcpy(name, (const char *)adv_name, adv_name_len);
+    }
+    if (rec->adv_data_len == 30) {
+        alt = 3;
+    }
+    return sprintf(payload, "{\"EspName\":\"%s\",\"Name\":\"%s\",\"NameLen\":\"%d\",\"RSSI\":\"%d\",\"Length\":\"%d\",\"Type\":\"%02X\",\"ManufacturerID\":\"%02X%02X\",\"Subtype\":\"%02X\",\"SubLength\":\"%02X\",\"UUID\":\"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X\",\"Major\":\"%02X%02X\",\"Minor\":\"%02X%02X\",\"bda\":\"%02X%02X%02X%02X%02X%02X\",\"DeviceType\":\"%d\",\"AdvDataLen\":\"%d\"}",
+                   esp_name, name, adv_name_len, rec->rssi,
+                   ble_adv[0+alt], ble_adv[1+alt], ble_adv[2+alt], ble_adv[3+alt], ble_adv[4+alt],
+                   ble_adv[5+alt], ble_adv[6+alt], ble_adv[7+alt], ble_adv[8+alt], ble_adv[9+alt],
+                   ble_adv[10+alt], ble_adv[11+alt], ble_adv[12+alt], ble_adv[13+alt], ble_adv[14+alt],
+                   ble_adv[15+alt], ble_adv[16+alt], ble_adv[17+alt], ble_adv[18+alt], ble_adv[19+alt],
+                   ble_adv[20+alt], ble_adv[21+alt], ble_adv[22+alt], ble_adv[23+alt], ble_adv[24+alt],
+                   ble_adv[25+alt],
+                   rec->bda[0], rec->bda[1], rec->bda[2], rec->bda[3], rec->bda[4], rec->bda[5],
+                   rec->dev_type, rec->adv_data_len);
+}
+
+int main(void) {
+    static char payload[512];
+    size_t json_bytes = 0, sprintf_bytes = 0, frame_bytes = 0;
+    adv_record_t decoded;
+
+    init_samples();
+    for (int i = 0; i < SAMPLES; i++) {
+        int len = adv_json_encode(&samples[i], NULL, ESP_NAME, out, sizeof(out));
+        if (len < 0) {
+            fprintf(stderr, "adv_json_encode failed on sample %d\n", i);
+            return 1;
+        }
+        json_bytes += len;
+        sprintf_bytes += sprintf_encode(&samples[i], ESP_NAME, payload);
+        frame_bytes += adv_frame_encode(&samples[i], NULL, frame, sizeof(frame));
+    }
+
+    uint64_t start = host_time_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        sink += adv_json_encode(&samples[r % SAMPLES], NULL, ESP_NAME, out, sizeof(out));
+    }
+    double json_s = (host_time_ns() - start) / 1e9;
+
+    start = host_time_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        sink += sprintf_encode(&samples[r % SAMPLES], ESP_NAME, payload);
+    }
+    double sprintf_s = (host_time_ns() - start) / 1e9;
+
+    start = host_time_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        sink += adv_frame_encode(&samples[r % SAMPLES], NULL, frame, sizeof(frame));
+    }
+    double frame_s = (host_time_ns() - start) / 1e9;
+
+    start = host_time_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        int len = adv_frame_encode(&samples[r % SAMPLES], NULL, frame, sizeof(frame));
+        sink += adv_frame_decode(frame, len, &decoded, NULL);
+    }
+    double round_trip_s = (host_time_ns() - start) / 1e9;
+    for (int i = 0; i < SAMPLES; i++) {
+        int len = adv_frame_encode(&samples[i], NULL, frame, sizeof(frame));
+        if (adv_frame_decode(frame, len, &decoded, NULL) != len ||
+            memcmp(decoded.data, samples[i].data, ADV_RECORD_DATA_MAX) != 0) {
+            fprintf(stderr, "adv_frame_decode failed on sample %d\n", i);
+            return 1;
+        }
+    }
+
+    printf("Encoding of %d adverts, iBeacon, Eddystone UID and URL, named\n", ROUNDS);
+    printf("adv_json_encode: %8.2f M adverts/s, %3zu bytes per advert\n", ROUNDS / json_s / 1e6,
+           json_bytes / SAMPLES);
+    printf("sprintf:         %8.2f M adverts/s, %3zu bytes per advert\n", ROUNDS / sprintf_s / 1e6,
+           sprintf_bytes / SAMPLES);
+    printf("adv_frame_encode:%8.2f M adverts/s, %3zu bytes per advert\n", ROUNDS / frame_s / 1e6,
+           frame_bytes / SAMPLES);
+    printf("  with decode:   %8.2f M adverts/s\n", ROUNDS / round_trip_s / 1e6);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "adv_parse.h"
+
+/*
+ * Single pass decode of the AD structures, adv_parse.h: adverts/s per
+ * payload type, with a scan response, and of the model fingerprint
+ *   make -C host bench
+ */
+
+#define ROUNDS          10000000
+
+typedef struct {
+    const char    *name;
+    const uint8_t *data;
+    uint8_t        len;
+    uint8_t        rsp_len;
+} sample_t;
+
+static const uint8_t ibeacon[] = {
+    0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15,
+    0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2, 0xB0, 0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0,
+    0x12, 0x34, 0x56, 0x78, 0xC5,
+};
+static const uint8_t eddystone_uid[] = {
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE, 0x15, 0x16, 0xAA, 0xFE, 0x00, 0xEE,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15,
+};
+static const uint8_t eddystone_tlm[] = {
+    0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE,
+    0x11, 0x16, 0xAA, 0xFE, 0x20, 0x00, 0x0B, 0xB8, 0x17, 0x80, 0x00, 0x01, 0x02, 0x03, 0x00, 0x00, 0x10, 0x00,
+};
+static const uint8_t altbeacon[] = {
+    0x02, 0x01, 0x06, 0x1B, 0xFF, 0x18, 0x01, 0xBE, 0xAC,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13,
+    0xBB, 0x42,
+};
+// Advert and scan response of a sensor tag
+static const uint8_t named[] = {
+    0x02, 0x01, 0x06, 0x05, 0x03, 0x0F, 0x18, 0x1A, 0x18, 0x03, 0x19, 0x40, 0x05,
+    0x0E, 0x09, 'T', 'a', 'g', ' ', 'K', 'i', 't', 'c', 'h', 'e', 'n', ' ', '2', 0x02, 0x0A, 0x04,
+    0x09, 0xFF, 0x59, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+};
+
+static const sample_t samples[] = {
+    { "iBeacon",      ibeacon,       sizeof(ibeacon),       0 },
+    { "EddystoneUID", eddystone_uid, sizeof(eddystone_uid), 0 },
+    { "EddystoneTLM", eddystone_tlm, sizeof(eddystone_tlm), 0 },
+    { "AltBeacon",    altbeacon,     sizeof(altbeacon),     0 },
+    { "named",        named,         31,                    sizeof(named) - 31 },
+};
+
+static volatile uint32_t sink;
+
+
+int main(void) {
+    adv_record_t rec;
+    adv_info_t info;
+
+    printf("AD structure decode, %d adverts per payload type\n", ROUNDS);
+    for (size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        memset(&rec, 0, sizeof(rec));
+        memcpy(rec.data, samples[s].data, samples[s].len + samples[s].rsp_len);
+        rec.adv_data_len = samples[s].len;
+        rec.scan_rsp_len = samples[s].rsp_len;
+
+        uint64_t start = host_time_ns();
+        for (uint32_t r = 0; r < ROUNDS; r++) {
+            // Changing data, as the callback sees it
+            rec.data[rec.adv_data_len - 1] = (uint8_t)r;
+            adv_parse(&rec, &info);
+            sink += info.beacon;
+        }
+        double parse_ns = (double)(host_time_ns() - start) / ROUNDS;
+
+        start = host_time_ns();
+        for (uint32_t r = 0; r < ROUNDS; r++) {
+            rec.data[rec.adv_data_len - 1] = (uint8_t)r;
+            sink += adv_fingerprint(rec.data, rec.adv_data_len + rec.scan_rsp_len);
+        }
+        double fingerprint_ns = (double)(host_time_ns() - start) / ROUNDS;
+
+        adv_parse(&rec, &info);
+        printf("%-13s %2u+%2u bytes: adv_parse %5.1f ns, %6.1f M adverts/s, adv_fingerprint %5.1f ns, %s\n",
+               samples[s].name, rec.adv_data_len, rec.scan_rsp_len, parse_ns, 1e3 / parse_ns, fingerprint_ns,
+               adv_beacon_name(info.beacon) ? adv_beacon_name(info.beacon) : "no beacon");
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "adv_presence.h"
+
+/*
+ * Cost of one device registry update, adv_presence.h, at 10k to 40k devices
+ * advertising once a second, a tenth of them replaced every minute, with the
+ * expiry and heartbeats of main.c: ns per advert, memory per device and the
+ * events published against one message per advert
+ *   make -C host bench
+ */
+
+#define SLOTS           32768
+#define SECONDS         600
+#define LEAVE_MS        90000           // CONFIG_TRACKER_PRESENCE_LEAVE_S
+#define HEARTBEAT_MS    300000          // CONFIG_TRACKER_PRESENCE_HEARTBEAT_S
+
+static const adv_presence_params_t params = {
+    .enter_count = 2,
+    .enter_rssi  = -90,
+    .leave_rssi  = -95,
+    .leave_ms    = LEAVE_MS,
+};
+
+static adv_presence_entry_t entries[SLOTS];
+static adv_presence_t presence;
+static uint32_t events[3];
+static volatile uint32_t sink;
+
+
+static uint32_t rand_next(uint32_t *state) {
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+static void on_event(const adv_presence_report_t *report, void *ctx) {
+    events[report->event]++;
+    sink += report->rssi;
+}
+
+static void bench(uint32_t devices) {
+    uint32_t state = devices, updates = devices * SECONDS;
+    adv_record_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    memset(events, 0, sizeof(events));
+    rec.bda[0] = 0xC0;
+    adv_presence_init(&presence, entries, SLOTS, &params, on_event, NULL);
+
+    uint64_t start = host_time_ns();
+    uint32_t expired_ms = 0, heartbeat_ms = 0;
+    for (uint32_t i = 0; i < updates; i++) {
+        uint32_t r = rand_next(&state);
+        uint32_t time_ms = (uint32_t)((uint64_t)i * 1000 / devices);
+        uint32_t device = r % devices + time_ms / 60000 * (devices / 10);
+        rec.bda[3] = (uint8_t)(device >> 16);
+        rec.bda[4] = (uint8_t)(device >> 8);
+        rec.bda[5] = (uint8_t)device;
+        rec.time_ms = time_ms;
+        rec.rssi = (int8_t)(-60 - (r >> 16) % 40);
+        adv_presence_update(&presence, &rec);
+        if (time_ms - expired_ms >= 1000) {
+            expired_ms = time_ms;
+            adv_presence_expire(&presence, time_ms);
+        }
+        if (time_ms - heartbeat_ms >= HEARTBEAT_MS) {
+            heartbeat_ms = time_ms;
+            adv_presence_heartbeat_start(&presence);
+            while (adv_presence_heartbeat_step(&presence)) {
+            }
+        }
+    }
+    uint64_t update_ns = host_time_ns() - start;
+
+    uint32_t total = events[ADV_PRESENCE_ENTER] + events[ADV_PRESENCE_LEAVE] + events[ADV_PRESENCE_HERE];
+    printf("%5u devices in %u slots: %5.1f ns per advert, %5u present, %5u evicted, "
+           "%u enter %u leave %u here, %.4f events per advert\n", devices, SLOTS, (double)update_ns / updates,
+           presence.present, presence.evicted, events[ADV_PRESENCE_ENTER], events[ADV_PRESENCE_LEAVE],
+           events[ADV_PRESENCE_HERE], (double)total / updates);
+}
+
+int main(void) {
+    printf("Device registry, %zu bytes per slot, %.1f per usable slot, %zu KB in all\n",
+           sizeof(adv_presence_entry_t), sizeof(adv_presence_entry_t) * 4.0 / 3.0, sizeof(entries) / 1024);
+    bench(10000);
+    bench(20000);
+    bench(40000);
+    return 0;
+}
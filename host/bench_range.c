@@ -0,0 +1,70 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "adv_range.h"
+
+/*
+ * Cost of one distance estimate update, adv_range.h, with the devices in the
+ * table and with more devices than slots, evicting at every new one
+ *   make -C host bench
+ */
+
+#define SLOTS           1024            // CONFIG_TRACKER_RANGE_DEVICES
+#define UPDATES         10000000
+
+static const adv_range_params_t params = {
+    .process_noise      = 1.0f,
+    .measurement_noise  = 16.0f,
+    .path_loss          = 2.0f,
+    .ref_power          = -59,
+    .threshold_cm       = 50,
+};
+
+static adv_range_entry_t entries[SLOTS];
+static adv_range_t range;
+static volatile uint32_t sink;
+
+
+static uint32_t rand_next(uint32_t *state) {
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+static void bench(uint32_t devices) {
+    uint32_t state = devices;
+    adv_range_estimate_t est;
+    adv_record_t rec;
+    adv_info_t info;
+    uint32_t reports = 0;
+
+    memset(&rec, 0, sizeof(rec));
+    memset(&info, 0, sizeof(info));
+    info.beacon = ADV_BEACON_IBEACON;
+    info.u.ibeacon.measured_power = -59;
+    rec.bda[0] = 0xC0;
+    adv_range_init(&range, entries, SLOTS, &params);
+
+    uint64_t start = host_time_ns();
+    for (uint32_t i = 0; i < UPDATES; i++) {
+        uint32_t r = rand_next(&state);
+        uint32_t device = r % devices;
+        rec.bda[4] = (uint8_t)(device >> 8);
+        rec.bda[5] = (uint8_t)device;
+        rec.time_ms = i / 10;
+        rec.rssi = (int8_t)(-60 - (r >> 16) % 30);
+        reports += adv_range_update(&range, &rec, &info, &est);
+    }
+    double ns = (double)(host_time_ns() - start) / UPDATES;
+    sink += reports;
+    printf("%5u devices in %u slots: %5.1f ns per update, %5.1f%% reported, %u evicted\n", devices, SLOTS, ns,
+           100.0 * reports / UPDATES, range.evicted);
+}
+
+int main(void) {
+    printf("Distance estimator, %zu bytes per device\n", sizeof(adv_range_entry_t));
+    bench(100);
+    bench(700);
+    bench(5000);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "adv_ring.h"
+
+/*
+ * Cost of the advert ring per record: pushes into a ring with room and taken
+ * one or a batch at a time, then pushes into a full ring under each overflow
+ * policy, the path of the GAP callback when the publisher falls behind
+ *   make -C host bench
+ */
+
+#define SLOTS           256
+#define BATCH           16
+#define RECORDS         20000000
+#define DEVICES         64
+
+static adv_ring_slot_t slots[SLOTS];
+static adv_ring_t ring;
+static adv_record_t recs[BATCH];
+static volatile uint32_t sink;
+
+
+static void record_make(adv_record_t *rec, uint32_t n) {
+    memset(rec, 0, sizeof(*rec));
+    rec->bda[0] = n % DEVICES;
+    rec->time_ms = n;
+    rec->rssi = -70;
+    rec->adv_data_len = 30;
+    memset(rec->data, (int)(n & 0xFF), 30);
+}
+
+/*
+ * batch: records taken at a time, 1 with adv_ring_pop()
+ * return: ns per record pushed and taken
+ */
+static double bench_handoff(uint32_t batch) {
+    adv_record_t rec;
+
+    adv_ring_init(&ring, slots, SLOTS, ADV_RING_DROP_NEWEST);
+    record_make(&rec, 0);
+    uint64_t start = host_time_ns();
+    for (uint32_t n = 0; n < RECORDS; n += batch) {
+        for (uint32_t i = 0; i < batch; i++) {
+            rec.time_ms = n + i;
+            adv_ring_push(&ring, &rec);
+        }
+        sink += batch == 1 ? adv_ring_pop(&ring, recs) : adv_ring_pop_batch(&ring, recs, batch);
+    }
+    return (double)(host_time_ns() - start) / RECORDS;
+}
+
+/*
+ * return: ns per record pushed into the full ring
+ */
+static double bench_full(adv_ring_policy_t policy, adv_ring_stats_t *stats) {
+    adv_record_t rec;
+
+    adv_ring_init(&ring, slots, SLOTS, policy);
+    for (uint32_t n = 0; n < SLOTS; n++) {
+        record_make(&rec, n);
+        adv_ring_push(&ring, &rec);
+    }
+    uint64_t start = host_time_ns();
+    for (uint32_t n = SLOTS; n < SLOTS + RECORDS; n++) {
+        rec.bda[0] = n % DEVICES;
+        rec.time_ms = n;
+        sink += adv_ring_push(&ring, &rec);
+    }
+    double ns = (double)(host_time_ns() - start) / RECORDS;
+    adv_ring_get_stats(&ring, stats);
+    return ns;
+}
+
+int main(void) {
+    static const struct {
+        adv_ring_policy_t policy;
+        const char       *name;
+    } policies[] = {
+        { ADV_RING_DROP_NEWEST, "drop-newest" },
+        { ADV_RING_DROP_OLDEST, "drop-oldest" },
+        { ADV_RING_COALESCE,    "coalesce" },
+    };
+    adv_ring_stats_t stats;
+
+    printf("Ring of %d slots, %zu byte records, %d records per run\n", SLOTS, sizeof(adv_ring_slot_t), RECORDS);
+    double ns = bench_handoff(1);
+    printf("push, pop:          %6.1f ns per record, %6.1f M records/s\n", ns, 1e3 / ns);
+    ns = bench_handoff(BATCH);
+    printf("push, pop batch %2d: %6.1f ns per record, %6.1f M records/s\n", BATCH, ns, 1e3 / ns);
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        ns = bench_full(policies[i].policy, &stats);
+        printf("full, %-12s %6.1f ns per push,   %u dropped newest %u oldest, %u coalesced\n", policies[i].name, ns,
+               stats.dropped_newest, stats.dropped_oldest, stats.coalesced);
+    }
+    return 0;
+}
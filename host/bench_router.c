@@ -0,0 +1,152 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "topic_router.h"
+
+/*
+ * Match cost of the topic router against a linear scan of the filters, with
+ * per device and per group command routes
+ *   make -C host bench
+ */
+
+#define DEVICES         400
+#define GROUPS          40
+#define COMMANDS        4               // Command topics per device and group
+#define ROUTES          ((DEVICES + GROUPS) * COMMANDS + COMMANDS)
+#define NODES           4096
+#define TOPICS          1024
+#define ROUNDS          200
+
+static const char *commands[COMMANDS] = { "scan", "filter", "stats_request", "fota" };
+
+static char filters[ROUTES][48];
+static topic_route_t routes[ROUTES];
+static topic_node_t nodes[NODES];
+static uint16_t edges[2 * NODES];
+static topic_router_t router;
+static char topics[TOPICS][48];
+static volatile unsigned int called;
+
+
+static void route_hit(const char *topic, size_t topic_len, const char *data, size_t len, void *ctx) {
+    called++;
+}
+
+/*
+ * MQTT filter match on a NUL terminated topic, the usual loop over the table
+ */
+static bool filter_match(const char *filter, const char *topic) {
+    while (*filter) {
+        if (filter[0] == '#') {
+            return true;
+        }
+        if (filter[0] == '+') {
+            while (*topic && *topic != '/') {
+                topic++;
+            }
+            filter++;
+        } else {
+            while (*filter && *filter != '/') {
+                if (*filter++ != *topic++) {
+                    return false;
+                }
+            }
+        }
+        if (*filter == '\0') {
+            return *topic == '\0';
+        }
+        if (*topic == '\0') {
+            // "a/#" matches "a"
+            return filter[1] == '#' && filter[2] == '\0';
+        }
+        if (*topic != '/') {
+            return false;
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == '\0';
+}
+
+static int linear_dispatch(const char *topic) {
+    int n = 0;
+    for (int i = 0; i < ROUTES; i++) {
+        if (filter_match(routes[i].filter, topic)) {
+            routes[i].handler(topic, strlen(topic), "", 0, NULL);
+            n++;
+        }
+    }
+    return n;
+}
+
+int main(void) {
+    int count = 0;
+
+    for (int c = 0; c < COMMANDS; c++) {
+        snprintf(filters[count], sizeof(filters[0]), "/tracker/%s/#", commands[c]);
+        count++;
+        for (int d = 0; d < DEVICES; d++) {
+            snprintf(filters[count++], sizeof(filters[0]), "/tracker/%s/ESP_%d/+", commands[c], d);
+        }
+        for (int g = 0; g < GROUPS; g++) {
+            snprintf(filters[count++], sizeof(filters[0]), "/tracker/+/group_%d/%s", g, commands[c]);
+        }
+    }
+    for (int i = 0; i < ROUTES; i++) {
+        routes[i].filter = filters[i];
+        routes[i].handler = route_hit;
+    }
+    if (!topic_router_init(&router, routes, ROUTES, nodes, NODES, edges, 2 * NODES)) {
+        fprintf(stderr, "topic_router_init failed, %u nodes used\n", router.node_count);
+        return 1;
+    }
+
+    srand(1);
+    for (int i = 0; i < TOPICS; i++) {
+        const char *command = commands[rand() % COMMANDS];
+        switch (rand() % 3) {
+        case 0:
+            snprintf(topics[i], sizeof(topics[0]), "/tracker/%s/ESP_%d/set", command, rand() % DEVICES);
+            break;
+        case 1:
+            snprintf(topics[i], sizeof(topics[0]), "/tracker/x/group_%d/%s", rand() % GROUPS, command);
+            break;
+        default:
+            snprintf(topics[i], sizeof(topics[0]), "/tracker/%s/ESP_%d", command, DEVICES + rand() % DEVICES);
+            break;
+        }
+    }
+
+    // Both find the same routes
+    for (int i = 0; i < TOPICS; i++) {
+        int trie = topic_router_dispatch(&router, topics[i], strlen(topics[i]), "", 0);
+        int linear = linear_dispatch(topics[i]);
+        if (trie != linear || trie == 0) {
+            fprintf(stderr, "%s: %d trie, %d linear matches\n", topics[i], trie, linear);
+            return 1;
+        }
+    }
+
+    uint64_t start = host_time_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < TOPICS; i++) {
+            topic_router_dispatch(&router, topics[i], strlen(topics[i]), "", 0);
+        }
+    }
+    double trie_ns = (double)(host_time_ns() - start) / (ROUNDS * TOPICS);
+
+    start = host_time_ns();
+    for (int r = 0; r < ROUNDS / 10; r++) {
+        for (int i = 0; i < TOPICS; i++) {
+            linear_dispatch(topics[i]);
+        }
+    }
+    double linear_ns = (double)(host_time_ns() - start) / (ROUNDS / 10 * TOPICS);
+
+    printf("%d routes, %u trie nodes, %u bytes\n", ROUTES, router.node_count,
+           (unsigned int)(sizeof(nodes) + sizeof(edges)));
+    printf("Trie:   %8.1f ns per topic\n", trie_ns);
+    printf("Linear: %8.1f ns per topic\n", linear_ns);
+    return 0;
+}
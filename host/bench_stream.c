@@ -0,0 +1,184 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "host.h"
+#include "gattc_stream.h"
+#include "adv_frame.h"
+
+/*
+ * GATT notification streams: sustained notification rate with the uplink
+ * task taking batches concurrently, then the share of notifications kept,
+ * decimated and dropped behind a slow uplink, and the static memory used
+ *   make -C host bench
+ */
+
+#define STREAMS         CONFIG_TRACKER_GATTC_STREAMS
+#define BUFFERS         CONFIG_TRACKER_GATTC_STREAM_BUFFERS
+#if CONFIG_TRACKER_GATTC_STREAM_BYTES < CONFIG_MQTT_BUFFER_SIZE_BYTE - 5 - 64
+#define BYTES           CONFIG_TRACKER_GATTC_STREAM_BYTES
+#else
+#define BYTES           (CONFIG_MQTT_BUFFER_SIZE_BYTE - 5 - 64)    // As main.c, within the MQTT client buffer
+#endif
+#define AGE_US          (CONFIG_TRACKER_GATTC_STREAM_AGE_MS * 1000)
+#define VALUE_LEN       20
+#define NOTIFICATIONS   4000000         // Throughput run
+#define SIM_STREAMS     4               // Uplink runs
+#define SIM_HZ          200
+#define SIM_S           60
+#define MESSAGE_COST    60              // MQTT and TCP/IP bytes per message
+
+#if STREAMS < SIM_STREAMS
+#undef STREAMS
+#define STREAMS         SIM_STREAMS
+#endif
+
+static gattc_stream_entry_t entries[STREAMS];
+static uint8_t storage[GATTC_STREAM_STORAGE(STREAMS, BUFFERS, BYTES)];
+static gattc_stream_t st;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool producing;
+static uint8_t sink[BYTES];
+
+
+static void init(gattc_stream_policy_t policy, uint32_t streams) {
+    gattc_stream_params_t params = {
+        .bytes = BYTES,
+        .buffers = BUFFERS,
+        .policy = policy,
+        .age_us = AGE_US,
+        .idle_us = 10000000,
+    };
+    uint8_t bda[ADV_BDA_LEN] = { 0xC0, 0, 0, 0, 0, 0 };
+
+    if (!gattc_stream_init(&st, entries, STREAMS, storage, sizeof(storage), &params)) {
+        fprintf(stderr, "gattc_stream_init failed\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < streams; i++) {
+        bda[5] = i;
+        gattc_stream_open(&st, bda, i, 0);
+    }
+}
+
+/*
+ * Uplink task of the throughput run: batches copied out as soon as sealed
+ */
+static void *consumer(void *arg) {
+    const uint8_t *batch;
+    size_t len;
+    int stream;
+
+    while (1) {
+        bool done = !producing;
+        pthread_mutex_lock(&lock);
+        stream = gattc_stream_take(&st, &batch, &len);
+        pthread_mutex_unlock(&lock);
+        if (stream < 0) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        memcpy(sink, batch, len);
+        pthread_mutex_lock(&lock);
+        gattc_stream_release(&st, stream);
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+static void throughput(void) {
+    uint8_t value[VALUE_LEN] = {0};
+    gattc_stream_stats_t stats;
+    pthread_t thread;
+
+    init(GATTC_STREAM_DROP, SIM_STREAMS);
+    producing = true;
+    pthread_create(&thread, NULL, consumer, NULL);
+    uint64_t start = host_time_ns();
+    for (uint32_t i = 0; i < NOTIFICATIONS; i++) {
+        value[0] = i;
+        pthread_mutex_lock(&lock);
+        bool sealed = gattc_stream_put(&st, i % SIM_STREAMS, value, sizeof(value), (uint32_t)(host_time_ns() / 1000));
+        pthread_mutex_unlock(&lock);
+        if (sealed) {
+            // The uplink task is woken, as in main.c
+            sched_yield();
+        }
+    }
+    double elapsed_s = (host_time_ns() - start) / 1e9;
+    pthread_mutex_lock(&lock);
+    gattc_stream_poll(&st, (uint32_t)(host_time_ns() / 1000) + AGE_US);
+    pthread_mutex_unlock(&lock);
+    producing = false;
+    pthread_join(thread, NULL);
+    gattc_stream_get_stats(&st, &stats);
+    printf("Throughput: %.0f notifications/s (%.0f ns each), %.2f%% dropped, %u batches %.1f MB/s out\n",
+           NOTIFICATIONS / elapsed_s, elapsed_s * 1e9 / NOTIFICATIONS, 100.0 * stats.dropped / stats.received,
+           stats.published, stats.bytes / elapsed_s / 1e6);
+}
+
+/*
+ * SIM_STREAMS streams of SIM_HZ notifications behind an uplink of bytes_s,
+ * simulated time, 1 ms steps
+ */
+static void uplink(gattc_stream_policy_t policy, uint32_t bytes_s) {
+    uint8_t value[VALUE_LEN] = {0};
+    gattc_stream_stats_t stats;
+    const uint8_t *batch;
+    size_t len;
+    int64_t credit = 0;
+    uint32_t seq = 0;
+
+    init(policy, SIM_STREAMS);
+    for (uint32_t ms = 0; ms < SIM_S * 1000; ms++) {
+        uint32_t now_us = ms * 1000;
+        // Streams out of phase
+        for (uint32_t i = 0; i < SIM_STREAMS; i++) {
+            if ((ms + i) % (1000 / SIM_HZ) == 0) {
+                value[0] = seq++;
+                gattc_stream_put(&st, i, value, sizeof(value), now_us);
+            }
+        }
+        gattc_stream_poll(&st, now_us);
+        credit += bytes_s / 1000;
+        int stream;
+        while (credit > 0 && (stream = gattc_stream_take(&st, &batch, &len)) >= 0) {
+            credit -= len + MESSAGE_COST;
+            gattc_stream_release(&st, stream);
+        }
+        if (credit > BYTES) {
+            // Idle uplink, no savings
+            credit = BYTES;
+        }
+    }
+    gattc_stream_get_stats(&st, &stats);
+    printf("%-9s %7u %9.1f %9.1f %9.1f %9u\n", policy == GATTC_STREAM_DROP ? "drop" : "decimate", bytes_s,
+           100.0 * stats.batched / stats.received, 100.0 * stats.decimated / stats.received,
+           100.0 * stats.dropped / stats.received, stats.published);
+}
+
+int main(void) {
+    // Records and headers of the batches of a second, in full
+    uint32_t need = SIM_STREAMS * (SIM_HZ * (ADV_FRAME_STREAM_RECORD_LEN + VALUE_LEN) +
+                                   1000000 / AGE_US * (ADV_FRAME_STREAM_HEADER_LEN + MESSAGE_COST));
+
+    throughput();
+    printf("\n%u streams of %u notifications/s of %u bytes, %u B/s needed, %d ms batches of %d bytes, %d per stream\n",
+           SIM_STREAMS, SIM_HZ, VALUE_LEN, need, CONFIG_TRACKER_GATTC_STREAM_AGE_MS, BYTES, BUFFERS);
+    printf("%-9s %7s %9s %9s %9s %9s\n", "policy", "B/s", "kept %", "decim %", "drop %", "batches");
+    for (int p = GATTC_STREAM_DROP; p <= GATTC_STREAM_DECIMATE; p++) {
+        uint32_t shares[] = { 200, 100, 50, 25, 10 };
+        for (size_t i = 0; i < sizeof(shares) / sizeof(shares[0]); i++) {
+            uplink(p, need * shares[i] / 100);
+        }
+    }
+    printf("\nMemory: %u bytes of batches and %u of stream state, CONFIG_TRACKER_GATTC_STREAMS %d\n",
+           (unsigned int)GATTC_STREAM_STORAGE(CONFIG_TRACKER_GATTC_STREAMS, BUFFERS, BYTES),
+           (unsigned int)(CONFIG_TRACKER_GATTC_STREAMS * sizeof(gattc_stream_entry_t) + sizeof(gattc_stream_t)),
+           CONFIG_TRACKER_GATTC_STREAMS);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "adv_table.h"
+
+/*
+ * Advert storms into the per window aggregation table, adv_table.h: 1k to 50k
+ * devices each advertising about 30 times per window in random order, then
+ * the flush of the window
+ *   make -C host bench
+ */
+
+#define CAPACITY_MAX    65536
+#define DEVICES_MAX     50000
+#define PER_DEVICE      30              // Adverts per window, 100 ms interval in a 3 s window
+#define ADVERTS         6000000         // Per run, over as many windows as needed
+
+static adv_entry_t entries[CAPACITY_MAX];
+static uint16_t order[CAPACITY_MAX];
+static adv_table_t table;
+static adv_record_t *devices;
+static uint32_t *storm;
+static volatile uint32_t sink;
+
+
+static uint32_t rand_next(uint32_t *state) {
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+/*
+ * Smallest capacity keeping the devices under the 75% load limit, 65536 max
+ */
+static uint32_t capacity_for(uint32_t count) {
+    uint32_t capacity = 16;
+    while (capacity < CAPACITY_MAX && count > capacity - capacity / 4) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+static void bench(uint32_t count) {
+    uint32_t state = count;
+    uint32_t capacity = capacity_for(count);
+    uint32_t per_window = count * PER_DEVICE;
+    uint32_t windows = ADVERTS / per_window;
+
+    for (uint32_t d = 0; d < count; d++) {
+        adv_record_t *rec = &devices[d];
+        memset(rec, 0, sizeof(*rec));
+        rec->bda[0] = 0xC0;
+        // Random addresses, as seen from public and random resolvable devices
+        uint32_t r = rand_next(&state);
+        rec->bda[1] = (uint8_t)r;
+        rec->bda[2] = (uint8_t)(r >> 8);
+        rec->bda[3] = (uint8_t)(r >> 16);
+        rec->bda[4] = (uint8_t)(d >> 8);
+        rec->bda[5] = (uint8_t)d;
+        rec->adv_data_len = 30;
+    }
+    for (uint32_t i = 0; i < per_window; i++) {
+        storm[i] = rand_next(&state) % count;
+    }
+
+    adv_table_init(&table, entries, order, capacity);
+    uint64_t update_ns = 0, flush_ns = 0;
+    for (uint32_t w = 0; w < windows; w++) {
+        uint64_t start = host_time_ns();
+        for (uint32_t i = 0; i < per_window; i++) {
+            adv_record_t *rec = &devices[storm[i]];
+            rec->time_ms = w * per_window + i;
+            rec->rssi = (int8_t)(-40 - (i & 63));
+            sink += adv_table_update(&table, rec) != NULL;
+        }
+        uint64_t mid = host_time_ns();
+        // What the publisher reads of each device when flushing
+        for (uint32_t i = 0; i < table.count; i++) {
+            sink += adv_table_at(&table, i)->stats.count;
+        }
+        adv_table_clear(&table);
+        flush_ns += host_time_ns() - mid;
+        update_ns += mid - start;
+    }
+    uint64_t adverts = (uint64_t)windows * per_window;
+    printf("%6u devices %6u slots: %5.1f ns per advert, %6.1f M adverts/s, flush %8.1f us per window, "
+           "%u adverts overflowed\n", count, capacity, (double)update_ns / adverts, adverts * 1e3 / update_ns,
+           flush_ns / 1e3 / windows, table.overflow);
+}
+
+int main(void) {
+    static const uint32_t counts[] = { 1000, 5000, 10000, 20000, 45000, 50000 };
+
+    devices = malloc(DEVICES_MAX * sizeof(adv_record_t));
+    storm = malloc(DEVICES_MAX * PER_DEVICE * sizeof(uint32_t));
+    if (!devices || !storm) {
+        return 1;
+    }
+    printf("Aggregation table, %zu bytes per slot, %d adverts per device and window\n",
+           sizeof(adv_entry_t) + sizeof(uint16_t), PER_DEVICE);
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        bench(counts[i]);
+    }
+    free(storm);
+    free(devices);
+    return 0;
+}
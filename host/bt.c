@@ -0,0 +1,952 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "host.h"
+#include "esp_log.h"
+#include "bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gattc_api.h"
+#include "esp_gatt_common_api.h"
+
+/*
+ * Bluedroid shim
+ * Command completions are delivered by a BTC thread, in order, as Bluedroid
+ * does. Advertising reports come from the load generator thread, which plays
+ * the controller; a lock serializes every callback so the GAP callback never
+ * runs concurrently with itself, as on the BTC task.
+ *
+ * GATT client: the devices registered with host_bt_gatt_server() advertise as
+ * connectable and accept connections. Each step of a connection completes on
+ * the BTC thread after a few connection intervals. While connections are open
+ * or being initiated, the radio is shared and a matching share of the adverts
+ * is lost.
+ * Servers with notify_hz have a stream service: once its CCCD is written,
+ * the value is notified at that rate, its sequence number first, until the
+ * connection closes.
+ */
+
+#define TAG_BT          "BT_HOST"
+#define BTC_QUEUE_LEN   16
+#define HOST_GATT_IF    3
+#define GATT_SERVERS    4096        // Registry slots, power of 2
+#define GATT_LINKS      9           // Controller connections
+#define GATT_TIMERS     64          // Pending GATT client events
+#define GATT_VALUE_MAX  244         // ATT MTU 247
+#define GATT_MTU        247         // Answered to MTU requests
+#define CONN_INTERVAL_NS    30000000ull
+#define INITIATING_SHARE    500     // Permille of the adverts lost while initiating a connection
+#define CONNECTION_SHARE    83      // and per open connection, 2.5 ms event every interval
+
+typedef struct {
+    bool                     gattc;
+    esp_gap_ble_cb_event_t   gap_event;
+    esp_gattc_cb_event_t     gattc_event;
+    esp_gatt_if_t            gattc_if;
+    uint8_t                  value[GATT_VALUE_MAX];     // Of param.gattc.read or notify
+    union {
+        esp_ble_gap_cb_param_t   gap;
+        esp_ble_gattc_cb_param_t gattc;
+    } param;
+} btc_msg_t;
+
+static esp_gap_ble_cb_t gap_cb = NULL;
+static esp_gattc_cb_t gattc_cb = NULL;
+static pthread_mutex_t cb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t btc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t btc_cond = PTHREAD_COND_INITIALIZER;
+static btc_msg_t btc_queue[BTC_QUEUE_LEN];
+static uint32_t btc_head = 0;
+static uint32_t btc_count = 0;
+static pthread_t btc_thread;
+static bool btc_started = false;
+
+// Scan state, btc_lock
+static bool scanning = false;
+static uint64_t scan_end_ns = 0;    // 0: no duration
+static bool scan_params_set = false;
+// With scan windows, the controller listens the first window of each interval from the scan start
+static bool scan_windows = false;
+static uint64_t scan_start_ns = 0;
+static uint64_t scan_interval_ns = 1;
+static uint64_t scan_window_ns = 1;
+// Active scan: scan responses are reported after their advert, rsp_loss percent are lost
+static bool scan_active = false;
+static uint32_t rsp_loss = 0;
+static uint32_t rsp_rng = 1;
+
+// GATT servers of the load generator, open addressing on the address
+typedef struct {
+    bool                used;
+    uint8_t             bda[6];
+    host_gatt_server_t  srv;
+} gatt_server_t;
+
+typedef enum {
+    LINK_FREE = 0,
+    LINK_INITIATING,
+    LINK_CONNECTED,
+    LINK_CLOSING,
+} link_state_t;
+
+typedef struct {
+    link_state_t         state;
+    uint8_t              bda[6];
+    const gatt_server_t *server;    // NULL if none registered
+    bool                 discovered;
+    uint16_t             mtu;
+    uint32_t             notified;  // Notifications sent
+} gatt_link_t;
+
+// GATT client event due at a time, applied to its link when delivered
+typedef struct {
+    bool      used;
+    uint64_t  due_ns;
+    uint32_t  seq;                  // Order of the events due at once
+    int       link;
+    btc_msg_t msg;
+} gatt_timer_t;
+
+// Service table of every server: start, end, then the characteristic values
+static const struct {
+    uint16_t uuid;
+    uint16_t start;
+    uint16_t end;
+} gatt_services[] = {
+    { 0x1800, 0x01, 0x05 },
+    { 0x1801, 0x06, 0x09 },
+    { 0x180F, 0x0A, 0x0C },
+    { 0x181A, 0x0D, 0x12 },
+    { 0xFFE0, 0x13, 0x16 },         // Stream, servers with notify_hz only
+};
+
+static const struct {
+    uint16_t uuid;
+    uint16_t handle;
+    uint8_t  properties;
+} gatt_chars[] = {
+    { 0x2A19, 0x0C, ESP_GATT_CHAR_PROP_BIT_READ },      // Battery level
+    { 0x2A6E, 0x0F, ESP_GATT_CHAR_PROP_BIT_READ },      // Temperature
+    { 0x2A6F, 0x12, ESP_GATT_CHAR_PROP_BIT_READ },      // Humidity
+    { 0xFFE1, 0x15, ESP_GATT_CHAR_PROP_BIT_NOTIFY },    // Stream, its CCCD next
+};
+
+#define GATT_STREAM_SERVICE 0xFFE0
+#define GATT_STREAM_CCCD    0x16
+
+// btc_lock
+static gatt_server_t gatt_servers[GATT_SERVERS];
+static gatt_link_t gatt_links[GATT_LINKS];
+static gatt_timer_t gatt_timers[GATT_TIMERS];
+static uint32_t gatt_seq = 0;
+static uint32_t radio_rng = 1;
+static uint64_t radio_lost = 0;
+
+
+static void btc_deliver(btc_msg_t *msg) {
+    if (msg->gattc && msg->gattc_event == ESP_GATTC_READ_CHAR_EVT) {
+        msg->param.gattc.read.value = msg->value;
+    } else if (msg->gattc && msg->gattc_event == ESP_GATTC_NOTIFY_EVT) {
+        msg->param.gattc.notify.value = msg->value;
+    }
+    pthread_mutex_lock(&cb_lock);
+    if (msg->gattc) {
+        if (gattc_cb) {
+            gattc_cb(msg->gattc_event, msg->gattc_if, &msg->param.gattc);
+        }
+    } else if (gap_cb) {
+        gap_cb(msg->gap_event, &msg->param.gap);
+    }
+    pthread_mutex_unlock(&cb_lock);
+}
+
+/*
+ * Earliest GATT client event, btc_lock held
+ * return: timer index, -1 if none
+ */
+static int gatt_timer_next(void) {
+    int next = -1;
+    for (int i = 0; i < GATT_TIMERS; i++) {
+        if (gatt_timers[i].used && (next < 0 || gatt_timers[i].due_ns < gatt_timers[next].due_ns ||
+                                    (gatt_timers[i].due_ns == gatt_timers[next].due_ns &&
+                                     (int32_t)(gatt_timers[i].seq - gatt_timers[next].seq) < 0))) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+static void gatt_notify_value(btc_msg_t *msg, gatt_link_t *link);
+
+/*
+ * Link state once an event is delivered, btc_lock held
+ * return: true if the timer was armed again, for the next notification
+ */
+static bool gatt_timer_apply(gatt_timer_t *timer) {
+    gatt_link_t *link = &gatt_links[timer->link];
+    switch (timer->msg.gattc_event) {
+    case ESP_GATTC_OPEN_EVT:
+        link->state = LINK_CONNECTED;
+        break;
+    case ESP_GATTC_CFG_MTU_EVT:
+        link->mtu = timer->msg.param.gattc.cfg_mtu.mtu;
+        break;
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        link->discovered = true;
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        // Periodic: due times do not drift with the delivery
+        timer->due_ns += 1000000000ull / link->server->srv.notify_hz;
+        timer->seq = gatt_seq++;
+        gatt_notify_value(&timer->msg, link);
+        return true;
+    case ESP_GATTC_CLOSE_EVT:
+        memset(link, 0, sizeof(*link));
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+/*
+ * BTC thread: command completions, the end of timed scans and GATT client events
+ */
+static void *btc_task(void *arg) {
+    btc_msg_t msg;
+    pthread_mutex_lock(&btc_lock);
+    while (1) {
+        uint64_t now = host_time_ns();
+        uint64_t wake = scanning && scan_end_ns ? scan_end_ns : 0;
+        int timer = gatt_timer_next();
+        if (timer >= 0 && (wake == 0 || gatt_timers[timer].due_ns < wake)) {
+            wake = gatt_timers[timer].due_ns;
+        }
+        if (btc_count) {
+            msg = btc_queue[btc_head];
+            btc_head = (btc_head + 1) % BTC_QUEUE_LEN;
+            btc_count--;
+            pthread_cond_broadcast(&btc_cond);
+        } else if (scanning && scan_end_ns && now >= scan_end_ns) {
+            scanning = false;
+            scan_end_ns = 0;
+            memset(&msg, 0, sizeof(msg));
+            msg.gap_event = ESP_GAP_BLE_SCAN_RESULT_EVT;
+            msg.param.gap.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_CMPL_EVT;
+        } else if (timer >= 0 && now >= gatt_timers[timer].due_ns) {
+            msg = gatt_timers[timer].msg;
+            if (!gatt_timer_apply(&gatt_timers[timer])) {
+                gatt_timers[timer].used = false;
+            }
+        } else if (wake) {
+            struct timespec ts = {
+                .tv_sec = wake / 1000000000ull,
+                .tv_nsec = wake % 1000000000ull,
+            };
+            pthread_cond_timedwait(&btc_cond, &btc_lock, &ts);
+            continue;
+        } else {
+            pthread_cond_wait(&btc_cond, &btc_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&btc_lock);
+        btc_deliver(&msg);
+        pthread_mutex_lock(&btc_lock);
+    }
+    return NULL;
+}
+
+/*
+ * Queue an event for the BTC thread, btc_lock held
+ */
+static esp_err_t btc_post_locked(const btc_msg_t *msg) {
+    if (!btc_started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    while (btc_count == BTC_QUEUE_LEN) {
+        pthread_cond_wait(&btc_cond, &btc_lock);
+    }
+    btc_queue[(btc_head + btc_count) % BTC_QUEUE_LEN] = *msg;
+    btc_count++;
+    pthread_cond_broadcast(&btc_cond);
+    return ESP_OK;
+}
+
+static esp_err_t btc_post_gap(esp_gap_ble_cb_event_t event, esp_bt_status_t status) {
+    btc_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.gap_event = event;
+    // Every completion event starts with its status
+    msg.param.gap.scan_start_cmpl.status = status;
+    pthread_mutex_lock(&btc_lock);
+    esp_err_t ret = btc_post_locked(&msg);
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+static void btc_clock_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&btc_cond);
+    pthread_cond_init(&btc_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void) {
+    pthread_mutex_lock(&btc_lock);
+    if (!btc_started) {
+        btc_clock_init();
+        if (pthread_create(&btc_thread, NULL, btc_task, NULL) != 0) {
+            pthread_mutex_unlock(&btc_lock);
+            return ESP_FAIL;
+        }
+        pthread_setname_np(btc_thread, "btcT");
+        btc_started = true;
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ESP_OK;
+}
+
+/*
+ * GAP
+ */
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback) {
+    gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params) {
+    ESP_LOGI(TAG_BT, "Scan params interval %u window %u", scan_params->scan_interval, scan_params->scan_window);
+    pthread_mutex_lock(&btc_lock);
+    scan_params_set = true;
+    scan_interval_ns = scan_params->scan_interval ? scan_params->scan_interval * 625000ull : 1;
+    scan_window_ns = scan_params->scan_window * 625000ull;
+    scan_active = scan_params->scan_type == BLE_SCAN_TYPE_ACTIVE;
+    pthread_mutex_unlock(&btc_lock);
+    return btc_post_gap(ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT, ESP_BT_STATUS_SUCCESS);
+}
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration) {
+    pthread_mutex_lock(&btc_lock);
+    bool ok = scan_params_set && !scanning;
+    if (ok) {
+        scanning = true;
+        scan_start_ns = host_time_ns();
+        scan_end_ns = duration ? scan_start_ns + (uint64_t)duration * 1000000000ull : 0;
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return btc_post_gap(ESP_GAP_BLE_SCAN_START_COMPLETE_EVT, ok ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL);
+}
+
+esp_err_t esp_ble_gap_stop_scanning(void) {
+    pthread_mutex_lock(&btc_lock);
+    scanning = false;
+    scan_end_ns = 0;
+    pthread_mutex_unlock(&btc_lock);
+    return btc_post_gap(ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT, ESP_BT_STATUS_SUCCESS);
+}
+
+static int gatt_timer_cancel(int link);
+static esp_err_t gatt_timer_add(int link, uint64_t delay_ns, const btc_msg_t *msg);
+static void gatt_msg(btc_msg_t *msg, esp_gattc_cb_event_t event, int link);
+
+/*
+ * Disconnect a link, or cancel the connection being initiated to the device
+ */
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device) {
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    btc_msg_t msg;
+
+    pthread_mutex_lock(&btc_lock);
+    for (int i = 0; i < GATT_LINKS; i++) {
+        gatt_link_t *link = &gatt_links[i];
+        if (link->state == LINK_FREE || memcmp(link->bda, remote_device, 6) != 0) {
+            continue;
+        }
+        if (link->state == LINK_INITIATING) {
+            // Connection never made, the open fails right away
+            gatt_timer_cancel(i);
+            gatt_msg(&msg, ESP_GATTC_OPEN_EVT, i);
+            msg.param.gattc.open.status = ESP_GATT_ERROR;
+            memset(link, 0, sizeof(*link));
+            ret = btc_post_locked(&msg);
+        } else if (link->state == LINK_CONNECTED) {
+            link->state = LINK_CLOSING;
+            gatt_timer_cancel(i);
+            gatt_msg(&msg, ESP_GATTC_DISCONNECT_EVT, i);
+            gatt_timer_add(i, CONN_INTERVAL_NS, &msg);
+            gatt_msg(&msg, ESP_GATTC_CLOSE_EVT, i);
+            ret = gatt_timer_add(i, CONN_INTERVAL_NS, &msg);
+        } else {
+            ret = ESP_OK;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+bool host_bt_scanning(void) {
+    return __atomic_load_n(&scanning, __ATOMIC_RELAXED);
+}
+
+void host_bt_scan_windows(bool on) {
+    scan_windows = on;
+}
+
+void host_bt_scan_rsp_loss(uint32_t percent) {
+    rsp_loss = percent;
+}
+
+static uint32_t gatt_hash(const uint8_t *bda) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        h = (h ^ bda[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Registered server of a device, btc_lock held
+ * add: take a free slot if not found
+ */
+static gatt_server_t *gatt_server_find(const uint8_t *bda, bool add) {
+    uint32_t h = gatt_hash(bda);
+    for (uint32_t i = 0; i < GATT_SERVERS; i++) {
+        gatt_server_t *server = &gatt_servers[(h + i) & (GATT_SERVERS - 1)];
+        if (!server->used) {
+            return add ? server : NULL;
+        }
+        if (memcmp(server->bda, bda, 6) == 0) {
+            return server;
+        }
+    }
+    return NULL;
+}
+
+bool host_bt_gatt_server(const uint8_t *bda, const host_gatt_server_t *srv) {
+    pthread_mutex_lock(&btc_lock);
+    gatt_server_t *server = gatt_server_find(bda, true);
+    if (server) {
+        server->used = true;
+        memcpy(server->bda, bda, 6);
+        server->srv = *srv;
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return server != NULL;
+}
+
+uint64_t host_bt_radio_lost(void) {
+    return __atomic_load_n(&radio_lost, __ATOMIC_RELAXED);
+}
+
+/*
+ * Scanning, and within a scan window
+ */
+static bool host_bt_listening(void) {
+    pthread_mutex_lock(&btc_lock);
+    bool listening = scanning && (!scan_windows ||
+                     (host_time_ns() - scan_start_ns) % scan_interval_ns < scan_window_ns);
+    pthread_mutex_unlock(&btc_lock);
+    return listening;
+}
+
+/*
+ * Radio time taken by connections, the advert is missed, btc_lock held
+ */
+static bool host_bt_radio_busy(void) {
+    uint32_t share = 0;
+    for (int i = 0; i < GATT_LINKS; i++) {
+        if (gatt_links[i].state == LINK_INITIATING) {
+            share += INITIATING_SHARE;
+        } else if (gatt_links[i].state != LINK_FREE) {
+            share += CONNECTION_SHARE;
+        }
+    }
+    if (share == 0) {
+        return false;
+    }
+    radio_rng = radio_rng * 1103515245 + 12345;
+    if ((radio_rng >> 16) % 1000 >= share) {
+        return false;
+    }
+    __atomic_fetch_add(&radio_lost, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*
+ * One advertising report to the GAP callback
+ */
+static void host_bt_report(const uint8_t *bda, int8_t rssi, uint8_t dev_type, esp_ble_evt_type_t evt_type,
+                           const uint8_t *data, uint8_t adv_data_len, uint8_t scan_rsp_len) {
+    esp_ble_gap_cb_param_t param;
+    struct ble_scan_result_evt_param *scan_rst = &param.scan_rst;
+
+    memset(scan_rst, 0, sizeof(*scan_rst));
+    scan_rst->search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    memcpy(scan_rst->bda, bda, sizeof(esp_bd_addr_t));
+    scan_rst->dev_type = dev_type;
+    scan_rst->ble_addr_type = BLE_ADDR_TYPE_RANDOM;
+    scan_rst->ble_evt_type = evt_type;
+    scan_rst->rssi = rssi;
+    memcpy(scan_rst->ble_adv, data, adv_data_len + scan_rsp_len);
+    scan_rst->adv_data_len = adv_data_len;
+    scan_rst->scan_rsp_len = scan_rsp_len;
+    scan_rst->num_resps = 1;
+
+    pthread_mutex_lock(&cb_lock);
+    if (gap_cb) {
+        gap_cb(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+    }
+    pthread_mutex_unlock(&cb_lock);
+}
+
+bool host_bt_scan_result(const uint8_t *bda, int8_t rssi, uint8_t dev_type, const uint8_t *data,
+                         uint8_t adv_data_len, uint8_t scan_rsp_len) {
+    if (!host_bt_listening()) {
+        return false;
+    }
+    pthread_mutex_lock(&btc_lock);
+    bool busy = host_bt_radio_busy();
+    bool connectable = !busy && gatt_server_find(bda, false) != NULL;
+    pthread_mutex_unlock(&btc_lock);
+    if (busy) {
+        return false;
+    }
+    if (scan_rsp_len == 0 && !connectable) {
+        host_bt_report(bda, rssi, dev_type, ESP_BLE_EVT_NON_CONN_ADV, data, adv_data_len, 0);
+        return true;
+    }
+    // Scannable: the response only comes to a scan request
+    host_bt_report(bda, rssi, dev_type, connectable ? ESP_BLE_EVT_CONN_ADV : ESP_BLE_EVT_DISC_ADV,
+                   data, adv_data_len, 0);
+    if (scan_rsp_len == 0) {
+        return true;
+    }
+    if (__atomic_load_n(&scan_active, __ATOMIC_RELAXED)) {
+        rsp_rng = rsp_rng * 1103515245 + 12345;
+        if ((rsp_rng >> 16) % 100 >= rsp_loss) {
+            host_bt_report(bda, rssi, dev_type, ESP_BLE_EVT_SCAN_RSP, data + adv_data_len, 0, scan_rsp_len);
+        }
+    }
+    return true;
+}
+
+/*
+ * GATT client
+ */
+static void gatt_msg(btc_msg_t *msg, esp_gattc_cb_event_t event, int link) {
+    memset(msg, 0, sizeof(*msg));
+    msg->gattc = true;
+    msg->gattc_event = event;
+    msg->gattc_if = HOST_GATT_IF;
+    // conn_id and status lead every connection event but open and close
+    switch (event) {
+    case ESP_GATTC_OPEN_EVT:
+        msg->param.gattc.open.conn_id = link;
+        memcpy(msg->param.gattc.open.remote_bda, gatt_links[link].bda, 6);
+        break;
+    case ESP_GATTC_CLOSE_EVT:
+        msg->param.gattc.close.conn_id = link;
+        memcpy(msg->param.gattc.close.remote_bda, gatt_links[link].bda, 6);
+        break;
+    case ESP_GATTC_DISCONNECT_EVT:
+        msg->param.gattc.disconnect.conn_id = link;
+        memcpy(msg->param.gattc.disconnect.remote_bda, gatt_links[link].bda, 6);
+        break;
+    case ESP_GATTC_SEARCH_RES_EVT:
+        msg->param.gattc.search_res.conn_id = link;
+        break;
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        msg->param.gattc.search_cmpl.conn_id = link;
+        break;
+    case ESP_GATTC_READ_CHAR_EVT:
+        msg->param.gattc.read.conn_id = link;
+        break;
+    case ESP_GATTC_CFG_MTU_EVT:
+        msg->param.gattc.cfg_mtu.conn_id = link;
+        break;
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        msg->param.gattc.write.conn_id = link;
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        msg->param.gattc.notify.conn_id = link;
+        memcpy(msg->param.gattc.notify.remote_bda, gatt_links[link].bda, 6);
+        msg->param.gattc.notify.is_notify = true;
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Deliver a GATT client event after delay_ns, btc_lock held
+ */
+static esp_err_t gatt_timer_add(int link, uint64_t delay_ns, const btc_msg_t *msg) {
+    for (int i = 0; i < GATT_TIMERS; i++) {
+        gatt_timer_t *timer = &gatt_timers[i];
+        if (!timer->used) {
+            timer->used = true;
+            timer->due_ns = host_time_ns() + delay_ns;
+            timer->seq = gatt_seq++;
+            timer->link = link;
+            timer->msg = *msg;
+            pthread_cond_broadcast(&btc_cond);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+/*
+ * Next notification of a link: its sequence number little endian, then a
+ * pattern, as long as the server sends within the MTU. btc_lock held
+ */
+static void gatt_notify_value(btc_msg_t *msg, gatt_link_t *link) {
+    const host_gatt_server_t *srv = &link->server->srv;
+    uint16_t len = srv->notify_len;
+    uint32_t seq = link->notified++;
+
+    if (len > link->mtu - 3) {
+        len = link->mtu - 3;
+    }
+    if (len > GATT_VALUE_MAX) {
+        len = GATT_VALUE_MAX;
+    }
+    for (uint16_t i = 0; i < len; i++) {
+        msg->value[i] = i < 4 ? (uint8_t)(seq >> (8 * i)) : (uint8_t)(seq + i);
+    }
+    msg->param.gattc.notify.value_len = len;
+}
+
+/*
+ * Drop the pending events of a link, btc_lock held
+ * return: number dropped
+ */
+static int gatt_timer_cancel(int link) {
+    int n = 0;
+    for (int i = 0; i < GATT_TIMERS; i++) {
+        if (gatt_timers[i].used && gatt_timers[i].link == link) {
+            gatt_timers[i].used = false;
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Link of a connection the client may use, btc_lock held
+ */
+static gatt_link_t *gatt_link_get(uint16_t conn_id) {
+    if (conn_id >= GATT_LINKS || gatt_links[conn_id].state != LINK_CONNECTED) {
+        return NULL;
+    }
+    return &gatt_links[conn_id];
+}
+
+esp_err_t esp_ble_gattc_register_callback(esp_gattc_cb_t callback) {
+    gattc_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_app_register(uint16_t app_id) {
+    btc_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.gattc = true;
+    msg.gattc_event = ESP_GATTC_REG_EVT;
+    msg.gattc_if = HOST_GATT_IF;
+    msg.param.gattc.reg.status = ESP_GATT_OK;
+    msg.param.gattc.reg.app_id = app_id;
+    pthread_mutex_lock(&btc_lock);
+    esp_err_t ret = btc_post_locked(&msg);
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu) {
+    return ESP_OK;
+}
+
+/*
+ * Exchanged on the next connection event, the server takes GATT_MTU
+ */
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t gattc_if, uint16_t conn_id) {
+    btc_msg_t msg;
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    pthread_mutex_lock(&btc_lock);
+    if (gatt_link_get(conn_id)) {
+        gatt_msg(&msg, ESP_GATTC_CFG_MTU_EVT, conn_id);
+        msg.param.gattc.cfg_mtu.status = ESP_GATT_OK;
+        msg.param.gattc.cfg_mtu.mtu = GATT_MTU;
+        ret = gatt_timer_add(conn_id, CONN_INTERVAL_NS, &msg);
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+/*
+ * Connected after the next advert of the device, uniform over its interval,
+ * and two connection events. Refusing devices never connect, the open is
+ * pending until cancelled with esp_ble_gap_disconnect().
+ */
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t gattc_if, esp_bd_addr_t remote_bda, bool is_direct) {
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    btc_msg_t msg;
+
+    pthread_mutex_lock(&btc_lock);
+    gatt_server_t *server = gatt_server_find(remote_bda, false);
+    for (int i = 0; i < GATT_LINKS; i++) {
+        gatt_link_t *link = &gatt_links[i];
+        if (link->state != LINK_FREE) {
+            continue;
+        }
+        link->state = LINK_INITIATING;
+        memcpy(link->bda, remote_bda, 6);
+        link->server = server;
+        link->discovered = false;
+        link->mtu = 23;
+        link->notified = 0;
+        ret = ESP_OK;
+        if (server == NULL || server->srv.refuse) {
+            // Pending until cancelled
+            break;
+        }
+        radio_rng = radio_rng * 1103515245 + 12345;
+        uint64_t wait_ns = (uint64_t)((radio_rng >> 8) % (server->srv.interval_ms * 1000 + 1)) * 1000;
+        gatt_msg(&msg, ESP_GATTC_OPEN_EVT, i);
+        msg.param.gattc.open.status = ESP_GATT_OK;
+        msg.param.gattc.open.mtu = 23;
+        ret = gatt_timer_add(i, wait_ns + 2 * CONN_INTERVAL_NS, &msg);
+        if (ret != ESP_OK) {
+            memset(link, 0, sizeof(*link));
+        }
+        break;
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+/*
+ * Disconnected on the next connection event
+ */
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t gattc_if, uint16_t conn_id) {
+    btc_msg_t msg;
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    pthread_mutex_lock(&btc_lock);
+    if (gatt_link_get(conn_id)) {
+        gatt_links[conn_id].state = LINK_CLOSING;
+        gatt_timer_cancel(conn_id);
+        gatt_msg(&msg, ESP_GATTC_DISCONNECT_EVT, conn_id);
+        gatt_timer_add(conn_id, CONN_INTERVAL_NS, &msg);
+        gatt_msg(&msg, ESP_GATTC_CLOSE_EVT, conn_id);
+        msg.param.gattc.close.status = ESP_GATT_OK;
+        ret = gatt_timer_add(conn_id, CONN_INTERVAL_NS, &msg);
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+/*
+ * Primary services found one per connection event, filter_uuid is ignored
+ */
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_bt_uuid_t *filter_uuid) {
+    btc_msg_t msg;
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    size_t i;
+
+    pthread_mutex_lock(&btc_lock);
+    gatt_link_t *link = gatt_link_get(conn_id);
+    if (link) {
+        uint16_t shift = link->server->srv.shift;
+        size_t n = 0;
+        for (i = 0; i < sizeof(gatt_services) / sizeof(gatt_services[0]); i++) {
+            if (gatt_services[i].uuid == GATT_STREAM_SERVICE && link->server->srv.notify_hz == 0) {
+                continue;
+            }
+            n++;
+            gatt_msg(&msg, ESP_GATTC_SEARCH_RES_EVT, conn_id);
+            msg.param.gattc.search_res.start_handle = gatt_services[i].start + shift;
+            msg.param.gattc.search_res.end_handle = gatt_services[i].end + shift;
+            msg.param.gattc.search_res.srvc_id.id.uuid.len = ESP_UUID_LEN_16;
+            msg.param.gattc.search_res.srvc_id.id.uuid.uuid.uuid16 = gatt_services[i].uuid;
+            msg.param.gattc.search_res.srvc_id.is_primary = true;
+            gatt_timer_add(conn_id, n * CONN_INTERVAL_NS, &msg);
+        }
+        gatt_msg(&msg, ESP_GATTC_SEARCH_CMPL_EVT, conn_id);
+        msg.param.gattc.search_cmpl.status = ESP_GATT_OK;
+        ret = gatt_timer_add(conn_id, n * CONN_INTERVAL_NS, &msg);
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_attr_count(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_gatt_db_attr_type_t type,
+                                               uint16_t start_handle, uint16_t end_handle, uint16_t char_handle,
+                                               uint16_t *count) {
+    *count = 0;
+    return ESP_GATT_NOT_FOUND;
+}
+
+/*
+ * From the discovered database: readable ones, and the stream one with its
+ * CCCD
+ */
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t start_handle,
+                                                 uint16_t end_handle, esp_bt_uuid_t char_uuid,
+                                                 esp_gattc_char_elem_t *result, uint16_t *count) {
+    esp_gatt_status_t status = ESP_GATT_NOT_FOUND;
+    uint16_t max = *count;
+
+    *count = 0;
+    pthread_mutex_lock(&btc_lock);
+    gatt_link_t *link = gatt_link_get(conn_id);
+    if (link && link->discovered && char_uuid.len == ESP_UUID_LEN_16) {
+        for (size_t i = 0; i < sizeof(gatt_chars) / sizeof(gatt_chars[0]) && *count < max; i++) {
+            uint16_t handle = gatt_chars[i].handle + link->server->srv.shift;
+            if ((gatt_chars[i].properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY) && link->server->srv.notify_hz == 0) {
+                continue;
+            }
+            if (gatt_chars[i].uuid == char_uuid.uuid.uuid16 && handle >= start_handle && handle <= end_handle) {
+                result[*count].char_handle = handle;
+                result[*count].properties = gatt_chars[i].properties;
+                result[*count].uuid = char_uuid;
+                (*count)++;
+                status = ESP_GATT_OK;
+            }
+        }
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return status;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(esp_gatt_if_t gattc_if, uint16_t conn_id,
+                                                         uint16_t char_handle, esp_bt_uuid_t descr_uuid,
+                                                         esp_gattc_descr_elem_t *result, uint16_t *count) {
+    esp_gatt_status_t status = ESP_GATT_NOT_FOUND;
+    uint16_t max = *count;
+
+    *count = 0;
+    pthread_mutex_lock(&btc_lock);
+    gatt_link_t *link = gatt_link_get(conn_id);
+    if (link && link->discovered && link->server->srv.notify_hz && max > 0 &&
+        char_handle == GATT_STREAM_CCCD - 1 + link->server->srv.shift &&
+        descr_uuid.len == ESP_UUID_LEN_16 && descr_uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG) {
+        result[0].handle = GATT_STREAM_CCCD + link->server->srv.shift;
+        result[0].uuid = descr_uuid;
+        *count = 1;
+        status = ESP_GATT_OK;
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return status;
+}
+
+/*
+ * Value on the next connection event, never from a stalling device. Reads by
+ * handle need no discovery, as with a GATT cache.
+ */
+esp_err_t esp_ble_gattc_read_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                  esp_gatt_auth_req_t auth_req) {
+    btc_msg_t msg;
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    pthread_mutex_lock(&btc_lock);
+    gatt_link_t *link = gatt_link_get(conn_id);
+    if (link) {
+        const host_gatt_server_t *srv = &link->server->srv;
+        gatt_msg(&msg, ESP_GATTC_READ_CHAR_EVT, conn_id);
+        msg.param.gattc.read.handle = handle;
+        msg.param.gattc.read.status = ESP_GATT_OK;
+        switch (handle - srv->shift) {
+        case 0x0C:
+            msg.value[0] = srv->battery;
+            msg.param.gattc.read.value_len = 1;
+            break;
+        case 0x0F:
+            msg.value[0] = (uint8_t)srv->temperature;
+            msg.value[1] = (uint8_t)((uint16_t)srv->temperature >> 8);
+            msg.param.gattc.read.value_len = 2;
+            break;
+        case 0x12:
+            msg.value[0] = (uint8_t)srv->humidity;
+            msg.value[1] = (uint8_t)(srv->humidity >> 8);
+            msg.param.gattc.read.value_len = 2;
+            break;
+        default:
+            msg.param.gattc.read.status = ESP_GATT_INVALID_HANDLE;
+            break;
+        }
+        ret = srv->stall ? ESP_OK : gatt_timer_add(conn_id, CONN_INTERVAL_NS, &msg);
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+/*
+ * Local registration, completed right away
+ */
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t gattc_if, esp_bd_addr_t server_bda, uint16_t handle) {
+    btc_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.gattc = true;
+    msg.gattc_event = ESP_GATTC_REG_FOR_NOTIFY_EVT;
+    msg.gattc_if = gattc_if;
+    msg.param.gattc.reg_for_notify.status = ESP_GATT_OK;
+    msg.param.gattc.reg_for_notify.handle = handle;
+    pthread_mutex_lock(&btc_lock);
+    esp_err_t ret = btc_post_locked(&msg);
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+/*
+ * Written on the next connection event. Only the stream CCCD exists, enabling
+ * it starts the notifications one period after the write.
+ */
+esp_err_t esp_ble_gattc_write_char_descr(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                         uint16_t value_len, uint8_t *value, esp_gatt_write_type_t write_type,
+                                         esp_gatt_auth_req_t auth_req) {
+    btc_msg_t msg;
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+    pthread_mutex_lock(&btc_lock);
+    gatt_link_t *link = gatt_link_get(conn_id);
+    if (link) {
+        const host_gatt_server_t *srv = &link->server->srv;
+        bool cccd = srv->notify_hz && handle == GATT_STREAM_CCCD + srv->shift && value_len == 2;
+        gatt_msg(&msg, ESP_GATTC_WRITE_DESCR_EVT, conn_id);
+        msg.param.gattc.write.handle = handle;
+        msg.param.gattc.write.status = cccd ? ESP_GATT_OK : ESP_GATT_INVALID_HANDLE;
+        ret = gatt_timer_add(conn_id, CONN_INTERVAL_NS, &msg);
+        if (ret == ESP_OK && cccd && (value[0] & 0x01)) {
+            gatt_msg(&msg, ESP_GATTC_NOTIFY_EVT, conn_id);
+            msg.param.gattc.notify.handle = handle - 1;
+            gatt_notify_value(&msg, link);
+            ret = gatt_timer_add(conn_id, CONN_INTERVAL_NS + 1000000000ull / srv->notify_hz, &msg);
+        }
+    }
+    pthread_mutex_unlock(&btc_lock);
+    return ret;
+}
+
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                   uint16_t value_len, uint8_t *value, esp_gatt_write_type_t write_type,
+                                   esp_gatt_auth_req_t auth_req) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
@@ -0,0 +1,324 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "host.h"
+#include "probe.h"
+#include "driver.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define SCAN_TOPIC      "/tracker/scan"     // As in main.c
+#define START_TIMEOUT_MS 5000
+#define TASKS_MAX       16
+#define CORES           2
+
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+#define WIRE_FORMAT     "binary"
+#else
+#define WIRE_FORMAT     "json"
+#endif
+
+/*
+ * CPU times of the threads, when the load starts and ends
+ */
+typedef struct {
+    uint64_t        ns;
+    uint64_t        self_ns;        // This thread
+    host_task_cpu_t tasks[TASKS_MAX];
+    size_t          task_count;
+} threads_snapshot_t;
+
+static threads_snapshot_t load_start, load_end;
+
+
+/*
+ * Block until the tracker scans, after a scan command too
+ */
+static bool wait_scanning(void) {
+    uint64_t deadline = host_time_ns() + (uint64_t)START_TIMEOUT_MS * 1000000;
+    while (!host_bt_scanning()) {
+        if (host_time_ns() > deadline) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+static void threads_snapshot(threads_snapshot_t *snap) {
+    snap->task_count = host_task_cpu(snap->tasks, TASKS_MAX);
+    snap->self_ns = host_thread_cpu_ns();
+    snap->ns = host_time_ns();
+}
+
+bool driver_start(const char *scan) {
+    app_main();
+    if (!wait_scanning()) {
+        fprintf(stderr, "The tracker did not start scanning\n");
+        return false;
+    }
+    if (scan) {
+        host_mqtt_inject(SCAN_TOPIC, scan, strlen(scan));
+        // The scanning task stops and restarts the scan with the new settings
+        vTaskDelay(100 / portTICK_PERIOD_MS);
+        if (!wait_scanning()) {
+            fprintf(stderr, "The tracker did not restart scanning\n");
+            return false;
+        }
+    }
+    threads_snapshot(&load_start);
+    return true;
+}
+
+bool driver_advert(driver_result_t *res, const adv_record_t *rec, uint64_t due_ns) {
+    uint64_t start = host_time_ns();
+    if (!host_bt_scan_result(rec->bda, rec->rssi, rec->dev_type, rec->data, rec->adv_data_len,
+                             rec->scan_rsp_len)) {
+        res->missed++;
+        return false;
+    }
+    probe_record(PROBE_GAP_CB, host_time_ns() - start);
+    res->delivered++;
+    if (due_ns && start > due_ns && start - due_ns > res->late_ns) {
+        res->late_ns = start - due_ns;
+    }
+    return true;
+}
+
+void driver_sleep_until(uint64_t ns) {
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000ull,
+        .tv_nsec = ns % 1000000000ull,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void driver_drain(uint32_t drain_ms) {
+    threads_snapshot(&load_end);
+    uint64_t deadline = host_time_ns() + (uint64_t)START_TIMEOUT_MS * 1000000;
+    while (!probe_idle() && host_time_ns() < deadline) {
+        vTaskDelay(1);
+    }
+    vTaskDelay(drain_ms / portTICK_PERIOD_MS);
+}
+
+double driver_cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * CPU share of each thread during the load, one per pipeline stage: the
+ * driver thread plays the controller and runs the GAP callback, the capture
+ * stage of core 0, the publisher task runs the rest of the pipeline on its core
+ * return: number of tasks, the driver thread excluded
+ */
+static size_t thread_shares(const host_task_cpu_t **tasks, double *shares, double *self, double *cores) {
+    double wall = load_end.ns - load_start.ns;
+
+    *tasks = load_end.tasks;
+    *self = (load_end.self_ns - load_start.self_ns) / wall;
+    memset(cores, 0, CORES * sizeof(*cores));
+    cores[0] = *self;
+    for (size_t i = 0; i < load_end.task_count; i++) {
+        // Tasks are listed in creation order, new ones last
+        uint64_t before = i < load_start.task_count ? load_start.tasks[i].cpu_ns : 0;
+        uint64_t after = load_end.tasks[i].cpu_ns;
+        shares[i] = after > before ? (after - before) / wall : 0;
+        if (load_end.tasks[i].core >= 0 && load_end.tasks[i].core < CORES) {
+            cores[load_end.tasks[i].core] += shares[i];
+        }
+    }
+    return load_end.task_count;
+}
+
+/*
+ * Mean duration of the finished jobs
+ */
+static double gatt_job_ms(const probe_counters_t *c) {
+    uint64_t jobs = c->gatt_read + c->gatt_failed + c->gatt_timeouts;
+    return jobs ? (double)c->gatt_busy_ms / jobs : 0.0;
+}
+
+static void report_text(const driver_result_t *res, const probe_counters_t *c, double cpu_s) {
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    printf("Adverts: %llu delivered (%.0f/s), %llu missed while not scanning, late by %.1f ms at most\n",
+           (unsigned long long)res->delivered, res->delivered / res->elapsed_s, (unsigned long long)res->missed,
+           res->late_ns / 1e6);
+    printf("Queue: %llu pushed, %llu processed (%.0f/s), dropped %llu newest %llu oldest, %llu coalesced, high water %u\n",
+           (unsigned long long)c->pushed, (unsigned long long)c->popped, c->popped / res->elapsed_s,
+           (unsigned long long)c->dropped_newest, (unsigned long long)c->dropped_oldest,
+           (unsigned long long)c->coalesced, c->high_water);
+    printf("Trackers: %llu adverts over the window table, %llu range and %llu presence evictions\n",
+           (unsigned long long)c->table_overflow, (unsigned long long)c->range_evicted,
+           (unsigned long long)c->presence_evicted);
+    printf("Published: %llu messages, %llu bytes (%.0f B/s), %llu advert messages with %llu records, " WIRE_FORMAT
+           " format\n",
+           (unsigned long long)c->messages, (unsigned long long)c->bytes, c->bytes / res->elapsed_s,
+           (unsigned long long)c->advert_messages, (unsigned long long)c->advert_records);
+    if (c->scannable || c->scan_responses) {
+        printf("Scan responses: %llu, merged %llu of %llu scannable adverts (%.1f%%), %llu expired %llu evicted "
+               "%llu orphans, %.1f ms/s on air\n",
+               (unsigned long long)c->scan_responses, (unsigned long long)c->merged,
+               (unsigned long long)c->scannable, c->scannable ? 100.0 * c->merged / c->scannable : 0.0,
+               (unsigned long long)c->rsp_expired, (unsigned long long)c->rsp_evicted,
+               (unsigned long long)c->rsp_orphans, c->rsp_airtime_us / 1e3 / res->elapsed_s);
+    }
+    if (c->gatt_tags) {
+        printf("GATT client: %llu tags, %.1f reads/min, %llu started %llu read %llu failed %llu timeouts "
+               "%llu deferred, %.0f ms per job, %llu missed adverts lost to connections\n",
+               (unsigned long long)c->gatt_tags, c->gatt_read * 60 / res->elapsed_s,
+               (unsigned long long)c->gatt_started, (unsigned long long)c->gatt_read,
+               (unsigned long long)c->gatt_failed, (unsigned long long)c->gatt_timeouts,
+               (unsigned long long)c->gatt_deferred, gatt_job_ms(c), (unsigned long long)c->radio_lost);
+        printf("GATT layouts: %llu jobs from the cache, %llu of them by model, %llu discovered, %llu invalidated\n",
+               (unsigned long long)c->gatt_cache_hits, (unsigned long long)c->gatt_cache_model,
+               (unsigned long long)c->gatt_cache_misses, (unsigned long long)c->gatt_cache_invalidated);
+    }
+    if (c->stream_received) {
+        printf("GATT streams: %llu connections, %llu notifications (%.0f/s), %llu batched %llu decimated "
+               "%llu dropped, %llu batches %llu bytes published, %llu bytes of buffers\n",
+               (unsigned long long)c->gatt_streams, (unsigned long long)c->stream_received,
+               c->stream_received / res->elapsed_s, (unsigned long long)c->stream_batched,
+               (unsigned long long)c->stream_decimated, (unsigned long long)c->stream_dropped,
+               (unsigned long long)c->stream_published, (unsigned long long)c->stream_bytes,
+               (unsigned long long)c->stream_memory);
+    }
+    if (c->time_requests) {
+        const probe_hist_t *h = probe_time_error();
+        printf("Fleet time: %llu requests %llu responses %llu rejected %llu steps, round trip %llu us at best, "
+               "drift %.2f ppm\n",
+               (unsigned long long)c->time_requests, (unsigned long long)c->time_responses,
+               (unsigned long long)c->time_rejected, (unsigned long long)c->time_steps,
+               (unsigned long long)c->time_rtt_min_us, c->time_drift_ppb / 1e3);
+        printf("Fleet time: %llu encodes stamped, error mean %.0f p99 %.0f max %.0f us, estimated %llu us, "
+               "%.1f%% within\n",
+               (unsigned long long)c->time_stamped, h->count ? h->sum_ns / 1e3 / h->count : 0.0,
+               probe_percentile(h, 0.99) / 1e3, h->max_ns / 1e3, (unsigned long long)c->time_error_us,
+               c->time_stamped ? 100.0 * c->time_within / c->time_stamped : 0.0);
+    }
+    printf("CPU: %.2f s, %.1f%% of one core\n", cpu_s, 100 * cpu_s / res->elapsed_s);
+
+    const host_task_cpu_t *tasks;
+    double shares[TASKS_MAX], self, cores[CORES];
+    size_t n = thread_shares(&tasks, shares, &self, cores);
+    printf("\n%-15s %4s %6s\n", "thread", "core", "cpu %");
+    printf("%-15s %4s %6.1f\n", "driver", "0", 100 * self);
+    for (size_t i = 0; i < n; i++) {
+        char core[8] = "-";
+        if (tasks[i].core >= 0 && tasks[i].core < CORES) {
+            snprintf(core, sizeof(core), "%d", tasks[i].core);
+        }
+        printf("%-15s %4s %6.1f\n", tasks[i].name, core, 100 * shares[i]);
+    }
+    printf("Cores: 0 %.1f%%, 1 %.1f%%, end to end %.0f adverts/s in, %.0f records/s out\n",
+           100 * cores[0], 100 * cores[1], res->delivered / res->elapsed_s, c->advert_records / res->elapsed_s);
+    printf("\n%-11s %10s %10s %10s %10s %10s %10s %10s\n", "stage (us)", "count", "mean", "p50", "p90", "p99",
+           "p99.9", "max");
+    for (int s = 0; s < PROBE_STAGES; s++) {
+        const probe_hist_t *h = probe_hist(s);
+        printf("%-11s %10llu %10.2f", probe_stage_name(s), (unsigned long long)h->count,
+               h->count ? h->sum_ns / 1e3 / h->count : 0.0);
+        for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+            printf(" %10.2f", probe_percentile(h, qs[i]) / 1e3);
+        }
+        printf(" %10.2f\n", h->max_ns / 1e3);
+    }
+}
+
+static void report_json(const driver_result_t *res, const probe_counters_t *c, double cpu_s) {
+    printf("\"duration_s\":%.3f,\"format\":\"%s\",", res->elapsed_s, WIRE_FORMAT);
+    printf("\"delivered\":%llu,\"delivered_per_s\":%.1f,\"missed\":%llu,\"late_ms\":%.3f,",
+           (unsigned long long)res->delivered, res->delivered / res->elapsed_s, (unsigned long long)res->missed,
+           res->late_ns / 1e6);
+    printf("\"pushed\":%llu,\"processed\":%llu,\"processed_per_s\":%.1f,\"dropped_newest\":%llu,"
+           "\"dropped_oldest\":%llu,\"coalesced\":%llu,\"high_water\":%u,",
+           (unsigned long long)c->pushed, (unsigned long long)c->popped, c->popped / res->elapsed_s,
+           (unsigned long long)c->dropped_newest, (unsigned long long)c->dropped_oldest,
+           (unsigned long long)c->coalesced, c->high_water);
+    printf("\"table_overflow\":%llu,\"range_evicted\":%llu,\"presence_evicted\":%llu,",
+           (unsigned long long)c->table_overflow, (unsigned long long)c->range_evicted,
+           (unsigned long long)c->presence_evicted);
+    printf("\"scannable\":%llu,\"scan_responses\":%llu,\"merged\":%llu,\"rsp_expired\":%llu,"
+           "\"rsp_evicted\":%llu,\"rsp_orphans\":%llu,\"rsp_airtime_ms_per_s\":%.3f,",
+           (unsigned long long)c->scannable, (unsigned long long)c->scan_responses, (unsigned long long)c->merged,
+           (unsigned long long)c->rsp_expired, (unsigned long long)c->rsp_evicted,
+           (unsigned long long)c->rsp_orphans, c->rsp_airtime_us / 1e3 / res->elapsed_s);
+    if (c->gatt_tags) {
+        printf("\"gatt_tags\":%llu,\"gatt_reads_per_min\":%.1f,\"gatt_started\":%llu,\"gatt_read\":%llu,"
+               "\"gatt_failed\":%llu,\"gatt_timeouts\":%llu,\"gatt_deferred\":%llu,\"gatt_job_ms\":%.1f,"
+               "\"radio_lost\":%llu,\"gatt_cache_hits\":%llu,\"gatt_cache_model\":%llu,\"gatt_cache_misses\":%llu,"
+               "\"gatt_cache_invalidated\":%llu,",
+               (unsigned long long)c->gatt_tags, c->gatt_read * 60 / res->elapsed_s,
+               (unsigned long long)c->gatt_started, (unsigned long long)c->gatt_read,
+               (unsigned long long)c->gatt_failed, (unsigned long long)c->gatt_timeouts,
+               (unsigned long long)c->gatt_deferred, gatt_job_ms(c), (unsigned long long)c->radio_lost,
+               (unsigned long long)c->gatt_cache_hits, (unsigned long long)c->gatt_cache_model,
+               (unsigned long long)c->gatt_cache_misses, (unsigned long long)c->gatt_cache_invalidated);
+    }
+    if (c->stream_received) {
+        printf("\"gatt_streams\":%llu,\"stream_received\":%llu,\"stream_per_s\":%.1f,\"stream_batched\":%llu,"
+               "\"stream_decimated\":%llu,\"stream_dropped\":%llu,\"stream_published\":%llu,"
+               "\"stream_bytes\":%llu,\"stream_memory\":%llu,",
+               (unsigned long long)c->gatt_streams, (unsigned long long)c->stream_received,
+               c->stream_received / res->elapsed_s, (unsigned long long)c->stream_batched,
+               (unsigned long long)c->stream_decimated, (unsigned long long)c->stream_dropped,
+               (unsigned long long)c->stream_published, (unsigned long long)c->stream_bytes,
+               (unsigned long long)c->stream_memory);
+    }
+    if (c->time_requests) {
+        const probe_hist_t *h = probe_time_error();
+        printf("\"time_requests\":%llu,\"time_responses\":%llu,\"time_rejected\":%llu,\"time_steps\":%llu,"
+               "\"time_rtt_min_us\":%llu,\"time_drift_ppb\":%lld,\"time_stamped\":%llu,\"time_error_mean_us\":%.1f,"
+               "\"time_error_p99_us\":%.1f,\"time_error_max_us\":%.1f,\"time_error_estimate_us\":%llu,"
+               "\"time_within\":%llu,",
+               (unsigned long long)c->time_requests, (unsigned long long)c->time_responses,
+               (unsigned long long)c->time_rejected, (unsigned long long)c->time_steps,
+               (unsigned long long)c->time_rtt_min_us, (long long)c->time_drift_ppb,
+               (unsigned long long)c->time_stamped, h->count ? h->sum_ns / 1e3 / h->count : 0.0,
+               probe_percentile(h, 0.99) / 1e3, h->max_ns / 1e3, (unsigned long long)c->time_error_us,
+               (unsigned long long)c->time_within);
+    }
+    printf("\"messages\":%llu,\"bytes\":%llu,\"advert_messages\":%llu,\"advert_records\":%llu,\"cpu_s\":%.3f,",
+           (unsigned long long)c->messages, (unsigned long long)c->bytes,
+           (unsigned long long)c->advert_messages, (unsigned long long)c->advert_records, cpu_s);
+    const host_task_cpu_t *tasks;
+    double shares[TASKS_MAX], self, cores[CORES];
+    size_t n = thread_shares(&tasks, shares, &self, cores);
+    printf("\"threads\":[{\"name\":\"driver\",\"core\":0,\"cpu\":%.4f}", self);
+    for (size_t i = 0; i < n; i++) {
+        bool pinned = tasks[i].core >= 0 && tasks[i].core < CORES;
+        printf(",{\"name\":\"%s\",\"core\":%d,\"cpu\":%.4f}", tasks[i].name, pinned ? tasks[i].core : -1,
+               shares[i]);
+    }
+    printf("],\"cores\":[%.4f,%.4f],\"records_per_s\":%.1f,", cores[0], cores[1],
+           c->advert_records / res->elapsed_s);
+    printf("\"stages_us\":{");
+    for (int s = 0; s < PROBE_STAGES; s++) {
+        const probe_hist_t *h = probe_hist(s);
+        printf("%s\"%s\":{\"count\":%llu,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,"
+               "\"max\":%.3f}",
+               s ? "," : "", probe_stage_name(s), (unsigned long long)h->count,
+               h->count ? h->sum_ns / 1e3 / h->count : 0.0, probe_percentile(h, 0.5) / 1e3,
+               probe_percentile(h, 0.9) / 1e3, probe_percentile(h, 0.99) / 1e3,
+               probe_percentile(h, 0.999) / 1e3, h->max_ns / 1e3);
+    }
+    printf("}}\n");
+}
+
+void driver_report(const driver_result_t *res, double cpu_s, bool json) {
+    probe_counters_t counters;
+
+    probe_get(&counters);
+    if (json) {
+        report_json(res, &counters, cpu_s);
+    } else {
+        report_text(res, &counters, cpu_s);
+    }
+}
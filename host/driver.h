@@ -0,0 +1,57 @@
+#ifndef __DRIVER_H__
+#define __DRIVER_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+
+/*
+ * Run loop shared by the load generator and the capture replay tool: start the
+ * tracker, feed it adverts, drain and report what the probes saw
+ */
+
+typedef struct {
+    uint64_t delivered;
+    uint64_t missed;                // Not scanning
+    uint64_t late_ns;               // Worst delivery delay behind schedule
+    double   elapsed_s;
+} driver_result_t;
+
+/*
+ * Run app_main() and wait for the scan, then apply a scan command if any, as
+ * published on /tracker/scan
+ * return: false if the tracker does not scan
+ */
+bool driver_start(const char *scan);
+
+/*
+ * Deliver one advert as a scan result, time it and account it in res
+ * due_ns: scheduled delivery time, 0 when there is no schedule
+ */
+bool driver_advert(driver_result_t *res, const adv_record_t *rec, uint64_t due_ns);
+
+/*
+ * Sleep until host_time_ns() reaches ns
+ */
+void driver_sleep_until(uint64_t ns);
+
+/*
+ * End of the load: wait for the queue to drain, then drain_ms for the last
+ * windows
+ */
+void driver_drain(uint32_t drain_ms);
+
+/*
+ * Process CPU time, user and system, in seconds
+ */
+double driver_cpu_seconds(void);
+
+/*
+ * Counters, CPU share of each thread during the load and stage percentiles,
+ * after a first line or the first JSON fields printed by the caller; the JSON
+ * object is closed
+ */
+void driver_report(const driver_result_t *res, double cpu_s, bool json);
+
+#endif
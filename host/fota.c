@@ -0,0 +1,21 @@
+#include "esp_log.h"
+#include "fota.h"
+
+/*
+ * Firmware updates need the OTA partitions, the host build rejects every
+ * request. Replaces main/fota.c, the download of main/fota_http.c is tested
+ * on its own by test_fota_http.c.
+ */
+
+#define TAG_FOTA "FOTA"
+
+
+bool fota_update(const char *request, size_t len, fota_progress_cb_t progress) {
+    ESP_LOGW(TAG_FOTA, "Firmware update not supported on the host");
+    return false;
+}
+
+const char *fota_state_name(fota_state_t state) {
+    static const char *const names[] = { "start", "progress", "done", "failed" };
+    return (unsigned)state < sizeof(names) / sizeof(names[0]) ? names[state] : "unknown";
+}
@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "host.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+
+/*
+ * FreeRTOS on pthreads: a task is a thread with its own notification counter,
+ * blocking calls are condition variable waits on CLOCK_MONOTONIC. Threads are
+ * left joinable so the CPU clock of a task can be read, see host_task_cpu().
+ */
+
+struct host_task {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    uint32_t        notify;
+    UBaseType_t     priority;
+    BaseType_t      core;
+    char            name[16];
+    TaskFunction_t  fn;
+    void           *param;
+    struct host_task *next;         // Created tasks, newest first
+};
+
+struct host_event_group {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    EventBits_t     bits;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    uint32_t        length;
+    uint32_t        item_size;
+    uint32_t        head;
+    uint32_t        count;
+    uint8_t        *items;
+};
+
+static __thread struct host_task *current_task = NULL;
+static struct host_task *tasks = NULL;
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+uint64_t host_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t boot_ns(void) {
+    static uint64_t boot = 0;
+    if (boot == 0) {
+        boot = host_time_ns();
+    }
+    return boot;
+}
+
+/*
+ * Start the tick counter, before any other thread exists
+ */
+__attribute__((constructor)) static void host_tick_init(void) {
+    boot_ns();
+}
+
+static void cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/*
+ * Wait on cond with the mutex held, forever if deadline is NULL
+ * return: false on timeout
+ */
+static bool cond_wait_ticks(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline) {
+    if (deadline == NULL) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+/*
+ * return: absolute deadline in *ts, NULL for portMAX_DELAY
+ */
+static const struct timespec *deadline_ticks(TickType_t ticks, struct timespec *ts) {
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+    uint64_t ns = host_time_ns() + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ull;
+    ts->tv_sec = ns / 1000000000ull;
+    ts->tv_nsec = ns % 1000000000ull;
+    return ts;
+}
+
+static struct host_task *task_alloc(const char *name, TaskFunction_t fn, void *param, UBaseType_t priority) {
+    struct host_task *task = calloc(1, sizeof(*task));
+    if (task == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->cond);
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->fn = fn;
+    task->param = param;
+    task->priority = priority;
+    task->core = tskNO_AFFINITY;
+    return task;
+}
+
+static void *task_entry(void *arg) {
+    struct host_task *task = arg;
+    current_task = task;
+    task->fn(task->param);
+    // A FreeRTOS task must not return, tolerate it
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+    pthread_attr_t attr;
+    struct host_task *task = task_alloc(name, fn, param, priority);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    if (handle) {
+        *handle = task;
+    }
+    task->core = core;
+    pthread_attr_init(&attr);
+    int rc = pthread_create(&task->thread, &attr, task_entry, task);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        if (handle) {
+            *handle = NULL;
+        }
+        free(task);
+        return pdFAIL;
+    }
+    // Thread names are limited to 15 characters, as FreeRTOS ones
+    pthread_setname_np(task->thread, task->name);
+    pthread_mutex_lock(&tasks_lock);
+    task->next = tasks;
+    tasks = task;
+    pthread_mutex_unlock(&tasks_lock);
+    return pdPASS;
+}
+
+static uint64_t thread_cpu_ns(pthread_t thread) {
+    clockid_t clock;
+    struct timespec ts;
+    // Fails once the thread has exited
+    if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+size_t host_task_cpu(host_task_cpu_t *out, size_t max) {
+    size_t n = 0;
+
+    pthread_mutex_lock(&tasks_lock);
+    for (struct host_task *task = tasks; task != NULL; task = task->next) {
+        n++;
+    }
+    // Creation order
+    size_t i = n;
+    for (struct host_task *task = tasks; task != NULL; task = task->next) {
+        if (--i < max) {
+            memcpy(out[i].name, task->name, sizeof(out[i].name));
+            out[i].core = task->core;
+            out[i].cpu_ns = thread_cpu_ns(task->thread);
+        }
+    }
+    pthread_mutex_unlock(&tasks_lock);
+    return n < max ? n : max;
+}
+
+uint64_t host_thread_cpu_ns(void) {
+    return thread_cpu_ns(pthread_self());
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle) {
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL || task == current_task) {
+        pthread_exit(NULL);
+    }
+    // Deleting another task is not used by main/
+    ESP_LOGE("HOST", "vTaskDelete of another task is not supported");
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (current_task == NULL) {
+        // Threads not created by xTaskCreate, e.g. main() or the load generator
+        current_task = task_alloc("host", NULL, NULL, 1);
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)((host_time_ns() - boot_ns()) / (portTICK_PERIOD_MS * 1000000ull));
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec ts = {
+        .tv_sec = ticks * portTICK_PERIOD_MS / 1000,
+        .tv_nsec = (long)(ticks * portTICK_PERIOD_MS % 1000) * 1000000,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period) {
+    TickType_t now = xTaskGetTickCount();
+    *previous_wake += period;
+    if ((int32_t)(*previous_wake - now) > 0) {
+        vTaskDelay(*previous_wake - now);
+    }
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    task->priority = priority;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    return task->priority;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    // Host stacks are megabytes, nothing meaningful to report
+    return 0;
+}
+
+char *pcTaskGetTaskName(TaskHandle_t task) {
+    if (task == NULL) {
+        task = xTaskGetCurrentTaskHandle();
+    }
+    return task->name;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void) {
+    // No meaningful heap limit on the host
+    return UINT32_MAX;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec ts;
+    const struct timespec *deadline = deadline_ticks(ticks, &ts);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify == 0 && ticks != 0) {
+        if (!cond_wait_ticks(&task->cond, &task->lock, deadline)) {
+            break;
+        }
+    }
+    value = task->notify;
+    if (value) {
+        task->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+int xPortGetCoreID(void) {
+    return 0;
+}
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    struct host_event_group *group = calloc(1, sizeof(*group));
+    if (group == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&group->lock, NULL);
+    cond_init(&group->cond);
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t value = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->lock);
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    return __atomic_load_n(&group->bits, __ATOMIC_RELAXED);
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+    struct timespec ts;
+    const struct timespec *deadline = deadline_ticks(ticks, &ts);
+    EventBits_t value;
+
+    pthread_mutex_lock(&group->lock);
+    for (;;) {
+        value = group->bits;
+        if (wait_for_all ? (value & bits) == bits : (value & bits) != 0) {
+            if (clear_on_exit) {
+                group->bits &= ~bits;
+            }
+            break;
+        }
+        if (ticks == 0 || !cond_wait_ticks(&group->cond, &group->lock, deadline)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->items = malloc((size_t)length * item_size);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init(&queue->not_empty);
+    cond_init(&queue->not_full);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    struct timespec ts;
+    const struct timespec *deadline = deadline_ticks(ticks, &ts);
+    BaseType_t ret = pdFAIL;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length && ticks != 0) {
+        if (!cond_wait_ticks(&queue->not_full, &queue->lock, deadline)) {
+            break;
+        }
+    }
+    if (queue->count < queue->length) {
+        uint32_t pos = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + (size_t)pos * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        ret = pdPASS;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    struct timespec ts;
+    const struct timespec *deadline = deadline_ticks(ticks, &ts);
+    BaseType_t ret = pdFAIL;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && ticks != 0) {
+        if (!cond_wait_ticks(&queue->not_empty, &queue->lock, deadline)) {
+            break;
+        }
+    }
+    if (queue->count > 0) {
+        memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        ret = pdPASS;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
@@ -0,0 +1,159 @@
+#ifndef __HOST_H__
+#define __HOST_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "idf_host.h"
+
+/*
+ * Glue between the IDF shims, the probes and the load generator of the host build
+ */
+
+/*
+ * Monotonic clock, nanoseconds
+ */
+uint64_t host_time_ns(void);
+
+/*
+ * CPU time of a FreeRTOS task thread
+ * core: the task is pinned to, tskNO_AFFINITY if none
+ */
+typedef struct {
+    char     name[16];
+    int      core;
+    uint64_t cpu_ns;
+} host_task_cpu_t;
+
+/*
+ * CPU time of each task created so far, in creation order, 0 once exited
+ * return: number of tasks filled in, max at most
+ */
+size_t host_task_cpu(host_task_cpu_t *tasks, size_t max);
+
+/*
+ * CPU time of the calling thread, nanoseconds
+ */
+uint64_t host_thread_cpu_ns(void);
+
+/*
+ * Log level of every tag, ESP_LOG_WARN by default
+ */
+void host_log_level(esp_log_level_t level);
+
+/*
+ * Entry point of main/main.c
+ */
+void app_main(void);
+
+/*
+ * Controller side of the GAP shim
+ * Deliver one advertising report to the GAP callback, in the calling thread,
+ * serialized with the other Bluedroid events. A device with a scan response
+ * is scannable: with active scanning, its response follows in a second report.
+ * dev_type: esp_bt_dev_type_t, ESP_BT_DEVICE_TYPE_BLE for beacons
+ * data: advertising data followed by the scan response
+ * return: false if the tracker is not scanning, or not listening with scan
+ * windows, the advert is then not delivered
+ */
+bool host_bt_scan_result(const uint8_t *bda, int8_t rssi, uint8_t dev_type, const uint8_t *data,
+                         uint8_t adv_data_len, uint8_t scan_rsp_len);
+
+/*
+ * Only deliver adverts within the HCI scan window of each scan interval,
+ * as a controller does, instead of all of them while scanning
+ */
+void host_bt_scan_windows(bool on);
+
+/*
+ * Share of the scan responses lost with active scanning, percent
+ */
+void host_bt_scan_rsp_loss(uint32_t percent);
+
+/*
+ * true once the tracker has started scanning
+ */
+bool host_bt_scanning(void);
+
+/*
+ * GATT server of a device, read by the tracker GATT client
+ * refuse: connections never complete, stall: reads are never answered
+ * interval_ms: advertising interval, the connection waits for an advert
+ * shift: added to every attribute handle, another firmware of the model
+ * notify_hz: with a stream service notifying notify_len bytes at that rate,
+ * within the MTU, once enabled
+ */
+typedef struct {
+    uint8_t  battery;               // %
+    int16_t  temperature;           // 0.01 C
+    uint16_t humidity;              // 0.01 %
+    bool     refuse;
+    bool     stall;
+    uint32_t interval_ms;
+    uint16_t shift;
+    uint32_t notify_hz;             // 0: no stream service
+    uint16_t notify_len;
+} host_gatt_server_t;
+
+/*
+ * Register or update the server of a device, its adverts are then reported
+ * connectable
+ * return: false if the registry is full
+ */
+bool host_bt_gatt_server(const uint8_t *bda, const host_gatt_server_t *srv);
+
+/*
+ * Adverts missed while the radio was initiating or serving connections
+ */
+uint64_t host_bt_radio_lost(void);
+
+/*
+ * Broker side of the MQTT shim
+ * Deliver a message to the tracker subscriptions, from the MQTT task
+ */
+void host_mqtt_inject(const char *topic, const char *data, size_t len);
+
+/*
+ * Simulated cost of mqtt_publish(), busy waited in the publishing task
+ */
+void host_mqtt_publish_cost(uint32_t us);
+
+/*
+ * Append the payload of the messages published on topic, or below it, to out
+ * e.g. /tracker/capture to save a capture file
+ */
+void host_mqtt_save(const char *topic, FILE *out);
+
+/*
+ * Fleet time server behind the broker shim, answering the time requests of the
+ * tracker, see main/time_sync.h. Its clock runs drift_ppb faster than the host
+ * monotonic clock, that of the tracker. Each way between the tracker and the
+ * server takes delay_us plus an exponential jitter of mean jitter_us.
+ */
+typedef struct {
+    int64_t  epoch_us;              // Fleet time at host time 0
+    int32_t  drift_ppb;
+    uint32_t delay_us;
+    uint32_t jitter_us;
+} host_time_server_t;
+
+/*
+ * Start answering the time requests, NULL to stop
+ */
+void host_mqtt_time_server(const host_time_server_t *srv);
+
+/*
+ * Fleet time at a host time, esp_timer_get_time(), the truth estimated by the
+ * tracker
+ */
+int64_t host_fleet_time(int64_t local_us);
+
+/*
+ * Called by the MQTT shim for each published message
+ * start_ns, end_ns: around the simulated transmission
+ */
+void probe_publish(const char *topic, size_t len, uint64_t start_ns, uint64_t end_ns);
+
+#endif
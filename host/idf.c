@@ -0,0 +1,531 @@
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include "host.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "esp_partition.h"
+#include "esp_wifi.h"
+#include "esp_event_loop.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#define TAG_HOST "HOST"
+#define NVS_NAMESPACES  8
+#define NVS_BLOBS       16
+#define NVS_NAME_LEN    16      // 15 characters and '\0', as NVS
+
+// Address reported by SYSTEM_EVENT_STA_GOT_IP, 192.168.1.42 in network order
+#define HOST_IP_ADDR ((uint32_t)42 << 24 | (uint32_t)1 << 16 | (uint32_t)168 << 8 | 192)
+
+/*
+ * Partitions of partitions.csv used by main/
+ */
+typedef struct {
+    esp_partition_t partition;
+    uint8_t        *data;       // Allocated and erased on first use
+} host_partition_t;
+
+static host_partition_t partitions[] = {
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = 0x40, .address = 0x310000,
+                     .size = 512 * 1024, .label = "advlog" } },
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = 0x41, .address = 0x390000,
+                     .size = 448 * 1024, .label = "capture" } },
+};
+
+// NVS blobs, handle = namespace index + 1
+typedef struct {
+    uint8_t namespace;
+    char    key[NVS_NAME_LEN];
+    void   *data;               // NULL when free
+    size_t  len;
+} host_blob_t;
+
+static char nvs_namespaces[NVS_NAMESPACES][NVS_NAME_LEN];
+static host_blob_t nvs_blobs[NVS_BLOBS];
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static esp_log_level_t log_level = ESP_LOG_WARN;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static system_event_cb_t event_cb = NULL;
+static void *event_ctx = NULL;
+static QueueHandle_t event_queue = NULL;
+
+
+void host_error_check_failed(esp_err_t rc, const char *file, int line, const char *expr) {
+    fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x at %s:%d\nexpression: %s\n", rc, file, line, expr);
+    abort();
+}
+
+void host_log_level(esp_log_level_t level) {
+    log_level = level;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    log_level = level;
+}
+
+uint32_t esp_log_timestamp(void) {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    va_list args;
+    if (level > log_level) {
+        return;
+    }
+    va_start(args, format);
+    pthread_mutex_lock(&log_lock);
+    vfprintf(stderr, format, args);
+    pthread_mutex_unlock(&log_lock);
+    va_end(args);
+}
+
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t buff_len) {
+    const uint8_t *data = buffer;
+    char line[16 * 3 + 1];
+
+    for (uint16_t i = 0; i < buff_len; i += 16) {
+        size_t pos = 0;
+        for (uint16_t j = i; j < buff_len && j < i + 16; j++) {
+            pos += snprintf(line + pos, sizeof(line) - pos, "%02x ", data[j]);
+        }
+        ESP_LOGI(tag, "%s", line);
+    }
+}
+
+void esp_restart(void) {
+    ESP_LOGW(TAG_HOST, "Restart requested, exiting");
+    exit(0);
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    // No meaningful heap limit on the host
+    return UINT32_MAX;
+}
+
+int64_t esp_timer_get_time(void) {
+    return (int64_t)(host_time_ns() / 1000);
+}
+
+char *itoa(int value, char *str, int radix) {
+    char digits[sizeof(int) * 8 + 1];
+    unsigned int v = (value < 0 && radix == 10) ? -(unsigned int)value : (unsigned int)value;
+    size_t n = 0;
+    char *out = str;
+
+    do {
+        unsigned int d = v % radix;
+        digits[n++] = d < 10 ? '0' + d : 'a' + d - 10;
+        v /= radix;
+    } while (v);
+    if (value < 0 && radix == 10) {
+        *out++ = '-';
+    }
+    while (n) {
+        *out++ = digits[--n];
+    }
+    *out = '\0';
+    return str;
+}
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    pthread_mutex_lock(&nvs_lock);
+    for (int i = 0; i < NVS_BLOBS; i++) {
+        free(nvs_blobs[i].data);
+    }
+    memset(nvs_blobs, 0, sizeof(nvs_blobs));
+    memset(nvs_namespaces, 0, sizeof(nvs_namespaces));
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle) {
+    esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+
+    if (strlen(name) >= NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&nvs_lock);
+    for (int i = 0; i < NVS_NAMESPACES; i++) {
+        if (strcmp(nvs_namespaces[i], name) == 0 ||
+            (nvs_namespaces[i][0] == '\0' && open_mode == NVS_READWRITE)) {
+            // Created on the first read-write open, as NVS
+            strcpy(nvs_namespaces[i], name);
+            *out_handle = i + 1;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+void nvs_close(nvs_handle handle) {
+}
+
+/*
+ * Blob of a key, nvs_lock held
+ */
+static host_blob_t *nvs_blob(nvs_handle handle, const char *key) {
+    for (int i = 0; i < NVS_BLOBS; i++) {
+        if (nvs_blobs[i].data && nvs_blobs[i].namespace == handle && strcmp(nvs_blobs[i].key, key) == 0) {
+            return &nvs_blobs[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length) {
+    esp_err_t ret = ESP_OK;
+
+    pthread_mutex_lock(&nvs_lock);
+    host_blob_t *blob = nvs_blob(handle, key);
+    if (blob == NULL) {
+        ret = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out_value == NULL) {
+        *length = blob->len;
+    } else if (*length < blob->len) {
+        ret = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, blob->data, blob->len);
+        *length = blob->len;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ret;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length) {
+    esp_err_t ret = ESP_ERR_NVS_NO_FREE_PAGES;
+    void *data;
+
+    if (strlen(key) >= NVS_NAME_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    data = malloc(length ? length : 1);
+    if (data == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(data, value, length);
+    pthread_mutex_lock(&nvs_lock);
+    host_blob_t *blob = nvs_blob(handle, key);
+    for (int i = 0; blob == NULL && i < NVS_BLOBS; i++) {
+        if (nvs_blobs[i].data == NULL) {
+            blob = &nvs_blobs[i];
+            blob->namespace = handle;
+            strcpy(blob->key, key);
+        }
+    }
+    if (blob) {
+        free(blob->data);
+        blob->data = data;
+        blob->len = length;
+        data = NULL;
+        ret = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    free(data);
+    return ret;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) {
+    return ESP_OK;
+}
+
+/*
+ * Partitions
+ */
+static host_partition_t *partition_get(const esp_partition_t *partition) {
+    host_partition_t *p = (host_partition_t *)partition;
+    if (p->data == NULL) {
+        p->data = malloc(p->partition.size);
+        if (p->data == NULL) {
+            return NULL;
+        }
+        memset(p->data, 0xFF, p->partition.size);
+    }
+    return p;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    for (size_t i = 0; i < sizeof(partitions) / sizeof(partitions[0]); i++) {
+        const esp_partition_t *p = &partitions[i].partition;
+        if (p->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || p->subtype == subtype) &&
+            (label == NULL || strcmp(p->label, label) == 0)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    host_partition_t *p = partition_get(partition);
+    if (p == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (src_offset > partition->size || size > partition->size - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, p->data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    host_partition_t *p = partition_get(partition);
+    const uint8_t *data = src;
+    if (p == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (dst_offset > partition->size || size > partition->size - dst_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    // NOR flash, programming only clears bits
+    for (size_t i = 0; i < size; i++) {
+        p->data[dst_offset + i] &= data[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, uint32_t start_addr, uint32_t size) {
+    host_partition_t *p = partition_get(partition);
+    if (p == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (start_addr % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (start_addr > partition->size || size > partition->size - start_addr) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(p->data + start_addr, 0xFF, size);
+    return ESP_OK;
+}
+
+/*
+ * SHA-256, FIPS 180-4, SHA-224 is not used by main/
+ */
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t ror32(uint32_t x, int n) {
+    return x >> n | x << (32 - n);
+}
+
+static void sha256_block(mbedtls_sha256_context *ctx, const unsigned char *block) {
+    uint32_t w[64], s[8];
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+               (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    memcpy(s, ctx->state, sizeof(s));
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = s[7] + (ror32(s[4], 6) ^ ror32(s[4], 11) ^ ror32(s[4], 25)) +
+                      ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+        uint32_t t2 = (ror32(s[0], 2) ^ ror32(s[0], 13) ^ ror32(s[0], 22)) +
+                      ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(&s[1], &s[0], 7 * sizeof(s[0]));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int i = 0; i < 8; i++) {
+        ctx->state[i] += s[i];
+    }
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224) {
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memset(ctx, 0, sizeof(*ctx));
+    memcpy(ctx->state, init, sizeof(init));
+}
+
+void mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen) {
+    size_t fill = ctx->total[0] & 63;
+
+    // total[0] counts bytes modulo 2^32, total[1] the carries
+    if ((ctx->total[0] += (uint32_t)ilen) < ilen) {
+        ctx->total[1]++;
+    }
+    if (fill && fill + ilen >= 64) {
+        memcpy(&ctx->buffer[fill], input, 64 - fill);
+        sha256_block(ctx, ctx->buffer);
+        input += 64 - fill;
+        ilen -= 64 - fill;
+        fill = 0;
+    }
+    for (; ilen >= 64; input += 64, ilen -= 64) {
+        sha256_block(ctx, input);
+    }
+    memcpy(&ctx->buffer[fill], input, ilen);
+}
+
+void mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32]) {
+    uint64_t bits = ((uint64_t)ctx->total[1] << 32 | ctx->total[0]) << 3;
+    size_t fill = ctx->total[0] & 63;
+    unsigned char pad[72];
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    size_t n = (fill < 56 ? 56 : 120) - fill;
+    for (int i = 0; i < 8; i++) {
+        pad[n + i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+    mbedtls_sha256_update(ctx, pad, n + 8);
+    for (int i = 0; i < 8; i++) {
+        output[4 * i] = (unsigned char)(ctx->state[i] >> 24);
+        output[4 * i + 1] = (unsigned char)(ctx->state[i] >> 16);
+        output[4 * i + 2] = (unsigned char)(ctx->state[i] >> 8);
+        output[4 * i + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+/*
+ * tinfl on zlib raw inflate, allocating from the arena of the decompressor
+ */
+static voidpf tinfl_alloc(voidpf opaque, uInt items, uInt size) {
+    tinfl_decompressor *r = opaque;
+    size_t len = ((size_t)items * size + 15) & ~(size_t)15;
+    if (len > sizeof(r->arena) - r->arena_used) {
+        return Z_NULL;
+    }
+    void *p = &r->arena[r->arena_used];
+    r->arena_used += len;
+    return p;
+}
+
+static void tinfl_release(voidpf opaque, voidpf address) {
+}
+
+void tinfl_init(tinfl_decompressor *r) {
+    memset(&r->stream, 0, sizeof(r->stream));
+    r->stream.zalloc = tinfl_alloc;
+    r->stream.zfree = tinfl_release;
+    r->stream.opaque = r;
+    r->arena_used = 0;
+    r->ready = inflateInit2(&r->stream, -15) == Z_OK;
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size,
+                              mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags) {
+    size_t in_len = *pIn_buf_size, out_len = *pOut_buf_size;
+
+    *pIn_buf_size = 0;
+    *pOut_buf_size = 0;
+    if (!r->ready || in_len > UINT_MAX || out_len > UINT_MAX) {
+        return TINFL_STATUS_BAD_PARAM;
+    }
+    r->stream.next_in = (Bytef *)pIn_buf_next;
+    r->stream.avail_in = (uInt)in_len;
+    r->stream.next_out = pOut_buf_next;
+    r->stream.avail_out = (uInt)out_len;
+    int ret = inflate(&r->stream, Z_NO_FLUSH);
+    *pIn_buf_size = in_len - r->stream.avail_in;
+    *pOut_buf_size = out_len - r->stream.avail_out;
+    if (ret == Z_STREAM_END) {
+        return TINFL_STATUS_DONE;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        return TINFL_STATUS_FAILED;
+    }
+    if (r->stream.avail_out == 0) {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    // All input taken, the stream goes on
+    return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED;
+}
+
+/*
+ * WiFi station, always connected
+ * Events are delivered by the event loop task, as in IDF.
+ */
+static void event_loop_task(void *param) {
+    system_event_t event;
+    while (1) {
+        if (xQueueReceive(event_queue, &event, portMAX_DELAY) && event_cb) {
+            event_cb(event_ctx, &event);
+        }
+    }
+}
+
+static esp_err_t event_post(system_event_id_t id) {
+    system_event_t event;
+    memset(&event, 0, sizeof(event));
+    event.event_id = id;
+    if (id == SYSTEM_EVENT_STA_GOT_IP) {
+        event.event_info.got_ip.ip_info.ip.addr = HOST_IP_ADDR;
+    }
+    return xQueueSend(event_queue, &event, portMAX_DELAY) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+void tcpip_adapter_init(void) {
+}
+
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void *ctx) {
+    event_cb = cb;
+    event_ctx = ctx;
+    event_queue = xQueueCreate(8, sizeof(system_event_t));
+    if (event_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(event_loop_task, "eventTask", 2048, NULL, 20, NULL) != pdPASS) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(wifi_init_config_t *config) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    return event_post(SYSTEM_EVENT_STA_START);
+}
+
+esp_err_t esp_wifi_connect(void) {
+    return event_post(SYSTEM_EVENT_STA_GOT_IP);
+}
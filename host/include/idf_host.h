@@ -0,0 +1,569 @@
+#ifndef __IDF_HOST_H__
+#define __IDF_HOST_H__
+
+/*
+ * The subset of the ESP-IDF v3.0 API used by main/, for the Linux host build.
+ * Declarations follow the IDF headers closely enough for main/ to compile
+ * unmodified; FreeRTOS is mapped onto pthreads, Bluetooth and MQTT are driven
+ * by the load generator, see host/loadgen.c.
+ * Every IDF header name used by main/ is a one line wrapper around this file.
+ */
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "sdkconfig.h"
+
+/*
+ * esp_err.h
+ */
+typedef int32_t esp_err_t;
+
+#define ESP_OK                      0
+#define ESP_FAIL                    -1
+#define ESP_ERR_NO_MEM              0x101
+#define ESP_ERR_INVALID_ARG         0x102
+#define ESP_ERR_INVALID_STATE       0x103
+#define ESP_ERR_INVALID_SIZE        0x104
+#define ESP_ERR_NOT_FOUND           0x105
+#define ESP_ERR_NOT_SUPPORTED       0x106
+#define ESP_ERR_TIMEOUT             0x107
+#define ESP_ERR_NVS_NO_FREE_PAGES   0x1100
+#define ESP_ERR_NVS_NOT_FOUND       0x1102
+#define ESP_ERR_NVS_INVALID_LENGTH  0x110c
+
+void host_error_check_failed(esp_err_t rc, const char *file, int line, const char *expr) __attribute__((noreturn));
+
+#define ESP_ERROR_CHECK(x) do {                                         \
+        esp_err_t __rc = (x);                                           \
+        if (__rc != ESP_OK) {                                           \
+            host_error_check_failed(__rc, __FILE__, __LINE__, #x);      \
+        }                                                               \
+    } while (0)
+
+/*
+ * esp_log.h
+ */
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+uint32_t esp_log_timestamp(void);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t buff_len);
+
+#define ESP_LOG_HOST(level, letter, tag, format, ...) \
+    esp_log_write(level, tag, letter " (%u) %s: " format "\n", esp_log_timestamp(), tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...) ESP_LOG_HOST(ESP_LOG_ERROR,   "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_HOST(ESP_LOG_WARN,    "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_HOST(ESP_LOG_INFO,    "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_HOST(ESP_LOG_DEBUG,   "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_HOST(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+/*
+ * esp_system.h
+ */
+void esp_restart(void) __attribute__((noreturn));
+uint32_t esp_get_free_heap_size(void);
+int64_t esp_timer_get_time(void);
+char *itoa(int value, char *str, int radix);
+
+/*
+ * FreeRTOS, one pthread per task, 1 ms ticks
+ * Priorities and core affinities are recorded but not enforced.
+ */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t EventBits_t;
+typedef struct host_task *TaskHandle_t;
+typedef struct host_event_group *EventGroupHandle_t;
+typedef struct host_queue *QueueHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define BIT0                0x00000001
+#define BIT1                0x00000002
+#define BIT2                0x00000004
+#define BIT3                0x00000008
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define portMAX_DELAY       (TickType_t)0xffffffffUL
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms) / portTICK_PERIOD_MS)
+#define tskNO_AFFINITY      0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+
+typedef struct {
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { PTHREAD_MUTEX_INITIALIZER }
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux)  pthread_mutex_unlock(&(mux)->mutex)
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelete(TaskHandle_t task);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period);
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+char *pcTaskGetTaskName(TaskHandle_t task);
+size_t xPortGetMinimumEverFreeHeapSize(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+int xPortGetCoreID(void);
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+/*
+ * nvs.h, nvs_flash.h, blobs in RAM for the life of the process
+ */
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode;
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+void nvs_close(nvs_handle handle);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_commit(nvs_handle handle);
+
+/*
+ * esp_partition.h, RAM backed with NOR flash semantics: erased to 0xFF,
+ * writes can only clear bits
+ */
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef int esp_partition_subtype_t;
+#define ESP_PARTITION_SUBTYPE_ANY 0xff
+#define SPI_FLASH_SEC_SIZE        4096
+
+typedef struct {
+    esp_partition_type_t    type;
+    esp_partition_subtype_t subtype;
+    uint32_t                address;
+    uint32_t                size;
+    char                    label[17];
+    bool                    encrypted;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, uint32_t start_addr, uint32_t size);
+
+/*
+ * esp_ota_ops.h, types only, firmware updates are not supported on the host
+ */
+typedef uint32_t esp_ota_handle_t;
+#define OTA_SIZE_UNKNOWN 0xffffffff
+
+/*
+ * mbedtls/sha256.h, the mbedTLS 2.x calls of the IDF
+ */
+typedef struct {
+    uint32_t      total[2];
+    uint32_t      state[8];
+    unsigned char buffer[64];
+    int           is224;
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224);
+void mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen);
+void mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32]);
+
+/*
+ * rom/miniz.h, the tinfl inflate of the ESP32 ROM, on zlib here. Output goes
+ * to a circular dictionary as with the ROM; zlib keeps its own window, which
+ * is allocated inside the decompressor so that free() releases everything.
+ */
+typedef uint8_t  mz_uint8;
+typedef uint32_t mz_uint32;
+
+#define TINFL_LZ_DICT_SIZE          32768
+#define TINFL_FLAG_HAS_MORE_INPUT   2
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct {
+    z_stream  stream;
+    bool      ready;
+    size_t    arena_used;
+    uint8_t   arena[48 * 1024] __attribute__((aligned(16)));  // Inflate state and 32 KB window
+} tinfl_decompressor;
+
+void tinfl_init(tinfl_decompressor *r);
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size,
+                              mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags);
+
+/*
+ * esp_wifi.h, esp_event_loop.h
+ * The station starts, connects and gets an address right away.
+ */
+typedef enum {
+    SYSTEM_EVENT_STA_START,
+    SYSTEM_EVENT_STA_GOT_IP,
+    SYSTEM_EVENT_STA_DISCONNECTED,
+} system_event_id_t;
+
+typedef struct {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct {
+    system_event_id_t event_id;
+    union {
+        struct {
+            struct {
+                ip4_addr_t ip;
+                ip4_addr_t netmask;
+                ip4_addr_t gw;
+            } ip_info;
+        } got_ip;
+    } event_info;
+} system_event_t;
+
+typedef esp_err_t (*system_event_cb_t)(void *ctx, system_event_t *event);
+
+typedef struct {
+    int unused;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() { 0 }
+
+typedef union {
+    struct {
+        uint8_t ssid[32];
+        uint8_t password[64];
+    } sta;
+} wifi_config_t;
+
+typedef enum { WIFI_STORAGE_FLASH, WIFI_STORAGE_RAM } wifi_storage_t;
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA } wifi_mode_t;
+typedef enum { ESP_IF_WIFI_STA } esp_interface_t;
+
+void tcpip_adapter_init(void);
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void *ctx);
+esp_err_t esp_wifi_init(wifi_init_config_t *config);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_connect(void);
+
+/*
+ * mqtt.h, espmqtt
+ * Each message is built in one buffer of CONFIG_MQTT_BUFFER_SIZE_BYTE, see
+ * mqtt_config.h, longer ones are not sent.
+ */
+#define CONFIG_MQTT_BUFFER_SIZE_BYTE 1024
+
+typedef struct mqtt_client mqtt_client;
+
+typedef struct {
+    uint8_t     type;
+    const char *topic;
+    const char *data;
+    uint16_t    topic_length;
+    uint16_t    data_length;
+    uint16_t    data_offset;
+    uint16_t    data_total_length;
+} mqtt_event_data_t;
+
+typedef void (*mqtt_callback)(mqtt_client *, mqtt_event_data_t *);
+
+typedef struct {
+    mqtt_callback connected_cb;
+    mqtt_callback disconnected_cb;
+    mqtt_callback reconnect_cb;
+    mqtt_callback subscribe_cb;
+    mqtt_callback publish_cb;
+    mqtt_callback data_cb;
+    char          host[64];
+    uint32_t      port;
+    char          client_id[32];
+    char          username[32];
+    char          password[32];
+    char          lwt_topic[32];
+    char          lwt_msg[32];
+    uint32_t      lwt_qos;
+    uint32_t      lwt_retain;
+    uint32_t      clean_session;
+    uint32_t      keepalive;
+} mqtt_settings;
+
+mqtt_client *mqtt_start(mqtt_settings *settings);
+void mqtt_stop(void);
+void mqtt_subscribe(mqtt_client *client, const char *topic, uint8_t qos);
+void mqtt_publish(mqtt_client *client, const char *topic, const char *data, int len, int qos, int retain);
+
+/*
+ * bt.h, esp_bt_main.h
+ */
+typedef uint8_t esp_bd_addr_t[6];
+
+typedef struct {
+    int unused;
+} esp_bt_controller_config_t;
+
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() { 0 }
+
+typedef enum { ESP_BT_MODE_IDLE, ESP_BT_MODE_BLE, ESP_BT_MODE_CLASSIC_BT, ESP_BT_MODE_BTDM } esp_bt_mode_t;
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg);
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode);
+esp_err_t esp_bluedroid_init(void);
+esp_err_t esp_bluedroid_enable(void);
+
+/*
+ * esp_gap_ble_api.h
+ */
+typedef enum {
+    ESP_BT_STATUS_SUCCESS = 0,
+    ESP_BT_STATUS_FAIL,
+} esp_bt_status_t;
+
+#define ESP_BLE_ADV_DATA_LEN_MAX      31
+#define ESP_BLE_SCAN_RSP_DATA_LEN_MAX 31
+
+typedef enum { BLE_SCAN_TYPE_PASSIVE, BLE_SCAN_TYPE_ACTIVE } esp_ble_scan_type_t;
+typedef enum { BLE_ADDR_TYPE_PUBLIC, BLE_ADDR_TYPE_RANDOM } esp_ble_addr_type_t;
+typedef enum { BLE_SCAN_FILTER_ALLOW_ALL, BLE_SCAN_FILTER_ALLOW_ONLY_WLST } esp_ble_scan_filter_t;
+typedef enum { ESP_BT_DEVICE_TYPE_BREDR = 1, ESP_BT_DEVICE_TYPE_BLE = 2, ESP_BT_DEVICE_TYPE_DUMO = 3 } esp_bt_dev_type_t;
+
+typedef struct {
+    esp_ble_scan_type_t   scan_type;
+    esp_ble_addr_type_t   own_addr_type;
+    esp_ble_scan_filter_t scan_filter_policy;
+    uint16_t              scan_interval;
+    uint16_t              scan_window;
+} esp_ble_scan_params_t;
+
+typedef enum {
+    ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_START_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RESULT_EVT,
+    ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT,
+} esp_gap_ble_cb_event_t;
+
+typedef enum {
+    ESP_GAP_SEARCH_INQ_RES_EVT = 0,
+    ESP_GAP_SEARCH_INQ_CMPL_EVT,
+} esp_gap_search_evt_t;
+
+typedef enum {
+    ESP_BLE_EVT_CONN_ADV = 0,
+    ESP_BLE_EVT_CONN_DIR_ADV,
+    ESP_BLE_EVT_DISC_ADV,
+    ESP_BLE_EVT_NON_CONN_ADV,
+    ESP_BLE_EVT_SCAN_RSP,
+} esp_ble_evt_type_t;
+
+typedef union {
+    struct {
+        esp_bt_status_t status;
+    } scan_param_cmpl, scan_start_cmpl, scan_stop_cmpl, adv_stop_cmpl;
+    struct {
+        esp_bt_status_t status;
+        esp_bd_addr_t   bda;
+        uint16_t        min_int;
+        uint16_t        max_int;
+        uint16_t        latency;
+        uint16_t        conn_int;
+        uint16_t        timeout;
+    } update_conn_params;
+    struct ble_scan_result_evt_param {
+        esp_gap_search_evt_t search_evt;
+        esp_bd_addr_t        bda;
+        esp_bt_dev_type_t    dev_type;
+        esp_ble_addr_type_t  ble_addr_type;
+        esp_ble_evt_type_t   ble_evt_type;
+        int                  rssi;
+        uint8_t              ble_adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+        int                  flag;
+        int                  num_resps;
+        uint8_t              adv_data_len;
+        uint8_t              scan_rsp_len;
+    } scan_rst;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params);
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration);
+esp_err_t esp_ble_gap_stop_scanning(void);
+esp_err_t esp_ble_gap_disconnect(esp_bd_addr_t remote_device);
+
+/*
+ * esp_gatt_defs.h, esp_gattc_api.h, esp_gatt_common_api.h
+ * Connections are made to the GATT servers of the load generator, see
+ * host_bt_gatt_server(). Notifications and writes are not supported.
+ */
+typedef uint8_t esp_gatt_if_t;
+#define ESP_GATT_IF_NONE 0xff
+
+#define ESP_UUID_LEN_16  2
+#define ESP_UUID_LEN_32  4
+#define ESP_UUID_LEN_128 16
+
+typedef struct {
+    uint16_t len;
+    union {
+        uint16_t uuid16;
+        uint32_t uuid32;
+        uint8_t  uuid128[ESP_UUID_LEN_128];
+    } uuid;
+} esp_bt_uuid_t;
+
+typedef struct {
+    esp_bt_uuid_t uuid;
+    uint8_t       inst_id;
+} esp_gatt_id_t;
+
+typedef struct {
+    esp_gatt_id_t id;
+    bool          is_primary;
+} esp_gatt_srvc_id_t;
+
+typedef enum {
+    ESP_GATT_OK = 0,
+    ESP_GATT_INVALID_HANDLE = 0x01,
+    ESP_GATT_ERROR = 0x85,
+    ESP_GATT_NOT_FOUND = 0x8d,
+} esp_gatt_status_t;
+
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG 0x2902
+#define ESP_GATT_CHAR_PROP_BIT_READ      0x02
+#define ESP_GATT_CHAR_PROP_BIT_NOTIFY    0x10
+
+typedef enum { ESP_GATT_DB_PRIMARY_SERVICE, ESP_GATT_DB_SECONDARY_SERVICE, ESP_GATT_DB_CHARACTERISTIC,
+               ESP_GATT_DB_DESCRIPTOR, ESP_GATT_DB_INCLUDED_SERVICE, ESP_GATT_DB_ALL } esp_gatt_db_attr_type_t;
+typedef enum { ESP_GATT_WRITE_TYPE_NO_RSP = 1, ESP_GATT_WRITE_TYPE_RSP } esp_gatt_write_type_t;
+typedef enum { ESP_GATT_AUTH_REQ_NONE = 0 } esp_gatt_auth_req_t;
+
+typedef struct {
+    uint16_t      char_handle;
+    uint8_t       properties;
+    esp_bt_uuid_t uuid;
+} esp_gattc_char_elem_t;
+
+typedef struct {
+    uint16_t      handle;
+    esp_bt_uuid_t uuid;
+} esp_gattc_descr_elem_t;
+
+typedef enum {
+    ESP_GATTC_REG_EVT,
+    ESP_GATTC_CONNECT_EVT,
+    ESP_GATTC_OPEN_EVT,
+    ESP_GATTC_CFG_MTU_EVT,
+    ESP_GATTC_SEARCH_RES_EVT,
+    ESP_GATTC_SEARCH_CMPL_EVT,
+    ESP_GATTC_REG_FOR_NOTIFY_EVT,
+    ESP_GATTC_NOTIFY_EVT,
+    ESP_GATTC_WRITE_DESCR_EVT,
+    ESP_GATTC_SRVC_CHG_EVT,
+    ESP_GATTC_WRITE_CHAR_EVT,
+    ESP_GATTC_DISCONNECT_EVT,
+    ESP_GATTC_READ_CHAR_EVT,
+    ESP_GATTC_CLOSE_EVT,
+} esp_gattc_cb_event_t;
+
+typedef union {
+    struct { esp_gatt_status_t status; uint16_t app_id; } reg;
+    struct { uint16_t conn_id; esp_bd_addr_t remote_bda; } connect;
+    struct { esp_gatt_status_t status; uint16_t conn_id; esp_bd_addr_t remote_bda; uint16_t mtu; } open;
+    struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t mtu; } cfg_mtu;
+    struct { uint16_t conn_id; uint16_t start_handle; uint16_t end_handle; esp_gatt_srvc_id_t srvc_id; } search_res;
+    struct { esp_gatt_status_t status; uint16_t conn_id; } search_cmpl;
+    struct { esp_gatt_status_t status; uint16_t handle; } reg_for_notify;
+    struct { uint16_t conn_id; esp_bd_addr_t remote_bda; uint16_t handle; uint16_t value_len; uint8_t *value;
+             bool is_notify; } notify;
+    struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t handle; } write;
+    struct { esp_bd_addr_t remote_bda; } srvc_chg;
+    struct { int reason; uint16_t conn_id; esp_bd_addr_t remote_bda; } disconnect;
+    struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t handle; uint8_t *value; uint16_t value_len; } read;
+    struct { esp_gatt_status_t status; uint16_t conn_id; esp_bd_addr_t remote_bda; int reason; } close;
+} esp_ble_gattc_cb_param_t;
+
+typedef void (*esp_gattc_cb_t)(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
+
+esp_err_t esp_ble_gattc_register_callback(esp_gattc_cb_t callback);
+esp_err_t esp_ble_gattc_app_register(uint16_t app_id);
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu);
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t gattc_if, uint16_t conn_id);
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_bt_uuid_t *filter_uuid);
+esp_gatt_status_t esp_ble_gattc_get_attr_count(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_gatt_db_attr_type_t type,
+                                               uint16_t start_handle, uint16_t end_handle, uint16_t char_handle,
+                                               uint16_t *count);
+esp_gatt_status_t esp_ble_gattc_get_char_by_uuid(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t start_handle,
+                                                 uint16_t end_handle, esp_bt_uuid_t char_uuid,
+                                                 esp_gattc_char_elem_t *result, uint16_t *count);
+esp_gatt_status_t esp_ble_gattc_get_descr_by_char_handle(esp_gatt_if_t gattc_if, uint16_t conn_id,
+                                                         uint16_t char_handle, esp_bt_uuid_t descr_uuid,
+                                                         esp_gattc_descr_elem_t *result, uint16_t *count);
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t gattc_if, esp_bd_addr_t server_bda, uint16_t handle);
+esp_err_t esp_ble_gattc_write_char_descr(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                         uint16_t value_len, uint8_t *value, esp_gatt_write_type_t write_type,
+                                         esp_gatt_auth_req_t auth_req);
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                   uint16_t value_len, uint8_t *value, esp_gatt_write_type_t write_type,
+                                   esp_gatt_auth_req_t auth_req);
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t gattc_if, esp_bd_addr_t remote_bda, bool is_direct);
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t gattc_if, uint16_t conn_id);
+esp_err_t esp_ble_gattc_read_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle,
+                                  esp_gatt_auth_req_t auth_req);
+
+#endif
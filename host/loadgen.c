@@ -0,0 +1,662 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include "host.h"
+#include "probe.h"
+#include "driver.h"
+#include "adv_record.h"
+
+/*
+ * Synthetic advert load generator for the host build
+ * Runs the tracker (app_main) against the shims, plays the BLE controller with
+ * a population of advertising devices, then reports throughput, per stage
+ * latency percentiles and drop counts.
+ * With a capture option (CONFIG_TRACKER_CAPTURE_MQTT) the capture stream is
+ * saved to a file, for tracker_replay.
+ * With --tags, a share of the devices are sensor tags with a GATT server, read
+ * by the tracker GATT client (CONFIG_TRACKER_GATTC). With --streams, a share
+ * of the tags notify a stream, kept by CONFIG_TRACKER_GATTC_STREAMS.
+ */
+
+#define TAG_LOADGEN     "LOADGEN"
+#define SCAN_TOPIC      "/tracker/scan"     // As in main.c
+#define CAPTURE_TOPIC   "/tracker/capture"
+#define FLOOD_CHECK     1024                // Adverts between two clock reads in flood mode
+
+typedef enum {
+    PAYLOAD_IBEACON = 0,
+    PAYLOAD_EDDYSTONE_UID,
+    PAYLOAD_EDDYSTONE_URL,
+    PAYLOAD_EDDYSTONE_TLM,
+    PAYLOAD_ALTBEACON,
+    PAYLOAD_NAMED,
+    PAYLOAD_RANDOM,
+    PAYLOAD_TYPES,
+} payload_type_t;
+
+static const char *const payload_names[PAYLOAD_TYPES] = {
+    [PAYLOAD_IBEACON]       = "ibeacon",
+    [PAYLOAD_EDDYSTONE_UID] = "uid",
+    [PAYLOAD_EDDYSTONE_URL] = "url",
+    [PAYLOAD_EDDYSTONE_TLM] = "tlm",
+    [PAYLOAD_ALTBEACON]     = "altbeacon",
+    [PAYLOAD_NAMED]         = "named",
+    [PAYLOAD_RANDOM]        = "random",
+};
+
+typedef struct {
+    uint8_t        bda[ADV_BDA_LEN];
+    uint8_t        type;
+    int8_t         rssi;            // Mean RSSI, drifts slowly
+    uint8_t        adv_len;
+    uint8_t        rsp_len;         // Scannable when not 0
+    uint8_t        data[ADV_RECORD_DATA_MAX];   // Advert then scan response
+    uint32_t       adverts;
+} device_t;
+
+typedef struct {
+    uint64_t due_ns;
+    uint32_t device;
+} event_t;
+
+typedef struct {
+    uint32_t devices;
+    uint32_t interval_ms;
+    uint32_t jitter_ms;
+    double   duration_s;
+    uint32_t drain_ms;
+    bool     flood;
+    bool     windows;
+    uint32_t scannable;             // Percent of the devices
+    uint32_t rsp_loss;              // Percent of the scan responses
+    uint32_t tags;                  // Percent of the devices, GATT servers
+    uint32_t gatt_fail;             // Percent of the tags refusing connections
+    uint32_t gatt_stall;            // Percent of the tags never answering reads
+    uint32_t gatt_moved;            // Percent of the tags with another layout than their model
+    uint32_t streams;               // Percent of the tags notifying a stream
+    uint32_t notify_hz;
+    uint32_t notify_len;
+    uint64_t seed;
+    uint32_t weights[PAYLOAD_TYPES];
+    const char *scan;
+    uint32_t publish_us;
+    uint32_t net_delay_us;          // Each way to the time server
+    uint32_t net_jitter_us;         // Mean of the exponential jitter added
+    double   clock_drift_ppm;       // Of the fleet clock against the tracker one
+    const char *capture;
+    bool     json;
+} options_t;
+
+static uint64_t rng_state;
+static device_t *devices;
+static event_t *heap;
+static uint32_t heap_len;
+
+
+/*
+ * xorshift64*
+ */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+static uint32_t rng_below(uint32_t n) {
+    return n ? (uint32_t)((rng_next() >> 32) % n) : 0;
+}
+
+static void rng_bytes(uint8_t *out, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (uint8_t)(rng_next() >> 56);
+    }
+}
+
+/*
+ * Min-heap of the next advert of each device
+ */
+static void heap_push(event_t ev) {
+    uint32_t i = heap_len++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (heap[parent].due_ns <= ev.due_ns) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = ev;
+}
+
+/*
+ * Replace the earliest event
+ */
+static void heap_replace_top(event_t ev) {
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= heap_len) {
+            break;
+        }
+        if (child + 1 < heap_len && heap[child + 1].due_ns < heap[child].due_ns) {
+            child++;
+        }
+        if (ev.due_ns <= heap[child].due_ns) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = ev;
+}
+
+/*
+ * Advertising data, flags first as most beacons do
+ */
+static size_t put_flags(uint8_t *p) {
+    p[0] = 2;
+    p[1] = 0x01;
+    p[2] = 0x06;
+    return 3;
+}
+
+/*
+ * Eddystone service UUID and the service data header
+ * frame_len: bytes after the frame type
+ */
+static size_t put_eddystone(uint8_t *p, uint8_t frame_len, uint8_t frame) {
+    size_t n = 0;
+    p[n++] = 3;
+    p[n++] = 0x03;          // Complete list of 16 bits service UUIDs
+    p[n++] = 0xAA;
+    p[n++] = 0xFE;
+    p[n++] = frame_len + 4;
+    p[n++] = 0x16;          // Service data
+    p[n++] = 0xAA;
+    p[n++] = 0xFE;
+    p[n++] = frame;
+    return n;
+}
+
+static void device_build(device_t *dev, uint32_t index, payload_type_t type) {
+    uint8_t *p = dev->data;
+    size_t n = put_flags(p);
+
+    dev->type = type;
+    switch (type) {
+    case PAYLOAD_IBEACON:
+        p[n++] = 26;
+        p[n++] = 0xFF;
+        p[n++] = 0x4C;      // Apple
+        p[n++] = 0x00;
+        p[n++] = 0x02;
+        p[n++] = 0x15;
+        rng_bytes(&p[n], 16);
+        n += 16;
+        p[n++] = index >> 8;
+        p[n++] = index;
+        p[n++] = rng_next() >> 56;
+        p[n++] = rng_next() >> 56;
+        p[n++] = (uint8_t)-59;
+        break;
+    case PAYLOAD_EDDYSTONE_UID:
+        n += put_eddystone(&p[n], 19, 0x00);
+        p[n++] = (uint8_t)-20;
+        rng_bytes(&p[n], 16);
+        n += 16;
+        p[n++] = 0;
+        p[n++] = 0;
+        break;
+    case PAYLOAD_EDDYSTONE_URL: {
+        static const char url[] = "example";
+        n += put_eddystone(&p[n], sizeof(url) + 2, 0x10);
+        p[n++] = (uint8_t)-20;
+        p[n++] = 0x01;      // https://www.
+        memcpy(&p[n], url, sizeof(url) - 1);
+        n += sizeof(url) - 1;
+        p[n++] = 0x07;      // .com
+        break;
+    }
+    case PAYLOAD_EDDYSTONE_TLM:
+        // Counters are refreshed for each advert, see device_advertise()
+        n += put_eddystone(&p[n], 13, 0x20);
+        memset(&p[n], 0, 13);
+        n += 13;
+        break;
+    case PAYLOAD_ALTBEACON:
+        p[n++] = 27;
+        p[n++] = 0xFF;
+        p[n++] = 0x18;      // Radius Networks
+        p[n++] = 0x01;
+        p[n++] = 0xBE;
+        p[n++] = 0xAC;
+        rng_bytes(&p[n], 20);
+        n += 20;
+        p[n++] = (uint8_t)-59;
+        p[n++] = 0;
+        break;
+    case PAYLOAD_NAMED: {
+        char name[16];
+        int len = snprintf(name, sizeof(name), "Tracker-%05u", index % 100000);
+        p[n++] = 2;
+        p[n++] = 0x0A;      // TX power
+        p[n++] = 0;
+        p[n++] = len + 1;
+        p[n++] = 0x09;      // Complete name
+        memcpy(&p[n], name, len);
+        n += len;
+        break;
+    }
+    case PAYLOAD_RANDOM:
+    default: {
+        // Manufacturer data of any company and length
+        uint8_t len = 3 + rng_below(ESP_BLE_ADV_DATA_LEN_MAX - 3 - 4);
+        p[n++] = len;
+        p[n++] = 0xFF;
+        rng_bytes(&p[n], len - 1);
+        n += len - 1;
+        break;
+    }
+    }
+    dev->adv_len = n;
+}
+
+/*
+ * Scan response of a scannable device: its name and TX power
+ */
+static void device_scan_rsp(device_t *dev, uint32_t index) {
+    uint8_t *p = &dev->data[dev->adv_len];
+    char name[16];
+    int len = snprintf(name, sizeof(name), "Tag-%05u", index % 100000);
+    size_t n = 0;
+
+    p[n++] = len + 1;
+    p[n++] = 0x09;          // Complete name
+    memcpy(&p[n], name, len);
+    n += len;
+    p[n++] = 2;
+    p[n++] = 0x0A;          // TX power
+    p[n++] = (uint8_t)-4;
+    dev->rsp_len = n;
+}
+
+/*
+ * Sensor tag: battery and environmental sensing services, connectable. Stream
+ * tags are another model, with the stream service.
+ */
+static void device_tag(device_t *dev, const options_t *opt) {
+    uint8_t *p = dev->data;
+    size_t n = put_flags(p);
+    host_gatt_server_t srv = {
+        .battery = 5 + rng_below(96),
+        .temperature = 1500 + rng_below(1501),
+        .humidity = 3000 + rng_below(4001),
+        .refuse = rng_below(100) < opt->gatt_fail,
+        .stall = rng_below(100) < opt->gatt_stall,
+        .interval_ms = opt->interval_ms,
+        .shift = rng_below(100) < opt->gatt_moved ? 0x10 : 0,
+    };
+
+    if (opt->streams && rng_below(100) < opt->streams) {
+        // Drawn only then: the populations of other runs are unchanged
+        srv.notify_hz = opt->notify_hz;
+        srv.notify_len = opt->notify_len;
+    }
+
+    dev->type = PAYLOAD_TYPES;
+    p[n++] = srv.notify_hz ? 7 : 5;
+    p[n++] = 0x03;          // Complete list of 16 bits service UUIDs
+    p[n++] = 0x0F;          // Battery
+    p[n++] = 0x18;
+    p[n++] = 0x1A;          // Environmental sensing
+    p[n++] = 0x18;
+    if (srv.notify_hz) {
+        p[n++] = 0xE0;      // Stream
+        p[n++] = 0xFF;
+    }
+    p[n++] = 2;
+    p[n++] = 0x0A;          // TX power
+    p[n++] = 0;
+    dev->adv_len = n;
+    if (!host_bt_gatt_server(dev->bda, &srv)) {
+        fprintf(stderr, "GATT server registry full\n");
+    }
+}
+
+/*
+ * Refresh the advert of a device before it is sent
+ */
+static void device_advertise(device_t *dev, uint32_t now_ms) {
+    dev->adverts++;
+    if (dev->type == PAYLOAD_EDDYSTONE_TLM) {
+        // After flags and UUID list: len, 0x16, AA FE, 0x20, version
+        uint8_t *tlm = &dev->data[3 + 4 + 6];
+        tlm[0] = 3000 >> 8;     // Battery, mV
+        tlm[1] = 3000 & 0xFF;
+        tlm[2] = 21;            // 21.5 C
+        tlm[3] = 0x80;
+        tlm[4] = dev->adverts >> 24;
+        tlm[5] = dev->adverts >> 16;
+        tlm[6] = dev->adverts >> 8;
+        tlm[7] = dev->adverts;
+        uint32_t uptime_ds = now_ms / 100;
+        tlm[8] = uptime_ds >> 24;
+        tlm[9] = uptime_ds >> 16;
+        tlm[10] = uptime_ds >> 8;
+        tlm[11] = uptime_ds;
+    }
+    // Slow drift, as a device moving around
+    int r = dev->rssi + (int)rng_below(3) - 1;
+    if (r < -95) {
+        r = -95;
+    } else if (r > -40) {
+        r = -40;
+    }
+    dev->rssi = r;
+}
+
+static payload_type_t pick_type(const options_t *opt) {
+    uint32_t total = 0;
+    for (int i = 0; i < PAYLOAD_TYPES; i++) {
+        total += opt->weights[i];
+    }
+    uint32_t r = rng_below(total);
+    for (int i = 0; i < PAYLOAD_TYPES; i++) {
+        if (r < opt->weights[i]) {
+            return i;
+        }
+        r -= opt->weights[i];
+    }
+    return PAYLOAD_RANDOM;
+}
+
+static bool population_init(const options_t *opt, uint64_t start_ns) {
+    devices = calloc(opt->devices, sizeof(*devices));
+    heap = calloc(opt->devices, sizeof(*heap));
+    if (devices == NULL || heap == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < opt->devices; i++) {
+        device_t *dev = &devices[i];
+        rng_bytes(dev->bda, ADV_BDA_LEN);
+        dev->bda[0] |= 0xC0;        // Random static address
+        dev->rssi = -95 + (int)rng_below(56);
+        if (opt->tags && rng_below(100) < opt->tags) {
+            device_tag(dev, opt);
+        } else {
+            device_build(dev, i, pick_type(opt));
+        }
+        if (opt->scannable && rng_below(100) < opt->scannable) {
+            device_scan_rsp(dev, i);
+        }
+        // Devices are not synchronized
+        event_t ev = {
+            .due_ns = start_ns + (uint64_t)rng_below(opt->interval_ms * 1000) * 1000,
+            .device = i,
+        };
+        heap_push(ev);
+    }
+    return true;
+}
+
+/*
+ * Send the earliest advert and schedule the next one of the same device
+ */
+static void advert_send(const options_t *opt, driver_result_t *result) {
+    event_t ev = heap[0];
+    device_t *dev = &devices[ev.device];
+    uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    adv_record_t rec;
+
+    device_advertise(dev, now_ms);
+    memcpy(rec.bda, dev->bda, ADV_BDA_LEN);
+    rec.rssi = dev->rssi + (int)rng_below(9) - 4;
+    rec.dev_type = ESP_BT_DEVICE_TYPE_BLE;
+    rec.adv_data_len = dev->adv_len;
+    rec.scan_rsp_len = dev->rsp_len;
+    memcpy(rec.data, dev->data, dev->adv_len + dev->rsp_len);
+    driver_advert(result, &rec, opt->flood ? 0 : ev.due_ns);
+    // advDelay, 0 to 10 ms in the specification
+    ev.due_ns += (uint64_t)opt->interval_ms * 1000000 + (uint64_t)rng_below(opt->jitter_ms * 1000 + 1) * 1000;
+    heap_replace_top(ev);
+}
+
+static void load_run(const options_t *opt, driver_result_t *result) {
+    uint64_t start = host_time_ns();
+    uint64_t end = start + (uint64_t)(opt->duration_s * 1e9);
+    uint64_t now = start;
+
+    memset(result, 0, sizeof(*result));
+    if (!population_init(opt, start)) {
+        fprintf(stderr, "Out of memory for %u devices\n", opt->devices);
+        exit(1);
+    }
+    if (opt->flood) {
+        // As fast as the pipeline takes them, in schedule order
+        while (now < end) {
+            for (int i = 0; i < FLOOD_CHECK; i++) {
+                advert_send(opt, result);
+            }
+            now = host_time_ns();
+        }
+    } else {
+        while (now < end) {
+            while (heap[0].due_ns <= now) {
+                advert_send(opt, result);
+            }
+            driver_sleep_until(heap[0].due_ns < end ? heap[0].due_ns : end);
+            now = host_time_ns();
+        }
+    }
+    result->elapsed_s = (now - start) / 1e9;
+}
+
+static bool parse_mix(const char *arg, uint32_t *weights) {
+    char *copy = strdup(arg);
+    char *save = NULL;
+    bool ok = true;
+
+    memset(weights, 0, PAYLOAD_TYPES * sizeof(*weights));
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *colon = strchr(tok, ':');
+        uint32_t weight = 1;
+        int type;
+        if (colon) {
+            *colon = '\0';
+            weight = strtoul(colon + 1, NULL, 10);
+        }
+        for (type = 0; type < PAYLOAD_TYPES; type++) {
+            if (strcmp(tok, payload_names[type]) == 0) {
+                weights[type] = weight;
+                break;
+            }
+        }
+        if (type == PAYLOAD_TYPES) {
+            fprintf(stderr, "Unknown payload type %s\n", tok);
+            ok = false;
+        }
+    }
+    free(copy);
+    return ok;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n, --devices N        advertising devices (1000)\n"
+            "  -i, --interval-ms MS   advertising interval of each device (100)\n"
+            "      --jitter-ms MS     random delay added to each interval, advDelay (10)\n"
+            "  -d, --duration S       load duration in seconds (10)\n"
+            "  -m, --mix TYPE[:W],..  payload types and weights among ibeacon, uid, url,\n"
+            "                         tlm, altbeacon, named, random (all 1)\n"
+            "  -f, --flood            send adverts as fast as possible\n"
+            "  -w, --windows          adverts outside the HCI scan windows are missed\n"
+            "      --scannable PCT    share of devices with a scan response, percent (0)\n"
+            "      --rsp-loss PCT     share of scan responses lost, percent (0)\n"
+            "      --tags PCT         share of devices with a GATT server, percent (0)\n"
+            "      --gatt-fail PCT    share of tags refusing connections, percent (0)\n"
+            "      --gatt-stall PCT   share of tags never answering reads, percent (0)\n"
+            "      --gatt-moved PCT   share of tags with other attribute handles than their\n"
+            "                         model, another firmware, percent (0)\n"
+            "      --streams PCT      share of tags notifying a stream, percent (0)\n"
+            "      --notify-hz N      notifications per second of a stream (200)\n"
+            "      --notify-len N     notification length, within the MTU (20)\n"
+            "  -s, --seed N           device population seed (1)\n"
+            "      --scan CMD         scan command published on " SCAN_TOPIC " first\n"
+            "      --publish-us US    simulated cost of each MQTT publish (0)\n"
+            "      --drain-ms MS      wait after the load for the last windows (%u)\n"
+            "      --net-delay-us US  delay each way to the fleet time server (1500)\n"
+            "      --net-jitter-us US mean exponential jitter added to each way (1000)\n"
+            "      --clock-drift-ppm P  fleet clock drift against the tracker clock (20)\n"
+            "      --capture FILE     save the capture stream of " CAPTURE_TOPIC " to FILE\n"
+            "  -j, --json             JSON report\n"
+            "  -v, --verbose          tracker logs, repeat for more\n",
+            prog, 2 * CONFIG_TRACKER_SCAN_WINDOW_MS + 500);
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        { "devices",     required_argument, NULL, 'n' },
+        { "interval-ms", required_argument, NULL, 'i' },
+        { "jitter-ms",   required_argument, NULL, 'J' },
+        { "duration",    required_argument, NULL, 'd' },
+        { "mix",         required_argument, NULL, 'm' },
+        { "flood",       no_argument,       NULL, 'f' },
+        { "windows",     no_argument,       NULL, 'w' },
+        { "scannable",   required_argument, NULL, 'R' },
+        { "rsp-loss",    required_argument, NULL, 'L' },
+        { "tags",        required_argument, NULL, 'T' },
+        { "gatt-fail",   required_argument, NULL, 'F' },
+        { "gatt-stall",  required_argument, NULL, 'G' },
+        { "gatt-moved",  required_argument, NULL, 'M' },
+        { "streams",     required_argument, NULL, 'A' },
+        { "notify-hz",   required_argument, NULL, 'H' },
+        { "notify-len",  required_argument, NULL, 'N' },
+        { "seed",        required_argument, NULL, 's' },
+        { "scan",        required_argument, NULL, 'S' },
+        { "publish-us",  required_argument, NULL, 'P' },
+        { "drain-ms",    required_argument, NULL, 'D' },
+        { "net-delay-us",  required_argument, NULL, 'Y' },
+        { "net-jitter-us", required_argument, NULL, 'X' },
+        { "clock-drift-ppm", required_argument, NULL, 'K' },
+        { "capture",     required_argument, NULL, 'C' },
+        { "json",        no_argument,       NULL, 'j' },
+        { "verbose",     no_argument,       NULL, 'v' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    options_t opt = {
+        .devices = 1000,
+        .interval_ms = 100,
+        .jitter_ms = 10,
+        .duration_s = 10,
+        .drain_ms = 2 * CONFIG_TRACKER_SCAN_WINDOW_MS + 500,
+        .seed = 1,
+        .notify_hz = 200,
+        .notify_len = 20,
+        .net_delay_us = 1500,
+        .net_jitter_us = 1000,
+        .clock_drift_ppm = 20,
+    };
+    esp_log_level_t level = ESP_LOG_WARN;
+    driver_result_t result;
+    FILE *capture_file = NULL;
+    int c;
+
+    for (int i = 0; i < PAYLOAD_TYPES; i++) {
+        opt.weights[i] = 1;
+    }
+    while ((c = getopt_long(argc, argv, "n:i:d:m:fws:jvh", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'n': opt.devices = strtoul(optarg, NULL, 0); break;
+        case 'i': opt.interval_ms = strtoul(optarg, NULL, 0); break;
+        case 'J': opt.jitter_ms = strtoul(optarg, NULL, 0); break;
+        case 'd': opt.duration_s = strtod(optarg, NULL); break;
+        case 'm':
+            if (!parse_mix(optarg, opt.weights)) {
+                return 2;
+            }
+            break;
+        case 'f': opt.flood = true; break;
+        case 'w': opt.windows = true; break;
+        case 'R': opt.scannable = strtoul(optarg, NULL, 0); break;
+        case 'L': opt.rsp_loss = strtoul(optarg, NULL, 0); break;
+        case 'T': opt.tags = strtoul(optarg, NULL, 0); break;
+        case 'F': opt.gatt_fail = strtoul(optarg, NULL, 0); break;
+        case 'G': opt.gatt_stall = strtoul(optarg, NULL, 0); break;
+        case 'M': opt.gatt_moved = strtoul(optarg, NULL, 0); break;
+        case 'A': opt.streams = strtoul(optarg, NULL, 0); break;
+        case 'H': opt.notify_hz = strtoul(optarg, NULL, 0); break;
+        case 'N': opt.notify_len = strtoul(optarg, NULL, 0); break;
+        case 's': opt.seed = strtoull(optarg, NULL, 0); break;
+        case 'S': opt.scan = optarg; break;
+        case 'P': opt.publish_us = strtoul(optarg, NULL, 0); break;
+        case 'D': opt.drain_ms = strtoul(optarg, NULL, 0); break;
+        case 'Y': opt.net_delay_us = strtoul(optarg, NULL, 0); break;
+        case 'X': opt.net_jitter_us = strtoul(optarg, NULL, 0); break;
+        case 'K': opt.clock_drift_ppm = strtod(optarg, NULL); break;
+        case 'C': opt.capture = optarg; break;
+        case 'j': opt.json = true; break;
+        case 'v': level = level < ESP_LOG_VERBOSE ? level + 1 : level; break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    if (opt.devices == 0 || opt.interval_ms == 0 || opt.duration_s <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    rng_state = opt.seed * 0x9E3779B97F4A7C15ull + 1;
+    host_log_level(level);
+    host_mqtt_publish_cost(opt.publish_us);
+    host_bt_scan_windows(opt.windows);
+    host_bt_scan_rsp_loss(opt.rsp_loss);
+    // Fleet time: wall clock time, running off the host clock by the drift
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    host_time_server_t time_server = {
+        .epoch_us = (int64_t)wall.tv_sec * 1000000 + wall.tv_nsec / 1000 - (int64_t)(host_time_ns() / 1000),
+        .drift_ppb = (int32_t)(opt.clock_drift_ppm * 1000),
+        .delay_us = opt.net_delay_us,
+        .jitter_us = opt.net_jitter_us,
+    };
+    host_mqtt_time_server(&time_server);
+    if (opt.capture) {
+        capture_file = fopen(opt.capture, "wb");
+        if (capture_file == NULL) {
+            perror(opt.capture);
+            return 1;
+        }
+        host_mqtt_save(CAPTURE_TOPIC, capture_file);
+#if !CONFIG_TRACKER_CAPTURE_MQTT
+        fprintf(stderr, "Built without CONFIG_TRACKER_CAPTURE_MQTT, %s stays empty\n", opt.capture);
+#endif
+    }
+
+    if (!driver_start(opt.scan)) {
+        return 1;
+    }
+    double cpu_start = driver_cpu_seconds();
+    load_run(&opt, &result);
+    double cpu_s = driver_cpu_seconds() - cpu_start;
+    driver_drain(opt.drain_ms);
+
+    if (opt.json) {
+        printf("{\"devices\":%u,\"interval_ms\":%u,\"flood\":%s,", opt.devices, opt.interval_ms,
+               opt.flood ? "true" : "false");
+    } else {
+        printf("Load: %u devices every %u ms, %.1f s%s\n", opt.devices, opt.interval_ms, result.elapsed_s,
+               opt.flood ? ", flood" : "");
+    }
+    driver_report(&result, cpu_s, opt.json);
+    if (capture_file) {
+        host_mqtt_save(NULL, NULL);
+        fclose(capture_file);
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include "host.h"
+#include "esp_log.h"
+#include "mqtt.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+/*
+ * espmqtt shim, an always connected broker
+ * Published messages are accounted by the probes and dropped, or saved to a
+ * file for one topic. Messages
+ * injected by the load generator are delivered to data_cb by the MQTT task.
+ * Time requests are answered by a simulated fleet time server, over a
+ * simulated network, when one is set.
+ */
+
+#define TAG_MQTT_HOST   "MQTT_HOST"
+#define INJECT_QUEUE    8
+#define TIME_REQUEST_TOPIC "/tracker/time_request"  // As in main.c
+#define TIME_TOPIC      "/tracker/time"
+#define TIME_SERVER_US  50          // Request received to response sent
+#define MQTT_HEADER_LEN 5           // Fixed header and topic length, QoS 0
+
+struct mqtt_client {
+    mqtt_settings *settings;
+};
+
+typedef struct {
+    char  *topic;
+    char  *data;
+    size_t len;
+} inject_msg_t;
+
+static mqtt_client client;
+static QueueHandle_t inject_queue = NULL;
+static uint32_t publish_cost_us = 0;
+static const char *save_topic = NULL;
+static FILE *save_file = NULL;
+static host_time_server_t time_server;
+static bool time_server_on = false;
+static pthread_mutex_t time_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t time_rng = 1;
+
+typedef struct {
+    uint64_t due_ns;
+    char     topic[64];
+    char     data[64];
+} time_response_t;
+
+
+static void mqtt_task(void *param) {
+    inject_msg_t msg;
+    mqtt_event_data_t event;
+
+    if (client.settings->connected_cb) {
+        client.settings->connected_cb(&client, NULL);
+    }
+    while (1) {
+        if (!xQueueReceive(inject_queue, &msg, portMAX_DELAY)) {
+            continue;
+        }
+        memset(&event, 0, sizeof(event));
+        event.topic = msg.topic;
+        event.topic_length = strlen(msg.topic);
+        event.data = msg.data;
+        event.data_length = msg.len;
+        event.data_total_length = msg.len;
+        if (client.settings->data_cb) {
+            client.settings->data_cb(&client, &event);
+        }
+        free(msg.topic);
+        free(msg.data);
+    }
+}
+
+mqtt_client *mqtt_start(mqtt_settings *settings) {
+    client.settings = settings;
+    if (inject_queue == NULL) {
+        inject_queue = xQueueCreate(INJECT_QUEUE, sizeof(inject_msg_t));
+        xTaskCreate(mqtt_task, "mqtt_task", 2048, NULL, 5, NULL);
+    }
+    ESP_LOGI(TAG_MQTT_HOST, "Client %s connected", settings->client_id);
+    return &client;
+}
+
+void mqtt_stop(void) {
+}
+
+void mqtt_subscribe(mqtt_client *c, const char *topic, uint8_t qos) {
+    ESP_LOGI(TAG_MQTT_HOST, "Subscribed to %s", topic);
+}
+
+int64_t host_fleet_time(int64_t local_us) {
+    return time_server.epoch_us + local_us + local_us * time_server.drift_ppb / 1000000000;
+}
+
+/*
+ * One way through the simulated network, us
+ */
+static int64_t time_way(void) {
+    time_rng ^= time_rng << 13;
+    time_rng ^= time_rng >> 7;
+    time_rng ^= time_rng << 17;
+    double u = ((time_rng >> 11) + 0.5) / 9007199254740992.0;
+    return time_server.delay_us + (int64_t)(-log(u) * time_server.jitter_us);
+}
+
+static void *time_respond(void *arg) {
+    time_response_t *rsp = arg;
+    struct timespec ts = {
+        .tv_sec = rsp->due_ns / 1000000000ull,
+        .tv_nsec = rsp->due_ns % 1000000000ull,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+    host_mqtt_inject(rsp->topic, rsp->data, strlen(rsp->data));
+    free(rsp);
+    return NULL;
+}
+
+/*
+ * Answer "<ESP Name> <id>" with "<id> <t2> <t3>" once the response got back
+ */
+static void time_request(const char *data, int len) {
+    char request[64];
+    char name[32];
+    unsigned long long id;
+    pthread_t thread;
+    time_response_t *rsp;
+
+    if (len <= 0 || len >= (int)sizeof(request)) {
+        return;
+    }
+    memcpy(request, data, len);
+    request[len] = '\0';
+    if (sscanf(request, "%31s %llu", name, &id) != 2 || (rsp = malloc(sizeof(*rsp))) == NULL) {
+        ESP_LOGE(TAG_MQTT_HOST, "Time request %s not answered", request);
+        return;
+    }
+    pthread_mutex_lock(&time_lock);
+    int64_t now_us = host_time_ns() / 1000;
+    int64_t received_us = now_us + time_way();
+    int64_t t2 = host_fleet_time(received_us);
+    rsp->due_ns = (uint64_t)(received_us + TIME_SERVER_US + time_way()) * 1000;
+    pthread_mutex_unlock(&time_lock);
+    snprintf(rsp->topic, sizeof(rsp->topic), "%s/%s", TIME_TOPIC, name);
+    snprintf(rsp->data, sizeof(rsp->data), "%llu %lld %lld", id, (long long)t2, (long long)(t2 + TIME_SERVER_US));
+    if (pthread_create(&thread, NULL, time_respond, rsp) != 0) {
+        free(rsp);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+void host_mqtt_time_server(const host_time_server_t *srv) {
+    if (srv) {
+        time_server = *srv;
+    }
+    time_server_on = srv != NULL;
+}
+
+void mqtt_publish(mqtt_client *c, const char *topic, const char *data, int len, int qos, int retain) {
+    uint64_t start = host_time_ns();
+    uint64_t end = start;
+    if (MQTT_HEADER_LEN + strlen(topic) + len > CONFIG_MQTT_BUFFER_SIZE_BYTE) {
+        // As espmqtt, the message does not fit the client buffer
+        ESP_LOGE(TAG_MQTT_HOST, "Message of %d bytes on %s over the client buffer, not sent", len, topic);
+        return;
+    }
+    if (publish_cost_us) {
+        // Busy wait, the publisher task is blocked in the socket write on the device
+        uint64_t until = start + (uint64_t)publish_cost_us * 1000;
+        while ((end = host_time_ns()) < until) {
+        }
+    }
+    if (save_file) {
+        size_t prefix = strlen(save_topic);
+        if (strncmp(topic, save_topic, prefix) == 0 && (topic[prefix] == '\0' || topic[prefix] == '/')) {
+            fwrite(data, 1, len, save_file);
+        }
+    }
+    if (time_server_on && strcmp(topic, TIME_REQUEST_TOPIC) == 0) {
+        time_request(data, len);
+    }
+    probe_publish(topic, len, start, end);
+}
+
+void host_mqtt_publish_cost(uint32_t us) {
+    publish_cost_us = us;
+}
+
+void host_mqtt_save(const char *topic, FILE *out) {
+    save_topic = topic;
+    save_file = out;
+}
+
+void host_mqtt_inject(const char *topic, const char *data, size_t len) {
+    inject_msg_t msg = {
+        .topic = strdup(topic),
+        .data = malloc(len),
+        .len = len,
+    };
+    if (msg.topic == NULL || msg.data == NULL || inject_queue == NULL) {
+        ESP_LOGE(TAG_MQTT_HOST, "Cannot inject a message on %s", topic);
+        free(msg.topic);
+        free(msg.data);
+        return;
+    }
+    memcpy(msg.data, data, len);
+    xQueueSend(inject_queue, &msg, portMAX_DELAY);
+}
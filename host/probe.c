@@ -0,0 +1,443 @@
+#include <string.h>
+#include "host.h"
+#include "probe.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "adv_ring.h"
+#include "adv_merge.h"
+#include "adv_parse.h"
+#include "adv_range.h"
+#include "adv_presence.h"
+#include "adv_table.h"
+#include "adv_json.h"
+#include "adv_frame.h"
+#include "gattc_sched.h"
+#include "gattc_cache.h"
+#include "gattc_stream.h"
+#include "time_sync.h"
+
+// ADV_TOPIC of main.c, possibly followed by /<client id>
+#define PROBE_ADV_TOPIC     "/test"
+// Advert records encoded and not published yet, more than a batch can hold
+#define PROBE_PENDING       1024
+// Ring slot stamps: position in the upper 16 bits, time in the lower 48
+#define STAMP_TIME_BITS     48
+#define STAMP_TIME_MASK     ((1ull << STAMP_TIME_BITS) - 1)
+
+bool __real_adv_ring_push(adv_ring_t *ring, const adv_record_t *rec);
+bool __real_adv_ring_pop(adv_ring_t *ring, adv_record_t *rec);
+uint32_t __real_adv_ring_pop_batch(adv_ring_t *ring, adv_record_t *recs, uint32_t max);
+bool __real_adv_merge_put(adv_merge_t *merge, const adv_record_t *rec, adv_merge_kind_t kind, adv_record_t *out);
+void __real_adv_parse(const adv_record_t *rec, adv_info_t *info);
+bool __real_adv_range_update(adv_range_t *range, const adv_record_t *rec, const adv_info_t *info,
+                             adv_range_estimate_t *est);
+void __real_adv_presence_update(adv_presence_t *presence, const adv_record_t *rec);
+adv_entry_t *__real_adv_table_update(adv_table_t *table, const adv_record_t *rec);
+int __real_adv_json_encode(const adv_record_t *rec, const adv_stats_t *stats, const char *esp_name,
+                           char *out, size_t size);
+int __real_adv_frame_encode(const adv_record_t *rec, const adv_stats_t *stats, uint8_t *out, size_t size);
+bool __real_gattc_sched_init(gattc_sched_t *sched, gattc_sched_tag_t *tags, uint32_t size,
+                             const gattc_sched_params_t *params, uint32_t now_ms);
+bool __real_gattc_cache_init(gattc_cache_t *cache, gattc_cache_entry_t *entries, uint32_t size);
+bool __real_gattc_stream_init(gattc_stream_t *st, gattc_stream_entry_t *entries, uint32_t size,
+                              uint8_t *storage, size_t storage_len, const gattc_stream_params_t *params);
+bool __real_time_sync_init(time_sync_t *ts, const time_sync_params_t *params);
+bool __real_time_sync_fleet(const time_sync_t *ts, int64_t local_us, int64_t *fleet_us, uint32_t *error_us);
+
+static const char *const stage_names[PROBE_STAGES] = {
+    [PROBE_GAP_CB]     = "gap_cb",
+    [PROBE_QUEUE]      = "queue",
+    [PROBE_PARSE]      = "parse",
+    [PROBE_RANGE]      = "range",
+    [PROBE_PRESENCE]   = "presence",
+    [PROBE_AGGREGATE]  = "aggregate",
+    [PROBE_ENCODE]     = "encode",
+    [PROBE_PUBLISH]    = "publish",
+    [PROBE_END_TO_END] = "end_to_end",
+};
+
+static probe_hist_t hists[PROBE_STAGES];
+static probe_hist_t time_error;
+
+// Pipeline state, seen in the wrapped calls
+static adv_ring_t *adv_ring = NULL;
+static adv_merge_t *adv_merge = NULL;
+static gattc_sched_t *gattc_sched = NULL;
+static gattc_cache_t *gattc_cache = NULL;
+static gattc_stream_t *gattc_streams = NULL;
+static uint64_t stream_memory = 0;
+static time_sync_t *time_sync = NULL;
+static uint64_t time_within = 0;
+static adv_range_t *adv_range = NULL;
+static adv_presence_t *adv_presence = NULL;
+static uint64_t *ring_stamps = NULL;
+
+static uint64_t table_overflow = 0;
+static uint64_t messages = 0;
+static uint64_t bytes = 0;
+static uint64_t advert_messages = 0;
+static uint64_t advert_records = 0;
+
+// Publisher task only
+static uint32_t pending_ms[PROBE_PENDING];
+static uint32_t pending = 0;
+
+
+static inline void counter_add(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static uint32_t bucket_index(uint64_t ns) {
+    if (ns < (1u << PROBE_SUB_BITS)) {
+        return (uint32_t)ns;
+    }
+    uint32_t exp = 63 - __builtin_clzll(ns);
+    uint32_t sub = (ns >> (exp - PROBE_SUB_BITS)) & ((1u << PROBE_SUB_BITS) - 1);
+    return ((exp - PROBE_SUB_BITS + 1) << PROBE_SUB_BITS) + sub;
+}
+
+/*
+ * Highest value of a bucket
+ */
+static uint64_t bucket_upper(uint32_t index) {
+    if (index < (1u << PROBE_SUB_BITS)) {
+        return index;
+    }
+    uint32_t exp = (index >> PROBE_SUB_BITS) + PROBE_SUB_BITS - 1;
+    uint64_t sub = index & ((1u << PROBE_SUB_BITS) - 1);
+    uint64_t width = 1ull << (exp - PROBE_SUB_BITS);
+    return (((1ull << PROBE_SUB_BITS) + sub) << (exp - PROBE_SUB_BITS)) + width - 1;
+}
+
+static void hist_add(probe_hist_t *hist, uint64_t ns) {
+    counter_add(&hist->count, 1);
+    counter_add(&hist->sum_ns, ns);
+    counter_add(&hist->buckets[bucket_index(ns)], 1);
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void probe_record(probe_stage_t stage, uint64_t ns) {
+    hist_add(&hists[stage], ns);
+}
+
+uint64_t probe_percentile(const probe_hist_t *hist, double q) {
+    uint64_t count = hist->count;
+    uint64_t target, seen = 0;
+    if (count == 0) {
+        return 0;
+    }
+    target = (uint64_t)(q * count);
+    if (target < q * count || target == 0) {
+        target++;
+    }
+    for (uint32_t i = 0; i < PROBE_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            uint64_t upper = bucket_upper(i);
+            return upper < hist->max_ns ? upper : hist->max_ns;
+        }
+    }
+    return hist->max_ns;
+}
+
+const probe_hist_t *probe_hist(probe_stage_t stage) {
+    return &hists[stage];
+}
+
+const probe_hist_t *probe_time_error(void) {
+    return &time_error;
+}
+
+const char *probe_stage_name(probe_stage_t stage) {
+    return stage_names[stage];
+}
+
+void probe_get(probe_counters_t *counters) {
+    adv_ring_stats_t stats;
+
+    memset(counters, 0, sizeof(*counters));
+    if (adv_ring) {
+        adv_ring_get_stats(adv_ring, &stats);
+        counters->pushed = stats.pushed;
+        counters->popped = stats.popped;
+        counters->dropped_newest = stats.dropped_newest;
+        counters->dropped_oldest = stats.dropped_oldest;
+        counters->coalesced = stats.coalesced;
+        counters->high_water = stats.high_water;
+    }
+    adv_merge_t *merge = __atomic_load_n(&adv_merge, __ATOMIC_ACQUIRE);
+    if (merge) {
+        adv_merge_stats_t merged;
+        adv_merge_get_stats(merge, &merged);
+        counters->scannable = merged.adverts;
+        counters->scan_responses = merged.responses;
+        counters->merged = merged.merged;
+        counters->rsp_expired = merged.expired;
+        counters->rsp_evicted = merged.evicted;
+        counters->rsp_orphans = merged.orphans;
+        counters->rsp_airtime_us = merged.airtime_us;
+    }
+    gattc_sched_t *sched = __atomic_load_n(&gattc_sched, __ATOMIC_ACQUIRE);
+    if (sched) {
+        gattc_sched_stats_t gatt;
+        gattc_sched_get_stats(sched, &gatt);
+        counters->gatt_tags = gatt.tags;
+        counters->gatt_started = gatt.started;
+        counters->gatt_read = gatt.read;
+        counters->gatt_failed = gatt.failed;
+        counters->gatt_timeouts = gatt.timeouts;
+        counters->gatt_deferred = gatt.deferred;
+        counters->gatt_busy_ms = gatt.busy_ms;
+        counters->gatt_streams = gatt.streams;
+    }
+    gattc_cache_t *cache = __atomic_load_n(&gattc_cache, __ATOMIC_ACQUIRE);
+    if (cache) {
+        gattc_cache_stats_t layouts;
+        gattc_cache_get_stats(cache, &layouts);
+        counters->gatt_cache_hits = layouts.hits_address + layouts.hits_model;
+        counters->gatt_cache_model = layouts.hits_model;
+        counters->gatt_cache_misses = layouts.misses;
+        counters->gatt_cache_invalidated = layouts.invalidated;
+    }
+    gattc_stream_t *streams = __atomic_load_n(&gattc_streams, __ATOMIC_ACQUIRE);
+    if (streams) {
+        gattc_stream_stats_t stream;
+        gattc_stream_get_stats(streams, &stream);
+        counters->stream_received = stream.received;
+        counters->stream_batched = stream.batched;
+        counters->stream_dropped = stream.dropped;
+        counters->stream_decimated = stream.decimated;
+        counters->stream_published = stream.published;
+        counters->stream_bytes = stream.bytes;
+        counters->stream_memory = stream_memory;
+    }
+    time_sync_t *ts = __atomic_load_n(&time_sync, __ATOMIC_ACQUIRE);
+    if (ts) {
+        time_sync_stats_t sync;
+        time_sync_get_stats(ts, &sync);
+        counters->time_requests = sync.requests;
+        counters->time_responses = sync.responses;
+        counters->time_rejected = sync.rejected;
+        counters->time_steps = sync.steps;
+        counters->time_rtt_min_us = sync.rtt_min_us;
+        counters->time_error_us = sync.error_us;
+        counters->time_drift_ppb = sync.drift_ppb;
+        counters->time_stamped = __atomic_load_n(&time_error.count, __ATOMIC_RELAXED);
+        counters->time_within = __atomic_load_n(&time_within, __ATOMIC_RELAXED);
+    }
+    counters->radio_lost = host_bt_radio_lost();
+    if (adv_range) {
+        counters->range_evicted = __atomic_load_n(&adv_range->evicted, __ATOMIC_RELAXED);
+    }
+    if (adv_presence) {
+        counters->presence_evicted = __atomic_load_n(&adv_presence->evicted, __ATOMIC_RELAXED);
+    }
+    counters->table_overflow = __atomic_load_n(&table_overflow, __ATOMIC_RELAXED);
+    counters->messages = __atomic_load_n(&messages, __ATOMIC_RELAXED);
+    counters->bytes = __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+    counters->advert_messages = __atomic_load_n(&advert_messages, __ATOMIC_RELAXED);
+    counters->advert_records = __atomic_load_n(&advert_records, __ATOMIC_RELAXED);
+}
+
+bool probe_idle(void) {
+    return probe_queued() == 0;
+}
+
+uint32_t probe_queued(void) {
+    adv_ring_t *ring = __atomic_load_n(&adv_ring, __ATOMIC_ACQUIRE);
+    return ring ? adv_ring_count(ring) : 0;
+}
+
+/*
+ * Advert ring, producer side: stamp the slot before it is published
+ */
+bool __wrap_adv_ring_push(adv_ring_t *ring, const adv_record_t *rec) {
+    if (adv_ring == NULL) {
+        ring_stamps = calloc(ring->mask + 1, sizeof(*ring_stamps));
+        __atomic_store_n(&adv_ring, ring, __ATOMIC_RELEASE);
+    }
+    uint32_t head = ring->head;
+    uint64_t stamp = (uint64_t)(head & 0xFFFF) << STAMP_TIME_BITS | (host_time_ns() & STAMP_TIME_MASK);
+    __atomic_store_n(&ring_stamps[head & ring->mask], stamp, __ATOMIC_RELAXED);
+    return __real_adv_ring_push(ring, rec);
+}
+
+/*
+ * Consumer side, the popped positions are known unless the producer dropped
+ * the oldest record meanwhile, their samples are then skipped
+ */
+static void popped(adv_ring_t *ring, uint32_t n) {
+    uint32_t end = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t now = host_time_ns() & STAMP_TIME_MASK;
+
+    for (uint32_t pos = end - n; pos != end; pos++) {
+        uint64_t stamp = __atomic_load_n(&ring_stamps[pos & ring->mask], __ATOMIC_RELAXED);
+        if ((stamp >> STAMP_TIME_BITS) == (pos & 0xFFFF)) {
+            probe_record(PROBE_QUEUE, (now - (stamp & STAMP_TIME_MASK)) & STAMP_TIME_MASK);
+        }
+    }
+}
+
+bool __wrap_adv_ring_pop(adv_ring_t *ring, adv_record_t *rec) {
+    if (!__real_adv_ring_pop(ring, rec)) {
+        return false;
+    }
+    popped(ring, 1);
+    return true;
+}
+
+uint32_t __wrap_adv_ring_pop_batch(adv_ring_t *ring, adv_record_t *recs, uint32_t max) {
+    uint32_t n = __real_adv_ring_pop_batch(ring, recs, max);
+    if (n) {
+        popped(ring, n);
+    }
+    return n;
+}
+
+/*
+ * Scan response merging, only seen with active scanning
+ */
+bool __wrap_adv_merge_put(adv_merge_t *merge, const adv_record_t *rec, adv_merge_kind_t kind, adv_record_t *out) {
+    __atomic_store_n(&adv_merge, merge, __ATOMIC_RELEASE);
+    return __real_adv_merge_put(merge, rec, kind, out);
+}
+
+/*
+ * GATT client scheduler, CONFIG_TRACKER_GATTC only
+ */
+bool __wrap_gattc_sched_init(gattc_sched_t *sched, gattc_sched_tag_t *tags, uint32_t size,
+                             const gattc_sched_params_t *params, uint32_t now_ms) {
+    bool ok = __real_gattc_sched_init(sched, tags, size, params, now_ms);
+    if (ok) {
+        __atomic_store_n(&gattc_sched, sched, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+bool __wrap_gattc_cache_init(gattc_cache_t *cache, gattc_cache_entry_t *entries, uint32_t size) {
+    bool ok = __real_gattc_cache_init(cache, entries, size);
+    if (ok) {
+        __atomic_store_n(&gattc_cache, cache, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+/*
+ * GATT notification streams, CONFIG_TRACKER_GATTC_STREAMS only
+ */
+bool __wrap_gattc_stream_init(gattc_stream_t *st, gattc_stream_entry_t *entries, uint32_t size,
+                              uint8_t *storage, size_t storage_len, const gattc_stream_params_t *params) {
+    bool ok = __real_gattc_stream_init(st, entries, size, storage, storage_len, params);
+    if (ok) {
+        stream_memory = storage_len + size * sizeof(*entries) + sizeof(*st);
+        __atomic_store_n(&gattc_streams, st, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+/*
+ * Fleet time, CONFIG_TRACKER_TIME_SYNC only: the mapping of each advert
+ * against the time server of the MQTT shim
+ */
+bool __wrap_time_sync_init(time_sync_t *ts, const time_sync_params_t *params) {
+    bool ok = __real_time_sync_init(ts, params);
+    if (ok) {
+        __atomic_store_n(&time_sync, ts, __ATOMIC_RELEASE);
+    }
+    return ok;
+}
+
+bool __wrap_time_sync_fleet(const time_sync_t *ts, int64_t local_us, int64_t *fleet_us, uint32_t *error_us) {
+    uint32_t estimate;
+    bool ok = __real_time_sync_fleet(ts, local_us, fleet_us, &estimate);
+    if (ok) {
+        int64_t error = *fleet_us - host_fleet_time(local_us);
+        uint64_t abs_error = error < 0 ? -error : error;
+        if (abs_error <= estimate) {
+            counter_add(&time_within, 1);
+        }
+        hist_add(&time_error, abs_error * 1000);
+        if (error_us) {
+            *error_us = estimate;
+        }
+    }
+    return ok;
+}
+
+void __wrap_adv_parse(const adv_record_t *rec, adv_info_t *info) {
+    uint64_t start = host_time_ns();
+    __real_adv_parse(rec, info);
+    probe_record(PROBE_PARSE, host_time_ns() - start);
+}
+
+bool __wrap_adv_range_update(adv_range_t *range, const adv_record_t *rec, const adv_info_t *info,
+                             adv_range_estimate_t *est) {
+    adv_range = range;
+    uint64_t start = host_time_ns();
+    bool ret = __real_adv_range_update(range, rec, info, est);
+    probe_record(PROBE_RANGE, host_time_ns() - start);
+    return ret;
+}
+
+void __wrap_adv_presence_update(adv_presence_t *presence, const adv_record_t *rec) {
+    adv_presence = presence;
+    uint64_t start = host_time_ns();
+    __real_adv_presence_update(presence, rec);
+    probe_record(PROBE_PRESENCE, host_time_ns() - start);
+}
+
+adv_entry_t *__wrap_adv_table_update(adv_table_t *table, const adv_record_t *rec) {
+    uint64_t start = host_time_ns();
+    adv_entry_t *entry = __real_adv_table_update(table, rec);
+    probe_record(PROBE_AGGREGATE, host_time_ns() - start);
+    if (entry == NULL) {
+        counter_add(&table_overflow, 1);
+    }
+    return entry;
+}
+
+/*
+ * An encoded advert is published with the next message on the advert topic
+ */
+static void encoded(const adv_record_t *rec, int len, uint64_t start) {
+    probe_record(PROBE_ENCODE, host_time_ns() - start);
+    if (len >= 0 && pending < PROBE_PENDING) {
+        pending_ms[pending++] = rec->time_ms;
+    }
+}
+
+int __wrap_adv_json_encode(const adv_record_t *rec, const adv_stats_t *stats, const char *esp_name,
+                           char *out, size_t size) {
+    uint64_t start = host_time_ns();
+    int len = __real_adv_json_encode(rec, stats, esp_name, out, size);
+    encoded(rec, len, start);
+    return len;
+}
+
+int __wrap_adv_frame_encode(const adv_record_t *rec, const adv_stats_t *stats, uint8_t *out, size_t size) {
+    uint64_t start = host_time_ns();
+    int len = __real_adv_frame_encode(rec, stats, out, size);
+    encoded(rec, len, start);
+    return len;
+}
+
+void probe_publish(const char *topic, size_t len, uint64_t start_ns, uint64_t end_ns) {
+    size_t prefix = strlen(PROBE_ADV_TOPIC);
+
+    counter_add(&messages, 1);
+    counter_add(&bytes, len);
+    probe_record(PROBE_PUBLISH, end_ns - start_ns);
+    if (strncmp(topic, PROBE_ADV_TOPIC, prefix) != 0 || (topic[prefix] != '\0' && topic[prefix] != '/')) {
+        return;
+    }
+    uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    for (uint32_t i = 0; i < pending; i++) {
+        probe_record(PROBE_END_TO_END, (uint64_t)(now_ms - pending_ms[i]) * 1000000);
+    }
+    counter_add(&advert_messages, 1);
+    counter_add(&advert_records, pending);
+    pending = 0;
+}
@@ -0,0 +1,126 @@
+#ifndef __PROBE_H__
+#define __PROBE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Pipeline probes of the host build
+ * The main/ modules are linked with -Wl,--wrap so each stage is timed without
+ * touching the tracker code; main.c internals are observed through the
+ * arguments of the wrapped calls.
+ */
+
+typedef enum {
+    PROBE_GAP_CB = 0,       // Scan result callback: copy and queue
+    PROBE_QUEUE,            // Waiting in the advert ring, push to pop
+    PROBE_PARSE,            // adv_parse(), including the one of the JSON encoder
+    PROBE_RANGE,            // adv_range_update()
+    PROBE_PRESENCE,         // adv_presence_update(), with its reports
+    PROBE_AGGREGATE,        // adv_table_update()
+    PROBE_ENCODE,           // adv_json_encode() or adv_frame_encode()
+    PROBE_PUBLISH,          // mqtt_publish()
+    PROBE_END_TO_END,       // Advert received to published, ms resolution
+    PROBE_STAGES,
+} probe_stage_t;
+
+// Log-linear histogram: 8 sub-buckets per power of 2, below 12.5% error
+#define PROBE_SUB_BITS  3
+#define PROBE_BUCKETS   (64 << PROBE_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[PROBE_BUCKETS];
+} probe_hist_t;
+
+/*
+ * Counters, snapshot taken by probe_get()
+ */
+typedef struct {
+    uint64_t pushed;            // Accepted by the advert ring
+    uint64_t popped;
+    uint64_t dropped_newest;
+    uint64_t dropped_oldest;
+    uint64_t coalesced;
+    uint32_t high_water;
+    uint64_t table_overflow;    // Adverts not aggregated, window table full
+    uint64_t range_evicted;     // Devices evicted from the distance estimator
+    uint64_t presence_evicted;  // Devices evicted from the registry
+    uint64_t messages;          // MQTT messages, all topics
+    uint64_t bytes;
+    uint64_t advert_messages;   // On the advert topic
+    uint64_t advert_records;    // Advert records published
+    uint64_t scannable;         // Active scan: adverts waiting for their scan response
+    uint64_t scan_responses;
+    uint64_t merged;            // Responses merged with their advert
+    uint64_t rsp_expired;       // Adverts published without response
+    uint64_t rsp_evicted;
+    uint64_t rsp_orphans;       // Responses without advert
+    uint64_t rsp_airtime_us;    // Scan requests and responses on air
+    uint64_t gatt_tags;         // GATT client: tags found
+    uint64_t gatt_started;      // Jobs
+    uint64_t gatt_read;
+    uint64_t gatt_failed;
+    uint64_t gatt_timeouts;
+    uint64_t gatt_deferred;
+    uint64_t gatt_busy_ms;
+    uint64_t gatt_cache_hits;   // Jobs reading with a cached layout
+    uint64_t gatt_cache_model;  // of which the layout of another unit of the model
+    uint64_t gatt_cache_misses; // Jobs discovering the services
+    uint64_t gatt_cache_invalidated;
+    uint64_t gatt_streams;      // Connections kept for notifications
+    uint64_t stream_received;   // Notifications
+    uint64_t stream_batched;
+    uint64_t stream_dropped;
+    uint64_t stream_decimated;
+    uint64_t stream_published;  // Batches
+    uint64_t stream_bytes;
+    uint64_t stream_memory;     // Static buffers and entries
+    uint64_t radio_lost;        // Adverts missed to connections
+    uint64_t time_requests;     // Fleet time exchanges
+    uint64_t time_responses;
+    uint64_t time_rejected;
+    uint64_t time_steps;
+    uint64_t time_rtt_min_us;
+    uint64_t time_error_us;     // Estimated by the tracker
+    int64_t  time_drift_ppb;
+    uint64_t time_stamped;      // Encodes with a fleet time, retries included
+    uint64_t time_within;       // of which off the truth by no more than the estimate
+} probe_counters_t;
+
+/*
+ * Record one sample of a stage
+ */
+void probe_record(probe_stage_t stage, uint64_t ns);
+
+/*
+ * Value below which a fraction q of the samples are, upper bound of its bucket
+ */
+uint64_t probe_percentile(const probe_hist_t *hist, double q);
+
+void probe_get(probe_counters_t *counters);
+
+const probe_hist_t *probe_hist(probe_stage_t stage);
+
+/*
+ * Fleet time of the adverts encoded, absolute error to host_fleet_time()
+ */
+const probe_hist_t *probe_time_error(void);
+
+const char *probe_stage_name(probe_stage_t stage);
+
+/*
+ * true when the advert ring is empty
+ */
+bool probe_idle(void);
+
+/*
+ * Adverts waiting in the advert ring
+ */
+uint32_t probe_queued(void);
+
+#endif
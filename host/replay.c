@@ -0,0 +1,245 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "host.h"
+#include "probe.h"
+#include "driver.h"
+#include "adv_capture.h"
+
+/*
+ * Capture replay for the host build
+ * Maps capture files (adv_capture.h), MQTT streams or flash dumps, and feeds
+ * their scan results to the tracker with the captured timing, scaled by a
+ * speed factor, or as fast as the pipeline takes them: the replay then
+ * waits for the advert queue instead of overflowing it. Files are read in
+ * place and pages already replayed are released, so captures larger than
+ * memory replay in constant space.
+ * The tracker stamps adverts on reception, a faster replay compresses its
+ * time and the presence and window timings with it.
+ */
+
+#define RELEASE_BYTES   (64u << 20)     // Replayed bytes between two page releases
+
+typedef struct {
+    double   speed;                     // 0: as fast as possible
+    const char *scan;
+    uint32_t publish_us;
+    uint32_t drain_ms;
+    bool     json;
+} options_t;
+
+typedef struct {
+    uint32_t files;
+    uint64_t bytes;
+    uint64_t capture_ms;                // Captured time replayed
+    adv_capture_reader_stats_t capture;
+} replay_stats_t;
+
+typedef struct {
+    bool     started;
+    uint32_t last_ms;                   // Capture time of the previous advert
+    uint64_t offset_ns;                 // Of the previous advert, from the start
+    uint64_t start_ns;
+} replay_clock_t;
+
+
+/*
+ * Schedule of the next advert, from the capture time
+ * Time going backwards, a reboot or the next file, is replayed as no delay.
+ */
+static uint64_t replay_due(replay_clock_t *clock, const options_t *opt, uint32_t time_ms,
+                           replay_stats_t *stats) {
+    if (!clock->started) {
+        clock->started = true;
+        clock->start_ns = host_time_ns();
+    } else {
+        int32_t delta_ms = (int32_t)(time_ms - clock->last_ms);
+        if (delta_ms > 0) {
+            stats->capture_ms += delta_ms;
+            if (opt->speed > 0) {
+                clock->offset_ns += (uint64_t)(delta_ms * 1e6 / opt->speed);
+            }
+        }
+    }
+    clock->last_ms = time_ms;
+    return clock->start_ns + clock->offset_ns;
+}
+
+static bool replay_file(const char *path, const options_t *opt, replay_clock_t *clock,
+                        driver_result_t *result, replay_stats_t *stats) {
+    adv_capture_reader_t reader;
+    adv_record_t rec;
+    struct stat st;
+    size_t released = 0;
+    long page = sysconf(_SC_PAGESIZE);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    stats->files++;
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    adv_capture_reader_init(&reader, data, st.st_size);
+    while (adv_capture_next(&reader, &rec)) {
+        uint64_t due = replay_due(clock, opt, rec.time_ms, stats);
+        if (opt->speed > 0) {
+            if (due > host_time_ns()) {
+                driver_sleep_until(due);
+            }
+            driver_advert(result, &rec, due);
+        } else {
+            while (probe_queued() >= CONFIG_TRACKER_RING_SIZE / 2) {
+                sched_yield();
+            }
+            driver_advert(result, &rec, 0);
+        }
+        // Replayed pages are not needed anymore
+        if (reader.pos - released >= RELEASE_BYTES) {
+            size_t upto = reader.pos & ~(size_t)(page - 1);
+            madvise(data + released, upto - released, MADV_DONTNEED);
+            released = upto;
+        }
+    }
+    munmap(data, st.st_size);
+
+    const adv_capture_reader_stats_t *rs = &reader.stats;
+    stats->bytes += st.st_size;
+    stats->capture.adverts += rs->adverts;
+    stats->capture.syncs += rs->syncs;
+    stats->capture.skipped += rs->skipped;
+    stats->capture.corrupted += rs->corrupted;
+    stats->capture.lost += rs->lost;
+    if (rs->syncs == 0) {
+        fprintf(stderr, "%s: no capture records\n", path);
+    }
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options] FILE...\n"
+            "  -s, --speed X          replay speed, 1 as captured (1)\n"
+            "  -f, --fast             replay as fast as the tracker takes the adverts\n"
+            "      --scan CMD         scan command published on /tracker/scan first\n"
+            "      --publish-us US    simulated cost of each MQTT publish (0)\n"
+            "      --drain-ms MS      wait after the replay for the last windows (%u)\n"
+            "  -j, --json             JSON report\n"
+            "  -v, --verbose          tracker logs, repeat for more\n",
+            prog, 2 * CONFIG_TRACKER_SCAN_WINDOW_MS + 500);
+}
+
+static long max_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+        { "speed",      required_argument, NULL, 's' },
+        { "fast",       no_argument,       NULL, 'f' },
+        { "scan",       required_argument, NULL, 'S' },
+        { "publish-us", required_argument, NULL, 'P' },
+        { "drain-ms",   required_argument, NULL, 'D' },
+        { "json",       no_argument,       NULL, 'j' },
+        { "verbose",    no_argument,       NULL, 'v' },
+        { "help",       no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    options_t opt = {
+        .speed = 1,
+        .drain_ms = 2 * CONFIG_TRACKER_SCAN_WINDOW_MS + 500,
+    };
+    esp_log_level_t level = ESP_LOG_WARN;
+    driver_result_t result;
+    replay_stats_t stats;
+    replay_clock_t clock;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "s:fjvh", long_options, NULL)) != -1) {
+        switch (c) {
+        case 's': opt.speed = strtod(optarg, NULL); break;
+        case 'f': opt.speed = 0; break;
+        case 'S': opt.scan = optarg; break;
+        case 'P': opt.publish_us = strtoul(optarg, NULL, 0); break;
+        case 'D': opt.drain_ms = strtoul(optarg, NULL, 0); break;
+        case 'j': opt.json = true; break;
+        case 'v': level = level < ESP_LOG_VERBOSE ? level + 1 : level; break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind >= argc || opt.speed < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    host_log_level(level);
+    host_mqtt_publish_cost(opt.publish_us);
+
+    if (!driver_start(opt.scan)) {
+        return 1;
+    }
+    memset(&result, 0, sizeof(result));
+    memset(&stats, 0, sizeof(stats));
+    memset(&clock, 0, sizeof(clock));
+    double cpu_start = driver_cpu_seconds();
+    uint64_t start = host_time_ns();
+    for (int i = optind; i < argc; i++) {
+        if (!replay_file(argv[i], &opt, &clock, &result, &stats)) {
+            return 1;
+        }
+    }
+    result.elapsed_s = (host_time_ns() - start) / 1e9;
+    double cpu_s = driver_cpu_seconds() - cpu_start;
+    driver_drain(opt.drain_ms);
+
+    const adv_capture_reader_stats_t *cs = &stats.capture;
+    if (opt.json) {
+        printf("{\"files\":%u,\"file_bytes\":%llu,\"speed\":%g,\"capture_s\":%.3f,\"captured\":%llu,"
+               "\"syncs\":%llu,\"corrupted\":%llu,\"skipped_bytes\":%llu,\"lost_at_capture\":%llu,"
+               "\"max_rss_kb\":%ld,",
+               stats.files, (unsigned long long)stats.bytes, opt.speed, stats.capture_ms / 1e3,
+               (unsigned long long)cs->adverts, (unsigned long long)cs->syncs,
+               (unsigned long long)cs->corrupted, (unsigned long long)cs->skipped,
+               (unsigned long long)cs->lost, max_rss_kb());
+    } else {
+        if (opt.speed > 0) {
+            printf("Replay: %u files, %llu bytes, %.1f s captured at %gx in %.1f s\n", stats.files,
+                   (unsigned long long)stats.bytes, stats.capture_ms / 1e3, opt.speed, result.elapsed_s);
+        } else {
+            printf("Replay: %u files, %llu bytes, %.1f s captured as fast as possible in %.1f s\n", stats.files,
+                   (unsigned long long)stats.bytes, stats.capture_ms / 1e3, result.elapsed_s);
+        }
+        printf("Capture: %llu adverts, %llu sync records, %llu corrupted, %llu bytes skipped, "
+               "%llu adverts lost on the tracker, max RSS %ld kB\n",
+               (unsigned long long)cs->adverts, (unsigned long long)cs->syncs,
+               (unsigned long long)cs->corrupted, (unsigned long long)cs->skipped,
+               (unsigned long long)cs->lost, max_rss_kb());
+    }
+    driver_report(&result, cpu_s, opt.json);
+    return 0;
+}
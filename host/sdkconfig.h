@@ -0,0 +1,230 @@
+#ifndef __SDKCONFIG_H__
+#define __SDKCONFIG_H__
+
+/*
+ * Host build configuration, the defaults of main/Kconfig.projbuild
+ * Any option can be overridden from the command line, e.g.
+ *   make CONFIG="-DCONFIG_TRACKER_WIRE_FORMAT_BINARY=1 -DCONFIG_TRACKER_AGGREGATE=0"
+ * Booleans are tested with #if, disable them with =0.
+ */
+
+// Network configuration, unused on the host
+#ifndef CONFIG_ESP_NAME
+#define CONFIG_ESP_NAME "ESP32_Name_"
+#endif
+#ifndef CONFIG_WIFI_SSID
+#define CONFIG_WIFI_SSID "myssid"
+#endif
+#ifndef CONFIG_WIFI_PASSWORD
+#define CONFIG_WIFI_PASSWORD "myPassword"
+#endif
+#ifndef CONFIG_MQTT_SERVER
+#define CONFIG_MQTT_SERVER "domain.com"
+#endif
+#ifndef CONFIG_MQTT_PORT
+#define CONFIG_MQTT_PORT 1883
+#endif
+#ifndef CONFIG_MQTT_USERNAME
+#define CONFIG_MQTT_USERNAME "username"
+#endif
+#ifndef CONFIG_MQTT_PASSWORD
+#define CONFIG_MQTT_PASSWORD "password"
+#endif
+
+// Tracker Configuration
+#ifndef CONFIG_TRACKER_GROUP
+#define CONFIG_TRACKER_GROUP ""
+#endif
+#ifndef CONFIG_TRACKER_WIRE_FORMAT_BINARY
+#define CONFIG_TRACKER_WIRE_FORMAT_BINARY 0
+#endif
+#ifndef CONFIG_TRACKER_RING_SIZE
+#define CONFIG_TRACKER_RING_SIZE 64
+#endif
+#ifndef CONFIG_TRACKER_RING_DROP_NEWEST
+#define CONFIG_TRACKER_RING_DROP_NEWEST 0
+#endif
+#ifndef CONFIG_TRACKER_RING_COALESCE
+#define CONFIG_TRACKER_RING_COALESCE 0
+#endif
+#ifndef CONFIG_TRACKER_AGGREGATE
+#define CONFIG_TRACKER_AGGREGATE 1
+#endif
+#ifndef CONFIG_TRACKER_TABLE_SIZE
+#define CONFIG_TRACKER_TABLE_SIZE 128
+#endif
+#ifndef CONFIG_TRACKER_BATCH
+#define CONFIG_TRACKER_BATCH 1
+#endif
+#ifndef CONFIG_TRACKER_BATCH_BYTES
+#define CONFIG_TRACKER_BATCH_BYTES 1024
+#endif
+#ifndef CONFIG_TRACKER_BATCH_RECORDS
+#define CONFIG_TRACKER_BATCH_RECORDS 32
+#endif
+#ifndef CONFIG_TRACKER_BATCH_MAX_AGE_MS
+#define CONFIG_TRACKER_BATCH_MAX_AGE_MS 500
+#endif
+#ifndef CONFIG_TRACKER_PUBLISH_ADVERTS
+#define CONFIG_TRACKER_PUBLISH_ADVERTS 1
+#endif
+#ifndef CONFIG_TRACKER_PRESENCE
+#define CONFIG_TRACKER_PRESENCE 1
+#endif
+#ifndef CONFIG_TRACKER_PRESENCE_DEVICES
+#define CONFIG_TRACKER_PRESENCE_DEVICES 1024
+#endif
+#ifndef CONFIG_TRACKER_PRESENCE_ENTER_COUNT
+#define CONFIG_TRACKER_PRESENCE_ENTER_COUNT 2
+#endif
+#ifndef CONFIG_TRACKER_PRESENCE_ENTER_RSSI
+#define CONFIG_TRACKER_PRESENCE_ENTER_RSSI -90
+#endif
+#ifndef CONFIG_TRACKER_PRESENCE_LEAVE_RSSI
+#define CONFIG_TRACKER_PRESENCE_LEAVE_RSSI -95
+#endif
+#ifndef CONFIG_TRACKER_PRESENCE_LEAVE_S
+#define CONFIG_TRACKER_PRESENCE_LEAVE_S 90
+#endif
+#ifndef CONFIG_TRACKER_PRESENCE_HEARTBEAT_S
+#define CONFIG_TRACKER_PRESENCE_HEARTBEAT_S 300
+#endif
+#ifndef CONFIG_TRACKER_RANGE
+#define CONFIG_TRACKER_RANGE 1
+#endif
+#ifndef CONFIG_TRACKER_RANGE_DEVICES
+#define CONFIG_TRACKER_RANGE_DEVICES 1024
+#endif
+#ifndef CONFIG_TRACKER_RANGE_THRESHOLD_CM
+#define CONFIG_TRACKER_RANGE_THRESHOLD_CM 50
+#endif
+#ifndef CONFIG_TRACKER_RANGE_REF_POWER
+#define CONFIG_TRACKER_RANGE_REF_POWER -59
+#endif
+#ifndef CONFIG_TRACKER_RANGE_PATH_LOSS
+#define CONFIG_TRACKER_RANGE_PATH_LOSS 20
+#endif
+#ifndef CONFIG_TRACKER_RANGE_MEASUREMENT_NOISE
+#define CONFIG_TRACKER_RANGE_MEASUREMENT_NOISE 16
+#endif
+#ifndef CONFIG_TRACKER_RANGE_PROCESS_NOISE
+#define CONFIG_TRACKER_RANGE_PROCESS_NOISE 100
+#endif
+#ifndef CONFIG_TRACKER_LOG
+#define CONFIG_TRACKER_LOG 1
+#endif
+#ifndef CONFIG_TRACKER_LOG_REPLAY_RATE
+#define CONFIG_TRACKER_LOG_REPLAY_RATE 20
+#endif
+#ifndef CONFIG_TRACKER_STATS
+#define CONFIG_TRACKER_STATS 1
+#endif
+#ifndef CONFIG_TRACKER_STATS_TOPIC
+#define CONFIG_TRACKER_STATS_TOPIC "/tracker/stats"
+#endif
+#ifndef CONFIG_TRACKER_STATS_PERIOD_S
+#define CONFIG_TRACKER_STATS_PERIOD_S 60
+#endif
+#ifndef CONFIG_TRACKER_TIME_SYNC
+#define CONFIG_TRACKER_TIME_SYNC 1
+#endif
+#ifndef CONFIG_TRACKER_TIME_SYNC_PERIOD_S
+#define CONFIG_TRACKER_TIME_SYNC_PERIOD_S 16
+#endif
+#ifndef CONFIG_TRACKER_TIME_SYNC_TIMEOUT_MS
+#define CONFIG_TRACKER_TIME_SYNC_TIMEOUT_MS 1000
+#endif
+#if !defined(CONFIG_TRACKER_CAPTURE_MQTT) && !defined(CONFIG_TRACKER_CAPTURE_FLASH)
+#define CONFIG_TRACKER_CAPTURE_OFF 1
+#endif
+// The load generator runs a single long scan, duty cycling would drop most adverts
+#ifndef CONFIG_TRACKER_SCAN_CONTINUOUS
+#define CONFIG_TRACKER_SCAN_CONTINUOUS 1
+#endif
+#ifndef CONFIG_TRACKER_SCAN_WINDOW_MS
+#define CONFIG_TRACKER_SCAN_WINDOW_MS 1000
+#endif
+#ifndef CONFIG_TRACKER_SCAN_ADAPTIVE
+#define CONFIG_TRACKER_SCAN_ADAPTIVE 0
+#endif
+#ifndef CONFIG_TRACKER_SCAN_DUTY_MIN
+#define CONFIG_TRACKER_SCAN_DUTY_MIN 20
+#endif
+#ifndef CONFIG_TRACKER_SCAN_DUTY_MAX
+#define CONFIG_TRACKER_SCAN_DUTY_MAX 600
+#endif
+#ifndef CONFIG_TRACKER_SCAN_SIGHTINGS
+#define CONFIG_TRACKER_SCAN_SIGHTINGS 3
+#endif
+#ifndef CONFIG_TRACKER_SCAN_QUEUE_HIGH
+#define CONFIG_TRACKER_SCAN_QUEUE_HIGH 50
+#endif
+#ifndef CONFIG_TRACKER_SCAN_ACTIVE
+#define CONFIG_TRACKER_SCAN_ACTIVE 0
+#endif
+#ifndef CONFIG_TRACKER_SCAN_RSP_CACHE
+#define CONFIG_TRACKER_SCAN_RSP_CACHE 16
+#endif
+#ifndef CONFIG_TRACKER_SCAN_RSP_TIMEOUT_MS
+#define CONFIG_TRACKER_SCAN_RSP_TIMEOUT_MS 50
+#endif
+// Exercised by the load generator, idle without --tags
+#ifndef CONFIG_TRACKER_GATTC
+#define CONFIG_TRACKER_GATTC 1
+#endif
+#ifndef CONFIG_TRACKER_GATTC_SERVICE
+#define CONFIG_TRACKER_GATTC_SERVICE 0x180F
+#endif
+#ifndef CONFIG_TRACKER_GATTC_TAGS
+#define CONFIG_TRACKER_GATTC_TAGS 256
+#endif
+#ifndef CONFIG_TRACKER_GATTC_LINKS
+#define CONFIG_TRACKER_GATTC_LINKS 3
+#endif
+#ifndef CONFIG_TRACKER_GATTC_PERIOD_S
+#define CONFIG_TRACKER_GATTC_PERIOD_S 600
+#endif
+#ifndef CONFIG_TRACKER_GATTC_LOW_BATTERY
+#define CONFIG_TRACKER_GATTC_LOW_BATTERY 20
+#endif
+#ifndef CONFIG_TRACKER_GATTC_DUTY
+#define CONFIG_TRACKER_GATTC_DUTY 300
+#endif
+#ifndef CONFIG_TRACKER_GATTC_CONNECT_TIMEOUT_MS
+#define CONFIG_TRACKER_GATTC_CONNECT_TIMEOUT_MS 2000
+#endif
+#ifndef CONFIG_TRACKER_GATTC_TIMEOUT_MS
+#define CONFIG_TRACKER_GATTC_TIMEOUT_MS 3000
+#endif
+#ifndef CONFIG_TRACKER_GATTC_CACHE
+#define CONFIG_TRACKER_GATTC_CACHE 32
+#endif
+#ifndef CONFIG_TRACKER_GATTC_STREAMS
+#define CONFIG_TRACKER_GATTC_STREAMS 1
+#endif
+#ifndef CONFIG_TRACKER_GATTC_STREAM_SERVICE
+#define CONFIG_TRACKER_GATTC_STREAM_SERVICE 0xFFE0
+#endif
+#ifndef CONFIG_TRACKER_GATTC_STREAM_CHAR
+#define CONFIG_TRACKER_GATTC_STREAM_CHAR 0xFFE1
+#endif
+#ifndef CONFIG_TRACKER_GATTC_STREAM_BYTES
+#define CONFIG_TRACKER_GATTC_STREAM_BYTES 1024
+#endif
+#ifndef CONFIG_TRACKER_GATTC_STREAM_BUFFERS
+#define CONFIG_TRACKER_GATTC_STREAM_BUFFERS 4
+#endif
+#ifndef CONFIG_TRACKER_GATTC_STREAM_AGE_MS
+#define CONFIG_TRACKER_GATTC_STREAM_AGE_MS 250
+#endif
+#ifndef CONFIG_TRACKER_GATTC_STREAM_DROP
+#define CONFIG_TRACKER_GATTC_STREAM_DROP 0
+#endif
+#ifndef CONFIG_TRACKER_PUBLISHER_CORE
+#define CONFIG_TRACKER_PUBLISHER_CORE 1
+#endif
+#ifndef CONFIG_TRACKER_HANDOFF_BATCH
+#define CONFIG_TRACKER_HANDOFF_BATCH 8
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "adv_batch.h"
+#include "adv_json.h"
+#include "adv_frame.h"
+#include "mqtt.h"
+
+/*
+ * Unit tests of the advert batching stage, adv_batch.h, then adverts at
+ * several rates batched into a broker stand-in that checks each message
+ * against the MQTT client buffer and decodes it, with messages/s, bytes per
+ * advert and the batch fill histogram
+ *   make -C host test
+ */
+
+#define TOPIC           "/test/ESP32_Name_42"
+#define ESP_NAME        "ESP32_Name_42"
+#define MQTT_HEADER_LEN 5               // Fixed header and topic length, QoS 0
+#define PAYLOAD_MAX     (CONFIG_MQTT_BUFFER_SIZE_BYTE - MQTT_HEADER_LEN - 64)
+#define CYCLE_MS        3000            // SCAN_DURATION_S
+#define RUN_MS          30000
+
+/*
+ * Broker stand-in, accounts what reaches the wire
+ */
+typedef struct {
+    bool     json;
+    uint32_t messages;
+    uint32_t records;
+    uint32_t wire_bytes;        // MQTT header, topic and payload
+    uint32_t oversize;
+    uint32_t malformed;
+} broker_t;
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+/*
+ * Top level objects of a JSON array, -1 if it is not one
+ */
+static int json_array_count(const uint8_t *data, size_t len) {
+    int depth = 0, count = 0;
+    bool string = false;
+
+    if (len < 2 || data[0] != '[' || data[len - 1] != ']') {
+        return -1;
+    }
+    for (size_t i = 1; i < len - 1; i++) {
+        uint8_t c = data[i];
+        if (string) {
+            if (c == '\\') {
+                i++;
+            } else if (c == '"') {
+                string = false;
+            }
+        } else if (c == '"') {
+            string = true;
+        } else if (c == '{') {
+            count += depth++ == 0;
+        } else if (c == '}') {
+            if (--depth < 0) {
+                return -1;
+            }
+        } else if (depth == 0 && c != ',') {
+            return -1;
+        }
+    }
+    return depth == 0 && !string ? count : -1;
+}
+
+static void broker_receive(const uint8_t *data, size_t len, void *ctx) {
+    broker_t *broker = ctx;
+    size_t wire = MQTT_HEADER_LEN + strlen(TOPIC) + len;
+
+    broker->messages++;
+    broker->wire_bytes += wire;
+    if (wire > CONFIG_MQTT_BUFFER_SIZE_BYTE) {
+        broker->oversize++;
+        return;
+    }
+    if (broker->json) {
+        int count = json_array_count(data, len);
+        if (count <= 0) {
+            broker->malformed++;
+            return;
+        }
+        broker->records += count;
+    } else {
+        adv_record_t rec;
+        size_t off = 0;
+        while (off < len) {
+            int n = adv_frame_decode(&data[off], len - off, &rec, NULL);
+            if (n < 0) {
+                broker->malformed++;
+                return;
+            }
+            off += n;
+            broker->records++;
+        }
+    }
+}
+
+static void advert(adv_record_t *rec, uint32_t n, uint32_t time_ms) {
+    static const uint8_t ibeacon[] = {
+        0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15,
+        0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2, 0xB0, 0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0,
+        0x00, 0x01, 0x00, 0x2A, 0xC5,
+    };
+    static const uint8_t named[] = {
+        0x02, 0x01, 0x06, 0x0B, 0x09, 'T', 'a', 'g', ' ', 'K', 'i', 't', 'c', 'h', 'e', 0x02, 0x0A, 0x04,
+    };
+
+    memset(rec, 0, sizeof(*rec));
+    rec->time_ms = time_ms;
+    rec->bda[0] = 0xC0;
+    rec->bda[4] = (uint8_t)(n >> 8);
+    rec->bda[5] = (uint8_t)n;
+    rec->rssi = (int8_t)(-50 - n % 40);
+    // Adverts of 30 bytes with the odd named one, and scan responses
+    if (n % 4 == 3) {
+        rec->adv_data_len = sizeof(named);
+        memcpy(rec->data, named, sizeof(named));
+        rec->scan_rsp_len = (uint8_t)(n % 20);
+    } else {
+        rec->adv_data_len = sizeof(ibeacon);
+        memcpy(rec->data, ibeacon, sizeof(ibeacon));
+    }
+}
+
+/*
+ * Encode and commit one advert as main.c does, flushing on the byte budget
+ * return: false if the advert does not fit an empty batch
+ */
+static bool batch_advert(adv_batch_t *batch, bool json, const adv_record_t *rec, uint32_t now_ms) {
+    size_t room;
+    uint8_t *out = adv_batch_reserve(batch, &room);
+    int len = json ? adv_json_encode(rec, NULL, ESP_NAME, (char *)out, room)
+                   : adv_frame_encode(rec, NULL, out, room);
+    if (len < 0 && !adv_batch_empty(batch)) {
+        adv_batch_flush(batch, ADV_BATCH_FLUSH_BYTES);
+        out = adv_batch_reserve(batch, &room);
+        len = json ? adv_json_encode(rec, NULL, ESP_NAME, (char *)out, room)
+                   : adv_frame_encode(rec, NULL, out, room);
+    }
+    if (len < 0) {
+        return false;
+    }
+    adv_batch_commit(batch, len, now_ms);
+    return true;
+}
+
+static void test_flush(void) {
+    static uint8_t buf[64];
+    broker_t broker = { .json = false };
+    adv_batch_t batch;
+    adv_record_t rec;
+    size_t room;
+
+    // Binary frames concatenated, sent on the byte budget
+    adv_batch_init(&batch, buf, sizeof(buf), 10, 100, false, broker_receive, &broker);
+    CHECK(adv_batch_empty(&batch));
+    adv_batch_reserve(&batch, &room);
+    CHECK(room == sizeof(buf));
+    advert(&rec, 3, 0);                 // 11 + 18 + 3 bytes
+    CHECK(batch_advert(&batch, false, &rec, 0));
+    CHECK(batch_advert(&batch, false, &rec, 1));
+    CHECK(broker.messages == 0 && batch.len == 64);
+    CHECK(batch_advert(&batch, false, &rec, 2));
+    CHECK(broker.messages == 1 && broker.records == 2);
+    CHECK(batch.stats.reasons[ADV_BATCH_FLUSH_BYTES] == 1);
+    CHECK(batch.stats.fill[ADV_BATCH_FILL_BUCKETS - 1] == 1);
+
+    // Deadline counted from the first record
+    adv_batch_poll(&batch, 99);
+    CHECK(broker.messages == 1);
+    adv_batch_poll(&batch, 102);
+    CHECK(broker.messages == 2 && broker.records == 3);
+    CHECK(batch.stats.reasons[ADV_BATCH_FLUSH_DEADLINE] == 1);
+    adv_batch_poll(&batch, 1000);
+    adv_batch_flush(&batch, ADV_BATCH_FLUSH_CYCLE);
+    CHECK(broker.messages == 2);
+
+    // Record count, then the end of the cycle
+    adv_batch_init(&batch, buf, sizeof(buf), 2, 100, false, broker_receive, &broker);
+    advert(&rec, 0, 0);
+    rec.adv_data_len = 4;
+    for (int i = 0; i < 3; i++) {
+        CHECK(batch_advert(&batch, false, &rec, 0));
+    }
+    CHECK(broker.messages == 3 && batch.stats.reasons[ADV_BATCH_FLUSH_RECORDS] == 1);
+    adv_batch_flush(&batch, ADV_BATCH_FLUSH_CYCLE);
+    CHECK(broker.messages == 4 && broker.records == 6);
+    CHECK(batch.stats.messages == 2 && batch.stats.records == 3 && batch.stats.bytes == 3 * 15);
+    CHECK(batch.stats.reasons[ADV_BATCH_FLUSH_CYCLE] == 1);
+    CHECK(broker.malformed == 0);
+
+    // Larger than the budget alone
+    advert(&rec, 0, 0);
+    rec.adv_data_len = 31;
+    rec.scan_rsp_len = 31;
+    CHECK(!batch_advert(&batch, false, &rec, 0));
+    CHECK(adv_batch_empty(&batch));
+}
+
+static void test_json(void) {
+    static uint8_t buf[PAYLOAD_MAX];
+    broker_t broker = { .json = true };
+    adv_batch_t batch;
+    adv_record_t rec;
+
+    // Arrays with the closing bracket always in the budget
+    adv_batch_init(&batch, buf, sizeof(buf), 255, 100, true, broker_receive, &broker);
+    for (uint32_t n = 0; n < 100; n++) {
+        advert(&rec, n, 0);
+        CHECK(batch_advert(&batch, true, &rec, 0));
+    }
+    adv_batch_flush(&batch, ADV_BATCH_FLUSH_CYCLE);
+    CHECK(broker.records == 100);
+    CHECK(broker.malformed == 0 && broker.oversize == 0);
+    CHECK(batch.stats.messages == broker.messages);
+    CHECK(batch.stats.reasons[ADV_BATCH_FLUSH_BYTES] == broker.messages - 1);
+
+    CHECK(json_array_count((const uint8_t *)"[{\"a\":\"}\"},{}]", 14) == 2);
+    CHECK(json_array_count((const uint8_t *)"[{},{]", 6) == -1);
+}
+
+/*
+ * rate: adverts per second
+ * max_records: 1 for one message per advert
+ */
+static void test_rate(bool json, uint32_t rate, uint16_t max_records, uint32_t max_age_ms) {
+    static uint8_t buf[PAYLOAD_MAX];
+    broker_t broker = { .json = json };
+    adv_batch_t batch;
+    adv_record_t rec;
+    uint32_t sent = 0;
+
+    adv_batch_init(&batch, buf, max_records == 1 ? ADV_JSON_MAX_LEN : sizeof(buf), max_records, max_age_ms, json,
+                   broker_receive, &broker);
+    for (uint32_t now_ms = 0; now_ms < RUN_MS; now_ms++) {
+        // Adverts due by the end of this millisecond, evenly spread
+        uint32_t due = (uint32_t)((uint64_t)(now_ms + 1) * rate / 1000);
+        for (; sent < due; sent++) {
+            advert(&rec, sent % 500, now_ms);
+            CHECK(batch_advert(&batch, json, &rec, now_ms));
+        }
+        if ((now_ms + 1) % CYCLE_MS == 0) {
+            adv_batch_flush(&batch, ADV_BATCH_FLUSH_CYCLE);
+        }
+        adv_batch_poll(&batch, now_ms);
+    }
+    adv_batch_flush(&batch, ADV_BATCH_FLUSH_CYCLE);
+
+    CHECK(broker.records == sent);
+    CHECK(broker.oversize == 0 && broker.malformed == 0);
+    CHECK(batch.stats.records == sent);
+
+    const uint32_t *reasons = batch.stats.reasons;
+    printf("%-6s %5u adverts/s %2u per msg max: %7.1f msg/s %6.1f bytes per advert, flushes bytes %u records %u "
+           "deadline %u cycle %u, fill %%", json ? "json" : "binary", rate, max_records,
+           broker.messages * 1000.0 / RUN_MS, (double)broker.wire_bytes / sent, reasons[ADV_BATCH_FLUSH_BYTES],
+           reasons[ADV_BATCH_FLUSH_RECORDS], reasons[ADV_BATCH_FLUSH_DEADLINE], reasons[ADV_BATCH_FLUSH_CYCLE]);
+    for (int i = 0; i < ADV_BATCH_FILL_BUCKETS; i++) {
+        printf(" %u", batch.stats.fill[i]);
+    }
+    printf("\n");
+}
+
+int main(void) {
+    test_flush();
+    test_json();
+    for (int json = 1; json >= 0; json--) {
+        test_rate(json, 2000, 1, 0);
+        test_rate(json, 5, CONFIG_TRACKER_BATCH_RECORDS, CONFIG_TRACKER_BATCH_MAX_AGE_MS);
+        test_rate(json, 100, CONFIG_TRACKER_BATCH_RECORDS, CONFIG_TRACKER_BATCH_MAX_AGE_MS);
+        test_rate(json, 2000, CONFIG_TRACKER_BATCH_RECORDS, CONFIG_TRACKER_BATCH_MAX_AGE_MS);
+        test_rate(json, 10000, CONFIG_TRACKER_BATCH_RECORDS, CONFIG_TRACKER_BATCH_MAX_AGE_MS);
+    }
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All advert batching tests passed\n");
+    return 0;
+}
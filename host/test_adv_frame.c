@@ -0,0 +1,162 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "adv_frame.h"
+
+/*
+ * Round trip of the binary advert frames through the reference decoder, adv_frame.h
+ *   make -C host test
+ */
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static void advert(adv_record_t *rec, uint8_t device, uint8_t adv_len, uint8_t rsp_len) {
+    memset(rec, 0, sizeof(*rec));
+    rec->bda[0] = 0xC0;
+    rec->bda[5] = device;
+    rec->rssi = -97;
+    rec->dev_type = 3;
+    rec->adv_data_len = adv_len;
+    rec->scan_rsp_len = rsp_len;
+    for (int i = 0; i < adv_len + rsp_len; i++) {
+        rec->data[i] = (uint8_t)(device + i);
+    }
+}
+
+static bool same_record(const adv_record_t *a, const adv_record_t *b) {
+    return memcmp(a->bda, b->bda, ADV_BDA_LEN) == 0 && a->rssi == b->rssi && a->dev_type == b->dev_type &&
+           a->adv_data_len == b->adv_data_len && a->scan_rsp_len == b->scan_rsp_len &&
+           memcmp(a->data, b->data, ADV_RECORD_DATA_MAX) == 0;
+}
+
+static void test_advert(void) {
+    uint8_t frame[ADV_FRAME_MAX_LEN];
+    adv_record_t rec, out;
+
+    // Lengths from empty to a full record, advert then response
+    for (int len = 0; len <= ADV_RECORD_DATA_MAX; len++) {
+        uint8_t adv_len = len > 31 ? 31 : (uint8_t)len;
+        advert(&rec, (uint8_t)len, adv_len, (uint8_t)(len - adv_len));
+        int n = adv_frame_encode(&rec, NULL, frame, sizeof(frame));
+        CHECK(n == ADV_FRAME_HEADER_LEN + len);
+        CHECK(frame[0] == ADV_FRAME_VERSION);
+        memset(&out, 0xFF, sizeof(out));
+        CHECK(adv_frame_decode(frame, n, &out, NULL) == n);
+        CHECK(same_record(&rec, &out));
+    }
+
+    // Too small an output buffer, invalid record lengths
+    advert(&rec, 1, 30, 0);
+    CHECK(adv_frame_encode(&rec, NULL, frame, ADV_FRAME_HEADER_LEN + 29) == -1);
+    CHECK(adv_frame_encode(&rec, NULL, frame, ADV_FRAME_HEADER_LEN + 30) == ADV_FRAME_HEADER_LEN + 30);
+    rec.adv_data_len = 31;
+    rec.scan_rsp_len = 32;
+    CHECK(adv_frame_encode(&rec, NULL, frame, sizeof(frame)) == -1);
+}
+
+static void test_aggregate(void) {
+    uint8_t frame[ADV_FRAME_MAX_LEN];
+    adv_record_t rec, out;
+    adv_stats_t stats = { 300, -101, -40, -77, 123456789, 0xFFFFFFF0 }, stats_out;
+
+    advert(&rec, 2, 27, 12);
+    int n = adv_frame_encode(&rec, &stats, frame, sizeof(frame));
+    CHECK(n == ADV_FRAME_HEADER_LEN + ADV_FRAME_STATS_LEN + 39);
+    CHECK(frame[0] == ADV_FRAME_VERSION_AGGREGATE);
+    memset(&stats_out, 0, sizeof(stats_out));
+    CHECK(adv_frame_decode(frame, n, &out, &stats_out) == n);
+    CHECK(same_record(&rec, &out));
+    CHECK(stats_out.count == 300);
+    CHECK(stats_out.rssi_min == -101 && stats_out.rssi_max == -40 && stats_out.rssi_mean == -77);
+    CHECK(stats_out.first_seen_ms == 123456789 && stats_out.last_seen_ms == 0xFFFFFFF0);
+
+    // Stats skipped when not asked for
+    CHECK(adv_frame_decode(frame, n, &out, NULL) == n);
+    CHECK(same_record(&rec, &out));
+
+    // Plain frames leave the stats alone
+    n = adv_frame_encode(&rec, NULL, frame, sizeof(frame));
+    memset(&stats_out, 0x5A, sizeof(stats_out));
+    CHECK(adv_frame_decode(frame, n, &out, &stats_out) == n);
+    CHECK(stats_out.count == 0x5A5A);
+}
+
+static void test_concatenated(void) {
+    uint8_t msg[8 * ADV_FRAME_MAX_LEN];
+    adv_record_t rec, out;
+    adv_stats_t stats = { 5, -80, -60, -70, 1000, 2000 };
+    size_t len = 0;
+
+    // One message of mixed frames, as batched by adv_batch.h
+    for (uint8_t d = 0; d < 8; d++) {
+        advert(&rec, d, (uint8_t)(3 * d), d);
+        int n = adv_frame_encode(&rec, d & 1 ? &stats : NULL, &msg[len], sizeof(msg) - len);
+        CHECK(n > 0);
+        len += n;
+    }
+    size_t off = 0;
+    for (uint8_t d = 0; d < 8; d++) {
+        advert(&rec, d, (uint8_t)(3 * d), d);
+        int n = adv_frame_decode(&msg[off], len - off, &out, NULL);
+        CHECK(n > 0 && same_record(&rec, &out));
+        if (n <= 0) {
+            return;
+        }
+        off += n;
+    }
+    CHECK(off == len);
+}
+
+static void test_malformed(void) {
+    uint8_t frame[ADV_FRAME_MAX_LEN];
+    adv_record_t rec, out;
+    adv_stats_t stats = { 1, -50, -50, -50, 0, 0 };
+
+    // Every truncation is rejected
+    advert(&rec, 3, 31, 31);
+    int n = adv_frame_encode(&rec, &stats, frame, sizeof(frame));
+    CHECK(n == ADV_FRAME_MAX_LEN);
+    for (int len = 0; len < n; len++) {
+        CHECK(adv_frame_decode(frame, len, &out, NULL) == -1);
+    }
+
+    // Unknown versions, including the other frame types
+    n = adv_frame_encode(&rec, NULL, frame, sizeof(frame));
+    for (int version = 0; version < 256; version++) {
+        if (version == ADV_FRAME_VERSION || version == ADV_FRAME_VERSION_AGGREGATE) {
+            continue;
+        }
+        frame[0] = (uint8_t)version;
+        CHECK(adv_frame_decode(frame, n, &out, NULL) == -1);
+    }
+
+    // Payload lengths beyond a record
+    frame[0] = ADV_FRAME_VERSION;
+    frame[9] = 31;
+    frame[10] = 32;
+    CHECK(adv_frame_decode(frame, sizeof(frame), &out, NULL) == -1);
+    frame[9] = 255;
+    frame[10] = 0;
+    CHECK(adv_frame_decode(frame, sizeof(frame), &out, NULL) == -1);
+}
+
+int main(void) {
+    test_advert();
+    test_aggregate();
+    test_concatenated();
+    test_malformed();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All advert frame tests passed\n");
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "adv_log.h"
+
+/*
+ * Unit tests of the flash advert log, adv_log.h, over a NOR flash stand-in:
+ * writes only clear bits, erases set a sector back to 0xFF, and a write can
+ * be cut short as on power loss. Remounts go through a file, as a reboot
+ * would find the partition.
+ *   make -C host test
+ */
+
+#define SECTORS         4
+#define FLASH_SIZE      (SECTORS * ADV_LOG_SECTOR_SIZE)
+#define PAYLOAD_LEN     20
+#define PER_SECTOR      ((ADV_LOG_SECTOR_SIZE - ADV_LOG_SECTOR_HDR_LEN) / \
+                         ((ADV_LOG_RECORD_HDR_LEN + PAYLOAD_LEN + 3) & ~3))
+
+typedef struct {
+    uint8_t  data[FLASH_SIZE];
+    uint32_t erases[SECTORS];
+    int32_t  cut;                   // Bytes written before power loss, -1 for none
+} flash_t;
+
+static flash_t flash;
+static adv_log_t log;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static int flash_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    flash_t *f = ctx;
+    if (offset > FLASH_SIZE || len > FLASH_SIZE - offset) {
+        return -1;
+    }
+    memcpy(buf, &f->data[offset], len);
+    return 0;
+}
+
+static int flash_write(void *ctx, uint32_t offset, const void *buf, size_t len) {
+    flash_t *f = ctx;
+    const uint8_t *src = buf;
+    if (offset > FLASH_SIZE || len > FLASH_SIZE - offset) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (f->cut == 0) {
+            return -1;
+        }
+        if (f->cut > 0) {
+            f->cut--;
+        }
+        f->data[offset + i] &= src[i];
+    }
+    return 0;
+}
+
+static int flash_erase(void *ctx, uint32_t offset) {
+    flash_t *f = ctx;
+    if (offset % ADV_LOG_SECTOR_SIZE || offset >= FLASH_SIZE) {
+        return -1;
+    }
+    memset(&f->data[offset], 0xFF, ADV_LOG_SECTOR_SIZE);
+    f->erases[offset / ADV_LOG_SECTOR_SIZE]++;
+    return 0;
+}
+
+static const adv_log_flash_t flash_ops = {
+    .read  = flash_read,
+    .write = flash_write,
+    .erase = flash_erase,
+    .ctx   = &flash,
+    .size  = FLASH_SIZE,
+};
+
+static void blank(void) {
+    memset(&flash, 0xFF, sizeof(flash.data));
+    memset(flash.erases, 0, sizeof(flash.erases));
+    flash.cut = -1;
+}
+
+/*
+ * Reboot: the partition is saved, reloaded and mounted again
+ */
+static bool remount(void) {
+    FILE *f = tmpfile();
+    bool ok = f && fwrite(flash.data, 1, FLASH_SIZE, f) == FLASH_SIZE;
+    memset(flash.data, 0, FLASH_SIZE);
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fread(flash.data, 1, FLASH_SIZE, f) == FLASH_SIZE;
+    if (f) {
+        fclose(f);
+    }
+    flash.cut = -1;
+    return ok && adv_log_mount(&log, &flash_ops);
+}
+
+/*
+ * Payload of a sequence number, without 0xFF bytes so that cut writes never
+ * look complete
+ */
+static void payload(uint32_t seq, uint8_t *buf) {
+    for (int i = 0; i < PAYLOAD_LEN; i++) {
+        buf[i] = (uint8_t)((seq * 7 + i) % 0xFF);
+    }
+}
+
+static bool append(uint32_t time_ms) {
+    uint8_t buf[PAYLOAD_LEN];
+    payload(log.next_seq, buf);
+    return adv_log_append(&log, time_ms, buf, sizeof(buf));
+}
+
+/*
+ * Read up to max records, checking their payloads and that sequence
+ * numbers follow from first
+ * return: records read
+ */
+static uint32_t read_all(uint32_t first, uint32_t max) {
+    adv_log_entry_t entry;
+    uint8_t buf[PAYLOAD_LEN];
+    uint32_t n = 0;
+
+    while (n < max && adv_log_read(&log, &entry)) {
+        payload(entry.seq, buf);
+        CHECK(entry.seq == first + n);
+        CHECK(entry.len == PAYLOAD_LEN && memcmp(entry.payload, buf, PAYLOAD_LEN) == 0);
+        CHECK(entry.time_ms == entry.seq * 10);
+        n++;
+    }
+    return n;
+}
+
+static void test_blank(void) {
+    adv_log_flash_t small = flash_ops;
+    adv_log_entry_t entry;
+
+    blank();
+    small.size = ADV_LOG_SECTOR_SIZE;
+    CHECK(!adv_log_mount(&log, &small));
+
+    // Formats the first sector
+    CHECK(adv_log_mount(&log, &flash_ops));
+    CHECK(adv_log_pending(&log) == 0 && log.next_seq == 0);
+    CHECK(flash.erases[0] == 1 && flash.erases[1] == 0);
+    CHECK(!adv_log_read(&log, &entry));
+    CHECK(!adv_log_append(&log, 0, flash.data, ADV_LOG_PAYLOAD_MAX + 1));
+
+    // Nothing written yet
+    CHECK(remount());
+    CHECK(adv_log_pending(&log) == 0 && log.next_seq == 0 && log.stats.corrupted == 0);
+    CHECK(flash.erases[0] == 1);
+}
+
+static void test_ack_rewind(void) {
+    blank();
+    CHECK(adv_log_mount(&log, &flash_ops));
+    for (uint32_t i = 0; i < 10; i++) {
+        CHECK(append(i * 10));
+    }
+    CHECK(adv_log_pending(&log) == 10);
+
+    // Send of 6 fails after 4 are through: the rest is read again
+    CHECK(read_all(0, 6) == 6);
+    adv_log_ack(&log, 4);
+    CHECK(adv_log_pending(&log) == 6 && log.stats.acked == 4);
+    adv_log_rewind(&log);
+    CHECK(read_all(4, 100) == 6);
+
+    // Acks never go past the records read
+    adv_log_rewind(&log);
+    CHECK(read_all(4, 2) == 2);
+    adv_log_ack(&log, 5);
+    CHECK(adv_log_pending(&log) == 4 && log.stats.acked == 6);
+
+    // Acknowledged records stay replayed after a reboot
+    CHECK(remount());
+    CHECK(adv_log_pending(&log) == 4 && log.next_seq == 10);
+    CHECK(read_all(6, 100) == 4);
+    adv_log_ack(&log, 4);
+    CHECK(adv_log_pending(&log) == 0);
+    CHECK(remount());
+    CHECK(adv_log_pending(&log) == 0 && log.next_seq == 10);
+}
+
+static void test_sequence(void) {
+    blank();
+    CHECK(adv_log_mount(&log, &flash_ops));
+
+    // Sequence numbers go on across reboots and sectors
+    uint32_t seq = 0;
+    for (int boot = 0; boot < 5; boot++) {
+        for (uint32_t i = 0; i < PER_SECTOR / 2; i++, seq++) {
+            CHECK(append(seq * 10));
+        }
+        CHECK(remount());
+        CHECK(log.next_seq == seq && adv_log_pending(&log) == seq);
+    }
+    CHECK(log.head.sector == 2);
+    CHECK(read_all(0, 1000) == seq);
+
+    // With everything replayed, the next record still follows
+    adv_log_ack(&log, seq);
+    CHECK(remount());
+    CHECK(log.next_seq == seq && adv_log_pending(&log) == 0);
+    CHECK(append(seq * 10));
+    CHECK(read_all(seq, 1000) == 1);
+}
+
+static void test_rotation(void) {
+    uint32_t total = 20 * PER_SECTOR + 7;
+
+    blank();
+    CHECK(adv_log_mount(&log, &flash_ops));
+
+    // Offline for long, the oldest sectors are dropped
+    for (uint32_t seq = 0; seq < total; seq++) {
+        CHECK(append(seq * 10));
+        CHECK(adv_log_pending(&log) <= SECTORS * PER_SECTOR);
+    }
+    uint32_t pending = adv_log_pending(&log);
+    CHECK(pending == (SECTORS - 1) * PER_SECTOR + 7);
+    CHECK(log.stats.dropped == total - pending);
+
+    // Erases spread over the sectors
+    for (int s = 0; s < SECTORS; s++) {
+        CHECK(flash.erases[s] >= 5 && flash.erases[s] <= 6);
+    }
+    CHECK(log.stats.max_erase_count == 6);
+
+    // The same records after a reboot, the latest ones
+    CHECK(remount());
+    CHECK(adv_log_pending(&log) == pending && log.next_seq == total);
+    CHECK(log.stats.max_erase_count == 6);
+    CHECK(read_all(total - pending, 10000) == pending);
+
+    // Replayed while still appending, nothing more is dropped
+    adv_log_rewind(&log);
+    uint32_t dropped = log.stats.dropped, seq = total, next = total - pending;
+    for (uint32_t i = 0; i < 10 * PER_SECTOR; i++) {
+        CHECK(append(seq * 10));
+        seq++;
+        uint32_t n = read_all(next, 2);
+        adv_log_ack(&log, n);
+        next += n;
+    }
+    CHECK(log.stats.dropped == dropped);
+    next += read_all(next, 10000);
+    adv_log_ack(&log, 10000);
+    CHECK(next == seq && adv_log_pending(&log) == 0);
+
+    // Replayed sectors are marked and left alone at mount
+    CHECK(remount());
+    CHECK(adv_log_pending(&log) == 0 && log.next_seq == seq);
+}
+
+static void test_torn(void) {
+    uint32_t size = (ADV_LOG_RECORD_HDR_LEN + PAYLOAD_LEN + 3) & ~3;
+
+    // Power lost at each byte of a record write
+    for (uint32_t cut = 0; cut < size; cut++) {
+        blank();
+        CHECK(adv_log_mount(&log, &flash_ops));
+        for (uint32_t seq = 0; seq < 5; seq++) {
+            CHECK(append(seq * 10));
+        }
+        flash.cut = (int32_t)cut;
+        CHECK(!append(50));
+
+        // The records before are kept, the next one follows them
+        CHECK(remount());
+        CHECK(log.next_seq == 5 && adv_log_pending(&log) == 5);
+        CHECK((log.stats.corrupted > 0) == (cut > 0));
+        CHECK(append(50));
+        CHECK(read_all(0, 1000) == 6);
+        CHECK(remount());
+        CHECK(log.next_seq == 6 && adv_log_pending(&log) == 6);
+    }
+
+    // Power lost while writing the header of a new sector
+    for (uint32_t cut = 0; cut < ADV_LOG_SECTOR_HDR_LEN; cut++) {
+        blank();
+        CHECK(adv_log_mount(&log, &flash_ops));
+        for (uint32_t seq = 0; seq < PER_SECTOR; seq++) {
+            CHECK(append(seq * 10));
+        }
+        flash.cut = (int32_t)cut;
+        CHECK(!append(PER_SECTOR * 10));
+        CHECK(remount());
+        CHECK(log.next_seq == PER_SECTOR && adv_log_pending(&log) == PER_SECTOR);
+        CHECK(append(PER_SECTOR * 10));
+        CHECK(log.head.sector == 1);
+        CHECK(read_all(0, 1000) == PER_SECTOR + 1);
+    }
+
+    // Power lost while marking a record replayed: replayed again at most
+    blank();
+    CHECK(adv_log_mount(&log, &flash_ops));
+    for (uint32_t seq = 0; seq < 5; seq++) {
+        CHECK(append(seq * 10));
+    }
+    CHECK(read_all(0, 3) == 3);
+    flash.cut = 0;
+    adv_log_ack(&log, 3);
+    CHECK(remount());
+    CHECK(adv_log_pending(&log) == 5 && read_all(0, 1000) == 5);
+}
+
+int main(void) {
+    test_blank();
+    test_ack_rewind();
+    test_sequence();
+    test_rotation();
+    test_torn();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All advert log tests passed\n");
+    return 0;
+}
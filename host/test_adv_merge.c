@@ -0,0 +1,156 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "adv_merge.h"
+
+/*
+ * Unit tests of the scan response merging cache, adv_merge.h
+ *   make -C host test
+ */
+
+#define ENTRIES         4
+#define TIMEOUT_MS      50
+
+static adv_merge_entry_t entries[ENTRIES];
+static adv_merge_t merge;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static void advert(adv_record_t *rec, uint8_t device, uint32_t time_ms, uint8_t len) {
+    memset(rec, 0, sizeof(*rec));
+    rec->time_ms = time_ms;
+    rec->bda[5] = device;
+    rec->rssi = -60;
+    rec->adv_data_len = len;
+    memset(rec->data, 0xAD, len);
+}
+
+static void response(adv_record_t *rec, uint8_t device, uint32_t time_ms, uint8_t len) {
+    memset(rec, 0, sizeof(*rec));
+    rec->time_ms = time_ms;
+    rec->bda[5] = device;
+    rec->rssi = -70;
+    rec->scan_rsp_len = len;
+    memset(rec->data, 0x5C, len);
+}
+
+static void test_merge(void) {
+    adv_record_t rec, out;
+    adv_merge_stats_t stats;
+
+    CHECK(!adv_merge_init(&merge, entries, 0, TIMEOUT_MS));
+    CHECK(adv_merge_init(&merge, entries, ENTRIES, TIMEOUT_MS));
+
+    // Not scannable, straight through
+    advert(&rec, 1, 0, 20);
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_PASS, &out));
+    CHECK(memcmp(&out, &rec, sizeof(rec)) == 0);
+
+    // Advert held, then one record with the response after the advertising data
+    advert(&rec, 2, 10, 20);
+    CHECK(!adv_merge_put(&merge, &rec, ADV_MERGE_ADVERT, &out));
+    CHECK(merge.count == 1);
+    response(&rec, 2, 11, 14);
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_RESPONSE, &out));
+    CHECK(out.time_ms == 10 && out.rssi == -60);
+    CHECK(out.adv_data_len == 20 && out.scan_rsp_len == 14);
+    CHECK(out.data[19] == 0xAD && out.data[20] == 0x5C && out.data[33] == 0x5C);
+    CHECK(merge.count == 0);
+
+    // Response data reported in the advertising data fields
+    advert(&rec, 3, 20, 10);
+    adv_merge_put(&merge, &rec, ADV_MERGE_ADVERT, &out);
+    response(&rec, 3, 21, 0);
+    rec.adv_data_len = 8;
+    memset(rec.data, 0x5C, 8);
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_RESPONSE, &out));
+    CHECK(out.adv_data_len == 10 && out.scan_rsp_len == 8 && out.data[10] == 0x5C);
+
+    // Truncated to the record
+    advert(&rec, 4, 30, 31);
+    adv_merge_put(&merge, &rec, ADV_MERGE_ADVERT, &out);
+    response(&rec, 4, 31, 31);
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_RESPONSE, &out));
+    CHECK(out.adv_data_len + out.scan_rsp_len == ADV_RECORD_DATA_MAX);
+
+    // Response without advert, alone
+    response(&rec, 5, 40, 14);
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_RESPONSE, &out));
+    CHECK(out.scan_rsp_len == 14 && out.adv_data_len == 0);
+
+    // Already merged by the stack: the held advert is replaced
+    advert(&rec, 6, 50, 20);
+    adv_merge_put(&merge, &rec, ADV_MERGE_ADVERT, &out);
+    advert(&rec, 6, 51, 20);
+    rec.scan_rsp_len = 10;
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_RESPONSE, &out));
+    CHECK(out.time_ms == 51 && out.scan_rsp_len == 10);
+    CHECK(merge.count == 0);
+
+    adv_merge_get_stats(&merge, &stats);
+    CHECK(stats.adverts == 4);
+    CHECK(stats.responses == 5);
+    CHECK(stats.merged == 4);
+    CHECK(stats.orphans == 1);
+    CHECK(stats.expired == 0);
+    CHECK(stats.airtime_us == 5 * (ADV_MERGE_SCAN_REQ_US + 2 * ADV_MERGE_T_IFS_US + ADV_MERGE_SCAN_RSP_US) +
+                              8 * (14 + 8 + 31 + 14 + 10));
+}
+
+static void test_expiry(void) {
+    adv_record_t rec, out;
+    adv_merge_stats_t stats;
+
+    adv_merge_init(&merge, entries, ENTRIES, TIMEOUT_MS);
+    for (uint8_t d = 0; d < ENTRIES; d++) {
+        advert(&rec, d, 1000 + 10 * d, 20);
+        CHECK(!adv_merge_put(&merge, &rec, ADV_MERGE_ADVERT, &out));
+    }
+    // Full: the oldest goes out
+    advert(&rec, ENTRIES, 1040, 20);
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_ADVERT, &out));
+    CHECK(out.bda[5] == 0 && out.scan_rsp_len == 0);
+    // The next advert of a device comes before the response of the previous one
+    advert(&rec, 2, 1045, 20);
+    CHECK(adv_merge_put(&merge, &rec, ADV_MERGE_ADVERT, &out));
+    CHECK(out.bda[5] == 2 && out.time_ms == 1020);
+    CHECK(merge.count == ENTRIES);
+
+    // Nothing due before 1010 + TIMEOUT_MS, then oldest first
+    CHECK(!adv_merge_expire(&merge, 1010 + TIMEOUT_MS - 1, false, &out));
+    CHECK(adv_merge_expire(&merge, 1030 + TIMEOUT_MS, false, &out));
+    CHECK(out.bda[5] == 1);
+    CHECK(adv_merge_expire(&merge, 1030 + TIMEOUT_MS, false, &out));
+    CHECK(out.bda[5] == 3);
+    CHECK(!adv_merge_expire(&merge, 1030 + TIMEOUT_MS, false, &out));
+    CHECK(!adv_merge_expire(&merge, 1040 + TIMEOUT_MS - 1, false, &out));
+    // End of the scan, the rest
+    CHECK(adv_merge_expire(&merge, 0, true, &out));
+    CHECK(adv_merge_expire(&merge, 0, true, &out));
+    CHECK(!adv_merge_expire(&merge, 0, true, &out));
+    CHECK(merge.count == 0);
+
+    adv_merge_get_stats(&merge, &stats);
+    CHECK(stats.adverts == ENTRIES + 2);
+    CHECK(stats.expired == ENTRIES + 2);
+    CHECK(stats.evicted == 1);
+    CHECK(stats.merged == 0 && stats.responses == 0);
+}
+
+int main(void) {
+    test_merge();
+    test_expiry();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All scan response merge tests passed\n");
+    return 0;
+}
@@ -0,0 +1,323 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "adv_parse.h"
+
+/*
+ * Unit tests of the AD structure parser, adv_parse.h, then a fuzz run over
+ * random, truncated and over-long AD structures, each in a buffer of its exact
+ * length so that an overread shows under -fsanitize=address
+ *   make -C host test
+ *   host/build/test_adv_parse 10000000
+ */
+
+#define FUZZ_RUNS       1000000
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const uint8_t ibeacon[] = {
+    0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15,
+    0xE2, 0xC5, 0x6D, 0xB5, 0xDF, 0xFB, 0x48, 0xD2, 0xB0, 0x60, 0xD0, 0xF5, 0xA7, 0x10, 0x96, 0xE0,
+    0x12, 0x34, 0x56, 0x78, 0xC5,
+};
+static const uint8_t eddystone_uid[] = {
+    0x03, 0x03, 0xAA, 0xFE, 0x15, 0x16, 0xAA, 0xFE, 0x00, 0xEE,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15,
+};
+static const uint8_t eddystone_url[] = {
+    0x03, 0x03, 0xAA, 0xFE, 0x0E, 0x16, 0xAA, 0xFE, 0x10, 0xEB, 0x03, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x07,
+};
+static const uint8_t eddystone_tlm[] = {
+    0x11, 0x16, 0xAA, 0xFE, 0x20, 0x00, 0x0B, 0xB8, 0x17, 0x80, 0x00, 0x01, 0x02, 0x03, 0x00, 0x00, 0x10, 0x00,
+};
+static const uint8_t altbeacon[] = {
+    0x1B, 0xFF, 0x18, 0x01, 0xBE, 0xAC,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13,
+    0xBB, 0x42,
+};
+
+
+static void parse(const uint8_t *data, size_t len, adv_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    adv_parse_data(data, len, info);
+}
+
+static void test_iter(void) {
+    static const uint8_t data[] = { 0x02, 0x01, 0x06, 0x03, 0x09, 'A', 'B', 0x00, 0x02, 0x0A, 0x04 };
+    adv_iter_t it;
+    adv_field_t field;
+
+    adv_iter_init(&it, data, sizeof(data));
+    CHECK(adv_iter_next(&it, &field));
+    CHECK(field.type == ADV_TYPE_FLAGS && field.len == 1 && field.data == &data[2]);
+    CHECK(adv_iter_next(&it, &field));
+    CHECK(field.type == ADV_TYPE_NAME_CMPL && field.len == 2 && field.data == &data[5]);
+    // Zero length ends the significant part
+    CHECK(!adv_iter_next(&it, &field));
+    CHECK(!adv_iter_next(&it, &field));
+
+    // Structure truncated by the length, at every length
+    for (size_t len = 0; len < 6; len++) {
+        int fields = 0;
+        adv_iter_init(&it, &data[3], len);
+        while (adv_iter_next(&it, &field)) {
+            fields++;
+        }
+        CHECK(fields == (len >= 4));
+    }
+
+    // Over-long structures, length beyond the buffer
+    static const uint8_t over[] = { 0x02, 0x01, 0x06, 0xFF, 0xFF, 0x4C, 0x00 };
+    adv_iter_init(&it, over, sizeof(over));
+    CHECK(adv_iter_next(&it, &field));
+    CHECK(!adv_iter_next(&it, &field));
+    CHECK(it.pos == it.len);
+
+    // A type without data
+    static const uint8_t empty[] = { 0x01, 0x09, 0x01, 0x0A };
+    adv_iter_init(&it, empty, sizeof(empty));
+    CHECK(adv_iter_next(&it, &field) && field.type == ADV_TYPE_NAME_CMPL && field.len == 0);
+    CHECK(adv_iter_next(&it, &field) && field.type == ADV_TYPE_TX_POWER && field.len == 0);
+    CHECK(!adv_iter_next(&it, &field));
+}
+
+static void test_beacons(void) {
+    adv_info_t info;
+    char url[64];
+
+    parse(ibeacon, sizeof(ibeacon), &info);
+    CHECK(info.beacon == ADV_BEACON_IBEACON);
+    CHECK(info.has_flags && info.flags == 0x06);
+    CHECK(info.has_company && info.company_id == 0x004C);
+    CHECK(info.u.ibeacon.uuid == &ibeacon[9]);
+    CHECK(info.u.ibeacon.major == 0x1234 && info.u.ibeacon.minor == 0x5678);
+    CHECK(info.u.ibeacon.measured_power == -59);
+
+    parse(eddystone_uid, sizeof(eddystone_uid), &info);
+    CHECK(info.beacon == ADV_BEACON_EDDYSTONE_UID);
+    CHECK(info.u.eddystone_uid.tx_power == -18);
+    CHECK(info.u.eddystone_uid.namespace_id == &eddystone_uid[10]);
+    CHECK(info.u.eddystone_uid.instance_id == &eddystone_uid[20]);
+    CHECK(adv_has_service16(eddystone_uid, sizeof(eddystone_uid), 0xFEAA));
+    CHECK(!adv_has_service16(eddystone_uid, sizeof(eddystone_uid), 0xFEAB));
+
+    parse(eddystone_url, sizeof(eddystone_url), &info);
+    CHECK(info.beacon == ADV_BEACON_EDDYSTONE_URL);
+    CHECK(info.u.eddystone_url.tx_power == -21 && info.u.eddystone_url.scheme == 3);
+    CHECK(adv_eddystone_url_expand(&info.u.eddystone_url, url, sizeof(url)) == 19);
+    CHECK(strcmp(url, "https://example.com") == 0);
+    // Room for the URL and its '\0', not one byte less
+    CHECK(adv_eddystone_url_expand(&info.u.eddystone_url, url, 20) == 19);
+    CHECK(adv_eddystone_url_expand(&info.u.eddystone_url, url, 19) == -1);
+    info.u.eddystone_url.scheme = 4;
+    CHECK(adv_eddystone_url_expand(&info.u.eddystone_url, url, sizeof(url)) == -1);
+
+    parse(eddystone_tlm, sizeof(eddystone_tlm), &info);
+    CHECK(info.beacon == ADV_BEACON_EDDYSTONE_TLM);
+    CHECK(info.u.eddystone_tlm.battery_mv == 3000);
+    CHECK(info.u.eddystone_tlm.temperature == 0x1780);
+    CHECK(info.u.eddystone_tlm.adv_count == 0x00010203 && info.u.eddystone_tlm.uptime_ds == 0x1000);
+
+    parse(altbeacon, sizeof(altbeacon), &info);
+    CHECK(info.beacon == ADV_BEACON_ALTBEACON);
+    CHECK(info.company_id == 0x0118);
+    CHECK(info.u.altbeacon.beacon_id == &altbeacon[6]);
+    CHECK(info.u.altbeacon.ref_rssi == -69 && info.u.altbeacon.mfg_reserved == 0x42);
+
+    CHECK(strcmp(adv_beacon_name(ADV_BEACON_ALTBEACON), "AltBeacon") == 0);
+    CHECK(adv_beacon_name(ADV_BEACON_NONE) == NULL);
+}
+
+static void test_malformed(void) {
+    uint8_t data[ADV_RECORD_DATA_MAX];
+    adv_info_t info;
+
+    // Truncated anywhere, no beacon is decoded past the data
+    for (size_t len = 0; len < sizeof(ibeacon); len++) {
+        parse(ibeacon, len, &info);
+        CHECK(info.beacon == ADV_BEACON_NONE);
+    }
+    for (size_t len = 0; len < sizeof(eddystone_uid); len++) {
+        parse(eddystone_uid, len, &info);
+        CHECK(info.beacon == ADV_BEACON_NONE);
+    }
+
+    // Structure lengths one short and one over the beacon layouts
+    memcpy(data, ibeacon, sizeof(ibeacon));
+    data[3] = 0x19;
+    parse(data, sizeof(ibeacon), &info);
+    CHECK(info.beacon == ADV_BEACON_NONE && info.has_company);
+    data[3] = 0x1B;
+    data[sizeof(ibeacon)] = 0x00;
+    parse(data, sizeof(ibeacon) + 1, &info);
+    CHECK(info.beacon == ADV_BEACON_NONE && info.has_company);
+    memcpy(data, eddystone_url, sizeof(eddystone_url));
+    data[4] = 0x05;                     // Service UUID, frame type, tx power
+    parse(data, 10, &info);
+    CHECK(info.beacon == ADV_BEACON_NONE);
+    data[4] = 0x06;                     // And the scheme, an empty URL
+    parse(data, 11, &info);
+    CHECK(info.beacon == ADV_BEACON_EDDYSTONE_URL && info.u.eddystone_url.url_len == 0);
+
+    // Unknown TLM version, manufacturer data without company
+    memcpy(data, eddystone_tlm, sizeof(eddystone_tlm));
+    data[5] = 0x01;
+    parse(data, sizeof(eddystone_tlm), &info);
+    CHECK(info.beacon == ADV_BEACON_NONE);
+    static const uint8_t short_mfg[] = { 0x02, 0xFF, 0x4C };
+    parse(short_mfg, sizeof(short_mfg), &info);
+    CHECK(!info.has_company);
+
+    // Complete name over a short one, in any order
+    static const uint8_t names[] = { 0x03, 0x08, 'A', 'B', 0x04, 0x09, 'A', 'B', 'C', 0x02, 0x08, 'A' };
+    parse(names, sizeof(names), &info);
+    CHECK(info.name == &names[6] && info.name_len == 3);
+    parse(names, 4, &info);
+    CHECK(info.name == &names[2] && info.name_len == 2);
+
+    // Record lengths over the record are clamped
+    adv_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.data, ibeacon, sizeof(ibeacon));
+    rec.adv_data_len = sizeof(ibeacon);
+    rec.scan_rsp_len = 255;
+    adv_parse(&rec, &info);
+    CHECK(info.beacon == ADV_BEACON_IBEACON);
+    rec.adv_data_len = 255;
+    adv_parse(&rec, &info);
+    CHECK(info.beacon == ADV_BEACON_IBEACON);
+}
+
+static uint32_t rand_next(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static bool within(const uint8_t *p, size_t n, const uint8_t *data, size_t len) {
+    return p >= data && p + n <= data + len;
+}
+
+/*
+ * One random AD buffer: random bytes, or valid beacons with bytes changed,
+ * cut short or given wrong structure lengths
+ */
+static size_t fuzz_data(uint32_t *state, uint8_t *data) {
+    static const struct {
+        const uint8_t *data;
+        size_t         len;
+    } seeds[] = {
+        { ibeacon, sizeof(ibeacon) }, { eddystone_uid, sizeof(eddystone_uid) },
+        { eddystone_url, sizeof(eddystone_url) }, { eddystone_tlm, sizeof(eddystone_tlm) },
+        { altbeacon, sizeof(altbeacon) },
+    };
+    uint32_t r = rand_next(state);
+    size_t len;
+
+    if (r % 4 == 0) {
+        len = rand_next(state) % (ADV_RECORD_DATA_MAX + 1);
+        for (size_t i = 0; i < len; i++) {
+            data[i] = (uint8_t)rand_next(state);
+        }
+        return len;
+    }
+    size_t seed = (r >> 8) % (sizeof(seeds) / sizeof(seeds[0]));
+    memcpy(data, seeds[seed].data, seeds[seed].len);
+    len = seeds[seed].len;
+    for (uint32_t n = (r >> 16) % 4; n > 0; n--) {
+        uint32_t m = rand_next(state);
+        size_t at = (m >> 8) % len;
+        switch (m % 4) {
+        case 0:
+            data[at] = (uint8_t)(m >> 16);                      // Any byte
+            break;
+        case 1:
+            data[at] += (m >> 16) & 1 ? 1 : -1;                 // Lengths one off
+            break;
+        case 2:
+            len = at;                                           // Cut short
+            break;
+        default:
+            data[at] = 0xFF;                                    // Over-long
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+    }
+    return len;
+}
+
+static void test_fuzz(uint32_t runs) {
+    uint8_t data[ADV_RECORD_DATA_MAX];
+    uint32_t state = 0x2545F491, beacons = 0;
+    adv_info_t info;
+    adv_iter_t it;
+    adv_field_t field;
+    char url[256];
+
+    for (uint32_t run = 0; run < runs; run++) {
+        size_t len = fuzz_data(&state, data);
+        // Exact length, nothing after it to read by mistake
+        uint8_t *buf = malloc(len ? len : 1);
+        memcpy(buf, data, len);
+
+        size_t covered = 0;
+        adv_iter_init(&it, buf, len);
+        while (adv_iter_next(&it, &field)) {
+            CHECK(within(field.data, field.len, buf, len));
+            covered += 2 + field.len;
+        }
+        CHECK(covered <= len);
+
+        parse(buf, len, &info);
+        CHECK(info.name == NULL || within(info.name, info.name_len, buf, len));
+        switch (info.beacon) {
+        case ADV_BEACON_IBEACON:
+            CHECK(within(info.u.ibeacon.uuid, 16, buf, len));
+            break;
+        case ADV_BEACON_EDDYSTONE_UID:
+            CHECK(within(info.u.eddystone_uid.namespace_id, 10, buf, len));
+            CHECK(within(info.u.eddystone_uid.instance_id, 6, buf, len));
+            break;
+        case ADV_BEACON_EDDYSTONE_URL: {
+            CHECK(within(info.u.eddystone_url.url, info.u.eddystone_url.url_len, buf, len));
+            size_t size = 1 + rand_next(&state) % sizeof(url);
+            int n = adv_eddystone_url_expand(&info.u.eddystone_url, url, size);
+            CHECK(n < (int)size && (n < 0 || url[n] == '\0'));
+            break;
+        }
+        case ADV_BEACON_ALTBEACON:
+            CHECK(within(info.u.altbeacon.beacon_id, 20, buf, len));
+            break;
+        default:
+            break;
+        }
+        beacons += info.beacon != ADV_BEACON_NONE;
+        adv_has_service16(buf, len, 0xFEAA);
+        adv_fingerprint(buf, len);
+        free(buf);
+    }
+    printf("Fuzz: %u AD buffers, %u decoded as beacons\n", runs, beacons);
+}
+
+int main(int argc, char **argv) {
+    test_iter();
+    test_beacons();
+    test_malformed();
+    test_fuzz(argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : FUZZ_RUNS);
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All AD parser tests passed\n");
+    return 0;
+}
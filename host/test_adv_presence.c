@@ -0,0 +1,253 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "adv_presence.h"
+
+/*
+ * Unit tests of the device registry, adv_presence.h: enter and leave
+ * hysteresis, heartbeats, LRU eviction, then devices churning through a
+ * small registry with its lists and probe sequences checked along the way
+ *   make -C host test
+ */
+
+#define LEAVE_MS        (CONFIG_TRACKER_PRESENCE_LEAVE_S * 1000)
+#define EVENTS_MAX      64
+
+typedef struct {
+    uint32_t              count[3];     // Per adv_presence_event_t
+    uint32_t              n;
+    adv_presence_report_t last[EVENTS_MAX];
+} events_t;
+
+static const adv_presence_params_t params = {
+    .enter_count = CONFIG_TRACKER_PRESENCE_ENTER_COUNT,
+    .enter_rssi  = CONFIG_TRACKER_PRESENCE_ENTER_RSSI,
+    .leave_rssi  = CONFIG_TRACKER_PRESENCE_LEAVE_RSSI,
+    .leave_ms    = LEAVE_MS,
+};
+
+static adv_presence_entry_t entries[1024];
+static adv_presence_t presence;
+static events_t events;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static void on_event(const adv_presence_report_t *report, void *ctx) {
+    events_t *ev = ctx;
+    ev->count[report->event]++;
+    ev->last[ev->n++ % EVENTS_MAX] = *report;
+}
+
+static void reset(uint32_t capacity) {
+    memset(&events, 0, sizeof(events));
+    CHECK(adv_presence_init(&presence, entries, capacity, &params, on_event, &events));
+}
+
+static void seen(uint32_t device, uint32_t time_ms, int8_t rssi) {
+    adv_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.time_ms = time_ms;
+    rec.bda[0] = 0xC0;
+    rec.bda[4] = (uint8_t)(device >> 8);
+    rec.bda[5] = (uint8_t)device;
+    rec.rssi = rssi;
+    adv_presence_update(&presence, &rec);
+}
+
+static const adv_presence_report_t *last_event(void) {
+    return &events.last[(events.n - 1) % EVENTS_MAX];
+}
+
+/*
+ * Lists, counters and probe sequences agree with the slots
+ */
+static bool registry_valid(void) {
+    uint32_t used = 0, listed = 0, present = 0;
+
+    for (uint32_t i = 0; i <= presence.mask; i++) {
+        adv_presence_entry_t *entry = &presence.entries[i];
+        if (!entry->used) {
+            continue;
+        }
+        used++;
+        present += entry->state == ADV_PRESENCE_PRESENT;
+        // No free slot between home and the entry
+        for (uint32_t k = adv_bda_hash(entry->bda) & presence.mask; k != i; k = (k + 1) & presence.mask) {
+            if (!presence.entries[k].used) {
+                return false;
+            }
+        }
+    }
+    for (int s = 0; s < ADV_PRESENCE_STATES; s++) {
+        uint16_t prev = ADV_PRESENCE_NONE;
+        for (uint16_t i = presence.head[s]; i != ADV_PRESENCE_NONE; i = presence.entries[i].next) {
+            adv_presence_entry_t *entry = &presence.entries[i];
+            if (!entry->used || entry->state != s || entry->prev != prev || ++listed > used) {
+                return false;
+            }
+            // Present devices most recently seen first, absent ones are
+            // listed as they leave
+            if (s == ADV_PRESENCE_PRESENT && prev != ADV_PRESENCE_NONE &&
+                (int32_t)(presence.entries[prev].last_seen_ms - entry->last_seen_ms) < 0) {
+                return false;
+            }
+            prev = i;
+        }
+        if (presence.tail[s] != prev) {
+            return false;
+        }
+    }
+    return used == presence.count && listed == used && present == presence.present;
+}
+
+static void test_hysteresis(void) {
+    reset(64);
+
+    // Too weak to be tracked at all
+    seen(1, 0, CONFIG_TRACKER_PRESENCE_LEAVE_RSSI - 1);
+    CHECK(presence.count == 0);
+
+    // Enter on the second strong advert
+    seen(1, 0, CONFIG_TRACKER_PRESENCE_ENTER_RSSI);
+    CHECK(presence.count == 1 && events.n == 0);
+    seen(1, 1000, CONFIG_TRACKER_PRESENCE_ENTER_RSSI + 20);
+    CHECK(events.count[ADV_PRESENCE_ENTER] == 1 && presence.present == 1);
+    CHECK(last_event()->first_seen_ms == 0 && last_event()->last_seen_ms == 1000);
+    CHECK(last_event()->rssi == CONFIG_TRACKER_PRESENCE_ENTER_RSSI + 20 && last_event()->bda[5] == 1);
+
+    // Adverts between the thresholds keep a present device, but do not make one enter
+    seen(2, 0, CONFIG_TRACKER_PRESENCE_ENTER_RSSI - 1);
+    seen(2, 100, CONFIG_TRACKER_PRESENCE_ENTER_RSSI - 1);
+    seen(2, 200, CONFIG_TRACKER_PRESENCE_ENTER_RSSI - 1);
+    CHECK(presence.present == 1 && presence.count == 2);
+    seen(1, LEAVE_MS, CONFIG_TRACKER_PRESENCE_ENTER_RSSI - 1);
+    adv_presence_expire(&presence, LEAVE_MS + 999);
+    CHECK(events.count[ADV_PRESENCE_LEAVE] == 0);
+
+    // Leave leave_ms after the last advert heard
+    adv_presence_expire(&presence, 2 * LEAVE_MS - 1);
+    CHECK(events.count[ADV_PRESENCE_LEAVE] == 0);
+    adv_presence_expire(&presence, 2 * LEAVE_MS);
+    CHECK(events.count[ADV_PRESENCE_LEAVE] == 1 && presence.present == 0);
+    CHECK(last_event()->bda[5] == 1 && last_event()->last_seen_ms == LEAVE_MS);
+    CHECK(presence.count == 2);
+
+    // Strong adverts too far apart do not add up
+    seen(3, 0, -50);
+    seen(3, LEAVE_MS + 1, -50);
+    CHECK(events.count[ADV_PRESENCE_ENTER] == 1);
+    seen(3, LEAVE_MS + 2, -50);
+    CHECK(events.count[ADV_PRESENCE_ENTER] == 2);
+    CHECK(registry_valid());
+}
+
+static void test_heartbeat(void) {
+    reset(64);
+    for (uint32_t d = 0; d < 5; d++) {
+        seen(d, d * 10, -60);
+        seen(d, d * 10 + 1, -60);
+    }
+    // Absent devices are not reported
+    seen(9, 100, -60);
+    CHECK(presence.present == 5 && presence.count == 6);
+
+    adv_presence_heartbeat_start(&presence);
+    uint32_t steps = 0;
+    while (adv_presence_heartbeat_step(&presence)) {
+        CHECK(last_event()->event == ADV_PRESENCE_HERE);
+        // Most recently seen first
+        CHECK(last_event()->bda[5] == 4 - steps);
+        steps++;
+    }
+    CHECK(steps == 5 && events.count[ADV_PRESENCE_HERE] == 5);
+
+    // Devices leaving during the heartbeat are skipped
+    adv_presence_heartbeat_start(&presence);
+    CHECK(adv_presence_heartbeat_step(&presence));
+    adv_presence_expire(&presence, 21 + LEAVE_MS);
+    CHECK(events.count[ADV_PRESENCE_LEAVE] == 3);
+    steps = 0;
+    while (adv_presence_heartbeat_step(&presence)) {
+        CHECK(last_event()->bda[5] == 3);
+        steps++;
+    }
+    CHECK(steps == 1);
+    CHECK(registry_valid());
+}
+
+static void test_eviction(void) {
+    // 12 devices in 16 slots
+    reset(16);
+    for (uint32_t d = 0; d < 12; d++) {
+        seen(d, d, -60);
+        if (d % 2) {
+            seen(d, d + 1, -60);
+        }
+    }
+    CHECK(presence.count == 12 && presence.present == 6);
+
+    // Absent devices go first, least recently seen first
+    seen(100, 100, -60);
+    CHECK(presence.evicted == 1 && events.count[ADV_PRESENCE_LEAVE] == 0);
+    for (uint32_t d = 101; d < 106; d++) {
+        seen(d, d, -60);
+    }
+    CHECK(presence.evicted == 6 && presence.present == 6);
+    CHECK(events.count[ADV_PRESENCE_LEAVE] == 0);
+
+    // Then present ones, reported as leaving
+    for (uint32_t d = 0; d < 12; d++) {
+        seen(100 + d, 200 + d, -60);
+        seen(100 + d, 300 + d, -60);
+    }
+    CHECK(presence.present == 12);
+    CHECK(events.count[ADV_PRESENCE_LEAVE] == 6);
+    CHECK(last_event()->event == ADV_PRESENCE_ENTER);
+    CHECK(registry_valid());
+}
+
+static void test_churn(void) {
+    uint32_t state = 1, bad = 0;
+
+    // 5000 devices in 768 usable slots, coming, going and reported
+    reset(1024);
+    for (uint32_t t = 0; t < 2000000; t++) {
+        state = state * 1664525 + 1013904223;
+        uint32_t device = (state >> 8) % 5000;
+        int8_t rssi = (int8_t)(-60 - (state >> 24) % 40);
+        seen(device, t * 10, rssi);
+        if (t % 1000 == 0) {
+            adv_presence_expire(&presence, t * 10);
+            adv_presence_heartbeat_start(&presence);
+        }
+        adv_presence_heartbeat_step(&presence);
+        if (t % 50000 == 0) {
+            bad += !registry_valid();
+        }
+    }
+    CHECK(bad == 0 && registry_valid());
+    CHECK(presence.count == presence.limit);
+    CHECK(events.count[ADV_PRESENCE_ENTER] - events.count[ADV_PRESENCE_LEAVE] == presence.present);
+    CHECK(presence.evicted > 0);
+}
+
+int main(void) {
+    test_hysteresis();
+    test_heartbeat();
+    test_eviction();
+    test_churn();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All device registry tests passed\n");
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sdkconfig.h"
+#include "adv_range.h"
+
+/*
+ * Unit tests of the distance estimator, adv_range.h, and its accuracy over
+ * RSSI traces: synthetic ones from the path loss model with Gaussian noise,
+ * or recorded ones given on the command line, one "time_ms rssi
+ * measured_power distance_cm" line per advert of a single device
+ *   make -C host test
+ *   host/build/test_adv_range trace.txt...
+ */
+
+#define RATE_HZ         10
+#define SETTLE_MS       5000        // Not accounted in the error, filter start
+#define TRACE_MAX       100000
+
+typedef struct {
+    uint32_t time_ms;
+    int8_t   rssi;
+    int8_t   measured_power;        // Of the iBeacon advert, 0 if none
+    uint16_t distance_cm;           // True distance
+} trace_sample_t;
+
+typedef struct {
+    double   mean_cm;               // Of the distance last reported, against the true one
+    double   relative;              // Mean error relative to the true distance
+    uint32_t reports;
+} trace_result_t;
+
+static const adv_range_params_t params = {
+    .process_noise      = CONFIG_TRACKER_RANGE_PROCESS_NOISE / 100.0f,
+    .measurement_noise  = CONFIG_TRACKER_RANGE_MEASUREMENT_NOISE,
+    .path_loss          = CONFIG_TRACKER_RANGE_PATH_LOSS / 10.0f,
+    .ref_power          = CONFIG_TRACKER_RANGE_REF_POWER,
+    .threshold_cm       = CONFIG_TRACKER_RANGE_THRESHOLD_CM,
+};
+
+static adv_range_entry_t entries[1024];
+static adv_range_t range;
+static trace_sample_t trace[TRACE_MAX];
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static double rand_unit(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return ((*state >> 8) + 0.5) / 16777216.0;
+}
+
+static double rand_gauss(uint32_t *state) {
+    return sqrt(-2.0 * log(rand_unit(state))) * cos(2.0 * M_PI * rand_unit(state));
+}
+
+static void advert(adv_record_t *rec, adv_info_t *info, uint32_t device, uint32_t time_ms, int8_t rssi,
+                   int8_t measured_power) {
+    memset(rec, 0, sizeof(*rec));
+    rec->time_ms = time_ms;
+    rec->bda[0] = 0xC0;
+    rec->bda[3] = (uint8_t)(device >> 16);
+    rec->bda[4] = (uint8_t)(device >> 8);
+    rec->bda[5] = (uint8_t)device;
+    rec->rssi = rssi;
+    memset(info, 0, sizeof(*info));
+    if (measured_power) {
+        info->beacon = ADV_BEACON_IBEACON;
+        info->u.ibeacon.measured_power = measured_power;
+    }
+}
+
+/*
+ * Replay the trace of one device
+ */
+static trace_result_t trace_run(const trace_sample_t *samples, size_t n, uint16_t threshold_cm) {
+    adv_range_params_t p = params;
+    adv_range_estimate_t est;
+    adv_record_t rec;
+    adv_info_t info;
+    trace_result_t res = { 0 };
+    uint32_t reported = 0, counted = 0;
+
+    p.threshold_cm = threshold_cm;
+    adv_range_init(&range, entries, 1024, &p);
+    for (size_t i = 0; i < n; i++) {
+        advert(&rec, &info, 1, samples[i].time_ms, samples[i].rssi, samples[i].measured_power);
+        if (adv_range_update(&range, &rec, &info, &est)) {
+            reported = est.distance_cm;
+            res.reports++;
+        }
+        if (samples[i].time_ms - samples[0].time_ms >= SETTLE_MS) {
+            double error = fabs((double)reported - samples[i].distance_cm);
+            res.mean_cm += error;
+            res.relative += error / samples[i].distance_cm;
+            counted++;
+        }
+    }
+    if (counted) {
+        res.mean_cm /= counted;
+        res.relative /= counted;
+    }
+    return res;
+}
+
+/*
+ * Synthetic trace along a distance profile, path loss model of the params
+ * distance_cm: true distance at time t, ms
+ */
+static size_t trace_make(uint32_t seconds, double noise_db, uint32_t seed, double (*distance_cm)(uint32_t t)) {
+    uint32_t state = seed;
+    size_t n = 0;
+
+    for (uint32_t t = 0; t < seconds * 1000 && n < TRACE_MAX; t += 1000 / RATE_HZ) {
+        double cm = distance_cm(t);
+        double rssi = params.ref_power - 10.0 * params.path_loss * log10(cm / 100.0) + noise_db * rand_gauss(&state);
+        trace[n].time_ms = t;
+        trace[n].rssi = (int8_t)lround(rssi < -127 ? -127 : rssi);
+        trace[n].measured_power = params.ref_power;
+        trace[n].distance_cm = (uint16_t)lround(cm);
+        n++;
+    }
+    return n;
+}
+
+static double at_3m(uint32_t t) {
+    return 300.0;
+}
+
+// 1 m to 8 m and back at 0.5 m/s, then staying at 1 m
+static double walking(uint32_t t) {
+    double s = t / 1000.0;
+    if (s < 14.0) {
+        return 100.0 + 50.0 * s;
+    }
+    if (s < 28.0) {
+        return 800.0 - 50.0 * (s - 14.0);
+    }
+    return 100.0;
+}
+
+static void test_model(void) {
+    CHECK(adv_range_distance_cm(-59.0f, -59, 2.0f) == 100);
+    CHECK(adv_range_distance_cm(-79.0f, -59, 2.0f) == 1000);
+    CHECK(adv_range_distance_cm(-69.0f, -59, 2.0f) == 316);
+    CHECK(adv_range_distance_cm(-79.0f, -59, 4.0f) == 316);
+    CHECK(adv_range_distance_cm(-39.0f, -59, 2.0f) == 10);
+    CHECK(adv_range_distance_cm(-127.0f, -20, 2.0f) == 65535);
+}
+
+static void test_reference(void) {
+    adv_range_estimate_t est;
+    adv_record_t rec;
+    adv_info_t info;
+
+    adv_range_init(&range, entries, 1024, &params);
+    // Default reference power without beacon
+    advert(&rec, &info, 1, 0, -59, 0);
+    CHECK(adv_range_update(&range, &rec, &info, &est));
+    CHECK(est.ref_power == CONFIG_TRACKER_RANGE_REF_POWER && est.distance_cm == 100);
+    CHECK(est.rssi_x10 == -590);
+
+    // iBeacon measured power
+    advert(&rec, &info, 2, 0, -59, -65);
+    CHECK(adv_range_update(&range, &rec, &info, &est));
+    CHECK(est.ref_power == -65 && est.distance_cm == 50);
+
+    // TX power at 0 m, then kept by adverts without it
+    advert(&rec, &info, 3, 0, -59, 0);
+    info.has_tx_power = true;
+    info.tx_power = -12;
+    CHECK(adv_range_update(&range, &rec, &info, &est));
+    CHECK(est.ref_power == -53);
+    advert(&rec, &info, 3, 100, -79, 0);
+    CHECK(adv_range_update(&range, &rec, &info, &est));
+    CHECK(est.ref_power == -53);
+    CHECK(range.count == 3);
+}
+
+static void test_threshold(void) {
+    adv_range_estimate_t est;
+    adv_record_t rec;
+    adv_info_t info;
+    uint16_t last = 0;
+    uint32_t reports = 0;
+
+    // Estimates move on as the device walks, reported in steps over the threshold
+    size_t n = trace_make(40, 0.0, 1, walking);
+    adv_range_init(&range, entries, 1024, &params);
+    for (size_t i = 0; i < n; i++) {
+        advert(&rec, &info, 1, trace[i].time_ms, trace[i].rssi, trace[i].measured_power);
+        if (adv_range_update(&range, &rec, &info, &est)) {
+            CHECK(reports == 0 || abs((int)est.distance_cm - last) > CONFIG_TRACKER_RANGE_THRESHOLD_CM);
+            last = est.distance_cm;
+            reports++;
+        }
+    }
+    CHECK(reports > 10 && reports < n / 4);
+    trace_result_t all = trace_run(trace, n, 0);
+    CHECK(all.reports > 3 * reports);
+}
+
+static void test_bounded(void) {
+    static adv_range_entry_t small[64];
+    adv_range_estimate_t est;
+    adv_record_t rec;
+    adv_info_t info;
+
+    // 1000 devices through 48 usable slots, the stalest go
+    CHECK(!adv_range_init(&range, small, 48, &params));
+    CHECK(adv_range_init(&range, small, 64, &params));
+    for (uint32_t t = 0; t < 10; t++) {
+        for (uint32_t d = 0; d < 1000; d++) {
+            advert(&rec, &info, d, t * 1000 + d, -70, 0);
+            adv_range_update(&range, &rec, &info, &est);
+            CHECK(range.count <= 48);
+        }
+    }
+    CHECK(range.count == 48);
+    CHECK(range.evicted > 9 * 1000);
+
+    // Every stored device is still found after the backward shifts
+    uint32_t evicted = range.evicted;
+    for (uint32_t i = 0; i < 64; i++) {
+        if (small[i].used) {
+            rec.time_ms = 20000;
+            memcpy(rec.bda, small[i].bda, ADV_BDA_LEN);
+            adv_range_update(&range, &rec, &info, &est);
+        }
+    }
+    CHECK(range.evicted == evicted && range.count == 48);
+}
+
+static void test_accuracy(void) {
+    static const double noises[] = { 2.0, 4.0, 6.0 };
+
+    for (size_t i = 0; i < sizeof(noises) / sizeof(noises[0]); i++) {
+        size_t n = trace_make(120, noises[i], 7 + i, at_3m);
+        trace_result_t res = trace_run(trace, n, CONFIG_TRACKER_RANGE_THRESHOLD_CM);
+        trace_result_t raw = trace_run(trace, n, 0);
+        // Without the filter, each advert alone
+        double single = 0.0;
+        for (size_t k = 0; k < n; k++) {
+            single += fabs(adv_range_distance_cm(trace[k].rssi, params.ref_power, params.path_loss) - 300.0);
+        }
+        printf("Range at 3 m, %.0f dB noise, %d Hz: reported error %5.1f cm, %3u reports, filtered %5.1f cm, "
+               "single advert %6.1f cm\n", noises[i], RATE_HZ, res.mean_cm, res.reports, raw.mean_cm, single / n);
+        CHECK(res.mean_cm < single / n / 2);
+        if (noises[i] == 4.0) {
+            CHECK(res.mean_cm < 60.0);
+        }
+    }
+
+    size_t n = trace_make(60, 4.0, 3, walking);
+    trace_result_t res = trace_run(trace, n, CONFIG_TRACKER_RANGE_THRESHOLD_CM);
+    printf("Range walking 1 m to 8 m, 4 dB noise: reported error %5.1f cm, %4.1f%% of the distance, %u reports\n",
+           res.mean_cm, 100.0 * res.relative, res.reports);
+    CHECK(res.relative < 0.25);
+}
+
+/*
+ * return: samples read, 0 on error
+ */
+static size_t trace_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    unsigned int time_ms, distance_cm;
+    int rssi, power;
+    size_t n = 0;
+
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    while (n < TRACE_MAX && fscanf(f, "%u %d %d %u", &time_ms, &rssi, &power, &distance_cm) == 4) {
+        trace[n].time_ms = time_ms;
+        trace[n].rssi = (int8_t)rssi;
+        trace[n].measured_power = (int8_t)power;
+        trace[n].distance_cm = (uint16_t)(distance_cm ? distance_cm : 1);
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            size_t n = trace_load(argv[i]);
+            if (n == 0) {
+                return 1;
+            }
+            trace_result_t res = trace_run(trace, n, CONFIG_TRACKER_RANGE_THRESHOLD_CM);
+            printf("%s: %zu adverts, reported error %.1f cm, %.1f%% of the distance, %u reports\n", argv[i], n,
+                   res.mean_cm, 100.0 * res.relative, res.reports);
+        }
+        return 0;
+    }
+    test_model();
+    test_reference();
+    test_threshold();
+    test_bounded();
+    test_accuracy();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All distance estimator tests passed\n");
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "adv_ring.h"
+
+/*
+ * Unit and stress tests of the advert ring, adv_ring.h: a producer thread
+ * pushes numbered records, the consumer takes them one or a batch at a time,
+ * under each overflow policy
+ *   make -C host test
+ */
+
+#define SLOTS           64
+#define BATCH           8
+#define RECORDS         2000000
+#define DEVICES         16          // Coalesced by BD address
+
+static adv_ring_slot_t slots[SLOTS];
+static adv_ring_t ring;
+static volatile bool producing = false;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+/*
+ * Record n: its number in the first bytes, repeated over the data
+ */
+static void record_make(adv_record_t *rec, uint32_t n) {
+    memset(rec, 0, sizeof(*rec));
+    rec->bda[0] = n % DEVICES;
+    rec->time_ms = n;
+    rec->adv_data_len = sizeof(rec->data);
+    memset(rec->data, (int)(n & 0xFF), sizeof(rec->data));
+}
+
+static bool record_intact(const adv_record_t *rec) {
+    uint32_t n = rec->time_ms;
+    if (rec->bda[0] != n % DEVICES) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(rec->data); i++) {
+        if (rec->data[i] != (uint8_t)n) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_single(void) {
+    adv_record_t rec, recs[BATCH * 2];
+    adv_ring_stats_t stats;
+    uint32_t seen = 0;
+
+    CHECK(adv_ring_init(&ring, slots, SLOTS, ADV_RING_DROP_NEWEST));
+    CHECK(adv_ring_pop_batch(&ring, recs, BATCH) == 0);
+    for (uint32_t n = 0; n < 10; n++) {
+        record_make(&rec, n);
+        CHECK(adv_ring_push(&ring, &rec));
+    }
+    adv_ring_mark(&ring);
+    for (uint32_t n = 10; n < 20; n++) {
+        record_make(&rec, n);
+        CHECK(adv_ring_push(&ring, &rec));
+    }
+
+    // Batches are bounded by max, then by the mark
+    CHECK(adv_ring_pop_batch(&ring, recs, BATCH) == BATCH);
+    CHECK(recs[0].time_ms == 0 && recs[BATCH - 1].time_ms == BATCH - 1);
+    CHECK(!adv_ring_mark_reached(&ring, &seen));
+    CHECK(adv_ring_pop_batch(&ring, recs, BATCH * 2) == 10 - BATCH);
+    CHECK(recs[0].time_ms == BATCH && recs[1].time_ms == 9);
+    CHECK(adv_ring_mark_reached(&ring, &seen));
+    CHECK(adv_ring_pop_batch(&ring, recs, BATCH * 2) == 10);
+    CHECK(recs[0].time_ms == 10 && recs[9].time_ms == 19);
+    CHECK(record_intact(&recs[9]));
+    CHECK(adv_ring_count(&ring) == 0);
+    adv_ring_get_stats(&ring, &stats);
+    CHECK(stats.pushed == 20 && stats.popped == 20);
+
+    // Across the wrap of the slots
+    for (uint32_t n = 0; n < SLOTS; n++) {
+        record_make(&rec, n);
+        CHECK(adv_ring_push(&ring, &rec));
+    }
+    record_make(&rec, SLOTS);
+    CHECK(!adv_ring_push(&ring, &rec));
+    uint32_t total = 0, n;
+    while ((n = adv_ring_pop_batch(&ring, recs, BATCH * 2 - 1)) > 0) {
+        for (uint32_t i = 0; i < n; i++) {
+            CHECK(recs[i].time_ms == total + i);
+        }
+        total += n;
+    }
+    CHECK(total == SLOTS);
+}
+
+static void *producer(void *arg) {
+    adv_record_t rec;
+    for (uint32_t n = 0; n < RECORDS; n++) {
+        record_make(&rec, n);
+        adv_ring_push(&ring, &rec);
+        if (n % 1024 == 0) {
+            adv_ring_mark(&ring);
+            sched_yield();
+        }
+    }
+    __atomic_store_n(&producing, false, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * batch: records taken at a time, 1 with adv_ring_pop()
+ */
+static void test_stress(adv_ring_policy_t policy, const char *name, uint32_t batch) {
+    static adv_record_t recs[BATCH];
+    adv_ring_stats_t stats;
+    pthread_t thread;
+    uint32_t popped = 0, batches = 0, torn = 0, reordered = 0, last = 0, seen = 0, n;
+    bool first = true;
+
+    CHECK(adv_ring_init(&ring, slots, SLOTS, policy));
+    producing = true;
+    pthread_create(&thread, NULL, producer, NULL);
+    while (1) {
+        bool more = __atomic_load_n(&producing, __ATOMIC_ACQUIRE);
+        adv_ring_mark_reached(&ring, &seen);
+        n = batch == 1 ? adv_ring_pop(&ring, recs) : adv_ring_pop_batch(&ring, recs, batch);
+        for (uint32_t i = 0; i < n; i++) {
+            torn += !record_intact(&recs[i]);
+            // Coalesced records replace older ones in place
+            if (!first && recs[i].time_ms <= last && policy != ADV_RING_COALESCE) {
+                reordered++;
+            }
+            last = recs[i].time_ms;
+            first = false;
+        }
+        popped += n;
+        batches += n > 0;
+        if (n == 0 && !more) {
+            break;
+        }
+    }
+    pthread_join(thread, NULL);
+
+    adv_ring_get_stats(&ring, &stats);
+    printf("Ring %-11s %u records, %u popped in %u pops of %u max, %u dropped newest %u oldest, %u coalesced\n",
+           name, RECORDS, popped, batches, batch, stats.dropped_newest, stats.dropped_oldest, stats.coalesced);
+    CHECK(torn == 0);
+    CHECK(reordered == 0);
+    CHECK(stats.popped == popped);
+    CHECK(stats.pushed == popped + stats.dropped_oldest);
+    CHECK(stats.pushed + stats.dropped_newest + stats.coalesced == RECORDS);
+    CHECK(stats.high_water <= SLOTS);
+}
+
+int main(void) {
+    test_single();
+    test_stress(ADV_RING_DROP_NEWEST, "drop-newest", 1);
+    test_stress(ADV_RING_DROP_OLDEST, "drop-oldest", 1);
+    test_stress(ADV_RING_COALESCE, "coalesce", 1);
+    test_stress(ADV_RING_DROP_NEWEST, "drop-newest", BATCH);
+    test_stress(ADV_RING_DROP_OLDEST, "drop-oldest", BATCH);
+    test_stress(ADV_RING_COALESCE, "coalesce", BATCH);
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All advert ring tests passed\n");
+    return 0;
+}
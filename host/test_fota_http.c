@@ -0,0 +1,501 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "host.h"
+#include "mbedtls/sha256.h"
+#include "fota_http.h"
+
+/*
+ * Unit tests of the firmware download, fota_http.h, against a local HTTP
+ * server stand-in: URL parsing, the response header parser resumed at every
+ * split of its input, body length and SHA-256 checks, sink failures and
+ * receive buffers handed out by the sink, then the download rate in MB/s
+ *   make -C host test
+ */
+
+#define BODY_LEN        (64 * 1024)
+#define RATE_LEN        (32 * 1024 * 1024)
+#define RATE_SEND       (64 * 1024)
+#define MAX_LEN         (1536 * 1024)   // ota_0 / ota_1 size
+#define SINK_BUFFERS    4
+
+/*
+ * Server stand-in: one connection per download, the response is sent in
+ * segment bytes at a time, 0 for random sizes
+ */
+typedef struct {
+    int        sock;
+    uint16_t   port;
+    pthread_t  thread;
+    uint8_t   *response;
+    size_t     len;
+    size_t     repeat;          // Times the body after the head is sent, 0 for once
+    size_t     head_len;
+    size_t     segment;
+    char       request[512];
+} server_t;
+
+typedef struct {
+    uint8_t  *data;             // NULL to only count the bytes
+    size_t    cap;
+    size_t    len;
+    int64_t   image_len;
+    uint32_t  begins;
+    uint32_t  writes;
+    size_t    fail_at;          // A write going past it fails, SIZE_MAX for none
+    bool      begin_fail;
+    bool      own_buffers;      // Hands out the receive buffers
+    uint8_t   pool[SINK_BUFFERS][4096];
+    uint32_t  next;
+    uint8_t  *handed;           // Last buffer handed out
+    size_t    handed_size;
+    uint32_t  outside;          // Writes not within that buffer
+} sink_t;
+
+static server_t server;
+static uint8_t body[BODY_LEN];
+static uint8_t body_sha[FOTA_SHA256_LEN];
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static uint32_t rand_next(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void sha256(const uint8_t *data, size_t len, uint8_t *digest) {
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, data, len);
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+}
+
+static bool server_open(void) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (server.sock < 0 || bind(server.sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server.sock, 4) != 0 || getsockname(server.sock, (struct sockaddr *)&addr, &addr_len) != 0) {
+        perror("server");
+        return false;
+    }
+    server.port = ntohs(addr.sin_port);
+    return true;
+}
+
+static void *server_run(void *arg) {
+    uint32_t state = 0x2545F491;
+    size_t got = 0, sent = 0;
+    int one = 1;
+
+    int conn = accept(server.sock, NULL, NULL);
+    if (conn < 0) {
+        return NULL;
+    }
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    while (got < sizeof(server.request) - 1 && !strstr(server.request, "\r\n\r\n")) {
+        ssize_t n = recv(conn, &server.request[got], sizeof(server.request) - 1 - got, 0);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+        server.request[got] = '\0';
+    }
+    size_t total = server.len + server.repeat * (server.len - server.head_len);
+    while (sent < total) {
+        // Past the first copy, the body is sent again
+        size_t pos = sent < server.len ? sent : server.head_len + (sent - server.len) % (server.len - server.head_len);
+        size_t n = server.segment ? server.segment : 1 + rand_next(&state) % 2048;
+        if (n > server.len - pos) {
+            n = server.len - pos;
+        }
+        ssize_t ret = send(conn, &server.response[pos], n, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            break;
+        }
+        sent += ret;
+    }
+    close(conn);
+    return NULL;
+}
+
+/*
+ * Serve head then body_len bytes of body to the next connection
+ */
+static void serve(const char *head, const uint8_t *data, size_t body_len, size_t segment) {
+    size_t head_len = strlen(head);
+
+    free(server.response);
+    server.response = malloc(head_len + body_len);
+    memcpy(server.response, head, head_len);
+    memcpy(&server.response[head_len], data, body_len);
+    server.len = head_len + body_len;
+    server.head_len = head_len;
+    server.segment = segment;
+    memset(server.request, 0, sizeof(server.request));
+    pthread_create(&server.thread, NULL, server_run, NULL);
+}
+
+static int sink_begin(void *ctx, int64_t image_len) {
+    sink_t *s = ctx;
+    s->begins++;
+    s->image_len = image_len;
+    return s->begin_fail ? -1 : 0;
+}
+
+static int sink_write(void *ctx, const uint8_t *data, size_t len) {
+    sink_t *s = ctx;
+    if (s->own_buffers && (data < s->handed || data + len > s->handed + s->handed_size)) {
+        s->outside++;
+    }
+    if (len > s->fail_at - s->len) {
+        return -1;
+    }
+    if (s->data) {
+        if (len > s->cap - s->len) {
+            return -1;
+        }
+        memcpy(&s->data[s->len], data, len);
+    }
+    s->len += len;
+    s->writes++;
+    return 0;
+}
+
+static uint8_t *sink_buffer(void *ctx, size_t *size) {
+    sink_t *s = ctx;
+    s->handed = s->pool[s->next++ % SINK_BUFFERS];
+    s->handed_size = sizeof(s->pool[0]);
+    *size = s->handed_size;
+    return s->handed;
+}
+
+static void sink_init(sink_t *s, fota_sink_t *out, uint8_t *data, size_t cap) {
+    memset(s, 0, sizeof(*s));
+    s->data = data;
+    s->cap = cap;
+    s->fail_at = SIZE_MAX;
+    out->begin = sink_begin;
+    out->write = sink_write;
+    out->buffer = NULL;
+    out->ctx = s;
+}
+
+/*
+ * Download from the stand-in, which has been given its response
+ */
+static fota_err_t download(const uint8_t *sha, uint32_t max_len, const fota_sink_t *out, size_t size,
+                           fota_result_t *result) {
+    static uint8_t buf[16384];
+    char url_text[64];
+    fota_url_t url;
+
+    snprintf(url_text, sizeof(url_text), "http://127.0.0.1:%u/fw/BLE_Tracker.bin", server.port);
+    CHECK(fota_url_parse(url_text, strlen(url_text), &url));
+    fota_err_t err = fota_download(&url, sha, max_len, out, buf, size, result);
+    pthread_join(server.thread, NULL);
+    server.repeat = 0;
+    return err;
+}
+
+static void test_sha256(void) {
+    static const uint8_t abc[FOTA_SHA256_LEN] = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+    };
+    static const uint8_t two_blocks[FOTA_SHA256_LEN] = {
+        0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+        0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1,
+    };
+    const char *msg = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    uint8_t digest[FOTA_SHA256_LEN], whole[FOTA_SHA256_LEN];
+    mbedtls_sha256_context sha;
+
+    sha256((const uint8_t *)"abc", 3, digest);
+    CHECK(memcmp(digest, abc, sizeof(abc)) == 0);
+    sha256((const uint8_t *)msg, strlen(msg), digest);
+    CHECK(memcmp(digest, two_blocks, sizeof(two_blocks)) == 0);
+
+    // Same digest whatever the updates
+    sha256(body, sizeof(body), whole);
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (size_t i = 0, n = 1; i < sizeof(body); i += n, n = n * 3 % 1000 + 1) {
+        mbedtls_sha256_update(&sha, &body[i], n < sizeof(body) - i ? n : sizeof(body) - i);
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    CHECK(memcmp(digest, whole, sizeof(whole)) == 0);
+}
+
+static void test_url(void) {
+    static const char long_host[] = "http://aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/";
+    fota_url_t url;
+
+#define PARSE(s) fota_url_parse(s, strlen(s), &url)
+    CHECK(PARSE("http://192.168.1.10:8080/BLE_Tracker.bin"));
+    CHECK(strcmp(url.host, "192.168.1.10") == 0 && url.port == 8080 && strcmp(url.path, "/BLE_Tracker.bin") == 0);
+    CHECK(PARSE("HTTP://updates.example.com"));
+    CHECK(strcmp(url.host, "updates.example.com") == 0 && url.port == 80 && strcmp(url.path, "/") == 0);
+    CHECK(PARSE("http://h:1/a?b=c"));
+    CHECK(url.port == 1 && strcmp(url.path, "/a?b=c") == 0);
+    // Only the given length is parsed
+    CHECK(fota_url_parse("http://h/fw.bin 9f86d0", 15, &url) && strcmp(url.path, "/fw.bin") == 0);
+
+    CHECK(!PARSE("https://h/fw.bin"));
+    CHECK(!PARSE("http://"));
+    CHECK(!PARSE("http:///fw.bin"));
+    CHECK(!PARSE("http://h:/fw.bin"));
+    CHECK(!PARSE("http://h:0/fw.bin"));
+    CHECK(!PARSE("http://h:65536/fw.bin"));
+    CHECK(!PARSE("http://h:80x/fw.bin"));
+    CHECK(!PARSE(long_host));
+#undef PARSE
+}
+
+static void test_parser(void) {
+    char head[1024];
+    fota_http_parser_t parser;
+
+    // Header lines longer than the line buffer are skipped
+    int head_len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nServer: stand-in\r\nX-Padding: %0300d\r\n"
+                            "content-length:   123456\r\nTransfer-Encoding: identity\r\n\r\nBODY", 0);
+    size_t headers = (size_t)head_len - 4;
+
+    // Resumed at every split of the input
+    for (size_t split = 0; split <= (size_t)head_len; split++) {
+        fota_http_init(&parser);
+        int first = fota_http_feed(&parser, (const uint8_t *)head, split);
+        int second = parser.state == FOTA_HTTP_BODY ? 0 :
+                     fota_http_feed(&parser, (const uint8_t *)&head[split], head_len - split);
+        CHECK(first >= 0 && second >= 0 && (size_t)(first + second) == headers);
+        CHECK(parser.state == FOTA_HTTP_BODY && parser.status == 200);
+        CHECK(parser.content_length == 123456 && !parser.chunked);
+    }
+    // One byte at a time, bare LF line ends
+    const char *lf = "HTTP/1.0 404 Not Found\nContent-Length: 9\n\nnot found";
+    size_t used = 0;
+    fota_http_init(&parser);
+    for (size_t i = 0; i < strlen(lf) && parser.state != FOTA_HTTP_BODY; i++) {
+        used += fota_http_feed(&parser, (const uint8_t *)&lf[i], 1);
+    }
+    CHECK(parser.state == FOTA_HTTP_BODY && parser.status == 404 && parser.content_length == 9);
+    CHECK(used == strlen(lf) - 9);
+
+    const char *chunked = "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, Chunked\r\n\r\n";
+    fota_http_init(&parser);
+    CHECK(fota_http_feed(&parser, (const uint8_t *)chunked, strlen(chunked)) == (int)strlen(chunked));
+    CHECK(parser.chunked && parser.content_length == -1);
+
+    static const char *const bad[] = {
+        "HTTP/2 200 OK\r\n",
+        "ICY 200 OK\r\n",
+        "HTTP/1.1 2x0 OK\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length:\r\n",
+        "HTTP/1.1 200 OK\r\nContent-Length: 99999999999\r\n",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        fota_http_init(&parser);
+        CHECK(fota_http_feed(&parser, (const uint8_t *)bad[i], strlen(bad[i])) < 0);
+        CHECK(parser.state == FOTA_HTTP_ERROR);
+    }
+}
+
+static void test_download(void) {
+    static const size_t segments[] = { 1, 7, 1460, 0 };
+    static const size_t sizes[] = { 128, 4096, 16384 };
+    static uint8_t data[BODY_LEN + 4096];
+    uint8_t wrong[FOTA_SHA256_LEN];
+    char head[256];
+    fota_result_t result;
+    fota_sink_t out;
+    sink_t s;
+
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+             "Content-Length: %u\r\nConnection: close\r\n\r\n", BODY_LEN);
+
+    // Any split of the response, through receive buffers from barely the
+    // request to larger than the headers
+    for (size_t g = 0; g < sizeof(segments) / sizeof(segments[0]); g++) {
+        for (size_t b = 0; b < sizeof(sizes) / sizeof(sizes[0]); b++) {
+            sink_init(&s, &out, data, sizeof(data));
+            serve(head, body, BODY_LEN, segments[g]);
+            CHECK(download(body_sha, MAX_LEN, &out, sizes[b], &result) == FOTA_OK);
+            CHECK(s.begins == 1 && s.image_len == BODY_LEN);
+            CHECK(s.len == BODY_LEN && memcmp(data, body, BODY_LEN) == 0);
+            CHECK(result.status == 200 && result.received == BODY_LEN);
+            CHECK(memcmp(result.sha256, body_sha, FOTA_SHA256_LEN) == 0);
+        }
+    }
+    CHECK(strncmp(server.request, "GET /fw/BLE_Tracker.bin HTTP/1.0\r\n", 34) == 0);
+    CHECK(strstr(server.request, "\r\nHost: 127.0.0.1\r\n") != NULL);
+
+    // Receiving into the buffers of the sink, written from them without copy
+    sink_init(&s, &out, data, sizeof(data));
+    s.own_buffers = true;
+    out.buffer = sink_buffer;
+    serve(head, body, BODY_LEN, 0);
+    CHECK(download(body_sha, MAX_LEN, &out, sizeof(s.pool[0]), &result) == FOTA_OK);
+    CHECK(s.len == BODY_LEN && memcmp(data, body, BODY_LEN) == 0 && s.outside == 0);
+
+    // Digest checked over the whole body
+    memcpy(wrong, body_sha, sizeof(wrong));
+    wrong[31] ^= 1;
+    sink_init(&s, &out, data, sizeof(data));
+    serve(head, body, BODY_LEN, 0);
+    CHECK(download(wrong, MAX_LEN, &out, 4096, &result) == FOTA_ERR_DIGEST);
+    CHECK(result.received == BODY_LEN);
+    sink_init(&s, &out, data, sizeof(data));
+    serve(head, body, BODY_LEN, 0);
+    CHECK(download(NULL, MAX_LEN, &out, 4096, &result) == FOTA_OK);
+    CHECK(memcmp(result.sha256, body_sha, FOTA_SHA256_LEN) == 0);
+
+    // One byte off the announced length
+    memcpy(data, body, BODY_LEN);
+    data[BODY_LEN] = 0x5A;
+    sink_init(&s, &out, NULL, 0);
+    serve(head, data, BODY_LEN - 1, 0);
+    CHECK(download(NULL, MAX_LEN, &out, 4096, &result) == FOTA_ERR_LENGTH);
+    sink_init(&s, &out, NULL, 0);
+    serve(head, data, BODY_LEN + 1, 0);
+    CHECK(download(NULL, MAX_LEN, &out, 4096, &result) == FOTA_ERR_LENGTH);
+    CHECK(s.len <= BODY_LEN);
+
+    // Too large for the partition, announced or not
+    sink_init(&s, &out, NULL, 0);
+    serve(head, body, BODY_LEN, 0);
+    CHECK(download(NULL, BODY_LEN - 1, &out, 4096, &result) == FOTA_ERR_LENGTH);
+    CHECK(s.begins == 0 && s.len == 0);
+    sink_init(&s, &out, data, sizeof(data));
+    serve("HTTP/1.0 200 OK\r\n\r\n", body, BODY_LEN, 0);
+    CHECK(download(NULL, BODY_LEN - 1, &out, 4096, &result) == FOTA_ERR_LENGTH);
+    CHECK(s.len < BODY_LEN);
+
+    // Without Content-Length, the body runs until the server closes
+    sink_init(&s, &out, data, sizeof(data));
+    serve("HTTP/1.0 200 OK\r\n\r\n", body, BODY_LEN, 0);
+    CHECK(download(body_sha, MAX_LEN, &out, 4096, &result) == FOTA_OK);
+    CHECK(s.image_len == -1 && s.len == BODY_LEN && memcmp(data, body, BODY_LEN) == 0);
+
+    // Responses not to be flashed
+    static const char *const refused[] = {
+        "HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\n",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "<html>",
+        "HTTP/1.1 200 OK\r\nContent-Length: 65536\r\n",
+        "",
+    };
+    for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+        sink_init(&s, &out, NULL, 0);
+        serve(refused[i], body, strstr(refused[i], "\r\n\r\n") ? 9 : 0, 0);
+        CHECK(download(NULL, MAX_LEN, &out, 4096, &result) == FOTA_ERR_HTTP);
+        CHECK(s.begins == 0 && s.len == 0);
+    }
+
+    // Sink failures stop the download
+    sink_init(&s, &out, NULL, 0);
+    s.begin_fail = true;
+    serve(head, body, BODY_LEN, 0);
+    CHECK(download(NULL, MAX_LEN, &out, 4096, &result) == FOTA_ERR_WRITE);
+    CHECK(s.len == 0);
+    sink_init(&s, &out, NULL, 0);
+    s.fail_at = BODY_LEN / 2;
+    serve(head, body, BODY_LEN, 0);
+    CHECK(download(NULL, MAX_LEN, &out, 4096, &result) == FOTA_ERR_WRITE);
+    CHECK(s.len <= BODY_LEN / 2);
+
+    // Nobody listening
+    fota_url_t url;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    CHECK(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    CHECK(getsockname(sock, (struct sockaddr *)&addr, &addr_len) == 0);
+    close(sock);
+    strcpy(url.host, "127.0.0.1");
+    url.port = ntohs(addr.sin_port);
+    strcpy(url.path, "/");
+    sink_init(&s, &out, NULL, 0);
+    CHECK(fota_download(&url, NULL, MAX_LEN, &out, data, 4096, &result) == FOTA_ERR_CONNECT);
+}
+
+/*
+ * Download rate over the loopback, the SHA-256 being the main cost
+ */
+static void test_rate(void) {
+    static const size_t sizes[] = { 1024, 4096, 16384 };
+    uint8_t digest[FOTA_SHA256_LEN];
+    mbedtls_sha256_context sha;
+    fota_result_t result;
+    fota_sink_t out;
+    sink_t s;
+    char head[128];
+
+    // The body repeated, RATE_LEN bytes in all
+    uint64_t start = host_time_ns();
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (size_t i = 0; i < RATE_LEN / BODY_LEN; i++) {
+        mbedtls_sha256_update(&sha, body, BODY_LEN);
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    double sha_mbs = RATE_LEN / 1e6 / ((host_time_ns() - start) / 1e9);
+
+    snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %u\r\n\r\n", RATE_LEN);
+    for (size_t b = 0; b < sizeof(sizes) / sizeof(sizes[0]); b++) {
+        sink_init(&s, &out, NULL, 0);
+        server.repeat = RATE_LEN / BODY_LEN - 1;
+        serve(head, body, BODY_LEN, RATE_SEND);
+        start = host_time_ns();
+        CHECK(download(digest, UINT32_MAX, &out, sizes[b], &result) == FOTA_OK);
+        double seconds = (host_time_ns() - start) / 1e9;
+        CHECK(s.len == RATE_LEN);
+        printf("Download of %u MB, %5zu B receive buffer: %6.1f MB/s, %6u writes, SHA-256 alone %6.1f MB/s\n",
+               RATE_LEN >> 20, sizes[b], RATE_LEN / 1e6 / seconds, s.writes, sha_mbs);
+    }
+}
+
+int main(void) {
+    uint32_t state = 1;
+
+    for (size_t i = 0; i < sizeof(body); i++) {
+        body[i] = (uint8_t)(rand_next(&state) >> 24);
+    }
+    sha256(body, sizeof(body), body_sha);
+    if (!server_open()) {
+        return 1;
+    }
+    test_sha256();
+    test_url();
+    test_parser();
+    test_download();
+    test_rate();
+    close(server.sock);
+    free(server.response);
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All firmware download tests passed\n");
+    return 0;
+}
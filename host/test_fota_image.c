@@ -0,0 +1,331 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+#include "fota_image.h"
+
+/*
+ * Unit tests of the firmware image decoder, fota_image.h: plain, compressed
+ * and delta images rebuilt intact whatever the write sizes, then corrupt
+ * payloads, deltas against another base and flash write failures, each
+ * failing the update rather than flashing garbage
+ *   make -C host test
+ */
+
+#define IMAGE_LEN       (200 * 1024 + 77)
+#define PACKED_MAX      (2 * IMAGE_LEN)
+
+typedef struct {
+    uint8_t  data[IMAGE_LEN + 4096];
+    size_t   len;
+    uint32_t begins;
+    uint32_t writes;
+    uint32_t short_writes;          // Writes under FOTA_IMAGE_OUT_SIZE
+    size_t   fail_at;               // A write going past it fails, SIZE_MAX for none
+} flash_t;
+
+static uint8_t base[IMAGE_LEN];
+static uint8_t image[IMAGE_LEN];
+static uint8_t ops[PACKED_MAX];
+static uint8_t packed[PACKED_MAX];
+static flash_t flash;
+static fota_image_t img;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static uint32_t rand_next(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int flash_begin(void *ctx, int64_t image_len) {
+    flash_t *f = ctx;
+    f->begins++;
+    return 0;
+}
+
+static int flash_write(void *ctx, const uint8_t *data, size_t len) {
+    flash_t *f = ctx;
+    if (len > f->fail_at - f->len || len > sizeof(f->data) - f->len) {
+        return -1;
+    }
+    memcpy(&f->data[f->len], data, len);
+    f->len += len;
+    f->writes++;
+    f->short_writes += len < FOTA_IMAGE_OUT_SIZE;
+    return 0;
+}
+
+static const fota_sink_t flash_sink = { flash_begin, flash_write, NULL, &flash };
+
+static int base_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    if (offset > sizeof(base) || len > sizeof(base) - offset) {
+        return -1;
+    }
+    memcpy(buf, &base[offset], len);
+    return 0;
+}
+
+static const fota_base_t running = { base_read, NULL, sizeof(base) };
+
+/*
+ * SHA-256 of data, as tools/fota_pack.py puts the one of the base in the header
+ */
+static void digest(const uint8_t *data, size_t len, uint8_t *out) {
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, data, len);
+    mbedtls_sha256_finish(&sha, out);
+    mbedtls_sha256_free(&sha);
+}
+
+static size_t put_varint(uint8_t *p, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+static void put_le32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+/*
+ * The image as a delta against the base: the first half moved by 1000 bytes
+ * with scattered changes, an insert, then the second half back from the
+ * start of the base, so that src goes backwards
+ */
+static size_t make_ops(void) {
+    size_t n = 0, half = IMAGE_LEN / 2;
+
+    ops[n++] = FOTA_OP_DIFF;
+    n += put_varint(&ops[n], half);
+    n += put_varint(&ops[n], 1000 * 2);
+    for (size_t i = 0; i < half; i++) {
+        ops[n++] = image[i] - base[1000 + i];
+    }
+    uint32_t src = 1000 + half;
+    ops[n++] = FOTA_OP_INSERT;
+    n += put_varint(&ops[n], 100);
+    memcpy(&ops[n], &image[half], 100);
+    n += 100;
+    ops[n++] = FOTA_OP_DIFF;
+    n += put_varint(&ops[n], IMAGE_LEN - half - 100);
+    n += put_varint(&ops[n], src * 2 - 1);
+    for (size_t i = half + 100; i < IMAGE_LEN; i++) {
+        ops[n++] = image[i] - base[i - half - 100];
+    }
+    return n;
+}
+
+/*
+ * Container of tools/fota_pack.py around payload
+ * return: its length
+ */
+static size_t pack(const uint8_t *payload, size_t len, uint8_t flags) {
+    memset(packed, 0, FOTA_IMAGE_HEADER_LEN);
+    memcpy(packed, "FPAT", 4);
+    packed[4] = 1;
+    packed[5] = flags;
+    put_le32(&packed[8], IMAGE_LEN);
+    if (flags & FOTA_IMAGE_DELTA) {
+        put_le32(&packed[12], sizeof(base));
+        digest(base, sizeof(base), &packed[16]);
+    }
+    if (!(flags & FOTA_IMAGE_DEFLATE)) {
+        memcpy(&packed[FOTA_IMAGE_HEADER_LEN], payload, len);
+        return FOTA_IMAGE_HEADER_LEN + len;
+    }
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    CHECK(deflateInit2(&z, 9, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    z.next_in = (Bytef *)payload;
+    z.avail_in = len;
+    z.next_out = &packed[FOTA_IMAGE_HEADER_LEN];
+    z.avail_out = PACKED_MAX - FOTA_IMAGE_HEADER_LEN;
+    CHECK(deflate(&z, Z_FINISH) == Z_STREAM_END);
+    size_t out = FOTA_IMAGE_HEADER_LEN + z.total_out;
+    deflateEnd(&z);
+    return out;
+}
+
+/*
+ * Download of data in writes of 1 to max_write bytes through the decoder
+ * return: the error of fota_image_finish()
+ */
+static fota_err_t decode(const uint8_t *data, size_t len, size_t max_write, uint32_t seed, const fota_base_t *b) {
+    uint32_t state = seed;
+    fota_sink_t sink;
+    size_t fail_at = flash.fail_at;
+
+    memset(&flash, 0, sizeof(flash));
+    flash.fail_at = fail_at;
+    fota_image_init(&img, &flash_sink, b);
+    fota_image_sink(&img, &sink);
+    CHECK(sink.begin(sink.ctx, len) == 0);
+    while (len) {
+        size_t n = 1 + rand_next(&state) % max_write;
+        if (n > len) {
+            n = len;
+        }
+        if (sink.write(sink.ctx, data, n)) {
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+    return fota_image_finish(&img);
+}
+
+static bool intact(void) {
+    uint8_t sha[FOTA_SHA256_LEN];
+    digest(image, sizeof(image), sha);
+    return flash.len == IMAGE_LEN && memcmp(flash.data, image, IMAGE_LEN) == 0 &&
+           memcmp(img.sha256, sha, FOTA_SHA256_LEN) == 0 && flash.begins == 1;
+}
+
+static void test_round_trip(void) {
+    static const size_t writes[] = { 1, 7, 1460, 4096, 65536 };
+    size_t ops_len = make_ops();
+    size_t len;
+
+    for (size_t w = 0; w < sizeof(writes) / sizeof(writes[0]); w++) {
+        // Plain image, written as received
+        flash.fail_at = SIZE_MAX;
+        CHECK(decode(image, sizeof(image), writes[w], 1 + w, NULL) == FOTA_OK && intact());
+        CHECK(img.flags == 0 && img.inflator == NULL);
+
+        // Compressed, in full chunks but the last
+        len = pack(image, sizeof(image), FOTA_IMAGE_DEFLATE);
+        CHECK(len < sizeof(image));
+        CHECK(decode(packed, len, writes[w], 2 + w, NULL) == FOTA_OK && intact());
+        CHECK(flash.short_writes == 1);
+
+        // Delta, uncompressed then compressed
+        len = pack(ops, ops_len, FOTA_IMAGE_DELTA);
+        CHECK(decode(packed, len, writes[w], 3 + w, &running) == FOTA_OK && intact());
+        len = pack(ops, ops_len, FOTA_IMAGE_DELTA | FOTA_IMAGE_DEFLATE);
+        CHECK(len < sizeof(image) / 10);
+        CHECK(decode(packed, len, writes[w], 4 + w, &running) == FOTA_OK && intact());
+        CHECK(flash.short_writes == 1);
+    }
+}
+
+static void test_corrupt(void) {
+    size_t ops_len = make_ops();
+    size_t len;
+
+    flash.fail_at = SIZE_MAX;
+    len = pack(image, sizeof(image), FOTA_IMAGE_DEFLATE);
+
+    // Truncated anywhere
+    for (size_t cut = 1; cut < len; cut += len / 7) {
+        CHECK(decode(packed, cut, 1460, 5, NULL) == FOTA_ERR_IMAGE);
+    }
+    CHECK(decode(packed, len - 1, 1460, 5, NULL) == FOTA_ERR_IMAGE);
+
+    // Bytes after the stream
+    packed[len] = 0;
+    CHECK(decode(packed, len + 1, 1460, 5, NULL) == FOTA_ERR_IMAGE);
+
+    // A flipped bit fails the stream or the digest, the fota.c check
+    packed[len / 2] ^= 0x10;
+    CHECK(decode(packed, len, 1460, 5, NULL) != FOTA_OK || !intact());
+
+    // Unknown version or flag
+    len = pack(image, sizeof(image), 0);
+    packed[4] = 2;
+    CHECK(decode(packed, len, 1460, 5, NULL) == FOTA_ERR_IMAGE && flash.len == 0);
+    len = pack(image, sizeof(image), 0x04);
+    CHECK(decode(packed, len, 1460, 5, NULL) == FOTA_ERR_IMAGE && flash.len == 0);
+
+    // Image longer or shorter than announced
+    len = pack(image, sizeof(image), 0);
+    put_le32(&packed[8], IMAGE_LEN - 1);
+    CHECK(decode(packed, len, 1460, 5, NULL) == FOTA_ERR_IMAGE);
+    put_le32(&packed[8], IMAGE_LEN + 1);
+    CHECK(decode(packed, len, 1460, 5, NULL) == FOTA_ERR_IMAGE);
+
+    // Unknown operation, source outside the base, operation cut short
+    len = pack(ops, ops_len, FOTA_IMAGE_DELTA);
+    packed[FOTA_IMAGE_HEADER_LEN] = 7;
+    CHECK(decode(packed, len, 1460, 5, &running) == FOTA_ERR_IMAGE && flash.len == 0);
+    uint8_t varint[5];
+    len = pack(ops, ops_len, FOTA_IMAGE_DELTA);
+    packed[FOTA_IMAGE_HEADER_LEN + 1 + put_varint(varint, IMAGE_LEN / 2)] = 0x7F;
+    CHECK(decode(packed, len, 1460, 5, &running) == FOTA_ERR_IMAGE && flash.len == 0);
+    len = pack(ops, ops_len, FOTA_IMAGE_DELTA);
+    CHECK(decode(packed, len - 10, 1460, 5, &running) == FOTA_ERR_IMAGE);
+}
+
+static void test_wrong_base(void) {
+    size_t len = make_ops();
+    fota_base_t small = running;
+
+    flash.fail_at = SIZE_MAX;
+    len = pack(ops, len, FOTA_IMAGE_DELTA | FOTA_IMAGE_DEFLATE);
+
+    // Another image, nothing flashed
+    base[12345] ^= 1;
+    CHECK(decode(packed, len, 1460, 6, &running) == FOTA_ERR_BASE && flash.len == 0);
+    base[12345] ^= 1;
+
+    // No base, or one smaller than the delta's
+    CHECK(decode(packed, len, 1460, 6, NULL) == FOTA_ERR_BASE && flash.len == 0);
+    small.size = sizeof(base) - 1;
+    CHECK(decode(packed, len, 1460, 6, &small) == FOTA_ERR_BASE && flash.len == 0);
+    CHECK(decode(packed, len, 1460, 6, &running) == FOTA_OK && intact());
+}
+
+static void test_write_failure(void) {
+    size_t len = pack(image, sizeof(image), FOTA_IMAGE_DEFLATE);
+
+    flash.fail_at = IMAGE_LEN / 3;
+    CHECK(decode(packed, len, 1460, 8, NULL) == FOTA_ERR_WRITE);
+    CHECK(flash.len <= IMAGE_LEN / 3 && memcmp(flash.data, image, flash.len) == 0);
+    flash.fail_at = IMAGE_LEN - 1;
+    CHECK(decode(image, sizeof(image), 1460, 8, NULL) == FOTA_ERR_WRITE);
+    flash.fail_at = SIZE_MAX;
+}
+
+int main(void) {
+    uint32_t state = 1;
+
+    // Code-like: runs of a few words, changed here and there in the new image
+    for (size_t i = 0; i < sizeof(base); i++) {
+        base[i] = (uint8_t)((rand_next(&state) >> 24) & 0x0F);
+    }
+    memcpy(image, &base[1000], IMAGE_LEN / 2);
+    memcpy(&image[IMAGE_LEN / 2 + 100], base, IMAGE_LEN - IMAGE_LEN / 2 - 100);
+    for (size_t i = 0; i < 100; i++) {
+        image[IMAGE_LEN / 2 + i] = (uint8_t)(rand_next(&state) >> 24);
+    }
+    for (size_t i = 0; i < sizeof(image); i += 1 + rand_next(&state) % 997) {
+        image[i] ^= (uint8_t)rand_next(&state) | 1;
+    }
+    test_round_trip();
+    test_corrupt();
+    test_wrong_base();
+    test_write_failure();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All firmware image tests passed\n");
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "fota_pipe.h"
+
+/*
+ * Unit tests of the buffers between the firmware download and the flash
+ * writer task, fota_pipe.h: the image written in order and intact whatever
+ * the receive sizes, the reader waiting on a slow writer, and flash write
+ * failures stopping the download without a hang
+ *   make -C host test
+ */
+
+#define IMAGE_LEN       (300 * 1024 + 123)
+#define BUFFERS         4
+#define BUFFER_SIZE     4096
+#define HEAD_LEN        97          // HTTP headers ahead of the body in the first buffer
+
+typedef struct {
+    uint8_t  *data;
+    size_t    len;
+    int64_t   image_len;
+    uint32_t  begins;
+    uint32_t  writes;
+    size_t    fail_at;              // A write going past it fails, SIZE_MAX for none
+    uint32_t  delay_us;             // Per write
+    uint32_t  outside;              // Writes not from the pool
+} flash_t;
+
+static uint8_t image[IMAGE_LEN];
+static uint8_t written[IMAGE_LEN];
+static uint8_t pool[BUFFERS * BUFFER_SIZE];
+static flash_t flash;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static uint32_t rand_next(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int flash_begin(void *ctx, int64_t image_len) {
+    flash_t *f = ctx;
+    f->begins++;
+    f->image_len = image_len;
+    return 0;
+}
+
+static int flash_write(void *ctx, const uint8_t *data, size_t len) {
+    flash_t *f = ctx;
+    if (data < pool || data + len > pool + sizeof(pool)) {
+        f->outside++;
+    }
+    if (f->delay_us) {
+        struct timespec ts = { 0, (long)f->delay_us * 1000 };
+        nanosleep(&ts, NULL);
+    }
+    if (len > f->fail_at - f->len || len > sizeof(written) - f->len) {
+        return -1;
+    }
+    memcpy(&f->data[f->len], data, len);
+    f->len += len;
+    f->writes++;
+    return 0;
+}
+
+static const fota_sink_t flash_sink = { flash_begin, flash_write, NULL, &flash };
+
+static void flash_init(void) {
+    memset(&flash, 0, sizeof(flash));
+    memset(written, 0, sizeof(written));
+    flash.data = written;
+    flash.fail_at = SIZE_MAX;
+}
+
+/*
+ * The receive loop of fota_download(): headers then the image, in reads of
+ * 1 to max_read bytes into the buffers of the pipe
+ * return: 0, -1 once the pipe refuses more
+ */
+static int receive(fota_pipe_t *pipe, size_t max_read, uint32_t seed) {
+    fota_sink_t sink;
+    uint32_t state = seed;
+    size_t sent = 0, head = HEAD_LEN;
+
+    fota_pipe_sink(pipe, &sink);
+    while (sent < IMAGE_LEN) {
+        size_t room = 0;
+        uint8_t *buf = sink.buffer(sink.ctx, &room);
+        if (buf == NULL) {
+            return -1;
+        }
+        CHECK(room > 0 && buf >= pool && buf + room <= pool + sizeof(pool));
+        size_t n = 1 + rand_next(&state) % max_read;
+        if (n > room) {
+            n = room;
+        }
+        if (head) {
+            // Headers end inside this read, the body follows them
+            size_t h = n < head ? n : head;
+            memset(buf, 'H', h);
+            head -= h;
+            if (head) {
+                continue;
+            }
+            CHECK(sink.begin(sink.ctx, IMAGE_LEN) == 0);
+            buf += h;
+            n -= h;
+        }
+        if (n > IMAGE_LEN - sent) {
+            n = IMAGE_LEN - sent;
+        }
+        memcpy(buf, &image[sent], n);
+        sent += n;
+        if (n && sink.write(sink.ctx, buf, n)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void test_intact(void) {
+    static const size_t reads[] = { 1, 100, 1460, BUFFER_SIZE };
+    fota_pipe_t pipe;
+
+    for (size_t r = 0; r < sizeof(reads) / sizeof(reads[0]); r++) {
+        flash_init();
+        CHECK(fota_pipe_start(&pipe, pool, BUFFERS, BUFFER_SIZE, &flash_sink, 5));
+        CHECK(receive(&pipe, reads[r], 7 + r) == 0);
+        CHECK(fota_pipe_finish(&pipe) == 0);
+        CHECK(flash.begins == 1 && flash.image_len == IMAGE_LEN);
+        CHECK(pipe.written == IMAGE_LEN && flash.len == IMAGE_LEN);
+        CHECK(memcmp(written, image, IMAGE_LEN) == 0 && flash.outside == 0);
+        // Buffers three quarters full at least, not every read
+        CHECK(flash.writes <= IMAGE_LEN / (BUFFER_SIZE * 3 / 4 - HEAD_LEN) + 2);
+    }
+}
+
+static void test_slow_flash(void) {
+    fota_pipe_t pipe;
+
+    // The reader waits for buffers, nothing is lost
+    flash_init();
+    flash.delay_us = 2000;
+    CHECK(fota_pipe_start(&pipe, pool, BUFFERS, BUFFER_SIZE, &flash_sink, 5));
+    CHECK(receive(&pipe, BUFFER_SIZE, 3) == 0);
+    CHECK(fota_pipe_finish(&pipe) == 0);
+    CHECK(pipe.stalls > 0);
+    CHECK(flash.len == IMAGE_LEN && memcmp(written, image, IMAGE_LEN) == 0);
+}
+
+static void test_failure(void) {
+    fota_pipe_t pipe;
+
+    // Midway: the reader is refused a buffer or a write, then finish reports it
+    flash_init();
+    flash.fail_at = IMAGE_LEN / 3;
+    CHECK(fota_pipe_start(&pipe, pool, BUFFERS, BUFFER_SIZE, &flash_sink, 5));
+    CHECK(receive(&pipe, 1460, 5) == -1);
+    CHECK(fota_pipe_finish(&pipe) == -1);
+    CHECK(flash.len <= IMAGE_LEN / 3 && pipe.written == flash.len);
+    CHECK(memcmp(written, image, flash.len) == 0);
+
+    // On the last bytes, only seen by finish
+    flash_init();
+    flash.fail_at = IMAGE_LEN - 1;
+    CHECK(fota_pipe_start(&pipe, pool, BUFFERS, BUFFER_SIZE, &flash_sink, 5));
+    receive(&pipe, 1460, 5);
+    CHECK(fota_pipe_finish(&pipe) == -1);
+    CHECK(pipe.written < IMAGE_LEN);
+
+    // Download failed before the body: the writer ends all the same
+    flash_init();
+    CHECK(fota_pipe_start(&pipe, pool, BUFFERS, BUFFER_SIZE, &flash_sink, 5));
+    CHECK(fota_pipe_finish(&pipe) == 0);
+    CHECK(flash.begins == 0 && flash.writes == 0);
+
+    // And the pipe is reusable after each
+    flash_init();
+    CHECK(fota_pipe_start(&pipe, pool, BUFFERS, BUFFER_SIZE, &flash_sink, 5));
+    CHECK(receive(&pipe, 1460, 11) == 0);
+    CHECK(fota_pipe_finish(&pipe) == 0);
+    CHECK(flash.len == IMAGE_LEN && memcmp(written, image, IMAGE_LEN) == 0);
+}
+
+int main(void) {
+    uint32_t state = 1;
+
+    for (size_t i = 0; i < sizeof(image); i++) {
+        image[i] = (uint8_t)(rand_next(&state) >> 24);
+    }
+    test_intact();
+    test_slow_flash();
+    test_failure();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All firmware pipe tests passed\n");
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gattc_cache.h"
+#include "adv_parse.h"
+
+/*
+ * Unit tests of the GATT layout cache, gattc_cache.h
+ *   make -C host test
+ */
+
+#define ENTRIES         4
+#define MODEL_A         0x11223344
+#define MODEL_B         0x55667788
+
+static gattc_cache_entry_t entries[ENTRIES];
+static gattc_cache_t cache;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static const uint8_t *bda(uint8_t device) {
+    static uint8_t addr[ADV_BDA_LEN] = { 0xC0, 0, 0, 0, 0, 0 };
+    addr[5] = device;
+    return addr;
+}
+
+static void layout(uint16_t *handles, uint16_t base) {
+    for (int i = 0; i < GATTC_CACHE_HANDLES; i++) {
+        handles[i] = base + 3 * i;
+    }
+}
+
+static void test_lookup(void) {
+    uint16_t put[GATTC_CACHE_HANDLES], got[GATTC_CACHE_HANDLES];
+    gattc_cache_stats_t stats;
+
+    CHECK(!gattc_cache_init(&cache, entries, 0));
+    CHECK(gattc_cache_init(&cache, entries, ENTRIES));
+    CHECK(gattc_cache_get(&cache, bda(1), MODEL_A, got) == GATTC_CACHE_MISS);
+    CHECK(!cache.dirty);
+
+    // Stored under the address and the model
+    layout(put, 0x0C);
+    gattc_cache_put(&cache, bda(1), MODEL_A, put);
+    CHECK(cache.dirty);
+    CHECK(gattc_cache_get(&cache, bda(1), MODEL_A, got) == GATTC_CACHE_ADDRESS);
+    CHECK(memcmp(got, put, sizeof(put)) == 0);
+    // Another unit of the model
+    memset(got, 0, sizeof(got));
+    CHECK(gattc_cache_get(&cache, bda(2), MODEL_A, got) == GATTC_CACHE_MODEL);
+    CHECK(memcmp(got, put, sizeof(put)) == 0);
+    CHECK(gattc_cache_get(&cache, bda(2), MODEL_B, got) == GATTC_CACHE_MISS);
+    CHECK(gattc_cache_get(&cache, bda(2), 0, got) == GATTC_CACHE_MISS);
+
+    // The address wins over the model
+    layout(put, 0x1C);
+    gattc_cache_put(&cache, bda(2), 0, put);
+    CHECK(gattc_cache_get(&cache, bda(2), MODEL_A, got) == GATTC_CACHE_ADDRESS);
+    CHECK(got[0] == 0x1C);
+
+    // Same layout again: nothing to save
+    cache.dirty = false;
+    gattc_cache_put(&cache, bda(2), 0, put);
+    CHECK(!cache.dirty);
+
+    gattc_cache_get_stats(&cache, &stats);
+    CHECK(stats.hits_address == 2 && stats.hits_model == 1 && stats.misses == 3);
+    CHECK(stats.stored == 3 && stats.evicted == 0);
+}
+
+static void test_invalidate(void) {
+    uint16_t put[GATTC_CACHE_HANDLES], got[GATTC_CACHE_HANDLES];
+    gattc_cache_stats_t stats;
+
+    gattc_cache_init(&cache, entries, ENTRIES);
+    layout(put, 0x0C);
+    gattc_cache_put(&cache, bda(1), MODEL_A, put);
+    gattc_cache_put(&cache, bda(2), MODEL_B, put);
+    cache.dirty = false;
+
+    // Service Changed from a unit: its address and its model
+    gattc_cache_invalidate(&cache, bda(1), MODEL_A);
+    CHECK(cache.dirty);
+    CHECK(gattc_cache_get(&cache, bda(1), MODEL_A, got) == GATTC_CACHE_MISS);
+    CHECK(gattc_cache_get(&cache, bda(3), MODEL_A, got) == GATTC_CACHE_MISS);
+    CHECK(gattc_cache_get(&cache, bda(2), MODEL_B, got) == GATTC_CACHE_ADDRESS);
+    // Model unknown: the address only
+    gattc_cache_invalidate(&cache, bda(2), 0);
+    CHECK(gattc_cache_get(&cache, bda(2), MODEL_B, got) == GATTC_CACHE_MODEL);
+
+    gattc_cache_get_stats(&cache, &stats);
+    CHECK(stats.invalidated == 3);
+}
+
+static void test_evict(void) {
+    uint16_t put[GATTC_CACHE_HANDLES], got[GATTC_CACHE_HANDLES];
+    gattc_cache_stats_t stats;
+
+    gattc_cache_init(&cache, entries, ENTRIES);
+    layout(put, 0x0C);
+    for (uint8_t d = 1; d <= ENTRIES; d++) {
+        gattc_cache_put(&cache, bda(d), 0, put);
+    }
+    // Used: kept over the others
+    CHECK(gattc_cache_get(&cache, bda(1), 0, got) == GATTC_CACHE_ADDRESS);
+    gattc_cache_put(&cache, bda(ENTRIES + 1), 0, put);
+    CHECK(gattc_cache_get(&cache, bda(1), 0, got) == GATTC_CACHE_ADDRESS);
+    CHECK(gattc_cache_get(&cache, bda(2), 0, got) == GATTC_CACHE_MISS);
+    CHECK(gattc_cache_get(&cache, bda(ENTRIES + 1), 0, got) == GATTC_CACHE_ADDRESS);
+    gattc_cache_get_stats(&cache, &stats);
+    CHECK(stats.evicted == 1);
+}
+
+static void test_restore(void) {
+    static gattc_cache_entry_t saved[ENTRIES];
+    uint16_t put[GATTC_CACHE_HANDLES], got[GATTC_CACHE_HANDLES];
+
+    gattc_cache_init(&cache, entries, ENTRIES);
+    layout(put, 0x0C);
+    gattc_cache_put(&cache, bda(1), MODEL_A, put);
+    gattc_cache_put(&cache, bda(2), 0, put);
+    memcpy(saved, entries, sizeof(saved));
+
+    // After a reboot
+    gattc_cache_init(&cache, entries, ENTRIES);
+    memcpy(entries, saved, sizeof(saved));
+    entries[3].kind = 0x7F;
+    CHECK(gattc_cache_restore(&cache, sizeof(saved)));
+    CHECK(!cache.dirty);
+    CHECK(entries[3].kind == GATTC_CACHE_MISS);
+    CHECK(gattc_cache_get(&cache, bda(3), MODEL_A, got) == GATTC_CACHE_MODEL);
+    CHECK(memcmp(got, put, sizeof(put)) == 0);
+    CHECK(gattc_cache_get(&cache, bda(2), 0, got) == GATTC_CACHE_ADDRESS);
+    // Use order carries on: the model entry, just used, stays
+    gattc_cache_put(&cache, bda(4), 0, put);
+    gattc_cache_put(&cache, bda(5), 0, put);
+    CHECK(gattc_cache_get(&cache, bda(3), MODEL_A, got) == GATTC_CACHE_MODEL);
+    CHECK(gattc_cache_get(&cache, bda(1), 0, got) == GATTC_CACHE_MISS);
+
+    // Saved with another size
+    memcpy(entries, saved, sizeof(saved));
+    CHECK(!gattc_cache_restore(&cache, sizeof(saved) - sizeof(saved[0])));
+    CHECK(gattc_cache_get(&cache, bda(1), MODEL_A, got) == GATTC_CACHE_MISS);
+}
+
+static void test_fingerprint(void) {
+    // Flags, UUID list, TX power, manufacturer data
+    uint8_t a[] = { 2, 0x01, 0x06, 5, 0x03, 0x0F, 0x18, 0x1A, 0x18, 2, 0x0A, 0x00, 5, 0xFF, 0x59, 0x00, 1, 2 };
+    uint8_t b[sizeof(a)];
+    uint32_t fp = adv_fingerprint(a, sizeof(a));
+
+    CHECK(fp != 0);
+    // Values of a unit do not count
+    memcpy(b, a, sizeof(a));
+    b[11] = 0xF0;
+    b[16] = 9;
+    CHECK(adv_fingerprint(b, sizeof(b)) == fp);
+    // The services and the company do
+    b[5] = 0x10;
+    CHECK(adv_fingerprint(b, sizeof(b)) != fp);
+    memcpy(b, a, sizeof(a));
+    b[14] = 0x4C;
+    CHECK(adv_fingerprint(b, sizeof(b)) != fp);
+    // Nothing identifying
+    CHECK(adv_fingerprint(a, 3) == 0);
+    CHECK(adv_fingerprint(NULL, 0) == 0);
+}
+
+int main(void) {
+    test_lookup();
+    test_invalidate();
+    test_evict();
+    test_restore();
+    test_fingerprint();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All GATT layout cache tests passed\n");
+    return 0;
+}
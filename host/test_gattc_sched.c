@@ -0,0 +1,328 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gattc_sched.h"
+#include "adv_frame.h"
+
+/*
+ * Unit tests of the GATT client scheduler, gattc_sched.h
+ *   make -C host test
+ */
+
+#define TAGS            4
+#define PERIOD_MS       60000
+#define URGENT_MS       10000
+#define RETRY_MS        1000
+#define SEEN_MS         5000
+#define CONNECT_MS      2000
+#define JOB_MS          3000
+
+static gattc_sched_tag_t tags[TAGS];
+static gattc_sched_t sched;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static void init(uint8_t links, uint16_t duty, uint32_t now_ms) {
+    gattc_sched_params_t params = {
+        .period_ms = PERIOD_MS,
+        .urgent_period_ms = URGENT_MS,
+        .retry_ms = RETRY_MS,
+        .seen_ms = SEEN_MS,
+        .connect_timeout_ms = CONNECT_MS,
+        .job_timeout_ms = JOB_MS,
+        .duty = duty,
+        .links = links,
+    };
+    CHECK(gattc_sched_init(&sched, tags, TAGS, &params, now_ms));
+}
+
+static void seen(uint8_t device, int8_t rssi, uint32_t now_ms) {
+    uint8_t bda[ADV_BDA_LEN] = { 0xC0, 0, 0, 0, 0, device };
+    gattc_sched_seen(&sched, bda, rssi, 0, now_ms);
+}
+
+static uint8_t device(int link) {
+    return gattc_sched_bda(&sched, link)[5];
+}
+
+/*
+ * Connect and read the tag of a CONNECTING link
+ */
+static void job(int link, bool ok, bool urgent, uint32_t now_ms) {
+    gattc_sched_connected(&sched, link, (uint16_t)link, now_ms);
+    gattc_sched_done(&sched, link, ok, urgent, now_ms + 100);
+}
+
+static void test_init(void) {
+    gattc_sched_params_t params = { .links = 1 };
+
+    CHECK(!gattc_sched_init(&sched, tags, 0, &params, 0));
+    CHECK(!gattc_sched_init(&sched, tags, GATTC_SCHED_NONE, &params, 0));
+    params.links = 0;
+    CHECK(!gattc_sched_init(&sched, tags, TAGS, &params, 0));
+    params.links = GATTC_SCHED_LINKS_MAX + 1;
+    CHECK(!gattc_sched_init(&sched, tags, TAGS, &params, 0));
+    init(1, 2000, 0);
+    CHECK(sched.params.duty == 1000);
+}
+
+static void test_order(void) {
+    gattc_sched_stats_t stats;
+    int link;
+
+    init(2, 1000, 0);
+    CHECK(gattc_sched_next(&sched, 0) == -1);
+    seen(1, -70, 0);
+    seen(2, -50, 0);
+    seen(3, -60, 0);
+    // Never read, same due time: strongest first
+    link = gattc_sched_next(&sched, 0);
+    CHECK(link == 0 && device(link) == 2);
+    CHECK(sched.links[0].state == GATTC_SCHED_CONNECTING);
+    // One connection initiated at a time
+    CHECK(gattc_sched_next(&sched, 0) == -1);
+    CHECK(gattc_sched_find(&sched, gattc_sched_bda(&sched, 0)) == 0);
+    job(link, true, true, 0);
+    CHECK(gattc_sched_find(&sched, gattc_sched_bda(&sched, 0)) == -1);
+
+    link = gattc_sched_next(&sched, 100);
+    CHECK(link == 0 && device(link) == 3);
+    gattc_sched_connected(&sched, link, 7, 100);
+    CHECK(gattc_sched_find_conn(&sched, 7) == 0);
+    // Second link while the first one reads
+    link = gattc_sched_next(&sched, 100);
+    CHECK(link == 1 && device(link) == 1);
+    job(link, true, false, 100);
+    gattc_sched_done(&sched, 0, true, false, 250);
+
+    // Nothing due until the urgent tag, which goes before a new one
+    CHECK(gattc_sched_next(&sched, 1000) == -1);
+    seen(2, -50, 100 + URGENT_MS);
+    seen(4, -40, 100 + URGENT_MS);
+    link = gattc_sched_next(&sched, 100 + URGENT_MS);
+    CHECK(link == 0 && device(link) == 2);
+    job(link, true, false, 100 + URGENT_MS);
+    link = gattc_sched_next(&sched, 200 + URGENT_MS);
+    CHECK(link == 0 && device(link) == 4);
+    job(link, true, false, 200 + URGENT_MS);
+
+    // Then the most overdue, before the strongest
+    seen(1, -70, 300 + PERIOD_MS);
+    seen(3, -60, 300 + PERIOD_MS);
+    link = gattc_sched_next(&sched, 300 + PERIOD_MS);
+    CHECK(device(link) == 1);
+    job(link, true, false, 300 + PERIOD_MS);
+    link = gattc_sched_next(&sched, 400 + PERIOD_MS);
+    CHECK(device(link) == 3);
+    job(link, true, false, 400 + PERIOD_MS);
+
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.tags == 4 && stats.started == 7 && stats.read == 7);
+    CHECK(stats.failed == 0 && stats.timeouts == 0);
+    CHECK(stats.busy_ms == 6 * 100 + 150);
+}
+
+static void test_seen(void) {
+    gattc_sched_stats_t stats;
+
+    init(1, 1000, 0);
+    for (uint8_t d = 0; d < TAGS; d++) {
+        seen(d, -60, d);
+    }
+    // Only tags advertising lately
+    CHECK(gattc_sched_next(&sched, SEEN_MS + 2) == 0);
+    CHECK(device(0) == 2);
+
+    init(1, 1000, 0);
+    seen(1, -60, 0);
+    CHECK(gattc_sched_next(&sched, SEEN_MS + 1) == -1);
+    seen(1, -60, SEEN_MS + 1);
+    CHECK(gattc_sched_next(&sched, SEEN_MS + 1) == 0);
+
+    // Full: the least recently seen idle tag goes
+    for (uint8_t d = 2; d <= TAGS; d++) {
+        seen(d, -60, SEEN_MS + d);
+    }
+    seen(TAGS + 1, -60, SEEN_MS + 10);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.tags == TAGS && stats.evicted == 1);
+    CHECK(device(0) == 1);
+    for (int i = 0; i < TAGS; i++) {
+        CHECK(tags[i].bda[5] != 2);
+    }
+}
+
+static void test_timeout(void) {
+    gattc_sched_stats_t stats;
+    int link;
+
+    init(1, 1000, 0);
+    seen(1, -60, 0);
+    link = gattc_sched_next(&sched, 0);
+    CHECK(link == 0);
+    CHECK(gattc_sched_expired(&sched, CONNECT_MS - 1) == -1);
+    // Connect timeout: closed by the caller
+    CHECK(gattc_sched_expired(&sched, CONNECT_MS) == 0);
+    CHECK(sched.links[0].state == GATTC_SCHED_CLOSING);
+    CHECK(gattc_sched_expired(&sched, CONNECT_MS) == -1);
+    // Close never confirmed: freed
+    CHECK(gattc_sched_expired(&sched, 2 * CONNECT_MS) == -1);
+    CHECK(sched.links[0].state == GATTC_SCHED_IDLE);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.timeouts == 1 && stats.failed == 0);
+    CHECK(stats.busy_ms == 2 * CONNECT_MS);
+
+    // Retried after RETRY_MS, doubled per failure, up to the period
+    uint32_t now = 2 * CONNECT_MS, backoff = RETRY_MS;
+    for (int i = 0; i < 8; i++) {
+        seen(1, -60, now + backoff - 1);
+        CHECK(gattc_sched_next(&sched, now + backoff - 1) == -1);
+        now += backoff;
+        seen(1, -60, now);
+        link = gattc_sched_next(&sched, now);
+        CHECK(link == 0);
+        gattc_sched_done(&sched, link, false, false, now);
+        backoff = backoff * 2 < PERIOD_MS ? backoff * 2 : PERIOD_MS;
+    }
+    CHECK(tags[0].due_ms == now + PERIOD_MS);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.failed == 8);
+
+    // Job timeout once connected
+    now += PERIOD_MS;
+    seen(1, -60, now);
+    link = gattc_sched_next(&sched, now);
+    gattc_sched_connected(&sched, link, 3, now + 100);
+    CHECK(gattc_sched_expired(&sched, now + 100 + JOB_MS - 1) == -1);
+    CHECK(gattc_sched_expired(&sched, now + 100 + JOB_MS) == 0);
+    gattc_sched_done(&sched, link, false, false, now + 200 + JOB_MS);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.timeouts == 2 && stats.failed == 8);
+    CHECK(tags[0].failures == 10);
+    // A read resets the backoff
+    now += 200 + JOB_MS + PERIOD_MS;
+    seen(1, -60, now);
+    link = gattc_sched_next(&sched, now);
+    CHECK(link == 0);
+    job(link, true, false, now);
+    CHECK(tags[0].failures == 0 && tags[0].due_ms == now + 100 + PERIOD_MS);
+}
+
+static void test_budget(void) {
+    gattc_sched_stats_t stats;
+    int link;
+
+    // 10% duty: one job burst, then a tenth of the time
+    init(2, 100, 0);
+    seen(1, -60, 0);
+    seen(2, -60, 0);
+    link = gattc_sched_next(&sched, 0);
+    CHECK(link == 0);
+    gattc_sched_connected(&sched, link, 0, 0);
+    // Started with one job worth, 6000 spent and 600 earned
+    gattc_sched_tick(&sched, 2 * JOB_MS, true);
+    seen(2, -60, 2 * JOB_MS);
+    CHECK(gattc_sched_next(&sched, 2 * JOB_MS) == -1);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.deferred == 1);
+    gattc_sched_done(&sched, link, true, false, 2 * JOB_MS);
+    // 2400 in debt, earned back in 2400 / 0.1
+    gattc_sched_tick(&sched, 2 * JOB_MS + 24000, true);
+    seen(2, -60, 2 * JOB_MS + 24000);
+    CHECK(gattc_sched_next(&sched, 2 * JOB_MS + 24000) == -1);
+    gattc_sched_tick(&sched, 2 * JOB_MS + 24001, true);
+    CHECK(gattc_sched_next(&sched, 2 * JOB_MS + 24001) == 0);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.deferred == 2);
+
+    // Free while the scanner is off
+    init(2, 100, 0);
+    seen(1, -60, 0);
+    seen(2, -60, 0);
+    link = gattc_sched_next(&sched, 0);
+    gattc_sched_connected(&sched, link, 0, 0);
+    gattc_sched_tick(&sched, 10 * JOB_MS, false);
+    seen(2, -60, 10 * JOB_MS);
+    CHECK(gattc_sched_next(&sched, 10 * JOB_MS) == 1);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.deferred == 0);
+}
+
+static void test_streaming(void) {
+    gattc_sched_stats_t stats;
+    int link;
+
+    init(2, 100, 0);
+    seen(1, -60, 0);
+    seen(2, -60, 0);
+    link = gattc_sched_next(&sched, 0);
+    gattc_sched_connected(&sched, link, 5, 0);
+    gattc_sched_streaming(&sched, link, 500);
+    CHECK(sched.links[link].state == GATTC_SCHED_STREAMING);
+    // No deadline, and no budget: the other tag is read
+    CHECK(gattc_sched_expired(&sched, 100 * JOB_MS) == -1);
+    gattc_sched_tick(&sched, 100 * JOB_MS, true);
+    seen(2, -60, 100 * JOB_MS);
+    CHECK(gattc_sched_next(&sched, 100 * JOB_MS) == 1);
+    gattc_sched_done(&sched, 1, true, false, 100 * JOB_MS);
+    // Closed by the caller: due again soon, as read
+    gattc_sched_closing(&sched, link, 200 * JOB_MS);
+    gattc_sched_done(&sched, link, false, false, 200 * JOB_MS);
+    CHECK(tags[0].due_ms == 200 * JOB_MS + RETRY_MS && tags[0].failures == 0);
+    gattc_sched_get_stats(&sched, &stats);
+    CHECK(stats.streams == 1 && stats.read == 2 && stats.failed == 0 && stats.timeouts == 0);
+    // Only the connection and the reads before streaming count as busy
+    CHECK(stats.busy_ms == 500);
+}
+
+static void test_reading(void) {
+    static const uint8_t battery[] = { 42 };
+    static const uint8_t temperature[] = { 0x18, 0xFC };   // -10.00 C
+    static const uint8_t humidity[] = { 0x88, 0x13 };      // 50.00 %
+    gattc_reading_t reading, decoded;
+    uint8_t frame[ADV_FRAME_GATT_LEN];
+
+    memset(&reading, 0, sizeof(reading));
+    memset(&decoded, 0, sizeof(decoded));
+    CHECK(!gattc_reading_put(&reading, GATTC_UUID_BATTERY_LEVEL, battery, 0));
+    CHECK(!gattc_reading_put(&reading, GATTC_UUID_TEMPERATURE, temperature, 1));
+    CHECK(!gattc_reading_put(&reading, 0x2A00, battery, 1));
+    CHECK(reading.fields == 0);
+    CHECK(gattc_reading_put(&reading, GATTC_UUID_BATTERY_LEVEL, battery, 1));
+    CHECK(gattc_reading_put(&reading, GATTC_UUID_TEMPERATURE, temperature, 2));
+    CHECK(gattc_reading_put(&reading, GATTC_UUID_HUMIDITY, humidity, 2));
+    CHECK(reading.fields == (GATTC_READING_BATTERY | GATTC_READING_TEMPERATURE | GATTC_READING_HUMIDITY));
+    CHECK(reading.battery == 42 && reading.temperature == -1000 && reading.humidity == 5000);
+
+    reading.bda[5] = 9;
+    reading.time_ms = 123456;
+    reading.duration_ms = 321;
+    CHECK(adv_frame_encode_gatt(&reading, frame, sizeof(frame) - 1) == -1);
+    CHECK(adv_frame_encode_gatt(&reading, frame, sizeof(frame)) == ADV_FRAME_GATT_LEN);
+    CHECK(adv_frame_decode_gatt(frame, sizeof(frame) - 1, &decoded) == -1);
+    CHECK(adv_frame_decode_gatt(frame, sizeof(frame), &decoded) == ADV_FRAME_GATT_LEN);
+    CHECK(memcmp(&decoded, &reading, sizeof(reading)) == 0);
+}
+
+int main(void) {
+    test_init();
+    test_order();
+    test_seen();
+    test_timeout();
+    test_budget();
+    test_streaming();
+    test_reading();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All GATT client scheduler tests passed\n");
+    return 0;
+}
@@ -0,0 +1,343 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gattc_stream.h"
+#include "adv_frame.h"
+
+/*
+ * Unit tests of the GATT notification streams, gattc_stream.h
+ *   make -C host test
+ */
+
+#define STREAMS         2
+#define BUFFERS         3
+#define BYTES           600
+#define AGE_US          10000
+#define IDLE_US         50000
+#define VALUE_LEN       20
+#define PER_BATCH       ((BYTES - ADV_FRAME_STREAM_HEADER_LEN) / (ADV_FRAME_STREAM_RECORD_LEN + VALUE_LEN))
+
+static gattc_stream_entry_t entries[STREAMS];
+static uint8_t storage[GATTC_STREAM_STORAGE(STREAMS, BUFFERS, BYTES)];
+static gattc_stream_t st;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static const uint8_t *bda(uint8_t device) {
+    static uint8_t addr[ADV_BDA_LEN] = { 0xC0, 0, 0, 0, 0, 0 };
+    addr[5] = device;
+    return addr;
+}
+
+static void init(gattc_stream_policy_t policy) {
+    gattc_stream_params_t params = {
+        .bytes = BYTES,
+        .buffers = BUFFERS,
+        .policy = policy,
+        .age_us = AGE_US,
+        .idle_us = IDLE_US,
+    };
+    CHECK(gattc_stream_init(&st, entries, STREAMS, storage, sizeof(storage), &params));
+}
+
+/*
+ * Notification seq of a connection, its sequence number first
+ * return: gattc_stream_put()
+ */
+static bool put(uint16_t conn_id, uint32_t seq, uint32_t now_us) {
+    uint8_t value[VALUE_LEN];
+    for (int i = 0; i < VALUE_LEN; i++) {
+        value[i] = i < 4 ? (uint8_t)(seq >> (8 * i)) : (uint8_t)(seq + i);
+    }
+    return gattc_stream_put(&st, conn_id, value, sizeof(value), now_us);
+}
+
+/*
+ * Take, check and release the next batch
+ * return: its notifications, -1 if none or invalid
+ */
+static int drain(gattc_stream_header_t *hdr) {
+    const uint8_t *batch, *value;
+    size_t len, pos;
+    uint16_t offset, value_len;
+    int stream = gattc_stream_take(&st, &batch, &len);
+    int n;
+
+    if (stream < 0) {
+        return -1;
+    }
+    n = adv_frame_decode_stream(batch, len, hdr);
+    CHECK(n == ADV_FRAME_STREAM_HEADER_LEN);
+    CHECK(memcmp(hdr->bda, gattc_stream_bda(&st, stream), ADV_BDA_LEN) == 0);
+    pos = n;
+    for (int i = 0; i < hdr->count; i++) {
+        n = adv_frame_decode_stream_record(batch + pos, len - pos, &offset, &value, &value_len);
+        CHECK(n == ADV_FRAME_STREAM_RECORD_LEN + VALUE_LEN && value_len == VALUE_LEN);
+        if (n < 0) {
+            break;
+        }
+        // Every 2^decimation notification from the first one
+        uint32_t seq = value[0] | value[1] << 8 | value[2] << 16 | (uint32_t)value[3] << 24;
+        CHECK(seq == hdr->seq + ((uint32_t)i << hdr->decimation));
+        pos += n;
+    }
+    CHECK(pos == len);
+    gattc_stream_release(&st, stream);
+    return hdr->count;
+}
+
+static void test_init(void) {
+    gattc_stream_params_t params = { .bytes = BYTES, .buffers = BUFFERS, .age_us = AGE_US };
+
+    CHECK(!gattc_stream_init(&st, entries, 0, storage, sizeof(storage), &params));
+    CHECK(!gattc_stream_init(&st, entries, STREAMS, storage, sizeof(storage) - 1, &params));
+    params.buffers = 1;
+    CHECK(!gattc_stream_init(&st, entries, STREAMS, storage, sizeof(storage), &params));
+    params.buffers = GATTC_STREAM_BUFFERS_MAX + 1;
+    CHECK(!gattc_stream_init(&st, entries, 1, storage, sizeof(storage), &params));
+    params.buffers = BUFFERS;
+    // A longest value must fit
+    params.bytes = ADV_FRAME_STREAM_HEADER_LEN + ADV_FRAME_STREAM_RECORD_LEN + GATTC_STREAM_VALUE_MAX - 1;
+    CHECK(!gattc_stream_init(&st, entries, 1, storage, sizeof(storage), &params));
+    params.bytes = BYTES;
+    params.age_us = GATTC_STREAM_AGE_MAX_US + 1;
+    CHECK(!gattc_stream_init(&st, entries, STREAMS, storage, sizeof(storage), &params));
+    init(GATTC_STREAM_DROP);
+    CHECK(gattc_stream_find(&st, 7) == -1);
+    CHECK(!put(7, 0, 0));
+}
+
+static void test_batch(void) {
+    gattc_stream_header_t hdr;
+    gattc_stream_stats_t stats;
+    int stream;
+
+    init(GATTC_STREAM_DROP);
+    stream = gattc_stream_open(&st, bda(1), 7, 0);
+    CHECK(stream == 0 && gattc_stream_find(&st, 7) == 0);
+    // Sealed once the next one does not fit
+    for (uint32_t i = 0; i < PER_BATCH; i++) {
+        CHECK(!put(7, i, 100 * i));
+    }
+    CHECK(drain(&hdr) == -1);
+    CHECK(put(7, PER_BATCH, 100 * PER_BATCH));
+    CHECK(drain(&hdr) == PER_BATCH);
+    CHECK(hdr.seq == 0 && hdr.time_us == 0 && hdr.decimation == 0);
+    CHECK(memcmp(hdr.bda, bda(1), ADV_BDA_LEN) == 0);
+
+    // Or after AGE_US
+    CHECK(!gattc_stream_poll(&st, 100 * PER_BATCH + AGE_US - 1));
+    CHECK(gattc_stream_poll(&st, 100 * PER_BATCH + AGE_US));
+    CHECK(drain(&hdr) == 1);
+    CHECK(hdr.seq == PER_BATCH && hdr.time_us == 100 * PER_BATCH);
+    // Also seen by the next notification
+    CHECK(!put(7, PER_BATCH + 1, 200000));
+    CHECK(put(7, PER_BATCH + 2, 200000 + AGE_US));
+    CHECK(drain(&hdr) == 1);
+
+    // Offsets in ticks from the first notification
+    const uint8_t *batch, *value;
+    size_t len;
+    uint16_t offset, value_len;
+    CHECK(!put(7, PER_BATCH + 3, 200000 + AGE_US + 250));
+    CHECK(gattc_stream_poll(&st, 200000 + 2 * AGE_US));
+    CHECK(gattc_stream_take(&st, &batch, &len) == stream);
+    int n = adv_frame_decode_stream(batch, len, &hdr);
+    CHECK(hdr.count == 2);
+    n += adv_frame_decode_stream_record(batch + n, len - n, &offset, &value, &value_len);
+    CHECK(offset == 0);
+    adv_frame_decode_stream_record(batch + n, len - n, &offset, &value, &value_len);
+    CHECK(offset == 250 / ADV_FRAME_STREAM_TICK_US);
+    gattc_stream_release(&st, stream);
+
+    gattc_stream_get_stats(&st, &stats);
+    CHECK(stats.opened == 1 && stats.received == PER_BATCH + 4 && stats.batched == PER_BATCH + 4);
+    CHECK(stats.sealed == 4 && stats.published == 4 && stats.dropped == 0);
+}
+
+static void test_drop(void) {
+    gattc_stream_header_t hdr;
+    gattc_stream_stats_t stats;
+    uint32_t seq;
+
+    init(GATTC_STREAM_DROP);
+    gattc_stream_open(&st, bda(1), 7, 0);
+    // Uplink down: every batch sealed, the next notifications dropped
+    for (seq = 0; seq < BUFFERS * PER_BATCH; seq++) {
+        put(7, seq, seq);
+    }
+    CHECK(put(7, seq, seq));
+    seq++;
+    CHECK(!put(7, seq, seq));
+    seq++;
+    gattc_stream_get_stats(&st, &stats);
+    CHECK(stats.sealed == BUFFERS && stats.dropped == 2);
+    CHECK(entries[0].decimation == 0);
+
+    // A batch out, room again
+    CHECK(drain(&hdr) == PER_BATCH && hdr.seq == 0);
+    CHECK(!put(7, seq, seq));
+    CHECK(drain(&hdr) == PER_BATCH && hdr.seq == PER_BATCH);
+    CHECK(drain(&hdr) == PER_BATCH && hdr.seq == 2 * PER_BATCH);
+    gattc_stream_poll(&st, seq + AGE_US);
+    // Gap in the sequence numbers: what was dropped
+    CHECK(drain(&hdr) == 1 && hdr.seq == BUFFERS * PER_BATCH + 2);
+    CHECK(drain(&hdr) == -1);
+}
+
+static void test_decimate(void) {
+    gattc_stream_header_t hdr;
+    gattc_stream_stats_t stats;
+    uint32_t seq;
+
+    init(GATTC_STREAM_DECIMATE);
+    gattc_stream_open(&st, bda(1), 7, 0);
+    for (seq = 0; seq <= PER_BATCH; seq++) {
+        put(7, seq, seq);
+    }
+    CHECK(entries[0].decimation == 0);
+    // Sealed while the previous batch waits: one in 2 kept from the next batch on
+    for (; seq <= 2 * PER_BATCH; seq++) {
+        put(7, seq, seq);
+    }
+    CHECK(entries[0].decimation == 1);
+    // Which also waits twice as long
+    CHECK(!gattc_stream_poll(&st, 2 * PER_BATCH + AGE_US));
+    CHECK(drain(&hdr) == PER_BATCH && hdr.decimation == 0 && hdr.seq == 0);
+    CHECK(drain(&hdr) == PER_BATCH && hdr.decimation == 0 && hdr.seq == PER_BATCH);
+
+    for (; seq <= 4 * PER_BATCH; seq++) {
+        put(7, seq, seq);
+    }
+    gattc_stream_get_stats(&st, &stats);
+    CHECK(stats.decimated == PER_BATCH && stats.dropped == 0);
+    // Sealed with nothing waiting: back down one step, from the next batch on
+    CHECK(entries[0].decimation == 0);
+    CHECK(drain(&hdr) == PER_BATCH && hdr.decimation == 1 && hdr.seq == 2 * PER_BATCH);
+    CHECK(gattc_stream_poll(&st, 4 * PER_BATCH + AGE_US));
+    CHECK(drain(&hdr) == 1 && hdr.decimation == 0 && hdr.seq == 4 * PER_BATCH);
+}
+
+static void test_close(void) {
+    gattc_stream_header_t hdr;
+
+    init(GATTC_STREAM_DROP);
+    CHECK(gattc_stream_open(&st, bda(1), 7, 0) == 0);
+    CHECK(gattc_stream_open(&st, bda(2), 8, 0) == 1);
+    CHECK(gattc_stream_open(&st, bda(3), 9, 0) == -1);
+    // Partial batch sealed, the stream lives until it is published
+    put(7, 0, 0);
+    gattc_stream_close(&st, 0);
+    CHECK(gattc_stream_find(&st, 7) == -1);
+    CHECK(!put(7, 1, 1));
+    CHECK(gattc_stream_open(&st, bda(3), 9, 0) == -1);
+    CHECK(drain(&hdr) == 1 && memcmp(hdr.bda, bda(1), ADV_BDA_LEN) == 0);
+    CHECK(gattc_stream_open(&st, bda(3), 9, 0) == 0);
+    // Nothing pending: free right away
+    gattc_stream_close(&st, 1);
+    CHECK(gattc_stream_open(&st, bda(4), 10, 0) == 1);
+}
+
+static void test_idle(void) {
+    init(GATTC_STREAM_DROP);
+    gattc_stream_open(&st, bda(1), 7, 0);
+    gattc_stream_open(&st, bda(2), 8, 0);
+    put(8, 0, IDLE_US);
+    // A notification stamped after now is recent
+    CHECK(gattc_stream_idle(&st, IDLE_US - 1) == -1);
+    CHECK(gattc_stream_idle(&st, IDLE_US) == 0);
+    CHECK(gattc_stream_idle(&st, IDLE_US) == -1);
+    // Reported again after another IDLE_US
+    CHECK(gattc_stream_idle(&st, 2 * IDLE_US) == 0);
+    CHECK(gattc_stream_idle(&st, 2 * IDLE_US) == 1);
+    // Closed streams are not
+    gattc_stream_close(&st, 0);
+    CHECK(gattc_stream_idle(&st, 4 * IDLE_US) == 1);
+    CHECK(gattc_stream_idle(&st, 4 * IDLE_US) == -1);
+}
+
+static void test_take(void) {
+    gattc_stream_header_t hdr;
+    const uint8_t *batch;
+    size_t len;
+
+    init(GATTC_STREAM_DROP);
+    gattc_stream_open(&st, bda(1), 7, 0);
+    gattc_stream_open(&st, bda(2), 8, 0);
+    // Two batches of the first stream, one of the second
+    for (uint32_t i = 0; i <= 2 * PER_BATCH; i++) {
+        put(7, i, i);
+    }
+    put(8, 0, 0);
+    gattc_stream_poll(&st, 2 * AGE_US);
+    // Streams take turns
+    CHECK(drain(&hdr) == PER_BATCH && hdr.bda[5] == 1);
+    CHECK(drain(&hdr) == 1 && hdr.bda[5] == 2);
+    CHECK(drain(&hdr) == PER_BATCH && hdr.bda[5] == 1);
+    CHECK(drain(&hdr) == 1 && hdr.bda[5] == 1);
+    // A taken batch is not taken again before its release
+    put(7, 2 * PER_BATCH + 1, 2 * AGE_US);
+    gattc_stream_poll(&st, 3 * AGE_US);
+    CHECK(gattc_stream_take(&st, &batch, &len) == 0);
+    CHECK(gattc_stream_take(&st, &batch, &len) == -1);
+    gattc_stream_release(&st, 0);
+    CHECK(gattc_stream_take(&st, &batch, &len) == -1);
+}
+
+static void test_frame(void) {
+    static const uint8_t value[] = { 1, 2, 3 };
+    gattc_stream_header_t hdr = {
+        .bda = { 1, 2, 3, 4, 5, 6 },
+        .decimation = 2,
+        .seq = 0x01020304,
+        .time_us = 0xA0B0C0D0,
+        .count = 1,
+    }, decoded;
+    uint8_t buf[ADV_FRAME_STREAM_HEADER_LEN + ADV_FRAME_STREAM_RECORD_LEN + sizeof(value)];
+    const uint8_t *got;
+    uint16_t offset, len;
+
+    memset(&decoded, 0, sizeof(decoded));
+    CHECK(adv_frame_encode_stream(&hdr, buf, ADV_FRAME_STREAM_HEADER_LEN - 1) == -1);
+    CHECK(adv_frame_encode_stream(&hdr, buf, sizeof(buf)) == ADV_FRAME_STREAM_HEADER_LEN);
+    CHECK(buf[0] == ADV_FRAME_VERSION_STREAM);
+    CHECK(adv_frame_encode_stream_record(7, value, sizeof(value), buf + ADV_FRAME_STREAM_HEADER_LEN,
+                                         sizeof(buf) - ADV_FRAME_STREAM_HEADER_LEN - 1) == -1);
+    CHECK(adv_frame_encode_stream_record(7, value, sizeof(value), buf + ADV_FRAME_STREAM_HEADER_LEN,
+                                         sizeof(buf) - ADV_FRAME_STREAM_HEADER_LEN) ==
+          ADV_FRAME_STREAM_RECORD_LEN + sizeof(value));
+    CHECK(adv_frame_decode_stream(buf, ADV_FRAME_STREAM_HEADER_LEN - 1, &decoded) == -1);
+    CHECK(adv_frame_decode_stream(buf, sizeof(buf), &decoded) == ADV_FRAME_STREAM_HEADER_LEN);
+    CHECK(memcmp(&decoded, &hdr, sizeof(hdr)) == 0);
+    CHECK(adv_frame_decode_stream_record(buf + ADV_FRAME_STREAM_HEADER_LEN,
+                                         sizeof(buf) - ADV_FRAME_STREAM_HEADER_LEN - 1, &offset, &got, &len) == -1);
+    CHECK(adv_frame_decode_stream_record(buf + ADV_FRAME_STREAM_HEADER_LEN, sizeof(buf) - ADV_FRAME_STREAM_HEADER_LEN,
+                                         &offset, &got, &len) == ADV_FRAME_STREAM_RECORD_LEN + sizeof(value));
+    CHECK(offset == 7 && len == sizeof(value) && memcmp(got, value, sizeof(value)) == 0);
+    buf[0] = ADV_FRAME_VERSION_STREAM + 1;
+    CHECK(adv_frame_decode_stream(buf, sizeof(buf), &decoded) == -1);
+}
+
+int main(void) {
+    test_init();
+    test_batch();
+    test_drop();
+    test_decimate();
+    test_close();
+    test_idle();
+    test_take();
+    test_frame();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All GATT notification stream tests passed\n");
+    return 0;
+}
@@ -0,0 +1,243 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "perf.h"
+#include "adv_json.h"
+#include "adv_frame.h"
+#include "mqtt.h"
+
+/*
+ * Unit tests of the stats subsystem, perf.h and its JSON and binary encoders
+ *   make -C host test
+ */
+
+#define THREADS         4
+#define THREAD_SAMPLES  100000
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static void test_bucket(void) {
+    CHECK(perf_bucket(0) == 0);
+    CHECK(perf_bucket(1) == 1);
+    CHECK(perf_bucket(2) == 2);
+    CHECK(perf_bucket(3) == 2);
+    CHECK(perf_bucket(4) == 3);
+    CHECK(perf_bucket(1023) == 10);
+    CHECK(perf_bucket(1024) == 11);
+    CHECK(perf_bucket(1u << 22) == PERF_HIST_BUCKETS - 1);
+    CHECK(perf_bucket(UINT32_MAX) == PERF_HIST_BUCKETS - 1);
+}
+
+static void test_snapshot(void) {
+    perf_snapshot_t snap;
+
+    perf_snapshot(&snap);
+    uint32_t results = snap.counters[PERF_SCAN_RESULTS];
+    perf_count(PERF_SCAN_RESULTS, 3);
+    perf_count(PERF_MQTT_BYTES, 100);
+    perf_record(PERF_HIST_PUBLISH, 5);
+    perf_record(PERF_HIST_PUBLISH, 700);
+    perf_record(PERF_HIST_GAP_CB, 0);
+
+    perf_snapshot(&snap);
+    CHECK(snap.counters[PERF_SCAN_RESULTS] == results + 3);
+    CHECK(snap.hists[PERF_HIST_PUBLISH].count == 2);
+    CHECK(snap.hists[PERF_HIST_PUBLISH].max_us == 700);
+    CHECK(snap.hists[PERF_HIST_PUBLISH].buckets[perf_bucket(5)] == 1);
+    CHECK(snap.hists[PERF_HIST_PUBLISH].buckets[perf_bucket(700)] == 1);
+    CHECK(snap.hists[PERF_HIST_GAP_CB].count == 1);
+    CHECK(snap.hists[PERF_HIST_GAP_CB].buckets[0] == 1);
+    CHECK(snap.hists[PERF_HIST_LATENCY].count == 0);
+
+    // Histograms start over, counters do not
+    perf_snapshot(&snap);
+    CHECK(snap.counters[PERF_SCAN_RESULTS] == results + 3);
+    for (int i = 0; i < PERF_HISTS; i++) {
+        uint32_t first;
+        CHECK(snap.hists[i].count == 0);
+        CHECK(snap.hists[i].max_us == 0);
+        CHECK(perf_hist_span(&snap.hists[i], &first) == 0);
+    }
+}
+
+static void test_percentile(void) {
+    perf_hist_t hist;
+    uint32_t first;
+
+    memset(&hist, 0, sizeof(hist));
+    CHECK(perf_percentile(&hist, 500) == 0);
+    for (int i = 0; i < 100; i++) {
+        hist.buckets[perf_bucket(10)]++;
+    }
+    hist.buckets[perf_bucket(1000)]++;
+    hist.count = 101;
+    hist.max_us = 1000;
+    // Bucket [8, 16) for 10 us, [512, 1024) for 1000 us, capped by the maximum
+    CHECK(perf_percentile(&hist, 500) == 15);
+    CHECK(perf_percentile(&hist, 990) == 15);
+    CHECK(perf_percentile(&hist, 1000) == 1000);
+    CHECK(perf_percentile(&hist, 1) == 15);
+    CHECK(perf_hist_span(&hist, &first) == perf_bucket(1000) - perf_bucket(10) + 1);
+    CHECK(first == perf_bucket(10));
+
+    // Open ended last bucket reports the maximum
+    memset(&hist, 0, sizeof(hist));
+    hist.buckets[PERF_HIST_BUCKETS - 1] = 1;
+    hist.count = 1;
+    hist.max_us = 30000000;
+    CHECK(perf_percentile(&hist, 500) == 30000000);
+}
+
+static void *count_thread(void *arg) {
+    for (uint32_t i = 0; i < THREAD_SAMPLES; i++) {
+        perf_count(PERF_MQTT_MESSAGES, 1);
+        perf_record(PERF_HIST_LATENCY, i & 0xFFF);
+    }
+    return NULL;
+}
+
+static void test_threads(void) {
+    pthread_t threads[THREADS];
+    perf_snapshot_t snap;
+
+    perf_snapshot(&snap);
+    uint32_t messages = snap.counters[PERF_MQTT_MESSAGES];
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, count_thread, NULL);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    perf_snapshot(&snap);
+    const perf_hist_t *hist = &snap.hists[PERF_HIST_LATENCY];
+    uint32_t total = 0;
+    for (int b = 0; b < PERF_HIST_BUCKETS; b++) {
+        total += hist->buckets[b];
+    }
+    CHECK(snap.counters[PERF_MQTT_MESSAGES] - messages == THREADS * THREAD_SAMPLES);
+    CHECK(hist->count == THREADS * THREAD_SAMPLES);
+    CHECK(total == THREADS * THREAD_SAMPLES);
+    CHECK(hist->max_us == 0xFFF);
+}
+
+/*
+ * Largest report: every field at its widest
+ */
+static void fill_worst_case(perf_snapshot_t *snap) {
+    memset(snap, 0, sizeof(*snap));
+    snap->uptime_s = UINT32_MAX;
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        snap->counters[i] = UINT32_MAX;
+    }
+    for (int i = 0; i < PERF_HISTS; i++) {
+        snap->hists[i].count = UINT32_MAX;
+        snap->hists[i].max_us = UINT32_MAX;
+        for (int b = 0; b < PERF_HIST_BUCKETS; b++) {
+            snap->hists[i].buckets[b] = UINT32_MAX;
+        }
+    }
+    snap->queue_depth = snap->queue_high_water = snap->queue_pushed = UINT32_MAX;
+    snap->queue_popped = snap->queue_dropped = snap->queue_coalesced = UINT32_MAX;
+    snap->heap_free = snap->heap_min_free = UINT32_MAX;
+    for (int i = 0; i < PERF_STACKS_MAX; i++) {
+        CHECK(perf_snapshot_stack(snap, "very_long_task_name", 65535));
+    }
+    CHECK(!perf_snapshot_stack(snap, "extra", 0));
+}
+
+static void test_json(void) {
+    static char json[ADV_JSON_PERF_MAX_LEN];
+    perf_snapshot_t snap;
+
+    memset(&snap, 0, sizeof(snap));
+    snap.uptime_s = 42;
+    snap.counters[PERF_SCAN_RESULTS] = 7;
+    snap.queue_high_water = 3;
+    snap.heap_min_free = 1000;
+    perf_snapshot_stack(&snap, "adv_publisher", 512);
+    snap.hists[PERF_HIST_PUBLISH].count = 2;
+    snap.hists[PERF_HIST_PUBLISH].max_us = 9;
+    snap.hists[PERF_HIST_PUBLISH].buckets[perf_bucket(2)] = 1;
+    snap.hists[PERF_HIST_PUBLISH].buckets[perf_bucket(9)] = 1;
+    int len = adv_json_encode_perf(&snap, "ESP1", true, json, sizeof(json));
+    CHECK(len > 0 && (size_t)len == strlen(json));
+    CHECK(strstr(json, "\"EspName\":\"ESP1\"") != NULL);
+    CHECK(strstr(json, "\"Uptime\":42") != NULL);
+    CHECK(strstr(json, "\"scan_results\":7") != NULL);
+    CHECK(strstr(json, "\"high_water\":3") != NULL);
+    CHECK(strstr(json, "\"min_free\":1000") != NULL);
+    CHECK(strstr(json, "\"adv_publisher\":512") != NULL);
+    CHECK(strstr(json, "\"publish\":{\"Count\":2,\"Max\":9,\"P50\":3,\"P99\":9,\"First\":2,\"Buckets\":[1,0,1]}") != NULL);
+    CHECK(strstr(json, "\"latency\":{\"Count\":0,\"Max\":0,\"P50\":0,\"P99\":0,\"First\":0,\"Buckets\":[]}") != NULL);
+    CHECK(adv_json_encode_perf(&snap, "ESP1", true, json, len) == -1);
+    len = adv_json_encode_perf(&snap, "ESP1", false, json, sizeof(json));
+    CHECK(len > 0 && strstr(json, "\"publish\":{\"Count\":2,\"Max\":9,\"P50\":3,\"P99\":9}") != NULL);
+    CHECK(strstr(json, "Buckets") == NULL);
+
+    fill_worst_case(&snap);
+    len = adv_json_encode_perf(&snap, "ESP32_Name_255", true, json, sizeof(json));
+    CHECK(len > 0 && len < ADV_JSON_PERF_MAX_LEN);
+    printf("Worst case JSON report %d of %d bytes\n", len, ADV_JSON_PERF_MAX_LEN);
+    // Summaries only, within an espmqtt message with a 63 byte topic
+    len = adv_json_encode_perf(&snap, "ESP32_Name_255", false, json, sizeof(json));
+    CHECK(len > 0 && len <= CONFIG_MQTT_BUFFER_SIZE_BYTE - 5 - 64);
+    printf("Worst case JSON summary %d of %d bytes\n", len, CONFIG_MQTT_BUFFER_SIZE_BYTE - 5 - 64);
+}
+
+static void test_frame(void) {
+    uint8_t frame[ADV_FRAME_PERF_MAX_LEN];
+    perf_snapshot_t snap, decoded;
+
+    fill_worst_case(&snap);
+    int len = adv_frame_encode_perf(&snap, frame, sizeof(frame));
+    CHECK(len > 0 && len <= ADV_FRAME_PERF_MAX_LEN);
+    printf("Worst case binary report %d of %d bytes\n", len, ADV_FRAME_PERF_MAX_LEN);
+    CHECK(adv_frame_decode_perf(frame, len, &decoded) == len);
+    CHECK(memcmp(&snap, &decoded, sizeof(snap)) == 0);
+    for (int n = 0; n < len; n++) {
+        CHECK(adv_frame_encode_perf(&snap, frame, n) == -1);
+    }
+
+    // Trimmed histograms
+    memset(&snap, 0, sizeof(snap));
+    snap.uptime_s = 60;
+    snap.counters[PERF_MQTT_LOST] = 2;
+    snap.hists[PERF_HIST_GAP_CB].count = 5;
+    snap.hists[PERF_HIST_GAP_CB].max_us = 40;
+    snap.hists[PERF_HIST_GAP_CB].buckets[5] = 4;
+    snap.hists[PERF_HIST_GAP_CB].buckets[6] = 1;
+    perf_snapshot_stack(&snap, "BTC_TASK", 1200);
+    len = adv_frame_encode_perf(&snap, frame, sizeof(frame));
+    CHECK(len == 6 + 4 * PERF_COUNTERS + 32 + 1 + 3 + 8 + 1 + PERF_HISTS * 10 + 2 * 4);
+    CHECK(adv_frame_decode_perf(frame, len, &decoded) == len);
+    CHECK(memcmp(&snap, &decoded, sizeof(snap)) == 0);
+    for (int n = 0; n < len; n++) {
+        CHECK(adv_frame_decode_perf(frame, n, &decoded) == -1);
+    }
+    frame[0] = ADV_FRAME_VERSION_PERF + 1;
+    CHECK(adv_frame_decode_perf(frame, len, &decoded) == -1);
+}
+
+int main(void) {
+    test_bucket();
+    test_snapshot();
+    test_percentile();
+    test_threads();
+    test_json();
+    test_frame();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All stats tests passed\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pool.h"
+
+/*
+ * Unit and stress tests of the block pool, pool.h
+ *   make -C host test
+ */
+
+#define BLOCKS          16
+#define THREADS         8
+#define ITERATIONS      200000
+#define HOLD_MAX        3           // Blocks held at once by each thread
+
+typedef struct {
+    uint32_t owner;
+    uint32_t seq;
+    uint8_t  payload[24];
+} block_t;
+
+static block_t blocks[BLOCKS];
+static uint32_t links[BLOCKS];
+static pool_t pool;
+static uint32_t corrupted = 0;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static void test_single(void) {
+    block_t *held[BLOCKS];
+    pool_stats_t stats;
+
+    CHECK(!pool_init(&pool, blocks, links, sizeof(block_t), 0));
+    CHECK(!pool_init(&pool, blocks, links, sizeof(block_t), POOL_BLOCKS_MAX + 1));
+    CHECK(pool_init(&pool, blocks, links, sizeof(block_t), BLOCKS));
+
+    for (int i = 0; i < BLOCKS; i++) {
+        held[i] = pool_alloc(&pool);
+        CHECK(held[i] != NULL);
+        for (int j = 0; j < i; j++) {
+            CHECK(held[i] != held[j]);
+        }
+    }
+    CHECK(pool_alloc(&pool) == NULL);
+    pool_get_stats(&pool, &stats);
+    CHECK(stats.in_use == BLOCKS);
+    CHECK(stats.high_water == BLOCKS);
+    CHECK(stats.exhausted == 1);
+
+    // Last freed, first reused
+    CHECK(pool_free(&pool, held[3]));
+    CHECK(pool_alloc(&pool) == held[3]);
+    for (int i = 0; i < BLOCKS; i++) {
+        CHECK(pool_free(&pool, held[i]));
+    }
+    CHECK(pool_free(&pool, NULL));
+    CHECK(!pool_free(&pool, held[0]));
+    CHECK(!pool_free(&pool, (uint8_t *)held[1] + 1));
+    CHECK(!pool_free(&pool, &blocks[BLOCKS]));
+    CHECK(!pool_free(&pool, &stats));
+    pool_get_stats(&pool, &stats);
+    CHECK(stats.in_use == 0);
+    CHECK(stats.invalid_frees == 4);
+}
+
+static void *stress_thread(void *arg) {
+    uint32_t id = (uint32_t)(uintptr_t)arg;
+    uint32_t rng = id * 2654435761u + 1;
+    block_t *held[HOLD_MAX];
+    int count = 0;
+
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        rng = rng * 1103515245 + 12345;
+        if (count < HOLD_MAX && (count == 0 || (rng >> 16) & 1)) {
+            block_t *block = pool_alloc(&pool);
+            if (block == NULL) {
+                sched_yield();
+                continue;
+            }
+            block->owner = id;
+            block->seq = i;
+            memset(block->payload, (int)id, sizeof(block->payload));
+            held[count++] = block;
+        } else {
+            block_t *block = held[--count];
+            // Nobody else may have written a held block
+            if (block->owner != id || block->payload[0] != (uint8_t)id ||
+                block->payload[sizeof(block->payload) - 1] != (uint8_t)id) {
+                __atomic_fetch_add(&corrupted, 1, __ATOMIC_RELAXED);
+            }
+            if (!pool_free(&pool, block)) {
+                __atomic_fetch_add(&corrupted, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if ((rng >> 20) % 64 == 0) {
+            sched_yield();
+        }
+    }
+    while (count) {
+        pool_free(&pool, held[--count]);
+    }
+    return NULL;
+}
+
+static void test_stress(void) {
+    pthread_t threads[THREADS];
+    block_t *held[BLOCKS];
+    pool_stats_t stats;
+
+    CHECK(pool_init(&pool, blocks, links, sizeof(block_t), BLOCKS));
+    for (int i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, stress_thread, (void *)(uintptr_t)(i + 1));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pool_get_stats(&pool, &stats);
+    printf("Pool stress: %d threads, %d iterations each, high water %u of %d, %u exhausted\n",
+           THREADS, ITERATIONS, stats.high_water, BLOCKS, stats.exhausted);
+    CHECK(corrupted == 0);
+    CHECK(stats.in_use == 0);
+    CHECK(stats.invalid_frees == 0);
+    CHECK(stats.high_water <= BLOCKS);
+
+    // Every block is back, exactly once
+    for (int i = 0; i < BLOCKS; i++) {
+        held[i] = pool_alloc(&pool);
+        CHECK(held[i] != NULL);
+        for (int j = 0; j < i; j++) {
+            CHECK(held[i] != held[j]);
+        }
+    }
+    CHECK(pool_alloc(&pool) == NULL);
+}
+
+int main(void) {
+    test_single();
+    test_stress();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All pool tests passed\n");
+    return 0;
+}
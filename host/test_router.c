@@ -0,0 +1,123 @@
+#include <string.h>
+#include <stdio.h>
+#include "topic_router.h"
+
+/*
+ * Unit tests of the MQTT topic router, topic_router.h
+ *   make -C host test
+ */
+
+#define NODES           32
+
+static topic_node_t nodes[NODES];
+static uint16_t edges[2 * NODES];
+static topic_router_t router;
+static unsigned int hits;               // Bit per route called
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static void route_hit(const char *topic, size_t topic_len, const char *data, size_t len, void *ctx) {
+    hits |= 1u << (uintptr_t)ctx;
+}
+
+#define ROUTE(filter, bit) { filter, route_hit, (void *)(bit) }
+
+static const topic_route_t routes[] = {
+    ROUTE("/tracker/scan", 0),
+    ROUTE("/tracker/scan/ESP_12", 1),
+    ROUTE("/tracker/scan/+", 2),
+    ROUTE("/tracker/#", 3),
+    ROUTE("/tracker/+/ESP_12", 4),
+    ROUTE("#", 5),
+    ROUTE("+/+/stats", 6),
+    ROUTE("$SYS/broker", 7),
+    ROUTE("sensors/+/temp", 8),
+};
+
+/*
+ * return: bits of the routes called for topic
+ */
+static unsigned int dispatch(const char *topic) {
+    hits = 0;
+    int called = topic_router_dispatch(&router, topic, strlen(topic), "", 0);
+    CHECK(called == __builtin_popcount(hits));
+    return hits;
+}
+
+#define BIT(n) (1u << (n))
+
+static void test_match(void) {
+    CHECK(topic_router_init(&router, routes, sizeof(routes) / sizeof(routes[0]), nodes, NODES, edges, 2 * NODES));
+
+    CHECK(dispatch("/tracker/scan") == (BIT(0) | BIT(3) | BIT(5)));
+    CHECK(dispatch("/tracker/scan/ESP_12") == (BIT(1) | BIT(2) | BIT(3) | BIT(4) | BIT(5)));
+    CHECK(dispatch("/tracker/scan/ESP_34") == (BIT(2) | BIT(3) | BIT(5)));
+    CHECK(dispatch("/tracker/fota/ESP_12") == (BIT(3) | BIT(4) | BIT(5)));
+    // '#' also matches its parent level
+    CHECK(dispatch("/tracker") == (BIT(3) | BIT(5)));
+    CHECK(dispatch("/tracker/scan/ESP_12/x") == (BIT(3) | BIT(5)));
+    CHECK(dispatch("/tracker/stats") == (BIT(3) | BIT(5) | BIT(6)));
+    // '+' matches an empty level
+    CHECK(dispatch("/tracker/scan/") == (BIT(2) | BIT(3) | BIT(5)));
+    CHECK(dispatch("sensors/kitchen/temp") == (BIT(5) | BIT(8)));
+    CHECK(dispatch("sensors/kitchen/humidity") == BIT(5));
+    CHECK(dispatch("sensors/temp") == BIT(5));
+    // Prefixes of a segment do not match
+    CHECK(dispatch("/tracker/sca") == (BIT(3) | BIT(5)));
+    CHECK(dispatch("/trackers") == BIT(5));
+    // No leading wildcard for '$' topics
+    CHECK(dispatch("$SYS/broker") == BIT(7));
+    CHECK(dispatch("$SYS/x/stats") == 0);
+
+    // The topic is matched in place, the bytes after topic_len are ignored
+    const char *topic = "/tracker/scan/ESP_12";
+    hits = 0;
+    CHECK(topic_router_dispatch(&router, topic, strlen("/tracker/scan"), "", 0) == 3);
+    CHECK(hits == (BIT(0) | BIT(3) | BIT(5)));
+    CHECK(topic_router_dispatch(&router, topic, 0, "", 0) == 0);
+}
+
+static void test_invalid(void) {
+    static const topic_route_t duplicate[] = { ROUTE("/a/+", 0), ROUTE("/a/b", 1), ROUTE("/a/+", 2) };
+    static const topic_route_t many[] = { ROUTE("/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17/18/19/20/21/22/23/24/25/26/27/28/29/30/31/32", 0) };
+
+    CHECK(topic_filter_valid("/tracker/+/x"));
+    CHECK(topic_filter_valid("+"));
+    CHECK(topic_filter_valid("#"));
+    CHECK(topic_filter_valid("/a/#"));
+    CHECK(!topic_filter_valid(""));
+    CHECK(!topic_filter_valid("/a/#/b"));
+    CHECK(!topic_filter_valid("/a#"));
+    CHECK(!topic_filter_valid("/a/b+"));
+    CHECK(!topic_filter_valid("/a/++/b"));
+    CHECK(!topic_filter_valid("/0/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16"));
+    CHECK(topic_filter_valid("0/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15"));
+
+    CHECK(!topic_router_init(&router, duplicate, 3, nodes, NODES, edges, 2 * NODES));
+    CHECK(topic_router_init(&router, duplicate, 2, nodes, NODES, edges, 2 * NODES));
+    // Out of nodes: root, "", "a", "+" and "b"
+    CHECK(!topic_router_init(&router, duplicate, 2, nodes, 4, edges, 16));
+    CHECK(topic_router_init(&router, duplicate, 2, nodes, 5, edges, 16));
+    CHECK(!topic_router_init(&router, many, 1, nodes, NODES, edges, 2 * NODES));
+    // Edges: power of 2, at least twice the nodes
+    CHECK(!topic_router_init(&router, duplicate, 2, nodes, 4, edges, 7));
+    CHECK(!topic_router_init(&router, duplicate, 2, nodes, 8, edges, 8));
+}
+
+int main(void) {
+    test_match();
+    test_invalid();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All router tests passed\n");
+    return 0;
+}
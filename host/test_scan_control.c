@@ -0,0 +1,271 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "scan_control.h"
+
+/*
+ * Closed loop simulation of the adaptive scan controller, scan_control.h:
+ * synthetic device density curves, adverts heard in proportion to the scan
+ * duty, and a publisher draining the advert queue at a fixed rate.
+ *   make -C host test
+ *   host/build/test_scan_control -v      per window trace
+ */
+
+#define WINDOW_MS       1000
+#define HEARD           0.9         // Adverts received while the radio listens, alone
+#define COLLISIONS      3000        // Devices halving the adverts received
+#define QUEUE_SIZE      512
+#define SETTLE          15          // Windows allowed to converge after a change
+#define SIGHTINGS       3
+
+typedef struct {
+    const char *name;
+    int         windows;
+    uint32_t    publish;            // Adverts drained per window
+    uint32_t  (*devices)(int w);
+    bool        overload;           // The publisher cannot keep up at the target
+    bool        slow;               // Density drifts, tracked rather than settled
+} scenario_t;
+
+static const scan_control_params_t params = {
+    .duty_min      = 20,
+    .duty_max      = 1000,
+    .sightings     = SIGHTINGS,
+    .queue_high    = 50,
+    .window_min    = 0x10,
+    .interval_max  = 0x800,
+    .period_max_ms = 120000,
+};
+
+static scan_control_t ctl;
+static uint32_t rng = 1;
+static bool verbose = false;
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+static double uniform(void) {
+    rng = rng * 1103515245 + 12345;
+    return ((rng >> 8) & 0xFFFFFF) / (double)0x1000000;
+}
+
+static uint32_t poisson(double mean) {
+    double l = exp(-mean), p = 1.0;
+    uint32_t k = 0;
+    do {
+        k++;
+        p *= uniform();
+    } while (p > l);
+    return k - 1;
+}
+
+/*
+ * Advertising interval of device d, 100 to 400 ms
+ */
+static uint32_t adv_ms(uint32_t d) {
+    return 100 * (1 + d * 2654435761u % 4);
+}
+
+static uint32_t quiet_then_some(int w) {
+    return w < 40 ? 0 : 20;
+}
+
+static uint32_t steps(int w) {
+    static const uint32_t levels[] = { 50, 800, 3000, 200, 50 };
+    return levels[w / 40];
+}
+
+static uint32_t day(int w) {
+    // One "day" over 200 windows
+    return (uint32_t)(1550 - 1500 * cos(2 * M_PI * w / 200));
+}
+
+static uint32_t crowd(int w) {
+    return w < 60 ? 3000 : 1000;
+}
+
+static const scenario_t scenarios[] = {
+    { "quiet",    80,  100000, quiet_then_some, false, false },
+    { "steps",    200, 100000, steps,           false, false },
+    { "day",      400, 100000, day,             false, true  },
+    { "overload", 120, 2000,   crowd,           true,  false },
+};
+
+static void run(const scenario_t *s) {
+    scan_config_t cfg = {
+        .mode = SCAN_MODE_CONTINUOUS, .interval = 0x50, .window = 0x30,
+        .period_ms = 30000, .duration_s = 3, .window_ms = WINDOW_MS,
+    };
+    uint16_t duty[512];
+    double sightings[512];
+    uint32_t queue = 0, dropped_total = 0, dropped_late = 0, changes = 0;
+    uint8_t bda[ADV_BDA_LEN] = { 0 };
+
+    scan_control_init(&ctl, &params, &cfg);
+    for (int w = 0; w < s->windows; w++) {
+        uint32_t n = s->devices(w);
+        duty[w] = scan_control_duty(&cfg);
+        // Crowds lose adverts to collisions
+        double heard_share = HEARD * duty[w] / SCAN_CONTROL_PERMILLE / (1.0 + (double)n / COLLISIONS);
+        uint32_t results = 0, heard = 0;
+
+        for (uint32_t d = 0; d < n; d++) {
+            uint32_t k = poisson(heard_share * WINDOW_MS / adv_ms(d));
+            memcpy(bda, &d, sizeof(d));
+            for (uint32_t i = 0; i < k; i++) {
+                scan_control_observe(&ctl, bda);
+            }
+            results += k;
+            heard += k > 0;
+        }
+
+        scan_control_obs_t obs = { 0 };
+        queue += results;
+        queue -= queue < s->publish ? queue : s->publish;
+        if (queue > QUEUE_SIZE) {
+            obs.dropped = queue - QUEUE_SIZE;
+            queue = QUEUE_SIZE;
+        }
+        obs.queue_depth = queue;
+        obs.queue_size = QUEUE_SIZE;
+        scan_control_window(&ctl, &obs);
+        CHECK(obs.scan_results == results);
+        // Linear counting within 5%
+        if (fabs((double)obs.devices - heard) > 2 + 0.05 * heard) {
+            fprintf(stderr, "%s %d: %u devices heard, %u estimated\n", s->name, w, heard, obs.devices);
+            failures++;
+        }
+
+        sightings[w] = heard ? (double)results / heard : 0;
+        dropped_total += obs.dropped;
+        if (w >= SETTLE && s->devices(w - SETTLE) == n) {
+            dropped_late += obs.dropped;
+        }
+        changes += scan_control_update(&ctl, &obs, &cfg);
+        CHECK(scan_config_valid(&cfg));
+        if (verbose) {
+            printf("%s,%d,%u,%u,%u,%.2f,%u,%u,%u,%u\n", s->name, w, n, duty[w], results, sightings[w],
+                   obs.devices, queue, obs.dropped, cfg.window);
+        }
+    }
+
+    // Settled phases, or all along a slow drift: at the target or at the bounds, and steady
+    int settled = 0, off = 0, wobbles = 0, flips = 0, dir = 0;
+    for (int w = SETTLE; w < s->windows; w++) {
+        bool steady = true;
+        for (int i = w - SETTLE; i < w && !s->slow; i++) {
+            steady &= s->devices(i) == s->devices(w);
+        }
+        if (!steady) {
+            dir = 0;
+            continue;
+        }
+        settled++;
+        // Direction changes of the duty
+        int step = (duty[w] > duty[w - 1]) - (duty[w] < duty[w - 1]);
+        if (step && dir && step != dir) {
+            flips++;
+        }
+        if (step) {
+            dir = step;
+        }
+        bool bound = duty[w] <= params.duty_min || duty[w] >= params.duty_max;
+        if (!s->overload && s->devices(w) && !bound &&
+            (sightings[w] < SIGHTINGS * 0.6 || sightings[w] > SIGHTINGS * 1.6)) {
+            off++;
+        }
+        if (w + 1 < s->windows && duty[w + 1] != duty[w]) {
+            wobbles++;
+        }
+    }
+    printf("Scan control %-8s %3d windows, duty %4u..%4u, %3u changes, %2d reversals settled, %3d of %3d "
+           "settled windows off target, %u dropped, %u after settling\n", s->name, s->windows,
+           params.duty_min, params.duty_max, changes, flips, off, settled, dropped_total, dropped_late);
+
+    CHECK(off <= settled / 20);
+    // Settled windows leave the parameters alone, a probe every so often at most.
+    // A drift is followed in steps, up then down.
+    CHECK(wobbles <= settled / (s->slow ? 4 : 10));
+    CHECK(flips <= 3);
+    if (s->overload) {
+        CHECK(dropped_late <= dropped_total / 10);
+    }
+    if (s->devices(s->windows - 1) == 0) {
+        CHECK(duty[s->windows - 1] == params.duty_min);
+    }
+}
+
+static void test_quiet_decay(void) {
+    scan_config_t cfg = {
+        .mode = SCAN_MODE_CONTINUOUS, .interval = 0x50, .window = 0x30,
+        .period_ms = 30000, .duration_s = 3, .window_ms = WINDOW_MS,
+    };
+    scan_control_obs_t obs = { .queue_size = QUEUE_SIZE };
+
+    scan_control_init(&ctl, &params, &cfg);
+    CHECK(ctl.duty == 600);
+    for (int w = 0; w < 40; w++) {
+        scan_control_window(&ctl, &obs);
+        scan_control_update(&ctl, &obs, &cfg);
+    }
+    // Down to duty_min, with windows no shorter than window_min
+    CHECK(ctl.duty == params.duty_min);
+    CHECK(cfg.window >= params.window_min);
+    CHECK(cfg.interval <= params.interval_max);
+    CHECK(abs((int)scan_control_duty(&cfg) - params.duty_min) <= 2);
+}
+
+static void test_duty_cycle_mode(void) {
+    scan_control_params_t low = params;
+    scan_config_t cfg = {
+        .mode = SCAN_MODE_DUTY_CYCLE, .interval = 0x50, .window = 0x30,
+        .period_ms = 30000, .duration_s = 3, .window_ms = WINDOW_MS,
+    };
+    scan_control_obs_t obs = { .queue_size = QUEUE_SIZE };
+
+    low.duty_min = 5;
+    scan_control_init(&ctl, &low, &cfg);
+    CHECK(ctl.duty == 60);
+    // Too few sightings: scans come closer first, the radio duty stays
+    obs.devices = 100;
+    obs.scan_results = 100;
+    CHECK(scan_control_update(&ctl, &obs, &cfg));
+    CHECK(cfg.window == 0x30 && cfg.interval == 0x50);
+    CHECK(cfg.period_ms < 30000 && cfg.period_ms >= 3000);
+    CHECK(scan_config_valid(&cfg));
+    // Nobody: scans spread out up to period_max_ms, then shorter windows
+    obs.devices = 0;
+    obs.scan_results = 0;
+    for (int w = 0; w < 40; w++) {
+        scan_control_update(&ctl, &obs, &cfg);
+    }
+    CHECK(ctl.duty == low.duty_min);
+    CHECK(cfg.period_ms == low.period_max_ms);
+    CHECK(cfg.window == 0x10);
+    CHECK(scan_config_valid(&cfg));
+}
+
+int main(int argc, char *argv[]) {
+    verbose = argc > 1 && !strcmp(argv[1], "-v");
+    if (verbose) {
+        printf("scenario,window,devices,duty,results,sightings,estimate,queue,dropped,hci_window\n");
+    }
+    test_quiet_decay();
+    test_duty_cycle_mode();
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        run(&scenarios[i]);
+    }
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All scan control tests passed\n");
+    return 0;
+}
@@ -0,0 +1,353 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sdkconfig.h"
+#include "time_sync.h"
+#include "adv_json.h"
+#include "adv_frame.h"
+
+/*
+ * Unit tests of the fleet time estimator, time_sync.h, and its accuracy
+ * against simulated network jitter, then the largest adverts with their
+ * fleet time in the message buffer of the unbatched publisher
+ *   make -C host test
+ */
+
+#define FLEET_EPOCH_US  1700000000000000ll  // Fleet time at local time 0
+#define SERVER_US       50                  // Request received to response sent
+#define STEP_US         100000              // Sampled error, local time step
+
+static time_sync_t ts;
+static const time_sync_params_t params = {
+    .period_us = 16000000,
+    .burst_us = 1000000,
+    .timeout_us = 1000000,
+    .drift_span_us = 30000000,
+    .drift_max_ppb = 200000,
+    .samples = 16,
+    .best = 6,
+};
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+/*
+ * Simulated fleet clock, network and tracker
+ */
+typedef struct {
+    int32_t  drift_ppb;             // Fleet clock rate against the local one
+    int64_t  step_us;               // Fleet clock step, from step_at_us
+    int64_t  step_at_us;
+    uint32_t delay_us;              // Each way, shortest
+    uint32_t jitter_us;             // Mean of the exponential jitter of each way
+    uint32_t spikes;                // Percent of the ways with a 10x jitter spike
+} sim_t;
+
+static uint64_t rng_state = 1;
+
+static double rng_uniform(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return ((rng_state >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static int64_t sim_fleet(const sim_t *sim, int64_t local_us) {
+    int64_t fleet = FLEET_EPOCH_US + local_us + local_us * sim->drift_ppb / 1000000000;
+    return local_us >= sim->step_at_us ? fleet + sim->step_us : fleet;
+}
+
+static int64_t sim_way(const sim_t *sim) {
+    double jitter = -log(rng_uniform()) * sim->jitter_us;
+    if (rng_uniform() * 100 < sim->spikes) {
+        jitter *= 10;
+    }
+    return sim->delay_us + (int64_t)jitter;
+}
+
+/*
+ * Run the exchanges due until until_us, requests polled every 10 ms as by the
+ * publisher task
+ * naive: offset of the latest exchange, the estimate without filtering
+ */
+static void sim_run(const sim_t *sim, int64_t *now_us, int64_t until_us, int64_t *naive) {
+    char request[TIME_SYNC_REQUEST_MAX];
+
+    for (; *now_us < until_us; *now_us += 10000) {
+        int64_t t1 = *now_us;
+        if (time_sync_request(&ts, "tracker", t1, request, sizeof(request)) <= 0) {
+            continue;
+        }
+        int64_t arrival = t1 + sim_way(sim);
+        int64_t t2 = sim_fleet(sim, arrival);
+        int64_t t3 = t2 + SERVER_US;
+        int64_t t4 = arrival + SERVER_US + sim_way(sim);
+        if (naive) {
+            *naive = ((t2 - t1) + (t3 - t4)) / 2;
+        }
+        time_sync_response(&ts, (uint64_t)t1, t2, t3, t4);
+    }
+}
+
+static void test_init(void) {
+    time_sync_params_t p = params;
+
+    CHECK(time_sync_init(&ts, &p));
+    p.samples = 1;
+    CHECK(!time_sync_init(&ts, &p));
+    p.samples = TIME_SYNC_SAMPLES_MAX + 1;
+    CHECK(!time_sync_init(&ts, &p));
+    p = params;
+    p.best = p.samples + 1;
+    CHECK(!time_sync_init(&ts, &p));
+    p.best = 0;
+    CHECK(!time_sync_init(&ts, &p));
+}
+
+static void test_protocol(void) {
+    char request[TIME_SYNC_REQUEST_MAX];
+    time_sync_stats_t stats;
+    uint64_t id;
+    int64_t t2, t3, fleet;
+
+    time_sync_init(&ts, &params);
+    CHECK(time_sync_request(&ts, "tracker", 5000000, request, sizeof(request)) == 15);
+    CHECK(strcmp(request, "tracker 5000000") == 0);
+    // Pending
+    CHECK(time_sync_request(&ts, "tracker", 5500000, request, sizeof(request)) == 0);
+    // Timed out, a burst period after the previous one
+    CHECK(time_sync_request(&ts, "tracker", 6000000, request, sizeof(request)) > 0);
+    CHECK(time_sync_request(&ts, "tracker", 6000000, request, 8) == 0);
+
+    CHECK(time_sync_parse("6000000 1700000000000000 1700000000000050", 41, &id, &t2, &t3));
+    CHECK(id == 6000000 && t2 == 1700000000000000ll && t3 == 1700000000000050ll);
+    CHECK(time_sync_parse("1 2 3\r\n", 7, &id, &t2, &t3));
+    CHECK(time_sync_parse("1 2 34", 5, &id, &t2, &t3) && t3 == 3);
+    CHECK(!time_sync_parse("1 2", 3, &id, &t2, &t3));
+    CHECK(!time_sync_parse("1 2 3 4", 7, &id, &t2, &t3));
+    CHECK(!time_sync_parse("1 -2 3", 6, &id, &t2, &t3));
+    CHECK(!time_sync_parse("1 2 99999999999999999999", 24, &id, &t2, &t3));
+    CHECK(!time_sync_parse("", 0, &id, &t2, &t3));
+
+    // The first request, replaced
+    CHECK(!time_sync_response(&ts, 5000000, FLEET_EPOCH_US, FLEET_EPOCH_US, 6010000));
+    // Round trip too long, then negative
+    CHECK(!time_sync_response(&ts, 6000000, FLEET_EPOCH_US, FLEET_EPOCH_US, 7000001));
+    time_sync_request(&ts, "tracker", 7000001, request, sizeof(request));
+    CHECK(!time_sync_response(&ts, 7000001, FLEET_EPOCH_US + 1000, FLEET_EPOCH_US, 7000002));
+    // Answered twice
+    time_sync_request(&ts, "tracker", 8000001, request, sizeof(request));
+    CHECK(time_sync_response(&ts, 8000001, FLEET_EPOCH_US, FLEET_EPOCH_US, 8000003));
+    CHECK(!time_sync_response(&ts, 8000001, FLEET_EPOCH_US, FLEET_EPOCH_US, 8000003));
+    CHECK(!time_sync_fleet(&ts, 8000002, &fleet, NULL));
+
+    time_sync_get_stats(&ts, &stats);
+    CHECK(stats.requests == 4 && stats.responses == 3 && stats.stale == 2 && stats.rejected == 2);
+}
+
+static void test_exact(void) {
+    sim_t sim = { .delay_us = 5000, .step_at_us = INT64_MAX };
+    int64_t now_us = 0;
+    int64_t fleet;
+    uint32_t error_us;
+
+    time_sync_init(&ts, &params);
+    sim_run(&sim, &now_us, (params.best - 1) * (int64_t)params.burst_us, NULL);
+    CHECK(!time_sync_fleet(&ts, now_us, &fleet, NULL));
+    sim_run(&sim, &now_us, params.best * (int64_t)params.burst_us, NULL);
+    CHECK(time_sync_fleet(&ts, now_us, &fleet, &error_us));
+    CHECK(llabs(fleet - sim_fleet(&sim, now_us)) <= 1);
+    CHECK(error_us == 5000);
+    // Burst until the window is full, at 15 s, then a period after the last one
+    sim_run(&sim, &now_us, 60000000, NULL);
+    CHECK(ts.count == params.samples);
+    CHECK(ts.stats.requests == params.samples + 2);
+}
+
+static void test_drift(void) {
+    sim_t sim = { .drift_ppb = 40000, .delay_us = 2000, .jitter_us = 500, .step_at_us = INT64_MAX };
+    int64_t now_us = 0;
+    int64_t fleet;
+    time_sync_stats_t stats;
+
+    time_sync_init(&ts, &params);
+    sim_run(&sim, &now_us, 600000000, NULL);
+    time_sync_get_stats(&ts, &stats);
+    CHECK(abs(stats.drift_ppb - sim.drift_ppb) < 2000);
+    // Between two exchanges
+    for (int64_t t = now_us; t < now_us + params.period_us; t += STEP_US) {
+        CHECK(time_sync_fleet(&ts, t, &fleet, NULL));
+        CHECK(llabs(fleet - sim_fleet(&sim, t)) < 500);
+    }
+    CHECK(stats.steps == 0);
+}
+
+static void test_step(void) {
+    sim_t sim = { .delay_us = 2000, .jitter_us = 500, .step_at_us = 300000000, .step_us = 2000000 };
+    int64_t now_us = 0;
+    int64_t fleet;
+    time_sync_stats_t stats;
+
+    time_sync_init(&ts, &params);
+    sim_run(&sim, &now_us, sim.step_at_us, NULL);
+    // Off the line, the mapping is kept until the step is certain
+    sim_run(&sim, &now_us, sim.step_at_us + (TIME_SYNC_STEPS - 1) * (int64_t)params.period_us, NULL);
+    CHECK(time_sync_fleet(&ts, now_us, &fleet, NULL));
+    CHECK(llabs(fleet - sim_fleet(&sim, now_us) + sim.step_us) < 2000);
+    time_sync_get_stats(&ts, &stats);
+    CHECK(stats.steps == 0 && stats.rejected == TIME_SYNC_STEPS - 1);
+    // Then the window restarts, in a burst
+    sim_run(&sim, &now_us, now_us + params.period_us + params.best * params.burst_us, NULL);
+    time_sync_get_stats(&ts, &stats);
+    CHECK(stats.steps == 1);
+    CHECK(time_sync_fleet(&ts, now_us, &fleet, NULL));
+    CHECK(llabs(fleet - sim_fleet(&sim, now_us)) < 2000);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Mapping error over one hour, sampled every STEP_US after the first ten
+ * minutes, against the offset of the latest exchange alone
+ * return: 99th percentile of the error, us
+ */
+static uint32_t accuracy(const sim_t *sim) {
+    static uint32_t errors[3000 * 1000000ll / STEP_US];
+    int64_t now_us = 0, naive = 0, fleet;
+    uint32_t error_us, n = 0, inside = 0;
+    double sum = 0, naive_sum = 0;
+
+    rng_state = 1;
+    time_sync_init(&ts, &params);
+    sim_run(sim, &now_us, 600000000, &naive);
+    while (now_us < 3600000000ll) {
+        int64_t until_us = now_us + STEP_US;
+        sim_run(sim, &now_us, until_us, &naive);
+        if (!time_sync_fleet(&ts, now_us, &fleet, &error_us)) {
+            continue;
+        }
+        int64_t truth = sim_fleet(sim, now_us);
+        uint32_t e = (uint32_t)llabs(fleet - truth);
+        errors[n++] = e;
+        sum += e;
+        naive_sum += llabs(now_us + naive - truth);
+        inside += e <= error_us;
+    }
+    qsort(errors, n, sizeof(errors[0]), cmp_u32);
+    printf("  jitter %6u us%s: error mean %6.0f p99 %6u max %6u us, %5.1f%% within estimate, latest exchange alone %6.0f us\n",
+           sim->jitter_us, sim->spikes ? " + spikes" : "        ", sum / n, errors[n * 99 / 100], errors[n - 1],
+           100.0 * inside / n, naive_sum / n);
+    CHECK(inside == n);
+    return errors[n * 99 / 100];
+}
+
+static void test_jitter(void) {
+    sim_t sim = { .drift_ppb = -25000, .delay_us = 3000, .step_at_us = INT64_MAX };
+    time_sync_stats_t stats;
+
+    printf("Fleet time error, %u us each way plus an exponential jitter, %d of %d exchanges fitted:\n",
+           sim.delay_us, params.best, params.samples);
+    sim.jitter_us = 500;
+    CHECK(accuracy(&sim) < 500);
+    sim.jitter_us = 2000;
+    CHECK(accuracy(&sim) < 2000);
+    sim.jitter_us = 10000;
+    CHECK(accuracy(&sim) < 10000);
+    sim.spikes = 10;
+    CHECK(accuracy(&sim) < 10000);
+    sim.jitter_us = 50000;
+    sim.spikes = 0;
+    CHECK(accuracy(&sim) < 50000);
+    time_sync_get_stats(&ts, &stats);
+    CHECK(stats.steps == 0);
+}
+
+/*
+ * Eddystone URL or AltBeacon with TX power, and a name of control characters
+ * in the scan response, every one escaped
+ */
+static void largest_advert(adv_record_t *rec, bool url) {
+    static const uint8_t altbeacon[] = {
+        27, ADV_TYPE_MANUFACTURER, 0xFF, 0xFF, 0xBE, 0xAC,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x80, 0xFF,
+        2, ADV_TYPE_TX_POWER, 0x80,
+    };
+    uint8_t *p = rec->data;
+
+    memset(rec, 0, sizeof(*rec));
+    memset(rec->bda, 0xFF, sizeof(rec->bda));
+    rec->rssi = -128;
+    rec->dev_type = 0xFF;
+    if (url) {
+        // Scheme and 24 URL bytes of the longest expansion
+        *p++ = 30;
+        *p++ = ADV_TYPE_SERVICE_DATA16;
+        *p++ = 0xAA;
+        *p++ = 0xFE;
+        *p++ = 0x10;
+        *p++ = 0x80;
+        *p++ = 0x01;
+        memset(p, 0x04, 24);
+        p += 24;
+    } else {
+        memcpy(p, altbeacon, sizeof(altbeacon));
+        p += sizeof(altbeacon);
+    }
+    rec->adv_data_len = (uint8_t)(p - rec->data);
+    *p++ = 30;
+    *p++ = ADV_TYPE_NAME_CMPL;
+    memset(p, 0x01, 29);
+    p += 29;
+    rec->scan_rsp_len = (uint8_t)(p - rec->data - rec->adv_data_len);
+}
+
+static void test_timed_advert(void) {
+    const adv_stats_t stats = { 0xFFFF, -128, -128, -128, UINT32_MAX, UINT32_MAX };
+    char json[ADV_JSON_MAX_LEN + ADV_JSON_TIMED_LEN + 1];
+    uint8_t frame[ADV_FRAME_TIMED_LEN + ADV_FRAME_MAX_LEN];
+    adv_record_t rec;
+
+    for (int url = 0; url < 2; url++) {
+        largest_advert(&rec, url);
+        CHECK(rec.adv_data_len + rec.scan_rsp_len == ADV_RECORD_DATA_MAX);
+
+        // Within ADV_JSON_MAX_LEN without the time, the unbatched buffer with it
+        int len = adv_json_encode(&rec, &stats, CONFIG_ESP_NAME, json, ADV_JSON_MAX_LEN);
+        CHECK(len > 0);
+        len = adv_json_encode(&rec, &stats, CONFIG_ESP_NAME, json, ADV_JSON_MAX_LEN + ADV_JSON_TIMED_LEN);
+        len = adv_json_encode_timed(-1, UINT32_MAX, json, len, ADV_JSON_MAX_LEN + ADV_JSON_TIMED_LEN);
+        CHECK(len > 0 && json[len - 1] == '}');
+        CHECK(strstr(json, "\"FleetTime\":18446744073709551615,\"FleetTimeError\":4294967295}") != NULL);
+
+        int header = adv_frame_encode_timed(INT64_MAX, UINT32_MAX, frame, sizeof(frame));
+        CHECK(header == ADV_FRAME_TIMED_LEN);
+        CHECK(adv_frame_encode(&rec, &stats, &frame[header], sizeof(frame) - header) == ADV_FRAME_MAX_LEN);
+    }
+}
+
+int main(void) {
+    test_init();
+    test_protocol();
+    test_exact();
+    test_drift();
+    test_step();
+    test_jitter();
+    test_timed_advert();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All fleet time tests passed\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <string.h>
+#include "adv_batch.h"
+
+
+void adv_batch_init(adv_batch_t *batch, uint8_t *buf, size_t size,
+                    uint16_t max_records, uint32_t max_age_ms, bool json,
+                    adv_batch_send_t send, void *send_ctx) {
+    memset(batch, 0, sizeof(*batch));
+    batch->buf = buf;
+    batch->size = size;
+    batch->max_records = max_records ? max_records : 1;
+    batch->max_age_ms = max_age_ms;
+    batch->prefix = json ? "[" : "";
+    batch->separator = json ? "," : "";
+    batch->suffix = json ? "]" : "";
+    batch->send = send;
+    batch->send_ctx = send_ctx;
+}
+
+/*
+ * Framing written in front of the next record
+ */
+static inline const char *adv_batch_lead(const adv_batch_t *batch) {
+    return batch->records ? batch->separator : batch->prefix;
+}
+
+uint8_t *adv_batch_reserve(adv_batch_t *batch, size_t *room) {
+    size_t offset = batch->len + strlen(adv_batch_lead(batch));
+    size_t reserved = offset + strlen(batch->suffix);
+    *room = (reserved < batch->size) ? batch->size - reserved : 0;
+    return &batch->buf[offset];
+}
+
+void adv_batch_commit(adv_batch_t *batch, size_t len, uint32_t now_ms) {
+    const char *lead = adv_batch_lead(batch);
+    size_t lead_len = strlen(lead);
+
+    memcpy(&batch->buf[batch->len], lead, lead_len);
+    batch->len += lead_len + len;
+    if (batch->records++ == 0) {
+        batch->opened_ms = now_ms;
+    }
+    if (batch->records >= batch->max_records) {
+        adv_batch_flush(batch, ADV_BATCH_FLUSH_RECORDS);
+    }
+}
+
+void adv_batch_flush(adv_batch_t *batch, adv_batch_reason_t reason) {
+    if (batch->records == 0) {
+        return;
+    }
+    size_t suffix_len = strlen(batch->suffix);
+    memcpy(&batch->buf[batch->len], batch->suffix, suffix_len);
+    batch->len += suffix_len;
+
+    batch->send(batch->buf, batch->len, batch->send_ctx);
+
+    adv_batch_stats_t *stats = &batch->stats;
+    uint32_t bucket = (uint32_t)(batch->len * ADV_BATCH_FILL_BUCKETS / (batch->size + 1));
+    stats->messages++;
+    stats->records += batch->records;
+    stats->bytes += batch->len;
+    stats->reasons[reason]++;
+    stats->fill[bucket]++;
+
+    batch->len = 0;
+    batch->records = 0;
+}
+
+void adv_batch_poll(adv_batch_t *batch, uint32_t now_ms) {
+    if (batch->records && now_ms - batch->opened_ms >= batch->max_age_ms) {
+        adv_batch_flush(batch, ADV_BATCH_FLUSH_DEADLINE);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef __ADV_BATCH_H__
+#define __ADV_BATCH_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ADV_BATCH_FILL_BUCKETS 10   // Fill histogram, 10% of the byte budget each
+
+/*
+ * Why a batch has been sent
+ */
+typedef enum {
+    ADV_BATCH_FLUSH_BYTES = 0,      // Next record did not fit
+    ADV_BATCH_FLUSH_RECORDS,        // Record count reached
+    ADV_BATCH_FLUSH_DEADLINE,       // Oldest record too old
+    ADV_BATCH_FLUSH_CYCLE,          // End of scan cycle
+    ADV_BATCH_FLUSH_REASONS
+} adv_batch_reason_t;
+
+typedef struct {
+    uint32_t messages;
+    uint32_t records;
+    uint32_t bytes;
+    uint32_t reasons[ADV_BATCH_FLUSH_REASONS];
+    uint32_t fill[ADV_BATCH_FILL_BUCKETS];
+} adv_batch_stats_t;
+
+/*
+ * Called with a complete message
+ */
+typedef void (*adv_batch_send_t)(const uint8_t *data, size_t len, void *ctx);
+
+/*
+ * Packs encoded records into one message until the byte budget, the record count
+ * or the deadline is reached. Records are encoded in place, no copy.
+ * JSON records are sent as an array, binary frames are simply concatenated.
+ */
+typedef struct {
+    uint8_t           *buf;
+    size_t             size;        // Byte budget
+    size_t             len;
+    uint16_t           records;
+    uint16_t           max_records;
+    uint32_t           max_age_ms;
+    uint32_t           opened_ms;   // Time of the first record
+    const char        *prefix;      // Framing, "" for none
+    const char        *separator;
+    const char        *suffix;
+    adv_batch_send_t   send;
+    void              *send_ctx;
+    adv_batch_stats_t  stats;
+} adv_batch_t;
+
+/*
+ * buf, size: message buffer, its size is the byte budget
+ * json: frame records as a JSON array
+ */
+void adv_batch_init(adv_batch_t *batch, uint8_t *buf, size_t size,
+                    uint16_t max_records, uint32_t max_age_ms, bool json,
+                    adv_batch_send_t send, void *send_ctx);
+
+/*
+ * Room to encode the next record
+ * room: available bytes at the returned address
+ */
+uint8_t *adv_batch_reserve(adv_batch_t *batch, size_t *room);
+
+/*
+ * Account a record of len bytes encoded at adv_batch_reserve(), sends the batch
+ * if the record count is reached
+ */
+void adv_batch_commit(adv_batch_t *batch, size_t len, uint32_t now_ms);
+
+/*
+ * Send pending records, if any
+ */
+void adv_batch_flush(adv_batch_t *batch, adv_batch_reason_t reason);
+
+/*
+ * Send pending records if the oldest one has waited max_age_ms
+ */
+void adv_batch_poll(adv_batch_t *batch, uint32_t now_ms);
+
+static inline bool adv_batch_empty(const adv_batch_t *batch) {
+    return batch->records == 0;
+}
+
+#endif
@@ -0,0 +1,243 @@
+#include <string.h>
+#include "adv_capture.h"
+
+
+// Constants
+#define PAD_ZERO        0x00
+#define PAD_ERASED      0xFF
+
+
+static inline void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int adv_capture_encode_sync(uint32_t dropped, uint8_t *out, size_t size) {
+    if (size < ADV_CAPTURE_SYNC_LEN) {
+        return -1;
+    }
+    out[0] = ADV_CAPTURE_SYNC_LEN - 1;
+    out[1] = ADV_CAPTURE_SYNC;
+    put_le32(&out[2], ADV_CAPTURE_MAGIC);
+    out[6] = ADV_CAPTURE_VERSION;
+    put_le32(&out[7], dropped);
+    return ADV_CAPTURE_SYNC_LEN;
+}
+
+int adv_capture_encode(const adv_record_t *rec, uint8_t *out, size_t size) {
+    size_t data_len = (size_t)rec->adv_data_len + rec->scan_rsp_len;
+    if (data_len > ADV_RECORD_DATA_MAX || size < ADV_CAPTURE_ADVERT_HDR_LEN + data_len) {
+        return -1;
+    }
+    out[0] = (uint8_t)(ADV_CAPTURE_ADVERT_HDR_LEN - 1 + data_len);
+    out[1] = ADV_CAPTURE_ADVERT;
+    put_le32(&out[2], rec->time_ms);
+    memcpy(&out[6], rec->bda, ADV_BDA_LEN);
+    out[12] = (uint8_t)rec->rssi;
+    out[13] = rec->dev_type;
+    out[14] = rec->adv_data_len;
+    out[15] = rec->scan_rsp_len;
+    memcpy(&out[ADV_CAPTURE_ADVERT_HDR_LEN], rec->data, data_len);
+    return (int)(ADV_CAPTURE_ADVERT_HDR_LEN + data_len);
+}
+
+void adv_capture_reader_init(adv_capture_reader_t *reader, const uint8_t *data, size_t len) {
+    memset(reader, 0, sizeof(*reader));
+    reader->data = data;
+    reader->len = len;
+}
+
+static bool adv_capture_is_sync(const uint8_t *p, size_t avail) {
+    return avail >= ADV_CAPTURE_SYNC_LEN && p[0] == ADV_CAPTURE_SYNC_LEN - 1 && p[1] == ADV_CAPTURE_SYNC &&
+           get_le32(&p[2]) == ADV_CAPTURE_MAGIC;
+}
+
+/*
+ * Account the queue drops of a sync record, the counter restarts at each boot
+ */
+static void adv_capture_sync(adv_capture_reader_t *reader, const uint8_t *p) {
+    uint32_t dropped = get_le32(&p[7]);
+    if (reader->has_dropped && dropped >= reader->dropped) {
+        reader->stats.lost += dropped - reader->dropped;
+    } else {
+        reader->stats.lost += dropped;
+    }
+    reader->dropped = dropped;
+    reader->has_dropped = true;
+    reader->synced = true;
+    reader->stats.syncs++;
+}
+
+/*
+ * Damaged record, look for the next sync record from the following byte
+ */
+static void adv_capture_resync(adv_capture_reader_t *reader) {
+    reader->synced = false;
+    reader->stats.corrupted++;
+    reader->stats.skipped++;
+    reader->pos++;
+}
+
+bool adv_capture_next(adv_capture_reader_t *reader, adv_record_t *rec) {
+    while (reader->pos < reader->len) {
+        const uint8_t *p = &reader->data[reader->pos];
+        size_t avail = reader->len - reader->pos;
+
+        if (!reader->synced) {
+            // Byte by byte, padding bytes may be part of a damaged record
+            if (adv_capture_is_sync(p, avail) && p[6] == ADV_CAPTURE_VERSION) {
+                adv_capture_sync(reader, p);
+                reader->pos += ADV_CAPTURE_SYNC_LEN;
+            } else {
+                reader->stats.skipped++;
+                reader->pos++;
+            }
+            continue;
+        }
+        if (p[0] == PAD_ZERO || p[0] == PAD_ERASED) {
+            size_t next = (reader->pos / ADV_CAPTURE_SECTOR_SIZE + 1) * ADV_CAPTURE_SECTOR_SIZE;
+            if (next > reader->len) {
+                next = reader->len;
+            }
+            reader->stats.skipped += next - reader->pos;
+            reader->pos = next;
+            continue;
+        }
+
+        size_t rec_len = (size_t)p[0] + 1;
+        if (rec_len > avail || rec_len < 2) {
+            // Truncated, e.g. a capture cut while writing
+            reader->stats.skipped += avail;
+            reader->pos = reader->len;
+            break;
+        }
+        switch (p[1]) {
+        case ADV_CAPTURE_SYNC:
+            if (!adv_capture_is_sync(p, avail)) {
+                adv_capture_resync(reader);
+                continue;
+            }
+            if (p[6] != ADV_CAPTURE_VERSION) {
+                // Newer format, skip up to a chunk we can read
+                reader->synced = false;
+                reader->stats.skipped += rec_len;
+            } else {
+                adv_capture_sync(reader, p);
+            }
+            reader->pos += rec_len;
+            break;
+        case ADV_CAPTURE_ADVERT: {
+            size_t data_len = rec_len < ADV_CAPTURE_ADVERT_HDR_LEN ? 0 : (size_t)p[14] + p[15];
+            if (rec_len < ADV_CAPTURE_ADVERT_HDR_LEN || data_len > ADV_RECORD_DATA_MAX ||
+                rec_len != ADV_CAPTURE_ADVERT_HDR_LEN + data_len) {
+                adv_capture_resync(reader);
+                continue;
+            }
+            rec->time_ms = get_le32(&p[2]);
+            rec->time_us = rec->time_ms * 1000;
+            memcpy(rec->bda, &p[6], ADV_BDA_LEN);
+            rec->rssi = (int8_t)p[12];
+            rec->dev_type = p[13];
+            rec->adv_data_len = p[14];
+            rec->scan_rsp_len = p[15];
+            memcpy(rec->data, &p[ADV_CAPTURE_ADVERT_HDR_LEN], data_len);
+            memset(&rec->data[data_len], 0, ADV_RECORD_DATA_MAX - data_len);
+            reader->pos += rec_len;
+            reader->stats.adverts++;
+            return true;
+        }
+        default:
+            reader->stats.skipped += rec_len;
+            reader->pos += rec_len;
+            break;
+        }
+    }
+    return false;
+}
+
+bool adv_capture_store_mount(adv_capture_store_t *store, const adv_capture_flash_t *flash) {
+    uint32_t sectors = flash->size / ADV_CAPTURE_SECTOR_SIZE;
+    uint32_t sector;
+    uint8_t len;
+
+    memset(store, 0, sizeof(*store));
+    store->flash = *flash;
+    if (sectors == 0) {
+        return false;
+    }
+    // Sectors are filled in order, each starts with a sync record
+    for (sector = 0; sector < sectors; sector++) {
+        if (flash->read(flash->ctx, sector * ADV_CAPTURE_SECTOR_SIZE, &len, 1)) {
+            store->flash_errors++;
+            return false;
+        }
+        if (len == PAD_ERASED) {
+            break;
+        }
+    }
+    store->offset = sector * ADV_CAPTURE_SECTOR_SIZE;
+    if (sector == 0) {
+        return true;
+    }
+    // Resume after the last record of the previous sector
+    uint32_t offset = (sector - 1) * ADV_CAPTURE_SECTOR_SIZE;
+    uint32_t end = offset + ADV_CAPTURE_SECTOR_SIZE;
+    while (offset < end) {
+        if (flash->read(flash->ctx, offset, &len, 1)) {
+            store->flash_errors++;
+            return false;
+        }
+        if (len == PAD_ZERO || len == PAD_ERASED) {
+            break;
+        }
+        offset += (uint32_t)len + 1;
+    }
+    if (offset < end) {
+        store->offset = offset;
+    } else if (sector == sectors) {
+        store->full = true;
+    }
+    return true;
+}
+
+bool adv_capture_store_append(adv_capture_store_t *store, const uint8_t *chunk, size_t len) {
+    uint32_t room = ADV_CAPTURE_SECTOR_SIZE - store->offset % ADV_CAPTURE_SECTOR_SIZE;
+
+    if (store->full || len == 0 || len > ADV_CAPTURE_SECTOR_SIZE) {
+        store->lost++;
+        return false;
+    }
+    if (len > room) {
+        // The rest of the sector stays erased, padding for readers
+        store->offset += room;
+    }
+    if (store->offset % ADV_CAPTURE_SECTOR_SIZE == 0) {
+        if (store->offset >= store->flash.size) {
+            store->full = true;
+            store->lost++;
+            return false;
+        }
+        if (store->flash.erase(store->flash.ctx, store->offset)) {
+            store->flash_errors++;
+            store->lost++;
+            return false;
+        }
+    }
+    if (store->flash.write(store->flash.ctx, store->offset, chunk, len)) {
+        store->flash_errors++;
+        store->lost++;
+        // Do not write over a partial chunk, go on in the next sector
+        store->offset += ADV_CAPTURE_SECTOR_SIZE - store->offset % ADV_CAPTURE_SECTOR_SIZE;
+        return false;
+    }
+    store->offset += len;
+    store->chunks++;
+    store->bytes += len;
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef __ADV_CAPTURE_H__
+#define __ADV_CAPTURE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "adv_record.h"
+
+/*
+ * Capture of raw scan results, to replay site traffic through the tracker.
+ *
+ * A capture is a sequence of length prefixed records:
+ *  [0]    length of the record after this byte
+ *  [1]    record type
+ *  [2..]  body
+ * Sync record, ADV_CAPTURE_SYNC, opens every MQTT message and flash sector:
+ *  [2..5] magic, ADV_CAPTURE_MAGIC
+ *  [6]    format version, ADV_CAPTURE_VERSION
+ *  [7..10] adverts dropped or coalesced by the advert queue since boot,
+ *          never captured
+ * Advert record, ADV_CAPTURE_ADVERT:
+ *  [2..5] time_ms, since boot
+ *  [6..11] bda, [12] rssi, [13] dev_type, [14] adv_data_len, [15] scan_rsp_len
+ *  [16..] adv_data_len + scan_rsp_len bytes of ble_adv
+ * Multi-byte fields are little endian, unknown record types are skipped.
+ * A length of 0x00 or 0xFF, erased flash, pads up to the next
+ * ADV_CAPTURE_SECTOR_SIZE boundary of the capture. Concatenated MQTT
+ * messages and a dump of the capture partition are both valid captures.
+ */
+#define ADV_CAPTURE_MAGIC       0x43564441  // "ADVC"
+#define ADV_CAPTURE_VERSION     1
+#define ADV_CAPTURE_SYNC        0x01
+#define ADV_CAPTURE_ADVERT      0x02
+#define ADV_CAPTURE_SYNC_LEN    11
+#define ADV_CAPTURE_ADVERT_HDR_LEN 16
+#define ADV_CAPTURE_RECORD_MAX  (ADV_CAPTURE_ADVERT_HDR_LEN + ADV_RECORD_DATA_MAX)
+#define ADV_CAPTURE_SECTOR_SIZE 4096
+
+/*
+ * return: record length, -1 on overflow
+ */
+int adv_capture_encode_sync(uint32_t dropped, uint8_t *out, size_t size);
+int adv_capture_encode(const adv_record_t *rec, uint8_t *out, size_t size);
+
+typedef struct {
+    uint64_t adverts;
+    uint64_t syncs;
+    uint64_t skipped;           // Bytes of padding, unknown records or corruption
+    uint64_t corrupted;         // Resynchronizations on a damaged record
+    uint64_t lost;              // Adverts lost on the tracker before capture
+} adv_capture_reader_stats_t;
+
+/*
+ * Sequential reader over a capture in memory, e.g. a mapped file
+ */
+typedef struct {
+    const uint8_t              *data;
+    size_t                      len;
+    size_t                      pos;
+    bool                        synced;
+    bool                        has_dropped;
+    uint32_t                    dropped;    // Of the last sync record
+    adv_capture_reader_stats_t  stats;
+} adv_capture_reader_t;
+
+void adv_capture_reader_init(adv_capture_reader_t *reader, const uint8_t *data, size_t len);
+
+/*
+ * Next advert, records before the first sync record are skipped
+ * return: false at the end of the capture
+ */
+bool adv_capture_next(adv_capture_reader_t *reader, adv_record_t *rec);
+
+/*
+ * Flash access, offsets are relative to the start of the capture area
+ * return: 0 on success
+ */
+typedef struct {
+    int      (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+    int      (*write)(void *ctx, uint32_t offset, const void *buf, size_t len);
+    int      (*erase)(void *ctx, uint32_t offset);     // One sector
+    void      *ctx;
+    uint32_t   size;                                    // Multiple of ADV_CAPTURE_SECTOR_SIZE
+} adv_capture_flash_t;
+
+/*
+ * Append only store of capture chunks, each starting with a sync record and
+ * held in one sector. Writing stops once the area is full, the capture is
+ * read back with a flash dump and erased with it.
+ */
+typedef struct {
+    adv_capture_flash_t flash;
+    uint32_t            offset;     // Next write
+    bool                full;
+    uint32_t            chunks;
+    uint32_t            bytes;
+    uint32_t            lost;       // Chunks not stored, area full or flash error
+    uint32_t            flash_errors;
+} adv_capture_store_t;
+
+/*
+ * Find the end of a previous capture, writing resumes there
+ */
+bool adv_capture_store_mount(adv_capture_store_t *store, const adv_capture_flash_t *flash);
+
+/*
+ * Store one chunk of at most ADV_CAPTURE_SECTOR_SIZE bytes, starting with a
+ * sync record, in the current sector or the next one
+ * return: false if it is lost
+ */
+bool adv_capture_store_append(adv_capture_store_t *store, const uint8_t *chunk, size_t len);
+
+#endif
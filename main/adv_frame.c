@@ -0,0 +1,414 @@
+#include <string.h>
+#include "adv_frame.h"
+
+
+static inline uint8_t *adv_frame_put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+    return p + 4;
+}
+
+static inline uint32_t adv_frame_get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int adv_frame_encode(const adv_record_t *rec, const adv_stats_t *stats, uint8_t *out, size_t size) {
+    size_t data_len = (size_t)rec->adv_data_len + rec->scan_rsp_len;
+    size_t header_len = ADV_FRAME_HEADER_LEN + (stats ? ADV_FRAME_STATS_LEN : 0);
+    if (data_len > ADV_RECORD_DATA_MAX || size < header_len + data_len) {
+        return -1;
+    }
+
+    out[0] = stats ? ADV_FRAME_VERSION_AGGREGATE : ADV_FRAME_VERSION;
+    memcpy(&out[1], rec->bda, ADV_BDA_LEN);
+    out[7] = (uint8_t)rec->rssi;
+    out[8] = rec->dev_type;
+    out[9] = rec->adv_data_len;
+    out[10] = rec->scan_rsp_len;
+    if (stats) {
+        uint8_t *p = &out[ADV_FRAME_HEADER_LEN];
+        *p++ = (uint8_t)stats->count;
+        *p++ = (uint8_t)(stats->count >> 8);
+        *p++ = (uint8_t)stats->rssi_min;
+        *p++ = (uint8_t)stats->rssi_max;
+        *p++ = (uint8_t)stats->rssi_mean;
+        p = adv_frame_put_u32(p, stats->first_seen_ms);
+        adv_frame_put_u32(p, stats->last_seen_ms);
+    }
+    memcpy(&out[header_len], rec->data, data_len);
+    return (int)(header_len + data_len);
+}
+
+int adv_frame_decode(const uint8_t *buf, size_t len, adv_record_t *rec, adv_stats_t *stats) {
+    if (len < ADV_FRAME_HEADER_LEN) {
+        return -1;
+    }
+    size_t header_len;
+    if (buf[0] == ADV_FRAME_VERSION) {
+        header_len = ADV_FRAME_HEADER_LEN;
+    } else if (buf[0] == ADV_FRAME_VERSION_AGGREGATE) {
+        header_len = ADV_FRAME_HEADER_LEN + ADV_FRAME_STATS_LEN;
+    } else {
+        return -1;
+    }
+    size_t data_len = (size_t)buf[9] + buf[10];
+    if (data_len > ADV_RECORD_DATA_MAX || len < header_len + data_len) {
+        return -1;
+    }
+
+    memcpy(rec->bda, &buf[1], ADV_BDA_LEN);
+    rec->rssi = (int8_t)buf[7];
+    rec->dev_type = buf[8];
+    rec->adv_data_len = buf[9];
+    rec->scan_rsp_len = buf[10];
+    memcpy(rec->data, &buf[header_len], data_len);
+    memset(&rec->data[data_len], 0, ADV_RECORD_DATA_MAX - data_len);
+    if (stats && buf[0] == ADV_FRAME_VERSION_AGGREGATE) {
+        const uint8_t *p = &buf[ADV_FRAME_HEADER_LEN];
+        stats->count = (uint16_t)(p[0] | p[1] << 8);
+        stats->rssi_min = (int8_t)p[2];
+        stats->rssi_max = (int8_t)p[3];
+        stats->rssi_mean = (int8_t)p[4];
+        stats->first_seen_ms = adv_frame_get_u32(&p[5]);
+        stats->last_seen_ms = adv_frame_get_u32(&p[9]);
+    }
+    return (int)(header_len + data_len);
+}
+
+int adv_frame_encode_range(const adv_range_estimate_t *est, uint8_t *out, size_t size) {
+    if (size < ADV_FRAME_RANGE_LEN) {
+        return -1;
+    }
+    out[0] = ADV_FRAME_VERSION_RANGE;
+    memcpy(&out[1], est->bda, ADV_BDA_LEN);
+    out[7] = (uint8_t)est->rssi_x10;
+    out[8] = (uint8_t)((uint16_t)est->rssi_x10 >> 8);
+    out[9] = (uint8_t)est->ref_power;
+    out[10] = (uint8_t)est->distance_cm;
+    out[11] = (uint8_t)(est->distance_cm >> 8);
+    return ADV_FRAME_RANGE_LEN;
+}
+
+int adv_frame_decode_range(const uint8_t *buf, size_t len, adv_range_estimate_t *est) {
+    if (len < ADV_FRAME_RANGE_LEN || buf[0] != ADV_FRAME_VERSION_RANGE) {
+        return -1;
+    }
+    memcpy(est->bda, &buf[1], ADV_BDA_LEN);
+    est->rssi_x10 = (int16_t)(buf[7] | buf[8] << 8);
+    est->ref_power = (int8_t)buf[9];
+    est->distance_cm = (uint16_t)(buf[10] | buf[11] << 8);
+    return ADV_FRAME_RANGE_LEN;
+}
+
+int adv_frame_encode_presence(const adv_presence_report_t *report, uint8_t *out, size_t size) {
+    if (size < ADV_FRAME_PRESENCE_LEN) {
+        return -1;
+    }
+    out[0] = ADV_FRAME_VERSION_PRESENCE;
+    out[1] = (uint8_t)report->event;
+    memcpy(&out[2], report->bda, ADV_BDA_LEN);
+    out[8] = (uint8_t)report->rssi;
+    adv_frame_put_u32(&out[9], report->first_seen_ms);
+    adv_frame_put_u32(&out[13], report->last_seen_ms);
+    return ADV_FRAME_PRESENCE_LEN;
+}
+
+int adv_frame_decode_presence(const uint8_t *buf, size_t len, adv_presence_report_t *report) {
+    if (len < ADV_FRAME_PRESENCE_LEN || buf[0] != ADV_FRAME_VERSION_PRESENCE) {
+        return -1;
+    }
+    report->event = (adv_presence_event_t)buf[1];
+    memcpy(report->bda, &buf[2], ADV_BDA_LEN);
+    report->rssi = (int8_t)buf[8];
+    report->first_seen_ms = adv_frame_get_u32(&buf[9]);
+    report->last_seen_ms = adv_frame_get_u32(&buf[13]);
+    return ADV_FRAME_PRESENCE_LEN;
+}
+
+int adv_frame_encode_gatt(const gattc_reading_t *reading, uint8_t *out, size_t size) {
+    if (size < ADV_FRAME_GATT_LEN) {
+        return -1;
+    }
+    out[0] = ADV_FRAME_VERSION_GATT;
+    memcpy(&out[1], reading->bda, ADV_BDA_LEN);
+    out[7] = reading->fields;
+    out[8] = reading->battery;
+    out[9] = (uint8_t)reading->temperature;
+    out[10] = (uint8_t)((uint16_t)reading->temperature >> 8);
+    out[11] = (uint8_t)reading->humidity;
+    out[12] = (uint8_t)(reading->humidity >> 8);
+    adv_frame_put_u32(&out[13], reading->time_ms);
+    out[17] = (uint8_t)reading->duration_ms;
+    out[18] = (uint8_t)(reading->duration_ms >> 8);
+    return ADV_FRAME_GATT_LEN;
+}
+
+int adv_frame_decode_gatt(const uint8_t *buf, size_t len, gattc_reading_t *reading) {
+    if (len < ADV_FRAME_GATT_LEN || buf[0] != ADV_FRAME_VERSION_GATT) {
+        return -1;
+    }
+    memcpy(reading->bda, &buf[1], ADV_BDA_LEN);
+    reading->fields = buf[7];
+    reading->battery = buf[8];
+    reading->temperature = (int16_t)(buf[9] | buf[10] << 8);
+    reading->humidity = (uint16_t)(buf[11] | buf[12] << 8);
+    reading->time_ms = adv_frame_get_u32(&buf[13]);
+    reading->duration_ms = (uint16_t)(buf[17] | buf[18] << 8);
+    return ADV_FRAME_GATT_LEN;
+}
+
+int adv_frame_encode_stream(const gattc_stream_header_t *hdr, uint8_t *out, size_t size) {
+    if (size < ADV_FRAME_STREAM_HEADER_LEN) {
+        return -1;
+    }
+    out[0] = ADV_FRAME_VERSION_STREAM;
+    memcpy(&out[1], hdr->bda, ADV_BDA_LEN);
+    out[7] = hdr->decimation;
+    adv_frame_put_u32(&out[8], hdr->seq);
+    adv_frame_put_u32(&out[12], hdr->time_us);
+    out[16] = (uint8_t)hdr->count;
+    out[17] = (uint8_t)(hdr->count >> 8);
+    return ADV_FRAME_STREAM_HEADER_LEN;
+}
+
+int adv_frame_encode_stream_record(uint16_t offset, const uint8_t *value, uint16_t len, uint8_t *out, size_t size) {
+    if (size < (size_t)ADV_FRAME_STREAM_RECORD_LEN + len) {
+        return -1;
+    }
+    out[0] = (uint8_t)offset;
+    out[1] = (uint8_t)(offset >> 8);
+    out[2] = (uint8_t)len;
+    out[3] = (uint8_t)(len >> 8);
+    memcpy(&out[ADV_FRAME_STREAM_RECORD_LEN], value, len);
+    return ADV_FRAME_STREAM_RECORD_LEN + len;
+}
+
+int adv_frame_decode_stream(const uint8_t *buf, size_t len, gattc_stream_header_t *hdr) {
+    if (len < ADV_FRAME_STREAM_HEADER_LEN || buf[0] != ADV_FRAME_VERSION_STREAM) {
+        return -1;
+    }
+    memcpy(hdr->bda, &buf[1], ADV_BDA_LEN);
+    hdr->decimation = buf[7];
+    hdr->seq = adv_frame_get_u32(&buf[8]);
+    hdr->time_us = adv_frame_get_u32(&buf[12]);
+    hdr->count = (uint16_t)(buf[16] | buf[17] << 8);
+    return ADV_FRAME_STREAM_HEADER_LEN;
+}
+
+int adv_frame_decode_stream_record(const uint8_t *buf, size_t len, uint16_t *offset, const uint8_t **value,
+                                   uint16_t *value_len) {
+    if (len < ADV_FRAME_STREAM_RECORD_LEN) {
+        return -1;
+    }
+    *value_len = (uint16_t)(buf[2] | buf[3] << 8);
+    if (len < (size_t)ADV_FRAME_STREAM_RECORD_LEN + *value_len) {
+        return -1;
+    }
+    *offset = (uint16_t)(buf[0] | buf[1] << 8);
+    *value = &buf[ADV_FRAME_STREAM_RECORD_LEN];
+    return ADV_FRAME_STREAM_RECORD_LEN + *value_len;
+}
+
+int adv_frame_encode_timed(int64_t time_us, uint32_t error_us, uint8_t *out, size_t size) {
+    if (size < ADV_FRAME_TIMED_LEN) {
+        return -1;
+    }
+    out[0] = ADV_FRAME_VERSION_TIMED;
+    adv_frame_put_u32(&out[1], (uint32_t)time_us);
+    adv_frame_put_u32(&out[5], (uint32_t)((uint64_t)time_us >> 32));
+    error_us = error_us > UINT16_MAX ? UINT16_MAX : error_us;
+    out[9] = (uint8_t)error_us;
+    out[10] = (uint8_t)(error_us >> 8);
+    return ADV_FRAME_TIMED_LEN;
+}
+
+int adv_frame_decode_timed(const uint8_t *buf, size_t len, int64_t *time_us, uint32_t *error_us) {
+    if (len < ADV_FRAME_TIMED_LEN || buf[0] != ADV_FRAME_VERSION_TIMED) {
+        return -1;
+    }
+    *time_us = (int64_t)((uint64_t)adv_frame_get_u32(&buf[5]) << 32 | adv_frame_get_u32(&buf[1]));
+    *error_us = (uint32_t)(buf[9] | buf[10] << 8);
+    return ADV_FRAME_TIMED_LEN;
+}
+
+/*
+ * Bounds checked writer and reader of the variable size frames
+ */
+typedef struct {
+    uint8_t *p;
+    uint8_t *end;
+    bool     overflow;
+} adv_frame_writer_t;
+
+static void adv_frame_write_u8(adv_frame_writer_t *w, uint8_t v) {
+    if (w->p >= w->end) {
+        w->overflow = true;
+        return;
+    }
+    *w->p++ = v;
+}
+
+static void adv_frame_write_u16(adv_frame_writer_t *w, uint16_t v) {
+    adv_frame_write_u8(w, (uint8_t)v);
+    adv_frame_write_u8(w, (uint8_t)(v >> 8));
+}
+
+static void adv_frame_write_u32(adv_frame_writer_t *w, uint32_t v) {
+    if (w->end - w->p < 4) {
+        w->overflow = true;
+        w->p = w->end;
+        return;
+    }
+    w->p = adv_frame_put_u32(w->p, v);
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool           truncated;
+} adv_frame_reader_t;
+
+static uint8_t adv_frame_read_u8(adv_frame_reader_t *r) {
+    if (r->p >= r->end) {
+        r->truncated = true;
+        return 0;
+    }
+    return *r->p++;
+}
+
+static uint32_t adv_frame_read_u32(adv_frame_reader_t *r) {
+    if (r->end - r->p < 4) {
+        r->truncated = true;
+        r->p = r->end;
+        return 0;
+    }
+    uint32_t v = adv_frame_get_u32(r->p);
+    r->p += 4;
+    return v;
+}
+
+int adv_frame_encode_perf(const perf_snapshot_t *snap, uint8_t *out, size_t size) {
+    adv_frame_writer_t w = { out, out + size, false };
+    const uint32_t queue[] = {
+        snap->queue_depth, snap->queue_high_water, snap->queue_pushed,
+        snap->queue_popped, snap->queue_dropped, snap->queue_coalesced,
+    };
+
+    adv_frame_write_u8(&w, ADV_FRAME_VERSION_PERF);
+    adv_frame_write_u32(&w, snap->uptime_s);
+    adv_frame_write_u8(&w, PERF_COUNTERS);
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        adv_frame_write_u32(&w, snap->counters[i]);
+    }
+    for (size_t i = 0; i < sizeof(queue) / sizeof(queue[0]); i++) {
+        adv_frame_write_u32(&w, queue[i]);
+    }
+    adv_frame_write_u32(&w, snap->heap_free);
+    adv_frame_write_u32(&w, snap->heap_min_free);
+    adv_frame_write_u8(&w, snap->stack_count);
+    for (int i = 0; i < snap->stack_count; i++) {
+        const perf_stack_t *stack = &snap->stacks[i];
+        size_t name_len = strnlen(stack->name, PERF_NAME_LEN);
+        adv_frame_write_u16(&w, stack->free_bytes > 0xFFFF ? 0xFFFF : (uint16_t)stack->free_bytes);
+        adv_frame_write_u8(&w, (uint8_t)name_len);
+        for (size_t c = 0; c < name_len; c++) {
+            adv_frame_write_u8(&w, (uint8_t)stack->name[c]);
+        }
+    }
+    adv_frame_write_u8(&w, PERF_HISTS);
+    for (int i = 0; i < PERF_HISTS; i++) {
+        const perf_hist_t *hist = &snap->hists[i];
+        uint32_t first;
+        uint32_t span = perf_hist_span(hist, &first);
+        adv_frame_write_u32(&w, hist->count);
+        adv_frame_write_u32(&w, hist->max_us);
+        adv_frame_write_u8(&w, (uint8_t)first);
+        adv_frame_write_u8(&w, (uint8_t)span);
+        for (uint32_t b = first; b < first + span; b++) {
+            adv_frame_write_u32(&w, hist->buckets[b]);
+        }
+    }
+    return w.overflow ? -1 : (int)(w.p - out);
+}
+
+int adv_frame_decode_perf(const uint8_t *buf, size_t len, perf_snapshot_t *snap) {
+    adv_frame_reader_t r = { buf, buf + len, false };
+    uint32_t *queue[] = {
+        &snap->queue_depth, &snap->queue_high_water, &snap->queue_pushed,
+        &snap->queue_popped, &snap->queue_dropped, &snap->queue_coalesced,
+    };
+
+    memset(snap, 0, sizeof(*snap));
+    if (adv_frame_read_u8(&r) != ADV_FRAME_VERSION_PERF) {
+        return -1;
+    }
+    snap->uptime_s = adv_frame_read_u32(&r);
+    uint8_t counters = adv_frame_read_u8(&r);
+    for (int i = 0; i < counters; i++) {
+        uint32_t v = adv_frame_read_u32(&r);
+        if (i < PERF_COUNTERS) {
+            snap->counters[i] = v;
+        }
+    }
+    for (size_t i = 0; i < sizeof(queue) / sizeof(queue[0]); i++) {
+        *queue[i] = adv_frame_read_u32(&r);
+    }
+    snap->heap_free = adv_frame_read_u32(&r);
+    snap->heap_min_free = adv_frame_read_u32(&r);
+    uint8_t stacks = adv_frame_read_u8(&r);
+    for (int i = 0; i < stacks && !r.truncated; i++) {
+        uint32_t free_bytes = adv_frame_read_u8(&r);
+        free_bytes |= (uint32_t)adv_frame_read_u8(&r) << 8;
+        uint8_t name_len = adv_frame_read_u8(&r);
+        if (name_len >= PERF_NAME_LEN || r.end - r.p < name_len || i >= PERF_STACKS_MAX) {
+            return -1;
+        }
+        perf_stack_t *stack = &snap->stacks[snap->stack_count++];
+        memcpy(stack->name, r.p, name_len);
+        stack->name[name_len] = '\0';
+        stack->free_bytes = free_bytes;
+        r.p += name_len;
+    }
+    uint8_t hists = adv_frame_read_u8(&r);
+    for (int i = 0; i < hists && !r.truncated; i++) {
+        perf_hist_t hist;
+        memset(&hist, 0, sizeof(hist));
+        hist.count = adv_frame_read_u32(&r);
+        hist.max_us = adv_frame_read_u32(&r);
+        uint8_t first = adv_frame_read_u8(&r);
+        uint8_t n = adv_frame_read_u8(&r);
+        for (int b = first; b < first + n; b++) {
+            uint32_t v = adv_frame_read_u32(&r);
+            if (b < PERF_HIST_BUCKETS) {
+                hist.buckets[b] = v;
+            }
+        }
+        if (i < PERF_HISTS) {
+            snap->hists[i] = hist;
+        }
+    }
+    return r.truncated ? -1 : (int)(r.p - buf);
+}
+
+int adv_frame_encode_logged(uint32_t seq, uint32_t time_ms, const uint8_t *frame, size_t frame_len,
+                            uint8_t *out, size_t size) {
+    if (size < ADV_FRAME_LOGGED_LEN + frame_len) {
+        return -1;
+    }
+    out[0] = ADV_FRAME_VERSION_LOGGED;
+    adv_frame_put_u32(&out[1], seq);
+    adv_frame_put_u32(&out[5], time_ms);
+    memcpy(&out[ADV_FRAME_LOGGED_LEN], frame, frame_len);
+    return (int)(ADV_FRAME_LOGGED_LEN + frame_len);
+}
+
+int adv_frame_decode_logged(const uint8_t *buf, size_t len, uint32_t *seq, uint32_t *time_ms) {
+    if (len < ADV_FRAME_LOGGED_LEN || buf[0] != ADV_FRAME_VERSION_LOGGED) {
+        return -1;
+    }
+    *seq = adv_frame_get_u32(&buf[1]);
+    *time_ms = adv_frame_get_u32(&buf[5]);
+    return ADV_FRAME_LOGGED_LEN;
+}
@@ -0,0 +1,239 @@
+#ifndef __ADV_FRAME_H__
+#define __ADV_FRAME_H__
+
+// Includes
+#include <stdint.h>
+#include <stddef.h>
+#include "adv_record.h"
+#include "adv_table.h"
+#include "adv_range.h"
+#include "adv_presence.h"
+#include "gattc_sched.h"
+#include "gattc_stream.h"
+#include "perf.h"
+
+/*
+ * Binary advert frame, all fields in transmission order:
+ *  [0]      version, ADV_FRAME_VERSION
+ *  [1..6]   bda
+ *  [7]      rssi, signed
+ *  [8]      dev_type
+ *  [9]      adv_data_len
+ *  [10]     scan_rsp_len
+ *  [11..]   ADV_FRAME_VERSION_AGGREGATE only, scan window aggregate:
+ *           count u16, rssi_min, rssi_max, rssi_mean, first_seen_ms u32, last_seen_ms u32
+ *  [..]     adv_data_len + scan_rsp_len bytes of raw AD payload
+ * Multi-byte fields are little endian.
+ * Frames are self delimiting and can be concatenated in one message.
+ */
+#define ADV_FRAME_VERSION            1
+#define ADV_FRAME_VERSION_AGGREGATE  2
+#define ADV_FRAME_HEADER_LEN         11
+#define ADV_FRAME_STATS_LEN          13
+#define ADV_FRAME_MAX_LEN            (ADV_FRAME_HEADER_LEN + ADV_FRAME_STATS_LEN + ADV_RECORD_DATA_MAX)
+
+/*
+ * Distance estimate frame, fixed size:
+ *  [0]      version, ADV_FRAME_VERSION_RANGE
+ *  [1..6]   bda
+ *  [7..8]   filtered rssi, tenth of dB, i16
+ *  [9]      rssi at 1 m used by the model, signed
+ *  [10..11] distance in cm, u16
+ */
+#define ADV_FRAME_VERSION_RANGE      3
+#define ADV_FRAME_RANGE_LEN          12
+
+/*
+ * Presence event frame, fixed size:
+ *  [0]      version, ADV_FRAME_VERSION_PRESENCE
+ *  [1]      event, adv_presence_event_t
+ *  [2..7]   bda
+ *  [8]      rssi of the latest advert, signed
+ *  [9..12]  first_seen_ms u32
+ *  [13..16] last_seen_ms u32
+ */
+#define ADV_FRAME_VERSION_PRESENCE   4
+#define ADV_FRAME_PRESENCE_LEN       17
+
+/*
+ * Replayed advert, kept in flash while offline:
+ *  [0]      version, ADV_FRAME_VERSION_LOGGED
+ *  [1..4]   log sequence number u32, for deduplication
+ *  [5..8]   reception time_ms u32
+ *  [9..]    the stored advert frame, version 1 or 2
+ */
+#define ADV_FRAME_VERSION_LOGGED     5
+#define ADV_FRAME_LOGGED_LEN         9
+
+/*
+ * Stats report frame, variable size:
+ *  [0]      version, ADV_FRAME_VERSION_PERF
+ *  [1..4]   uptime_s u32
+ *  [5]      counter count N, then N counters u32, perf_counter_t order
+ *  [..]     queue depth, high water, pushed, popped, dropped, coalesced, u32 each
+ *  [..]     heap free, heap lowest free, u32 each
+ *  [..]     stack count S, then S times: free bytes u16, name length u8, name
+ *  [..]     histogram count H, then H times, perf_hist_id_t order: count u32,
+ *           max_us u32, first bucket u8, bucket count B u8, B buckets u32
+ */
+#define ADV_FRAME_VERSION_PERF       6
+#define ADV_FRAME_PERF_MAX_LEN       (6 + 4 * PERF_COUNTERS + 32 + 1 + PERF_STACKS_MAX * (3 + PERF_NAME_LEN) + \
+                                      1 + PERF_HISTS * (10 + 4 * PERF_HIST_BUCKETS))
+
+/*
+ * GATT reading of a tag, fixed size:
+ *  [0]      version, ADV_FRAME_VERSION_GATT
+ *  [1..6]   bda
+ *  [7]      fields present, GATTC_READING_ bits
+ *  [8]      battery level, %
+ *  [9..10]  temperature, 0.01 C, i16
+ *  [11..12] humidity, 0.01 %, u16
+ *  [13..16] connection time_ms u32
+ *  [17..18] connection to last read, ms, u16
+ */
+#define ADV_FRAME_VERSION_GATT       7
+#define ADV_FRAME_GATT_LEN           19
+
+/*
+ * Notification batch of a stream, built in place by gattc_stream.h:
+ *  [0]      version, ADV_FRAME_VERSION_STREAM
+ *  [1..6]   bda
+ *  [7]      decimation n: one notification in 2^n is kept
+ *  [8..11]  number of the first notification u32, counting all those received
+ *  [12..15] reception time of the first notification, us u32
+ *  [16..17] notification count u16
+ *  [18..]   count times: time since the first one, 0.1 ms u16, value length
+ *           u16, value
+ * Notification i of a batch is the one received number seq + i * 2^n.
+ */
+#define ADV_FRAME_VERSION_STREAM     8
+#define ADV_FRAME_STREAM_HEADER_LEN  18
+#define ADV_FRAME_STREAM_RECORD_LEN  4
+#define ADV_FRAME_STREAM_TICK_US     100
+
+/*
+ * Advert with its fleet reception time, see time_sync.h:
+ *  [0]      version, ADV_FRAME_VERSION_TIMED
+ *  [1..8]   fleet time, us since the Unix epoch u64
+ *  [9..10]  its estimated error, us u16, 65535 or more
+ *  [11..]   the advert frame, version 1 or 2
+ * Adverts are not wrapped until the tracker is synced.
+ */
+#define ADV_FRAME_VERSION_TIMED      9
+#define ADV_FRAME_TIMED_LEN          11
+
+/*
+ * Encode one record, as an aggregate frame when stats is not NULL
+ * return: frame length, -1 if out is too small or the record lengths are invalid
+ */
+int adv_frame_encode(const adv_record_t *rec, const adv_stats_t *stats, uint8_t *out, size_t size);
+
+/*
+ * Decode the frame at the start of buf, reference decoder for consumers
+ * stats: filled for aggregate frames, may be NULL
+ * return: bytes consumed, -1 if truncated, unknown version or invalid lengths
+ */
+int adv_frame_decode(const uint8_t *buf, size_t len, adv_record_t *rec, adv_stats_t *stats);
+
+/*
+ * Encode one distance estimate
+ * return: ADV_FRAME_RANGE_LEN, -1 if out is too small
+ */
+int adv_frame_encode_range(const adv_range_estimate_t *est, uint8_t *out, size_t size);
+
+/*
+ * Decode the distance estimate frame at the start of buf
+ * return: bytes consumed, -1 if truncated or not a distance estimate frame
+ */
+int adv_frame_decode_range(const uint8_t *buf, size_t len, adv_range_estimate_t *est);
+
+/*
+ * Encode one presence event
+ * return: ADV_FRAME_PRESENCE_LEN, -1 if out is too small
+ */
+int adv_frame_encode_presence(const adv_presence_report_t *report, uint8_t *out, size_t size);
+
+/*
+ * Decode the presence event frame at the start of buf
+ * return: bytes consumed, -1 if truncated or not a presence event frame
+ */
+int adv_frame_decode_presence(const uint8_t *buf, size_t len, adv_presence_report_t *report);
+
+/*
+ * Encode one GATT reading
+ * return: ADV_FRAME_GATT_LEN, -1 if out is too small
+ */
+int adv_frame_encode_gatt(const gattc_reading_t *reading, uint8_t *out, size_t size);
+
+/*
+ * Decode the GATT reading frame at the start of buf
+ * return: bytes consumed, -1 if truncated or not a GATT reading frame
+ */
+int adv_frame_decode_gatt(const uint8_t *buf, size_t len, gattc_reading_t *reading);
+
+/*
+ * Encode the header of a notification batch
+ * return: ADV_FRAME_STREAM_HEADER_LEN, -1 if out is too small
+ */
+int adv_frame_encode_stream(const gattc_stream_header_t *hdr, uint8_t *out, size_t size);
+
+/*
+ * Encode one notification of a batch
+ * offset: since the first notification, ADV_FRAME_STREAM_TICK_US
+ * return: record length, -1 if out is too small
+ */
+int adv_frame_encode_stream_record(uint16_t offset, const uint8_t *value, uint16_t len, uint8_t *out, size_t size);
+
+/*
+ * Decode the header of the notification batch at the start of buf, count
+ * records follow it
+ * return: header length, -1 if truncated or not a notification batch
+ */
+int adv_frame_decode_stream(const uint8_t *buf, size_t len, gattc_stream_header_t *hdr);
+
+/*
+ * Decode the notification record at the start of buf, value points into buf
+ * return: bytes consumed, -1 if truncated
+ */
+int adv_frame_decode_stream_record(const uint8_t *buf, size_t len, uint16_t *offset, const uint8_t **value,
+                                   uint16_t *value_len);
+
+/*
+ * Encode the fleet time header of an advert, its frame follows
+ * return: ADV_FRAME_TIMED_LEN, -1 if out is too small
+ */
+int adv_frame_encode_timed(int64_t time_us, uint32_t error_us, uint8_t *out, size_t size);
+
+/*
+ * Decode the fleet time header at the start of buf, the advert frame follows it
+ * return: header length, -1 if truncated or not a timed advert
+ */
+int adv_frame_decode_timed(const uint8_t *buf, size_t len, int64_t *time_us, uint32_t *error_us);
+
+/*
+ * Encode a stats report, histograms are trimmed to their non-empty buckets
+ * return: frame length, -1 if out is too small
+ */
+int adv_frame_encode_perf(const perf_snapshot_t *snap, uint8_t *out, size_t size);
+
+/*
+ * Decode the stats report frame at the start of buf, counters and histograms
+ * beyond those known to this build are skipped
+ * return: bytes consumed, -1 if truncated or not a stats report frame
+ */
+int adv_frame_decode_perf(const uint8_t *buf, size_t len, perf_snapshot_t *snap);
+
+/*
+ * Wrap a stored advert frame for replay
+ * return: frame length, -1 if out is too small
+ */
+int adv_frame_encode_logged(uint32_t seq, uint32_t time_ms, const uint8_t *frame, size_t frame_len,
+                            uint8_t *out, size_t size);
+
+/*
+ * Decode the replay header at the start of buf, the advert frame follows it
+ * return: header length, -1 if truncated or not a replayed advert
+ */
+int adv_frame_decode_logged(const uint8_t *buf, size_t len, uint32_t *seq, uint32_t *time_ms);
+
+#endif
@@ -0,0 +1,332 @@
+#include <string.h>
+#include "adv_json.h"
+#include "adv_parse.h"
+#include "json_writer.h"
+
+
+/*
+ * Beacon specific members
+ */
+static void adv_json_beacon(json_writer_t *w, const adv_info_t *info) {
+    const char *beacon = adv_beacon_name(info->beacon);
+    if (beacon == NULL) {
+        return;
+    }
+    json_key(w, "Beacon", false);
+    json_put_string(w, beacon, strlen(beacon));
+
+    switch (info->beacon) {
+    case ADV_BEACON_IBEACON:
+        json_key(w, "UUID", false);
+        json_put_uuid(w, info->u.ibeacon.uuid);
+        json_key(w, "Major", false);
+        json_put_uint(w, info->u.ibeacon.major);
+        json_key(w, "Minor", false);
+        json_put_uint(w, info->u.ibeacon.minor);
+        json_key(w, "TxPower", false);
+        json_put_int(w, info->u.ibeacon.measured_power);
+        break;
+    case ADV_BEACON_EDDYSTONE_UID:
+        json_key(w, "Namespace", false);
+        json_put_hex(w, info->u.eddystone_uid.namespace_id, 10);
+        json_key(w, "Instance", false);
+        json_put_hex(w, info->u.eddystone_uid.instance_id, 6);
+        json_key(w, "TxPower", false);
+        json_put_int(w, info->u.eddystone_uid.tx_power);
+        break;
+    case ADV_BEACON_EDDYSTONE_URL: {
+        char url[ADV_RECORD_DATA_MAX * 6];
+        int url_len = adv_eddystone_url_expand(&info->u.eddystone_url, url, sizeof(url));
+        if (url_len >= 0) {
+            json_key(w, "URL", false);
+            json_put_string(w, url, url_len);
+        }
+        json_key(w, "TxPower", false);
+        json_put_int(w, info->u.eddystone_url.tx_power);
+        break;
+    }
+    case ADV_BEACON_EDDYSTONE_TLM:
+        json_key(w, "Battery", false);
+        json_put_uint(w, info->u.eddystone_tlm.battery_mv);
+        json_key(w, "Temperature", false);
+        json_put_fixed(w, info->u.eddystone_tlm.temperature * 100 / 256, 2);
+        json_key(w, "AdvCount", false);
+        json_put_uint(w, info->u.eddystone_tlm.adv_count);
+        json_key(w, "Uptime", false);
+        json_put_uint(w, info->u.eddystone_tlm.uptime_ds);
+        break;
+    case ADV_BEACON_ALTBEACON:
+        json_key(w, "BeaconID", false);
+        json_put_hex(w, info->u.altbeacon.beacon_id, 20);
+        json_key(w, "TxPower", false);
+        json_put_int(w, info->u.altbeacon.ref_rssi);
+        break;
+    default:
+        break;
+    }
+}
+
+int adv_json_encode(const adv_record_t *rec, const adv_stats_t *stats, const char *esp_name,
+                    char *out, size_t size) {
+    json_writer_t w;
+    adv_info_t info;
+
+    adv_parse(rec, &info);
+
+    json_init(&w, out, size);
+    json_put_char(&w, '{');
+    json_key(&w, "EspName", true);
+    json_put_string(&w, esp_name, strlen(esp_name));
+    json_key(&w, "Name", false);
+    json_put_string(&w, (const char *)info.name, info.name_len);
+    json_key(&w, "NameLen", false);
+    json_put_uint(&w, info.name_len);
+    json_key(&w, "RSSI", false);
+    json_put_int(&w, rec->rssi);
+    json_key(&w, "bda", false);
+    json_put_hex(&w, rec->bda, ADV_BDA_LEN);
+    json_key(&w, "DeviceType", false);
+    json_put_uint(&w, rec->dev_type);
+    json_key(&w, "AdvDataLen", false);
+    json_put_uint(&w, rec->adv_data_len);
+    if (info.has_company) {
+        // Transmission order, as in the advert
+        uint8_t company[2] = { (uint8_t)info.company_id, (uint8_t)(info.company_id >> 8) };
+        json_key(&w, "ManufacturerID", false);
+        json_put_hex(&w, company, sizeof(company));
+    }
+    if (info.has_tx_power) {
+        json_key(&w, "AdvTxPower", false);
+        json_put_int(&w, info.tx_power);
+    }
+    adv_json_beacon(&w, &info);
+    if (stats) {
+        json_key(&w, "Count", false);
+        json_put_uint(&w, stats->count);
+        json_key(&w, "RSSIMin", false);
+        json_put_int(&w, stats->rssi_min);
+        json_key(&w, "RSSIMax", false);
+        json_put_int(&w, stats->rssi_max);
+        json_key(&w, "RSSIMean", false);
+        json_put_int(&w, stats->rssi_mean);
+        json_key(&w, "FirstSeen", false);
+        json_put_uint(&w, stats->first_seen_ms);
+        json_key(&w, "LastSeen", false);
+        json_put_uint(&w, stats->last_seen_ms);
+    }
+    json_put_char(&w, '}');
+
+    return json_finish(&w);
+}
+
+int adv_json_encode_timed(int64_t time_us, uint32_t error_us, char *out, size_t len, size_t size) {
+    json_writer_t w;
+
+    if (len < 2 || out[len - 1] != '}') {
+        return -1;
+    }
+    // Members appended in place of the closing brace
+    json_init(&w, &out[len - 1], size - len + 1);
+    json_key(&w, "FleetTime", false);
+    json_put_uint64(&w, (uint64_t)time_us);
+    json_key(&w, "FleetTimeError", false);
+    json_put_uint(&w, error_us);
+    json_put_char(&w, '}');
+    int n = json_finish(&w);
+
+    return n < 0 ? -1 : (int)(len - 1 + n);
+}
+
+int adv_json_encode_range(const adv_range_estimate_t *est, const char *esp_name, char *out, size_t size) {
+    json_writer_t w;
+
+    json_init(&w, out, size);
+    json_put_char(&w, '{');
+    json_key(&w, "EspName", true);
+    json_put_string(&w, esp_name, strlen(esp_name));
+    json_key(&w, "bda", false);
+    json_put_hex(&w, est->bda, ADV_BDA_LEN);
+    json_key(&w, "RSSIFiltered", false);
+    json_put_fixed(&w, est->rssi_x10, 1);
+    json_key(&w, "RefPower", false);
+    json_put_int(&w, est->ref_power);
+    json_key(&w, "Distance", false);
+    json_put_fixed(&w, est->distance_cm, 2);
+    json_put_char(&w, '}');
+
+    return json_finish(&w);
+}
+
+int adv_json_encode_presence(const adv_presence_report_t *report, const char *esp_name,
+                             char *out, size_t size) {
+    static const char *const events[] = { "enter", "leave", "here" };
+    json_writer_t w;
+
+    json_init(&w, out, size);
+    json_put_char(&w, '{');
+    json_key(&w, "EspName", true);
+    json_put_string(&w, esp_name, strlen(esp_name));
+    json_key(&w, "Event", false);
+    json_put_string(&w, events[report->event], strlen(events[report->event]));
+    json_key(&w, "bda", false);
+    json_put_hex(&w, report->bda, ADV_BDA_LEN);
+    json_key(&w, "RSSI", false);
+    json_put_int(&w, report->rssi);
+    json_key(&w, "FirstSeen", false);
+    json_put_uint(&w, report->first_seen_ms);
+    json_key(&w, "LastSeen", false);
+    json_put_uint(&w, report->last_seen_ms);
+    json_put_char(&w, '}');
+
+    return json_finish(&w);
+}
+
+int adv_json_encode_gatt(const gattc_reading_t *reading, const char *esp_name, char *out, size_t size) {
+    json_writer_t w;
+
+    json_init(&w, out, size);
+    json_put_char(&w, '{');
+    json_key(&w, "EspName", true);
+    json_put_string(&w, esp_name, strlen(esp_name));
+    json_key(&w, "bda", false);
+    json_put_hex(&w, reading->bda, ADV_BDA_LEN);
+    if (reading->fields & GATTC_READING_BATTERY) {
+        json_key(&w, "Battery", false);
+        json_put_uint(&w, reading->battery);
+    }
+    if (reading->fields & GATTC_READING_TEMPERATURE) {
+        json_key(&w, "Temperature", false);
+        json_put_fixed(&w, reading->temperature, 2);
+    }
+    if (reading->fields & GATTC_READING_HUMIDITY) {
+        json_key(&w, "Humidity", false);
+        json_put_fixed(&w, reading->humidity, 2);
+    }
+    json_key(&w, "Time", false);
+    json_put_uint(&w, reading->time_ms);
+    json_key(&w, "Duration", false);
+    json_put_uint(&w, reading->duration_ms);
+    json_put_char(&w, '}');
+
+    return json_finish(&w);
+}
+
+int adv_json_encode_logged(uint32_t seq, uint32_t time_ms, const adv_record_t *rec,
+                           const adv_stats_t *stats, const char *esp_name, char *out, size_t size) {
+    json_writer_t w;
+
+    json_init(&w, out, size);
+    json_put_char(&w, '{');
+    json_key(&w, "Seq", true);
+    json_put_uint(&w, seq);
+    json_key(&w, "Time", false);
+    json_put_uint(&w, time_ms);
+    json_key(&w, "Advert", false);
+    if (json_finish(&w) < 0) {
+        return -1;
+    }
+    // Nested object written in place, room kept for the closing brace
+    int len = adv_json_encode(rec, stats, esp_name, &out[w.len], size - w.len - 1);
+    if (len < 0) {
+        return -1;
+    }
+    w.len += len;
+    json_put_char(&w, '}');
+
+    return json_finish(&w);
+}
+
+int adv_json_encode_perf(const perf_snapshot_t *snap, const char *esp_name, bool buckets, char *out, size_t size) {
+    json_writer_t w;
+
+    json_init(&w, out, size);
+    json_put_char(&w, '{');
+    json_key(&w, "EspName", true);
+    json_put_string(&w, esp_name, strlen(esp_name));
+    json_key(&w, "Uptime", false);
+    json_put_uint(&w, snap->uptime_s);
+
+    json_key(&w, "Counters", false);
+    json_put_char(&w, '{');
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        json_key(&w, perf_counter_name(i), i == 0);
+        json_put_uint(&w, snap->counters[i]);
+    }
+    json_put_char(&w, '}');
+
+    json_key(&w, "Queue", false);
+    json_put_char(&w, '{');
+    json_key(&w, "depth", true);
+    json_put_uint(&w, snap->queue_depth);
+    json_key(&w, "high_water", false);
+    json_put_uint(&w, snap->queue_high_water);
+    json_key(&w, "pushed", false);
+    json_put_uint(&w, snap->queue_pushed);
+    json_key(&w, "popped", false);
+    json_put_uint(&w, snap->queue_popped);
+    json_key(&w, "dropped", false);
+    json_put_uint(&w, snap->queue_dropped);
+    json_key(&w, "coalesced", false);
+    json_put_uint(&w, snap->queue_coalesced);
+    json_put_char(&w, '}');
+
+    json_key(&w, "Heap", false);
+    json_put_char(&w, '{');
+    json_key(&w, "free", true);
+    json_put_uint(&w, snap->heap_free);
+    json_key(&w, "min_free", false);
+    json_put_uint(&w, snap->heap_min_free);
+    json_put_char(&w, '}');
+
+    // Lowest free stack bytes per task
+    json_key(&w, "Stacks", false);
+    json_put_char(&w, '{');
+    for (int i = 0; i < snap->stack_count; i++) {
+        const perf_stack_t *stack = &snap->stacks[i];
+        if (i) {
+            json_put_char(&w, ',');
+        }
+        json_put_string(&w, stack->name, strnlen(stack->name, PERF_NAME_LEN));
+        json_put_char(&w, ':');
+        json_put_uint(&w, stack->free_bytes);
+    }
+    json_put_char(&w, '}');
+
+    json_key(&w, "Hists", false);
+    json_put_char(&w, '{');
+    for (int i = 0; i < PERF_HISTS; i++) {
+        const perf_hist_t *hist = &snap->hists[i];
+        uint32_t first;
+        uint32_t span = perf_hist_span(hist, &first);
+        json_key(&w, perf_hist_name(i), i == 0);
+        json_put_char(&w, '{');
+        json_key(&w, "Count", true);
+        json_put_uint(&w, hist->count);
+        json_key(&w, "Max", false);
+        json_put_uint(&w, hist->max_us);
+        json_key(&w, "P50", false);
+        json_put_uint(&w, perf_percentile(hist, 500));
+        json_key(&w, "P99", false);
+        json_put_uint(&w, perf_percentile(hist, 990));
+        if (!buckets) {
+            json_put_char(&w, '}');
+            continue;
+        }
+        json_key(&w, "First", false);
+        json_put_uint(&w, first);
+        json_key(&w, "Buckets", false);
+        json_put_char(&w, '[');
+        for (uint32_t b = first; b < first + span; b++) {
+            if (b > first) {
+                json_put_char(&w, ',');
+            }
+            json_put_uint(&w, hist->buckets[b]);
+        }
+        json_put_char(&w, ']');
+        json_put_char(&w, '}');
+    }
+    json_put_char(&w, '}');
+    json_put_char(&w, '}');
+
+    return json_finish(&w);
+}
@@ -0,0 +1,76 @@
+#ifndef __ADV_JSON_H__
+#define __ADV_JSON_H__
+
+// Includes
+#include <stddef.h>
+#include "adv_record.h"
+#include "adv_table.h"
+#include "adv_range.h"
+#include "adv_presence.h"
+#include "gattc_sched.h"
+#include "perf.h"
+
+// Worst case JSON size of one advert, escaped name included
+#define ADV_JSON_MAX_LEN 640
+// Added by adv_json_encode_timed(): ,"FleetTime":<20 digits>,"FleetTimeError":<10 digits>
+#define ADV_JSON_TIMED_LEN 61
+#define ADV_JSON_RANGE_MAX_LEN 160
+#define ADV_JSON_PRESENCE_MAX_LEN 192
+#define ADV_JSON_GATT_MAX_LEN 192
+#define ADV_JSON_PERF_MAX_LEN 2048
+
+/*
+ * Serialize one scan result as a JSON object into a caller-owned buffer,
+ * name and beacon fields are decoded from the advert and its scan response
+ * stats: scan window aggregate of the device, may be NULL
+ * esp_name: tracker name, '\0' terminated
+ * return: JSON length without '\0', -1 if out is too small
+ */
+int adv_json_encode(const adv_record_t *rec, const adv_stats_t *stats, const char *esp_name,
+                    char *out, size_t size);
+
+/*
+ * Add the fleet reception time of an advert to its object, as FleetTime in us
+ * since the Unix epoch and FleetTimeError in us, see time_sync.h
+ * len: of the object at out, as returned by adv_json_encode()
+ * return: JSON length without '\0', -1 if out is too small
+ */
+int adv_json_encode_timed(int64_t time_us, uint32_t error_us, char *out, size_t len, size_t size);
+
+/*
+ * Serialize one distance estimate, Distance in meters
+ * return: JSON length without '\0', -1 if out is too small
+ */
+int adv_json_encode_range(const adv_range_estimate_t *est, const char *esp_name, char *out, size_t size);
+
+/*
+ * Serialize one presence event, Event is "enter", "leave" or "here"
+ * return: JSON length without '\0', -1 if out is too small
+ */
+int adv_json_encode_presence(const adv_presence_report_t *report, const char *esp_name,
+                             char *out, size_t size);
+
+/*
+ * Serialize one GATT reading, Battery in %, Temperature in C and Humidity in %
+ * when read, Time of the connection and Duration to the last read in ms
+ * return: JSON length without '\0', -1 if out is too small
+ */
+int adv_json_encode_gatt(const gattc_reading_t *reading, const char *esp_name, char *out, size_t size);
+
+/*
+ * Serialize a stats report, times in us, each histogram with its median, 99th
+ * percentile and its buckets from the first non-empty one ("First"), see perf.h
+ * buckets: false for the histogram summaries only, a shorter report
+ * return: JSON length without '\0', -1 if out is too small
+ */
+int adv_json_encode_perf(const perf_snapshot_t *snap, const char *esp_name, bool buckets, char *out, size_t size);
+
+/*
+ * Serialize a replayed advert as {"Seq":..,"Time":..,"Advert":{..}}, the advert
+ * being encoded as by adv_json_encode()
+ * return: JSON length without '\0', -1 if out is too small
+ */
+int adv_json_encode_logged(uint32_t seq, uint32_t time_ms, const adv_record_t *rec,
+                           const adv_stats_t *stats, const char *esp_name, char *out, size_t size);
+
+#endif
@@ -0,0 +1,369 @@
+#include <string.h>
+#include "adv_log.h"
+
+
+// Constants
+#define STATE_FREE      0xFF
+#define STATE_WRITTEN   0xFE
+#define ACKED           0x00
+
+#define HDR_MAGIC       0
+#define HDR_ERASES      4
+#define HDR_SECTOR_SEQ  8
+#define HDR_FIRST_SEQ   12
+#define HDR_DONE        16
+
+
+static inline void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t adv_log_record_size(uint8_t len) {
+    return (ADV_LOG_RECORD_HDR_LEN + len + 3) & ~3u;
+}
+
+/*
+ * CRC-8, polynomial 0x07
+ */
+static uint8_t adv_log_crc8(uint8_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (uint8_t)(crc << 1 ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint8_t adv_log_record_crc(const uint8_t *hdr, const uint8_t *payload) {
+    uint8_t crc = adv_log_crc8(0, &hdr[1], 1);
+    crc = adv_log_crc8(crc, &hdr[4], ADV_LOG_RECORD_HDR_LEN - 4);
+    return adv_log_crc8(crc, payload, hdr[1]);
+}
+
+static bool adv_log_rd(adv_log_t *log, uint32_t sector, uint32_t offset, void *buf, size_t len) {
+    if (log->flash.read(log->flash.ctx, sector * ADV_LOG_SECTOR_SIZE + offset, buf, len)) {
+        log->stats.flash_errors++;
+        return false;
+    }
+    return true;
+}
+
+static bool adv_log_wr(adv_log_t *log, uint32_t sector, uint32_t offset, const void *buf, size_t len) {
+    if (log->flash.write(log->flash.ctx, sector * ADV_LOG_SECTOR_SIZE + offset, buf, len)) {
+        log->stats.flash_errors++;
+        return false;
+    }
+    return true;
+}
+
+static inline bool adv_log_pos_eq(const adv_log_pos_t *a, const adv_log_pos_t *b) {
+    return a->sector == b->sector && a->offset == b->offset;
+}
+
+/*
+ * Move to the first record of the next sector, or to the head if pos was in
+ * the head sector
+ */
+static void adv_log_next_sector(adv_log_t *log, adv_log_pos_t *pos) {
+    if (pos->sector == log->head.sector) {
+        *pos = log->head;
+        return;
+    }
+    pos->sector = (pos->sector + 1) % log->sectors;
+    pos->offset = ADV_LOG_SECTOR_HDR_LEN;
+}
+
+/*
+ * Load the first valid record at or after pos, skipping sector ends and
+ * corrupted records. pos is left on the record.
+ * size: record size in flash, to step over it
+ * acked: record already replayed
+ * return: 1 for a record, 0 at the head, -1 on flash error
+ */
+static int adv_log_load(adv_log_t *log, adv_log_pos_t *pos, adv_log_entry_t *entry,
+                        uint32_t *size, bool *acked) {
+    uint8_t hdr[ADV_LOG_RECORD_HDR_LEN];
+
+    while (1) {
+        if (adv_log_pos_eq(pos, &log->head)) {
+            return 0;
+        }
+        if (pos->offset + ADV_LOG_RECORD_HDR_LEN > ADV_LOG_SECTOR_SIZE) {
+            adv_log_next_sector(log, pos);
+            continue;
+        }
+        if (!adv_log_rd(log, pos->sector, pos->offset, hdr, sizeof(hdr))) {
+            return -1;
+        }
+        if (hdr[0] == STATE_FREE) {
+            // End of the written part of the sector
+            adv_log_next_sector(log, pos);
+            continue;
+        }
+        *size = adv_log_record_size(hdr[1]);
+        if (hdr[0] != STATE_WRITTEN || pos->offset + *size > ADV_LOG_SECTOR_SIZE ||
+            !adv_log_rd(log, pos->sector, pos->offset + ADV_LOG_RECORD_HDR_LEN, entry->payload, hdr[1]) ||
+            adv_log_record_crc(hdr, entry->payload) != hdr[2]) {
+            // Lengths cannot be trusted, skip the rest of the sector
+            log->stats.corrupted++;
+            adv_log_next_sector(log, pos);
+            continue;
+        }
+        entry->len = hdr[1];
+        entry->seq = get_le32(&hdr[4]);
+        entry->time_ms = get_le32(&hdr[8]);
+        *acked = hdr[3] == ACKED;
+        return 1;
+    }
+}
+
+/*
+ * Erase a sector and write its header, keeping its erase count
+ */
+static bool adv_log_format(adv_log_t *log, uint32_t sector, uint32_t sector_seq) {
+    uint8_t hdr[ADV_LOG_SECTOR_HDR_LEN];
+    uint32_t erases = 0;
+
+    if (adv_log_rd(log, sector, 0, hdr, sizeof(hdr)) && get_le32(&hdr[HDR_MAGIC]) == ADV_LOG_MAGIC) {
+        erases = get_le32(&hdr[HDR_ERASES]);
+    }
+    if (log->flash.erase(log->flash.ctx, sector * ADV_LOG_SECTOR_SIZE)) {
+        log->stats.flash_errors++;
+        return false;
+    }
+    erases++;
+    log->stats.erases++;
+    if (erases > log->stats.max_erase_count) {
+        log->stats.max_erase_count = erases;
+    }
+    put_le32(&hdr[HDR_MAGIC], ADV_LOG_MAGIC);
+    put_le32(&hdr[HDR_ERASES], erases);
+    put_le32(&hdr[HDR_SECTOR_SEQ], sector_seq);
+    put_le32(&hdr[HDR_FIRST_SEQ], log->next_seq);
+    put_le32(&hdr[HDR_DONE], 0xFFFFFFFF);
+    // Magic last: a header cut short by a power loss is not taken as valid
+    return adv_log_wr(log, sector, HDR_ERASES, &hdr[HDR_ERASES], sizeof(hdr) - HDR_ERASES) &&
+           adv_log_wr(log, sector, HDR_MAGIC, &hdr[HDR_MAGIC], HDR_ERASES);
+}
+
+/*
+ * Start writing in the next sector, dropping its records if they were not replayed
+ */
+static bool adv_log_rotate(adv_log_t *log) {
+    uint32_t next = (log->head.sector + 1) % log->sectors;
+
+    if (log->pending && log->tail.sector == next) {
+        adv_log_entry_t entry;
+        uint32_t size;
+        bool acked;
+        while (log->tail.sector == next && adv_log_load(log, &log->tail, &entry, &size, &acked) > 0 &&
+               log->tail.sector == next) {
+            log->stats.dropped++;
+            log->pending--;
+            log->tail.offset += size;
+        }
+        log->tail.sector = (next + 1) % log->sectors;
+        log->tail.offset = ADV_LOG_SECTOR_HDR_LEN;
+        if (log->read.sector == next) {
+            log->read = log->tail;
+        }
+    }
+    if (!adv_log_format(log, next, log->head_sector_seq + 1)) {
+        return false;
+    }
+    log->head_sector_seq++;
+    log->head.sector = next;
+    log->head.offset = ADV_LOG_SECTOR_HDR_LEN;
+    if (log->pending == 0) {
+        log->tail = log->head;
+        log->read = log->head;
+    }
+    return true;
+}
+
+bool adv_log_mount(adv_log_t *log, const adv_log_flash_t *flash) {
+    uint8_t hdr[ADV_LOG_SECTOR_HDR_LEN];
+    adv_log_entry_t entry;
+    uint32_t size;
+    bool acked, found = false;
+    int ret;
+
+    memset(log, 0, sizeof(*log));
+    log->flash = *flash;
+    log->sectors = flash->size / ADV_LOG_SECTOR_SIZE;
+    if (log->sectors < 2) {
+        return false;
+    }
+
+    // Head: valid sector of highest sequence
+    for (uint32_t s = 0; s < log->sectors; s++) {
+        if (!adv_log_rd(log, s, 0, hdr, sizeof(hdr))) {
+            return false;
+        }
+        if (get_le32(&hdr[HDR_MAGIC]) != ADV_LOG_MAGIC) {
+            continue;
+        }
+        uint32_t sector_seq = get_le32(&hdr[HDR_SECTOR_SEQ]);
+        if (get_le32(&hdr[HDR_ERASES]) > log->stats.max_erase_count) {
+            log->stats.max_erase_count = get_le32(&hdr[HDR_ERASES]);
+        }
+        if (!found || (int32_t)(sector_seq - log->head_sector_seq) > 0) {
+            found = true;
+            log->head.sector = s;
+            log->head_sector_seq = sector_seq;
+            log->next_seq = get_le32(&hdr[HDR_FIRST_SEQ]);
+        }
+    }
+    if (!found) {
+        // Blank area
+        log->head.offset = ADV_LOG_SECTOR_HDR_LEN;
+        log->tail = log->head;
+        log->read = log->head;
+        return adv_log_format(log, 0, 0);
+    }
+
+    // Write position: after the last valid record of the head sector
+    log->head.offset = ADV_LOG_SECTOR_SIZE;
+    for (uint32_t offset = ADV_LOG_SECTOR_HDR_LEN; offset + ADV_LOG_RECORD_HDR_LEN <= ADV_LOG_SECTOR_SIZE; ) {
+        uint8_t rec[ADV_LOG_RECORD_HDR_LEN];
+        if (!adv_log_rd(log, log->head.sector, offset, rec, sizeof(rec))) {
+            return false;
+        }
+        if (rec[0] == STATE_FREE) {
+            log->head.offset = offset;
+            break;
+        }
+        size = adv_log_record_size(rec[1]);
+        if (rec[0] != STATE_WRITTEN || offset + size > ADV_LOG_SECTOR_SIZE ||
+            !adv_log_rd(log, log->head.sector, offset + ADV_LOG_RECORD_HDR_LEN, entry.payload, rec[1]) ||
+            adv_log_record_crc(rec, entry.payload) != rec[2]) {
+            // Interrupted write, the sector is closed
+            log->stats.corrupted++;
+            break;
+        }
+        log->next_seq = get_le32(&rec[4]) + 1;
+        offset += size;
+    }
+
+    // Oldest sector of the unbroken sequence before the head
+    adv_log_pos_t pos = { log->head.sector, ADV_LOG_SECTOR_HDR_LEN };
+    for (uint32_t k = 1; k < log->sectors; k++) {
+        uint32_t s = (log->head.sector + log->sectors - k) % log->sectors;
+        if (!adv_log_rd(log, s, 0, hdr, sizeof(hdr))) {
+            return false;
+        }
+        if (get_le32(&hdr[HDR_MAGIC]) != ADV_LOG_MAGIC ||
+            get_le32(&hdr[HDR_SECTOR_SEQ]) != log->head_sector_seq - k) {
+            break;
+        }
+        // Fully replayed sectors are not scanned
+        if (get_le32(&hdr[HDR_DONE]) == 0) {
+            break;
+        }
+        pos.sector = s;
+    }
+
+    // Oldest record not replayed, and how many follow
+    while ((ret = adv_log_load(log, &pos, &entry, &size, &acked)) > 0 && acked) {
+        pos.offset += size;
+    }
+    if (ret < 0) {
+        return false;
+    }
+    log->tail = pos;
+    log->read = pos;
+    while ((ret = adv_log_load(log, &pos, &entry, &size, &acked)) > 0) {
+        log->pending++;
+        pos.offset += size;
+    }
+    if (ret < 0) {
+        return false;
+    }
+    if (log->head.offset == ADV_LOG_SECTOR_SIZE) {
+        return adv_log_rotate(log);
+    }
+    return true;
+}
+
+bool adv_log_append(adv_log_t *log, uint32_t time_ms, const uint8_t *payload, size_t len) {
+    uint8_t rec[ADV_LOG_RECORD_HDR_LEN + ADV_LOG_PAYLOAD_MAX + 3];
+
+    if (len > ADV_LOG_PAYLOAD_MAX) {
+        return false;
+    }
+    uint32_t size = adv_log_record_size((uint8_t)len);
+    if (log->head.offset + size > ADV_LOG_SECTOR_SIZE && !adv_log_rotate(log)) {
+        return false;
+    }
+
+    memset(rec, 0xFF, size);
+    rec[0] = STATE_WRITTEN;
+    rec[1] = (uint8_t)len;
+    put_le32(&rec[4], log->next_seq);
+    put_le32(&rec[8], time_ms);
+    memcpy(&rec[ADV_LOG_RECORD_HDR_LEN], payload, len);
+    rec[2] = adv_log_record_crc(rec, payload);
+    rec[3] = 0xFF;
+
+    bool ok = adv_log_wr(log, log->head.sector, log->head.offset, rec, size);
+    // Even on error, the area may have been partly written
+    log->head.offset += size;
+    if (!ok) {
+        return false;
+    }
+    log->next_seq++;
+    log->pending++;
+    log->stats.appended++;
+    return true;
+}
+
+bool adv_log_read(adv_log_t *log, adv_log_entry_t *entry) {
+    uint32_t size;
+    bool acked;
+
+    if (adv_log_load(log, &log->read, entry, &size, &acked) <= 0) {
+        return false;
+    }
+    log->read.offset += size;
+    return true;
+}
+
+void adv_log_ack(adv_log_t *log, uint32_t count) {
+    static const uint8_t acked_mark = ACKED;
+    static const uint8_t done[4] = { 0, 0, 0, 0 };
+    adv_log_entry_t entry;
+    uint32_t size;
+    bool acked;
+
+    while (count-- && !adv_log_pos_eq(&log->tail, &log->read)) {
+        uint32_t sector = log->tail.sector;
+        if (adv_log_load(log, &log->tail, &entry, &size, &acked) <= 0) {
+            break;
+        }
+        if (log->tail.sector != sector) {
+            // Sector replayed, skipped at mount
+            adv_log_wr(log, sector, HDR_DONE, done, sizeof(done));
+        }
+        adv_log_wr(log, log->tail.sector, log->tail.offset + 3, &acked_mark, 1);
+        log->tail.offset += size;
+        if (log->pending) {
+            log->pending--;
+        }
+        log->stats.acked++;
+    }
+    if (adv_log_pos_eq(&log->tail, &log->head)) {
+        log->pending = 0;
+    }
+}
+
+void adv_log_rewind(adv_log_t *log) {
+    log->read = log->tail;
+}
@@ -0,0 +1,116 @@
+#ifndef __ADV_LOG_H__
+#define __ADV_LOG_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Append only circular log of small records in a flash partition, to keep
+ * adverts while the network is down and replay them later.
+ *
+ * Sector layout, ADV_LOG_SECTOR_SIZE bytes:
+ *  [0..3]   magic, ADV_LOG_MAGIC
+ *  [4..7]   erase count, carried over each erase
+ *  [8..11]  sector sequence, +1 for each new sector, finds the head at mount
+ *  [12..15] sequence number of the first record
+ *  [16..19] 0 once all its records are replayed, 0xFFFFFFFF before
+ *  [20..]   records, each aligned on 4 bytes:
+ *           [0] state 0xFE, 0xFF when free
+ *           [1] payload length
+ *           [2] crc8 of [1], [4..] and the payload
+ *           [3] 0x00 once replayed, 0xFF before
+ *           [4..7] sequence number, [8..11] time_ms, then the payload
+ * Multi-byte fields are little endian. Sectors are used in turn, so erases
+ * are spread evenly; the oldest records are dropped when the log is full.
+ */
+#define ADV_LOG_SECTOR_SIZE     4096
+#define ADV_LOG_MAGIC           0x474F4C41  // "ALOG"
+#define ADV_LOG_SECTOR_HDR_LEN  20
+#define ADV_LOG_RECORD_HDR_LEN  12
+#define ADV_LOG_PAYLOAD_MAX     255
+
+/*
+ * Flash access, offsets are relative to the start of the log area
+ * return: 0 on success
+ */
+typedef struct {
+    int      (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+    int      (*write)(void *ctx, uint32_t offset, const void *buf, size_t len);
+    int      (*erase)(void *ctx, uint32_t offset);     // One sector
+    void      *ctx;
+    uint32_t   size;                                    // Multiple of ADV_LOG_SECTOR_SIZE
+} adv_log_flash_t;
+
+typedef struct {
+    uint32_t sector;
+    uint32_t offset;
+} adv_log_pos_t;
+
+typedef struct {
+    uint32_t appended;
+    uint32_t acked;
+    uint32_t dropped;           // Not replayed before being overwritten
+    uint32_t corrupted;         // Records or sectors skipped, e.g. power loss while writing
+    uint32_t erases;
+    uint32_t max_erase_count;
+    uint32_t flash_errors;
+} adv_log_stats_t;
+
+typedef struct {
+    adv_log_flash_t  flash;
+    uint32_t         sectors;
+    uint32_t         head_sector_seq;
+    uint32_t         head_erase_count;
+    adv_log_pos_t    head;      // Next write
+    adv_log_pos_t    tail;      // Oldest record not acknowledged
+    adv_log_pos_t    read;      // Next record to replay
+    uint32_t         next_seq;
+    uint32_t         pending;   // Records not acknowledged
+    adv_log_stats_t  stats;
+} adv_log_t;
+
+/*
+ * One record read back
+ */
+typedef struct {
+    uint32_t seq;
+    uint32_t time_ms;
+    uint8_t  len;
+    uint8_t  payload[ADV_LOG_PAYLOAD_MAX];
+} adv_log_entry_t;
+
+/*
+ * Find the head and the oldest pending record, formats a blank area
+ * return: false on flash error or if the area is smaller than 2 sectors
+ */
+bool adv_log_mount(adv_log_t *log, const adv_log_flash_t *flash);
+
+/*
+ * Append a record, drops the oldest sector if the log is full
+ * return: false on flash error or invalid length
+ */
+bool adv_log_append(adv_log_t *log, uint32_t time_ms, const uint8_t *payload, size_t len);
+
+/*
+ * Next record to replay, the read position moves past it
+ * return: false when everything has been read
+ */
+bool adv_log_read(adv_log_t *log, adv_log_entry_t *entry);
+
+/*
+ * Mark the count oldest records read as replayed
+ */
+void adv_log_ack(adv_log_t *log, uint32_t count);
+
+/*
+ * Read again from the oldest record not acknowledged, e.g. after a failed send
+ */
+void adv_log_rewind(adv_log_t *log);
+
+static inline uint32_t adv_log_pending(const adv_log_t *log) {
+    return log->pending;
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include <string.h>
+#include "adv_merge.h"
+
+
+/*
+ * Single writer counters, read from other tasks
+ */
+static void adv_merge_count(uint32_t *counter, uint32_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+bool adv_merge_init(adv_merge_t *merge, adv_merge_entry_t *entries, uint32_t size, uint32_t timeout_ms) {
+    if (size == 0) {
+        return false;
+    }
+    memset(merge, 0, sizeof(*merge));
+    memset(entries, 0, size * sizeof(*entries));
+    merge->entries = entries;
+    merge->size = size;
+    merge->timeout_ms = timeout_ms;
+    return true;
+}
+
+static adv_merge_entry_t *adv_merge_find(adv_merge_t *merge, const uint8_t *bda) {
+    for (uint32_t i = 0; i < merge->size; i++) {
+        adv_merge_entry_t *entry = &merge->entries[i];
+        if (entry->used && memcmp(entry->rec.bda, bda, ADV_BDA_LEN) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * return: the advert waiting the longest, NULL if none
+ */
+static adv_merge_entry_t *adv_merge_oldest(adv_merge_t *merge) {
+    adv_merge_entry_t *oldest = NULL;
+    for (uint32_t i = 0; i < merge->size && merge->count; i++) {
+        adv_merge_entry_t *entry = &merge->entries[i];
+        if (entry->used && (oldest == NULL || (int32_t)(entry->rec.time_ms - oldest->rec.time_ms) < 0)) {
+            oldest = entry;
+        }
+    }
+    return oldest;
+}
+
+static void adv_merge_release(adv_merge_t *merge, adv_merge_entry_t *entry) {
+    entry->used = false;
+    merge->count--;
+    adv_merge_entry_t *oldest = adv_merge_oldest(merge);
+    if (oldest) {
+        merge->due_ms = oldest->rec.time_ms + merge->timeout_ms;
+    }
+}
+
+/*
+ * Cache a scannable advert
+ * return: true if out is set with an advert that has to go first
+ */
+static bool adv_merge_hold(adv_merge_t *merge, const adv_record_t *rec, adv_record_t *out) {
+    adv_merge_entry_t *entry = adv_merge_find(merge, rec->bda);
+    bool emit = false;
+
+    adv_merge_count(&merge->stats.adverts, 1);
+    if (entry == NULL && merge->count == merge->size) {
+        entry = adv_merge_oldest(merge);
+        adv_merge_count(&merge->stats.evicted, 1);
+    }
+    if (entry) {
+        // The response of the previous advert did not come
+        *out = entry->rec;
+        adv_merge_count(&merge->stats.expired, 1);
+        adv_merge_release(merge, entry);
+        emit = true;
+    } else {
+        for (entry = merge->entries; entry->used; entry++) {
+        }
+    }
+    entry->rec = *rec;
+    entry->used = true;
+    if (merge->count++ == 0) {
+        merge->due_ms = rec->time_ms + merge->timeout_ms;
+    }
+    return emit;
+}
+
+bool adv_merge_put(adv_merge_t *merge, const adv_record_t *rec, adv_merge_kind_t kind, adv_record_t *out) {
+    if (kind == ADV_MERGE_ADVERT) {
+        return adv_merge_hold(merge, rec, out);
+    }
+    if (kind != ADV_MERGE_RESPONSE) {
+        *out = *rec;
+        return true;
+    }
+
+    // Response data after the advertising data, or alone
+    const uint8_t *rsp = rec->data;
+    uint32_t len = rec->adv_data_len;
+    if (rec->scan_rsp_len) {
+        rsp += rec->adv_data_len;
+        len = rec->scan_rsp_len;
+    }
+    adv_merge_count(&merge->stats.responses, 1);
+    adv_merge_count(&merge->stats.airtime_us, ADV_MERGE_SCAN_REQ_US + 2 * ADV_MERGE_T_IFS_US +
+                                              ADV_MERGE_SCAN_RSP_US + 8 * len);
+
+    adv_merge_entry_t *entry = adv_merge_find(merge, rec->bda);
+    if (entry == NULL || (rec->adv_data_len && rec->scan_rsp_len)) {
+        // Complete already, as some stacks report it, or too late
+        if (entry) {
+            adv_merge_count(&merge->stats.merged, 1);
+            adv_merge_release(merge, entry);
+        } else if (!(rec->adv_data_len && rec->scan_rsp_len)) {
+            adv_merge_count(&merge->stats.orphans, 1);
+        }
+        *out = *rec;
+        return true;
+    }
+
+    *out = entry->rec;
+    if (len > ADV_RECORD_DATA_MAX - out->adv_data_len) {
+        len = ADV_RECORD_DATA_MAX - out->adv_data_len;
+    }
+    memcpy(&out->data[out->adv_data_len], rsp, len);
+    out->scan_rsp_len = (uint8_t)len;
+    adv_merge_count(&merge->stats.merged, 1);
+    adv_merge_release(merge, entry);
+    return true;
+}
+
+bool adv_merge_expire(adv_merge_t *merge, uint32_t now_ms, bool all, adv_record_t *out) {
+    if (merge->count == 0 || (!all && (int32_t)(now_ms - merge->due_ms) < 0)) {
+        return false;
+    }
+    adv_merge_entry_t *entry = adv_merge_oldest(merge);
+    *out = entry->rec;
+    adv_merge_count(&merge->stats.expired, 1);
+    adv_merge_release(merge, entry);
+    return true;
+}
+
+void adv_merge_get_stats(const adv_merge_t *merge, adv_merge_stats_t *stats) {
+    stats->adverts = __atomic_load_n(&merge->stats.adverts, __ATOMIC_RELAXED);
+    stats->responses = __atomic_load_n(&merge->stats.responses, __ATOMIC_RELAXED);
+    stats->merged = __atomic_load_n(&merge->stats.merged, __ATOMIC_RELAXED);
+    stats->expired = __atomic_load_n(&merge->stats.expired, __ATOMIC_RELAXED);
+    stats->evicted = __atomic_load_n(&merge->stats.evicted, __ATOMIC_RELAXED);
+    stats->orphans = __atomic_load_n(&merge->stats.orphans, __ATOMIC_RELAXED);
+    stats->airtime_us = __atomic_load_n(&merge->stats.airtime_us, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,81 @@
+#ifndef __ADV_MERGE_H__
+#define __ADV_MERGE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+
+/*
+ * Scan response merging, for active scanning.
+ * The advert of a scannable device and its scan response are two scan
+ * results. The advert waits in a small cache, by BD address, until the
+ * response comes and one record is emitted with both, advertising data then
+ * scan response data as in scan_rst.ble_adv. An advert is emitted alone when
+ * no response came within timeout_ms, when the next advert of the device
+ * comes first, or when it is the oldest of a full cache. Other results go
+ * straight through.
+ * Single task: the GAP callback.
+ */
+
+// Air time of a scan request and its response, LE 1M: 8 us per byte
+#define ADV_MERGE_T_IFS_US      150     // Between advert and request, request and response
+#define ADV_MERGE_SCAN_REQ_US   176     // Preamble, access address, header, ScanA, AdvA, CRC
+#define ADV_MERGE_SCAN_RSP_US   128     // The same, AdvA only, without the response data
+
+typedef enum {
+    ADV_MERGE_PASS = 0,         // Not scannable, or passive scanning
+    ADV_MERGE_ADVERT,           // Scannable advert, ADV_IND or ADV_SCAN_IND
+    ADV_MERGE_RESPONSE,         // SCAN_RSP
+} adv_merge_kind_t;
+
+typedef struct {
+    uint32_t adverts;           // Scannable adverts cached
+    uint32_t responses;         // Scan responses received
+    uint32_t merged;            // Responses joined to their advert
+    uint32_t expired;           // Adverts emitted without response
+    uint32_t evicted;           // Of those, pushed out of a full cache
+    uint32_t orphans;           // Responses without advert, emitted alone
+    uint32_t airtime_us;        // Scan requests and responses received, on air, wraps
+} adv_merge_stats_t;
+
+typedef struct {
+    adv_record_t rec;
+    bool         used;
+} adv_merge_entry_t;
+
+typedef struct {
+    adv_merge_entry_t *entries;
+    uint32_t           size;
+    uint32_t           count;
+    uint32_t           timeout_ms;
+    uint32_t           due_ms;      // Earliest expiry, when count > 0
+    adv_merge_stats_t  stats;
+} adv_merge_t;
+
+/*
+ * Initialize the cache over caller-provided entries
+ * return: false if size is 0
+ */
+bool adv_merge_init(adv_merge_t *merge, adv_merge_entry_t *entries, uint32_t size, uint32_t timeout_ms);
+
+/*
+ * Account one scan result
+ * out: record to emit, the merged one, rec, or an advert that waited
+ * return: true if out is set
+ */
+bool adv_merge_put(adv_merge_t *merge, const adv_record_t *rec, adv_merge_kind_t kind, adv_record_t *out);
+
+/*
+ * Emit one advert that waited timeout_ms since its reception, any if all.
+ * Call until false.
+ * return: true if out is set
+ */
+bool adv_merge_expire(adv_merge_t *merge, uint32_t now_ms, bool all, adv_record_t *out);
+
+/*
+ * Snapshot of the counters, from any task
+ */
+void adv_merge_get_stats(const adv_merge_t *merge, adv_merge_stats_t *stats);
+
+#endif
@@ -0,0 +1,294 @@
+#include <string.h>
+#include "adv_parse.h"
+
+
+// Constants
+#define COMPANY_APPLE           0x004C
+#define EDDYSTONE_UUID          0xFEAA
+#define EDDYSTONE_FRAME_UID     0x00
+#define EDDYSTONE_FRAME_URL     0x10
+#define EDDYSTONE_FRAME_TLM     0x20
+
+static const char *const url_schemes[] = {
+    "http://www.", "https://www.", "http://", "https://",
+};
+
+static const char *const url_suffixes[] = {
+    ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+    ".com", ".org", ".edu", ".net", ".info", ".biz", ".gov",
+};
+
+
+static inline uint16_t get_be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[1] << 8 | p[0]);
+}
+
+static inline uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+void adv_iter_init(adv_iter_t *it, const uint8_t *data, size_t len) {
+    it->data = data;
+    it->len = len;
+    it->pos = 0;
+}
+
+bool adv_iter_next(adv_iter_t *it, adv_field_t *field) {
+    if (it->pos >= it->len) {
+        return false;
+    }
+    uint8_t len = it->data[it->pos];
+    // Zero length: early end of the significant part
+    if (len == 0 || it->pos + 1 + len > it->len) {
+        it->pos = it->len;
+        return false;
+    }
+    field->type = it->data[it->pos + 1];
+    field->len = len - 1;
+    field->data = &it->data[it->pos + 2];
+    it->pos += 1 + len;
+    return true;
+}
+
+/*
+ * Manufacturer specific data: iBeacon and AltBeacon
+ */
+static void adv_parse_manufacturer(const adv_field_t *field, adv_info_t *info) {
+    const uint8_t *d = field->data;
+    if (field->len < 2) {
+        return;
+    }
+    info->has_company = true;
+    info->company_id = get_le16(d);
+
+    if (field->len == 25 && info->company_id == COMPANY_APPLE && d[2] == 0x02 && d[3] == 0x15) {
+        info->beacon = ADV_BEACON_IBEACON;
+        info->u.ibeacon.uuid = &d[4];
+        info->u.ibeacon.major = get_be16(&d[20]);
+        info->u.ibeacon.minor = get_be16(&d[22]);
+        info->u.ibeacon.measured_power = (int8_t)d[24];
+    } else if (field->len == 26 && d[2] == 0xBE && d[3] == 0xAC) {
+        info->beacon = ADV_BEACON_ALTBEACON;
+        info->u.altbeacon.beacon_id = &d[4];
+        info->u.altbeacon.ref_rssi = (int8_t)d[24];
+        info->u.altbeacon.mfg_reserved = d[25];
+    }
+}
+
+/*
+ * 16 bits UUID service data: Eddystone
+ */
+static void adv_parse_service_data(const adv_field_t *field, adv_info_t *info) {
+    const uint8_t *d = field->data;
+    if (field->len < 3 || get_le16(d) != EDDYSTONE_UUID) {
+        return;
+    }
+    switch (d[2]) {
+    case EDDYSTONE_FRAME_UID:
+        // RFU bytes are optional
+        if (field->len >= 20) {
+            info->beacon = ADV_BEACON_EDDYSTONE_UID;
+            info->u.eddystone_uid.tx_power = (int8_t)d[3];
+            info->u.eddystone_uid.namespace_id = &d[4];
+            info->u.eddystone_uid.instance_id = &d[14];
+        }
+        break;
+    case EDDYSTONE_FRAME_URL:
+        if (field->len >= 5) {
+            info->beacon = ADV_BEACON_EDDYSTONE_URL;
+            info->u.eddystone_url.tx_power = (int8_t)d[3];
+            info->u.eddystone_url.scheme = d[4];
+            info->u.eddystone_url.url = &d[5];
+            info->u.eddystone_url.url_len = field->len - 5;
+        }
+        break;
+    case EDDYSTONE_FRAME_TLM:
+        if (field->len >= 16 && d[3] == 0x00) {
+            info->beacon = ADV_BEACON_EDDYSTONE_TLM;
+            info->u.eddystone_tlm.version = d[3];
+            info->u.eddystone_tlm.battery_mv = get_be16(&d[4]);
+            info->u.eddystone_tlm.temperature = (int16_t)get_be16(&d[6]);
+            info->u.eddystone_tlm.adv_count = get_be32(&d[8]);
+            info->u.eddystone_tlm.uptime_ds = get_be32(&d[12]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void adv_parse_data(const uint8_t *data, size_t len, adv_info_t *info) {
+    adv_iter_t it;
+    adv_field_t field;
+
+    adv_iter_init(&it, data, len);
+    while (adv_iter_next(&it, &field)) {
+        switch (field.type) {
+        case ADV_TYPE_FLAGS:
+            if (field.len >= 1) {
+                info->has_flags = true;
+                info->flags = field.data[0];
+            }
+            break;
+        case ADV_TYPE_NAME_SHORT:
+            if (info->name) {
+                break;
+            }
+            // Fall through
+        case ADV_TYPE_NAME_CMPL:
+            info->name = field.data;
+            info->name_len = field.len;
+            break;
+        case ADV_TYPE_TX_POWER:
+            if (field.len >= 1) {
+                info->has_tx_power = true;
+                info->tx_power = (int8_t)field.data[0];
+            }
+            break;
+        case ADV_TYPE_SERVICE_DATA16:
+            adv_parse_service_data(&field, info);
+            break;
+        case ADV_TYPE_MANUFACTURER:
+            adv_parse_manufacturer(&field, info);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void adv_parse(const adv_record_t *rec, adv_info_t *info) {
+    size_t adv_len = rec->adv_data_len;
+    size_t rsp_len = rec->scan_rsp_len;
+
+    memset(info, 0, sizeof(*info));
+    if (adv_len > ADV_RECORD_DATA_MAX) {
+        adv_len = ADV_RECORD_DATA_MAX;
+    }
+    if (rsp_len > ADV_RECORD_DATA_MAX - adv_len) {
+        rsp_len = ADV_RECORD_DATA_MAX - adv_len;
+    }
+    adv_parse_data(rec->data, adv_len, info);
+    adv_parse_data(&rec->data[adv_len], rsp_len, info);
+}
+
+/*
+ * Service UUID lookup of the GATT client, see adv_parse.h
+ */
+bool adv_has_service16(const uint8_t *data, size_t len, uint16_t uuid) {
+    adv_iter_t it;
+    adv_field_t field;
+
+    adv_iter_init(&it, data, len);
+    while (adv_iter_next(&it, &field)) {
+        switch (field.type) {
+        case ADV_TYPE_UUID16_MORE:
+        case ADV_TYPE_UUID16_CMPL:
+            for (uint8_t i = 0; i + 2 <= field.len; i += 2) {
+                if (get_le16(&field.data[i]) == uuid) {
+                    return true;
+                }
+            }
+            break;
+        case ADV_TYPE_SERVICE_DATA16:
+            if (field.len >= 2 && get_le16(field.data) == uuid) {
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+static uint32_t fingerprint_add(uint32_t hash, uint8_t type, const uint8_t *data, size_t len) {
+    hash = (hash ^ type) * 16777619u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t adv_fingerprint(const uint8_t *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    bool found = false;
+    adv_iter_t it;
+    adv_field_t field;
+
+    adv_iter_init(&it, data, len);
+    while (adv_iter_next(&it, &field)) {
+        size_t n = field.len;
+        if (field.type >= ADV_TYPE_UUID16_MORE && field.type <= ADV_TYPE_UUID128_CMPL) {
+            // Lists of any UUID size
+        } else if (field.type == ADV_TYPE_APPEARANCE ||
+                   field.type == ADV_TYPE_MANUFACTURER || field.type == ADV_TYPE_SERVICE_DATA16) {
+            // Appearance, company or service UUID, not the values
+            n = n < 2 ? n : 2;
+        } else {
+            continue;
+        }
+        hash = fingerprint_add(hash, field.type, field.data, n);
+        found = true;
+    }
+    if (!found) {
+        return 0;
+    }
+    return hash ? hash : 1;
+}
+
+/*
+ * Append n bytes, keeping room for the final '\0'
+ */
+static bool url_append(char *out, size_t size, size_t *len, const char *s, size_t n) {
+    if (*len + n >= size) {
+        return false;
+    }
+    memcpy(&out[*len], s, n);
+    *len += n;
+    return true;
+}
+
+int adv_eddystone_url_expand(const adv_eddystone_url_t *url, char *out, size_t size) {
+    size_t len = 0;
+    const size_t schemes = sizeof(url_schemes) / sizeof(url_schemes[0]);
+    const size_t suffixes = sizeof(url_suffixes) / sizeof(url_suffixes[0]);
+
+    if (url->scheme >= schemes ||
+        !url_append(out, size, &len, url_schemes[url->scheme], strlen(url_schemes[url->scheme]))) {
+        return -1;
+    }
+    for (uint8_t i = 0; i < url->url_len; i++) {
+        uint8_t c = url->url[i];
+        bool ok;
+        if (c < suffixes) {
+            ok = url_append(out, size, &len, url_suffixes[c], strlen(url_suffixes[c]));
+        } else {
+            ok = url_append(out, size, &len, (const char *)&url->url[i], 1);
+        }
+        if (!ok) {
+            return -1;
+        }
+    }
+    out[len] = '\0';
+    return (int)len;
+}
+
+const char *adv_beacon_name(adv_beacon_t beacon) {
+    switch (beacon) {
+    case ADV_BEACON_IBEACON:
+        return "iBeacon";
+    case ADV_BEACON_EDDYSTONE_UID:
+        return "EddystoneUID";
+    case ADV_BEACON_EDDYSTONE_URL:
+        return "EddystoneURL";
+    case ADV_BEACON_EDDYSTONE_TLM:
+        return "EddystoneTLM";
+    case ADV_BEACON_ALTBEACON:
+        return "AltBeacon";
+    default:
+        return NULL;
+    }
+}
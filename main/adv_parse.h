@@ -0,0 +1,159 @@
+#ifndef __ADV_PARSE_H__
+#define __ADV_PARSE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "adv_record.h"
+
+// AD types, Bluetooth assigned numbers
+#define ADV_TYPE_FLAGS          0x01
+#define ADV_TYPE_UUID16_MORE    0x02
+#define ADV_TYPE_UUID16_CMPL    0x03
+#define ADV_TYPE_UUID128_CMPL   0x07
+#define ADV_TYPE_NAME_SHORT     0x08
+#define ADV_TYPE_NAME_CMPL      0x09
+#define ADV_TYPE_TX_POWER       0x0A
+#define ADV_TYPE_SERVICE_DATA16 0x16
+#define ADV_TYPE_APPEARANCE     0x19
+#define ADV_TYPE_MANUFACTURER   0xFF
+
+/*
+ * One length-type-value AD structure, data points into the advert
+ */
+typedef struct {
+    uint8_t        type;
+    uint8_t        len;
+    const uint8_t *data;
+} adv_field_t;
+
+/*
+ * Iterator over the AD structures of a buffer, never reads past len
+ */
+typedef struct {
+    const uint8_t *data;
+    size_t         len;
+    size_t         pos;
+} adv_iter_t;
+
+void adv_iter_init(adv_iter_t *it, const uint8_t *data, size_t len);
+
+/*
+ * return: false at the end of the data, on a zero length structure or on a
+ * structure truncated by len
+ */
+bool adv_iter_next(adv_iter_t *it, adv_field_t *field);
+
+typedef enum {
+    ADV_BEACON_NONE = 0,
+    ADV_BEACON_IBEACON,
+    ADV_BEACON_EDDYSTONE_UID,
+    ADV_BEACON_EDDYSTONE_URL,
+    ADV_BEACON_EDDYSTONE_TLM,
+    ADV_BEACON_ALTBEACON,
+} adv_beacon_t;
+
+/*
+ * iBeacon, manufacturer data 4C 00 02 15
+ */
+typedef struct {
+    const uint8_t *uuid;            // 16 bytes
+    uint16_t       major;
+    uint16_t       minor;
+    int8_t         measured_power;  // RSSI at 1 m
+} adv_ibeacon_t;
+
+/*
+ * Eddystone, service data of UUID 0xFEAA
+ */
+typedef struct {
+    int8_t         tx_power;        // At 0 m
+    const uint8_t *namespace_id;    // 10 bytes
+    const uint8_t *instance_id;     // 6 bytes
+} adv_eddystone_uid_t;
+
+typedef struct {
+    int8_t         tx_power;        // At 0 m
+    uint8_t        scheme;
+    const uint8_t *url;             // Encoded, see adv_eddystone_url_expand()
+    uint8_t        url_len;
+} adv_eddystone_url_t;
+
+typedef struct {
+    uint8_t  version;
+    uint16_t battery_mv;
+    int16_t  temperature;           // 8.8 fixed point, degrees Celsius
+    uint32_t adv_count;
+    uint32_t uptime_ds;             // Tenth of seconds
+} adv_eddystone_tlm_t;
+
+/*
+ * AltBeacon, manufacturer data <mfg id> BE AC
+ */
+typedef struct {
+    const uint8_t *beacon_id;       // 20 bytes
+    int8_t         ref_rssi;        // RSSI at 1 m
+    uint8_t        mfg_reserved;
+} adv_altbeacon_t;
+
+/*
+ * Everything the tracker uses from an advert and its scan response, decoded in
+ * a single pass. Pointers refer to the parsed buffer.
+ */
+typedef struct {
+    const uint8_t *name;
+    uint8_t        name_len;
+    bool           has_flags;
+    uint8_t        flags;
+    bool           has_tx_power;
+    int8_t         tx_power;
+    bool           has_company;
+    uint16_t       company_id;
+    adv_beacon_t   beacon;
+    union {
+        adv_ibeacon_t       ibeacon;
+        adv_eddystone_uid_t eddystone_uid;
+        adv_eddystone_url_t eddystone_url;
+        adv_eddystone_tlm_t eddystone_tlm;
+        adv_altbeacon_t     altbeacon;
+    } u;
+} adv_info_t;
+
+/*
+ * Decode the advertising data and scan response of a record
+ */
+void adv_parse(const adv_record_t *rec, adv_info_t *info);
+
+/*
+ * Decode one AD buffer, info must be cleared by the caller before the first call
+ * A complete name wins over a short one.
+ */
+void adv_parse_data(const uint8_t *data, size_t len, adv_info_t *info);
+
+/*
+ * return: true if the 16-bit service UUID is listed or has service data in the
+ * AD buffer
+ */
+bool adv_has_service16(const uint8_t *data, size_t len, uint16_t uuid);
+
+/*
+ * Model fingerprint of an AD buffer: hash of the fields that a device model
+ * advertises the same on every unit, service UUID lists, appearance, company
+ * of the manufacturer data and UUID of the service data
+ * return: fingerprint, never 0, 0 if none of those fields is present
+ */
+uint32_t adv_fingerprint(const uint8_t *data, size_t len);
+
+/*
+ * Expand an Eddystone URL
+ * return: URL length without '\0', -1 if out is too small
+ */
+int adv_eddystone_url_expand(const adv_eddystone_url_t *url, char *out, size_t size);
+
+/*
+ * Printable beacon type, NULL for ADV_BEACON_NONE
+ */
+const char *adv_beacon_name(adv_beacon_t beacon);
+
+#endif
@@ -0,0 +1,209 @@
+#include <string.h>
+#include "adv_presence.h"
+
+
+bool adv_presence_init(adv_presence_t *presence, adv_presence_entry_t *entries, uint32_t capacity,
+                       const adv_presence_params_t *params, adv_presence_cb_t cb, void *cb_ctx) {
+    if (capacity == 0 || capacity > 32768 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+    memset(presence, 0, sizeof(*presence));
+    memset(entries, 0, capacity * sizeof(*entries));
+    presence->entries = entries;
+    presence->mask = capacity - 1;
+    // 75% load factor
+    presence->limit = capacity - capacity / 4;
+    for (int s = 0; s < ADV_PRESENCE_STATES; s++) {
+        presence->head[s] = ADV_PRESENCE_NONE;
+        presence->tail[s] = ADV_PRESENCE_NONE;
+    }
+    presence->heartbeat = ADV_PRESENCE_NONE;
+    presence->params = *params;
+    presence->cb = cb;
+    presence->cb_ctx = cb_ctx;
+    return true;
+}
+
+static void adv_presence_report(adv_presence_t *presence, const adv_presence_entry_t *entry,
+                                adv_presence_event_t event) {
+    adv_presence_report_t report;
+    report.event = event;
+    memcpy(report.bda, entry->bda, ADV_BDA_LEN);
+    report.rssi = entry->rssi;
+    report.first_seen_ms = entry->first_seen_ms;
+    report.last_seen_ms = entry->last_seen_ms;
+    presence->cb(&report, presence->cb_ctx);
+}
+
+/*
+ * Remove slot i from the list of its state
+ */
+static void adv_presence_unlink(adv_presence_t *presence, uint16_t i) {
+    adv_presence_entry_t *entry = &presence->entries[i];
+    if (presence->heartbeat == i) {
+        presence->heartbeat = entry->next;
+    }
+    if (entry->prev != ADV_PRESENCE_NONE) {
+        presence->entries[entry->prev].next = entry->next;
+    } else {
+        presence->head[entry->state] = entry->next;
+    }
+    if (entry->next != ADV_PRESENCE_NONE) {
+        presence->entries[entry->next].prev = entry->prev;
+    } else {
+        presence->tail[entry->state] = entry->prev;
+    }
+}
+
+/*
+ * Insert slot i as the most recently seen of its state
+ */
+static void adv_presence_link(adv_presence_t *presence, uint16_t i) {
+    adv_presence_entry_t *entry = &presence->entries[i];
+    uint16_t head = presence->head[entry->state];
+    entry->prev = ADV_PRESENCE_NONE;
+    entry->next = head;
+    if (head != ADV_PRESENCE_NONE) {
+        presence->entries[head].prev = i;
+    } else {
+        presence->tail[entry->state] = i;
+    }
+    presence->head[entry->state] = i;
+}
+
+/*
+ * Move the entry of slot from to the free slot to, fixing its neighbours
+ */
+static void adv_presence_move(adv_presence_t *presence, uint16_t from, uint16_t to) {
+    adv_presence_entry_t *entry = &presence->entries[to];
+    *entry = presence->entries[from];
+    if (entry->prev != ADV_PRESENCE_NONE) {
+        presence->entries[entry->prev].next = to;
+    } else {
+        presence->head[entry->state] = to;
+    }
+    if (entry->next != ADV_PRESENCE_NONE) {
+        presence->entries[entry->next].prev = to;
+    } else {
+        presence->tail[entry->state] = to;
+    }
+    if (presence->heartbeat == from) {
+        presence->heartbeat = to;
+    }
+}
+
+/*
+ * Free slot i, moving back the following entries of the cluster so that
+ * linear probing still finds them
+ */
+static void adv_presence_remove(adv_presence_t *presence, uint16_t i) {
+    adv_presence_unlink(presence, i);
+    if (presence->entries[i].state == ADV_PRESENCE_PRESENT) {
+        presence->present--;
+    }
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & presence->mask;
+        if (!presence->entries[j].used) {
+            break;
+        }
+        uint32_t home = adv_bda_hash(presence->entries[j].bda) & presence->mask;
+        // Entry j can move to i if its home slot is not in (i, j]
+        if (((j - home) & presence->mask) >= ((j - i) & presence->mask)) {
+            adv_presence_move(presence, (uint16_t)j, i);
+            i = (uint16_t)j;
+        }
+    }
+    presence->entries[i].used = 0;
+    presence->count--;
+}
+
+/*
+ * Forget the least recently seen device, absent ones first
+ */
+static void adv_presence_evict(adv_presence_t *presence) {
+    uint16_t victim = presence->tail[ADV_PRESENCE_ABSENT];
+    if (victim == ADV_PRESENCE_NONE) {
+        victim = presence->tail[ADV_PRESENCE_PRESENT];
+        adv_presence_report(presence, &presence->entries[victim], ADV_PRESENCE_LEAVE);
+    }
+    adv_presence_remove(presence, victim);
+    presence->evicted++;
+}
+
+void adv_presence_update(adv_presence_t *presence, const adv_record_t *rec) {
+    const adv_presence_params_t *params = &presence->params;
+    adv_presence_entry_t *entry;
+    uint32_t i;
+
+    if (rec->rssi < params->leave_rssi) {
+        return;
+    }
+    while (1) {
+        i = adv_bda_hash(rec->bda) & presence->mask;
+        while (presence->entries[i].used &&
+               memcmp(presence->entries[i].bda, rec->bda, ADV_BDA_LEN) != 0) {
+            i = (i + 1) & presence->mask;
+        }
+        if (presence->entries[i].used || presence->count < presence->limit) {
+            break;
+        }
+        // Eviction moves entries around, probe again
+        adv_presence_evict(presence);
+    }
+
+    entry = &presence->entries[i];
+    if (entry->used) {
+        adv_presence_unlink(presence, (uint16_t)i);
+        // Absent device seen again too late, start counting again
+        if ((int32_t)(rec->time_ms - entry->last_seen_ms) > (int32_t)params->leave_ms) {
+            entry->hits = 0;
+        }
+    } else {
+        memset(entry, 0, sizeof(*entry));
+        memcpy(entry->bda, rec->bda, ADV_BDA_LEN);
+        entry->used = 1;
+        entry->state = ADV_PRESENCE_ABSENT;
+        entry->first_seen_ms = rec->time_ms;
+        presence->count++;
+    }
+    entry->rssi = rec->rssi;
+    entry->last_seen_ms = rec->time_ms;
+    if (entry->state == ADV_PRESENCE_ABSENT && rec->rssi >= params->enter_rssi &&
+        ++entry->hits >= params->enter_count) {
+        entry->state = ADV_PRESENCE_PRESENT;
+        entry->hits = 0;
+        presence->present++;
+        adv_presence_report(presence, entry, ADV_PRESENCE_ENTER);
+    }
+    adv_presence_link(presence, (uint16_t)i);
+}
+
+void adv_presence_expire(adv_presence_t *presence, uint32_t now_ms) {
+    uint16_t i;
+    while ((i = presence->tail[ADV_PRESENCE_PRESENT]) != ADV_PRESENCE_NONE) {
+        adv_presence_entry_t *entry = &presence->entries[i];
+        if ((int32_t)(now_ms - entry->last_seen_ms) < (int32_t)presence->params.leave_ms) {
+            break;
+        }
+        adv_presence_unlink(presence, i);
+        entry->state = ADV_PRESENCE_ABSENT;
+        presence->present--;
+        adv_presence_report(presence, entry, ADV_PRESENCE_LEAVE);
+        adv_presence_link(presence, i);
+    }
+}
+
+void adv_presence_heartbeat_start(adv_presence_t *presence) {
+    presence->heartbeat = presence->head[ADV_PRESENCE_PRESENT];
+}
+
+bool adv_presence_heartbeat_step(adv_presence_t *presence) {
+    uint16_t i = presence->heartbeat;
+    if (i == ADV_PRESENCE_NONE) {
+        return false;
+    }
+    presence->heartbeat = presence->entries[i].next;
+    adv_presence_report(presence, &presence->entries[i], ADV_PRESENCE_HERE);
+    return true;
+}
@@ -0,0 +1,112 @@
+#ifndef __ADV_PRESENCE_H__
+#define __ADV_PRESENCE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+
+#define ADV_PRESENCE_NONE 0xFFFF    // List end
+
+typedef enum {
+    ADV_PRESENCE_ABSENT = 0,
+    ADV_PRESENCE_PRESENT,
+    ADV_PRESENCE_STATES
+} adv_presence_state_t;
+
+typedef enum {
+    ADV_PRESENCE_ENTER = 0,         // Device became present
+    ADV_PRESENCE_LEAVE,             // Device timed out or was evicted while present
+    ADV_PRESENCE_HERE,              // Heartbeat, device still present
+} adv_presence_event_t;
+
+/*
+ * Hysteresis settings
+ * A device enters after enter_count adverts at enter_rssi or more, none of them
+ * apart by more than leave_ms. It leaves after leave_ms without adverts at
+ * leave_rssi or more. Weaker adverts are ignored.
+ */
+typedef struct {
+    uint8_t  enter_count;
+    int8_t   enter_rssi;
+    int8_t   leave_rssi;
+    uint32_t leave_ms;
+} adv_presence_params_t;
+
+typedef struct {
+    uint8_t  bda[ADV_BDA_LEN];
+    uint8_t  used;
+    uint8_t  state;
+    uint8_t  hits;                  // Qualifying adverts while absent
+    int8_t   rssi;                  // Latest qualifying advert
+    uint16_t prev;                  // Towards the most recently seen
+    uint16_t next;                  // Towards the least recently seen
+    uint32_t first_seen_ms;
+    uint32_t last_seen_ms;
+} adv_presence_entry_t;
+
+typedef struct {
+    adv_presence_event_t event;
+    uint8_t              bda[ADV_BDA_LEN];
+    int8_t               rssi;
+    uint32_t             first_seen_ms;
+    uint32_t             last_seen_ms;
+} adv_presence_report_t;
+
+/*
+ * Called for each state transition and heartbeat
+ */
+typedef void (*adv_presence_cb_t)(const adv_presence_report_t *report, void *ctx);
+
+/*
+ * Long lived device registry, open addressing table keyed by BD address.
+ * Devices are kept in one LRU list per state, so expiring present devices and
+ * evicting the least recently seen one, absent first, do not scan the table.
+ * Storage is provided by the caller, nothing is allocated.
+ */
+typedef struct {
+    adv_presence_entry_t  *entries;
+    uint32_t               mask;
+    uint32_t               count;
+    uint32_t               limit;   // Max devices, keeps probe sequences short
+    uint32_t               evicted;
+    uint16_t               head[ADV_PRESENCE_STATES];   // Most recently seen
+    uint16_t               tail[ADV_PRESENCE_STATES];   // Least recently seen
+    uint32_t               present;
+    uint16_t               heartbeat;                   // Next device to report
+    adv_presence_params_t  params;
+    adv_presence_cb_t      cb;
+    void                  *cb_ctx;
+} adv_presence_t;
+
+/*
+ * entries: capacity elements, capacity must be a power of 2, 32768 max
+ * return: false on invalid capacity
+ */
+bool adv_presence_init(adv_presence_t *presence, adv_presence_entry_t *entries, uint32_t capacity,
+                       const adv_presence_params_t *params, adv_presence_cb_t cb, void *cb_ctx);
+
+/*
+ * Account one advert, may report ENTER, or LEAVE for an evicted device
+ */
+void adv_presence_update(adv_presence_t *presence, const adv_record_t *rec);
+
+/*
+ * Report LEAVE for the present devices not seen for leave_ms
+ * Cost is O(1) plus O(1) per device leaving.
+ */
+void adv_presence_expire(adv_presence_t *presence, uint32_t now_ms);
+
+/*
+ * Start a heartbeat, present devices are then reported by adv_presence_heartbeat_step()
+ * A device seen again during the heartbeat may be skipped.
+ */
+void adv_presence_heartbeat_start(adv_presence_t *presence);
+
+/*
+ * Report HERE for the next present device
+ * return: false once the heartbeat is over
+ */
+bool adv_presence_heartbeat_step(adv_presence_t *presence);
+
+#endif
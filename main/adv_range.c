@@ -0,0 +1,157 @@
+#include <string.h>
+#include <math.h>
+#include "adv_range.h"
+
+
+// Eddystone and the TX power AD give the power at 0 m, 41 dB above the 1 m one
+#define ADV_RANGE_LOSS_1M 41
+
+
+bool adv_range_init(adv_range_t *range, adv_range_entry_t *entries, uint32_t capacity,
+                    const adv_range_params_t *params) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+    memset(range, 0, sizeof(*range));
+    memset(entries, 0, capacity * sizeof(*entries));
+    range->entries = entries;
+    range->mask = capacity - 1;
+    // 75% load factor
+    range->limit = capacity - capacity / 4;
+    range->params = *params;
+    return true;
+}
+
+uint16_t adv_range_distance_cm(float rssi, int8_t ref_power, float path_loss) {
+    float cm = 100.0f * powf(10.0f, (ref_power - rssi) / (10.0f * path_loss));
+    if (!(cm < 65535.0f)) {
+        return 65535;
+    }
+    return (uint16_t)(cm + 0.5f);
+}
+
+/*
+ * RSSI at 1 m advertised by the device, 0 if unknown
+ */
+static int8_t adv_range_ref_power(const adv_info_t *info) {
+    switch (info->beacon) {
+    case ADV_BEACON_IBEACON:
+        return info->u.ibeacon.measured_power;
+    case ADV_BEACON_ALTBEACON:
+        return info->u.altbeacon.ref_rssi;
+    case ADV_BEACON_EDDYSTONE_UID:
+        return (int8_t)(info->u.eddystone_uid.tx_power - ADV_RANGE_LOSS_1M);
+    case ADV_BEACON_EDDYSTONE_URL:
+        return (int8_t)(info->u.eddystone_url.tx_power - ADV_RANGE_LOSS_1M);
+    default:
+        break;
+    }
+    if (info->has_tx_power) {
+        return (int8_t)(info->tx_power - ADV_RANGE_LOSS_1M);
+    }
+    return 0;
+}
+
+/*
+ * Free slot i, moving back the following entries of the cluster so that
+ * linear probing still finds them
+ */
+static void adv_range_remove(adv_range_t *range, uint32_t i) {
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & range->mask;
+        if (!range->entries[j].used) {
+            break;
+        }
+        uint32_t home = adv_bda_hash(range->entries[j].bda) & range->mask;
+        // Entry j can move to i if its home slot is not in (i, j]
+        if (((j - home) & range->mask) >= ((j - i) & range->mask)) {
+            range->entries[i] = range->entries[j];
+            i = j;
+        }
+    }
+    range->entries[i].used = false;
+    range->count--;
+}
+
+/*
+ * Find the device, or make room for it
+ * return: its entry, a free one if the device is new
+ */
+static adv_range_entry_t *adv_range_lookup(adv_range_t *range, const uint8_t *bda) {
+    uint32_t home = adv_bda_hash(bda) & range->mask;
+    uint32_t i = home;
+
+    while (range->entries[i].used) {
+        if (memcmp(range->entries[i].bda, bda, ADV_BDA_LEN) == 0) {
+            return &range->entries[i];
+        }
+        i = (i + 1) & range->mask;
+    }
+    if (range->count < range->limit) {
+        return &range->entries[i];
+    }
+
+    // Full, forget the stalest of the devices stored after the home slot
+    uint32_t victim = home, seen = 0;
+    for (uint32_t n = 0; n <= range->mask && seen < ADV_RANGE_EVICT_SCAN; n++) {
+        uint32_t k = (home + n) & range->mask;
+        if (!range->entries[k].used) {
+            continue;
+        }
+        if (seen++ == 0 || (int32_t)(range->entries[k].last_ms - range->entries[victim].last_ms) < 0) {
+            victim = k;
+        }
+    }
+    adv_range_remove(range, victim);
+    range->evicted++;
+    i = home;
+    while (range->entries[i].used) {
+        i = (i + 1) & range->mask;
+    }
+    return &range->entries[i];
+}
+
+bool adv_range_update(adv_range_t *range, const adv_record_t *rec, const adv_info_t *info,
+                      adv_range_estimate_t *est) {
+    const adv_range_params_t *params = &range->params;
+    adv_range_entry_t *entry = adv_range_lookup(range, rec->bda);
+    int8_t ref_power = adv_range_ref_power(info);
+
+    if (!entry->used) {
+        memset(entry, 0, sizeof(*entry));
+        memcpy(entry->bda, rec->bda, ADV_BDA_LEN);
+        entry->used = true;
+        entry->ref_power = params->ref_power;
+        entry->rssi = rec->rssi;
+        entry->variance = params->measurement_noise;
+        range->count++;
+    } else {
+        // One dimension Kalman filter, constant RSSI model
+        float dt = (rec->time_ms - entry->last_ms) / 1000.0f;
+        float variance = entry->variance + params->process_noise * dt;
+        float gain = variance / (variance + params->measurement_noise);
+        entry->rssi += gain * (rec->rssi - entry->rssi);
+        entry->variance = (1.0f - gain) * variance;
+    }
+    // TLM frames do not carry it, keep the one of the UID / URL frames
+    if (ref_power) {
+        entry->ref_power = ref_power;
+    }
+    entry->last_ms = rec->time_ms;
+
+    uint16_t distance = adv_range_distance_cm(entry->rssi, entry->ref_power, params->path_loss);
+    uint16_t moved = distance > entry->published_cm ? distance - entry->published_cm
+                                                    : entry->published_cm - distance;
+    if (entry->published && moved <= params->threshold_cm) {
+        return false;
+    }
+    entry->published = true;
+    entry->published_cm = distance;
+
+    memcpy(est->bda, rec->bda, ADV_BDA_LEN);
+    est->rssi_x10 = (int16_t)lroundf(entry->rssi * 10.0f);
+    est->ref_power = entry->ref_power;
+    est->distance_cm = distance;
+    return true;
+}
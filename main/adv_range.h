@@ -0,0 +1,84 @@
+#ifndef __ADV_RANGE_H__
+#define __ADV_RANGE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+#include "adv_parse.h"
+
+#define ADV_RANGE_EVICT_SCAN 16     // Slots looked at to find a device to evict
+
+/*
+ * Filter and path loss model settings
+ */
+typedef struct {
+    float    process_noise;         // RSSI variance added per second, dB^2
+    float    measurement_noise;     // Variance of one RSSI sample, dB^2
+    float    path_loss;             // Path loss exponent, 2.0 in free space
+    int8_t   ref_power;             // RSSI at 1 m when the advert does not tell
+    uint16_t threshold_cm;          // Publish when the distance moved by more
+} adv_range_params_t;
+
+/*
+ * Estimator state of one device
+ */
+typedef struct {
+    uint8_t  bda[ADV_BDA_LEN];
+    int8_t   ref_power;             // RSSI at 1 m, from the advert or the default
+    bool     used;
+    float    rssi;                  // Filtered RSSI
+    float    variance;              // Of the filtered RSSI
+    uint32_t last_ms;               // Last update
+    uint16_t published_cm;          // Distance last reported
+    bool     published;
+} adv_range_entry_t;
+
+/*
+ * Fixed capacity open addressing table keyed by BD address, the least recently
+ * seen device around the home slot is evicted when the table is full, so memory
+ * stays bounded whatever the number of devices around.
+ * Storage is provided by the caller, nothing is allocated.
+ */
+typedef struct {
+    adv_range_entry_t  *entries;
+    uint32_t            mask;
+    uint32_t            count;
+    uint32_t            limit;      // Max devices, keeps probe sequences short
+    uint32_t            evicted;
+    adv_range_params_t  params;
+} adv_range_t;
+
+/*
+ * Result of one update
+ */
+typedef struct {
+    uint8_t  bda[ADV_BDA_LEN];
+    int16_t  rssi_x10;              // Filtered RSSI, tenth of dB
+    int8_t   ref_power;
+    uint16_t distance_cm;
+} adv_range_estimate_t;
+
+/*
+ * entries: capacity elements, capacity must be a power of 2
+ * return: false on invalid capacity
+ */
+bool adv_range_init(adv_range_t *range, adv_range_entry_t *entries, uint32_t capacity,
+                    const adv_range_params_t *params);
+
+/*
+ * Filter the RSSI of one advert and estimate the device distance
+ * info: decoded advert, its beacon measured power is used as reference
+ * return: true if the estimate moved by more than the threshold since it was
+ * last reported, est is then filled and considered reported
+ */
+bool adv_range_update(adv_range_t *range, const adv_record_t *rec, const adv_info_t *info,
+                      adv_range_estimate_t *est);
+
+/*
+ * Log-distance path loss model
+ * return: distance in cm, saturated to 65535
+ */
+uint16_t adv_range_distance_cm(float rssi, int8_t ref_power, float path_loss);
+
+#endif
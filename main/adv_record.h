@@ -0,0 +1,36 @@
+#ifndef __ADV_RECORD_H__
+#define __ADV_RECORD_H__
+
+// Includes
+#include <stdint.h>
+
+// Advertising data + scan response, as reported by Bluedroid in scan_rst.ble_adv
+#define ADV_RECORD_DATA_MAX 62
+#define ADV_BDA_LEN         6
+
+/*
+ * One scan result, copied out of esp_ble_gap_cb_param_t so it can outlive the GAP callback
+ */
+typedef struct {
+    uint32_t time_ms;           // Reception time, since boot
+    uint32_t time_us;           // Reception time, esp_timer_get_time() low bits
+    uint8_t  bda[ADV_BDA_LEN];
+    int8_t   rssi;
+    uint8_t  dev_type;
+    uint8_t  adv_data_len;
+    uint8_t  scan_rsp_len;
+    uint8_t  data[ADV_RECORD_DATA_MAX];
+} adv_record_t;
+
+/*
+ * Hash of a BD address for the device tables
+ * Mix the 6 address bytes, the last ones carry most of the entropy
+ */
+static inline uint32_t adv_bda_hash(const uint8_t *bda) {
+    uint32_t lo = (uint32_t)bda[2] << 24 | (uint32_t)bda[3] << 16 | (uint32_t)bda[4] << 8 | bda[5];
+    uint32_t hi = (uint32_t)bda[0] << 8 | bda[1];
+    uint32_t h = lo * 0x9E3779B1u ^ hi * 0x85EBCA6Bu;
+    return h ^ (h >> 16);
+}
+
+#endif
@@ -0,0 +1,178 @@
+#include <string.h>
+#include "adv_ring.h"
+
+
+bool adv_ring_init(adv_ring_t *ring, adv_ring_slot_t *slots, uint32_t capacity, adv_ring_policy_t policy) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+    memset(ring, 0, sizeof(*ring));
+    memset(slots, 0, capacity * sizeof(*slots));
+    ring->mask = capacity - 1;
+    ring->policy = policy;
+    ring->slots = slots;
+    return true;
+}
+
+/*
+ * Producer only, seqlock write
+ */
+static void adv_ring_slot_write(adv_ring_slot_t *slot, const adv_record_t *rec) {
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->rec, rec, sizeof(*rec));
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Consumer only, seqlock read
+ * return: false if the producer wrote the slot meanwhile
+ */
+static bool adv_ring_slot_read(const adv_ring_slot_t *slot, adv_record_t *rec) {
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return false;
+    }
+    memcpy(rec, (const void *)&slot->rec, sizeof(*rec));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/*
+ * Replace the queued record of the same device, if any.
+ * If the consumer takes that slot concurrently it gets the previous, consistent,
+ * record and the new one is lost, as with drop-newest.
+ */
+static bool adv_ring_coalesce(adv_ring_t *ring, const adv_record_t *rec, uint32_t tail, uint32_t head) {
+    for (uint32_t i = tail; i != head; i++) {
+        adv_ring_slot_t *slot = &ring->slots[i & ring->mask];
+        if (memcmp(slot->rec.bda, rec->bda, ADV_BDA_LEN) == 0) {
+            adv_ring_slot_write(slot, rec);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool adv_ring_push(adv_ring_t *ring, const adv_record_t *rec) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail > ring->mask) {
+        switch (ring->policy) {
+        case ADV_RING_COALESCE:
+            if (adv_ring_coalesce(ring, rec, tail, head)) {
+                __atomic_store_n(&ring->stats.coalesced, ring->stats.coalesced + 1, __ATOMIC_RELAXED);
+                return true;
+            }
+            // Fall through
+        case ADV_RING_DROP_NEWEST:
+        default:
+            __atomic_store_n(&ring->stats.dropped_newest, ring->stats.dropped_newest + 1, __ATOMIC_RELAXED);
+            return false;
+        case ADV_RING_DROP_OLDEST:
+            // If the CAS fails the consumer has just freed that slot
+            if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&ring->stats.dropped_oldest, ring->stats.dropped_oldest + 1, __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+
+    adv_ring_slot_write(&ring->slots[head & ring->mask], rec);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&ring->stats.pushed, ring->stats.pushed + 1, __ATOMIC_RELAXED);
+    uint32_t depth = head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if (depth > ring->stats.high_water) {
+        __atomic_store_n(&ring->stats.high_water, depth, __ATOMIC_RELAXED);
+    }
+    return true;
+}
+
+bool adv_ring_pop(adv_ring_t *ring, adv_record_t *rec) {
+    for (;;) {
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            return false;
+        }
+        if (!adv_ring_slot_read(&ring->slots[tail & ring->mask], rec)) {
+            continue;
+        }
+        // Fails if the producer dropped this record meanwhile
+        if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&ring->stats.popped, ring->stats.popped + 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+}
+
+uint32_t adv_ring_pop_batch(adv_ring_t *ring, adv_record_t *recs, uint32_t max) {
+    for (;;) {
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t mark = __atomic_load_n(&ring->mark_pos, __ATOMIC_RELAXED);
+        uint32_t n = head - tail < max ? head - tail : max;
+        if ((int32_t)(mark - tail) > 0 && mark - tail < n) {
+            n = mark - tail;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        // A slot being coalesced ends the batch before it
+        uint32_t i;
+        for (i = 0; i < n; i++) {
+            if (!adv_ring_slot_read(&ring->slots[(tail + i) & ring->mask], &recs[i])) {
+                break;
+            }
+        }
+        if (i == 0) {
+            continue;
+        }
+        // Fails if the producer dropped the oldest record meanwhile, the batch is read again
+        if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + i, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&ring->stats.popped, ring->stats.popped + i, __ATOMIC_RELAXED);
+            return i;
+        }
+    }
+}
+
+void adv_ring_mark(adv_ring_t *ring) {
+    __atomic_store_n(&ring->mark_pos, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ring->mark_seq, 1, __ATOMIC_RELEASE);
+}
+
+bool adv_ring_mark_reached(adv_ring_t *ring, uint32_t *seen) {
+    uint32_t seq = __atomic_load_n(&ring->mark_seq, __ATOMIC_ACQUIRE);
+    if (seq == *seen) {
+        return false;
+    }
+    // A newer mark may be read here, both windows are then merged
+    uint32_t pos = __atomic_load_n(&ring->mark_pos, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if ((int32_t)(tail - pos) < 0) {
+        return false;
+    }
+    *seen = seq;
+    return true;
+}
+
+uint32_t adv_ring_count(const adv_ring_t *ring) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+void adv_ring_get_stats(const adv_ring_t *ring, adv_ring_stats_t *stats) {
+    stats->pushed = __atomic_load_n(&ring->stats.pushed, __ATOMIC_RELAXED);
+    stats->popped = __atomic_load_n(&ring->stats.popped, __ATOMIC_RELAXED);
+    stats->dropped_newest = __atomic_load_n(&ring->stats.dropped_newest, __ATOMIC_RELAXED);
+    stats->dropped_oldest = __atomic_load_n(&ring->stats.dropped_oldest, __ATOMIC_RELAXED);
+    stats->coalesced = __atomic_load_n(&ring->stats.coalesced, __ATOMIC_RELAXED);
+    stats->high_water = __atomic_load_n(&ring->stats.high_water, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,102 @@
+#ifndef __ADV_RING_H__
+#define __ADV_RING_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+
+/*
+ * Lock-free single producer / single consumer ring of scan results.
+ * The producer is the Bluedroid GAP callback, the consumer the publisher task.
+ *
+ * Slots are protected by a sequence counter (odd while being written) so the
+ * producer can overwrite a queued slot (drop-oldest, coalesce) without the
+ * consumer ever returning a torn record.
+ */
+
+/*
+ * What to do with a new record when the ring is full
+ */
+typedef enum {
+    ADV_RING_DROP_NEWEST = 0,   // Keep the queue, discard the new record
+    ADV_RING_DROP_OLDEST,       // Discard the oldest queued record
+    ADV_RING_COALESCE,          // Overwrite the queued record of the same device, else drop newest
+} adv_ring_policy_t;
+
+typedef struct {
+    uint32_t pushed;            // Records accepted, coalesced ones excluded
+    uint32_t popped;
+    uint32_t dropped_newest;
+    uint32_t dropped_oldest;
+    uint32_t coalesced;
+    uint32_t high_water;        // Highest number of queued records
+} adv_ring_stats_t;
+
+typedef struct {
+    volatile uint32_t seq;
+    adv_record_t      rec;
+} adv_ring_slot_t;
+
+typedef struct {
+    volatile uint32_t  head;    // Next slot to write, producer only
+    volatile uint32_t  tail;    // Next slot to read, consumer, and producer on drop-oldest
+    volatile uint32_t  mark_pos; // Head position of the last mark
+    volatile uint32_t  mark_seq; // Number of marks
+    uint32_t           mask;
+    adv_ring_policy_t  policy;
+    adv_ring_slot_t   *slots;
+    adv_ring_stats_t   stats;
+} adv_ring_t;
+
+/*
+ * Initialize the ring over caller-provided slots
+ * capacity: number of slots, must be a power of 2
+ * return: false if capacity is not a power of 2
+ */
+bool adv_ring_init(adv_ring_t *ring, adv_ring_slot_t *slots, uint32_t capacity, adv_ring_policy_t policy);
+
+/*
+ * Producer side, never blocks
+ * return: true if the record is queued or coalesced, false if dropped
+ */
+bool adv_ring_push(adv_ring_t *ring, const adv_record_t *rec);
+
+/*
+ * Consumer side, never blocks
+ * return: true if a record has been copied into rec
+ */
+bool adv_ring_pop(adv_ring_t *ring, adv_record_t *rec);
+
+/*
+ * Consumer side, never blocks: copy up to max records in one go, the ring
+ * position is advanced once for the whole batch. A batch stops at the last
+ * mark, the records after it belong to the next window.
+ * return: number of records copied into recs
+ */
+uint32_t adv_ring_pop_batch(adv_ring_t *ring, adv_record_t *recs, uint32_t max);
+
+/*
+ * Flag the current end of the queue, e.g. the end of a scan window
+ * May be called from any task, not only the producer.
+ */
+void adv_ring_mark(adv_ring_t *ring);
+
+/*
+ * Consumer side, true once every record pushed before the last unseen mark
+ * has been popped or dropped
+ * seen: consumer owned, updated when returning true
+ */
+bool adv_ring_mark_reached(adv_ring_t *ring, uint32_t *seen);
+
+/*
+ * Number of queued records, approximate when called concurrently
+ */
+uint32_t adv_ring_count(const adv_ring_t *ring);
+
+/*
+ * Snapshot of the counters, each one read atomically
+ */
+void adv_ring_get_stats(const adv_ring_t *ring, adv_ring_stats_t *stats);
+
+#endif
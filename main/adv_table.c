@@ -0,0 +1,71 @@
+#include <string.h>
+#include "adv_table.h"
+
+
+bool adv_table_init(adv_table_t *table, adv_entry_t *entries, uint16_t *order, uint32_t capacity) {
+    if (capacity == 0 || capacity > 65536 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+    memset(table, 0, sizeof(*table));
+    memset(entries, 0, capacity * sizeof(*entries));
+    table->entries = entries;
+    table->order = order;
+    table->mask = capacity - 1;
+    // 75% load factor
+    table->limit = capacity - capacity / 4;
+    return true;
+}
+
+adv_entry_t *adv_table_update(adv_table_t *table, const adv_record_t *rec) {
+    uint32_t i = adv_bda_hash(rec->bda) & table->mask;
+    adv_entry_t *entry;
+
+    // Linear probing, the load factor guarantees a free slot
+    while (1) {
+        entry = &table->entries[i];
+        if (!entry->used) {
+            break;
+        }
+        if (memcmp(entry->rec.bda, rec->bda, ADV_BDA_LEN) == 0) {
+            adv_stats_t *stats = &entry->stats;
+            if (stats->count < UINT16_MAX) {
+                stats->count++;
+                entry->rssi_sum += rec->rssi;
+                stats->rssi_mean = (int8_t)(entry->rssi_sum / stats->count);
+            }
+            if (rec->rssi < stats->rssi_min) {
+                stats->rssi_min = rec->rssi;
+            }
+            if (rec->rssi > stats->rssi_max) {
+                stats->rssi_max = rec->rssi;
+            }
+            stats->last_seen_ms = rec->time_ms;
+            memcpy(&entry->rec, rec, sizeof(*rec));
+            return entry;
+        }
+        i = (i + 1) & table->mask;
+    }
+
+    if (table->count >= table->limit) {
+        table->overflow++;
+        return NULL;
+    }
+    entry->used = true;
+    entry->rssi_sum = rec->rssi;
+    entry->stats.count = 1;
+    entry->stats.rssi_min = rec->rssi;
+    entry->stats.rssi_max = rec->rssi;
+    entry->stats.rssi_mean = rec->rssi;
+    entry->stats.first_seen_ms = rec->time_ms;
+    entry->stats.last_seen_ms = rec->time_ms;
+    memcpy(&entry->rec, rec, sizeof(*rec));
+    table->order[table->count++] = (uint16_t)i;
+    return entry;
+}
+
+void adv_table_clear(adv_table_t *table) {
+    for (uint32_t i = 0; i < table->count; i++) {
+        table->entries[table->order[i]].used = false;
+    }
+    table->count = 0;
+}
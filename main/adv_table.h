@@ -0,0 +1,67 @@
+#ifndef __ADV_TABLE_H__
+#define __ADV_TABLE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+
+/*
+ * Per scan window aggregate of one device
+ */
+typedef struct {
+    uint16_t count;
+    int8_t   rssi_min;
+    int8_t   rssi_max;
+    int8_t   rssi_mean;
+    uint32_t first_seen_ms;
+    uint32_t last_seen_ms;
+} adv_stats_t;
+
+typedef struct {
+    adv_record_t rec;           // Latest advert of the device
+    adv_stats_t  stats;
+    int32_t      rssi_sum;
+    bool         used;
+} adv_entry_t;
+
+/*
+ * Fixed capacity open addressing table keyed by BD address.
+ * Storage is provided by the caller, nothing is allocated.
+ * Used slots are also listed in `order` so iterating and clearing cost
+ * O(devices) instead of O(capacity).
+ */
+typedef struct {
+    adv_entry_t *entries;
+    uint16_t    *order;
+    uint32_t     mask;
+    uint32_t     count;
+    uint32_t     limit;         // Max devices, keeps probe sequences short
+    uint32_t     overflow;      // Adverts rejected because the table was full
+} adv_table_t;
+
+/*
+ * entries, order: capacity elements each, capacity must be a power of 2, 65536 max
+ * return: false on invalid capacity
+ */
+bool adv_table_init(adv_table_t *table, adv_entry_t *entries, uint16_t *order, uint32_t capacity);
+
+/*
+ * Account one advert
+ * return: the device entry, NULL if the table is full
+ */
+adv_entry_t *adv_table_update(adv_table_t *table, const adv_record_t *rec);
+
+/*
+ * Entry i, in insertion order, 0 <= i < table->count
+ */
+static inline adv_entry_t *adv_table_at(adv_table_t *table, uint32_t i) {
+    return &table->entries[table->order[i]];
+}
+
+/*
+ * Remove all devices, keeps the overflow counter
+ */
+void adv_table_clear(adv_table_t *table);
+
+#endif
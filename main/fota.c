@@ -1,208 +1,314 @@
 #include <esp_log.h>
 #include <string.h>
-#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "fota.h"
+#include "fota_pipe.h"
+#include "fota_image.h"
 
 
-// Contants
+// Constants
 #define TAG_FOTA "ota"
-#define BUFFSIZE 1024
+#define FOTA_BUFFER_SIZE      4096
+#define FOTA_BUFFER_COUNT     4         // Rides over slow sector erases
+#define FOTA_SECTOR_SIZE      4096
+#define FOTA_REQUEST_MAX      (FOTA_HOST_MAX + FOTA_PATH_MAX + 2 * FOTA_SHA256_LEN + 16)
+#define FOTA_TASK_STACK       4096
+#define FOTA_TASK_PRIORITY    5
+#define FOTA_PROGRESS_STEP    (64 * 1024)
+#define FOTA_RESTART_DELAY_MS 1000      // Lets the last report go out
 
-// Variables & buffers
-char writeDataBuff[BUFFSIZE + 1] = { 0 }; // Fota data write buffer ready to write to the flash
-char packet[BUFFSIZE + 1] = { 0 };         // Packet receive buffer
-int binaryFileLength = 0;                  // Image total length
-int socketId = -1;
-char http_request[64] = {0};
+// Receive buffers, the image is written to flash straight from them
+static uint8_t fota_pool[FOTA_BUFFER_COUNT * FOTA_BUFFER_SIZE];
+static char fota_request[FOTA_REQUEST_MAX];
+static fota_image_t fota_image;
+static fota_progress_cb_t fota_progress_cb = NULL;
+static volatile bool fota_running = false;
 
+typedef struct {
+    const esp_partition_t *partition;
+    esp_ota_handle_t       handle;
+    bool                   begun;
+    uint32_t               offset;      // Written so far
+    uint32_t               erased;      // Erased up to
+} fota_ota_t;
 
-uint8_t fota_update( char *url ) {
-    ESP_LOGI( TAG_FOTA, "Start updating with %s", url );
-    fota_update_task( );
+/*
+ * Reader side of the download, accounts progress on top of the pipe
+ */
+typedef struct {
+    fota_sink_t     pipe;
+    fota_pipe_t    *pipe_state;
+    fota_progress_t progress;
+    uint32_t        started_ms;
+    uint32_t        reported;
+} fota_stream_t;
+
+
+static uint32_t fota_now_ms(void) {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static void fota_report(fota_stream_t *stream, fota_state_t state, fota_err_t err) {
+    fota_progress_t *progress = &stream->progress;
+
+    progress->state = state;
+    progress->err = err;
+    if (stream->pipe_state) {
+        progress->written = stream->pipe_state->written;
+    }
+    progress->elapsed_ms = fota_now_ms() - stream->started_ms;
+    stream->reported = progress->received;
+    if (fota_progress_cb) {
+        fota_progress_cb(progress);
+    }
+}
+
+/*
+ * Flash side, begin runs in the OTA task and write in the pipe writer task
+ */
+static int fota_ota_begin(void *ctx, int64_t image_len) {
+    fota_ota_t *ota = (fota_ota_t *)ctx;
+    // Only erase the first sector, 0 would erase the whole partition. The others
+    // are erased by fota_ota_write(), just ahead of the data, while receiving.
+    esp_err_t err = esp_ota_begin(ota->partition, 1, &ota->handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_FOTA, "esp_ota_begin failed, error=%d", err);
+        return -1;
+    }
+    ota->begun = true;
+    ota->offset = 0;
+    ota->erased = FOTA_SECTOR_SIZE;
     return 0;
 }
 
-void fota_update_task( void ) {
+static int fota_ota_write(void *ctx, const uint8_t *data, size_t len) {
+    fota_ota_t *ota = (fota_ota_t *)ctx;
+    uint32_t end = ota->offset + len;
     esp_err_t err;
-    /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
-    esp_ota_handle_t update_handle = 0 ;
-    const esp_partition_t *update_partition = NULL;
 
-    ESP_LOGI(TAG_FOTA, "Starting OTA example...");
+    if (end > ota->erased) {
+        uint32_t erase_end = (end + FOTA_SECTOR_SIZE - 1) & ~(uint32_t)(FOTA_SECTOR_SIZE - 1);
+        err = esp_partition_erase_range(ota->partition, ota->erased, erase_end - ota->erased);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG_FOTA, "Error: erase at 0x%x failed! err=0x%x", ota->erased, err);
+            return -1;
+        }
+        ota->erased = erase_end;
+    }
+    err = esp_ota_write(ota->handle, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_FOTA, "Error: esp_ota_write failed! err=0x%x", err);
+        return -1;
+    }
+    ota->offset = end;
+    return 0;
+}
+
+/*
+ * Delta base, the running image
+ */
+static int fota_base_read(void *ctx, uint32_t offset, void *buf, size_t len) {
+    return esp_partition_read((const esp_partition_t *)ctx, offset, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int fota_stream_begin(void *ctx, int64_t image_len) {
+    fota_stream_t *stream = (fota_stream_t *)ctx;
+    stream->progress.total = image_len;
+    return stream->pipe.begin(stream->pipe.ctx, image_len);
+}
+
+static int fota_stream_write(void *ctx, const uint8_t *data, size_t len) {
+    fota_stream_t *stream = (fota_stream_t *)ctx;
+    int ret = stream->pipe.write(stream->pipe.ctx, data, len);
+
+    stream->progress.received += len;
+    if (stream->progress.received - stream->reported >= FOTA_PROGRESS_STEP) {
+        fota_report(stream, FOTA_STATE_PROGRESS, FOTA_OK);
+    }
+    return ret;
+}
+
+static uint8_t *fota_stream_buffer(void *ctx, size_t *size) {
+    fota_stream_t *stream = (fota_stream_t *)ctx;
+    return stream->pipe.buffer(stream->pipe.ctx, size);
+}
+
+static int fota_hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Split "<url> [<sha256 hex>]"
+ * return: false if the URL or the digest is invalid
+ */
+static bool fota_parse_request(const char *request, fota_url_t *url, uint8_t *sha256, bool *has_sha256) {
+    const char *space = strchr(request, ' ');
+    size_t url_len = space ? (size_t)(space - request) : strlen(request);
+
+    if (!fota_url_parse(request, url_len, url)) {
+        return false;
+    }
+    *has_sha256 = false;
+    if (space == NULL) {
+        return true;
+    }
+    while (*space == ' ') {
+        space++;
+    }
+    if (*space == '\0') {
+        return true;
+    }
+    for (int i = 0; i < FOTA_SHA256_LEN; i++) {
+        int hi = fota_hex_digit(space[2 * i]);
+        int lo = hi < 0 ? -1 : fota_hex_digit(space[2 * i + 1]);
+        if (lo < 0) {
+            return false;
+        }
+        sha256[i] = (uint8_t)(hi << 4 | lo);
+    }
+    *has_sha256 = true;
+    return true;
+}
+
+/*
+ * Download to the next OTA partition and switch to it
+ * return: FOTA_OK once the new image is bootable
+ */
+static fota_err_t fota_run(fota_stream_t *stream) {
+    fota_url_t url;
+    uint8_t sha256[FOTA_SHA256_LEN];
+    bool has_sha256;
+    fota_result_t result;
+    fota_pipe_t pipe;
+    fota_ota_t ota = { 0 };
+    fota_sink_t flash = { fota_ota_begin, fota_ota_write, NULL, &ota };
+    fota_sink_t decoder;
+    fota_sink_t sink = { fota_stream_begin, fota_stream_write, fota_stream_buffer, stream };
+
+    if (!fota_parse_request(fota_request, &url, sha256, &has_sha256)) {
+        ESP_LOGE(TAG_FOTA, "Invalid update request: %s", fota_request);
+        return FOTA_ERR_HTTP;
+    }
+    ESP_LOGI(TAG_FOTA, "Start updating from %s:%u%s, %s digest", url.host, url.port, url.path,
+             has_sha256 ? "checking" : "no");
 
     const esp_partition_t *configured = esp_ota_get_boot_partition();
     const esp_partition_t *running = esp_ota_get_running_partition();
-
     if (configured != running) {
         ESP_LOGW(TAG_FOTA, "Configured OTA boot partition at offset 0x%08x, but running from offset 0x%08x",
                  configured->address, running->address);
         ESP_LOGW(TAG_FOTA, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)");
     }
-    ESP_LOGI(TAG_FOTA, "Running partition type %d subtype %d (offset 0x%08x)",
-             running->type, running->subtype, running->address);
-
-    /* Wait for the callback to set the CONNECTED_BIT in the
-       event group.
-    */
-    /*
-    xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT,
-                        false, true, portMAX_DELAY);
-    ESP_LOGI(TAG_FOTA, "Connect to Wifi ! Start to Connect to Server....");
-    TODO: Might not be required as triggered by MQTT
-    */
-
-    /*connect to http server*/
-    if (fota_connect_to_http_server()) {
-        ESP_LOGI(TAG_FOTA, "Connected to http server");
-    } else {
-        ESP_LOGE(TAG_FOTA, "Connect to http server failed!");
-        fota_task_fatal_error();
-    }
-
-    int res = -1;
-    /*send GET request to http server*/
-    res = send(socketId, http_request, strlen(http_request), 0);
-    if (res == -1) {
-        ESP_LOGE(TAG_FOTA, "Send GET request to server failed");
-        fota_task_fatal_error();
-    } else {
-        ESP_LOGI(TAG_FOTA, "Send GET request to server succeeded");
-    }
-
-    update_partition = esp_ota_get_next_update_partition(NULL);
+    ota.partition = esp_ota_get_next_update_partition(NULL);
+    if (ota.partition == NULL) {
+        ESP_LOGE(TAG_FOTA, "No update partition");
+        return FOTA_ERR_WRITE;
+    }
     ESP_LOGI(TAG_FOTA, "Writing to partition subtype %d at offset 0x%x",
-             update_partition->subtype, update_partition->address);
-    assert(update_partition != NULL);
+             ota.partition->subtype, ota.partition->address);
 
-    err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG_FOTA, "esp_ota_begin failed, error=%d", err);
-        fota_task_fatal_error();
-    }
-    ESP_LOGI(TAG_FOTA, "esp_ota_begin succeeded");
-
-    bool resp_body_start = false, flag = true;
-    /*deal with all receive packet*/
-    while (flag) {
-        memset(packet, 0, BUFFSIZE);
-        memset(writeDataBuff, 0, BUFFSIZE);
-        int buff_len = recv(socketId, packet, BUFFSIZE, 0);
-        if (buff_len < 0) { /*receive error*/
-            ESP_LOGE(TAG_FOTA, "Error: receive data error! errno=%d", errno);
-            fota_task_fatal_error();
-        } else if (buff_len > 0 && !resp_body_start) { /*deal with response header*/
-            memcpy(writeDataBuff, packet, buff_len);
-            resp_body_start = fota_read_past_http_header(packet, buff_len, update_handle);
-        } else if (buff_len > 0 && resp_body_start) { /*deal with response body*/
-            memcpy(writeDataBuff, packet, buff_len);
-            err = esp_ota_write( update_handle, (const void *)writeDataBuff, buff_len);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG_FOTA, "Error: esp_ota_write failed! err=0x%x", err);
-                fota_task_fatal_error();
-            }
-            binaryFileLength += buff_len;
-            ESP_LOGI(TAG_FOTA, "Have written image length %d", binaryFileLength);
-        } else if (buff_len == 0) {  /*packet over*/
-            flag = false;
-            ESP_LOGI(TAG_FOTA, "Connection closed, all packets received");
-            close(socketId);
-        } else {
-            ESP_LOGE(TAG_FOTA, "Unexpected recv result");
-        }
+    // Received bytes go through the pipe, are decoded in the writer task and flashed
+    fota_base_t base = { fota_base_read, (void *)running, running->size };
+    fota_image_init(&fota_image, &flash, &base);
+    fota_image_sink(&fota_image, &decoder);
+    if (!fota_pipe_start(&pipe, fota_pool, FOTA_BUFFER_COUNT, FOTA_BUFFER_SIZE, &decoder, FOTA_TASK_PRIORITY)) {
+        ESP_LOGE(TAG_FOTA, "Cannot start the flash writer");
+        return FOTA_ERR_WRITE;
     }
-
-    ESP_LOGI(TAG_FOTA, "Total Write binary data length : %d", binaryFileLength);
-
-    if (esp_ota_end(update_handle) != ESP_OK) {
+    fota_pipe_sink(&pipe, &stream->pipe);
+    stream->pipe_state = &pipe;
+    // The digest is the decoded image one, checked below
+    fota_err_t err = fota_download(&url, NULL, ota.partition->size, &sink, NULL, 0, &result);
+    if (fota_pipe_finish(&pipe) && err == FOTA_OK) {
+        err = FOTA_ERR_WRITE;
+    }
+    stream->progress.written = pipe.written;
+    stream->pipe_state = NULL;
+    fota_err_t image_err = fota_image_finish(&fota_image);
+    if (image_err != FOTA_OK && (err == FOTA_OK || err == FOTA_ERR_WRITE)) {
+        // More precise than the write failure it caused
+        err = image_err;
+    }
+    if (err == FOTA_OK && has_sha256 && memcmp(sha256, fota_image.sha256, FOTA_SHA256_LEN) != 0) {
+        err = FOTA_ERR_DIGEST;
+    }
+    // Also validates the image
+    if (ota.begun && esp_ota_end(ota.handle) != ESP_OK && err == FOTA_OK) {
         ESP_LOGE(TAG_FOTA, "esp_ota_end failed!");
-        fota_task_fatal_error();
+        err = FOTA_ERR_WRITE;
     }
-    err = esp_ota_set_boot_partition(update_partition);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG_FOTA, "esp_ota_set_boot_partition failed! err=0x%x", err);
-        fota_task_fatal_error();
+    if (err != FOTA_OK) {
+        ESP_LOGE(TAG_FOTA, "Update failed: %s, HTTP status %d, %u bytes received",
+                 fota_err_name(err), result.status, result.received);
+        return err;
+    }
+    ESP_LOGI(TAG_FOTA, "Total Write binary data length : %u from %u bytes%s%s, in %u ms, flash writer waited for %u times",
+             fota_image.written, result.received,
+             (fota_image.flags & FOTA_IMAGE_DEFLATE) ? ", compressed" : "",
+             (fota_image.flags & FOTA_IMAGE_DELTA) ? ", delta" : "",
+             fota_now_ms() - stream->started_ms, pipe.stalls);
+    ESP_LOGI(TAG_FOTA, "Image SHA-256:");
+    esp_log_buffer_hex(TAG_FOTA, fota_image.sha256, FOTA_SHA256_LEN);
+
+    esp_err_t ret = esp_ota_set_boot_partition(ota.partition);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG_FOTA, "esp_ota_set_boot_partition failed! err=0x%x", ret);
+        return FOTA_ERR_WRITE;
     }
-    ESP_LOGI(TAG_FOTA, "Prepare to restart system!");
-    esp_restart();
-    return ;
+    return FOTA_OK;
 }
 
+static void fota_task(void *pvParameters) {
+    fota_stream_t stream;
 
+    memset(&stream, 0, sizeof(stream));
+    stream.progress.total = -1;
+    stream.started_ms = fota_now_ms();
+    fota_report(&stream, FOTA_STATE_START, FOTA_OK);
 
-void __attribute__(( noreturn )) fota_task_fatal_error( )
-{
-   ESP_LOGE( TAG_FOTA, "Restaring task due to fatal error..." );
-   close( socketId );
-   esp_restart( );
+    fota_err_t err = fota_run(&stream);
+    fota_report(&stream, err == FOTA_OK ? FOTA_STATE_DONE : FOTA_STATE_FAILED, err);
+    if (err == FOTA_OK) {
+        ESP_LOGI(TAG_FOTA, "Prepare to restart system!");
+        vTaskDelay(FOTA_RESTART_DELAY_MS / portTICK_PERIOD_MS);
+        esp_restart();
+    }
+    fota_running = false;
+    vTaskDelete(NULL);
 }
 
-int fota_read_until(char *buffer, char delim, int len) {
-//  /*TODO: delim check,buffer check,further: do an buffer length limited*/
-    int i = 0;
-    while (buffer[i] != delim && i < len) {
-        ++i;
+bool fota_update(const char *request, size_t len, fota_progress_cb_t progress) {
+    if (fota_running) {
+        ESP_LOGW(TAG_FOTA, "Update already running");
+        return false;
     }
-    return i + 1;
+    if (len >= sizeof(fota_request)) {
+        ESP_LOGE(TAG_FOTA, "Update request too long");
+        return false;
+    }
+    memcpy(fota_request, request, len);
+    fota_request[len] = '\0';
+    fota_progress_cb = progress;
+    fota_running = true;
+    if (xTaskCreate(&fota_task, "fota", FOTA_TASK_STACK, NULL, FOTA_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG_FOTA, "Cannot create the OTA task");
+        fota_running = false;
+        return false;
+    }
+    return true;
 }
 
-bool fota_read_past_http_header(char text[], int total_len, esp_ota_handle_t update_handle) {
-   /* i means current position */
-   int i = 0, i_read_len = 0;
-   while (text[i] != 0 && i < total_len) {
-       i_read_len = fota_read_until(&text[i], '\n', total_len);
-       // if we resolve \r\n line,we think packet header is finished
-       if (i_read_len == 2) {
-           int i_write_len = total_len - (i + 2);
-           memset(writeDataBuff, 0, BUFFSIZE);
-           /*copy first http packet body to write buffer*/
-           memcpy(writeDataBuff, &(text[i + 2]), i_write_len);
-
-           esp_err_t err = esp_ota_write( update_handle, (const void *)writeDataBuff, i_write_len);
-           if (err != ESP_OK) {
-               ESP_LOGE(TAG_FOTA, "Error: esp_ota_write failed! err=0x%x", err);
-               return false;
-           } else {
-               ESP_LOGI(TAG_FOTA, "esp_ota_write header OK");
-               binaryFileLength += i_write_len;
-           }
-           return true;
-       }
-       i += i_read_len;
-   }
-   return false;
+const char *fota_state_name(fota_state_t state) {
+    static const char *const names[] = { "start", "progress", "done", "failed" };
+    return (unsigned)state < sizeof(names) / sizeof(names[0]) ? names[state] : "unknown";
 }
-
-bool fota_connect_to_http_server()
-{
-   // TODO: Use fota_update parameters()
-   ESP_LOGI(TAG_FOTA, "Server IP: %s Server Port:%s", "192.168.1.10", "8080");
-   sprintf(http_request, "GET %s HTTP/1.1\r\nHost: %s:%s \r\n\r\n", "BLE_Tracker.bin", "192.168.1.10", "8080");
-
-   int  http_connect_flag = -1;
-   struct sockaddr_in sock_info;
-
-   socketId = socket(AF_INET, SOCK_STREAM, 0);
-   if (socketId == -1) {
-       ESP_LOGE(TAG_FOTA, "Create socket failed!");
-       return false;
-   }
-
-   // set connect info
-   memset(&sock_info, 0, sizeof(struct sockaddr_in));
-   sock_info.sin_family = AF_INET;
-   // TODO Use start_update parameters
-   sock_info.sin_addr.s_addr = inet_addr("192.168.1.10");
-   sock_info.sin_port = htons(atoi("8080"));
-
-   // connect to http server
-   http_connect_flag = connect(socketId, (struct sockaddr *)&sock_info, sizeof(sock_info));
-   if (http_connect_flag == -1) {
-       ESP_LOGE(TAG_FOTA, "Connect to server failed! errno=%d", errno);
-       close(socketId);
-       return false;
-   } else {
-       ESP_LOGI(TAG_FOTA, "Connected to server");
-       return true;
-   }
-   return false;
-}
\ No newline at end of file
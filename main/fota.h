@@ -3,40 +3,46 @@
 
 // Includes
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include "esp_ota_ops.h"
+#include "fota_http.h"
+
+typedef enum {
+    FOTA_STATE_START = 0,
+    FOTA_STATE_PROGRESS,
+    FOTA_STATE_DONE,        // About to restart on the new image
+    FOTA_STATE_FAILED,      // Still running the current image
+} fota_state_t;
+
+typedef struct {
+    fota_state_t state;
+    fota_err_t   err;
+    uint32_t     received;  // Downloaded bytes
+    uint32_t     written;   // Downloaded bytes decoded and flashed
+    int64_t      total;     // Content-Length, -1 if unknown
+    uint32_t     elapsed_ms;
+} fota_progress_t;
 
 /*
- * Start firmware over the air upgrade
- * char *url : Url of the new firmware
- * return: FOTA state
+ * Called from the OTA task at start, every FOTA_PROGRESS_STEP bytes and at the end
  */
-uint8_t fota_update(char *url);
+typedef void (*fota_progress_cb_t)(const fota_progress_t *progress);
 
 /*
- * Read buffer by byte still delim ,return read bytes counts
+ * Start firmware over the air upgrade in the OTA task, restarts on success
+ * request: "<url> [<sha256 of the image, hex>]", e.g.
+ *          "http://192.168.1.10:8080/BLE_Tracker.bin 9f86d0...", the digest is
+ *          checked before the new image is made bootable. The URL may point to
+ *          a plain image or to a compressed or delta one made by
+ *          tools/fota_pack.py, the digest is always the one of the plain image.
+ * return: false if an update is already running or the request is too long
  */
-int fota_read_until(char *buffer, char delim, int len);
+bool fota_update(const char *request, size_t len, fota_progress_cb_t progress);
 
 /*
- * resolve a packet from http socket
- * return true if packet including \r\n\r\n that means http packet header finished,start to receive packet body
- * otherwise return false
+ * Printable state
  */
-bool fota_read_past_http_header(char text[], int total_len, esp_ota_handle_t update_handle);
+const char *fota_state_name(fota_state_t state);
 
-/*
- * Connect to HTTP server and prepare HTTP request
- */
-bool fota_connect_to_http_server();
-
-/*
- * Error handler
- */
-void __attribute__((noreturn)) fota_task_fatal_error();
-
-/*
- * Example from ESP-IDF for now
- */
-void fota_update_task( void );
-
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,318 @@
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#ifdef ESP_PLATFORM
+#include "lwip/netdb.h"
+#else
+#include <netdb.h>
+#endif
+#include "mbedtls/sha256.h"
+#include "fota_http.h"
+
+
+// Constants
+#define FOTA_RECV_TIMEOUT_S 10
+
+
+static inline char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+/*
+ * Case insensitive prefix match
+ */
+static bool starts_with(const char *s, size_t len, const char *prefix) {
+    size_t n = strlen(prefix);
+    if (len < n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (lower(s[i]) != prefix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool fota_url_parse(const char *url, size_t len, fota_url_t *out) {
+    const char *end = url + len;
+    const char *p;
+    uint32_t port = 80;
+
+    if (!starts_with(url, len, "http://")) {
+        return false;
+    }
+    url += 7;
+    for (p = url; p < end && *p != ':' && *p != '/'; p++) {
+    }
+    if (p == url || (size_t)(p - url) >= sizeof(out->host)) {
+        return false;
+    }
+    memcpy(out->host, url, p - url);
+    out->host[p - url] = '\0';
+
+    if (p < end && *p == ':') {
+        port = 0;
+        const char *digits = ++p;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            port = port * 10 + (uint32_t)(*p - '0');
+            if (port > 65535) {
+                return false;
+            }
+        }
+        if (p == digits || port == 0 || (p < end && *p != '/')) {
+            return false;
+        }
+    }
+    out->port = (uint16_t)port;
+
+    if (p == end) {
+        strcpy(out->path, "/");
+    } else {
+        if ((size_t)(end - p) >= sizeof(out->path)) {
+            return false;
+        }
+        memcpy(out->path, p, end - p);
+        out->path[end - p] = '\0';
+    }
+    return true;
+}
+
+void fota_http_init(fota_http_parser_t *parser) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = FOTA_HTTP_STATUS;
+    parser->content_length = -1;
+}
+
+/*
+ * Handle one complete line, without its CR LF
+ */
+static void fota_http_line(fota_http_parser_t *parser) {
+    const char *line = parser->line;
+    size_t len = parser->line_len;
+
+    if (parser->state == FOTA_HTTP_STATUS) {
+        // HTTP/1.x 200 OK
+        if (len < 12 || !starts_with(line, len, "http/1.") || line[8] != ' ') {
+            parser->state = FOTA_HTTP_ERROR;
+            return;
+        }
+        parser->status = 0;
+        for (int i = 9; i < 12; i++) {
+            if (line[i] < '0' || line[i] > '9') {
+                parser->state = FOTA_HTTP_ERROR;
+                return;
+            }
+            parser->status = parser->status * 10 + (line[i] - '0');
+        }
+        parser->state = FOTA_HTTP_HEADERS;
+        return;
+    }
+
+    if (len == 0) {
+        parser->state = FOTA_HTTP_BODY;
+    } else if (parser->line_overflow) {
+        // Not a header we use
+    } else if (starts_with(line, len, "content-length:")) {
+        int64_t value = 0;
+        size_t i = 15;
+        while (i < len && (line[i] == ' ' || line[i] == '\t')) {
+            i++;
+        }
+        if (i == len) {
+            parser->state = FOTA_HTTP_ERROR;
+            return;
+        }
+        for (; i < len && line[i] >= '0' && line[i] <= '9'; i++) {
+            value = value * 10 + (line[i] - '0');
+            if (value > INT32_MAX) {
+                parser->state = FOTA_HTTP_ERROR;
+                return;
+            }
+        }
+        parser->content_length = value;
+    } else if (starts_with(line, len, "transfer-encoding:")) {
+        for (size_t i = 18; i + 7 <= len; i++) {
+            if (starts_with(&line[i], len - i, "chunked")) {
+                parser->chunked = true;
+            }
+        }
+    }
+}
+
+int fota_http_feed(fota_http_parser_t *parser, const uint8_t *data, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len && parser->state < FOTA_HTTP_BODY; i++) {
+        char c = (char)data[i];
+        if (c == '\n') {
+            fota_http_line(parser);
+            parser->line_len = 0;
+            parser->line_overflow = false;
+        } else if (c == '\r') {
+            // Dropped, bare LF line ends are accepted too
+        } else if (parser->line_len < sizeof(parser->line) - 1) {
+            parser->line[parser->line_len++] = c;
+            parser->line[parser->line_len] = '\0';
+        } else {
+            parser->line_overflow = true;
+        }
+    }
+    if (parser->state == FOTA_HTTP_ERROR) {
+        return -1;
+    }
+    return (int)i;
+}
+
+/*
+ * return: connected socket, -1 on error
+ */
+static int fota_connect(const fota_url_t *url) {
+    struct addrinfo hints, *res = NULL;
+    struct timeval timeout = { FOTA_RECV_TIMEOUT_S, 0 };
+    char port[6];
+    int sock;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", url->port);
+    if (getaddrinfo(url->host, port, &hints, &res) != 0 || res == NULL) {
+        return -1;
+    }
+    sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock >= 0) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+/*
+ * Room for the next read
+ */
+static uint8_t *fota_recv_buffer(const fota_sink_t *sink, uint8_t *buf, size_t *size) {
+    return sink->buffer ? sink->buffer(sink->ctx, size) : buf;
+}
+
+/*
+ * Headers are over: check the response and open the sink
+ */
+static fota_err_t fota_body_start(const fota_http_parser_t *parser, uint32_t max_len,
+                                  const fota_sink_t *sink) {
+    if (parser->status != 200 || parser->chunked) {
+        return FOTA_ERR_HTTP;
+    }
+    if (parser->content_length > (int64_t)max_len) {
+        return FOTA_ERR_LENGTH;
+    }
+    if (sink->begin(sink->ctx, parser->content_length)) {
+        return FOTA_ERR_WRITE;
+    }
+    return FOTA_OK;
+}
+
+fota_err_t fota_download(const fota_url_t *url, const uint8_t *sha256, uint32_t max_len,
+                         const fota_sink_t *sink, uint8_t *buf, size_t size, fota_result_t *result) {
+    fota_http_parser_t parser;
+    mbedtls_sha256_context sha;
+    fota_err_t err = FOTA_OK;
+    size_t room = size;
+    int sock, len;
+
+    memset(result, 0, sizeof(*result));
+    buf = fota_recv_buffer(sink, buf, &room);
+    if (buf == NULL) {
+        return FOTA_ERR_WRITE;
+    }
+    sock = fota_connect(url);
+    if (sock < 0) {
+        return FOTA_ERR_CONNECT;
+    }
+    // HTTP/1.0: no chunked body, the server closes at the end
+    len = snprintf((char *)buf, room, "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                   url->path, url->host);
+    if (len < 0 || (size_t)len >= room || send(sock, buf, len, 0) != len) {
+        close(sock);
+        return FOTA_ERR_SEND;
+    }
+
+    fota_http_init(&parser);
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    while (err == FOTA_OK) {
+        room = size;
+        buf = fota_recv_buffer(sink, buf, &room);
+        if (buf == NULL) {
+            err = FOTA_ERR_WRITE;
+            break;
+        }
+        len = recv(sock, buf, room, 0);
+        if (len < 0) {
+            err = FOTA_ERR_RECV;
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        uint8_t *body = buf;
+        if (parser.state != FOTA_HTTP_BODY) {
+            int used = fota_http_feed(&parser, buf, len);
+            if (used < 0) {
+                err = FOTA_ERR_HTTP;
+                break;
+            }
+            if (parser.state != FOTA_HTTP_BODY) {
+                continue;
+            }
+            result->status = parser.status;
+            err = fota_body_start(&parser, max_len, sink);
+            body += used;
+            len -= used;
+        }
+        if (len == 0 || err != FOTA_OK) {
+            continue;
+        }
+        result->received += len;
+        if (result->received > max_len ||
+            (parser.content_length >= 0 && result->received > parser.content_length)) {
+            err = FOTA_ERR_LENGTH;
+            break;
+        }
+        mbedtls_sha256_update(&sha, body, len);
+        if (sink->write(sink->ctx, body, len)) {
+            err = FOTA_ERR_WRITE;
+        }
+    }
+    close(sock);
+    mbedtls_sha256_finish(&sha, result->sha256);
+    mbedtls_sha256_free(&sha);
+
+    if (err != FOTA_OK) {
+        return err;
+    }
+    if (parser.state != FOTA_HTTP_BODY) {
+        return FOTA_ERR_HTTP;
+    }
+    if (parser.content_length >= 0 && result->received != parser.content_length) {
+        return FOTA_ERR_LENGTH;
+    }
+    if (sha256 && memcmp(sha256, result->sha256, FOTA_SHA256_LEN) != 0) {
+        return FOTA_ERR_DIGEST;
+    }
+    return FOTA_OK;
+}
+
+const char *fota_err_name(fota_err_t err) {
+    static const char *const names[] = {
+        "ok", "connect", "send", "receive", "bad response", "bad length", "flash write", "digest mismatch",
+        "bad image", "wrong delta base",
+    };
+    return (unsigned)err < sizeof(names) / sizeof(names[0]) ? names[err] : "unknown";
+}
@@ -0,0 +1,104 @@
+#ifndef __FOTA_HTTP_H__
+#define __FOTA_HTTP_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FOTA_HOST_MAX       64
+#define FOTA_PATH_MAX       192
+#define FOTA_HTTP_LINE_MAX  256     // Longer header lines are skipped
+#define FOTA_SHA256_LEN     32
+
+/*
+ * http://host[:port]/path
+ */
+typedef struct {
+    char     host[FOTA_HOST_MAX];
+    uint16_t port;
+    char     path[FOTA_PATH_MAX];
+} fota_url_t;
+
+/*
+ * return: false if not an http URL or a field is too long
+ */
+bool fota_url_parse(const char *url, size_t len, fota_url_t *out);
+
+typedef enum {
+    FOTA_HTTP_STATUS = 0,
+    FOTA_HTTP_HEADERS,
+    FOTA_HTTP_BODY,
+    FOTA_HTTP_ERROR,
+} fota_http_state_t;
+
+/*
+ * Streaming HTTP response header parser, lines may be split across reads
+ */
+typedef struct {
+    fota_http_state_t state;
+    int               status;
+    int64_t           content_length;   // -1 if not sent
+    bool              chunked;
+    size_t            line_len;
+    bool              line_overflow;
+    char              line[FOTA_HTTP_LINE_MAX];
+} fota_http_parser_t;
+
+void fota_http_init(fota_http_parser_t *parser);
+
+/*
+ * Parse the next received bytes
+ * return: bytes consumed by the status line and headers, the rest of data is
+ * body once parser->state is FOTA_HTTP_BODY; -1 on malformed response
+ */
+int fota_http_feed(fota_http_parser_t *parser, const uint8_t *data, size_t len);
+
+typedef enum {
+    FOTA_OK = 0,
+    FOTA_ERR_CONNECT,
+    FOTA_ERR_SEND,
+    FOTA_ERR_RECV,
+    FOTA_ERR_HTTP,          // Malformed response, status not 200 or chunked body
+    FOTA_ERR_LENGTH,        // Too large, or not the announced Content-Length
+    FOTA_ERR_WRITE,
+    FOTA_ERR_DIGEST,
+    FOTA_ERR_IMAGE,         // Corrupt compressed or delta image
+    FOTA_ERR_BASE,          // Delta made against another image than the running one
+} fota_err_t;
+
+/*
+ * Where the image goes, callbacks return 0 on success
+ * begin: called once the headers are parsed, image_len is -1 if unknown
+ * write: data points into the receive buffer, no copy is made
+ * buffer: optional, room for the next recv(), NULL to abort. Lets the sink hand
+ *         out its own buffers and keep the written ones until they are flashed.
+ */
+typedef struct {
+    int      (*begin)(void *ctx, int64_t image_len);
+    int      (*write)(void *ctx, const uint8_t *data, size_t len);
+    uint8_t *(*buffer)(void *ctx, size_t *size);
+    void      *ctx;
+} fota_sink_t;
+
+typedef struct {
+    uint32_t received;      // Body bytes
+    int      status;        // HTTP status
+    uint8_t  sha256[FOTA_SHA256_LEN];
+} fota_result_t;
+
+/*
+ * GET the URL over HTTP/1.0 and stream the body to the sink
+ * sha256: expected body digest, NULL to skip the check
+ * max_len: largest acceptable image
+ * buf, size: receive buffer, unused if the sink provides its buffers
+ */
+fota_err_t fota_download(const fota_url_t *url, const uint8_t *sha256, uint32_t max_len,
+                         const fota_sink_t *sink, uint8_t *buf, size_t size, fota_result_t *result);
+
+/*
+ * Printable error
+ */
+const char *fota_err_name(fota_err_t err);
+
+#endif
@@ -0,0 +1,346 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fota_image.h"
+
+
+// Constants
+#define FOTA_IMAGE_MAGIC        "FPAT"
+#define FOTA_IMAGE_MAGIC_LEN    4
+#define FOTA_IMAGE_VERSION      1
+
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+void fota_image_init(fota_image_t *img, const fota_sink_t *out, const fota_base_t *base) {
+    memset(img, 0, sizeof(*img));
+    img->out = out;
+    if (base) {
+        img->base = *base;
+    }
+    img->state = FOTA_IMAGE_STATE_HEADER;
+    img->image_len = UINT32_MAX;
+    mbedtls_sha256_init(&img->sha);
+    mbedtls_sha256_starts(&img->sha, 0);
+}
+
+static int fota_image_fail(fota_image_t *img, fota_err_t err) {
+    if (img->err == FOTA_OK) {
+        img->err = err;
+    }
+    img->state = FOTA_IMAGE_STATE_ERROR;
+    return -1;
+}
+
+static int fota_image_flush(fota_image_t *img) {
+    if (img->out_len == 0) {
+        return 0;
+    }
+    if (img->out->write(img->out->ctx, img->out_buf, img->out_len)) {
+        return fota_image_fail(img, FOTA_ERR_WRITE);
+    }
+    img->out_len = 0;
+    return 0;
+}
+
+/*
+ * Account decoded bytes and buffer them until a full chunk can be written
+ */
+static int fota_image_emit(fota_image_t *img, const uint8_t *data, size_t len) {
+    if (len > img->image_len - img->written) {
+        return fota_image_fail(img, FOTA_ERR_IMAGE);
+    }
+    mbedtls_sha256_update(&img->sha, data, len);
+    img->written += len;
+    while (len) {
+        size_t n = sizeof(img->out_buf) - img->out_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&img->out_buf[img->out_len], data, n);
+        img->out_len += n;
+        data += n;
+        len -= n;
+        if (img->out_len == sizeof(img->out_buf) && fota_image_flush(img)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Plain image, written as received
+ */
+static int fota_image_raw(fota_image_t *img, const uint8_t *data, size_t len) {
+    mbedtls_sha256_update(&img->sha, data, len);
+    img->written += len;
+    if (img->out->write(img->out->ctx, data, len)) {
+        return fota_image_fail(img, FOTA_ERR_WRITE);
+    }
+    return 0;
+}
+
+/*
+ * Base bytes at src plus the received differences
+ */
+static int fota_image_diff(fota_image_t *img, const uint8_t *data, size_t len) {
+    while (len) {
+        size_t n = len < sizeof(img->base_buf) ? len : sizeof(img->base_buf);
+        if (img->base.read(img->base.ctx, img->src, img->base_buf, n)) {
+            return fota_image_fail(img, FOTA_ERR_BASE);
+        }
+        for (size_t i = 0; i < n; i++) {
+            img->base_buf[i] += data[i];
+        }
+        if (fota_image_emit(img, img->base_buf, n)) {
+            return -1;
+        }
+        img->src += n;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Delta operations, split anywhere across calls
+ */
+static int fota_image_ops(fota_image_t *img, const uint8_t *data, size_t len) {
+    while (len) {
+        switch (img->op_state) {
+        case FOTA_OP_STATE_TYPE:
+            img->op = *data++;
+            len--;
+            if (img->op != FOTA_OP_DIFF && img->op != FOTA_OP_INSERT) {
+                return fota_image_fail(img, FOTA_ERR_IMAGE);
+            }
+            img->varint = 0;
+            img->shift = 0;
+            img->op_state = FOTA_OP_STATE_LEN;
+            break;
+        case FOTA_OP_STATE_LEN:
+        case FOTA_OP_STATE_SRC: {
+            uint8_t c = *data++;
+            len--;
+            if (img->shift > 28) {
+                return fota_image_fail(img, FOTA_ERR_IMAGE);
+            }
+            img->varint |= (uint32_t)(c & 0x7F) << img->shift;
+            img->shift += 7;
+            if (c & 0x80) {
+                break;
+            }
+            uint32_t value = img->varint;
+            img->varint = 0;
+            img->shift = 0;
+            if (img->op_state == FOTA_OP_STATE_LEN) {
+                if (value > img->image_len - img->written) {
+                    return fota_image_fail(img, FOTA_ERR_IMAGE);
+                }
+                img->op_len = value;
+                img->op_state = (img->op == FOTA_OP_DIFF) ? FOTA_OP_STATE_SRC : FOTA_OP_STATE_DATA;
+            } else {
+                int64_t src = (int64_t)img->src + ((value >> 1) ^ -(int64_t)(value & 1));
+                if (src < 0 || src + img->op_len > img->base_len) {
+                    return fota_image_fail(img, FOTA_ERR_IMAGE);
+                }
+                img->src = (uint32_t)src;
+                img->op_state = FOTA_OP_STATE_DATA;
+            }
+            if (img->op_state == FOTA_OP_STATE_DATA && img->op_len == 0) {
+                img->op_state = FOTA_OP_STATE_TYPE;
+            }
+            break;
+        }
+        case FOTA_OP_STATE_DATA: {
+            size_t n = len < img->op_len ? len : img->op_len;
+            int ret = (img->op == FOTA_OP_DIFF) ? fota_image_diff(img, data, n) : fota_image_emit(img, data, n);
+            if (ret) {
+                return -1;
+            }
+            data += n;
+            len -= n;
+            img->op_len -= n;
+            if (img->op_len == 0) {
+                img->op_state = FOTA_OP_STATE_TYPE;
+            }
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Uncompressed payload
+ */
+static int fota_image_payload(fota_image_t *img, const uint8_t *data, size_t len) {
+    return (img->flags & FOTA_IMAGE_DELTA) ? fota_image_ops(img, data, len) : fota_image_emit(img, data, len);
+}
+
+static int fota_image_inflate(fota_image_t *img, const uint8_t *data, size_t len) {
+    while (1) {
+        size_t in = len;
+        size_t out = TINFL_LZ_DICT_SIZE - img->dict_ofs;
+        tinfl_status status = tinfl_decompress(img->inflator, data, &in, img->dict, &img->dict[img->dict_ofs],
+                                               &out, TINFL_FLAG_HAS_MORE_INPUT);
+        data += in;
+        len -= in;
+        if (out && fota_image_payload(img, &img->dict[img->dict_ofs], out)) {
+            return -1;
+        }
+        img->dict_ofs = (img->dict_ofs + out) & (TINFL_LZ_DICT_SIZE - 1);
+        if (status < TINFL_STATUS_DONE) {
+            return fota_image_fail(img, FOTA_ERR_IMAGE);
+        }
+        if (status == TINFL_STATUS_DONE) {
+            img->state = FOTA_IMAGE_STATE_END;
+            // Nothing may follow the compressed stream
+            return len ? fota_image_fail(img, FOTA_ERR_IMAGE) : 0;
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Container header complete
+ */
+static int fota_image_header(fota_image_t *img) {
+    const uint8_t *h = img->header;
+
+    img->flags = h[5];
+    img->image_len = get_le32(&h[8]);
+    img->base_len = get_le32(&h[12]);
+    if (h[4] != FOTA_IMAGE_VERSION || (img->flags & ~(FOTA_IMAGE_DEFLATE | FOTA_IMAGE_DELTA))) {
+        return fota_image_fail(img, FOTA_ERR_IMAGE);
+    }
+    if (img->flags & FOTA_IMAGE_DELTA) {
+        // Rebuilding from another image would only produce garbage
+        mbedtls_sha256_context sha;
+        uint8_t digest[FOTA_SHA256_LEN];
+        bool ok = img->base.read && img->base_len <= img->base.size;
+
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts(&sha, 0);
+        for (uint32_t offset = 0; ok && offset < img->base_len; offset += sizeof(img->base_buf)) {
+            size_t n = img->base_len - offset;
+            if (n > sizeof(img->base_buf)) {
+                n = sizeof(img->base_buf);
+            }
+            ok = img->base.read(img->base.ctx, offset, img->base_buf, n) == 0;
+            mbedtls_sha256_update(&sha, img->base_buf, n);
+        }
+        mbedtls_sha256_finish(&sha, digest);
+        mbedtls_sha256_free(&sha);
+        if (!ok || memcmp(digest, &h[16], FOTA_SHA256_LEN) != 0) {
+            return fota_image_fail(img, FOTA_ERR_BASE);
+        }
+    }
+    if (img->flags & FOTA_IMAGE_DEFLATE) {
+        img->inflator = malloc(sizeof(tinfl_decompressor));
+        img->dict = malloc(TINFL_LZ_DICT_SIZE);
+        if (img->inflator == NULL || img->dict == NULL) {
+            return fota_image_fail(img, FOTA_ERR_IMAGE);
+        }
+        tinfl_init(img->inflator);
+    }
+    img->state = FOTA_IMAGE_STATE_PAYLOAD;
+    return 0;
+}
+
+static int fota_image_begin(void *ctx, int64_t image_len) {
+    fota_image_t *img = (fota_image_t *)ctx;
+    // Only the transfer length is known yet
+    return img->out->begin(img->out->ctx, -1);
+}
+
+static int fota_image_write(void *ctx, const uint8_t *data, size_t len) {
+    fota_image_t *img = (fota_image_t *)ctx;
+
+    if (img->state == FOTA_IMAGE_STATE_HEADER) {
+        size_t n = FOTA_IMAGE_HEADER_LEN - img->header_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&img->header[img->header_len], data, n);
+        img->header_len += n;
+        data += n;
+        len -= n;
+        if (img->header_len < FOTA_IMAGE_MAGIC_LEN) {
+            return 0;
+        }
+        if (memcmp(img->header, FOTA_IMAGE_MAGIC, FOTA_IMAGE_MAGIC_LEN) != 0) {
+            img->state = FOTA_IMAGE_STATE_RAW;
+            if (fota_image_raw(img, img->header, img->header_len)) {
+                return -1;
+            }
+        } else if (img->header_len < FOTA_IMAGE_HEADER_LEN) {
+            return 0;
+        } else if (fota_image_header(img)) {
+            return -1;
+        }
+    }
+    if (len == 0) {
+        return img->state == FOTA_IMAGE_STATE_ERROR ? -1 : 0;
+    }
+    switch (img->state) {
+    case FOTA_IMAGE_STATE_RAW:
+        return fota_image_raw(img, data, len);
+    case FOTA_IMAGE_STATE_PAYLOAD:
+        if (img->flags & FOTA_IMAGE_DEFLATE) {
+            return fota_image_inflate(img, data, len);
+        }
+        return fota_image_payload(img, data, len);
+    case FOTA_IMAGE_STATE_END:
+        return fota_image_fail(img, FOTA_ERR_IMAGE);
+    default:
+        return -1;
+    }
+}
+
+void fota_image_sink(fota_image_t *img, fota_sink_t *sink) {
+    sink->begin = fota_image_begin;
+    sink->write = fota_image_write;
+    sink->buffer = NULL;
+    sink->ctx = img;
+}
+
+fota_err_t fota_image_finish(fota_image_t *img) {
+    bool complete;
+
+    switch (img->state) {
+    case FOTA_IMAGE_STATE_RAW:
+        complete = true;
+        break;
+    case FOTA_IMAGE_STATE_PAYLOAD:
+        complete = !(img->flags & FOTA_IMAGE_DEFLATE);
+        break;
+    case FOTA_IMAGE_STATE_END:
+        complete = true;
+        break;
+    default:
+        complete = false;
+        break;
+    }
+    if ((img->flags & FOTA_IMAGE_DELTA) && img->op_state != FOTA_OP_STATE_TYPE) {
+        complete = false;
+    }
+    if (img->state != FOTA_IMAGE_STATE_RAW && img->written != img->image_len) {
+        complete = false;
+    }
+    if (!complete) {
+        fota_image_fail(img, FOTA_ERR_IMAGE);
+    } else {
+        fota_image_flush(img);
+    }
+    mbedtls_sha256_finish(&img->sha, img->sha256);
+    mbedtls_sha256_free(&img->sha);
+    free(img->inflator);
+    free(img->dict);
+    img->inflator = NULL;
+    img->dict = NULL;
+    return img->err;
+}
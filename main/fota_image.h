@@ -0,0 +1,115 @@
+#ifndef __FOTA_IMAGE_H__
+#define __FOTA_IMAGE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "mbedtls/sha256.h"
+#include "rom/miniz.h"
+#include "fota_http.h"
+
+/*
+ * Update container, written by tools/fota_pack.py. Anything else is taken as a
+ * plain image. Little endian header:
+ *   0  "FPAT"
+ *   4  version, 1
+ *   5  flags, FOTA_IMAGE_DEFLATE | FOTA_IMAGE_DELTA
+ *   6  reserved, 0
+ *   8  image length
+ *  12  base length, delta only
+ *  16  SHA-256 of the base, delta only
+ * Then the payload, raw deflate if compressed. A delta payload is a list of
+ * operations rebuilding the image from the running one (the base):
+ *   FOTA_OP_DIFF   <len> <src> <len bytes added to the base bytes at src>
+ *   FOTA_OP_INSERT <len> <len bytes>
+ * len is an unsigned LEB128, src a zigzag LEB128 relative to the end of the
+ * previous DIFF source. Unchanged code is a DIFF of zeros, which deflate
+ * squeezes to almost nothing.
+ */
+#define FOTA_IMAGE_HEADER_LEN   48
+#define FOTA_IMAGE_DEFLATE      0x01
+#define FOTA_IMAGE_DELTA        0x02
+#define FOTA_OP_DIFF            0
+#define FOTA_OP_INSERT          1
+
+#define FOTA_IMAGE_OUT_SIZE     4096    // Decoded bytes are written in chunks of this size
+#define FOTA_IMAGE_BASE_CHUNK   512
+
+/*
+ * Image the delta applies to, the running partition
+ */
+typedef struct {
+    int    (*read)(void *ctx, uint32_t offset, void *buf, size_t len);
+    void    *ctx;
+    uint32_t size;
+} fota_base_t;
+
+typedef enum {
+    FOTA_IMAGE_STATE_HEADER = 0,
+    FOTA_IMAGE_STATE_RAW,
+    FOTA_IMAGE_STATE_PAYLOAD,
+    FOTA_IMAGE_STATE_END,           // Deflate stream complete
+    FOTA_IMAGE_STATE_ERROR,
+} fota_image_state_t;
+
+typedef enum {
+    FOTA_OP_STATE_TYPE = 0,
+    FOTA_OP_STATE_LEN,
+    FOTA_OP_STATE_SRC,
+    FOTA_OP_STATE_DATA,
+} fota_op_state_t;
+
+/*
+ * Streaming decoder, sits between the download and the flash sink. Bounded
+ * RAM: this structure, plus the inflate state and its 32 KB dictionary which
+ * are only allocated for a compressed image.
+ */
+typedef struct {
+    const fota_sink_t      *out;
+    fota_base_t             base;
+    fota_image_state_t      state;
+    fota_err_t              err;
+    uint8_t                 header[FOTA_IMAGE_HEADER_LEN];
+    size_t                  header_len;
+    uint8_t                 flags;
+    uint32_t                image_len;      // UINT32_MAX for a plain image
+    uint32_t                base_len;
+    uint32_t                written;        // Decoded bytes
+    // Delta operations
+    fota_op_state_t         op_state;
+    uint8_t                 op;
+    uint32_t                op_len;
+    uint32_t                src;
+    uint32_t                varint;
+    uint8_t                 shift;
+    // Deflate
+    tinfl_decompressor     *inflator;
+    uint8_t                *dict;
+    size_t                  dict_ofs;
+    mbedtls_sha256_context  sha;
+    uint8_t                 sha256[FOTA_SHA256_LEN];   // Of the decoded image, after fota_image_finish()
+    size_t                  out_len;
+    uint8_t                 out_buf[FOTA_IMAGE_OUT_SIZE];
+    uint8_t                 base_buf[FOTA_IMAGE_BASE_CHUNK];
+} fota_image_t;
+
+/*
+ * out: receives the decoded image
+ * base: NULL if deltas are not supported
+ */
+void fota_image_init(fota_image_t *img, const fota_sink_t *out, const fota_base_t *base);
+
+/*
+ * Sink decoding into out
+ */
+void fota_image_sink(fota_image_t *img, fota_sink_t *sink);
+
+/*
+ * Write the last decoded bytes and check the image is complete, img->sha256 is
+ * its digest
+ * return: FOTA_OK, or the first error
+ */
+fota_err_t fota_image_finish(fota_image_t *img);
+
+#endif
@@ -0,0 +1,146 @@
+#include <string.h>
+#include "fota_pipe.h"
+
+
+// Constants
+#define FOTA_PIPE_STACK     2048
+// Hand a buffer to the writer once less than a quarter of it is left
+#define FOTA_PIPE_MIN_ROOM(size) ((size) / 4)
+
+typedef struct {
+    const uint8_t *data;
+    size_t         len;
+    uint8_t       *buf;             // Back to the pool once written
+} fota_chunk_t;
+
+
+static void fota_pipe_writer(void *pvParameters) {
+    fota_pipe_t *pipe = (fota_pipe_t *)pvParameters;
+    const fota_sink_t *flash = pipe->flash;
+    fota_chunk_t chunk;
+
+    while (1) {
+        xQueueReceive(pipe->full, &chunk, portMAX_DELAY);
+        if (chunk.data == NULL) {
+            break;
+        }
+        // After a failure, buffers are only recycled so that the reader never blocks
+        if (!pipe->failed) {
+            if (flash->write(flash->ctx, chunk.data, chunk.len)) {
+                pipe->failed = true;
+            } else {
+                pipe->written += chunk.len;
+            }
+        }
+        xQueueSend(pipe->free, &chunk.buf, portMAX_DELAY);
+    }
+    xTaskNotifyGive(pipe->reader);
+    vTaskDelete(NULL);
+}
+
+bool fota_pipe_start(fota_pipe_t *pipe, uint8_t *pool, size_t count, size_t size,
+                     const fota_sink_t *flash, UBaseType_t priority) {
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->flash = flash;
+    pipe->pool = pool;
+    pipe->size = size;
+    pipe->reader = xTaskGetCurrentTaskHandle();
+    pipe->free = xQueueCreate(count, sizeof(uint8_t *));
+    // One more slot for the end marker
+    pipe->full = xQueueCreate(count + 1, sizeof(fota_chunk_t));
+    if (pipe->free == NULL || pipe->full == NULL) {
+        goto error;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *buf = &pool[i * size];
+        xQueueSend(pipe->free, &buf, 0);
+    }
+    if (xTaskCreate(&fota_pipe_writer, "fota_writer", FOTA_PIPE_STACK, pipe, priority, NULL) != pdPASS) {
+        goto error;
+    }
+    return true;
+
+error:
+    if (pipe->free) {
+        vQueueDelete(pipe->free);
+    }
+    if (pipe->full) {
+        vQueueDelete(pipe->full);
+    }
+    return false;
+}
+
+/*
+ * Queue the pending bytes of the current buffer
+ */
+static void fota_pipe_handoff(fota_pipe_t *pipe) {
+    fota_chunk_t chunk = { &pipe->cur[pipe->start], pipe->fill - pipe->start, pipe->cur };
+    xQueueSend(pipe->full, &chunk, portMAX_DELAY);
+    pipe->cur = NULL;
+}
+
+static uint8_t *fota_pipe_buffer(void *ctx, size_t *size) {
+    fota_pipe_t *pipe = (fota_pipe_t *)ctx;
+
+    if (pipe->failed) {
+        return NULL;
+    }
+    if (pipe->cur == NULL) {
+        if (xQueueReceive(pipe->free, &pipe->cur, 0) != pdTRUE) {
+            // Flash is the bottleneck
+            pipe->stalls++;
+            xQueueReceive(pipe->free, &pipe->cur, portMAX_DELAY);
+        }
+        pipe->start = 0;
+        pipe->fill = 0;
+    }
+    *size = pipe->size - pipe->fill;
+    return &pipe->cur[pipe->fill];
+}
+
+/*
+ * data is within the room returned by fota_pipe_buffer(), past any header bytes
+ */
+static int fota_pipe_write(void *ctx, const uint8_t *data, size_t len) {
+    fota_pipe_t *pipe = (fota_pipe_t *)ctx;
+    size_t offset = (size_t)(data - pipe->cur);
+
+    if (pipe->fill == pipe->start) {
+        pipe->start = offset;
+    }
+    pipe->fill = offset + len;
+    if (pipe->size - pipe->fill < FOTA_PIPE_MIN_ROOM(pipe->size)) {
+        fota_pipe_handoff(pipe);
+    }
+    return pipe->failed ? -1 : 0;
+}
+
+static int fota_pipe_begin(void *ctx, int64_t image_len) {
+    fota_pipe_t *pipe = (fota_pipe_t *)ctx;
+    return pipe->flash->begin(pipe->flash->ctx, image_len);
+}
+
+void fota_pipe_sink(fota_pipe_t *pipe, fota_sink_t *sink) {
+    sink->begin = fota_pipe_begin;
+    sink->write = fota_pipe_write;
+    sink->buffer = fota_pipe_buffer;
+    sink->ctx = pipe;
+}
+
+int fota_pipe_finish(fota_pipe_t *pipe) {
+    fota_chunk_t end = { NULL, 0, NULL };
+
+    if (pipe->cur) {
+        if (pipe->fill > pipe->start) {
+            fota_pipe_handoff(pipe);
+        } else {
+            xQueueSend(pipe->free, &pipe->cur, 0);
+            pipe->cur = NULL;
+        }
+    }
+    xQueueSend(pipe->full, &end, portMAX_DELAY);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    vQueueDelete(pipe->free);
+    vQueueDelete(pipe->full);
+    return pipe->failed ? -1 : 0;
+}
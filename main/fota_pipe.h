@@ -0,0 +1,55 @@
+#ifndef __FOTA_PIPE_H__
+#define __FOTA_PIPE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "fota_http.h"
+
+/*
+ * Buffers between the network reader and a flash writer task, so that recv()
+ * and flash erase / write overlap. The reader receives straight into a pool
+ * buffer, which is queued to the writer once nearly full and comes back to
+ * the pool once written. Used through fota_pipe_sink().
+ */
+typedef struct {
+    const fota_sink_t *flash;       // Written from the writer task
+    uint8_t           *pool;
+    size_t             size;        // Per buffer
+    QueueHandle_t      free;        // Buffers to receive into
+    QueueHandle_t      full;        // Chunks to write, NULL data ends the writer
+    TaskHandle_t       reader;
+    uint8_t           *cur;         // Buffer being received into
+    size_t             start;       // Pending bytes of cur, [start, fill)
+    size_t             fill;
+    volatile bool      failed;      // A flash write failed, the reader aborts
+    volatile uint32_t  written;
+    uint32_t           stalls;      // Reader waited for a free buffer
+} fota_pipe_t;
+
+/*
+ * Start the writer task
+ * pool: count buffers of size bytes each, contiguous
+ * flash: begin is called from the reader, write from the writer task
+ * return: false if the queues or the task could not be created
+ */
+bool fota_pipe_start(fota_pipe_t *pipe, uint8_t *pool, size_t count, size_t size,
+                     const fota_sink_t *flash, UBaseType_t priority);
+
+/*
+ * Sink for fota_download(), receiving into the pipe buffers
+ */
+void fota_pipe_sink(fota_pipe_t *pipe, fota_sink_t *sink);
+
+/*
+ * Write the last pending bytes and wait for the writer task to end, always
+ * called after fota_pipe_start(), even on a failed download
+ * return: 0, -1 if a flash write failed
+ */
+int fota_pipe_finish(fota_pipe_t *pipe);
+
+#endif
@@ -0,0 +1,151 @@
+#include <string.h>
+#include "gattc_cache.h"
+
+
+/*
+ * Single writer counters, read from other tasks
+ */
+static void gattc_cache_count(uint32_t *counter) {
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static void gattc_cache_key(uint8_t *key, gattc_cache_kind_t kind, const uint8_t *bda, uint32_t model) {
+    if (kind == GATTC_CACHE_ADDRESS) {
+        memcpy(key, bda, ADV_BDA_LEN);
+        return;
+    }
+    memset(key, 0, ADV_BDA_LEN);
+    key[0] = model;
+    key[1] = model >> 8;
+    key[2] = model >> 16;
+    key[3] = model >> 24;
+}
+
+static gattc_cache_entry_t *gattc_cache_find(gattc_cache_t *cache, gattc_cache_kind_t kind, const uint8_t *key) {
+    for (uint32_t i = 0; i < cache->size; i++) {
+        gattc_cache_entry_t *entry = &cache->entries[i];
+        if (entry->kind == kind && memcmp(entry->key, key, ADV_BDA_LEN) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool gattc_cache_init(gattc_cache_t *cache, gattc_cache_entry_t *entries, uint32_t size) {
+    if (size == 0) {
+        return false;
+    }
+    memset(cache, 0, sizeof(*cache));
+    memset(entries, 0, size * sizeof(*entries));
+    cache->entries = entries;
+    cache->size = size;
+    return true;
+}
+
+bool gattc_cache_restore(gattc_cache_t *cache, size_t len) {
+    cache->clock = 0;
+    cache->dirty = false;
+    if (len != cache->size * sizeof(gattc_cache_entry_t)) {
+        memset(cache->entries, 0, cache->size * sizeof(gattc_cache_entry_t));
+        return false;
+    }
+    for (uint32_t i = 0; i < cache->size; i++) {
+        gattc_cache_entry_t *entry = &cache->entries[i];
+        if (entry->kind != GATTC_CACHE_ADDRESS && entry->kind != GATTC_CACHE_MODEL) {
+            memset(entry, 0, sizeof(*entry));
+        } else if ((int32_t)(entry->stamp - cache->clock) > 0) {
+            cache->clock = entry->stamp;
+        }
+    }
+    return true;
+}
+
+gattc_cache_kind_t gattc_cache_get(gattc_cache_t *cache, const uint8_t *bda, uint32_t model, uint16_t *handles) {
+    uint8_t key[ADV_BDA_LEN];
+    gattc_cache_entry_t *entry;
+
+    gattc_cache_key(key, GATTC_CACHE_ADDRESS, bda, model);
+    entry = gattc_cache_find(cache, GATTC_CACHE_ADDRESS, key);
+    if (entry == NULL && model) {
+        gattc_cache_key(key, GATTC_CACHE_MODEL, bda, model);
+        entry = gattc_cache_find(cache, GATTC_CACHE_MODEL, key);
+    }
+    if (entry == NULL) {
+        gattc_cache_count(&cache->stats.misses);
+        return GATTC_CACHE_MISS;
+    }
+    // Use order is not worth a flash write
+    entry->stamp = ++cache->clock;
+    memcpy(handles, entry->handles, sizeof(entry->handles));
+    gattc_cache_count(entry->kind == GATTC_CACHE_ADDRESS ? &cache->stats.hits_address : &cache->stats.hits_model);
+    return entry->kind;
+}
+
+static void gattc_cache_store(gattc_cache_t *cache, gattc_cache_kind_t kind, const uint8_t *key,
+                              const uint16_t *handles) {
+    gattc_cache_entry_t *entry = gattc_cache_find(cache, kind, key);
+
+    if (entry == NULL) {
+        for (uint32_t i = 0; i < cache->size; i++) {
+            gattc_cache_entry_t *e = &cache->entries[i];
+            if (e->kind == GATTC_CACHE_MISS) {
+                entry = e;
+                break;
+            }
+            if (entry == NULL || (int32_t)(e->stamp - entry->stamp) < 0) {
+                entry = e;
+            }
+        }
+        if (entry->kind != GATTC_CACHE_MISS) {
+            gattc_cache_count(&cache->stats.evicted);
+        }
+        entry->kind = kind;
+        memcpy(entry->key, key, ADV_BDA_LEN);
+        entry->reserved = 0;
+    } else if (memcmp(entry->handles, handles, sizeof(entry->handles)) == 0) {
+        entry->stamp = ++cache->clock;
+        return;
+    }
+    memcpy(entry->handles, handles, sizeof(entry->handles));
+    entry->stamp = ++cache->clock;
+    cache->dirty = true;
+    gattc_cache_count(&cache->stats.stored);
+}
+
+void gattc_cache_put(gattc_cache_t *cache, const uint8_t *bda, uint32_t model, const uint16_t *handles) {
+    uint8_t key[ADV_BDA_LEN];
+
+    gattc_cache_key(key, GATTC_CACHE_ADDRESS, bda, model);
+    gattc_cache_store(cache, GATTC_CACHE_ADDRESS, key, handles);
+    if (model) {
+        gattc_cache_key(key, GATTC_CACHE_MODEL, bda, model);
+        gattc_cache_store(cache, GATTC_CACHE_MODEL, key, handles);
+    }
+}
+
+void gattc_cache_invalidate(gattc_cache_t *cache, const uint8_t *bda, uint32_t model) {
+    uint8_t key[ADV_BDA_LEN];
+    gattc_cache_entry_t *entry;
+
+    for (int kind = GATTC_CACHE_ADDRESS; kind <= GATTC_CACHE_MODEL; kind++) {
+        if (kind == GATTC_CACHE_MODEL && model == 0) {
+            break;
+        }
+        gattc_cache_key(key, kind, bda, model);
+        entry = gattc_cache_find(cache, kind, key);
+        if (entry) {
+            memset(entry, 0, sizeof(*entry));
+            cache->dirty = true;
+            gattc_cache_count(&cache->stats.invalidated);
+        }
+    }
+}
+
+void gattc_cache_get_stats(const gattc_cache_t *cache, gattc_cache_stats_t *stats) {
+    stats->hits_address = __atomic_load_n(&cache->stats.hits_address, __ATOMIC_RELAXED);
+    stats->hits_model = __atomic_load_n(&cache->stats.hits_model, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&cache->stats.misses, __ATOMIC_RELAXED);
+    stats->stored = __atomic_load_n(&cache->stats.stored, __ATOMIC_RELAXED);
+    stats->invalidated = __atomic_load_n(&cache->stats.invalidated, __ATOMIC_RELAXED);
+    stats->evicted = __atomic_load_n(&cache->stats.evicted, __ATOMIC_RELAXED);
+}
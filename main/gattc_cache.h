@@ -0,0 +1,92 @@
+#ifndef __GATTC_CACHE_H__
+#define __GATTC_CACHE_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "adv_record.h"
+
+/*
+ * GATT layout cache: the handles of the characteristics read from a tag, found
+ * by a first service discovery, so later connections read them right away.
+ *
+ * Layouts are kept per device address and per model fingerprint of the
+ * adverts (adv_fingerprint()): a unit never connected before reuses the
+ * layout of another unit of its model. The address entry wins over the model
+ * one. A read failing on cached handles, or a Service Changed indication,
+ * invalidates both entries and the tag is discovered again.
+ *
+ * The entries are plain data, saved and restored as a blob, e.g. in NVS. The
+ * least recently used entry is replaced when full. Single task, the counters
+ * may be read from others. Storage is provided by the caller.
+ */
+
+#define GATTC_CACHE_HANDLES     4   // Characteristics per layout
+
+typedef enum {
+    GATTC_CACHE_MISS = 0,
+    GATTC_CACHE_ADDRESS,
+    GATTC_CACHE_MODEL,
+} gattc_cache_kind_t;
+
+typedef struct {
+    uint8_t  kind;                  // gattc_cache_kind_t, MISS when free
+    uint8_t  key[ADV_BDA_LEN];      // Address, or fingerprint little endian
+    uint8_t  reserved;
+    uint16_t handles[GATTC_CACHE_HANDLES];  // 0 if absent or not readable
+    uint32_t stamp;                 // Use order
+} gattc_cache_entry_t;
+
+typedef struct {
+    uint32_t hits_address;
+    uint32_t hits_model;
+    uint32_t misses;
+    uint32_t stored;
+    uint32_t invalidated;
+    uint32_t evicted;
+} gattc_cache_stats_t;
+
+typedef struct {
+    gattc_cache_entry_t *entries;
+    uint32_t             size;
+    uint32_t             clock;
+    bool                 dirty;     // Changed since cleared by the caller
+    gattc_cache_stats_t  stats;
+} gattc_cache_t;
+
+/*
+ * return: false on a zero size
+ */
+bool gattc_cache_init(gattc_cache_t *cache, gattc_cache_entry_t *entries, uint32_t size);
+
+/*
+ * Check the entries once a saved blob of len bytes was read back into
+ * cache->entries, invalid ones are dropped
+ * return: false if the blob is not size entries, the cache is then emptied
+ */
+bool gattc_cache_restore(gattc_cache_t *cache, size_t len);
+
+/*
+ * Layout of a tag, by address then by model
+ * model: adv_fingerprint() of its adverts, 0 if unknown
+ * handles: GATTC_CACHE_HANDLES filled on a hit
+ */
+gattc_cache_kind_t gattc_cache_get(gattc_cache_t *cache, const uint8_t *bda, uint32_t model, uint16_t *handles);
+
+/*
+ * Store a discovered layout under the address and the model
+ */
+void gattc_cache_put(gattc_cache_t *cache, const uint8_t *bda, uint32_t model, const uint16_t *handles);
+
+/*
+ * Forget the layouts of a tag and of its model
+ */
+void gattc_cache_invalidate(gattc_cache_t *cache, const uint8_t *bda, uint32_t model);
+
+/*
+ * Snapshot of the counters, from any task
+ */
+void gattc_cache_get_stats(const gattc_cache_t *cache, gattc_cache_stats_t *stats);
+
+#endif
@@ -0,0 +1,300 @@
+#include <string.h>
+#include "gattc_sched.h"
+
+
+// Constants
+#define GATTC_SCHED_PERMILLE    1000
+#define GATTC_SCHED_BACKOFF_MAX 16      // Doublings of retry_ms
+
+
+/*
+ * Single writer counters, read from other tasks
+ */
+static void gattc_sched_count(uint32_t *counter, uint32_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static bool gattc_sched_reached(uint32_t now_ms, uint32_t when_ms) {
+    return (int32_t)(now_ms - when_ms) >= 0;
+}
+
+bool gattc_sched_init(gattc_sched_t *sched, gattc_sched_tag_t *tags, uint32_t size,
+                      const gattc_sched_params_t *params, uint32_t now_ms) {
+    if (size == 0 || size >= GATTC_SCHED_NONE || params->links == 0 || params->links > GATTC_SCHED_LINKS_MAX) {
+        return false;
+    }
+    memset(sched, 0, sizeof(*sched));
+    memset(tags, 0, size * sizeof(*tags));
+    sched->tags = tags;
+    sched->size = size;
+    sched->params = *params;
+    if (sched->params.duty > GATTC_SCHED_PERMILLE) {
+        sched->params.duty = GATTC_SCHED_PERMILLE;
+    }
+    for (int i = 0; i < GATTC_SCHED_LINKS_MAX; i++) {
+        sched->links[i].tag = GATTC_SCHED_NONE;
+    }
+    // One job worth of budget to start with
+    sched->budget = (int32_t)params->job_timeout_ms * GATTC_SCHED_PERMILLE;
+    sched->tick_ms = now_ms;
+    return true;
+}
+
+void gattc_sched_seen(gattc_sched_t *sched, const uint8_t *bda, int8_t rssi, uint32_t model, uint32_t now_ms) {
+    gattc_sched_tag_t *free_tag = NULL, *oldest = NULL;
+
+    gattc_sched_count(&sched->stats.seen, 1);
+    for (uint32_t i = 0; i < sched->size; i++) {
+        gattc_sched_tag_t *tag = &sched->tags[i];
+        if (!tag->used) {
+            if (free_tag == NULL) {
+                free_tag = tag;
+            }
+        } else if (memcmp(tag->bda, bda, ADV_BDA_LEN) == 0) {
+            tag->rssi = rssi;
+            tag->seen_ms = now_ms;
+            tag->model = model;
+            return;
+        } else if (!tag->busy && (oldest == NULL || (int32_t)(tag->seen_ms - oldest->seen_ms) < 0)) {
+            oldest = tag;
+        }
+    }
+    if (free_tag == NULL) {
+        if (oldest == NULL) {
+            // Every tag is on a link
+            return;
+        }
+        free_tag = oldest;
+        gattc_sched_count(&sched->stats.evicted, 1);
+    } else {
+        gattc_sched_count(&sched->stats.tags, 1);
+    }
+    memset(free_tag, 0, sizeof(*free_tag));
+    memcpy(free_tag->bda, bda, ADV_BDA_LEN);
+    free_tag->used = 1;
+    free_tag->rssi = rssi;
+    free_tag->seen_ms = now_ms;
+    free_tag->due_ms = now_ms;
+    free_tag->model = model;
+}
+
+void gattc_sched_tick(gattc_sched_t *sched, uint32_t now_ms, bool scanning) {
+    int64_t elapsed = (int32_t)(now_ms - sched->tick_ms);
+    int64_t budget = sched->budget;
+    int64_t cap = (int64_t)sched->params.job_timeout_ms * GATTC_SCHED_PERMILLE;
+    uint32_t busy = 0;
+
+    if (elapsed <= 0) {
+        return;
+    }
+    sched->tick_ms = now_ms;
+    for (int i = 0; i < sched->params.links; i++) {
+        busy += sched->links[i].state != GATTC_SCHED_IDLE && sched->links[i].state != GATTC_SCHED_STREAMING;
+    }
+    if (scanning) {
+        budget -= elapsed * busy * GATTC_SCHED_PERMILLE;
+    }
+    budget += elapsed * sched->params.duty;
+    // A burst of one job, and no debt beyond one job per link
+    if (budget > cap) {
+        budget = cap;
+    } else if (budget < -cap * sched->params.links) {
+        budget = -cap * sched->params.links;
+    }
+    sched->budget = (int32_t)budget;
+}
+
+/*
+ * return: true if a is to be read before b
+ */
+static bool gattc_sched_before(const gattc_sched_tag_t *a, const gattc_sched_tag_t *b, uint32_t now_ms) {
+    int rank_a = a->urgent ? 2 : !a->read;
+    int rank_b = b->urgent ? 2 : !b->read;
+    if (rank_a != rank_b) {
+        return rank_a > rank_b;
+    }
+    uint32_t overdue_a = now_ms - a->due_ms, overdue_b = now_ms - b->due_ms;
+    if (overdue_a != overdue_b) {
+        return overdue_a > overdue_b;
+    }
+    return a->rssi > b->rssi;
+}
+
+int gattc_sched_next(gattc_sched_t *sched, uint32_t now_ms) {
+    gattc_sched_link_t *link = NULL;
+    gattc_sched_tag_t *best = NULL;
+    int index = -1;
+
+    for (int i = 0; i < sched->params.links; i++) {
+        if (sched->links[i].state == GATTC_SCHED_CONNECTING) {
+            // The controller creates one connection at a time
+            return -1;
+        }
+        if (link == NULL && sched->links[i].state == GATTC_SCHED_IDLE) {
+            link = &sched->links[i];
+            index = i;
+        }
+    }
+    if (link == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < sched->size; i++) {
+        gattc_sched_tag_t *tag = &sched->tags[i];
+        if (tag->used && !tag->busy && gattc_sched_reached(now_ms, tag->due_ms) &&
+            now_ms - tag->seen_ms <= sched->params.seen_ms &&
+            (best == NULL || gattc_sched_before(tag, best, now_ms))) {
+            best = tag;
+        }
+    }
+    if (best == NULL) {
+        return -1;
+    }
+    if (sched->params.duty < GATTC_SCHED_PERMILLE && sched->budget <= 0) {
+        gattc_sched_count(&sched->stats.deferred, 1);
+        return -1;
+    }
+    best->busy = 1;
+    link->tag = (uint16_t)(best - sched->tags);
+    link->state = GATTC_SCHED_CONNECTING;
+    link->timed_out = 0;
+    link->streamed = 0;
+    link->conn_id = GATTC_SCHED_NONE;
+    link->start_ms = now_ms;
+    link->deadline_ms = now_ms + sched->params.connect_timeout_ms;
+    gattc_sched_count(&sched->stats.started, 1);
+    return index;
+}
+
+int gattc_sched_expired(gattc_sched_t *sched, uint32_t now_ms) {
+    for (int i = 0; i < sched->params.links; i++) {
+        gattc_sched_link_t *link = &sched->links[i];
+        if (link->state == GATTC_SCHED_IDLE || link->state == GATTC_SCHED_STREAMING ||
+            !gattc_sched_reached(now_ms, link->deadline_ms)) {
+            continue;
+        }
+        if (link->state == GATTC_SCHED_CLOSING) {
+            // The close was never confirmed
+            link->timed_out = 1;
+            gattc_sched_done(sched, i, false, false, now_ms);
+            continue;
+        }
+        link->timed_out = 1;
+        gattc_sched_closing(sched, i, now_ms);
+        return i;
+    }
+    return -1;
+}
+
+int gattc_sched_find(const gattc_sched_t *sched, const uint8_t *bda) {
+    for (int i = 0; i < sched->params.links; i++) {
+        if (sched->links[i].state != GATTC_SCHED_IDLE &&
+            memcmp(gattc_sched_bda(sched, i), bda, ADV_BDA_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int gattc_sched_find_conn(const gattc_sched_t *sched, uint16_t conn_id) {
+    for (int i = 0; i < sched->params.links; i++) {
+        if (sched->links[i].state != GATTC_SCHED_IDLE && sched->links[i].conn_id == conn_id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void gattc_sched_connected(gattc_sched_t *sched, int link, uint16_t conn_id, uint32_t now_ms) {
+    sched->links[link].state = GATTC_SCHED_ACTIVE;
+    sched->links[link].conn_id = conn_id;
+    sched->links[link].deadline_ms = now_ms + sched->params.job_timeout_ms;
+}
+
+void gattc_sched_closing(gattc_sched_t *sched, int link, uint32_t now_ms) {
+    sched->links[link].state = GATTC_SCHED_CLOSING;
+    sched->links[link].deadline_ms = now_ms + sched->params.connect_timeout_ms;
+}
+
+void gattc_sched_streaming(gattc_sched_t *sched, int link, uint32_t now_ms) {
+    gattc_sched_link_t *l = &sched->links[link];
+
+    l->state = GATTC_SCHED_STREAMING;
+    l->streamed = 1;
+    gattc_sched_count(&sched->stats.busy_ms, now_ms - l->start_ms);
+    gattc_sched_count(&sched->stats.streams, 1);
+}
+
+void gattc_sched_done(gattc_sched_t *sched, int link, bool ok, bool urgent, uint32_t now_ms) {
+    gattc_sched_link_t *l = &sched->links[link];
+    gattc_sched_tag_t *tag = &sched->tags[l->tag];
+
+    tag->busy = 0;
+    if (l->streamed) {
+        // Streaming again soon, read on the way
+        tag->read = 1;
+        tag->failures = 0;
+        tag->urgent = 0;
+        tag->due_ms = now_ms + sched->params.retry_ms;
+        gattc_sched_count(&sched->stats.read, 1);
+    } else if (ok) {
+        tag->read = 1;
+        tag->failures = 0;
+        tag->urgent = urgent;
+        tag->due_ms = now_ms + (urgent ? sched->params.urgent_period_ms : sched->params.period_ms);
+        gattc_sched_count(&sched->stats.read, 1);
+    } else {
+        uint32_t shift = tag->failures < GATTC_SCHED_BACKOFF_MAX ? tag->failures : GATTC_SCHED_BACKOFF_MAX;
+        uint64_t backoff = (uint64_t)sched->params.retry_ms << shift;
+        tag->failures += tag->failures < 0xFF;
+        tag->due_ms = now_ms + (backoff < sched->params.period_ms ? (uint32_t)backoff : sched->params.period_ms);
+        gattc_sched_count(l->timed_out ? &sched->stats.timeouts : &sched->stats.failed, 1);
+    }
+    if (!l->streamed) {
+        gattc_sched_count(&sched->stats.busy_ms, now_ms - l->start_ms);
+    }
+    l->tag = GATTC_SCHED_NONE;
+    l->streamed = 0;
+    l->state = GATTC_SCHED_IDLE;
+    l->conn_id = GATTC_SCHED_NONE;
+}
+
+void gattc_sched_get_stats(const gattc_sched_t *sched, gattc_sched_stats_t *stats) {
+    stats->seen = __atomic_load_n(&sched->stats.seen, __ATOMIC_RELAXED);
+    stats->tags = __atomic_load_n(&sched->stats.tags, __ATOMIC_RELAXED);
+    stats->evicted = __atomic_load_n(&sched->stats.evicted, __ATOMIC_RELAXED);
+    stats->started = __atomic_load_n(&sched->stats.started, __ATOMIC_RELAXED);
+    stats->read = __atomic_load_n(&sched->stats.read, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&sched->stats.failed, __ATOMIC_RELAXED);
+    stats->timeouts = __atomic_load_n(&sched->stats.timeouts, __ATOMIC_RELAXED);
+    stats->deferred = __atomic_load_n(&sched->stats.deferred, __ATOMIC_RELAXED);
+    stats->busy_ms = __atomic_load_n(&sched->stats.busy_ms, __ATOMIC_RELAXED);
+    stats->streams = __atomic_load_n(&sched->stats.streams, __ATOMIC_RELAXED);
+}
+
+bool gattc_reading_put(gattc_reading_t *reading, uint16_t uuid, const uint8_t *value, uint16_t len) {
+    switch (uuid) {
+    case GATTC_UUID_BATTERY_LEVEL:
+        if (len < 1) {
+            return false;
+        }
+        reading->battery = value[0];
+        reading->fields |= GATTC_READING_BATTERY;
+        return true;
+    case GATTC_UUID_TEMPERATURE:
+        if (len < 2) {
+            return false;
+        }
+        reading->temperature = (int16_t)(value[0] | value[1] << 8);
+        reading->fields |= GATTC_READING_TEMPERATURE;
+        return true;
+    case GATTC_UUID_HUMIDITY:
+        if (len < 2) {
+            return false;
+        }
+        reading->humidity = (uint16_t)(value[0] | value[1] << 8);
+        reading->fields |= GATTC_READING_HUMIDITY;
+        return true;
+    default:
+        return false;
+    }
+}
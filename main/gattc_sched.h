@@ -0,0 +1,202 @@
+#ifndef __GATTC_SCHED_H__
+#define __GATTC_SCHED_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+
+/*
+ * GATT client scheduler: connect, read, disconnect jobs over the tags found by
+ * the scanner, on a few concurrent connections.
+ *
+ * A tag is due period_ms after its last read, urgent_period_ms when the last
+ * read flagged it, e.g. low battery, and right away once discovered. Among the
+ * due tags advertising within seen_ms, urgent ones go first, then those never
+ * read, then the most overdue, the strongest on a tie. A failed job is retried
+ * after retry_ms, doubled per failure up to period_ms.
+ *
+ * One connection is initiated at a time, as the controller does. A job that
+ * does not connect within connect_timeout_ms, or is not over job_timeout_ms
+ * after connecting, is given up: the caller closes it and reports it done. A
+ * link whose close is not confirmed within connect_timeout_ms is freed anyway.
+ *
+ * Jobs share the radio with scanning. While scanning, each running job spends
+ * a budget refilled at `duty` permille of the time, no job starts with the
+ * budget spent: scan coverage loses at most that share. Jobs are free while the
+ * scanner is off, in duty cycle mode.
+ *
+ * A job may keep its connection to stream the notifications of the tag: the
+ * link is then STREAMING, without deadline nor budget, until the caller closes
+ * it. The tag is due retry_ms after its stream ends.
+ *
+ * Single task, the counters may be read from others. Storage is provided by the
+ * caller, nothing is allocated.
+ */
+
+#define GATTC_SCHED_LINKS_MAX   9       // Bluedroid BLE connections
+#define GATTC_SCHED_NONE        0xFFFF
+
+// Characteristics read from each tag, assigned numbers
+#define GATTC_UUID_BATTERY_SERVICE  0x180F
+#define GATTC_UUID_BATTERY_LEVEL    0x2A19  // uint8, %
+#define GATTC_UUID_ENV_SENSING      0x181A
+#define GATTC_UUID_TEMPERATURE      0x2A6E  // sint16, 0.01 C
+#define GATTC_UUID_HUMIDITY         0x2A6F  // uint16, 0.01 %
+
+// gattc_reading_t fields
+#define GATTC_READING_BATTERY       0x01
+#define GATTC_READING_TEMPERATURE   0x02
+#define GATTC_READING_HUMIDITY      0x04
+
+typedef enum {
+    GATTC_SCHED_IDLE = 0,
+    GATTC_SCHED_CONNECTING,         // Open requested
+    GATTC_SCHED_ACTIVE,             // Connected, reading
+    GATTC_SCHED_CLOSING,            // Close requested
+    GATTC_SCHED_STREAMING,          // Connected, notifying
+} gattc_sched_state_t;
+
+typedef struct {
+    uint32_t period_ms;             // Between reads of a tag
+    uint32_t urgent_period_ms;
+    uint32_t retry_ms;              // After a first failure
+    uint32_t seen_ms;               // Only tags advertising within that are connected
+    uint32_t connect_timeout_ms;
+    uint32_t job_timeout_ms;        // Connected to closed
+    uint16_t duty;                  // Permille of the time with jobs running while scanning
+    uint8_t  links;                 // Concurrent connections, GATTC_SCHED_LINKS_MAX at most
+} gattc_sched_params_t;
+
+typedef struct {
+    uint8_t  bda[ADV_BDA_LEN];
+    uint8_t  used;
+    uint8_t  busy;                  // On a link
+    uint8_t  urgent;
+    uint8_t  read;                  // Read at least once
+    uint8_t  failures;              // Since the last read
+    int8_t   rssi;                  // Latest advert
+    uint32_t seen_ms;
+    uint32_t due_ms;
+    uint32_t model;                 // adv_fingerprint() of the latest advert
+} gattc_sched_tag_t;
+
+typedef struct {
+    uint16_t tag;                   // GATTC_SCHED_NONE when idle
+    uint8_t  state;
+    uint8_t  timed_out;
+    uint8_t  streamed;              // Turned into a stream
+    uint16_t conn_id;
+    uint32_t start_ms;
+    uint32_t deadline_ms;
+} gattc_sched_link_t;
+
+typedef struct {
+    uint32_t seen;                  // Tag adverts
+    uint32_t tags;                  // Known tags
+    uint32_t evicted;               // Forgotten, table full
+    uint32_t started;
+    uint32_t read;                  // Jobs done with a reading
+    uint32_t failed;                // Refused, lost or nothing read
+    uint32_t timeouts;
+    uint32_t deferred;              // Ticks with a due tag and a free link, budget spent
+    uint32_t busy_ms;               // Sum of the job durations, streams excluded
+    uint32_t streams;               // Jobs turned into streams
+} gattc_sched_stats_t;
+
+typedef struct {
+    gattc_sched_tag_t   *tags;
+    uint32_t             size;
+    gattc_sched_link_t   links[GATTC_SCHED_LINKS_MAX];
+    gattc_sched_params_t params;
+    int32_t              budget;    // Job time left while scanning, ms / 1000
+    uint32_t             tick_ms;
+    gattc_sched_stats_t  stats;
+} gattc_sched_t;
+
+/*
+ * Values read from a tag
+ */
+typedef struct {
+    uint8_t  bda[ADV_BDA_LEN];
+    uint8_t  fields;                // GATTC_READING_ bits
+    uint8_t  battery;               // %
+    int16_t  temperature;           // 0.01 C
+    uint16_t humidity;              // 0.01 %
+    uint32_t time_ms;               // Connected
+    uint16_t duration_ms;           // Connected to the last read
+} gattc_reading_t;
+
+/*
+ * tags: size elements, 65535 max
+ * return: false on invalid size or link count
+ */
+bool gattc_sched_init(gattc_sched_t *sched, gattc_sched_tag_t *tags, uint32_t size,
+                      const gattc_sched_params_t *params, uint32_t now_ms);
+
+/*
+ * Account one advert of a tag, the least recently seen idle tag is forgotten
+ * for a new one when the table is full
+ * model: fingerprint of the advert, kept with the tag
+ */
+void gattc_sched_seen(gattc_sched_t *sched, const uint8_t *bda, int8_t rssi, uint32_t model, uint32_t now_ms);
+
+/*
+ * Spend and refill the budget up to now
+ * scanning: the scanner was on since the previous tick
+ */
+void gattc_sched_tick(gattc_sched_t *sched, uint32_t now_ms, bool scanning);
+
+/*
+ * Start the job of the next tag on a free link, now CONNECTING, to be opened
+ * by the caller. Call until -1.
+ * return: link index, -1 if none
+ */
+int gattc_sched_next(gattc_sched_t *sched, uint32_t now_ms);
+
+/*
+ * Give up the next job past its deadline, now CLOSING. Call until -1.
+ * return: link index to close, -1 if none
+ */
+int gattc_sched_expired(gattc_sched_t *sched, uint32_t now_ms);
+
+/*
+ * Link of a running job
+ * return: link index, -1 if none
+ */
+int gattc_sched_find(const gattc_sched_t *sched, const uint8_t *bda);
+int gattc_sched_find_conn(const gattc_sched_t *sched, uint16_t conn_id);
+
+/*
+ * Transitions of a running job
+ */
+void gattc_sched_connected(gattc_sched_t *sched, int link, uint16_t conn_id, uint32_t now_ms);
+void gattc_sched_closing(gattc_sched_t *sched, int link, uint32_t now_ms);
+void gattc_sched_streaming(gattc_sched_t *sched, int link, uint32_t now_ms);
+
+/*
+ * End of a job, the link is free
+ * ok: values were read, urgent: read them again after urgent_period_ms
+ */
+void gattc_sched_done(gattc_sched_t *sched, int link, bool ok, bool urgent, uint32_t now_ms);
+
+static inline const uint8_t *gattc_sched_bda(const gattc_sched_t *sched, int link) {
+    return sched->tags[sched->links[link].tag].bda;
+}
+
+static inline uint32_t gattc_sched_model(const gattc_sched_t *sched, int link) {
+    return sched->tags[sched->links[link].tag].model;
+}
+
+/*
+ * Snapshot of the counters, from any task
+ */
+void gattc_sched_get_stats(const gattc_sched_t *sched, gattc_sched_stats_t *stats);
+
+/*
+ * Decode the value of a characteristic into a reading
+ * return: false if the characteristic is unknown or the value too short
+ */
+bool gattc_reading_put(gattc_reading_t *reading, uint16_t uuid, const uint8_t *value, uint16_t len);
+
+#endif
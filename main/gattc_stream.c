@@ -0,0 +1,223 @@
+#include <string.h>
+#include "gattc_stream.h"
+#include "adv_frame.h"
+
+
+/*
+ * Counters are written under the caller lock, read from other tasks
+ */
+static void gattc_stream_count(uint32_t *counter, uint32_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/*
+ * A thinned batch waits longer, the same notifications per message
+ */
+static bool gattc_stream_aged(const gattc_stream_t *st, const gattc_stream_entry_t *e, uint32_t now_us) {
+    uint64_t age_us = (uint64_t)st->params.age_us << e->fill.decimation;
+
+    if (age_us > GATTC_STREAM_AGE_MAX_US) {
+        age_us = GATTC_STREAM_AGE_MAX_US;
+    }
+    // Signed: notifications may be stamped after now_us was read
+    return (int32_t)(now_us - e->fill.time_us) >= (int32_t)age_us;
+}
+
+static uint8_t *gattc_stream_batch(const gattc_stream_t *st, const gattc_stream_entry_t *e, uint32_t index) {
+    return e->buf + (index % st->params.buffers) * st->params.bytes;
+}
+
+bool gattc_stream_init(gattc_stream_t *st, gattc_stream_entry_t *entries, uint32_t size,
+                       uint8_t *storage, size_t storage_len, const gattc_stream_params_t *params) {
+    if (size == 0 || params->buffers < 2 || params->buffers > GATTC_STREAM_BUFFERS_MAX ||
+        params->bytes < ADV_FRAME_STREAM_HEADER_LEN + ADV_FRAME_STREAM_RECORD_LEN + GATTC_STREAM_VALUE_MAX ||
+        params->age_us > GATTC_STREAM_AGE_MAX_US ||
+        storage_len < GATTC_STREAM_STORAGE(size, params->buffers, params->bytes)) {
+        return false;
+    }
+    memset(st, 0, sizeof(*st));
+    memset(entries, 0, size * sizeof(*entries));
+    for (uint32_t i = 0; i < size; i++) {
+        entries[i].conn_id = GATTC_STREAM_NONE;
+        entries[i].buf = storage + GATTC_STREAM_STORAGE(i, params->buffers, params->bytes);
+    }
+    st->entries = entries;
+    st->size = size;
+    st->params = *params;
+    return true;
+}
+
+int gattc_stream_open(gattc_stream_t *st, const uint8_t *bda, uint16_t conn_id, uint32_t now_us) {
+    for (uint32_t i = 0; i < st->size; i++) {
+        gattc_stream_entry_t *e = &st->entries[i];
+        if (e->used) {
+            continue;
+        }
+        uint8_t *buf = e->buf;
+        memset(e, 0, sizeof(*e));
+        e->buf = buf;
+        e->used = 1;
+        e->conn_id = conn_id;
+        e->last_us = now_us;
+        memcpy(e->fill.bda, bda, ADV_BDA_LEN);
+        gattc_stream_count(&st->stats.opened, 1);
+        return (int)i;
+    }
+    return -1;
+}
+
+int gattc_stream_find(const gattc_stream_t *st, uint16_t conn_id) {
+    if (conn_id == GATTC_STREAM_NONE) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < st->size; i++) {
+        if (st->entries[i].used && st->entries[i].conn_id == conn_id) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Complete the filling batch, which gets in line for the uplink
+ */
+static void gattc_stream_seal(gattc_stream_t *st, gattc_stream_entry_t *e) {
+    adv_frame_encode_stream(&e->fill, gattc_stream_batch(st, e, e->tail + e->sealed), ADV_FRAME_STREAM_HEADER_LEN);
+    e->len[(e->tail + e->sealed) % st->params.buffers] = e->fill_len;
+    e->sealed++;
+    e->fill.count = 0;
+    e->fill_len = 0;
+    gattc_stream_count(&st->stats.sealed, 1);
+    if (st->params.policy != GATTC_STREAM_DECIMATE) {
+        return;
+    }
+    if (e->sealed > 1) {
+        // The previous batch still waits, the uplink is behind: thin the next ones
+        e->decimation += e->decimation < GATTC_STREAM_DECIMATION_MAX;
+    } else if (e->decimation) {
+        // Caught up
+        e->decimation--;
+    }
+}
+
+void gattc_stream_close(gattc_stream_t *st, int stream) {
+    gattc_stream_entry_t *e = &st->entries[stream];
+
+    if (e->fill.count) {
+        gattc_stream_seal(st, e);
+    }
+    e->conn_id = GATTC_STREAM_NONE;
+    if (e->sealed == 0) {
+        e->used = 0;
+    }
+}
+
+bool gattc_stream_put(gattc_stream_t *st, uint16_t conn_id, const uint8_t *value, uint16_t len, uint32_t now_us) {
+    int stream = gattc_stream_find(st, conn_id);
+    gattc_stream_entry_t *e;
+    uint32_t seq;
+    bool sealed = false;
+
+    if (stream < 0) {
+        return false;
+    }
+    e = &st->entries[stream];
+    seq = e->seq++;
+    e->last_us = now_us;
+    gattc_stream_count(&st->stats.received, 1);
+    if (len > GATTC_STREAM_VALUE_MAX) {
+        len = GATTC_STREAM_VALUE_MAX;
+    }
+    if (e->fill.count) {
+        if ((seq - e->fill.seq) & ((1u << e->fill.decimation) - 1)) {
+            gattc_stream_count(&st->stats.decimated, 1);
+            return false;
+        }
+        if (e->fill_len + ADV_FRAME_STREAM_RECORD_LEN + len > st->params.bytes || gattc_stream_aged(st, e, now_us)) {
+            gattc_stream_seal(st, e);
+            sealed = true;
+        }
+    }
+    if (e->sealed == st->params.buffers) {
+        // Every batch waits for the uplink
+        gattc_stream_count(&st->stats.dropped, 1);
+        return sealed;
+    }
+    if (e->fill.count == 0) {
+        e->fill.decimation = e->decimation;
+        e->fill.seq = seq;
+        e->fill.time_us = now_us;
+        e->fill_len = ADV_FRAME_STREAM_HEADER_LEN;
+    }
+    e->fill_len += adv_frame_encode_stream_record((uint16_t)((now_us - e->fill.time_us) / ADV_FRAME_STREAM_TICK_US),
+                                                  value, len,
+                                                  gattc_stream_batch(st, e, e->tail + e->sealed) + e->fill_len,
+                                                  st->params.bytes - e->fill_len);
+    e->fill.count++;
+    gattc_stream_count(&st->stats.batched, 1);
+    return sealed;
+}
+
+bool gattc_stream_poll(gattc_stream_t *st, uint32_t now_us) {
+    bool sealed = false;
+
+    for (uint32_t i = 0; i < st->size; i++) {
+        gattc_stream_entry_t *e = &st->entries[i];
+        if (e->used && e->fill.count && gattc_stream_aged(st, e, now_us)) {
+            gattc_stream_seal(st, e);
+            sealed = true;
+        }
+    }
+    return sealed;
+}
+
+int gattc_stream_idle(gattc_stream_t *st, uint32_t now_us) {
+    for (uint32_t i = 0; i < st->size; i++) {
+        gattc_stream_entry_t *e = &st->entries[i];
+        if (e->used && e->conn_id != GATTC_STREAM_NONE &&
+            (int32_t)(now_us - e->last_us) >= (int32_t)st->params.idle_us) {
+            e->last_us = now_us;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int gattc_stream_take(gattc_stream_t *st, const uint8_t **batch, size_t *len) {
+    for (uint32_t n = 0; n < st->size; n++) {
+        uint32_t i = (st->next + n) % st->size;
+        gattc_stream_entry_t *e = &st->entries[i];
+        if (e->used && e->sealed && !e->taken) {
+            e->taken = 1;
+            *batch = gattc_stream_batch(st, e, e->tail);
+            *len = e->len[e->tail];
+            st->next = i + 1;
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void gattc_stream_release(gattc_stream_t *st, int stream) {
+    gattc_stream_entry_t *e = &st->entries[stream];
+
+    gattc_stream_count(&st->stats.published, 1);
+    gattc_stream_count(&st->stats.bytes, e->len[e->tail]);
+    e->taken = 0;
+    e->tail = (e->tail + 1) % st->params.buffers;
+    e->sealed--;
+    if (e->sealed == 0 && e->conn_id == GATTC_STREAM_NONE) {
+        e->used = 0;
+    }
+}
+
+void gattc_stream_get_stats(const gattc_stream_t *st, gattc_stream_stats_t *stats) {
+    stats->opened = __atomic_load_n(&st->stats.opened, __ATOMIC_RELAXED);
+    stats->received = __atomic_load_n(&st->stats.received, __ATOMIC_RELAXED);
+    stats->batched = __atomic_load_n(&st->stats.batched, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&st->stats.dropped, __ATOMIC_RELAXED);
+    stats->decimated = __atomic_load_n(&st->stats.decimated, __ATOMIC_RELAXED);
+    stats->sealed = __atomic_load_n(&st->stats.sealed, __ATOMIC_RELAXED);
+    stats->published = __atomic_load_n(&st->stats.published, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&st->stats.bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,164 @@
+#ifndef __GATTC_STREAM_H__
+#define __GATTC_STREAM_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "adv_record.h"
+
+/*
+ * GATT notification streams: the notifications of the tags holding a
+ * connection, time stamped and packed into batches per connection, each batch
+ * being one MQTT message in the frame format of adv_frame.h.
+ *
+ * Each stream owns `buffers` batches of `bytes` bytes, in storage given at
+ * init: one filling, the others sealed and waiting for the uplink. A batch is
+ * sealed once the next notification does not fit, or `age_us` after its first
+ * one. When every batch of a stream waits for the uplink, notifications are
+ * dropped until one is released. With GATTC_STREAM_DECIMATE, a stream keeps
+ * only one notification in 2^n, n growing when a batch is sealed while the
+ * previous one still waits for the uplink and shrinking when none does. A
+ * thinned batch also waits 2^n age_us, up to GATTC_STREAM_AGE_MAX_US, for as
+ * many notifications per message: a slow uplink gets a thinned stream rather
+ * than gaps. n changes between batches only.
+ *
+ * Notifications come from the Bluedroid task and batches leave from another,
+ * the caller holds a lock around each call. A taken batch belongs to the caller
+ * until released and is read out of the lock. Nothing is allocated.
+ */
+
+#define GATTC_STREAM_BUFFERS_MAX    8
+#define GATTC_STREAM_VALUE_MAX      512     // ATT attribute value
+#define GATTC_STREAM_DECIMATION_MAX 6       // One notification in 64
+#define GATTC_STREAM_AGE_MAX_US     6000000 // Record time offsets are 16-bit
+#define GATTC_STREAM_NONE           0xFFFF
+
+// Storage of streams streams
+#define GATTC_STREAM_STORAGE(streams, buffers, bytes) ((size_t)(streams) * (buffers) * (bytes))
+
+typedef enum {
+    GATTC_STREAM_DROP = 0,          // Newest notifications dropped
+    GATTC_STREAM_DECIMATE,          // One in 2^n kept, n following the backlog
+} gattc_stream_policy_t;
+
+typedef struct {
+    uint16_t bytes;                 // Per batch, the MQTT message
+    uint8_t  buffers;               // Batches per stream, 2 to GATTC_STREAM_BUFFERS_MAX
+    uint8_t  policy;                // gattc_stream_policy_t
+    uint32_t age_us;                // First notification to sealed, without decimation
+    uint32_t idle_us;               // Without notification, the stream is reported idle
+} gattc_stream_params_t;
+
+/*
+ * Header of a batch, see ADV_FRAME_VERSION_STREAM
+ */
+typedef struct {
+    uint8_t  bda[ADV_BDA_LEN];
+    uint8_t  decimation;            // One notification in 2^decimation kept
+    uint32_t seq;                   // Of the first notification, counting all received
+    uint32_t time_us;               // Of the first notification
+    uint16_t count;                 // Notifications
+} gattc_stream_header_t;
+
+typedef struct {
+    uint32_t opened;
+    uint32_t received;              // Notifications of open streams
+    uint32_t batched;
+    uint32_t dropped;               // No free batch, or too long
+    uint32_t decimated;
+    uint32_t sealed;                // Batches
+    uint32_t published;
+    uint32_t bytes;                 // Of the batches published
+} gattc_stream_stats_t;
+
+typedef struct {
+    gattc_stream_header_t fill;     // Filling batch, after the sealed ones
+    uint16_t conn_id;               // GATTC_STREAM_NONE once closed
+    uint8_t  used;
+    uint8_t  decimation;            // Of the next batch
+    uint8_t  tail;                  // Oldest sealed batch
+    uint8_t  sealed;                // Waiting for the uplink
+    uint8_t  taken;                 // The oldest one, by the caller
+    uint16_t fill_len;
+    uint32_t seq;                   // Notifications received
+    uint32_t last_us;               // Latest notification, or idle report
+    uint16_t len[GATTC_STREAM_BUFFERS_MAX];     // Of the sealed batches
+    uint8_t *buf;
+} gattc_stream_entry_t;
+
+typedef struct {
+    gattc_stream_entry_t *entries;
+    uint32_t              size;
+    uint32_t              next;     // Round robin of the uplink
+    gattc_stream_params_t params;
+    gattc_stream_stats_t  stats;
+} gattc_stream_t;
+
+/*
+ * entries: size streams, storage: GATTC_STREAM_STORAGE(size, buffers, bytes)
+ * return: false on a zero size, storage too small, a batch not holding a
+ * notification of GATTC_STREAM_VALUE_MAX, or age_us too long
+ */
+bool gattc_stream_init(gattc_stream_t *st, gattc_stream_entry_t *entries, uint32_t size,
+                       uint8_t *storage, size_t storage_len, const gattc_stream_params_t *params);
+
+/*
+ * Stream of a connection, before its notifications are enabled
+ * return: stream index, -1 if none is free
+ */
+int gattc_stream_open(gattc_stream_t *st, const uint8_t *bda, uint16_t conn_id, uint32_t now_us);
+
+/*
+ * Open stream of a connection
+ * return: stream index, -1 if none
+ */
+int gattc_stream_find(const gattc_stream_t *st, uint16_t conn_id);
+
+/*
+ * Connection closed: the partial batch is sealed, the stream is free once its
+ * batches are published
+ */
+void gattc_stream_close(gattc_stream_t *st, int stream);
+
+/*
+ * One notification of a connection, from the Bluedroid callback
+ * now_us: reception time, e.g. esp_timer_get_time()
+ * return: true if a batch was sealed, to be taken
+ */
+bool gattc_stream_put(gattc_stream_t *st, uint16_t conn_id, const uint8_t *value, uint16_t len, uint32_t now_us);
+
+/*
+ * Seal the batches past age_us
+ * return: true if a batch was sealed
+ */
+bool gattc_stream_poll(gattc_stream_t *st, uint32_t now_us);
+
+/*
+ * Next open stream without notification for idle_us, reported again after
+ * another idle_us. Call until -1.
+ * return: stream index, -1 if none
+ */
+int gattc_stream_idle(gattc_stream_t *st, uint32_t now_us);
+
+/*
+ * Oldest sealed batch of the next stream with one, round robin
+ * return: stream index, to release, -1 if none
+ */
+int gattc_stream_take(gattc_stream_t *st, const uint8_t **batch, size_t *len);
+
+/*
+ * The batch taken from a stream was sent
+ */
+void gattc_stream_release(gattc_stream_t *st, int stream);
+
+static inline const uint8_t *gattc_stream_bda(const gattc_stream_t *st, int stream) {
+    return st->entries[stream].fill.bda;
+}
+
+/*
+ * Snapshot of the counters, from any task
+ */
+void gattc_stream_get_stats(const gattc_stream_t *st, gattc_stream_stats_t *stats);
+
+#endif
@@ -0,0 +1,191 @@
+#include <string.h>
+#include "json_writer.h"
+
+
+// Constants
+static const char hex_digits[16] = "0123456789ABCDEF";
+
+
+void json_init(json_writer_t *w, char *buf, size_t size) {
+    w->buf = buf;
+    w->len = 0;
+    w->size = size;
+    w->overflow = (size == 0);
+}
+
+int json_finish(json_writer_t *w) {
+    if (w->overflow || w->len >= w->size) {
+        if (w->size > 0) {
+            w->buf[0] = '\0';
+        }
+        return -1;
+    }
+    w->buf[w->len] = '\0';
+    return (int)w->len;
+}
+
+/*
+ * Reserve n bytes, always keeping one byte for the final '\0'
+ */
+static inline char *json_reserve(json_writer_t *w, size_t n) {
+    if (w->overflow || w->size - w->len <= n) {
+        w->overflow = true;
+        return NULL;
+    }
+    char *p = &w->buf[w->len];
+    w->len += n;
+    return p;
+}
+
+void json_put_char(json_writer_t *w, char c) {
+    char *p = json_reserve(w, 1);
+    if (p) {
+        *p = c;
+    }
+}
+
+void json_put_raw(json_writer_t *w, const char *s, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    char *p = json_reserve(w, len);
+    if (p) {
+        memcpy(p, s, len);
+    }
+}
+
+void json_put_string(json_writer_t *w, const char *s, size_t len) {
+    json_put_char(w, '"');
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = (uint8_t)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // Flush the clean run, then the escaped character
+        json_put_raw(w, &s[start], i - start);
+        start = i + 1;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            json_put_raw(w, esc, 2);
+        } else {
+            char esc[6] = { '\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0x0F] };
+            json_put_raw(w, esc, 6);
+        }
+    }
+    json_put_raw(w, &s[start], len - start);
+    json_put_char(w, '"');
+}
+
+void json_put_uint(json_writer_t *w, uint32_t value) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    char *p = json_reserve(w, n);
+    if (p) {
+        while (n) {
+            *p++ = digits[--n];
+        }
+    }
+}
+
+void json_put_uint64(json_writer_t *w, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    char *p = json_reserve(w, n);
+    if (p) {
+        while (n) {
+            *p++ = digits[--n];
+        }
+    }
+}
+
+void json_put_int(json_writer_t *w, int32_t value) {
+    if (value < 0) {
+        json_put_char(w, '-');
+        json_put_uint(w, (uint32_t)0 - (uint32_t)value);
+    } else {
+        json_put_uint(w, (uint32_t)value);
+    }
+}
+
+void json_put_fixed(json_writer_t *w, int32_t value, uint8_t decimals) {
+    uint32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) {
+        scale *= 10;
+    }
+    uint32_t magnitude = value < 0 ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+    if (value < 0) {
+        json_put_char(w, '-');
+    }
+    json_put_uint(w, magnitude / scale);
+    if (decimals) {
+        // Fraction with its leading zeros
+        char digits[10];
+        uint32_t fraction = magnitude % scale;
+        for (int i = decimals - 1; i >= 0; i--) {
+            digits[i] = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        json_put_char(w, '.');
+        json_put_raw(w, digits, decimals);
+    }
+}
+
+static inline char *json_hex_digits(char *p, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        *p++ = hex_digits[data[i] >> 4];
+        *p++ = hex_digits[data[i] & 0x0F];
+    }
+    return p;
+}
+
+void json_put_hex(json_writer_t *w, const uint8_t *data, size_t len) {
+    char *p = json_reserve(w, 2 * len + 2);
+    if (p) {
+        *p++ = '"';
+        p = json_hex_digits(p, data, len);
+        *p = '"';
+    }
+}
+
+void json_put_uuid(json_writer_t *w, const uint8_t uuid[16]) {
+    char *p = json_reserve(w, 32 + 4 + 2);
+    if (p) {
+        *p++ = '"';
+        p = json_hex_digits(p, &uuid[0], 4);
+        *p++ = '-';
+        p = json_hex_digits(p, &uuid[4], 2);
+        *p++ = '-';
+        p = json_hex_digits(p, &uuid[6], 2);
+        *p++ = '-';
+        p = json_hex_digits(p, &uuid[8], 2);
+        *p++ = '-';
+        p = json_hex_digits(p, &uuid[10], 6);
+        *p = '"';
+    }
+}
+
+void json_key(json_writer_t *w, const char *key, bool first) {
+    size_t key_len = strlen(key);
+    char *p = json_reserve(w, key_len + (first ? 3 : 4));
+    if (p) {
+        if (!first) {
+            *p++ = ',';
+        }
+        *p++ = '"';
+        memcpy(p, key, key_len);
+        p += key_len;
+        *p++ = '"';
+        *p = ':';
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Append-only JSON writer over a caller-owned buffer.
+ * Every append is bounds checked; once a write does not fit, `overflow` is set,
+ * later appends are ignored and json_finish() reports the failure.
+ */
+typedef struct {
+    char   *buf;
+    size_t  len;
+    size_t  size;
+    bool    overflow;
+} json_writer_t;
+
+/*
+ * Start writing into buf, size includes room for the terminating '\0'
+ */
+void json_init(json_writer_t *w, char *buf, size_t size);
+
+/*
+ * Terminate the buffer
+ * return: payload length without '\0', -1 if the buffer was too small
+ */
+int json_finish(json_writer_t *w);
+
+/*
+ * Raw appends, no escaping
+ */
+void json_put_char(json_writer_t *w, char c);
+void json_put_raw(json_writer_t *w, const char *s, size_t len);
+
+/*
+ * Quoted and escaped string, data does not need to be '\0' terminated
+ */
+void json_put_string(json_writer_t *w, const char *s, size_t len);
+
+/*
+ * Numbers, written as JSON numbers (no quotes)
+ */
+void json_put_int(json_writer_t *w, int32_t value);
+void json_put_uint(json_writer_t *w, uint32_t value);
+void json_put_uint64(json_writer_t *w, uint64_t value);
+
+/*
+ * Fixed point number, e.g. value 2350 with 2 decimals is written 23.50, 9 decimals max
+ */
+void json_put_fixed(json_writer_t *w, int32_t value, uint8_t decimals);
+
+/*
+ * Quoted upper case hex string of len bytes, e.g. "4C00"
+ */
+void json_put_hex(json_writer_t *w, const uint8_t *data, size_t len);
+
+/*
+ * Quoted 128 bits UUID in its 8-4-4-4-12 form, bytes in transmission order
+ */
+void json_put_uuid(json_writer_t *w, const uint8_t uuid[16]);
+
+/*
+ * Object member helpers, `first` members are not preceded by a comma
+ * key is a '\0' terminated literal and is not escaped
+ */
+void json_key(json_writer_t *w, const char *key, bool first);
+
+#endif
@@ -17,10 +17,9 @@
 
 /****************************************************************************
 *
-* This file is for gatt client. It can scan ble device, connect one device.
-* Run the gatt_server demo, the client demo will automatically connect to the gatt_server demo.
-* Client demo will enable gatt_server's notify after connection. Then the two devices will exchange
-* data.
+* BLE tracker: scans BLE adverts and publishes them over MQTT, with distance
+* estimates and presence events. With CONFIG_TRACKER_GATTC it also connects to
+* the tags it hears, a few at a time, to read their battery and sensor values.
 *
 ****************************************************************************/
 
@@ -31,10 +30,13 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "controller.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
@@ -51,32 +53,468 @@
 #include "esp_gatt_common_api.h"
 
 #include "fota.h"
+#include "adv_record.h"
+#include "adv_json.h"
+#include "adv_frame.h"
+#include "adv_ring.h"
+#include "adv_merge.h"
+#include "adv_table.h"
+#include "adv_batch.h"
+#include "adv_parse.h"
+#include "adv_range.h"
+#include "adv_presence.h"
+#include "adv_log.h"
+#include "adv_capture.h"
+#include "scan_config.h"
+#include "scan_control.h"
+#include "gattc_sched.h"
+#include "gattc_cache.h"
+#include "gattc_stream.h"
+#include "time_sync.h"
+#include "perf.h"
+#include "pool.h"
+#include "topic_router.h"
 
 #define TAG_TRACKER "TRACKER"
 #define TAG_WIFI "WIFI"
 #define TAG_MQTT "MQTT"
-#define REMOTE_SERVICE_UUID        0x00FF
-#define REMOTE_NOTIFY_CHAR_UUID    0xFF01
 #define PROFILE_NUM      1
 #define PROFILE_A_APP_ID 0
-#define INVALID_HANDLE   0
 
 #define SCAN_FREQUENCY_MS 30000
 #define SCAN_DURATION_S   3
-
-
-static bool connect    = false;
-static bool get_server = false;
-static esp_gattc_char_elem_t *char_elem_result   = NULL;
-static esp_gattc_descr_elem_t *descr_elem_result = NULL;
+#define SCAN_WINDOW_MIN   0x10      // Adaptive scan: no shorter HCI window, 10 ms
+#define SCAN_INTERVAL_LONGEST 0x800 // nor longer interval, 1.28 s
+#define SCAN_PERIOD_MAX_MS (4 * SCAN_FREQUENCY_MS)
+#define SCAN_INTERVAL     0x50
+#define SCAN_WINDOW       0x30
+#define SCAN_TOPIC        "/tracker/scan"
+#define STATS_REQUEST_TOPIC "/tracker/stats_request"
+#define FOTA_TOPIC        "/fota/firmware"
+#define FOTA_PROGRESS_TOPIC "/fota/progress"
+#define TIME_REQUEST_TOPIC "/tracker/time_request"
+#define TIME_TOPIC        "/tracker/time"     // Responses, on /tracker/time/<ESP Name>
+#define TIME_SYNC_SAMPLES 16        // Exchanges in the window, see time_sync.h
+#define TIME_SYNC_BEST    6         // of which fitted
+#define TIME_SYNC_BURST_MS 1000     // Between requests until the window is full
+#define TIME_SYNC_DRIFT_SPAN_S 30
+#define TIME_SYNC_DRIFT_MAX_PPB 200000
+#define TRACKER_PRIORITY  5
+#define TRACKER_FOTA_PRIORITY 2     // Scanning and publishing during an update
+
+#if CONFIG_TRACKER_SCAN_CONTINUOUS
+#define SCAN_MODE         SCAN_MODE_CONTINUOUS
+#else
+#define SCAN_MODE         SCAN_MODE_DUTY_CYCLE
+#endif
+
+#if CONFIG_TRACKER_SCAN_ADAPTIVE
+#define SCAN_ADAPTIVE     true
+#else
+#define SCAN_ADAPTIVE     false
+#endif
+
+#if CONFIG_TRACKER_SCAN_ACTIVE
+#define SCAN_ACTIVE       true
+#define SCAN_TYPE         BLE_SCAN_TYPE_ACTIVE
+#else
+#define SCAN_ACTIVE       false
+#define SCAN_TYPE         BLE_SCAN_TYPE_PASSIVE
+#endif
+
+// espmqtt builds each message in one buffer of CONFIG_MQTT_BUFFER_SIZE_BYTE
+// (mqtt_config.h): fixed header, topic length and topic, then the payload
+#ifndef CONFIG_MQTT_BUFFER_SIZE_BYTE
+#define CONFIG_MQTT_BUFFER_SIZE_BYTE 1024
+#endif
+#define TOPIC_MAX         64        // Published topics, '\0' included
+#define MQTT_HEADER_MAX   5         // Fixed header and topic length, QoS 0
+#define MQTT_PAYLOAD_MAX  (CONFIG_MQTT_BUFFER_SIZE_BYTE - MQTT_HEADER_MAX - TOPIC_MAX)
+
+#define ADV_TOPIC         "/test"
+#define RANGE_TOPIC       "/tracker/range"
+#define PRESENCE_TOPIC    "/tracker/presence"
+#define REPLAY_TOPIC      "/tracker/replay"
+#define LOG_PARTITION     "advlog"
+#define LOG_SUBTYPE       0x40
+#define CAPTURE_TOPIC     "/tracker/capture"
+#define CAPTURE_PARTITION "capture"
+#define CAPTURE_SUBTYPE   0x41
+#if CONFIG_TRACKER_CAPTURE_MQTT
+#define CAPTURE_BYTES     MQTT_PAYLOAD_MAX  // Per MQTT message
+#else
+#define CAPTURE_BYTES     1024      // Per flash chunk, one sector at most
+#endif
+#define CAPTURE_RECORDS   255
+#define CAPTURE_AGE_MS    1000
+#define PUBLISHER_POLL_MS 100
+#define SCANNING_STACK    4096      // Bytes, lower only once its high water mark in the stats allows
+// Worst path: replaying a stored advert (264 B log entry, 80 B record, 86 B
+// frame) into the JSON encoder (372 B URL buffer), under an ESP_LOG call
+// which takes about 1.5 KB of its own
+#define PUBLISHER_STACK   4096
+#define STACK_MARGIN      512       // Free bytes under which the stats warn
+#define COMMAND_POOL_SIZE 2         // Inbound commands, handled one at a time by the MQTT task
+#define COMMAND_TOPIC_MAX 64
+#define COMMAND_NODES     32        // Levels of the command topic filters
+#define COMMAND_DATA_MAX  384       // FOTA request, URL and digest
+#define MESSAGE_POOL_SIZE 2         // Outbound FOTA progress
+#define MESSAGE_MAX       160
+#define GATT_TOPIC        "/tracker/gatt"
+#define GATTC_STACK       3072
+#define GATTC_POLL_MS     100
+#define GATTC_EVENTS      32        // Bluedroid events waiting for the GATT client task
+#define GATTC_SEEN_QUEUE  64        // Tag adverts waiting for the GATT client task
+#define GATTC_VALUE_MAX   8         // Characteristic value bytes kept, the longest one read
+#define GATTC_READS       3         // Characteristics read per tag, see gattc_reads
+#define GATTC_RETRY_MS    5000
+#define GATTC_SEEN_MS     10000     // Tags not heard for longer are not connected
+#define GATTC_CACHE_NAMESPACE "gattc"
+#define GATTC_CACHE_KEY   "layouts2"    // Entry format version
+#define GATTC_CACHE_SAVE_MS 60000       // Between two NVS writes of the layouts
+#define STREAM_TOPIC      "/tracker/stream"
+#define GATTC_STREAM      GATTC_READS   // Index of the stream characteristic
+#define GATTC_STREAM_IDLE_MS 10000      // A stream without notification is closed
+#if CONFIG_TRACKER_GATTC_STREAMS
+#define GATTC_CHARS       (GATTC_READS + 1)
+// Stream batches are single MQTT messages, within the client buffer
+#if CONFIG_TRACKER_GATTC_STREAM_BYTES < MQTT_PAYLOAD_MAX
+#define GATTC_STREAM_BYTES CONFIG_TRACKER_GATTC_STREAM_BYTES
+#else
+#define GATTC_STREAM_BYTES MQTT_PAYLOAD_MAX
+#endif
+#if CONFIG_TRACKER_GATTC_STREAMS >= CONFIG_TRACKER_GATTC_LINKS
+#error "GATT notification streams must leave a connection for reads"
+#endif
+#else
+#define GATTC_CHARS       GATTC_READS
+#endif
+#if GATTC_CHARS > GATTC_CACHE_HANDLES
+#error "GATT layouts cannot hold every characteristic used"
+#endif
+#define STATS_TOPIC       CONFIG_TRACKER_STATS_TOPIC
+// Stats reports are single MQTT messages, within the client buffer
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+#define STATS_MAX_LEN     ADV_FRAME_PERF_MAX_LEN
+#elif ADV_JSON_PERF_MAX_LEN < MQTT_PAYLOAD_MAX
+#define STATS_MAX_LEN     ADV_JSON_PERF_MAX_LEN
+#else
+#define STATS_MAX_LEN     MQTT_PAYLOAD_MAX
+#endif
+
+#if CONFIG_TRACKER_RING_DROP_NEWEST
+#define ADV_RING_POLICY ADV_RING_DROP_NEWEST
+#elif CONFIG_TRACKER_RING_COALESCE
+#define ADV_RING_POLICY ADV_RING_COALESCE
+#else
+#define ADV_RING_POLICY ADV_RING_DROP_OLDEST
+#endif
+
+// Adverts handed over to the publisher at once, no more than the queue holds
+#if CONFIG_TRACKER_HANDOFF_BATCH < CONFIG_TRACKER_RING_SIZE
+#define ADV_HANDOFF_BATCH CONFIG_TRACKER_HANDOFF_BATCH
+#else
+#define ADV_HANDOFF_BATCH CONFIG_TRACKER_RING_SIZE
+#endif
+
+#if CONFIG_TRACKER_CAPTURE_MQTT || CONFIG_TRACKER_CAPTURE_FLASH
+#define TRACKER_CAPTURE 1
+#endif
+
+
+// Block pools, reserved at boot instead of malloc() per message or lookup
+typedef struct {
+    char data[COMMAND_DATA_MAX];
+} command_buf_t;
+
+typedef struct {
+    char json[MESSAGE_MAX];
+} message_buf_t;
+
+static command_buf_t command_blocks[COMMAND_POOL_SIZE];
+static uint32_t command_links[COMMAND_POOL_SIZE];
+static pool_t command_pool;
+static message_buf_t message_blocks[MESSAGE_POOL_SIZE];
+static uint32_t message_links[MESSAGE_POOL_SIZE];
+static pool_t message_pool;
 
 mqtt_client *mqtt_c = NULL;
+extern mqtt_settings settings;     // With the MQTT callbacks below
+static char adv_topic[TOPIC_MAX] = ADV_TOPIC;
+static char range_topic[TOPIC_MAX] = RANGE_TOPIC;
+static char presence_topic[TOPIC_MAX] = PRESENCE_TOPIC;
+static char replay_topic[TOPIC_MAX] = REPLAY_TOPIC;
+static char gatt_topic[TOPIC_MAX] = GATT_TOPIC;
+static char fota_progress_topic[TOPIC_MAX] = FOTA_PROGRESS_TOPIC;
+
+// Adverts queued by the GAP callback, on core 0, for the publisher task on
+// CONFIG_TRACKER_PUBLISHER_CORE: the only data shared by the two stages
+static adv_ring_slot_t adv_ring_slots[CONFIG_TRACKER_RING_SIZE];
+static adv_ring_t adv_ring;
+static adv_record_t adv_handoff[ADV_HANDOFF_BATCH];    // Publisher task only
+static TaskHandle_t publisher_task = NULL;
+
+// Batches are single MQTT messages, within the client buffer
+#if CONFIG_TRACKER_BATCH
+#if CONFIG_TRACKER_BATCH_BYTES < MQTT_PAYLOAD_MAX
+#define ADV_BATCH_BYTES   CONFIG_TRACKER_BATCH_BYTES
+#else
+#define ADV_BATCH_BYTES   MQTT_PAYLOAD_MAX
+#endif
+#define ADV_BATCH_RECORDS CONFIG_TRACKER_BATCH_RECORDS
+#define ADV_BATCH_AGE_MS  CONFIG_TRACKER_BATCH_MAX_AGE_MS
+#else
+// One advert, with its fleet time once synced
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+#define ADV_BATCH_BYTES   (ADV_FRAME_TIMED_LEN + ADV_FRAME_MAX_LEN)
+#else
+#define ADV_BATCH_BYTES   (ADV_JSON_MAX_LEN + ADV_JSON_TIMED_LEN)
+#endif
+#define ADV_BATCH_RECORDS 1
+#define ADV_BATCH_AGE_MS  0
+#endif
+#if ADV_BATCH_BYTES > MQTT_PAYLOAD_MAX
+#error "An advert does not fit the MQTT client buffer, see CONFIG_MQTT_BUFFER_SIZE_BYTE"
+#endif
+#if CONFIG_TRACKER_BATCH && !CONFIG_TRACKER_WIRE_FORMAT_BINARY
+#define ADV_BATCH_JSON    true
+#else
+#define ADV_BATCH_JSON    false
+#endif
+
+// Outbound message, filled by the publisher task only
+static uint8_t adv_batch_buf[ADV_BATCH_BYTES];
+static adv_batch_t adv_batch;
+static volatile bool adv_cycle_end = false;
+
+#if CONFIG_TRACKER_RANGE
+// Distance estimates, filled and sent by the publisher task only
+static adv_range_entry_t range_entries[CONFIG_TRACKER_RANGE_DEVICES];
+static adv_range_t range;
+static uint8_t range_batch_buf[ADV_BATCH_BYTES];
+static adv_batch_t range_batch;
+static const adv_range_params_t range_params = {
+    .process_noise      = CONFIG_TRACKER_RANGE_PROCESS_NOISE / 100.0f,
+    .measurement_noise  = CONFIG_TRACKER_RANGE_MEASUREMENT_NOISE,
+    .path_loss          = CONFIG_TRACKER_RANGE_PATH_LOSS / 10.0f,
+    .ref_power          = CONFIG_TRACKER_RANGE_REF_POWER,
+    .threshold_cm       = CONFIG_TRACKER_RANGE_THRESHOLD_CM,
+};
+#endif
+
+#if CONFIG_TRACKER_PRESENCE
+// Device registry, updated and reported by the publisher task only
+static adv_presence_entry_t presence_entries[CONFIG_TRACKER_PRESENCE_DEVICES];
+static adv_presence_t presence;
+static uint8_t presence_batch_buf[ADV_BATCH_BYTES];
+static adv_batch_t presence_batch;
+static const adv_presence_params_t presence_params = {
+    .enter_count = CONFIG_TRACKER_PRESENCE_ENTER_COUNT,
+    .enter_rssi  = CONFIG_TRACKER_PRESENCE_ENTER_RSSI,
+    .leave_rssi  = CONFIG_TRACKER_PRESENCE_LEAVE_RSSI,
+    .leave_ms    = CONFIG_TRACKER_PRESENCE_LEAVE_S * 1000,
+};
+#endif
+
+#if CONFIG_TRACKER_LOG
+// Adverts stored while offline, replayed by the publisher task
+static const esp_partition_t *log_partition = NULL;
+static adv_log_t adv_log;
+static bool adv_log_ready = false;
+static uint8_t replay_batch_buf[ADV_BATCH_BYTES];
+static adv_batch_t replay_batch;
+static uint32_t replay_skipped = 0;         // Entries read between those of replay_batch
+#endif
+static bool adv_online = false;
+
+#if CONFIG_TRACKER_STATS
+static uint32_t adv_batch_oldest_ms = 0;   // Scan time of the oldest advert in adv_batch
+static char stats_topic[TOPIC_MAX] = STATS_TOPIC;
+static char stats_buf[STATS_MAX_LEN];
+static TaskHandle_t btc_task = NULL;
+static TaskHandle_t mqtt_task = NULL;
+static volatile bool stats_requested = false;
+#endif
+
+#if CONFIG_TRACKER_TIME_SYNC
+// Fleet time, estimated and used by the publisher task. The MQTT task hands it
+// the latest response, stamped on reception.
+typedef struct {
+    uint64_t id;
+    int64_t  t2;
+    int64_t  t3;
+    int64_t  t4;
+    bool     ready;
+} time_reply_t;
+
+static time_sync_t time_sync;
+static const time_sync_params_t time_sync_params = {
+    .period_us     = CONFIG_TRACKER_TIME_SYNC_PERIOD_S * 1000000,
+    .burst_us      = TIME_SYNC_BURST_MS * 1000,
+    .timeout_us    = CONFIG_TRACKER_TIME_SYNC_TIMEOUT_MS * 1000,
+    .drift_span_us = TIME_SYNC_DRIFT_SPAN_S * 1000000,
+    .drift_max_ppb = TIME_SYNC_DRIFT_MAX_PPB,
+    .samples       = TIME_SYNC_SAMPLES,
+    .best          = TIME_SYNC_BEST,
+};
+static time_reply_t time_reply;
+static portMUX_TYPE time_reply_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+#if TRACKER_CAPTURE
+// Raw scan results, see adv_capture.h
+static char capture_topic[TOPIC_MAX] = CAPTURE_TOPIC;
+static uint8_t capture_batch_buf[CAPTURE_BYTES];
+static adv_batch_t capture_batch;
+#endif
+#if CONFIG_TRACKER_CAPTURE_FLASH
+static const esp_partition_t *capture_partition = NULL;
+static adv_capture_store_t capture_store;
+static bool capture_ready = false;
+#endif
+
+#if CONFIG_TRACKER_AGGREGATE
+// Per scan window device tables, one filling while the other one is flushed
+static adv_entry_t adv_entries[2][CONFIG_TRACKER_TABLE_SIZE];
+static uint16_t adv_order[2][CONFIG_TRACKER_TABLE_SIZE];
+static adv_table_t adv_tables[2];
+#endif
+
+// Scan settings, changed from MQTT and applied by the scanning task
+static scan_config_t scan_config = {
+    .mode       = SCAN_MODE,
+    .interval   = SCAN_INTERVAL,
+    .window     = SCAN_WINDOW,
+    .period_ms  = SCAN_FREQUENCY_MS,
+    .duration_s = SCAN_DURATION_S,
+    .window_ms  = CONFIG_TRACKER_SCAN_WINDOW_MS,
+    .adaptive   = SCAN_ADAPTIVE,
+    .active     = SCAN_ACTIVE,
+};
+static portMUX_TYPE scan_config_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t scanning_task = NULL;
+
+// Adaptive scan, the scanning task adjusts the settings above at each window
+static const scan_control_params_t scan_control_params = {
+    .duty_min      = CONFIG_TRACKER_SCAN_DUTY_MIN,
+    .duty_max      = CONFIG_TRACKER_SCAN_DUTY_MAX,
+    .sightings     = CONFIG_TRACKER_SCAN_SIGHTINGS,
+    .queue_high    = CONFIG_TRACKER_SCAN_QUEUE_HIGH,
+    .window_min    = SCAN_WINDOW_MIN,
+    .interval_max  = SCAN_INTERVAL_LONGEST,
+    .period_max_ms = SCAN_PERIOD_MAX_MS,
+};
+static scan_control_t scan_control;
+static volatile bool scan_adaptive = false;
+
+// Active scan, scannable adverts wait for their scan response, GAP callback only
+static adv_merge_entry_t adv_merge_entries[CONFIG_TRACKER_SCAN_RSP_CACHE];
+static adv_merge_t adv_merge;
+static volatile bool scan_active = SCAN_ACTIVE;
+static volatile bool scan_on = false;      // Scanner listening, GATT client budget
+
+#if CONFIG_TRACKER_GATTC
+// GATT client, the scheduler and the jobs belong to the GATT client task. The
+// Bluedroid callbacks hand it copies of their events.
+typedef struct {
+    esp_gattc_cb_event_t event;
+    esp_gatt_status_t    status;
+    uint16_t             conn_id;
+    uint8_t              bda[ADV_BDA_LEN];     // OPEN, CLOSE, SRVC_CHG
+    uint16_t             uuid;              // SEARCH_RES: service
+    uint16_t             start;             // SEARCH_RES: handle range, READ_CHAR, WRITE_DESCR: handle,
+                                            // CFG_MTU: mtu
+    uint16_t             end;
+    uint8_t              value_len;
+    uint8_t              value[GATTC_VALUE_MAX];
+} gattc_event_t;
+
+typedef struct {
+    uint8_t  bda[ADV_BDA_LEN];
+    int8_t   rssi;
+    uint32_t model;                         // adv_fingerprint()
+    uint32_t time_ms;
+} gattc_seen_t;
+
+typedef struct {
+    uint16_t service;
+    uint16_t characteristic;
+    uint8_t  property;                      // Required, ESP_GATT_CHAR_PROP_BIT_
+} gattc_read_t;
+
+// The characteristics read, then the one streamed
+static const gattc_read_t gattc_reads[GATTC_CHARS] = {
+    { GATTC_UUID_BATTERY_SERVICE, GATTC_UUID_BATTERY_LEVEL, ESP_GATT_CHAR_PROP_BIT_READ },
+    { GATTC_UUID_ENV_SENSING,     GATTC_UUID_TEMPERATURE,   ESP_GATT_CHAR_PROP_BIT_READ },
+    { GATTC_UUID_ENV_SENSING,     GATTC_UUID_HUMIDITY,      ESP_GATT_CHAR_PROP_BIT_READ },
+#if CONFIG_TRACKER_GATTC_STREAMS
+    { CONFIG_TRACKER_GATTC_STREAM_SERVICE, CONFIG_TRACKER_GATTC_STREAM_CHAR, ESP_GATT_CHAR_PROP_BIT_NOTIFY },
+#endif
+};
+
+// One per link: services found, characteristics to read, values read so far
+typedef struct {
+    uint16_t        start[GATTC_CHARS];     // Service of each characteristic, 0 if absent
+    uint16_t        end[GATTC_CHARS];
+    uint16_t        handles[GATTC_CHARS];   // 0 if absent or not usable
+    uint16_t        cccd;                   // Descriptor enabling the stream, 0 if not discovered
+    uint8_t         next;                   // Read in progress
+    uint8_t         cached;                 // gattc_cache_kind_t of the handles
+    int8_t          stream;                 // Notification stream, -1 if none
+    gattc_reading_t reading;
+} gattc_job_t;
+
+static const gattc_sched_params_t gattc_params = {
+    .period_ms          = CONFIG_TRACKER_GATTC_PERIOD_S * 1000,
+    .urgent_period_ms   = CONFIG_TRACKER_GATTC_PERIOD_S * 1000 / 4,
+    .retry_ms           = GATTC_RETRY_MS,
+    .seen_ms            = GATTC_SEEN_MS,
+    .connect_timeout_ms = CONFIG_TRACKER_GATTC_CONNECT_TIMEOUT_MS,
+    .job_timeout_ms     = CONFIG_TRACKER_GATTC_TIMEOUT_MS,
+    .duty               = CONFIG_TRACKER_GATTC_DUTY,
+    .links              = CONFIG_TRACKER_GATTC_LINKS,
+};
+static gattc_sched_tag_t gattc_tags[CONFIG_TRACKER_GATTC_TAGS];
+static gattc_sched_t gattc_sched;
+static gattc_job_t gattc_jobs[CONFIG_TRACKER_GATTC_LINKS];
+static QueueHandle_t gattc_events = NULL;
+static QueueHandle_t gattc_seen_queue = NULL;
+static TaskHandle_t gattc_task = NULL;
+static uint8_t gattc_batch_buf[ADV_BATCH_BYTES];
+static adv_batch_t gattc_batch;
+#if CONFIG_TRACKER_GATTC_CACHE
+static gattc_cache_entry_t gattc_cache_entries[CONFIG_TRACKER_GATTC_CACHE];
+static gattc_cache_t gattc_cache;
+static uint32_t gattc_cache_saved_ms = 0;
+#endif
+#if CONFIG_TRACKER_GATTC_STREAMS
+// Notification streams, filled by the BTC task and sent by the GATT client
+// task, both under gattc_stream_lock
+static const gattc_stream_params_t gattc_stream_params = {
+    .bytes   = GATTC_STREAM_BYTES,
+    .buffers = CONFIG_TRACKER_GATTC_STREAM_BUFFERS,
+#if CONFIG_TRACKER_GATTC_STREAM_DROP
+    .policy  = GATTC_STREAM_DROP,
+#else
+    .policy  = GATTC_STREAM_DECIMATE,
+#endif
+    .age_us  = CONFIG_TRACKER_GATTC_STREAM_AGE_MS * 1000,
+    .idle_us = GATTC_STREAM_IDLE_MS * 1000,
+};
+static gattc_stream_entry_t gattc_stream_entries[CONFIG_TRACKER_GATTC_STREAMS];
+static uint8_t gattc_stream_buf[GATTC_STREAM_STORAGE(CONFIG_TRACKER_GATTC_STREAMS, CONFIG_TRACKER_GATTC_STREAM_BUFFERS,
+                                                     GATTC_STREAM_BYTES)];
+static gattc_stream_t gattc_streams;
+static portMUX_TYPE gattc_stream_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+#endif
 
 
 // FreeRTOS event group to signal when we are connected & ready to send data
 EventGroupHandle_t network_event_group;
 const int WIFI_CONNECTED = BIT0;
 const int MQTT_CONNECTED = BIT1;
+const int SCAN_PARAMS_SET = BIT2;
 
 // Declare static functions
 static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
@@ -84,48 +522,81 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
 static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
 
 
-static esp_bt_uuid_t remote_filter_service_uuid = {
-    .len = ESP_UUID_LEN_16,
-    .uuid = {.uuid16 = REMOTE_SERVICE_UUID,},
-};
-
-static esp_bt_uuid_t remote_filter_char_uuid = {
-    .len = ESP_UUID_LEN_16,
-    .uuid = {.uuid16 = REMOTE_NOTIFY_CHAR_UUID,},
-};
-
-static esp_bt_uuid_t notify_descr_uuid = {
-    .len = ESP_UUID_LEN_16,
-    .uuid = {.uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG,},
-};
-
 static esp_ble_scan_params_t ble_scan_params = {
-    .scan_type              = BLE_SCAN_TYPE_PASSIVE,
+    .scan_type              = SCAN_TYPE,
     .own_addr_type          = BLE_ADDR_TYPE_PUBLIC,
     .scan_filter_policy     = BLE_SCAN_FILTER_ALLOW_ALL,
-    .scan_interval          = 0x50,
-    .scan_window            = 0x30
+    .scan_interval          = SCAN_INTERVAL,
+    .scan_window            = SCAN_WINDOW
 };
 
 struct gattc_profile_inst {
     esp_gattc_cb_t gattc_cb;
     uint16_t gattc_if;
     uint16_t app_id;
-    uint16_t conn_id;
-    uint16_t service_start_handle;
-    uint16_t service_end_handle;
-    uint16_t char_handle;
-    esp_bd_addr_t remote_bda;
 };
 
+/*
+ * Microseconds since an esp_timer_get_time() stamp, from any core
+ */
+static inline uint32_t perf_elapsed_us(int64_t start_us)
+{
+    return (uint32_t)(esp_timer_get_time() - start_us);
+}
+
+/*
+ * Publish a message, accounted in the stats
+ */
+static void tracker_publish(mqtt_client *client, const char *topic, const void *data, size_t len)
+{
+#if CONFIG_TRACKER_STATS
+    int64_t start = esp_timer_get_time();
+    mqtt_publish(client, topic, (const char *)data, len, 0, 0);
+    perf_record(PERF_HIST_PUBLISH, perf_elapsed_us(start));
+    perf_count(PERF_MQTT_MESSAGES, 1);
+    perf_count(PERF_MQTT_BYTES, len);
+#else
+    mqtt_publish(client, topic, (const char *)data, len, 0, 0);
+#endif
+}
+
+/*
+ * Subscribe to a command topic: for all trackers, this one, <topic>/<ESP Name>,
+ * and its group, <topic>/<group>
+ */
+static void command_subscribe( mqtt_client *client, const char *topic ) {
+    char sub_topic[COMMAND_TOPIC_MAX];
+
+    mqtt_subscribe( client, topic, 0 );
+    snprintf( sub_topic, sizeof( sub_topic ), "%s/%s", topic, settings.client_id );
+    mqtt_subscribe( client, sub_topic, 0 );
+    if ( CONFIG_TRACKER_GROUP[0] ) {
+        snprintf( sub_topic, sizeof( sub_topic ), "%s/%s", topic, CONFIG_TRACKER_GROUP );
+        mqtt_subscribe( client, sub_topic, 0 );
+    }
+}
+
 /* 
  * Called when MQTT is connected
  */
 void connected_cb( mqtt_client *self, mqtt_event_data_t *params ) {
     ESP_LOGI( TAG_MQTT, "Connected" );
+#if CONFIG_TRACKER_STATS
+    mqtt_task = xTaskGetCurrentTaskHandle();
+#endif
     xEventGroupSetBits( network_event_group, MQTT_CONNECTED );
     mqtt_client *client = (mqtt_client *) self;
-    mqtt_subscribe( client, "/fota/firmware", 0 );
+    command_subscribe( client, FOTA_TOPIC );
+    command_subscribe( client, SCAN_TOPIC );
+#if CONFIG_TRACKER_STATS
+    command_subscribe( client, STATS_REQUEST_TOPIC );
+#endif
+#if CONFIG_TRACKER_TIME_SYNC
+    // This tracker only
+    char sub_topic[COMMAND_TOPIC_MAX];
+    snprintf( sub_topic, sizeof( sub_topic ), "%s/%s", TIME_TOPIC, settings.client_id );
+    mqtt_subscribe( client, sub_topic, 0 );
+#endif
 }
 
 /* 
@@ -137,326 +608,1672 @@ void disconnected_cb( mqtt_client *self, mqtt_event_data_t *params ) {
 }
 
 /*
- * TODO
+ * TODO
+ */
+void reconnect_cb( mqtt_client *self, mqtt_event_data_t *params ) {
+}
+
+/*
+ * Called after each topic subscription
+ */
+void subscribe_cb( mqtt_client *self, mqtt_event_data_t *params ) {
+    ESP_LOGI( TAG_MQTT, "Subscribe OK" );
+}
+
+/*
+ * Called each time a message is published
+ */
+void publish_cb( mqtt_client *self, mqtt_event_data_t *params ) {
+    ESP_LOGI( TAG_MQTT, "Published" );
+}
+
+/*
+ * Scan settings command, applied by the scanning task without stopping longer
+ * than needed to change the controller parameters
+ */
+static void scan_command( const char *data, size_t len ) {
+    scan_config_t cfg;
+
+    portENTER_CRITICAL( &scan_config_lock );
+    cfg = scan_config;
+    portEXIT_CRITICAL( &scan_config_lock );
+    if ( !scan_config_parse( data, len, &cfg ) ) {
+        ESP_LOGW( TAG_TRACKER, "Invalid scan command: %.*s", (int)len, data );
+        return;
+    }
+    portENTER_CRITICAL( &scan_config_lock );
+    scan_config = cfg;
+    portEXIT_CRITICAL( &scan_config_lock );
+    if ( scanning_task ) {
+        xTaskNotifyGive( scanning_task );
+    }
+}
+
+/*
+ * Update progress, from the OTA task. The tracker keeps going behind the
+ * download, at a lower priority.
+ */
+static void fota_progress( const fota_progress_t *progress ) {
+    message_buf_t *msg;
+    int len;
+    mqtt_client *client = mqtt_c;
+
+    if ( progress->state == FOTA_STATE_START || progress->state == FOTA_STATE_FAILED ) {
+        UBaseType_t priority = ( progress->state == FOTA_STATE_START ) ? TRACKER_FOTA_PRIORITY : TRACKER_PRIORITY;
+        if ( scanning_task ) {
+            vTaskPrioritySet( scanning_task, priority );
+        }
+        vTaskPrioritySet( publisher_task, priority );
+#if CONFIG_TRACKER_GATTC
+        if ( gattc_task ) {
+            vTaskPrioritySet( gattc_task, priority );
+        }
+#endif
+    }
+    msg = pool_alloc( &message_pool );
+    if ( msg == NULL ) {
+        ESP_LOGW( TAG_TRACKER, "FOTA %s, no message buffer", fota_state_name( progress->state ) );
+#if CONFIG_TRACKER_STATS
+        perf_count( PERF_POOL_EXHAUSTED, 1 );
+#endif
+        return;
+    }
+    len = snprintf( msg->json, sizeof( msg->json ),
+                    "{\"State\":\"%s\",\"Error\":\"%s\",\"Received\":%u,\"Written\":%u,\"Total\":%d,\"Elapsed\":%u}",
+                    fota_state_name( progress->state ), fota_err_name( progress->err ),
+                    progress->received, progress->written, (int)progress->total, progress->elapsed_ms );
+    ESP_LOGI( TAG_TRACKER, "FOTA %s", msg->json );
+    if ( client && len > 0 && len < sizeof( msg->json ) ) {
+        tracker_publish( client, fota_progress_topic, msg->json, len );
+    }
+    pool_free( &message_pool, msg );
+}
+
+static void fota_route( const char *topic, size_t topic_len, const char *data, size_t len, void *ctx ) {
+    fota_update( data, len, fota_progress );
+}
+
+static void scan_route( const char *topic, size_t topic_len, const char *data, size_t len, void *ctx ) {
+    scan_command( data, len );
+}
+
+#if CONFIG_TRACKER_STATS
+/*
+ * Publish the stats now, the period restarts
+ */
+static void stats_route( const char *topic, size_t topic_len, const char *data, size_t len, void *ctx ) {
+    stats_requested = true;
+    xTaskNotifyGive( publisher_task );
+}
+#endif
+
+#if CONFIG_TRACKER_TIME_SYNC
+/*
+ * Fleet time response, for the publisher task
+ */
+static void time_route( const char *topic, size_t topic_len, const char *data, size_t len, void *ctx ) {
+    time_reply_t reply;
+
+    reply.t4 = esp_timer_get_time();
+    if ( !time_sync_parse( data, len, &reply.id, &reply.t2, &reply.t3 ) ) {
+        ESP_LOGW( TAG_MQTT, "Invalid time response: %.*s", (int)len, data );
+        return;
+    }
+    reply.ready = true;
+    portENTER_CRITICAL( &time_reply_lock );
+    time_reply = reply;
+    portEXIT_CRITICAL( &time_reply_lock );
+    xTaskNotifyGive( publisher_task );
+}
+#endif
+
+/*
+ * Command topics, each also per tracker and per group, see command_subscribe()
+ */
+static const topic_route_t command_routes[] = {
+    { FOTA_TOPIC "/#",          fota_route,  NULL },
+    { SCAN_TOPIC "/#",          scan_route,  NULL },
+#if CONFIG_TRACKER_STATS
+    { STATS_REQUEST_TOPIC "/#", stats_route, NULL },
+#endif
+#if CONFIG_TRACKER_TIME_SYNC
+    { TIME_TOPIC "/#",          time_route,  NULL },
+#endif
+};
+static topic_node_t command_nodes[COMMAND_NODES];
+static uint16_t command_edges[2 * COMMAND_NODES];
+static topic_router_t command_router;
+
+/*
+ * Called for each message received on subscribed topics
+ */
+void data_cb( mqtt_client *self, mqtt_event_data_t *params ) {
+    mqtt_event_data_t *event_data = (mqtt_event_data_t *) params;
+
+    if ( event_data->data_offset == 0 ) { // TODO - Why ?
+        if ( event_data->data_length >= COMMAND_DATA_MAX ) {
+            ESP_LOGE( TAG_MQTT, "Message of %d bytes on %.*s dropped, too long", (int)event_data->data_length,
+                      (int)event_data->topic_length, event_data->topic );
+            return;
+        }
+        command_buf_t *cmd = pool_alloc( &command_pool );
+        if ( cmd == NULL ) {
+            ESP_LOGE( TAG_MQTT, "Message dropped, no command buffer" );
+#if CONFIG_TRACKER_STATS
+            perf_count( PERF_POOL_EXHAUSTED, 1 );
+#endif
+            return;
+        }
+        ESP_LOGI( TAG_MQTT, "Published on topic: %.*s", (int)event_data->topic_length, event_data->topic );
+
+        char *data = cmd->data;
+        memcpy( data, event_data->data, event_data->data_length );
+        data[event_data->data_length] = 0; //  TODO - Why ?
+        /*
+        ESP_LOGI( TAG_MQTT, "Published data[%d/%d bytes] - %s",
+                    event_data->data_length + event_data->data_offset,
+                    event_data->data_total_length, data
+                );
+        */
+        if ( topic_router_dispatch( &command_router, event_data->topic, event_data->topic_length,
+                                    data, event_data->data_length ) == 0 ) {
+            ESP_LOGW( TAG_MQTT, "No handler for %.*s", (int)event_data->topic_length, event_data->topic );
+        }
+        pool_free( &command_pool, cmd );
+    }
+}
+
+mqtt_settings settings = {
+    .host = CONFIG_MQTT_SERVER,
+//#if defined(CONFIG_MQTT_SECURITY_ON)
+// TODO select CONFIG_MQTT_SECURITY_ON via Menuconfig
+    .port = CONFIG_MQTT_PORT,
+/*#else    .port = 1883, #endif */
+    .client_id = CONFIG_ESP_NAME,
+    .username = CONFIG_MQTT_USERNAME,
+    .password = CONFIG_MQTT_PASSWORD,
+    .clean_session = 0,
+    .keepalive = 120,
+    .lwt_topic = "/lwt",
+    .lwt_msg = "offline",
+    .lwt_qos = 0,
+    .lwt_retain = 0,
+    .connected_cb = connected_cb,
+    .disconnected_cb = disconnected_cb,
+    // TODO .reconnect_cb = reconnect_cb,
+    .subscribe_cb = subscribe_cb,
+    .publish_cb = publish_cb,
+    .data_cb = data_cb
+};
+
+/* One gatt-based profile one app_id and one gattc_if, this array will store the gattc_if returned by ESP_GATTS_REG_EVT */
+static struct gattc_profile_inst gl_profile_tab[PROFILE_NUM] = {
+    [PROFILE_A_APP_ID] = {
+        .gattc_cb = gattc_profile_event_handler,
+        .gattc_if = ESP_GATT_IF_NONE,       /* Not get the gatt_if, so initial is ESP_GATT_IF_NONE */
+    },
+};
+
+#if CONFIG_TRACKER_GATTC
+/*
+ * Hand a GATT client event to the GATT client task, from the BTC task
+ */
+static void gattc_post(const gattc_event_t *ev)
+{
+    if (xQueueSend(gattc_events, ev, 0) != pdTRUE) {
+        // The job of the link times out
+        ESP_LOGW(TAG_TRACKER, "GATT client event %d lost, queue full", ev->event);
+        return;
+    }
+    xTaskNotifyGive(gattc_task);
+}
+
+#if CONFIG_TRACKER_GATTC_STREAMS
+/*
+ * Notification of a stream, from the BTC task: batched right away, the GATT
+ * client task is woken once a batch is ready
+ */
+static void gattc_notified(uint16_t conn_id, const uint8_t *value, uint16_t len)
+{
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    bool sealed;
+
+    portENTER_CRITICAL(&gattc_stream_lock);
+    sealed = gattc_stream_put(&gattc_streams, conn_id, value, len, now_us);
+    portEXIT_CRITICAL(&gattc_stream_lock);
+    if (sealed) {
+        xTaskNotifyGive(gattc_task);
+    }
+}
+#endif
+#endif
+
+static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+{
+#if CONFIG_TRACKER_GATTC
+    gattc_event_t ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.event = event;
+#endif
+    switch (event) {
+    case ESP_GATTC_REG_EVT:
+        ESP_LOGI(TAG_TRACKER, "REG_EVT");
+        esp_err_t scan_ret = esp_ble_gap_set_scan_params(&ble_scan_params);
+        if (scan_ret){
+            ESP_LOGE(TAG_TRACKER, "set scan params error, error code = %x", scan_ret);
+        }
+        break;
+#if CONFIG_TRACKER_GATTC
+    case ESP_GATTC_OPEN_EVT:
+        ev.status = param->open.status;
+        ev.conn_id = param->open.conn_id;
+        memcpy(ev.bda, param->open.remote_bda, ADV_BDA_LEN);
+        gattc_post(&ev);
+        break;
+    case ESP_GATTC_SEARCH_RES_EVT:
+        if (param->search_res.srvc_id.id.uuid.len != ESP_UUID_LEN_16) {
+            break;
+        }
+        ev.conn_id = param->search_res.conn_id;
+        ev.uuid = param->search_res.srvc_id.id.uuid.uuid.uuid16;
+        ev.start = param->search_res.start_handle;
+        ev.end = param->search_res.end_handle;
+        gattc_post(&ev);
+        break;
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        ev.status = param->search_cmpl.status;
+        ev.conn_id = param->search_cmpl.conn_id;
+        gattc_post(&ev);
+        break;
+    case ESP_GATTC_READ_CHAR_EVT:
+        ev.status = param->read.status;
+        ev.conn_id = param->read.conn_id;
+        ev.start = param->read.handle;
+        ev.value_len = param->read.value_len < GATTC_VALUE_MAX ? param->read.value_len : GATTC_VALUE_MAX;
+        if (ev.status == ESP_GATT_OK) {
+            memcpy(ev.value, param->read.value, ev.value_len);
+        }
+        gattc_post(&ev);
+        break;
+    case ESP_GATTC_CLOSE_EVT:
+        ev.status = param->close.status;
+        ev.conn_id = param->close.conn_id;
+        memcpy(ev.bda, param->close.remote_bda, ADV_BDA_LEN);
+        gattc_post(&ev);
+        break;
+    case ESP_GATTC_SRVC_CHG_EVT:
+        memcpy(ev.bda, param->srvc_chg.remote_bda, ADV_BDA_LEN);
+        gattc_post(&ev);
+        break;
+#endif
+#if CONFIG_TRACKER_GATTC_STREAMS
+    case ESP_GATTC_CFG_MTU_EVT:
+        ev.status = param->cfg_mtu.status;
+        ev.conn_id = param->cfg_mtu.conn_id;
+        ev.start = param->cfg_mtu.mtu;
+        gattc_post(&ev);
+        break;
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        ev.status = param->write.status;
+        ev.conn_id = param->write.conn_id;
+        ev.start = param->write.handle;
+        gattc_post(&ev);
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        gattc_notified(param->notify.conn_id, param->notify.value, param->notify.value_len);
+        break;
+#endif
+    case ESP_GATTC_DISCONNECT_EVT:
+        ESP_LOGD(TAG_TRACKER, "ESP_GATTC_DISCONNECT_EVT, conn_id %d reason %d", param->disconnect.conn_id,
+                 param->disconnect.reason);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Close the current window: the publisher flushes what was queued before
+ */
+static void scan_window_end(void)
+{
+    adv_ring_mark(&adv_ring);
+    xTaskNotifyGive(publisher_task);
+}
+
+/*
+ * Stop scanning, load the new controller parameters and wait until they are set
+ */
+static void scan_apply(const scan_config_t *cfg, bool scanning)
+{
+    if (scanning) {
+        esp_ble_gap_stop_scanning();
+    }
+    // Bluedroid does not complete a stopped scan, end its window here
+    scan_window_end();
+    ble_scan_params.scan_interval = cfg->interval;
+    ble_scan_params.scan_window = cfg->window;
+    ble_scan_params.scan_type = cfg->active ? BLE_SCAN_TYPE_ACTIVE : BLE_SCAN_TYPE_PASSIVE;
+    scan_active = cfg->active;
+    xEventGroupClearBits(network_event_group, SCAN_PARAMS_SET);
+    esp_err_t ret = esp_ble_gap_set_scan_params(&ble_scan_params);
+    if (ret) {
+        ESP_LOGE(TAG_TRACKER, "set scan params error, error code = %x", ret);
+        return;
+    }
+    xEventGroupWaitBits(network_event_group, SCAN_PARAMS_SET, true, true, 1000 / portTICK_PERIOD_MS);
+}
+
+/*
+ * Start the adaptive control from the settings
+ * dropped: set to the adverts dropped by the queue so far
+ */
+static void scan_adapt_init(const scan_config_t *cfg, uint32_t *dropped)
+{
+    adv_ring_stats_t stats;
+
+    scan_adaptive = false;
+    scan_control_init(&scan_control, &scan_control_params, cfg);
+    adv_ring_get_stats(&adv_ring, &stats);
+    *dropped = stats.dropped_newest + stats.dropped_oldest;
+    scan_adaptive = cfg->adaptive;
+}
+
+/*
+ * Adaptive scan: settings for the next window from the one that just ended
+ * dropped: adverts dropped by the queue so far, updated
+ * return: true if cfg changed
+ */
+static bool scan_adapt(scan_config_t *cfg, uint32_t *dropped)
+{
+    scan_control_obs_t obs;
+    adv_ring_stats_t stats;
+
+    scan_control_window(&scan_control, &obs);
+    adv_ring_get_stats(&adv_ring, &stats);
+    obs.dropped = stats.dropped_newest + stats.dropped_oldest - *dropped;
+    *dropped += obs.dropped;
+    obs.queue_depth = adv_ring_count(&adv_ring);
+    obs.queue_size = CONFIG_TRACKER_RING_SIZE;
+    if (!scan_control_update(&scan_control, &obs, cfg)) {
+        return false;
+    }
+    ESP_LOGI(TAG_TRACKER, "Scan duty %u/1000 for %u devices %u adverts %u dropped, interval %u window %u period %u ms",
+             scan_control.duty, obs.devices, obs.scan_results, obs.dropped, cfg->interval, cfg->window,
+             cfg->period_ms);
+    return true;
+}
+
+/*
+ * Duty cycle: scan duration_s every period_ms, the window ends on scan completion.
+ * Continuous: scan forever, a window is closed every window_ms so adverts are
+ * published with bounded latency.
+ * Both run until the settings change. Adaptive settings are updated at the end
+ * of each window, see scan_control.h.
+ */
+static void esp_ble_gap_start_scanning_wrapper( void * pvParameters )
+{
+    scan_config_t cfg;
+    TickType_t next, now;
+    TickType_t scan_end = 0;
+    bool scanning = false;
+    uint32_t dropped;
+
+    portENTER_CRITICAL(&scan_config_lock);
+    cfg = scan_config;
+    portEXIT_CRITICAL(&scan_config_lock);
+    scan_adapt_init(&cfg, &dropped);
+    next = xTaskGetTickCount();
+
+    while( 1 )
+    {
+        now = xTaskGetTickCount();
+        if (cfg.mode == SCAN_MODE_DUTY_CYCLE) {
+            scanning = (int32_t)(scan_end - now) > 0;
+        }
+        if ((int32_t)(next - now) <= 0) {
+            if (cfg.mode == SCAN_MODE_CONTINUOUS) {
+                if (scanning && cfg.adaptive && scan_adapt(&cfg, &dropped)) {
+                    // Ends the window
+                    scan_apply(&cfg, true);
+                    esp_ble_gap_start_scanning(0);
+                } else if (scanning) {
+                    scan_window_end();
+                } else {
+                    esp_ble_gap_start_scanning(0);
+                    scanning = true;
+                }
+                next += cfg.window_ms / portTICK_PERIOD_MS;
+            } else {
+                // Previous cycle is over, do not hold its adverts any longer
+                adv_cycle_end = true;
+                xTaskNotifyGive( publisher_task );
+                if (cfg.adaptive && scan_end != 0 && scan_adapt(&cfg, &dropped)) {
+                    scan_apply(&cfg, false);
+                }
+                esp_ble_gap_start_scanning( cfg.duration_s );
+                scan_end = now + cfg.duration_s * 1000 / portTICK_PERIOD_MS;
+                next += cfg.period_ms / portTICK_PERIOD_MS;
+            }
+            // Do not try to catch up after a stall
+            if ((int32_t)(next - now) <= 0) {
+                next = now + 1;
+            }
+            continue;
+        }
+        // Sleep until the next cycle or window, or until the settings change
+        if (ulTaskNotifyTake(pdTRUE, next - now)) {
+            portENTER_CRITICAL(&scan_config_lock);
+            cfg = scan_config;
+            portEXIT_CRITICAL(&scan_config_lock);
+            ESP_LOGW(TAG_TRACKER, "Scan %s%s%s, interval %u window %u",
+                     cfg.mode == SCAN_MODE_CONTINUOUS ? "continuous" : "duty cycle",
+                     cfg.adaptive ? " adaptive" : "", cfg.active ? " active" : "", cfg.interval, cfg.window);
+            scan_apply(&cfg, scanning);
+            scan_adapt_init(&cfg, &dropped);
+            scanning = false;
+            scan_end = 0;
+            next = xTaskGetTickCount();
+        }
+    }
+}
+
+/*
+ * Copy a scan result out of the Bluedroid event
+ */
+static void adv_record_fill(const struct ble_scan_result_evt_param *scan_rst, adv_record_t *rec)
+{
+    rec->time_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    rec->time_us = (uint32_t)esp_timer_get_time();
+    memcpy(rec->bda, scan_rst->bda, ADV_BDA_LEN);
+    rec->rssi = (int8_t)scan_rst->rssi;
+    rec->dev_type = (uint8_t)scan_rst->dev_type;
+    rec->adv_data_len = scan_rst->adv_data_len;
+    rec->scan_rsp_len = scan_rst->scan_rsp_len;
+    memcpy(rec->data, scan_rst->ble_adv, ADV_RECORD_DATA_MAX);
+}
+
+/*
+ * What to do with a scan result until its scan response, see adv_merge.h
+ */
+static adv_merge_kind_t adv_merge_kind(const struct ble_scan_result_evt_param *scan_rst)
+{
+    if (!scan_active) {
+        return ADV_MERGE_PASS;
+    }
+    switch (scan_rst->ble_evt_type) {
+    case ESP_BLE_EVT_CONN_ADV:
+    case ESP_BLE_EVT_DISC_ADV:
+        // Reported with its response already
+        return scan_rst->scan_rsp_len ? ADV_MERGE_PASS : ADV_MERGE_ADVERT;
+    case ESP_BLE_EVT_SCAN_RSP:
+        return ADV_MERGE_RESPONSE;
+    default:
+        return ADV_MERGE_PASS;
+    }
+}
+
+/*
+ * Capture stage, core 0: queue a record for the publisher. It is woken once per
+ * batch, waking it takes the scheduler lock of both cores.
+ */
+static void adv_queue(const adv_record_t *rec)
+{
+    if (adv_ring_push(&adv_ring, rec) && adv_ring_count(&adv_ring) == ADV_HANDOFF_BATCH) {
+        xTaskNotifyGive(publisher_task);
+    }
+}
+
+/*
+ * Encode a record in the configured wire format, with its fleet reception time
+ * once synced
+ * stats: scan window aggregate, may be NULL
+ * return: payload length, -1 on overflow
+ */
+static int adv_encode(adv_record_t *rec, const adv_stats_t *stats, char *out, size_t size)
+{
+#if CONFIG_TRACKER_TIME_SYNC
+    int64_t now_us = esp_timer_get_time();
+    int64_t time_us;
+    uint32_t error_us;
+    int len;
+
+    // Reception time back to 64 bits, it is less than 71 minutes old
+    if (time_sync_fleet(&time_sync, now_us - (uint32_t)((uint32_t)now_us - rec->time_us), &time_us, &error_us)) {
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+        int header = adv_frame_encode_timed(time_us, error_us, (uint8_t *)out, size);
+        len = header < 0 ? -1 : adv_frame_encode(rec, stats, (uint8_t *)out + header, size - header);
+        return len < 0 ? -1 : header + len;
+#else
+        len = adv_json_encode(rec, stats, settings.client_id, out, size);
+        return len < 0 ? -1 : adv_json_encode_timed(time_us, error_us, out, len, size);
+#endif
+    }
+#endif
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+    return adv_frame_encode(rec, stats, (uint8_t *)out, size);
+#else
+    return adv_json_encode(rec, stats, settings.client_id, out, size);
+#endif
+}
+
+/*
+ * Batch sink, ctx is the topic
+ */
+static void adv_batch_send(const uint8_t *data, size_t len, void *ctx)
+{
+    const char *topic = (const char *)ctx;
+    mqtt_client *client = mqtt_c;
+    if (client == NULL) {
+        ESP_LOGW(TAG_MQTT, "Batch of %d bytes lost, not connected", (int)len);
+#if CONFIG_TRACKER_STATS
+        perf_count(PERF_MQTT_LOST, 1);
+#endif
+        return;
+    }
+    tracker_publish(client, topic, data, len);
+#if CONFIG_TRACKER_STATS
+    if (topic == adv_topic) {
+        perf_record(PERF_HIST_LATENCY, (xTaskGetTickCount() * portTICK_PERIOD_MS - adv_batch_oldest_ms) * 1000);
+    }
+#endif
+}
+
+/*
+ * Encode a record straight into the outbound batch
+ */
+static void adv_publish(adv_record_t *rec, const adv_stats_t *stats)
+{
+#if CONFIG_TRACKER_LOG
+    if (!adv_online) {
+        uint8_t frame[ADV_FRAME_MAX_LEN];
+        int len = adv_frame_encode(rec, stats, frame, sizeof(frame));
+        if (adv_log_ready && len > 0 && adv_log_append(&adv_log, rec->time_ms, frame, len)) {
+#if CONFIG_TRACKER_STATS
+            perf_count(PERF_ADV_LOGGED, 1);
+#endif
+        }
+        return;
+    }
+#endif
+    size_t room;
+    uint8_t *out = adv_batch_reserve(&adv_batch, &room);
+    int len = adv_encode(rec, stats, (char *)out, room);
+
+    if (len < 0 && !adv_batch_empty(&adv_batch)) {
+        adv_batch_flush(&adv_batch, ADV_BATCH_FLUSH_BYTES);
+        out = adv_batch_reserve(&adv_batch, &room);
+        len = adv_encode(rec, stats, (char *)out, room);
+    }
+    if (len < 0) {
+        ESP_LOGE(TAG_TRACKER, "Payload overflow");
+        return;
+    }
+#if CONFIG_TRACKER_STATS
+    if (adv_batch_empty(&adv_batch) || (int32_t)(rec->time_ms - adv_batch_oldest_ms) < 0) {
+        adv_batch_oldest_ms = rec->time_ms;
+    }
+    perf_count(PERF_ADV_PUBLISHED, 1);
+#endif
+    adv_batch_commit(&adv_batch, len, xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+
+/*
+ * Item encoder for batch_put(), in the configured wire format
+ */
+typedef int (*batch_encode_t)(const void *item, uint8_t *out, size_t size);
+
+/*
+ * Encode an item into a batch, sending the batch first if the item does not fit
+ */
+static void batch_put(adv_batch_t *batch, batch_encode_t encode, const void *item, uint32_t now_ms)
+{
+    size_t room;
+    uint8_t *out = adv_batch_reserve(batch, &room);
+    int len = encode(item, out, room);
+
+    if (len < 0 && !adv_batch_empty(batch)) {
+        adv_batch_flush(batch, ADV_BATCH_FLUSH_BYTES);
+        out = adv_batch_reserve(batch, &room);
+        len = encode(item, out, room);
+    }
+    if (len < 0) {
+        ESP_LOGE(TAG_TRACKER, "Payload overflow");
+        return;
+    }
+    adv_batch_commit(batch, len, now_ms);
+}
+
+#if CONFIG_TRACKER_RANGE
+static int range_encode(const void *item, uint8_t *out, size_t size)
+{
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+    return adv_frame_encode_range(item, out, size);
+#else
+    return adv_json_encode_range(item, settings.client_id, (char *)out, size);
+#endif
+}
+#endif
+
+#if CONFIG_TRACKER_PRESENCE
+static int presence_encode(const void *item, uint8_t *out, size_t size)
+{
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+    return adv_frame_encode_presence(item, out, size);
+#else
+    return adv_json_encode_presence(item, settings.client_id, (char *)out, size);
+#endif
+}
+
+/*
+ * Registry sink, presence events and heartbeats
+ */
+static void presence_report(const adv_presence_report_t *report, void *ctx)
+{
+    batch_put(&presence_batch, presence_encode, report, xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+#endif
+
+/*
+ * Feed one advert to the per device trackers: distance estimator and registry
+ */
+static void adv_track(const adv_record_t *rec)
+{
+#if CONFIG_TRACKER_RANGE
+    adv_info_t info;
+    adv_range_estimate_t est;
+
+    adv_parse(rec, &info);
+    if (adv_range_update(&range, rec, &info, &est)) {
+        batch_put(&range_batch, range_encode, &est, rec->time_ms);
+    }
+#endif
+#if CONFIG_TRACKER_PRESENCE
+    adv_presence_update(&presence, rec);
+#endif
+}
+
+/*
+ * Time based work of the trackers: presence timeouts, heartbeats, batch deadlines
+ * cycle_end: also send pending messages
+ * return: true if there is more to do right away
+ */
+static bool adv_track_poll(uint32_t now_ms, bool cycle_end)
+{
+    bool busy = false;
+#if CONFIG_TRACKER_RANGE
+    if (cycle_end) {
+        adv_batch_flush(&range_batch, ADV_BATCH_FLUSH_CYCLE);
+    }
+    adv_batch_poll(&range_batch, now_ms);
+#endif
+#if CONFIG_TRACKER_PRESENCE
+    static uint32_t heartbeat_ms = 0;
+    adv_presence_expire(&presence, now_ms);
+    if (now_ms - heartbeat_ms >= CONFIG_TRACKER_PRESENCE_HEARTBEAT_S * 1000) {
+        heartbeat_ms = now_ms;
+        adv_presence_heartbeat_start(&presence);
+    }
+    // One device per loop, adverts keep flowing during large heartbeats
+    busy = adv_presence_heartbeat_step(&presence);
+    if (cycle_end) {
+        adv_batch_flush(&presence_batch, ADV_BATCH_FLUSH_CYCLE);
+    }
+    adv_batch_poll(&presence_batch, now_ms);
+#endif
+    return busy;
+}
+
+#if CONFIG_TRACKER_LOG
+static int log_flash_read(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    return esp_partition_read(log_partition, offset, buf, len);
+}
+
+static int log_flash_write(void *ctx, uint32_t offset, const void *buf, size_t len)
+{
+    return esp_partition_write(log_partition, offset, buf, len);
+}
+
+static int log_flash_erase(void *ctx, uint32_t offset)
+{
+    return esp_partition_erase_range(log_partition, offset, ADV_LOG_SECTOR_SIZE);
+}
+
+static int replay_encode(const void *item, uint8_t *out, size_t size)
+{
+    const adv_log_entry_t *entry = (const adv_log_entry_t *)item;
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+    return adv_frame_encode_logged(entry->seq, entry->time_ms, entry->payload, entry->len, out, size);
+#else
+    adv_record_t rec;
+    adv_stats_t stats;
+    adv_frame_decode(entry->payload, entry->len, &rec, &stats);
+    return adv_json_encode_logged(entry->seq, entry->time_ms, &rec,
+                                  entry->payload[0] == ADV_FRAME_VERSION_AGGREGATE ? &stats : NULL,
+                                  settings.client_id, (char *)out, size);
+#endif
+}
+
+/*
+ * Replay batch sink, stored adverts are acknowledged once sent
+ */
+static void replay_send(const uint8_t *data, size_t len, void *ctx)
+{
+    mqtt_client *client = mqtt_c;
+    if (client == NULL) {
+        adv_log_rewind(&adv_log);
+        replay_skipped = 0;
+        return;
+    }
+    tracker_publish(client, replay_topic, data, len);
+    adv_log_ack(&adv_log, replay_batch.records + replay_skipped);
+    replay_skipped = 0;
+}
+
+/*
+ * Replay stored adverts at CONFIG_TRACKER_LOG_REPLAY_RATE per second at most,
+ * only called when live adverts are all published
+ * return: true if an advert has been replayed
+ */
+static bool replay_step(uint32_t now_ms)
+{
+    static uint32_t tokens = 0;
+    static uint32_t refill_ms = 0;
+    static uint32_t credit = 0;         // Time not yet turned into a token, in ms * rate
+    adv_log_entry_t entry;
+    adv_record_t rec;
+
+    if (!adv_log_ready || adv_log_pending(&adv_log) == 0) {
+        return false;
+    }
+    // Token bucket, one second of burst. The fraction of a token left over
+    // carries to the next call, the rate does not depend on the call rate.
+    uint32_t elapsed_ms = now_ms - refill_ms;
+    if (elapsed_ms > 1000) {
+        elapsed_ms = 1000;
+    }
+    refill_ms = now_ms;
+    credit += elapsed_ms * CONFIG_TRACKER_LOG_REPLAY_RATE;
+    tokens += credit / 1000;
+    credit %= 1000;
+    if (tokens >= CONFIG_TRACKER_LOG_REPLAY_RATE) {
+        tokens = CONFIG_TRACKER_LOG_REPLAY_RATE;
+        credit = 0;
+    }
+    if (tokens == 0) {
+        return false;
+    }
+    if (!adv_log_read(&adv_log, &entry)) {
+        return false;
+    }
+    tokens--;
+    if (adv_frame_decode(entry.payload, entry.len, &rec, NULL) < 0) {
+        // Not an advert frame, nothing to replay, acknowledged with the batch around it
+        if (adv_batch_empty(&replay_batch)) {
+            adv_log_ack(&adv_log, 1);
+        } else {
+            replay_skipped++;
+        }
+        return true;
+    }
+    batch_put(&replay_batch, replay_encode, &entry, now_ms);
+    return true;
+}
+#endif
+
+#if TRACKER_CAPTURE
+/*
+ * Capture record, behind a sync record when it opens a message
+ */
+static int capture_encode(const void *item, uint8_t *out, size_t size)
+{
+    int sync_len = 0;
+    if (adv_batch_empty(&capture_batch)) {
+        adv_ring_stats_t stats;
+        adv_ring_get_stats(&adv_ring, &stats);
+        sync_len = adv_capture_encode_sync(stats.dropped_newest + stats.dropped_oldest + stats.coalesced,
+                                           out, size);
+        if (sync_len < 0) {
+            return -1;
+        }
+    }
+    int len = adv_capture_encode((const adv_record_t *)item, out + sync_len, size - sync_len);
+    return len < 0 ? -1 : sync_len + len;
+}
+
+#if CONFIG_TRACKER_CAPTURE_FLASH
+static int capture_flash_read(void *ctx, uint32_t offset, void *buf, size_t len)
+{
+    return esp_partition_read(capture_partition, offset, buf, len);
+}
+
+static int capture_flash_write(void *ctx, uint32_t offset, const void *buf, size_t len)
+{
+    return esp_partition_write(capture_partition, offset, buf, len);
+}
+
+static int capture_flash_erase(void *ctx, uint32_t offset)
+{
+    return esp_partition_erase_range(capture_partition, offset, ADV_CAPTURE_SECTOR_SIZE);
+}
+
+/*
+ * Batch sink of the flash capture
+ */
+static void capture_store_send(const uint8_t *data, size_t len, void *ctx)
+{
+    bool full = capture_store.full;
+    if (!capture_ready) {
+        return;
+    }
+    adv_capture_store_append(&capture_store, data, len);
+    if (capture_store.full && !full) {
+        ESP_LOGW(TAG_TRACKER, "Capture partition full, %u bytes in %u chunks",
+                 capture_store.offset, capture_store.chunks);
+    }
+}
+#endif
+#endif
+
+#if CONFIG_TRACKER_GATTC
+static int gatt_encode(const void *item, uint8_t *out, size_t size)
+{
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+    return adv_frame_encode_gatt(item, out, size);
+#else
+    return adv_json_encode_gatt(item, settings.client_id, (char *)out, size);
+#endif
+}
+
+/*
+ * Tag advert, from the GAP callback: connectable and advertising the service.
+ * The GATT client task takes it on its next wakeup.
+ */
+static void gattc_observe(const struct ble_scan_result_evt_param *scan_rst, uint32_t time_ms)
+{
+    gattc_seen_t seen;
+
+    if (scan_rst->ble_evt_type != ESP_BLE_EVT_CONN_ADV ||
+        !adv_has_service16(scan_rst->ble_adv, scan_rst->adv_data_len, CONFIG_TRACKER_GATTC_SERVICE)) {
+        return;
+    }
+    memcpy(seen.bda, scan_rst->bda, ADV_BDA_LEN);
+    seen.rssi = (int8_t)scan_rst->rssi;
+    seen.model = adv_fingerprint(scan_rst->ble_adv, scan_rst->adv_data_len);
+    seen.time_ms = time_ms;
+    xQueueSend(gattc_seen_queue, &seen, 0);
+}
+
+static esp_gatt_if_t gattc_if_get(void)
+{
+    return gl_profile_tab[PROFILE_A_APP_ID].gattc_if;
+}
+
+/*
+ * Close the connection of a job given up, or cancel its open
+ */
+static void gattc_close(int link)
+{
+    uint16_t conn_id = gattc_sched.links[link].conn_id;
+
+    if (conn_id == GATTC_SCHED_NONE) {
+        // Not connected yet, Bluedroid has no cancel call for a direct open
+        esp_ble_gap_disconnect(gattc_jobs[link].reading.bda);
+    } else {
+        esp_ble_gattc_close(gattc_if_get(), conn_id);
+    }
+}
+
+#if CONFIG_TRACKER_GATTC_STREAMS
+/*
+ * Register for the notifications of the stream characteristic and enable them
+ * on the tag
+ */
+static bool gattc_notify_enable(int link)
+{
+    gattc_job_t *job = &gattc_jobs[link];
+    uint8_t notify_on[2] = {0x01, 0x00};
+
+    return esp_ble_gattc_register_for_notify(gattc_if_get(), job->reading.bda, job->handles[GATTC_STREAM]) == ESP_OK &&
+           esp_ble_gattc_write_char_descr(gattc_if_get(), gattc_sched.links[link].conn_id, job->cccd,
+                                          sizeof(notify_on), notify_on, ESP_GATT_WRITE_TYPE_RSP,
+                                          ESP_GATT_AUTH_REQ_NONE) == ESP_OK;
+}
+
+/*
+ * Reads over, keep the connection of a streaming tag: a stream to fill, then
+ * the MTU of the local stack for longer notifications
+ * return: false if no stream is free
+ */
+static bool gattc_subscribe(int link)
+{
+    gattc_job_t *job = &gattc_jobs[link];
+    uint16_t conn_id = gattc_sched.links[link].conn_id;
+
+    if (job->cccd == 0) {
+        // Cached layout: the descriptor follows the value, as most stacks lay it out
+        job->cccd = job->handles[GATTC_STREAM] + 1;
+    }
+    portENTER_CRITICAL(&gattc_stream_lock);
+    job->stream = gattc_stream_open(&gattc_streams, job->reading.bda, conn_id, (uint32_t)esp_timer_get_time());
+    portEXIT_CRITICAL(&gattc_stream_lock);
+    if (job->stream < 0) {
+        return false;
+    }
+    if (esp_ble_gattc_send_mtu_req(gattc_if_get(), conn_id) != ESP_OK) {
+        // Notifications within the default MTU
+        return gattc_notify_enable(link);
+    }
+    return true;
+}
+
+/*
+ * Close the stream of a job, its batches are still sent
+ */
+static void gattc_unsubscribe(int link)
+{
+    gattc_job_t *job = &gattc_jobs[link];
+
+    if (job->stream < 0) {
+        return;
+    }
+    portENTER_CRITICAL(&gattc_stream_lock);
+    gattc_stream_close(&gattc_streams, job->stream);
+    portEXIT_CRITICAL(&gattc_stream_lock);
+    job->stream = -1;
+}
+#endif
+
+/*
+ * Read the next characteristic of a job. Once all are read, close it or keep
+ * it for the notifications of the tag.
  */
-void reconnect_cb( mqtt_client *self, mqtt_event_data_t *params ) {
+static void gattc_read_next(int link, uint32_t now_ms)
+{
+    gattc_job_t *job = &gattc_jobs[link];
+    uint16_t conn_id = gattc_sched.links[link].conn_id;
+
+    while (job->next < GATTC_READS && job->handles[job->next] == 0) {
+        job->next++;
+    }
+    if (job->next < GATTC_READS &&
+        esp_ble_gattc_read_char(gattc_if_get(), conn_id, job->handles[job->next], ESP_GATT_AUTH_REQ_NONE) == ESP_OK) {
+        return;
+    }
+#if CONFIG_TRACKER_GATTC_STREAMS
+    if (job->next >= GATTC_READS && job->handles[GATTC_STREAM] && gattc_subscribe(link)) {
+        return;
+    }
+#endif
+    gattc_sched_closing(&gattc_sched, link, now_ms);
+    esp_ble_gattc_close(gattc_if_get(), conn_id);
 }
 
+#if CONFIG_TRACKER_GATTC_CACHE
 /*
- * Called after each topic subscription
+ * Layouts saved before the last reboot, if any
  */
-void subscribe_cb( mqtt_client *self, mqtt_event_data_t *params ) {
-    ESP_LOGI( TAG_MQTT, "Subscribe OK" );
+static void gattc_layouts_load(void)
+{
+    nvs_handle nvs;
+    size_t len = sizeof(gattc_cache_entries);
+
+    gattc_cache_init(&gattc_cache, gattc_cache_entries, CONFIG_TRACKER_GATTC_CACHE);
+    if (nvs_open(GATTC_CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(nvs, GATTC_CACHE_KEY, gattc_cache_entries, &len) != ESP_OK) {
+        len = 0;
+    }
+    nvs_close(nvs);
+    if (gattc_cache_restore(&gattc_cache, len)) {
+        ESP_LOGI(TAG_TRACKER, "GATT layouts restored");
+    }
 }
 
 /*
- * Called each time a message is published
+ * Save the changed layouts, at most every GATTC_CACHE_SAVE_MS to spare the flash
  */
-void publish_cb( mqtt_client *self, mqtt_event_data_t *params ) {
-    ESP_LOGI( TAG_MQTT, "Published" );
+static void gattc_layouts_save(uint32_t now_ms)
+{
+    nvs_handle nvs;
+    esp_err_t err;
+
+    if (!gattc_cache.dirty || now_ms - gattc_cache_saved_ms < GATTC_CACHE_SAVE_MS) {
+        return;
+    }
+    gattc_cache_saved_ms = now_ms;
+    gattc_cache.dirty = false;
+    err = nvs_open(GATTC_CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, GATTC_CACHE_KEY, gattc_cache_entries, sizeof(gattc_cache_entries));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_TRACKER, "%s GATT layouts not saved, error %x", __func__, err);
+    }
 }
+#endif
 
 /*
- * Called for each message received on subscribed topics
+ * Connected: read right away with the cached layout of the tag, or search its
+ * services
  */
-void data_cb( mqtt_client *self, mqtt_event_data_t *params ) {
-    mqtt_event_data_t *event_data = (mqtt_event_data_t *) params;
-
-    if ( event_data->data_offset == 0 ) { // TODO - Why ?
-        char *topic = malloc( event_data->topic_length + 1 );
-        memcpy( topic, event_data->topic, event_data->topic_length );
-        topic[event_data->topic_length] = 0; //  TODO - Why ?
-        ESP_LOGI( TAG_MQTT, "Published on topic: %s", topic );
+static void gattc_discover(int link, uint32_t now_ms)
+{
+    gattc_job_t *job = &gattc_jobs[link];
+    uint16_t conn_id = gattc_sched.links[link].conn_id;
+
+    memset(job->start, 0, sizeof(job->start));
+    memset(job->end, 0, sizeof(job->end));
+    memset(job->handles, 0, sizeof(job->handles));
+    job->cccd = 0;
+    job->next = 0;
+    job->cached = GATTC_CACHE_MISS;
+#if CONFIG_TRACKER_GATTC_CACHE
+    uint16_t handles[GATTC_CACHE_HANDLES];
+    job->cached = gattc_cache_get(&gattc_cache, job->reading.bda, gattc_sched_model(&gattc_sched, link), handles);
+    if (job->cached != GATTC_CACHE_MISS) {
+        memcpy(job->handles, handles, sizeof(job->handles));
+        gattc_read_next(link, now_ms);
+        return;
+    }
+#endif
+    if (esp_ble_gattc_search_service(gattc_if_get(), conn_id, NULL) != ESP_OK) {
+        gattc_sched_closing(&gattc_sched, link, now_ms);
+        esp_ble_gattc_close(gattc_if_get(), conn_id);
+    }
+}
 
-        char *data = malloc( event_data->data_length + 1 );
-        memcpy( data, event_data->data, event_data->data_length );
-        data[event_data->data_length] = 0; //  TODO - Why ?
-        /*
-        ESP_LOGI( TAG_MQTT, "Published data[%d/%d bytes] - %s",
-                    event_data->data_length + event_data->data_offset,
-                    event_data->data_total_length, data
-                );
-        */
-        if ( strcmp( topic, "/fota/firmware" ) == 0 ) {
-            fota_update( data );
+/*
+ * Services found: look up the characteristics to use in the Bluedroid cache
+ */
+static void gattc_discovered(int link, uint32_t now_ms)
+{
+    gattc_job_t *job = &gattc_jobs[link];
+    uint16_t conn_id = gattc_sched.links[link].conn_id;
+    esp_gattc_char_elem_t elem;
+
+    for (int i = 0; i < GATTC_CHARS; i++) {
+        esp_bt_uuid_t uuid = {
+            .len  = ESP_UUID_LEN_16,
+            .uuid = {.uuid16 = gattc_reads[i].characteristic,},
+        };
+        uint16_t count = 1;
+        if (job->start[i] == 0) {
+            continue;
+        }
+        if (esp_ble_gattc_get_char_by_uuid(gattc_if_get(), conn_id, job->start[i], job->end[i], uuid,
+                                           &elem, &count) == ESP_GATT_OK &&
+            count > 0 && (elem.properties & gattc_reads[i].property)) {
+            job->handles[i] = elem.char_handle;
+        }
+    }
+#if CONFIG_TRACKER_GATTC_STREAMS
+    if (job->handles[GATTC_STREAM]) {
+        esp_bt_uuid_t uuid = {
+            .len  = ESP_UUID_LEN_16,
+            .uuid = {.uuid16 = ESP_GATT_UUID_CHAR_CLIENT_CONFIG,},
+        };
+        esp_gattc_descr_elem_t descr;
+        uint16_t count = 1;
+        if (esp_ble_gattc_get_descr_by_char_handle(gattc_if_get(), conn_id, job->handles[GATTC_STREAM], uuid,
+                                                   &descr, &count) == ESP_GATT_OK && count > 0) {
+            job->cccd = descr.handle;
+        } else {
+            // Notifications cannot be enabled
+            job->handles[GATTC_STREAM] = 0;
         }
-        free( data ); // TODO - Avoid on OTA ?
-        free( topic );
     }
+#endif
+#if CONFIG_TRACKER_GATTC_CACHE
+    for (int i = 0; i < GATTC_CHARS; i++) {
+        if (job->handles[i]) {
+            // Something to use: worth skipping the discovery next time
+            uint16_t handles[GATTC_CACHE_HANDLES] = {0};
+            memcpy(handles, job->handles, sizeof(job->handles));
+            gattc_cache_put(&gattc_cache, job->reading.bda, gattc_sched_model(&gattc_sched, link), handles);
+            break;
+        }
+    }
+#endif
+    job->next = 0;
+    gattc_read_next(link, now_ms);
 }
 
-mqtt_settings settings = {
-    .host = CONFIG_MQTT_SERVER,
-//#if defined(CONFIG_MQTT_SECURITY_ON)
-// TODO select CONFIG_MQTT_SECURITY_ON via Menuconfig
-    .port = CONFIG_MQTT_PORT,
-/*#else    .port = 1883, #endif */
-    .client_id = CONFIG_ESP_NAME,
-    .username = CONFIG_MQTT_USERNAME,
-    .password = CONFIG_MQTT_PASSWORD,
-    .clean_session = 0,
-    .keepalive = 120,
-    .lwt_topic = "/lwt",
-    .lwt_msg = "offline",
-    .lwt_qos = 0,
-    .lwt_retain = 0,
-    .connected_cb = connected_cb,
-    .disconnected_cb = disconnected_cb,
-    // TODO .reconnect_cb = reconnect_cb,
-    .subscribe_cb = subscribe_cb,
-    .publish_cb = publish_cb,
-    .data_cb = data_cb
-};
-
-/* One gatt-based profile one app_id and one gattc_if, this array will store the gattc_if returned by ESP_GATTS_REG_EVT */
-static struct gattc_profile_inst gl_profile_tab[PROFILE_NUM] = {
-    [PROFILE_A_APP_ID] = {
-        .gattc_cb = gattc_profile_event_handler,
-        .gattc_if = ESP_GATT_IF_NONE,       /* Not get the gatt_if, so initial is ESP_GATT_IF_NONE */
-    },
-};
+/*
+ * Job over: publish what was read, unless a stream did, and schedule the next
+ * read of the tag
+ */
+static void gattc_finish(int link, uint32_t now_ms)
+{
+    const gattc_reading_t *reading = &gattc_jobs[link].reading;
+    bool urgent = (reading->fields & GATTC_READING_BATTERY) &&
+                  reading->battery <= CONFIG_TRACKER_GATTC_LOW_BATTERY;
+
+#if CONFIG_TRACKER_GATTC_STREAMS
+    gattc_unsubscribe(link);
+#endif
+    if (reading->fields && !gattc_sched.links[link].streamed) {
+        batch_put(&gattc_batch, gatt_encode, reading, now_ms);
+    }
+    gattc_sched_done(&gattc_sched, link, reading->fields != 0, urgent, now_ms);
+}
 
-static void gattc_profile_event_handler(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+/*
+ * One Bluedroid event of a job
+ */
+static void gattc_handle(const gattc_event_t *ev, uint32_t now_ms)
 {
-    esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
+    gattc_job_t *job;
+    int link;
 
-    switch (event) {
-    case ESP_GATTC_REG_EVT:
-        ESP_LOGI(TAG_TRACKER, "REG_EVT");
-        esp_err_t scan_ret = esp_ble_gap_set_scan_params(&ble_scan_params);
-        if (scan_ret){
-            ESP_LOGE(TAG_TRACKER, "set scan params error, error code = %x", scan_ret);
+    if (ev->event == ESP_GATTC_OPEN_EVT || ev->event == ESP_GATTC_SRVC_CHG_EVT) {
+        link = gattc_sched_find(&gattc_sched, ev->bda);
+    } else {
+        link = gattc_sched_find_conn(&gattc_sched, ev->conn_id);
+    }
+    if (link < 0) {
+        if (ev->event == ESP_GATTC_OPEN_EVT && ev->status == ESP_GATT_OK) {
+            // The job was given up and its link freed
+            esp_ble_gattc_close(gattc_if_get(), ev->conn_id);
         }
-        break;
-    case ESP_GATTC_CONNECT_EVT:{
-        ESP_LOGI(TAG_TRACKER, "ESP_GATTC_CONNECT_EVT conn_id %d, if %d", p_data->connect.conn_id, gattc_if);
-        gl_profile_tab[PROFILE_A_APP_ID].conn_id = p_data->connect.conn_id;
-        memcpy(gl_profile_tab[PROFILE_A_APP_ID].remote_bda, p_data->connect.remote_bda, sizeof(esp_bd_addr_t));
-        ESP_LOGI(TAG_TRACKER, "REMOTE BDA:");
-        esp_log_buffer_hex(TAG_TRACKER, gl_profile_tab[PROFILE_A_APP_ID].remote_bda, sizeof(esp_bd_addr_t));
-        esp_err_t mtu_ret = esp_ble_gattc_send_mtu_req (gattc_if, p_data->connect.conn_id);
-        if (mtu_ret){
-            ESP_LOGE(TAG_TRACKER, "config MTU error, error code = %x", mtu_ret);
+#if CONFIG_TRACKER_GATTC_CACHE
+        if (ev->event == ESP_GATTC_SRVC_CHG_EVT) {
+            gattc_cache_invalidate(&gattc_cache, ev->bda, 0);
         }
-        break;
+#endif
+        return;
     }
+    job = &gattc_jobs[link];
+    switch (ev->event) {
     case ESP_GATTC_OPEN_EVT:
-        if (param->open.status != ESP_GATT_OK){
-            ESP_LOGE(TAG_TRACKER, "open failed, status %d", p_data->open.status);
+        if (ev->status != ESP_GATT_OK) {
+            gattc_sched_done(&gattc_sched, link, false, false, now_ms);
             break;
         }
-        ESP_LOGI(TAG_TRACKER, "open success");
-        break;
-    case ESP_GATTC_CFG_MTU_EVT:
-        if (param->cfg_mtu.status != ESP_GATT_OK){
-            ESP_LOGE(TAG_TRACKER,"config mtu failed, error status = %x", param->cfg_mtu.status);
+        if (gattc_sched.links[link].state == GATTC_SCHED_CLOSING) {
+            // Connected while being cancelled
+            gattc_sched_connected(&gattc_sched, link, ev->conn_id, now_ms);
+            gattc_sched_closing(&gattc_sched, link, now_ms);
+            esp_ble_gattc_close(gattc_if_get(), ev->conn_id);
+            break;
         }
-        ESP_LOGI(TAG_TRACKER, "ESP_GATTC_CFG_MTU_EVT, Status %d, MTU %d, conn_id %d", param->cfg_mtu.status, param->cfg_mtu.mtu, param->cfg_mtu.conn_id);
-        esp_ble_gattc_search_service(gattc_if, param->cfg_mtu.conn_id, &remote_filter_service_uuid);
+        gattc_sched_connected(&gattc_sched, link, ev->conn_id, now_ms);
+        job->reading.time_ms = now_ms;
+        gattc_discover(link, now_ms);
         break;
-    case ESP_GATTC_SEARCH_RES_EVT: {
-        ESP_LOGI(TAG_TRACKER, "ESP_GATTC_SEARCH_RES_EVT");
-        esp_gatt_srvc_id_t *srvc_id =(esp_gatt_srvc_id_t *)&p_data->search_res.srvc_id;
-        if (srvc_id->id.uuid.len == ESP_UUID_LEN_16 && srvc_id->id.uuid.uuid.uuid16 == REMOTE_SERVICE_UUID) {
-            ESP_LOGI(TAG_TRACKER, "service found");
-            get_server = true;
-            gl_profile_tab[PROFILE_A_APP_ID].service_start_handle = p_data->search_res.start_handle;
-            gl_profile_tab[PROFILE_A_APP_ID].service_end_handle = p_data->search_res.end_handle;
-            ESP_LOGI(TAG_TRACKER, "UUID16: %x", srvc_id->id.uuid.uuid.uuid16);
+    case ESP_GATTC_SEARCH_RES_EVT:
+        for (int i = 0; i < GATTC_CHARS; i++) {
+            if (gattc_reads[i].service == ev->uuid) {
+                job->start[i] = ev->start;
+                job->end[i] = ev->end;
+            }
         }
         break;
-    }
     case ESP_GATTC_SEARCH_CMPL_EVT:
-        if (p_data->search_cmpl.status != ESP_GATT_OK){
-            ESP_LOGE(TAG_TRACKER, "search service failed, error status = %x", p_data->search_cmpl.status);
+        if (gattc_sched.links[link].state != GATTC_SCHED_ACTIVE) {
             break;
         }
-        ESP_LOGI(TAG_TRACKER, "ESP_GATTC_SEARCH_CMPL_EVT");
-        if (get_server){
-            uint16_t count = 0;
-            esp_gatt_status_t status = esp_ble_gattc_get_attr_count( gattc_if,
-                                                                     p_data->search_cmpl.conn_id,
-                                                                     ESP_GATT_DB_CHARACTERISTIC,
-                                                                     gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                                     gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                                     INVALID_HANDLE,
-                                                                     &count);
-            if (status != ESP_GATT_OK){
-                ESP_LOGE(TAG_TRACKER, "esp_ble_gattc_get_attr_count error");
-            }
-
-            if (count > 0){
-                char_elem_result = (esp_gattc_char_elem_t *)malloc(sizeof(esp_gattc_char_elem_t) * count);
-                if (!char_elem_result){
-                    ESP_LOGE(TAG_TRACKER, "gattc no mem");
-                }else{
-                    status = esp_ble_gattc_get_char_by_uuid( gattc_if,
-                                                             p_data->search_cmpl.conn_id,
-                                                             gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                             gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                             remote_filter_char_uuid,
-                                                             char_elem_result,
-                                                             &count);
-                    if (status != ESP_GATT_OK){
-                        ESP_LOGE(TAG_TRACKER, "esp_ble_gattc_get_char_by_uuid error");
-                    }
-
-                    /*  Every service have only one char in our 'ESP_GATTS_DEMO' demo, so we used first 'char_elem_result' */
-                    if (count > 0 && (char_elem_result[0].properties & ESP_GATT_CHAR_PROP_BIT_NOTIFY)){
-                        gl_profile_tab[PROFILE_A_APP_ID].char_handle = char_elem_result[0].char_handle;
-                        esp_ble_gattc_register_for_notify (gattc_if, gl_profile_tab[PROFILE_A_APP_ID].remote_bda, char_elem_result[0].char_handle);
-                    }
-                }
-                /* free char_elem_result */
-                free(char_elem_result);
-            }else{
-                ESP_LOGE(TAG_TRACKER, "no char found");
-            }
+        if (ev->status != ESP_GATT_OK) {
+            gattc_sched_closing(&gattc_sched, link, now_ms);
+            esp_ble_gattc_close(gattc_if_get(), ev->conn_id);
+            break;
         }
-         break;
-    case ESP_GATTC_REG_FOR_NOTIFY_EVT: {
-        ESP_LOGI(TAG_TRACKER, "ESP_GATTC_REG_FOR_NOTIFY_EVT");
-        if (p_data->reg_for_notify.status != ESP_GATT_OK){
-            ESP_LOGE(TAG_TRACKER, "REG FOR NOTIFY failed: error status = %d", p_data->reg_for_notify.status);
-        }else{
-            uint16_t count = 0;
-            uint16_t notify_en = 1;
-            esp_gatt_status_t ret_status = esp_ble_gattc_get_attr_count( gattc_if,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                         ESP_GATT_DB_DESCRIPTOR,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].service_start_handle,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].service_end_handle,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].char_handle,
-                                                                         &count);
-            if (ret_status != ESP_GATT_OK){
-                ESP_LOGE(TAG_TRACKER, "esp_ble_gattc_get_attr_count error");
-            }
-            if (count > 0){
-                descr_elem_result = malloc(sizeof(esp_gattc_descr_elem_t) * count);
-                if (!descr_elem_result){
-                    ESP_LOGE(TAG_TRACKER, "malloc error, gattc no mem");
-                }else{
-                    ret_status = esp_ble_gattc_get_descr_by_char_handle( gattc_if,
-                                                                         gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                         p_data->reg_for_notify.handle,
-                                                                         notify_descr_uuid,
-                                                                         descr_elem_result,
-                                                                         &count);
-                    if (ret_status != ESP_GATT_OK){
-                        ESP_LOGE(TAG_TRACKER, "esp_ble_gattc_get_descr_by_char_handle error");
-                    }
-
-                    /* Erery char have only one descriptor in our 'ESP_GATTS_DEMO' demo, so we used first 'descr_elem_result' */
-                    if (count > 0 && descr_elem_result[0].uuid.len == ESP_UUID_LEN_16 && descr_elem_result[0].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG){
-                        ret_status = esp_ble_gattc_write_char_descr( gattc_if,
-                                                                     gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                                                     descr_elem_result[0].handle,
-                                                                     sizeof(notify_en),
-                                                                     (uint8_t *)&notify_en,
-                                                                     ESP_GATT_WRITE_TYPE_RSP,
-                                                                     ESP_GATT_AUTH_REQ_NONE);
-                    }
-
-                    if (ret_status != ESP_GATT_OK){
-                        ESP_LOGE(TAG_TRACKER, "esp_ble_gattc_write_char_descr error");
-                    }
-
-                    /* free descr_elem_result */
-                    free(descr_elem_result);
-                }
-            }
-            else{
-                ESP_LOGE(TAG_TRACKER, "decsr not found");
-            }
-
+        gattc_discovered(link, now_ms);
+        break;
+    case ESP_GATTC_READ_CHAR_EVT:
+        if (gattc_sched.links[link].state != GATTC_SCHED_ACTIVE || job->next >= GATTC_READS ||
+            job->handles[job->next] != ev->start) {
+            break;
         }
+        if (ev->status == ESP_GATT_OK &&
+            gattc_reading_put(&job->reading, gattc_reads[job->next].characteristic, ev->value, ev->value_len)) {
+            job->reading.duration_ms = now_ms - job->reading.time_ms;
+#if CONFIG_TRACKER_GATTC_CACHE
+        } else if (job->cached != GATTC_CACHE_MISS) {
+            // Another firmware or model behind the cached handles
+            gattc_cache_invalidate(&gattc_cache, job->reading.bda, gattc_sched_model(&gattc_sched, link));
+            gattc_discover(link, now_ms);
+            break;
+#endif
+        }
+        job->next++;
+        gattc_read_next(link, now_ms);
         break;
-    }
-    case ESP_GATTC_NOTIFY_EVT:
-        if (p_data->notify.is_notify) {
-             ESP_LOGI(TAG_TRACKER, "ESP_GATTC_NOTIFY_EVT, receive notify value:");
-         } else {
-             ESP_LOGI(TAG_TRACKER, "ESP_GATTC_NOTIFY_EVT, receive indicate value:");
-         }
-        esp_log_buffer_hex(TAG_TRACKER, p_data->notify.value, p_data->notify.value_len);
+#if CONFIG_TRACKER_GATTC_CACHE
+    case ESP_GATTC_SRVC_CHG_EVT:
+        gattc_cache_invalidate(&gattc_cache, ev->bda, gattc_sched_model(&gattc_sched, link));
+        if (gattc_sched.links[link].state == GATTC_SCHED_ACTIVE && job->cached != GATTC_CACHE_MISS &&
+            job->next < GATTC_READS) {
+            // The handles left to read may have moved
+            gattc_discover(link, now_ms);
+        }
         break;
-    case ESP_GATTC_WRITE_DESCR_EVT:
-        if (p_data->write.status != ESP_GATT_OK){
-            ESP_LOGE(TAG_TRACKER, "write descr failed, error status = %x", p_data->write.status);
+#endif
+#if CONFIG_TRACKER_GATTC_STREAMS
+    case ESP_GATTC_CFG_MTU_EVT:
+        if (gattc_sched.links[link].state != GATTC_SCHED_ACTIVE || job->stream < 0) {
+            // Exchange started by the tag
             break;
         }
-        ESP_LOGI(TAG_TRACKER, "write descr success ");
-        uint8_t write_char_data[35];
-        for (int i = 0; i < sizeof(write_char_data); ++i)
-        {
-            write_char_data[i] = i % 256;
-        }
-        esp_ble_gattc_write_char( gattc_if,
-                                  gl_profile_tab[PROFILE_A_APP_ID].conn_id,
-                                  gl_profile_tab[PROFILE_A_APP_ID].char_handle,
-                                  sizeof(write_char_data),
-                                  write_char_data,
-                                  ESP_GATT_WRITE_TYPE_RSP,
-                                  ESP_GATT_AUTH_REQ_NONE);
-        break;
-    case ESP_GATTC_SRVC_CHG_EVT: {
-        esp_bd_addr_t bda;
-        memcpy(bda, p_data->srvc_chg.remote_bda, sizeof(esp_bd_addr_t));
-        ESP_LOGI(TAG_TRACKER, "ESP_GATTC_SRVC_CHG_EVT, bd_addr:");
-        esp_log_buffer_hex(TAG_TRACKER, bda, sizeof(esp_bd_addr_t));
+        if (!gattc_notify_enable(link)) {
+            gattc_sched_closing(&gattc_sched, link, now_ms);
+            esp_ble_gattc_close(gattc_if_get(), ev->conn_id);
+        }
         break;
-    }
-    case ESP_GATTC_WRITE_CHAR_EVT:
-        if (p_data->write.status != ESP_GATT_OK){
-            ESP_LOGE(TAG_TRACKER, "write char failed, error status = %x", p_data->write.status);
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        if (gattc_sched.links[link].state != GATTC_SCHED_ACTIVE || job->stream < 0 || ev->start != job->cccd) {
+            break;
+        }
+        if (ev->status != ESP_GATT_OK) {
+#if CONFIG_TRACKER_GATTC_CACHE
+            if (job->cached != GATTC_CACHE_MISS) {
+                // Not the descriptor guessed from the cached layout
+                gattc_cache_invalidate(&gattc_cache, job->reading.bda, gattc_sched_model(&gattc_sched, link));
+            }
+#endif
+            gattc_sched_closing(&gattc_sched, link, now_ms);
+            esp_ble_gattc_close(gattc_if_get(), ev->conn_id);
             break;
         }
-        ESP_LOGI(TAG_TRACKER, "write char success ");
+        gattc_sched_streaming(&gattc_sched, link, now_ms);
+        if (job->reading.fields) {
+            batch_put(&gattc_batch, gatt_encode, &job->reading, now_ms);
+        }
         break;
-    case ESP_GATTC_DISCONNECT_EVT:
-        connect = false;
-        get_server = false;
-        ESP_LOGI(TAG_TRACKER, "ESP_GATTC_DISCONNECT_EVT, reason = %d", p_data->disconnect.reason);
+#endif
+    case ESP_GATTC_CLOSE_EVT:
+        gattc_finish(link, now_ms);
         break;
     default:
         break;
     }
 }
 
-static void esp_ble_gap_start_scanning_wrapper( void * pvParameters )
+#if CONFIG_TRACKER_GATTC_STREAMS
+/*
+ * Close a silent stream: its connection, or the stream alone once the
+ * connection is gone
+ */
+static void gattc_stream_silent(int stream, uint16_t conn_id, uint32_t now_ms)
 {
-    TickType_t xLastWakeTime;
-   
-    // Initialise the xLastWakeTime variable with the current time.
-    xLastWakeTime = xTaskGetTickCount( );
+    int link = gattc_sched_find_conn(&gattc_sched, conn_id);
 
-    while( 1 )
-    {
-        esp_ble_gap_start_scanning( SCAN_DURATION_S );
-        // Wait for the next cycle.
-        vTaskDelayUntil( &xLastWakeTime, SCAN_FREQUENCY_MS/portTICK_PERIOD_MS );
+    if (link >= 0 && gattc_jobs[link].stream == stream) {
+        if (gattc_sched.links[link].state != GATTC_SCHED_CLOSING) {
+            gattc_sched_closing(&gattc_sched, link, now_ms);
+            esp_ble_gattc_close(gattc_if_get(), conn_id);
+        }
+        return;
+    }
+    portENTER_CRITICAL(&gattc_stream_lock);
+    gattc_stream_close(&gattc_streams, stream);
+    portEXIT_CRITICAL(&gattc_stream_lock);
+}
+
+/*
+ * Seal the batches past their age and publish the sealed ones, each on the
+ * topic of its tag. Offline, they wait and the overflow policy applies.
+ */
+static void gattc_streams_send(uint32_t now_ms)
+{
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    char topic[sizeof(STREAM_TOPIC) + 2 * ADV_BDA_LEN + 1];
+    mqtt_client *client = mqtt_c;
+    const uint8_t *batch, *bda;
+    size_t len;
+    uint16_t conn_id = GATTC_STREAM_NONE;
+    int stream;
+
+    while (1) {
+        portENTER_CRITICAL(&gattc_stream_lock);
+        gattc_stream_poll(&gattc_streams, now_us);
+        stream = gattc_stream_idle(&gattc_streams, now_us);
+        if (stream >= 0) {
+            conn_id = gattc_streams.entries[stream].conn_id;
+        }
+        portEXIT_CRITICAL(&gattc_stream_lock);
+        if (stream < 0) {
+            break;
+        }
+        gattc_stream_silent(stream, conn_id, now_ms);
+    }
+    if (client == NULL || !(xEventGroupGetBits(network_event_group) & MQTT_CONNECTED)) {
+        return;
+    }
+    while (1) {
+        portENTER_CRITICAL(&gattc_stream_lock);
+        stream = gattc_stream_take(&gattc_streams, &batch, &len);
+        portEXIT_CRITICAL(&gattc_stream_lock);
+        if (stream < 0) {
+            break;
+        }
+        // Out of the lock: a taken batch and its stream stay as they are
+        bda = gattc_stream_bda(&gattc_streams, stream);
+        snprintf(topic, sizeof(topic), "%s/%02x%02x%02x%02x%02x%02x", STREAM_TOPIC,
+                 bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+        tracker_publish(client, topic, batch, len);
+        portENTER_CRITICAL(&gattc_stream_lock);
+        gattc_stream_release(&gattc_streams, stream);
+        portEXIT_CRITICAL(&gattc_stream_lock);
+    }
+}
+#endif
+
+/*
+ * GATT client task: takes the tag adverts and the Bluedroid events, gives up
+ * the jobs past their deadline and starts new ones, see gattc_sched.h
+ */
+static void gattc_client_task(void *pvParameters)
+{
+    gattc_event_t ev;
+    gattc_seen_t seen;
+    uint32_t now_ms;
+    int link;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, GATTC_POLL_MS / portTICK_PERIOD_MS);
+        now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        while (xQueueReceive(gattc_seen_queue, &seen, 0) == pdTRUE) {
+            gattc_sched_seen(&gattc_sched, seen.bda, seen.rssi, seen.model, seen.time_ms);
+        }
+        while (xQueueReceive(gattc_events, &ev, 0) == pdTRUE) {
+            gattc_handle(&ev, now_ms);
+        }
+        gattc_sched_tick(&gattc_sched, now_ms, scan_on);
+        while ((link = gattc_sched_expired(&gattc_sched, now_ms)) >= 0) {
+            gattc_close(link);
+        }
+        while ((link = gattc_sched_next(&gattc_sched, now_ms)) >= 0) {
+            memset(&gattc_jobs[link], 0, sizeof(gattc_jobs[link]));
+            gattc_jobs[link].stream = -1;
+            memcpy(gattc_jobs[link].reading.bda, gattc_sched_bda(&gattc_sched, link), ADV_BDA_LEN);
+            if (esp_ble_gattc_open(gattc_if_get(), gattc_jobs[link].reading.bda, true) != ESP_OK) {
+                gattc_sched_done(&gattc_sched, link, false, false, now_ms);
+            }
+        }
+        adv_batch_poll(&gattc_batch, now_ms);
+#if CONFIG_TRACKER_GATTC_STREAMS
+        gattc_streams_send(now_ms);
+#endif
+#if CONFIG_TRACKER_GATTC_CACHE
+        gattc_layouts_save(now_ms);
+#endif
+    }
+}
+#endif
+
+#if CONFIG_TRACKER_STATS
+/*
+ * Stack high water mark of a task, if it has started, with a warning when
+ * it is close to overflowing
+ */
+static void stats_stack(perf_snapshot_t *snap, TaskHandle_t task)
+{
+    if (task) {
+        UBaseType_t free_bytes = uxTaskGetStackHighWaterMark(task);
+        perf_snapshot_stack(snap, pcTaskGetTaskName(task), free_bytes);
+        // Zero on the host, whose stacks are not measured
+        if (free_bytes > 0 && free_bytes < STACK_MARGIN) {
+            ESP_LOGW(TAG_TRACKER, "Task %s down to %u free stack bytes", pcTaskGetTaskName(task), (unsigned)free_bytes);
+        }
+    }
+}
+
+/*
+ * Sample the gauges and publish the counters and histograms of the period
+ */
+static void stats_publish(uint32_t now_ms)
+{
+    static perf_snapshot_t snap;
+    adv_ring_stats_t ring;
+    mqtt_client *client = mqtt_c;
+    int len;
+
+    perf_snapshot(&snap);
+    snap.uptime_s = now_ms / 1000;
+    adv_ring_get_stats(&adv_ring, &ring);
+    snap.queue_depth = adv_ring_count(&adv_ring);
+    snap.queue_high_water = ring.high_water;
+    snap.queue_pushed = ring.pushed;
+    snap.queue_popped = ring.popped;
+    snap.queue_dropped = ring.dropped_newest + ring.dropped_oldest;
+    snap.queue_coalesced = ring.coalesced;
+    snap.heap_free = esp_get_free_heap_size();
+    snap.heap_min_free = xPortGetMinimumEverFreeHeapSize();
+    stats_stack(&snap, publisher_task);
+    stats_stack(&snap, scanning_task);
+    stats_stack(&snap, btc_task);
+    stats_stack(&snap, mqtt_task);
+#if CONFIG_TRACKER_GATTC
+    stats_stack(&snap, gattc_task);
+#endif
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+    len = adv_frame_encode_perf(&snap, (uint8_t *)stats_buf, sizeof(stats_buf));
+#else
+    len = adv_json_encode_perf(&snap, settings.client_id, true, stats_buf, sizeof(stats_buf));
+    if (len < 0) {
+        // Histogram buckets over the MQTT client buffer, summaries only
+        len = adv_json_encode_perf(&snap, settings.client_id, false, stats_buf, sizeof(stats_buf));
+    }
+#endif
+    if (len < 0) {
+        ESP_LOGE(TAG_TRACKER, "Stats overflow");
+        return;
+    }
+    if (client) {
+        tracker_publish(client, stats_topic, stats_buf, len);
+    }
+}
+#endif
+
+#if CONFIG_TRACKER_TIME_SYNC
+/*
+ * Account the latest fleet time response, then send a request if one is due
+ */
+static void time_sync_step(void)
+{
+    time_reply_t reply;
+    char request[TIME_SYNC_REQUEST_MAX];
+    mqtt_client *client;
+    int len;
+
+    portENTER_CRITICAL(&time_reply_lock);
+    reply = time_reply;
+    time_reply.ready = false;
+    portEXIT_CRITICAL(&time_reply_lock);
+    if (reply.ready && time_sync_response(&time_sync, reply.id, reply.t2, reply.t3, reply.t4)) {
+        ESP_LOGD(TAG_TRACKER, "Fleet time exchange, round trip %d us, drift %d ppb, error %u us",
+                 (int)((reply.t4 - (int64_t)reply.id) - (reply.t3 - reply.t2)), time_sync.drift_ppb,
+                 time_sync.error_us);
+    }
+    // Disconnected since the publisher loop looked, the request waits for the next one
+    client = mqtt_c;
+    if (client == NULL) {
+        return;
+    }
+    len = time_sync_request(&time_sync, settings.client_id, esp_timer_get_time(), request, sizeof(request));
+    if (len > 0) {
+        tracker_publish(client, TIME_REQUEST_TOPIC, request, len);
+    }
+}
+#endif
+
+static void adv_batch_log(void)
+{
+    const adv_batch_stats_t *stats = &adv_batch.stats;
+    ESP_LOGI(TAG_TRACKER, "Batches %u, adverts %u, %u bytes/advert, flushed on size %u count %u deadline %u cycle %u",
+             stats->messages, stats->records, stats->records ? stats->bytes / stats->records : 0,
+             stats->reasons[ADV_BATCH_FLUSH_BYTES], stats->reasons[ADV_BATCH_FLUSH_RECORDS],
+             stats->reasons[ADV_BATCH_FLUSH_DEADLINE], stats->reasons[ADV_BATCH_FLUSH_CYCLE]);
+}
+
+/*
+ * Drain the advert queue and publish, off the Bluedroid task.
+ * Adverts are taken off the queue a batch at a time, then parsed, tracked,
+ * aggregated, encoded and published on this core.
+ * With aggregation, adverts are accounted per device in the filling table and
+ * the previous window is published one device per advert, in between batches.
+ */
+static void adv_publisher_task(void *pvParameters)
+{
+    uint32_t i, n;
+    bool busy, cycle_end;
+    uint32_t mark_seen = 0;
+    uint32_t now_ms;
+#if CONFIG_TRACKER_STATS
+    uint32_t stats_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+#endif
+#if CONFIG_TRACKER_AGGREGATE
+    adv_table_t *filling = &adv_tables[0];
+    adv_table_t *flushing = NULL;
+    uint32_t flush_pos = 0;
+#endif
+
+    while (1) {
+#if CONFIG_TRACKER_LOG
+        // Offline, adverts go to the flash log
+        adv_online = (xEventGroupGetBits(network_event_group) & MQTT_CONNECTED) && mqtt_c != NULL;
+#else
+        // Adverts stay queued while MQTT is down, the overflow policy applies
+        xEventGroupWaitBits(network_event_group, MQTT_CONNECTED, false, true, portMAX_DELAY);
+        if (mqtt_c == NULL) {
+            vTaskDelay(PUBLISHER_POLL_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+        adv_online = true;
+#endif
+        busy = false;
+
+#if CONFIG_TRACKER_AGGREGATE
+        if (adv_ring_mark_reached(&adv_ring, &mark_seen)) {
+            // Scan window complete, finish the previous flush if it is late
+            if (flushing) {
+                for (; flush_pos < flushing->count; flush_pos++) {
+                    adv_entry_t *entry = adv_table_at(flushing, flush_pos);
+                    adv_publish(&entry->rec, &entry->stats);
+                }
+                adv_table_clear(flushing);
+            }
+            ESP_LOGI(TAG_TRACKER, "Window complete, %u devices, %u adverts over capacity",
+                     filling->count, filling->overflow);
+            flushing = filling;
+            flush_pos = 0;
+            filling = (filling == &adv_tables[0]) ? &adv_tables[1] : &adv_tables[0];
+        }
+        n = adv_ring_pop_batch(&adv_ring, adv_handoff, ADV_HANDOFF_BATCH);
+        for (i = 0; i < n; i++) {
+#if TRACKER_CAPTURE
+            batch_put(&capture_batch, capture_encode, &adv_handoff[i], xTaskGetTickCount() * portTICK_PERIOD_MS);
+#endif
+            adv_track(&adv_handoff[i]);
+#if CONFIG_TRACKER_PUBLISH_ADVERTS
+            adv_table_update(filling, &adv_handoff[i]);
+#endif
+        }
+        busy |= n > 0;
+        if (flushing) {
+            if (flush_pos < flushing->count) {
+                // As many devices as adverts taken, one at least
+                for (i = n ? n : 1; i > 0 && flush_pos < flushing->count; i--) {
+                    adv_entry_t *entry = adv_table_at(flushing, flush_pos++);
+                    adv_publish(&entry->rec, &entry->stats);
+                }
+                busy = true;
+            } else {
+                // Window published, end of the scan cycle
+                adv_table_clear(flushing);
+                flushing = NULL;
+                adv_batch_flush(&adv_batch, ADV_BATCH_FLUSH_CYCLE);
+                adv_batch_log();
+            }
+        }
+#else
+        if (adv_ring_mark_reached(&adv_ring, &mark_seen)) {
+            adv_batch_flush(&adv_batch, ADV_BATCH_FLUSH_CYCLE);
+            adv_batch_log();
+        }
+        n = adv_ring_pop_batch(&adv_ring, adv_handoff, ADV_HANDOFF_BATCH);
+        for (i = 0; i < n; i++) {
+#if TRACKER_CAPTURE
+            batch_put(&capture_batch, capture_encode, &adv_handoff[i], xTaskGetTickCount() * portTICK_PERIOD_MS);
+#endif
+            adv_track(&adv_handoff[i]);
+#if CONFIG_TRACKER_PUBLISH_ADVERTS
+            adv_publish(&adv_handoff[i], NULL);
+#endif
+        }
+        busy |= n > 0;
+#endif
+        now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+        cycle_end = adv_cycle_end;
+        if (cycle_end) {
+            adv_cycle_end = false;
+            adv_batch_flush(&adv_batch, ADV_BATCH_FLUSH_CYCLE);
+        }
+        adv_batch_poll(&adv_batch, now_ms);
+#if TRACKER_CAPTURE
+        adv_batch_poll(&capture_batch, now_ms);
+#endif
+        busy |= adv_track_poll(now_ms, cycle_end);
+#if CONFIG_TRACKER_LOG
+        if (adv_online) {
+            // Live adverts first
+            if (!busy) {
+                busy = replay_step(now_ms);
+            }
+            adv_batch_poll(&replay_batch, now_ms);
+        }
+#endif
+#if CONFIG_TRACKER_STATS
+        if (adv_online && (stats_requested || now_ms - stats_ms >= CONFIG_TRACKER_STATS_PERIOD_S * 1000)) {
+            stats_requested = false;
+            stats_ms = now_ms;
+            stats_publish(now_ms);
+        }
+#endif
+#if CONFIG_TRACKER_TIME_SYNC
+        if (adv_online) {
+            time_sync_step();
+        }
+#endif
+        if (!busy) {
+            ulTaskNotifyTake(pdTRUE, PUBLISHER_POLL_MS / portTICK_PERIOD_MS);
+        }
     }
 }
 
 static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
-    uint8_t *adv_name = NULL;
-    uint8_t adv_name_len = 0;
+    adv_record_t adv_rec, merged;
+    adv_merge_kind_t kind;
+#if CONFIG_TRACKER_STATS
+    int64_t start;
+#endif
     switch (event) {
     case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT: {
+        if (scanning_task) {
+            // Runtime change, the scanning task restarts the scan
+            xEventGroupSetBits(network_event_group, SCAN_PARAMS_SET);
+            break;
+        }
         // TODO infinite timeout on return value
         xEventGroupWaitBits(network_event_group, WIFI_CONNECTED | MQTT_CONNECTED, false, true, 0xFFFF);
         ESP_LOGW(TAG_TRACKER, "Starting scan");
         // Create FreeRTOS task
-        // TODO - Task stack size
-        
         xTaskCreatePinnedToCore(
                 &esp_ble_gap_start_scanning_wrapper,  /* Function to call            */
                 "scanning_wrapper",                   /* Name - 16 char max          */
-                1000,                                 /* Allocated stacks in words   */
+                SCANNING_STACK,                       /* Allocated stack in bytes    */
                 NULL,                                 /* Parameters                  */
-                5,                                    /* Priority (Low: 0, High: TBC)*/
-                NULL,                                 /* Task handle                 */
+                TRACKER_PRIORITY,                     /* Priority (Low: 0, High: TBC)*/
+                &scanning_task,                       /* Task handle                 */
                 1                                     /* Assigned to app core        */
             );
         break;
@@ -468,90 +2285,62 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
             break;
         }
         ESP_LOGI(TAG_TRACKER, "scan start success");
+        scan_on = true;
 
         break;
     case ESP_GAP_BLE_SCAN_RESULT_EVT: {
         esp_ble_gap_cb_param_t *scan_result = (esp_ble_gap_cb_param_t *)param;
         switch (scan_result->scan_rst.search_evt) {
             case ESP_GAP_SEARCH_INQ_RES_EVT:
-                esp_log_buffer_hex(TAG_TRACKER, scan_result->scan_rst.bda, 6);
-                adv_name = esp_ble_resolve_adv_data(scan_result->scan_rst.ble_adv,
-                                                    ESP_BLE_AD_TYPE_NAME_CMPL, &adv_name_len);
-                /* From Wikipedia
-                *
-                * Byte 3: Length: 0x1a
-                * Byte 4: Type: 0xff (Custom Manufacturer Packet)
-                * Byte 5-6: Manufacturer ID : 0x4c00 (Apple)
-                * Byte 7: SubType: 0x2 (iBeacon)
-                * Byte 8: SubType Length: 0x15
-                * Byte 9-24: Proximity UUID
-                * Byte 25-26: Major
-                * Byte 27-28: Minor
-                * Byte 29: Signal Power
-                *
-                * Manufacturer IDs
-                * https://www.bluetooth.com/specifications/assigned-numbers/company-identifiers
-                */
-                char payload[512]; // TODO Length
-                char name[255];    // Use malloc
-                int alt = 0;       // Fix to use Android Beacon Simulator
-                if (adv_name_len == 0) {
-                    name[0] = '\0';
-                } else {
-                    name[adv_name_len] = '\0';
-                    memcpy(name, (char *)adv_name, adv_name_len);
+#if CONFIG_TRACKER_STATS
+                start = esp_timer_get_time();
+                if (btc_task == NULL) {
+                    btc_task = xTaskGetCurrentTaskHandle();
                 }
-                if (scan_result->scan_rst.adv_data_len == 30) {
-                    alt = 3;
+#endif
+                adv_record_fill(&scan_result->scan_rst, &adv_rec);
+#if CONFIG_TRACKER_GATTC
+                gattc_observe(&scan_result->scan_rst, adv_rec.time_ms);
+#endif
+                kind = adv_merge_kind(&scan_result->scan_rst);
+                if (scan_adaptive && kind != ADV_MERGE_RESPONSE) {
+                    scan_control_observe(&scan_control, scan_result->scan_rst.bda);
                 }
-                // TODO split sprintf and/or use memcpy
-                sprintf(payload, "{\"EspName\":\"%s\",\"Name\":\"%s\",\"NameLen\":\"%d\",\"RSSI\":\"%d\",\"Length\":\"%d\",\"Type\":\"%02X\",\"ManufacturerID\":\"%02X%02X\",\"Subtype\":\"%02X\",\"SubLength\":\"%02X\",\"UUID\":\"%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X\",\"Major\":\"%02X%02X\",\"Minor\":\"%02X%02X\",\"bda\":\"%02X%02X%02X%02X%02X%02X\",\"DeviceType\":\"%d\",\"AdvDataLen\":\"%d\"}",
-                        settings.client_id,
-                        name,
-                        adv_name_len,
-                        scan_result->scan_rst.rssi,
-                        scan_result->scan_rst.ble_adv[0+alt],
-                        scan_result->scan_rst.ble_adv[1+alt],
-                        scan_result->scan_rst.ble_adv[2+alt],
-                        scan_result->scan_rst.ble_adv[3+alt],
-                        scan_result->scan_rst.ble_adv[4+alt],
-                        scan_result->scan_rst.ble_adv[5+alt],
-                        scan_result->scan_rst.ble_adv[6+alt],
-                        scan_result->scan_rst.ble_adv[7+alt],
-                        scan_result->scan_rst.ble_adv[8+alt],
-                        scan_result->scan_rst.ble_adv[9+alt],
-                        scan_result->scan_rst.ble_adv[10+alt],
-                        scan_result->scan_rst.ble_adv[11+alt],
-                        scan_result->scan_rst.ble_adv[12+alt],
-                        scan_result->scan_rst.ble_adv[13+alt],
-                        scan_result->scan_rst.ble_adv[14+alt],
-                        scan_result->scan_rst.ble_adv[15+alt],
-                        scan_result->scan_rst.ble_adv[16+alt],
-                        scan_result->scan_rst.ble_adv[17+alt],
-                        scan_result->scan_rst.ble_adv[18+alt],
-                        scan_result->scan_rst.ble_adv[19+alt],
-                        scan_result->scan_rst.ble_adv[20+alt],
-                        scan_result->scan_rst.ble_adv[21+alt],
-                        scan_result->scan_rst.ble_adv[22+alt],
-                        scan_result->scan_rst.ble_adv[23+alt],
-                        scan_result->scan_rst.ble_adv[24+alt],
-                        scan_result->scan_rst.ble_adv[25+alt],
-                        scan_result->scan_rst.bda[0],
-                        scan_result->scan_rst.bda[1],
-                        scan_result->scan_rst.bda[2],
-                        scan_result->scan_rst.bda[3],
-                        scan_result->scan_rst.bda[4],
-                        scan_result->scan_rst.bda[5],
-                        scan_result->scan_rst.dev_type,
-                        scan_result->scan_rst.adv_data_len
-                );
-                ESP_LOGW(TAG_TRACKER, "JSON: %s", payload);
-                mqtt_publish(mqtt_c, "/test", payload, strlen(payload), 0, 0);
-
-                ESP_LOGI(TAG_TRACKER, "\n");
+                // Adverts whose scan response did not come
+                while (adv_merge_expire(&adv_merge, adv_rec.time_ms, false, &merged)) {
+                    adv_queue(&merged);
+                }
+                if (kind == ADV_MERGE_PASS) {
+                    adv_queue(&adv_rec);
+                } else if (adv_merge_put(&adv_merge, &adv_rec, kind, &merged)) {
+                    adv_queue(&merged);
+                }
+#if CONFIG_TRACKER_STATS
+                perf_count(PERF_SCAN_RESULTS, 1);
+                perf_record(PERF_HIST_GAP_CB, perf_elapsed_us(start));
+#endif
                 break;
-            case ESP_GAP_SEARCH_INQ_CMPL_EVT:
+            case ESP_GAP_SEARCH_INQ_CMPL_EVT: {
+                adv_ring_stats_t stats;
+                adv_merge_stats_t merge;
+                scan_on = false;
+                // No more responses
+                while (adv_merge_expire(&adv_merge, 0, true, &merged)) {
+                    adv_queue(&merged);
+                }
+                scan_window_end();
+                adv_ring_get_stats(&adv_ring, &stats);
+                ESP_LOGI(TAG_TRACKER, "Scan complete, queue pushed %u popped %u dropped %u/%u coalesced %u high water %u",
+                         stats.pushed, stats.popped, stats.dropped_newest, stats.dropped_oldest,
+                         stats.coalesced, stats.high_water);
+                adv_merge_get_stats(&adv_merge, &merge);
+                if (merge.responses) {
+                    ESP_LOGI(TAG_TRACKER, "Scan responses %u merged %u of %u adverts, %u expired %u evicted %u orphans, %u us on air",
+                             merge.responses, merge.merged, merge.adverts, merge.expired, merge.evicted,
+                             merge.orphans, merge.airtime_us);
+                }
                 break;
+            }
             default:
                 break;
             }
@@ -564,6 +2353,7 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
             break;
         }
         ESP_LOGI(TAG_TRACKER, "stop scan successfully");
+        scan_on = false;
         
         break;
 
@@ -632,12 +2422,30 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
         xEventGroupSetBits(network_event_group, WIFI_CONNECTED);
         // /!\ Careful, might be more than client_id size;
         itoa(ipLastByte, settings.client_id + strlen(settings.client_id), 10 );
+#if CONFIG_TRACKER_WIRE_FORMAT_BINARY
+        snprintf(adv_topic, sizeof(adv_topic), "%s/%s", ADV_TOPIC, settings.client_id);
+        snprintf(range_topic, sizeof(range_topic), "%s/%s", RANGE_TOPIC, settings.client_id);
+        snprintf(presence_topic, sizeof(presence_topic), "%s/%s", PRESENCE_TOPIC, settings.client_id);
+        snprintf(replay_topic, sizeof(replay_topic), "%s/%s", REPLAY_TOPIC, settings.client_id);
+        snprintf(gatt_topic, sizeof(gatt_topic), "%s/%s", GATT_TOPIC, settings.client_id);
+#endif
+        snprintf(fota_progress_topic, sizeof(fota_progress_topic), "%s/%s", FOTA_PROGRESS_TOPIC, settings.client_id);
+#if CONFIG_TRACKER_STATS
+        snprintf(stats_topic, sizeof(stats_topic), "%s/%s", STATS_TOPIC, settings.client_id);
+#endif
+#if TRACKER_CAPTURE
+        snprintf(capture_topic, sizeof(capture_topic), "%s/%s", CAPTURE_TOPIC, settings.client_id);
+#endif
 	    mqtt_c = mqtt_start(&settings);
 	break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
         /* This is a workaround as ESP32 WiFi libs don't currently
            auto-reassociate. */
         xEventGroupClearBits(network_event_group, WIFI_CONNECTED | MQTT_CONNECTED);
+#if CONFIG_TRACKER_STATS
+        // Deleted by mqtt_stop()
+        mqtt_task = NULL;
+#endif
 	mqtt_stop();
 	mqtt_c = NULL;
 	esp_wifi_connect();
@@ -683,8 +2491,149 @@ void app_main()
     }
     ESP_ERROR_CHECK( ret );
 
+    pool_init(&command_pool, command_blocks, command_links, sizeof(command_blocks[0]), COMMAND_POOL_SIZE);
+    pool_init(&message_pool, message_blocks, message_links, sizeof(message_blocks[0]), MESSAGE_POOL_SIZE);
+    if (!topic_router_init(&command_router, command_routes, sizeof(command_routes) / sizeof(command_routes[0]),
+                           command_nodes, COMMAND_NODES, command_edges, 2 * COMMAND_NODES)) {
+        ESP_LOGE(TAG_TRACKER, "%s invalid command topic filters", __func__);
+        return;
+    }
+#if CONFIG_TRACKER_TIME_SYNC
+    time_sync_init(&time_sync, &time_sync_params);
+#endif
+
     initialise_wifi();
 
+    adv_merge_init(&adv_merge, adv_merge_entries, CONFIG_TRACKER_SCAN_RSP_CACHE, CONFIG_TRACKER_SCAN_RSP_TIMEOUT_MS);
+    if (!adv_ring_init(&adv_ring, adv_ring_slots, CONFIG_TRACKER_RING_SIZE, ADV_RING_POLICY)) {
+        ESP_LOGE(TAG_TRACKER, "%s advert queue size must be a power of 2", __func__);
+        return;
+    }
+    adv_batch_init(&adv_batch, adv_batch_buf, sizeof(adv_batch_buf),
+                   ADV_BATCH_RECORDS, ADV_BATCH_AGE_MS, ADV_BATCH_JSON,
+                   adv_batch_send, adv_topic);
+#if CONFIG_TRACKER_RANGE
+    adv_batch_init(&range_batch, range_batch_buf, sizeof(range_batch_buf),
+                   ADV_BATCH_RECORDS, ADV_BATCH_AGE_MS, ADV_BATCH_JSON,
+                   adv_batch_send, range_topic);
+    if (!adv_range_init(&range, range_entries, CONFIG_TRACKER_RANGE_DEVICES, &range_params)) {
+        ESP_LOGE(TAG_TRACKER, "%s distance estimator size must be a power of 2", __func__);
+        return;
+    }
+#endif
+#if CONFIG_TRACKER_PRESENCE
+    adv_batch_init(&presence_batch, presence_batch_buf, sizeof(presence_batch_buf),
+                   ADV_BATCH_RECORDS, ADV_BATCH_AGE_MS, ADV_BATCH_JSON,
+                   adv_batch_send, presence_topic);
+    if (!adv_presence_init(&presence, presence_entries, CONFIG_TRACKER_PRESENCE_DEVICES,
+                           &presence_params, presence_report, NULL)) {
+        ESP_LOGE(TAG_TRACKER, "%s device registry size must be a power of 2, 32768 max", __func__);
+        return;
+    }
+#endif
+#if CONFIG_TRACKER_LOG
+    adv_batch_init(&replay_batch, replay_batch_buf, sizeof(replay_batch_buf),
+                   ADV_BATCH_RECORDS, ADV_BATCH_AGE_MS, ADV_BATCH_JSON,
+                   replay_send, NULL);
+    log_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, LOG_SUBTYPE, LOG_PARTITION);
+    if (log_partition) {
+        adv_log_flash_t flash = {
+            .read  = log_flash_read,
+            .write = log_flash_write,
+            .erase = log_flash_erase,
+            .ctx   = NULL,
+            .size  = log_partition->size,
+        };
+        adv_log_ready = adv_log_mount(&adv_log, &flash);
+    }
+    if (adv_log_ready) {
+        ESP_LOGI(TAG_TRACKER, "Advert log, %u pending, next sequence %u, max erase count %u",
+                 adv_log_pending(&adv_log), adv_log.next_seq, adv_log.stats.max_erase_count);
+    } else {
+        ESP_LOGE(TAG_TRACKER, "%s no usable %s partition, adverts are lost while offline", __func__, LOG_PARTITION);
+    }
+#endif
+#if CONFIG_TRACKER_CAPTURE_MQTT
+    adv_batch_init(&capture_batch, capture_batch_buf, sizeof(capture_batch_buf),
+                   CAPTURE_RECORDS, CAPTURE_AGE_MS, false,
+                   adv_batch_send, capture_topic);
+#elif CONFIG_TRACKER_CAPTURE_FLASH
+    adv_batch_init(&capture_batch, capture_batch_buf, sizeof(capture_batch_buf),
+                   CAPTURE_RECORDS, CAPTURE_AGE_MS, false,
+                   capture_store_send, NULL);
+    capture_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, CAPTURE_SUBTYPE, CAPTURE_PARTITION);
+    if (capture_partition) {
+        adv_capture_flash_t flash = {
+            .read  = capture_flash_read,
+            .write = capture_flash_write,
+            .erase = capture_flash_erase,
+            .ctx   = NULL,
+            .size  = capture_partition->size,
+        };
+        capture_ready = adv_capture_store_mount(&capture_store, &flash);
+    }
+    if (capture_ready) {
+        ESP_LOGI(TAG_TRACKER, "Capture resumes at %u of %u bytes%s", capture_store.offset,
+                 capture_store.flash.size, capture_store.full ? ", full" : "");
+    } else {
+        ESP_LOGE(TAG_TRACKER, "%s no usable %s partition, scan results are not captured", __func__, CAPTURE_PARTITION);
+    }
+#endif
+#if CONFIG_TRACKER_AGGREGATE
+    for (int i = 0; i < 2; i++) {
+        if (!adv_table_init(&adv_tables[i], adv_entries[i], adv_order[i], CONFIG_TRACKER_TABLE_SIZE)) {
+            ESP_LOGE(TAG_TRACKER, "%s device table size must be a power of 2", __func__);
+            return;
+        }
+    }
+#endif
+    xTaskCreatePinnedToCore(
+            &adv_publisher_task,                  /* Function to call            */
+            "adv_publisher",                      /* Name - 16 char max          */
+            PUBLISHER_STACK,                      /* Allocated stack in bytes    */
+            NULL,                                 /* Parameters                  */
+            TRACKER_PRIORITY,                     /* Priority (Low: 0, High: TBC)*/
+            &publisher_task,                      /* Task handle                 */
+            CONFIG_TRACKER_PUBLISHER_CORE         /* Assigned core               */
+        );
+
+#if CONFIG_TRACKER_GATTC
+    adv_batch_init(&gattc_batch, gattc_batch_buf, sizeof(gattc_batch_buf),
+                   ADV_BATCH_RECORDS, ADV_BATCH_AGE_MS, ADV_BATCH_JSON,
+                   adv_batch_send, gatt_topic);
+    if (!gattc_sched_init(&gattc_sched, gattc_tags, CONFIG_TRACKER_GATTC_TAGS, &gattc_params,
+                          xTaskGetTickCount() * portTICK_PERIOD_MS)) {
+        ESP_LOGE(TAG_TRACKER, "%s GATT client links must be 1 to %d", __func__, GATTC_SCHED_LINKS_MAX);
+        return;
+    }
+#if CONFIG_TRACKER_GATTC_CACHE
+    gattc_layouts_load();
+#endif
+#if CONFIG_TRACKER_GATTC_STREAMS
+    if (!gattc_stream_init(&gattc_streams, gattc_stream_entries, CONFIG_TRACKER_GATTC_STREAMS,
+                           gattc_stream_buf, sizeof(gattc_stream_buf), &gattc_stream_params)) {
+        ESP_LOGE(TAG_TRACKER, "%s GATT stream batches must hold %d bytes", __func__,
+                 ADV_FRAME_STREAM_HEADER_LEN + ADV_FRAME_STREAM_RECORD_LEN + GATTC_STREAM_VALUE_MAX);
+        return;
+    }
+#endif
+    gattc_events = xQueueCreate(GATTC_EVENTS, sizeof(gattc_event_t));
+    gattc_seen_queue = xQueueCreate(GATTC_SEEN_QUEUE, sizeof(gattc_seen_t));
+    if (gattc_events == NULL || gattc_seen_queue == NULL) {
+        ESP_LOGE(TAG_TRACKER, "%s no memory for the GATT client queues", __func__);
+        return;
+    }
+    xTaskCreatePinnedToCore(
+            &gattc_client_task,                   /* Function to call            */
+            "gattc_client",                       /* Name - 16 char max          */
+            GATTC_STACK,                          /* Allocated stack in bytes    */
+            NULL,                                 /* Parameters                  */
+            TRACKER_PRIORITY,                     /* Priority (Low: 0, High: TBC)*/
+            &gattc_task,                          /* Task handle                 */
+            1                                     /* Assigned to app core        */
+        );
+#endif
+
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
     ret = esp_bt_controller_init(&bt_cfg);
     if (ret) {
@@ -0,0 +1,107 @@
+#include <string.h>
+#include "perf.h"
+
+
+uint32_t perf_counters[PERF_COUNTERS];
+static perf_hist_t perf_hists[PERF_HISTS];
+
+static const char *const counter_names[PERF_COUNTERS] = {
+    [PERF_SCAN_RESULTS]   = "scan_results",
+    [PERF_ADV_PUBLISHED]  = "adv_published",
+    [PERF_ADV_LOGGED]     = "adv_logged",
+    [PERF_MQTT_MESSAGES]  = "mqtt_messages",
+    [PERF_MQTT_BYTES]     = "mqtt_bytes",
+    [PERF_MQTT_LOST]      = "mqtt_lost",
+    [PERF_POOL_EXHAUSTED] = "pool_exhausted",
+};
+
+static const char *const hist_names[PERF_HISTS] = {
+    [PERF_HIST_GAP_CB]  = "gap_cb",
+    [PERF_HIST_PUBLISH] = "publish",
+    [PERF_HIST_LATENCY] = "latency",
+};
+
+
+void perf_record(perf_hist_id_t hist, uint32_t us) {
+    perf_hist_t *h = &perf_hists[hist];
+    __atomic_fetch_add(&h->buckets[perf_bucket(us)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    uint32_t max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+    while (us > max && !__atomic_compare_exchange_n(&h->max_us, &max, us, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void perf_snapshot(perf_snapshot_t *snap) {
+    memset(snap, 0, sizeof(*snap));
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        snap->counters[i] = __atomic_load_n(&perf_counters[i], __ATOMIC_RELAXED);
+    }
+    // Samples recorded meanwhile go to one period or the next, never lost
+    for (int i = 0; i < PERF_HISTS; i++) {
+        perf_hist_t *h = &perf_hists[i];
+        perf_hist_t *out = &snap->hists[i];
+        out->count = __atomic_exchange_n(&h->count, 0, __ATOMIC_RELAXED);
+        out->max_us = __atomic_exchange_n(&h->max_us, 0, __ATOMIC_RELAXED);
+        for (int b = 0; b < PERF_HIST_BUCKETS; b++) {
+            out->buckets[b] = __atomic_exchange_n(&h->buckets[b], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+bool perf_snapshot_stack(perf_snapshot_t *snap, const char *name, uint32_t free_bytes) {
+    if (snap->stack_count >= PERF_STACKS_MAX) {
+        return false;
+    }
+    perf_stack_t *stack = &snap->stacks[snap->stack_count];
+    strncpy(stack->name, name, PERF_NAME_LEN - 1);
+    stack->name[PERF_NAME_LEN - 1] = '\0';
+    stack->free_bytes = free_bytes;
+    snap->stack_count++;
+    return true;
+}
+
+uint32_t perf_percentile(const perf_hist_t *hist, uint32_t permille) {
+    uint32_t total = 0, seen = 0;
+    for (int b = 0; b < PERF_HIST_BUCKETS; b++) {
+        total += hist->buckets[b];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // Rank of the sample, rounded up
+    uint32_t rank = (uint32_t)(((uint64_t)total * permille + 999) / 1000);
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int b = 0; b < PERF_HIST_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= rank) {
+            uint32_t upper = b ? (uint32_t)((1ull << b) - 1) : 0;
+            return (b == PERF_HIST_BUCKETS - 1 || upper > hist->max_us) ? hist->max_us : upper;
+        }
+    }
+    return hist->max_us;
+}
+
+uint32_t perf_hist_span(const perf_hist_t *hist, uint32_t *first) {
+    int lo = -1, hi = -1;
+    for (int b = 0; b < PERF_HIST_BUCKETS; b++) {
+        if (hist->buckets[b]) {
+            if (lo < 0) {
+                lo = b;
+            }
+            hi = b;
+        }
+    }
+    *first = lo < 0 ? 0 : (uint32_t)lo;
+    return lo < 0 ? 0 : (uint32_t)(hi - lo + 1);
+}
+
+const char *perf_counter_name(perf_counter_t counter) {
+    return counter_names[counter];
+}
+
+const char *perf_hist_name(perf_hist_id_t hist) {
+    return hist_names[hist];
+}
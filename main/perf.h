@@ -0,0 +1,120 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Performance counters and latency histograms of the tracker pipeline.
+ * Recording is a few relaxed atomic adds, safe from any task. Counters run
+ * since boot, histograms are cleared by each snapshot so they cover one stats
+ * period. Gauges, queue, heap and stacks, are sampled by the caller.
+ */
+
+// Log2 buckets: 0 holds 0 us, bucket i holds [2^(i-1), 2^i) us, the last one is open ended
+#define PERF_HIST_BUCKETS   24
+#define PERF_STACKS_MAX     8
+#define PERF_NAME_LEN       16      // Task name, configMAX_TASK_NAME_LEN
+
+typedef enum {
+    PERF_SCAN_RESULTS = 0,      // Scan results received by the GAP callback
+    PERF_ADV_PUBLISHED,         // Adverts or window aggregates encoded for MQTT
+    PERF_ADV_LOGGED,            // Kept in the flash log while offline
+    PERF_MQTT_MESSAGES,         // Published, all topics
+    PERF_MQTT_BYTES,
+    PERF_MQTT_LOST,             // Not published, MQTT down
+    PERF_POOL_EXHAUSTED,        // Messages or lookups dropped, no free pool block
+    PERF_COUNTERS
+} perf_counter_t;
+
+typedef enum {
+    PERF_HIST_GAP_CB = 0,       // Scan result handling in the GAP callback
+    PERF_HIST_PUBLISH,          // mqtt_publish() call
+    PERF_HIST_LATENCY,          // Scan result to mqtt_publish() return, oldest advert of each message
+    PERF_HISTS
+} perf_hist_id_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint32_t buckets[PERF_HIST_BUCKETS];
+} perf_hist_t;
+
+/*
+ * Lowest free stack of a task since it started
+ */
+typedef struct {
+    char     name[PERF_NAME_LEN];
+    uint32_t free_bytes;
+} perf_stack_t;
+
+/*
+ * One stats report
+ */
+typedef struct {
+    uint32_t     uptime_s;
+    uint32_t     counters[PERF_COUNTERS];
+    perf_hist_t  hists[PERF_HISTS];
+    // Advert queue, see adv_ring_stats_t
+    uint32_t     queue_depth;
+    uint32_t     queue_high_water;
+    uint32_t     queue_pushed;
+    uint32_t     queue_popped;
+    uint32_t     queue_dropped;
+    uint32_t     queue_coalesced;
+    uint32_t     heap_free;
+    uint32_t     heap_min_free;
+    uint8_t      stack_count;
+    perf_stack_t stacks[PERF_STACKS_MAX];
+} perf_snapshot_t;
+
+extern uint32_t perf_counters[PERF_COUNTERS];
+
+static inline void perf_count(perf_counter_t counter, uint32_t n) {
+    __atomic_fetch_add(&perf_counters[counter], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Bucket of a sample
+ */
+static inline uint32_t perf_bucket(uint32_t us) {
+    uint32_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    return bucket < PERF_HIST_BUCKETS ? bucket : PERF_HIST_BUCKETS - 1;
+}
+
+/*
+ * Record one sample
+ */
+void perf_record(perf_hist_id_t hist, uint32_t us);
+
+/*
+ * Counters and histograms, the histograms start over
+ * Gauges are left to the caller.
+ */
+void perf_snapshot(perf_snapshot_t *snap);
+
+/*
+ * Add a stack gauge
+ * return: false if PERF_STACKS_MAX are already set
+ */
+bool perf_snapshot_stack(perf_snapshot_t *snap, const char *name, uint32_t free_bytes);
+
+/*
+ * Upper bound of the bucket holding a quantile, capped by the maximum
+ * permille: 500 for the median, 1 to 1000
+ */
+uint32_t perf_percentile(const perf_hist_t *hist, uint32_t permille);
+
+/*
+ * Non-empty part of a histogram, to publish it trimmed
+ * first: first non-empty bucket, 0 if none
+ * return: buckets from the first to the last non-empty one
+ */
+uint32_t perf_hist_span(const perf_hist_t *hist, uint32_t *first);
+
+const char *perf_counter_name(perf_counter_t counter);
+const char *perf_hist_name(perf_hist_id_t hist);
+
+#endif
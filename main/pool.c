@@ -0,0 +1,81 @@
+#include <string.h>
+#include "pool.h"
+
+
+// Constants
+#define POOL_INDEX_MASK     0xFFFF
+#define POOL_NONE           0xFFFF      // Index of the empty stack
+#define POOL_TAG_ONE        0x10000
+#define POOL_ALLOCATED      0xFFFFFFFF  // Link of a block in use
+
+
+bool pool_init(pool_t *pool, void *blocks, uint32_t *links, size_t block_size, uint32_t count) {
+    if (count == 0 || count > POOL_BLOCKS_MAX || block_size == 0) {
+        return false;
+    }
+    memset(pool, 0, sizeof(*pool));
+    pool->blocks = blocks;
+    pool->links = links;
+    pool->block_size = block_size;
+    pool->count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        links[i] = (i + 1 < count) ? i + 1 : POOL_NONE;
+    }
+    pool->head = 0;
+    return true;
+}
+
+void *pool_alloc(pool_t *pool) {
+    uint32_t head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    uint32_t index, next;
+
+    do {
+        index = head & POOL_INDEX_MASK;
+        if (index == POOL_NONE) {
+            __atomic_fetch_add(&pool->stats.exhausted, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        // Stale if another task takes the block first, the tag then fails the swap
+        next = ((head & ~POOL_INDEX_MASK) + POOL_TAG_ONE) |
+               (__atomic_load_n(&pool->links[index], __ATOMIC_RELAXED) & POOL_INDEX_MASK);
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    __atomic_store_n(&pool->links[index], POOL_ALLOCATED, __ATOMIC_RELAXED);
+
+    uint32_t in_use = __atomic_add_fetch(&pool->stats.in_use, 1, __ATOMIC_RELAXED);
+    uint32_t high = __atomic_load_n(&pool->stats.high_water, __ATOMIC_RELAXED);
+    while (in_use > high && !__atomic_compare_exchange_n(&pool->stats.high_water, &high, in_use, true,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return pool->blocks + (size_t)index * pool->block_size;
+}
+
+bool pool_free(pool_t *pool, void *block) {
+    uint32_t allocated = POOL_ALLOCATED;
+    uint32_t head, next;
+
+    if (block == NULL) {
+        return true;
+    }
+    size_t offset = (uint8_t *)block - pool->blocks;
+    uint32_t index = offset / pool->block_size;
+    if ((uint8_t *)block < pool->blocks || index >= pool->count || offset % pool->block_size ||
+        !__atomic_compare_exchange_n(&pool->links[index], &allocated, POOL_NONE, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&pool->stats.invalid_frees, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&pool->links[index], head & POOL_INDEX_MASK, __ATOMIC_RELAXED);
+        next = ((head & ~POOL_INDEX_MASK) + POOL_TAG_ONE) | index;
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_fetch_sub(&pool->stats.in_use, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void pool_get_stats(const pool_t *pool, pool_stats_t *stats) {
+    stats->in_use = __atomic_load_n(&pool->stats.in_use, __ATOMIC_RELAXED);
+    stats->high_water = __atomic_load_n(&pool->stats.high_water, __ATOMIC_RELAXED);
+    stats->exhausted = __atomic_load_n(&pool->stats.exhausted, __ATOMIC_RELAXED);
+    stats->invalid_frees = __atomic_load_n(&pool->stats.invalid_frees, __ATOMIC_RELAXED);
+}
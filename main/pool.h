@@ -0,0 +1,58 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Fixed size block pool, reserved at boot in place of malloc() on hot paths.
+ * Free blocks form a lock-free stack: alloc and free are one compare and
+ * swap of the head, O(1) and safe from any task on both cores. The head
+ * holds a block index and a 16 bit tag bumped on every change, so a block
+ * freed and reallocated meanwhile does not pass for the same head (ABA).
+ */
+
+#define POOL_BLOCKS_MAX     0xFFFE
+
+typedef struct {
+    uint32_t in_use;
+    uint32_t high_water;        // Most blocks in use at once
+    uint32_t exhausted;         // Allocations failed, no free block
+    uint32_t invalid_frees;     // Foreign pointer or double free, ignored
+} pool_stats_t;
+
+typedef struct {
+    uint8_t           *blocks;
+    uint32_t          *links;   // Per block: next free block, or allocated
+    size_t             block_size;
+    uint32_t           count;
+    volatile uint32_t  head;    // Tag << 16 | first free block
+    pool_stats_t       stats;
+} pool_t;
+
+/*
+ * blocks: count * block_size bytes, e.g. an array of the pooled type
+ * links: count entries
+ * return: false if count is 0 or above POOL_BLOCKS_MAX
+ */
+bool pool_init(pool_t *pool, void *blocks, uint32_t *links, size_t block_size, uint32_t count);
+
+/*
+ * return: a block, NULL if the pool is exhausted
+ */
+void *pool_alloc(pool_t *pool);
+
+/*
+ * Give a block back, NULL is ignored
+ * return: false if block is not an allocated block of this pool
+ */
+bool pool_free(pool_t *pool, void *block);
+
+/*
+ * Snapshot of the counters, each one read atomically
+ */
+void pool_get_stats(const pool_t *pool, pool_stats_t *stats);
+
+#endif
@@ -0,0 +1,102 @@
+#include <string.h>
+#include "scan_config.h"
+
+
+/*
+ * Unsigned decimal, whole token
+ */
+static bool scan_config_uint(const char *s, size_t len, uint32_t *value) {
+    uint32_t v = 0;
+    if (len == 0 || len > 9) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        v = v * 10 + (uint32_t)(s[i] - '0');
+    }
+    *value = v;
+    return true;
+}
+
+static bool scan_config_token(const char *key, size_t key_len, const char *val, size_t val_len,
+                              scan_config_t *cfg) {
+    uint32_t v = 0;
+#define KEY_IS(k) (key_len == sizeof(k) - 1 && memcmp(key, k, key_len) == 0)
+#define VAL_IS(k) (val_len == sizeof(k) - 1 && memcmp(val, k, val_len) == 0)
+    if (KEY_IS("mode")) {
+        if (VAL_IS("duty")) {
+            cfg->mode = SCAN_MODE_DUTY_CYCLE;
+        } else if (VAL_IS("continuous")) {
+            cfg->mode = SCAN_MODE_CONTINUOUS;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (!scan_config_uint(val, val_len, &v)) {
+        return false;
+    }
+    if (KEY_IS("interval")) {
+        cfg->interval = (uint16_t)(v > 0xFFFF ? 0xFFFF : v);
+    } else if (KEY_IS("window")) {
+        cfg->window = (uint16_t)(v > 0xFFFF ? 0xFFFF : v);
+    } else if (KEY_IS("period_ms")) {
+        cfg->period_ms = v;
+    } else if (KEY_IS("duration_s")) {
+        cfg->duration_s = v;
+    } else if (KEY_IS("window_ms")) {
+        cfg->window_ms = v;
+    } else if (KEY_IS("adaptive") && v <= 1) {
+        cfg->adaptive = v;
+    } else if (KEY_IS("active") && v <= 1) {
+        cfg->active = v;
+    } else {
+        return false;
+    }
+    return true;
+#undef KEY_IS
+#undef VAL_IS
+}
+
+bool scan_config_parse(const char *cmd, size_t len, scan_config_t *cfg) {
+    scan_config_t next = *cfg;
+    size_t i = 0;
+
+    while (i < len) {
+        // Tokens are separated by spaces, commas or new lines
+        while (i < len && (cmd[i] == ' ' || cmd[i] == ',' || cmd[i] == '\n' || cmd[i] == '\r')) {
+            i++;
+        }
+        if (i == len) {
+            break;
+        }
+        size_t start = i, eq = 0;
+        while (i < len && cmd[i] != ' ' && cmd[i] != ',' && cmd[i] != '\n' && cmd[i] != '\r') {
+            if (cmd[i] == '=' && eq == 0) {
+                eq = i;
+            }
+            i++;
+        }
+        if (eq == 0 || !scan_config_token(&cmd[start], eq - start, &cmd[eq + 1], i - eq - 1, &next)) {
+            return false;
+        }
+    }
+    if (!scan_config_valid(&next)) {
+        return false;
+    }
+    *cfg = next;
+    return true;
+}
+
+bool scan_config_valid(const scan_config_t *cfg) {
+    if (cfg->interval < SCAN_INTERVAL_MIN || cfg->interval > SCAN_INTERVAL_MAX ||
+        cfg->window < SCAN_INTERVAL_MIN || cfg->window > cfg->interval) {
+        return false;
+    }
+    if (cfg->mode == SCAN_MODE_DUTY_CYCLE) {
+        return cfg->duration_s > 0 && cfg->period_ms >= cfg->duration_s * 1000;
+    }
+    return cfg->window_ms >= 100;
+}
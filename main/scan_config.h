@@ -0,0 +1,43 @@
+#ifndef __SCAN_CONFIG_H__
+#define __SCAN_CONFIG_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// BLE scan interval / window limits, 0.625 ms units
+#define SCAN_INTERVAL_MIN 0x0004
+#define SCAN_INTERVAL_MAX 0x4000
+
+typedef enum {
+    SCAN_MODE_DUTY_CYCLE = 0,   // Scan duration_s every period_ms
+    SCAN_MODE_CONTINUOUS,       // Never stop, windows of window_ms are cut in software
+} scan_mode_t;
+
+typedef struct {
+    scan_mode_t mode;
+    uint16_t    interval;       // HCI scan interval, 0.625 ms units
+    uint16_t    window;         // HCI scan window, 0.625 ms units
+    uint32_t    period_ms;      // Duty cycle period
+    uint32_t    duration_s;     // Duty cycle scan duration
+    uint32_t    window_ms;      // Continuous mode reporting window
+    bool        adaptive;       // Duty steered by the advert density, see scan_control.h
+    bool        active;         // Scan requests, scan responses are merged, see adv_merge.h
+} scan_config_t;
+
+/*
+ * Apply a "key=value key=value" command over cfg, e.g. "mode=continuous window_ms=500"
+ * keys: mode (duty|continuous), interval, window, period_ms, duration_s, window_ms, adaptive (0|1),
+ *       active (0|1)
+ * Nothing is changed unless the whole command is valid.
+ * return: false on unknown key, bad value or inconsistent result
+ */
+bool scan_config_parse(const char *cmd, size_t len, scan_config_t *cfg);
+
+/*
+ * return: true if the settings are usable
+ */
+bool scan_config_valid(const scan_config_t *cfg);
+
+#endif
@@ -0,0 +1,191 @@
+#include <string.h>
+#include <math.h>
+#include "scan_control.h"
+
+
+// Constants
+#define SCAN_CONTROL_WORDS      (SCAN_CONTROL_SKETCH_BITS / 32)
+
+
+static uint32_t clamp(uint32_t v, uint32_t lo, uint32_t hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/*
+ * BD address hash, FNV-1a and a final mix so close addresses spread evenly
+ */
+static uint32_t scan_control_hash(const uint8_t bda[ADV_BDA_LEN]) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < ADV_BDA_LEN; i++) {
+        h ^= bda[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    return h ^ (h >> 16);
+}
+
+uint16_t scan_control_duty(const scan_config_t *cfg) {
+    uint32_t radio = (uint32_t)cfg->window * SCAN_CONTROL_PERMILLE / cfg->interval;
+    if (cfg->mode == SCAN_MODE_DUTY_CYCLE && cfg->period_ms) {
+        radio = (uint64_t)radio * cfg->duration_s * 1000 / cfg->period_ms;
+    }
+    return (uint16_t)clamp(radio, 1, SCAN_CONTROL_PERMILLE);
+}
+
+void scan_control_init(scan_control_t *ctl, const scan_control_params_t *params, const scan_config_t *cfg) {
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->params = *params;
+    if (ctl->params.duty_min == 0) {
+        ctl->params.duty_min = 1;
+    }
+    ctl->params.duty_max = clamp(ctl->params.duty_max, ctl->params.duty_min, SCAN_CONTROL_PERMILLE);
+    ctl->duty = clamp(scan_control_duty(cfg), ctl->params.duty_min, ctl->params.duty_max);
+    ctl->probe_wait = SCAN_CONTROL_PROBE_MIN;
+    ctl->radio = clamp((uint32_t)cfg->window * SCAN_CONTROL_PERMILLE / cfg->interval, 1, SCAN_CONTROL_PERMILLE);
+    ctl->interval = cfg->interval;
+}
+
+void scan_control_observe(scan_control_t *ctl, const uint8_t bda[ADV_BDA_LEN]) {
+    scan_control_sketch_t *sketch = &ctl->sketch[__atomic_load_n(&ctl->active, __ATOMIC_RELAXED)];
+    uint32_t bit = scan_control_hash(bda) % SCAN_CONTROL_SKETCH_BITS;
+
+    __atomic_fetch_or(&sketch->bits[bit / 32], 1u << (bit % 32), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sketch->results, 1, __ATOMIC_RELAXED);
+}
+
+uint32_t scan_control_estimate(const scan_control_sketch_t *sketch) {
+    uint32_t set = 0;
+    for (int i = 0; i < SCAN_CONTROL_WORDS; i++) {
+        set += __builtin_popcount(sketch->bits[i]);
+    }
+    if (set == SCAN_CONTROL_SKETCH_BITS) {
+        set--;
+    }
+    // n = -m ln(empty / m)
+    float m = SCAN_CONTROL_SKETCH_BITS;
+    return (uint32_t)(-m * logf((m - set) / m) + 0.5f);
+}
+
+void scan_control_window(scan_control_t *ctl, scan_control_obs_t *obs) {
+    uint32_t done = __atomic_load_n(&ctl->active, __ATOMIC_RELAXED);
+    scan_control_sketch_t *sketch = &ctl->sketch[done];
+
+    __atomic_store_n(&ctl->active, done ^ 1, __ATOMIC_RELAXED);
+    obs->scan_results = __atomic_exchange_n(&sketch->results, 0, __ATOMIC_RELAXED);
+    obs->devices = scan_control_estimate(sketch);
+    for (int i = 0; i < SCAN_CONTROL_WORDS; i++) {
+        __atomic_store_n(&sketch->bits[i], 0, __ATOMIC_RELAXED);
+    }
+    // Results of one device were counted, it was heard
+    if (obs->devices == 0 && obs->scan_results) {
+        obs->devices = 1;
+    }
+}
+
+/*
+ * Interval, window and period of cfg for the duty
+ */
+static void scan_control_apply(scan_control_t *ctl, scan_config_t *cfg) {
+    const scan_control_params_t *p = &ctl->params;
+    uint32_t duty = ctl->duty;
+    uint32_t radio = duty;
+
+    if (cfg->mode == SCAN_MODE_DUTY_CYCLE) {
+        // Period first, at the radio duty of the settings
+        uint32_t scan_ms = cfg->duration_s * 1000;
+        uint32_t cycle_min = clamp((uint64_t)scan_ms * SCAN_CONTROL_PERMILLE / p->period_max_ms, 1,
+                                   SCAN_CONTROL_PERMILLE);
+        uint32_t cycle = duty * SCAN_CONTROL_PERMILLE / ctl->radio;
+        if (cycle > SCAN_CONTROL_PERMILLE) {
+            cycle = SCAN_CONTROL_PERMILLE;
+        } else if (cycle < cycle_min) {
+            cycle = cycle_min;
+        }
+        radio = clamp(duty * SCAN_CONTROL_PERMILLE / cycle, 1, SCAN_CONTROL_PERMILLE);
+        cfg->period_ms = (uint64_t)scan_ms * SCAN_CONTROL_PERMILLE / cycle;
+    }
+
+    // Longer intervals rather than windows shorter than window_min
+    uint32_t interval = ctl->interval;
+    if (radio * interval < (uint32_t)p->window_min * SCAN_CONTROL_PERMILLE) {
+        interval = ((uint32_t)p->window_min * SCAN_CONTROL_PERMILLE + radio - 1) / radio;
+        interval = clamp(interval, ctl->interval, p->interval_max > ctl->interval ? p->interval_max : ctl->interval);
+    }
+    interval = clamp(interval, SCAN_INTERVAL_MIN, SCAN_INTERVAL_MAX);
+    cfg->interval = interval;
+    cfg->window = clamp((radio * interval + SCAN_CONTROL_PERMILLE / 2) / SCAN_CONTROL_PERMILLE,
+                        SCAN_INTERVAL_MIN, interval);
+}
+
+bool scan_control_update(scan_control_t *ctl, const scan_control_obs_t *obs, scan_config_t *cfg) {
+    const scan_control_params_t *p = &ctl->params;
+    uint32_t duty = ctl->duty;
+    uint32_t results = obs->scan_results;
+    uint64_t high = (uint64_t)obs->queue_size * p->queue_high;
+    uint64_t depth = (uint64_t)obs->queue_depth * 100;
+    uint16_t interval = cfg->interval, window = cfg->window;
+    uint32_t period_ms = cfg->period_ms;
+
+    // Adverts the publisher took off the queue during the window
+    int64_t drained = (int64_t)ctl->depth + results - obs->queue_depth - obs->dropped;
+    // Drops with the queue drained by the end of the window are bursts within the
+    // HCI window, a lower duty would lose those adverts at the radio instead
+    bool overflow = (obs->dropped && depth * 4 >= high) || (obs->queue_size && depth >= high);
+    bool building = obs->queue_depth > ctl->depth && depth * 4 >= high;
+    ctl->depth = obs->queue_depth;
+
+    if (overflow || building) {
+        // The publisher is the limit, stay below its rate, well below to drain a backlog
+        uint32_t budget = drained > 0 ? (uint32_t)drained : 1;
+        budget = overflow ? budget * 3 / 4 : budget * 15 / 16;
+        if (ctl->budget == 0 || budget < ctl->budget) {
+            ctl->budget = budget ? budget : 1;
+        }
+        if (ctl->probed) {
+            ctl->probe_wait = ctl->probe_wait < SCAN_CONTROL_PROBE_MAX ? ctl->probe_wait * 2 : ctl->probe_wait;
+            ctl->probed = false;
+        }
+        ctl->calm = 0;
+    } else if (obs->queue_depth == 0 && ctl->limited && ++ctl->calm >= ctl->probe_wait) {
+        // Budget bound, try a little more, the publisher may have sped up
+        ctl->budget += ctl->budget / 16 + 1;
+        ctl->calm = 0;
+        ctl->probed = true;
+    }
+
+    if (obs->devices == 0) {
+        // Nobody around
+        duty = duty * 3 / 4;
+    } else {
+        // Sightings are proportional to the duty, half way to the target
+        uint32_t target = p->sightings * obs->devices;
+        uint64_t want = (uint64_t)duty * target / (results ? results : 1);
+        want = clamp(want, duty / 2, duty * 2);
+        if (want * 4 < duty * 3 || want * 4 > duty * 5) {
+            duty = (duty + want) / 2;
+        }
+    }
+    if (ctl->budget && results) {
+        // Adverts are proportional to the duty too
+        uint64_t limit = (uint64_t)ctl->duty * ctl->budget / results;
+        if (overflow || building) {
+            duty = duty < limit ? duty : limit;
+        } else if (duty > ctl->duty && duty > limit) {
+            // Up to the limit only when there is room, not on noise
+            duty = limit * 16 >= (uint64_t)ctl->duty * 17 ? limit : ctl->duty;
+        }
+        ctl->limited = duty * 16 >= limit * 15;
+    } else {
+        ctl->limited = false;
+    }
+    // Backlog, no more adverts until it is gone
+    if (depth * 2 >= high && duty > ctl->duty) {
+        duty = ctl->duty;
+    }
+    ctl->duty = clamp(duty, p->duty_min, p->duty_max);
+    scan_control_apply(ctl, cfg);
+    return cfg->interval != interval || cfg->window != window || cfg->period_ms != period_ms;
+}
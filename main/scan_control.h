@@ -0,0 +1,114 @@
+#ifndef __SCAN_CONTROL_H__
+#define __SCAN_CONTROL_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include "adv_record.h"
+#include "scan_config.h"
+
+/*
+ * Adaptive scan duty cycle: once per window the share of time spent scanning
+ * is steered so every device is heard about `sightings` times per window,
+ * without handing the publisher more adverts than it drains. A quiet site
+ * thus decays to duty_min, a busy one settles where the publish path keeps up.
+ *
+ * Sightings are proportional to the duty, so each step covers half of the
+ * remaining error, within a dead band of +-25% nothing changes. When the
+ * queue drops adverts, passes `queue_high` or keeps growing, the adverts it
+ * drained in the window become the budget, less a margin. Adverts are
+ * proportional to the duty as well, the duty is cut to fit in one step.
+ * The budget is raised by 1/16 after a while with an empty queue, less and
+ * less often as such probes fill the queue again.
+ *
+ * The duty is applied to the HCI window first, the interval is stretched to
+ * keep windows of window_min. In duty cycle mode the period between scans
+ * changes first, within period_max_ms.
+ */
+
+#define SCAN_CONTROL_SKETCH_BITS    4096    // Unique devices estimated within a few % up to ~10000
+#define SCAN_CONTROL_PERMILLE       1000
+#define SCAN_CONTROL_PROBE_MIN      8       // Windows between probes above the budget,
+#define SCAN_CONTROL_PROBE_MAX      128     // doubled each time a probe fills the queue
+
+/*
+ * Bounds and targets
+ */
+typedef struct {
+    uint16_t duty_min;              // Permille of the time scanning
+    uint16_t duty_max;
+    uint16_t sightings;             // Target adverts per device per window
+    uint8_t  queue_high;            // Percent of the advert queue, backpressure above
+    uint16_t window_min;            // Shortest HCI window, 0.625 ms units
+    uint16_t interval_max;          // Longest HCI interval, 0.625 ms units
+    uint32_t period_max_ms;         // Longest duty cycle period
+} scan_control_params_t;
+
+/*
+ * What happened during one window
+ */
+typedef struct {
+    uint32_t scan_results;
+    uint32_t devices;               // Unique devices, estimated
+    uint32_t dropped;               // Adverts dropped by the queue
+    uint32_t queue_depth;           // Adverts queued at the end of the window
+    uint32_t queue_size;
+} scan_control_obs_t;
+
+/*
+ * Linear counting sketch of the devices heard in a window
+ */
+typedef struct {
+    uint32_t bits[SCAN_CONTROL_SKETCH_BITS / 32];
+    uint32_t results;
+} scan_control_sketch_t;
+
+typedef struct {
+    scan_control_params_t params;
+    scan_control_sketch_t sketch[2];
+    volatile uint32_t     active;   // Sketch being filled
+    uint16_t              duty;     // Permille
+    uint32_t              budget;   // Adverts per window the publisher keeps up with, 0 unknown
+    uint32_t              depth;    // Queue depth at the end of the last window
+    uint16_t              calm;     // Windows with an empty queue since the last probe
+    uint16_t              probe_wait; // Before trying a larger budget
+    bool                  probed;
+    bool                  limited;  // Duty held down by the budget
+    uint16_t              radio;    // Share of each scan with the radio on, duty cycle mode
+    uint16_t              interval; // HCI interval of the settings
+} scan_control_t;
+
+/*
+ * Start from the duty of cfg, clamped to the bounds
+ */
+void scan_control_init(scan_control_t *ctl, const scan_control_params_t *params, const scan_config_t *cfg);
+
+/*
+ * Account one scan result, from the Bluedroid task
+ */
+void scan_control_observe(scan_control_t *ctl, const uint8_t bda[ADV_BDA_LEN]);
+
+/*
+ * End the window: results and devices of obs are filled from the sketch,
+ * which restarts empty. A result observed during the swap may be counted in
+ * the next window.
+ */
+void scan_control_window(scan_control_t *ctl, scan_control_obs_t *obs);
+
+/*
+ * Next duty from the window, applied to the interval, window and period of cfg
+ * return: true if cfg changed
+ */
+bool scan_control_update(scan_control_t *ctl, const scan_control_obs_t *obs, scan_config_t *cfg);
+
+/*
+ * return: permille of the time cfg scans
+ */
+uint16_t scan_control_duty(const scan_config_t *cfg);
+
+/*
+ * Unique devices of a sketch
+ */
+uint32_t scan_control_estimate(const scan_control_sketch_t *sketch);
+
+#endif
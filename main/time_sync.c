@@ -0,0 +1,238 @@
+#include <string.h>
+#include <math.h>
+#include "time_sync.h"
+
+
+/*
+ * Counters are written by the calling task, read from other tasks
+ */
+static void time_sync_count(uint32_t *counter, uint32_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static void time_sync_set(uint32_t *field, uint32_t value) {
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+bool time_sync_init(time_sync_t *ts, const time_sync_params_t *params) {
+    if (params->samples < 2 || params->samples > TIME_SYNC_SAMPLES_MAX || params->best == 0 ||
+        params->best > params->samples || params->timeout_us == 0) {
+        return false;
+    }
+    memset(ts, 0, sizeof(*ts));
+    ts->params = *params;
+    return true;
+}
+
+int time_sync_request(time_sync_t *ts, const char *esp_name, int64_t now_us, char *out, size_t size) {
+    uint32_t interval_us = ts->count < ts->params.samples ? ts->params.burst_us : ts->params.period_us;
+    size_t name_len = strlen(esp_name);
+    char digits[20];
+    size_t n = 0;
+    uint64_t id = (uint64_t)now_us;
+
+    if (ts->pending && now_us - ts->sent_us < ts->params.timeout_us) {
+        return 0;
+    }
+    if (ts->stats.requests && now_us - ts->sent_us < interval_us) {
+        return 0;
+    }
+    // No printf, it takes over a KB of the publisher task stack
+    do {
+        digits[n++] = (char)('0' + id % 10);
+        id /= 10;
+    } while (id);
+    if (name_len + 1 + n >= size) {
+        return -1;
+    }
+    memcpy(out, esp_name, name_len);
+    out[name_len] = ' ';
+    for (size_t i = 0; i < n; i++) {
+        out[name_len + 1 + i] = digits[n - 1 - i];
+    }
+    out[name_len + 1 + n] = '\0';
+    ts->pending = true;
+    ts->sent_us = now_us;
+    time_sync_count(&ts->stats.requests, 1);
+    return (int)(name_len + 1 + n);
+}
+
+/*
+ * Unsigned decimal number after optional spaces
+ */
+static bool time_sync_number(const char **p, const char *end, uint64_t *value) {
+    const char *s = *p;
+    uint64_t v = 0;
+
+    while (s < end && *s == ' ') {
+        s++;
+    }
+    if (s == end || *s < '0' || *s > '9') {
+        return false;
+    }
+    while (s < end && *s >= '0' && *s <= '9') {
+        if (v > (UINT64_MAX - 9) / 10) {
+            return false;
+        }
+        v = v * 10 + (uint64_t)(*s++ - '0');
+    }
+    *p = s;
+    *value = v;
+    return true;
+}
+
+bool time_sync_parse(const char *data, size_t len, uint64_t *id, int64_t *t2, int64_t *t3) {
+    const char *p = data;
+    const char *end = data + len;
+    uint64_t v2, v3;
+
+    if (!time_sync_number(&p, end, id) || !time_sync_number(&p, end, &v2) || !time_sync_number(&p, end, &v3) ||
+        v2 > INT64_MAX || v3 > INT64_MAX) {
+        return false;
+    }
+    // Trailing white space only
+    while (p < end && (*p == ' ' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    if (p != end) {
+        return false;
+    }
+    *t2 = (int64_t)v2;
+    *t3 = (int64_t)v3;
+    return true;
+}
+
+/*
+ * Least squares line through the offsets of the best exchanges of the window,
+ * around the newest one
+ */
+static void time_sync_fit(time_sync_t *ts, const time_sync_sample_t *ref) {
+    uint8_t order[TIME_SYNC_SAMPLES_MAX];
+    uint32_t n = ts->count < ts->params.best ? ts->count : ts->params.best;
+    uint32_t rtt_max = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    double x_min = 0, x_max = 0;
+    double slope = ts->drift_ppb / 1e9;
+
+    // The n shortest round trips first
+    for (uint32_t i = 0; i < ts->count; i++) {
+        order[i] = (uint8_t)i;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t min = i;
+        for (uint32_t j = i + 1; j < ts->count; j++) {
+            if (ts->window[order[j]].rtt_us < ts->window[order[min]].rtt_us) {
+                min = j;
+            }
+        }
+        uint8_t tmp = order[i];
+        order[i] = order[min];
+        order[min] = tmp;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const time_sync_sample_t *s = &ts->window[order[i]];
+        double x = (double)(s->local_us - ref->local_us);
+        double y = (double)(s->offset_us - ref->offset_us);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        x_min = i == 0 || x < x_min ? x : x_min;
+        x_max = i == 0 || x > x_max ? x : x_max;
+        rtt_max = s->rtt_us > rtt_max ? s->rtt_us : rtt_max;
+    }
+    if (n >= 2 && x_max - x_min >= ts->params.drift_span_us) {
+        double d = n * sxx - sx * sx;
+        if (d > 0) {
+            double s = (n * sxy - sx * sy) / d;
+            if (fabs(s) * 1e9 <= ts->params.drift_max_ppb) {
+                slope = s;
+            }
+        }
+    }
+    ts->local_us = ref->local_us;
+    ts->fleet_us = ref->local_us + ref->offset_us + llround((sy - slope * sx) / n);
+    ts->drift_ppb = (int32_t)lround(slope * 1e9);
+    ts->error_us = rtt_max / 2;
+    time_sync_set(&ts->stats.rtt_min_us, ts->window[order[0]].rtt_us);
+    time_sync_set(&ts->stats.error_us, ts->error_us);
+    __atomic_store_n(&ts->stats.drift_ppb, ts->drift_ppb, __ATOMIC_RELAXED);
+}
+
+bool time_sync_response(time_sync_t *ts, uint64_t id, int64_t t2, int64_t t3, int64_t t4) {
+    time_sync_sample_t sample;
+    int64_t t1 = ts->sent_us;
+    int64_t rtt;
+
+    if (!ts->pending || id != (uint64_t)t1) {
+        time_sync_count(&ts->stats.stale, 1);
+        return false;
+    }
+    ts->pending = false;
+    time_sync_count(&ts->stats.responses, 1);
+    rtt = (t4 - t1) - (t3 - t2);
+    if (t3 < t2 || rtt < 0 || rtt > ts->params.timeout_us) {
+        time_sync_count(&ts->stats.rejected, 1);
+        return false;
+    }
+    sample.local_us = t1 + (t4 - t1) / 2;
+    sample.offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+    sample.rtt_us = (uint32_t)rtt;
+
+    if (ts->kept >= ts->params.best) {
+        // Off the line by more than jitter and drift allow
+        int64_t fleet_us;
+        time_sync_fleet(ts, sample.local_us, &fleet_us, NULL);
+        int64_t off = sample.offset_us - (fleet_us - sample.local_us);
+        int64_t elapsed = sample.local_us - ts->local_us;
+        int64_t tolerance = rtt / 2 + ts->error_us + TIME_SYNC_STEP_MIN_US +
+                            (elapsed < 0 ? -elapsed : elapsed) * ts->params.drift_max_ppb / 1000000000;
+        if (off > tolerance || off < -tolerance) {
+            if (++ts->off < TIME_SYNC_STEPS) {
+                time_sync_count(&ts->stats.rejected, 1);
+                return false;
+            }
+            // The fleet clock was stepped, start over with the drift known
+            ts->count = 0;
+            ts->next = 0;
+            ts->kept = 0;
+            time_sync_count(&ts->stats.steps, 1);
+        }
+    }
+    ts->off = 0;
+    if (ts->count < ts->params.samples) {
+        ts->window[ts->count++] = sample;
+    } else {
+        ts->window[ts->next] = sample;
+        ts->next = (ts->next + 1) % ts->params.samples;
+    }
+    if (ts->kept < ts->params.best) {
+        ts->kept++;
+    }
+    time_sync_fit(ts, &sample);
+    return true;
+}
+
+bool time_sync_fleet(const time_sync_t *ts, int64_t local_us, int64_t *fleet_us, uint32_t *error_us) {
+    int64_t elapsed = local_us - ts->local_us;
+
+    if (ts->kept < ts->params.best) {
+        return false;
+    }
+    *fleet_us = ts->fleet_us + elapsed + elapsed * ts->drift_ppb / 1000000000;
+    if (error_us) {
+        *error_us = ts->error_us;
+    }
+    return true;
+}
+
+void time_sync_get_stats(const time_sync_t *ts, time_sync_stats_t *stats) {
+    stats->requests = __atomic_load_n(&ts->stats.requests, __ATOMIC_RELAXED);
+    stats->responses = __atomic_load_n(&ts->stats.responses, __ATOMIC_RELAXED);
+    stats->stale = __atomic_load_n(&ts->stats.stale, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&ts->stats.rejected, __ATOMIC_RELAXED);
+    stats->steps = __atomic_load_n(&ts->stats.steps, __ATOMIC_RELAXED);
+    stats->rtt_min_us = __atomic_load_n(&ts->stats.rtt_min_us, __ATOMIC_RELAXED);
+    stats->error_us = __atomic_load_n(&ts->stats.error_us, __ATOMIC_RELAXED);
+    stats->drift_ppb = __atomic_load_n(&ts->stats.drift_ppb, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,121 @@
+#ifndef __TIME_SYNC_H__
+#define __TIME_SYNC_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Fleet time: the local monotonic clock, esp_timer_get_time(), mapped to the
+ * clock of a time server shared by the trackers, microseconds since the Unix
+ * epoch, from request/response exchanges over MQTT:
+ *  request  "<ESP Name> <id>"
+ *  response "<id> <t2> <t3>", t2 request received and t3 response sent, fleet
+ * The id is t1, the local time the request was sent, and t4 is the local time
+ * the response was received. As in NTP, the offset of an exchange, fleet -
+ * local at (t1 + t4) / 2, is within half its round trip
+ * (t4 - t1) - (t3 - t2) of the true one.
+ *
+ * Network jitter only lengthens round trips: the `best` exchanges with the
+ * shortest round trips among the last `samples` are fitted with a least
+ * squares line, offset and drift of the local clock. The drift is estimated
+ * once the fitted exchanges span drift_span_us, it is kept otherwise.
+ *
+ * An exchange off the line by more than its half round trip plus the error of
+ * the line is not jitter. After TIME_SYNC_STEPS of them in a row, the fleet
+ * clock was stepped and the window restarts.
+ *
+ * One task calls, counters are read from any. Nothing is allocated.
+ */
+
+#define TIME_SYNC_SAMPLES_MAX   32
+#define TIME_SYNC_STEPS         3
+#define TIME_SYNC_STEP_MIN_US   1000        // Closer exchanges are jitter
+#define TIME_SYNC_REQUEST_MAX   48          // Request payload, ESP Name included
+
+typedef struct {
+    uint32_t period_us;             // Between requests, window full
+    uint32_t burst_us;              // Between requests, window filling
+    uint32_t timeout_us;            // Longer round trips are dropped
+    uint32_t drift_span_us;
+    int32_t  drift_max_ppb;         // Larger estimates are ignored
+    uint8_t  samples;               // Window, up to TIME_SYNC_SAMPLES_MAX
+    uint8_t  best;                  // Fitted, synced once as many were kept
+} time_sync_params_t;
+
+typedef struct {
+    int64_t  local_us;              // (t1 + t4) / 2
+    int64_t  offset_us;             // Fleet - local
+    uint32_t rtt_us;
+} time_sync_sample_t;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t responses;             // Of the pending request
+    uint32_t stale;                 // Not for the pending request
+    uint32_t rejected;              // Round trip negative or too long, or off the line
+    uint32_t steps;
+    uint32_t rtt_min_us;            // Of the window
+    uint32_t error_us;
+    int32_t  drift_ppb;
+} time_sync_stats_t;
+
+typedef struct {
+    time_sync_params_t params;
+    time_sync_sample_t window[TIME_SYNC_SAMPLES_MAX];
+    uint8_t  count;
+    uint8_t  next;                  // Oldest sample, once full
+    uint8_t  kept;                  // Since the window restarted, up to best
+    uint8_t  off;                   // Exchanges off the line in a row
+    bool     pending;
+    int64_t  sent_us;               // t1 of the pending request, or of the last one
+    // Mapping: fleet = fleet_us + (local - local_us) * (1 + drift_ppb / 1e9)
+    int64_t  local_us;
+    int64_t  fleet_us;
+    int32_t  drift_ppb;
+    uint32_t error_us;              // Half the longest round trip fitted
+    time_sync_stats_t stats;
+} time_sync_t;
+
+/*
+ * return: false on a window out of 2..TIME_SYNC_SAMPLES_MAX, best out of
+ * 1..samples or a zero timeout
+ */
+bool time_sync_init(time_sync_t *ts, const time_sync_params_t *params);
+
+/*
+ * Start an exchange if one is due: none pending, or the pending one past its
+ * timeout, and the period elapsed since the previous one
+ * now_us: local time, the request is sent right after
+ * out: the request payload, "<ESP Name> <id>", '\0' terminated
+ * return: payload length, 0 if no request is due, -1 if out is too small
+ */
+int time_sync_request(time_sync_t *ts, const char *esp_name, int64_t now_us, char *out, size_t size);
+
+/*
+ * Parse a response, data does not need to be '\0' terminated
+ * return: false if malformed
+ */
+bool time_sync_parse(const char *data, size_t len, uint64_t *id, int64_t *t2, int64_t *t3);
+
+/*
+ * Account a response of the server
+ * t4: local time it was received
+ * return: true if the exchange was kept and the mapping updated
+ */
+bool time_sync_response(time_sync_t *ts, uint64_t id, int64_t t2, int64_t t3, int64_t t4);
+
+/*
+ * Fleet time of a local time
+ * error_us: half the longest round trip fitted, may be NULL
+ * return: false until synced
+ */
+bool time_sync_fleet(const time_sync_t *ts, int64_t local_us, int64_t *fleet_us, uint32_t *error_us);
+
+/*
+ * Snapshot of the counters, from any task
+ */
+void time_sync_get_stats(const time_sync_t *ts, time_sync_stats_t *stats);
+
+#endif
@@ -0,0 +1,226 @@
+#include <string.h>
+#include "topic_router.h"
+
+
+// Constants
+#define FNV_OFFSET      2166136261u
+#define FNV_PRIME       16777619u
+
+/*
+ * State of one dispatch
+ */
+typedef struct {
+    const topic_router_t *router;
+    const char           *topic;
+    size_t                topic_len;
+    const char           *data;
+    size_t                len;
+    int                   called;
+} topic_match_t;
+
+
+/*
+ * Edge slot of a segment below parent, FNV-1a
+ */
+static uint32_t topic_edge_hash(uint16_t parent, const char *seg, size_t len) {
+    uint32_t h = FNV_OFFSET ^ parent;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)seg[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*
+ * Child of parent for an exact segment
+ * slot: set to the slot of the child, or the free slot to add it
+ */
+static uint16_t topic_edge_find(const topic_router_t *router, uint16_t parent, const char *seg, size_t len,
+                                uint32_t *slot) {
+    uint32_t i = topic_edge_hash(parent, seg, len) & router->edge_mask;
+    while (1) {
+        uint16_t n = router->edges[i];
+        if (n == TOPIC_NONE) {
+            break;
+        }
+        const topic_node_t *node = &router->nodes[n];
+        if (node->parent == parent && node->seg_len == len && memcmp(node->seg, seg, len) == 0) {
+            break;
+        }
+        i = (i + 1) & router->edge_mask;
+    }
+    if (slot) {
+        *slot = i;
+    }
+    return router->edges[i];
+}
+
+static uint16_t topic_node_new(topic_router_t *router, uint16_t parent, const char *seg, size_t len) {
+    if (router->node_count >= router->node_max) {
+        return TOPIC_NONE;
+    }
+    uint16_t n = router->node_count++;
+    topic_node_t *node = &router->nodes[n];
+    node->seg = seg;
+    node->seg_len = (uint16_t)len;
+    node->parent = parent;
+    node->plus = TOPIC_NONE;
+    node->hash = TOPIC_NONE;
+    node->route = TOPIC_NONE;
+    return n;
+}
+
+/*
+ * Child of a wildcard level, created on first use
+ */
+static uint16_t topic_wildcard_child(topic_router_t *router, uint16_t parent, uint16_t *child, const char *seg) {
+    if (*child == TOPIC_NONE) {
+        *child = topic_node_new(router, parent, seg, 1);
+    }
+    return *child;
+}
+
+static bool topic_router_add(topic_router_t *router, uint16_t route) {
+    const char *filter = router->routes[route].filter;
+    const char *end = filter + strlen(filter);
+    const char *p = filter;
+    uint16_t n = 0;
+
+    while (1) {
+        const char *slash = memchr(p, '/', end - p);
+        size_t len = (slash ? slash : end) - p;
+        uint16_t child;
+
+        if (len == 1 && *p == '+') {
+            child = topic_wildcard_child(router, n, &router->nodes[n].plus, p);
+        } else if (len == 1 && *p == '#') {
+            child = topic_wildcard_child(router, n, &router->nodes[n].hash, p);
+        } else {
+            uint32_t slot;
+            child = topic_edge_find(router, n, p, len, &slot);
+            if (child == TOPIC_NONE) {
+                child = topic_node_new(router, n, p, len);
+                router->edges[slot] = child;
+            }
+        }
+        if (child == TOPIC_NONE) {
+            return false;
+        }
+        n = child;
+        if (slash == NULL) {
+            break;
+        }
+        p = slash + 1;
+    }
+    if (router->nodes[n].route != TOPIC_NONE) {
+        return false;
+    }
+    router->nodes[n].route = route;
+    return true;
+}
+
+bool topic_filter_valid(const char *filter) {
+    size_t len = strlen(filter);
+    int levels = 1;
+
+    if (len == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = filter[i];
+        if (c == '/') {
+            if (++levels > TOPIC_LEVELS_MAX) {
+                return false;
+            }
+        } else if (c == '+' || c == '#') {
+            bool whole = (i == 0 || filter[i - 1] == '/') && (i + 1 == len || filter[i + 1] == '/');
+            if (!whole || (c == '#' && i + 1 != len)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool topic_router_init(topic_router_t *router, const topic_route_t *routes, size_t route_count,
+                       topic_node_t *nodes, size_t node_max, uint16_t *edges, size_t edge_count) {
+    memset(router, 0, sizeof(*router));
+    if (node_max == 0 || node_max >= TOPIC_NONE || route_count >= TOPIC_NONE ||
+        edge_count < 2 * node_max || (edge_count & (edge_count - 1)) != 0) {
+        return false;
+    }
+    router->routes = routes;
+    router->route_count = (uint16_t)route_count;
+    router->nodes = nodes;
+    router->node_max = (uint16_t)node_max;
+    router->edges = edges;
+    router->edge_mask = edge_count - 1;
+    for (size_t i = 0; i < edge_count; i++) {
+        edges[i] = TOPIC_NONE;
+    }
+    topic_node_new(router, TOPIC_NONE, "", 0);
+
+    for (uint16_t i = 0; i < route_count; i++) {
+        if (!topic_filter_valid(routes[i].filter) || !topic_router_add(router, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void topic_call(topic_match_t *m, uint16_t route) {
+    if (route != TOPIC_NONE) {
+        const topic_route_t *r = &m->router->routes[route];
+        r->handler(m->topic, m->topic_len, m->data, m->len, r->ctx);
+        m->called++;
+    }
+}
+
+/*
+ * Match the levels from p below node n
+ * p: next level, NULL once the whole topic is matched
+ */
+static void topic_match(topic_match_t *m, uint16_t n, const char *p, int depth) {
+    const topic_router_t *router = m->router;
+    const topic_node_t *node = &router->nodes[n];
+    // Wildcards do not match the first level of $SYS like topics
+    bool wildcards = n != 0 || m->topic[0] != '$';
+
+    if (wildcards && node->hash != TOPIC_NONE) {
+        topic_call(m, router->nodes[node->hash].route);
+    }
+    if (p == NULL) {
+        topic_call(m, node->route);
+        return;
+    }
+    if (depth >= TOPIC_LEVELS_MAX) {
+        return;
+    }
+    const char *end = m->topic + m->topic_len;
+    const char *slash = memchr(p, '/', end - p);
+    const char *next = slash ? slash + 1 : NULL;
+    uint16_t child = topic_edge_find(router, n, p, (slash ? slash : end) - p, NULL);
+    if (child != TOPIC_NONE) {
+        topic_match(m, child, next, depth + 1);
+    }
+    if (wildcards && node->plus != TOPIC_NONE) {
+        topic_match(m, node->plus, next, depth + 1);
+    }
+}
+
+int topic_router_dispatch(const topic_router_t *router, const char *topic, size_t topic_len,
+                          const char *data, size_t len) {
+    topic_match_t m = {
+        .router = router,
+        .topic = topic,
+        .topic_len = topic_len,
+        .data = data,
+        .len = len,
+        .called = 0,
+    };
+    if (topic_len == 0 || router->node_count == 0) {
+        return 0;
+    }
+    topic_match(&m, 0, topic, 0);
+    return m.called;
+}
@@ -0,0 +1,77 @@
+#ifndef __TOPIC_ROUTER_H__
+#define __TOPIC_ROUTER_H__
+
+// Includes
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * MQTT topic router: a constant table of topic filters and handlers, indexed
+ * at boot into a trie held in caller provided arrays. Filters follow MQTT:
+ * '+' matches one level, a trailing '#' the parent level and any below, e.g.
+ * "/tracker/scan/#" matches "/tracker/scan" and "/tracker/scan/ESP_12".
+ * Topics are matched in place, without copy or allocation: a lookup per
+ * level in a hash table of the trie edges, plus the wildcard branches.
+ */
+
+#define TOPIC_LEVELS_MAX    16          // Deeper topics are not routed
+#define TOPIC_NONE          0xFFFF
+
+/*
+ * topic: not NUL terminated
+ * data: payload, data[len] is '\0'
+ */
+typedef void (*topic_handler_t)(const char *topic, size_t topic_len, const char *data, size_t len, void *ctx);
+
+typedef struct {
+    const char      *filter;
+    topic_handler_t  handler;
+    void            *ctx;
+} topic_route_t;
+
+/*
+ * One level of a filter, its segment points into the filter string
+ */
+typedef struct {
+    const char *seg;
+    uint16_t    seg_len;
+    uint16_t    parent;
+    uint16_t    plus;                   // '+' child
+    uint16_t    hash;                   // '#' child
+    uint16_t    route;                  // Route ending at this level
+} topic_node_t;
+
+typedef struct {
+    const topic_route_t *routes;
+    uint16_t             route_count;
+    topic_node_t        *nodes;         // Root first
+    uint16_t             node_count;
+    uint16_t             node_max;
+    uint16_t            *edges;         // Open addressing: node of each exact segment edge
+    uint32_t             edge_mask;
+} topic_router_t;
+
+/*
+ * Index a route table
+ * nodes: one per distinct filter level, plus the root
+ * edges: power of 2, at least twice the nodes
+ * return: false on an invalid or duplicate filter, or when out of nodes
+ */
+bool topic_router_init(topic_router_t *router, const topic_route_t *routes, size_t route_count,
+                       topic_node_t *nodes, size_t node_max, uint16_t *edges, size_t edge_count);
+
+/*
+ * Call the handler of every route matching topic, a topic starting with '$'
+ * is not matched by a leading wildcard
+ * return: number of handlers called
+ */
+int topic_router_dispatch(const topic_router_t *router, const char *topic, size_t topic_len,
+                          const char *data, size_t len);
+
+/*
+ * Check a filter: '+' and '#' fill a whole level, '#' is last
+ */
+bool topic_filter_valid(const char *filter);
+
+#endif
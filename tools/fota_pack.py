@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+"""
+Make a compressed or delta firmware update for /fota/firmware, see main/fota_image.h
+
+  fota_pack.py build/BLE_Tracker.bin -o update.bin
+      compressed image
+  fota_pack.py build/BLE_Tracker.bin --base old/BLE_Tracker.bin -o update.bin
+      delta against the image the devices run, compressed
+
+Serve the output over HTTP and publish "<url> <sha256>" with the printed digest,
+which is the one of the plain image.
+"""
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = b"FPAT"
+VERSION = 1
+DEFLATE = 0x01
+DELTA = 0x02
+OP_DIFF = 0
+OP_INSERT = 1
+
+SEED = 8        # Exact match length starting a DIFF
+STEP = 4        # Base positions indexed, any match of SEED + STEP - 1 bytes is found
+BLOCK = 32      # Exact compare stride while extending
+GIVE_UP = 32    # Mismatches over matches ending a DIFF
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return value * 2 if value >= 0 else -value * 2 - 1
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def extend(base, src, image, dst):
+    """Length of the approximate match, maximising matches * 2 - length like bsdiff"""
+    limit = min(len(base) - src, len(image) - dst)
+    length = score = best = best_score = 0
+    while length < limit:
+        if length + BLOCK <= limit and image[dst + length:dst + length + BLOCK] == base[src + length:src + length + BLOCK]:
+            length += BLOCK
+            score += BLOCK
+        else:
+            score += 1 if image[dst + length] == base[src + length] else -1
+            length += 1
+        if score > best_score:
+            best, best_score = length, score
+        elif best_score - score > GIVE_UP:
+            break
+    return best
+
+
+def delta_ops(base, image):
+    """List of (OP_DIFF, src, bytes) and (OP_INSERT, None, bytes)"""
+    table = {}
+    for pos in range(0, len(base) - SEED + 1, STEP):
+        table.setdefault(base[pos:pos + SEED], pos)
+
+    ops = []
+    start = dst = 0
+    while dst <= len(image) - SEED:
+        src = table.get(image[dst:dst + SEED])
+        if src is None:
+            dst += 1
+            continue
+        while dst > start and src > 0 and image[dst - 1] == base[src - 1]:
+            dst -= 1
+            src -= 1
+        length = extend(base, src, image, dst)
+        if dst > start:
+            ops.append((OP_INSERT, None, image[start:dst]))
+        diff = bytes((image[dst + k] - base[src + k]) & 0xFF for k in range(length))
+        ops.append((OP_DIFF, src, diff))
+        dst += length
+        start = dst
+    if start < len(image):
+        ops.append((OP_INSERT, None, image[start:]))
+    return ops
+
+
+def encode_ops(ops):
+    out = bytearray()
+    last_src = 0
+    for op, src, data in ops:
+        out.append(op)
+        out += varint(len(data))
+        if op == OP_DIFF:
+            out += varint(zigzag(src - last_src))
+            last_src = src + len(data)
+        out += data
+    return bytes(out)
+
+
+def apply_ops(base, payload):
+    """Reference decoder, mirrors fota_image_ops()"""
+    out = bytearray()
+    pos = src = 0
+    while pos < len(payload):
+        op = payload[pos]
+        length, pos = read_varint(payload, pos + 1)
+        if op == OP_DIFF:
+            value, pos = read_varint(payload, pos)
+            src += (value >> 1) ^ -(value & 1)
+            out += bytes((base[src + k] + payload[pos + k]) & 0xFF for k in range(length))
+            src += length
+        elif op == OP_INSERT:
+            out += payload[pos:pos + length]
+        else:
+            raise ValueError("bad operation %d" % op)
+        pos += length
+    return bytes(out)
+
+
+def pack(image, base=None, compress=True, level=9):
+    flags = 0
+    payload = image
+    base_len = 0
+    base_sha = bytes(32)
+    if base is not None:
+        flags |= DELTA
+        payload = encode_ops(delta_ops(base, image))
+        base_len = len(base)
+        base_sha = hashlib.sha256(base).digest()
+    if compress:
+        flags |= DEFLATE
+        deflate = zlib.compressobj(level, zlib.DEFLATED, -15)
+        payload = deflate.compress(payload) + deflate.flush()
+    header = MAGIC + struct.pack("<BBHII", VERSION, flags, 0, len(image), base_len) + base_sha
+    return header + payload
+
+
+def unpack(update, base=None):
+    if update[:4] != MAGIC:
+        return update
+    version, flags, _, image_len, base_len = struct.unpack_from("<BBHII", update, 4)
+    payload = update[48:]
+    if flags & DEFLATE:
+        payload = zlib.decompress(payload, -15)
+    if flags & DELTA:
+        if base is None or hashlib.sha256(base[:base_len]).digest() != update[16:48]:
+            raise ValueError("delta made against another base")
+        payload = apply_ops(base[:base_len], payload)
+    if len(payload) != image_len:
+        raise ValueError("bad image length")
+    return payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="new application image, build/<project>.bin")
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--base", help="image running on the devices, makes a delta")
+    parser.add_argument("--no-compress", action="store_true", help="skip deflate")
+    parser.add_argument("--level", type=int, default=9, help="deflate level, 9 by default")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    base = None
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+
+    started = time.time()
+    update = pack(image, base, not args.no_compress, args.level)
+    elapsed = time.time() - started
+    if unpack(update, base) != image:
+        sys.exit("round trip failed")
+    with open(args.output, "wb") as f:
+        f.write(update)
+
+    print("%s: %d bytes, %.1f%% of the %d bytes image, packed in %.1f s"
+          % (args.output, len(update), 100.0 * len(update) / len(image), len(image), elapsed))
+    print("sha256 %s" % hashlib.sha256(image).hexdigest())
+
+
+if __name__ == "__main__":
+    main()